@@ -6,21 +6,45 @@ open F, 'sparTemplate.h';
 @ls = <F>;
 close F;
 
-# Print template headers
+# Print template headers, those inside top-level conditional blocks go with their block
 open G, '>'.'../spar.h';
+$d = 0;
 foreach $l (@ls)
 {
-	if( $l =~ /^\s*\#include/ )
+	if( $l =~ /^\#if/ )
+	{
+		$d++;
+	}
+	if( $l =~ /^\#endif/ )
+	{
+		$d--;
+	}
+	if( $d == 0 && $l =~ /^\s*\#include/ )
 	{
 		print G $l;
 	}
 }
 
+# Print template conditional blocks, shared by all data types
+$x = join('',@ls);
+while( $x =~ /((\/\/[^\r\n]*\r?\n)?^\#if[\s\S]*?^\#endif[^\r\n]*\r?\n)/mg )
+{
+	print G "\n".$1;
+}
+
 print G "\n";
 print G '// Do not edit!'."\n";
 print G '// Automatically-generated file from sparTemplate.h'."\n";
 
 $x = join('',@ls);
+$x =~ s/(\/\/[^\r\n]*\r?\n)?^\#if[\s\S]*?^\#endif[^\r\n]*\r?\n//mg;
+
+# Print template constants, shared by all data types
+while( $x =~ /((\/\/[^\r\n]*\r?\n)?(\#define\s+SPAR_[^\r\n]*\r?\n)+)/g )
+{
+	print G "\n".$1;
+}
+
 if( $x =~ /(\/*[^\r\n]*[\r\n]*typedef[^\{]+\{[^\}]+\}[^\r\n]*[\r\n]*)/ )
 {
 	$td = $1;
@@ -39,10 +63,21 @@ foreach my $l (@ls)
 	$ll = $l;
 }
 
-# Append structs and function headers
+# Append structs, all of them before function headers
 foreach my $t (@ts)
 {
-	$l = $td.join('', @gs);
+	$l = $td;
+	$l =~ s/sparType/$t/g;
+	$l =~ s/spar([\s\*\)])/'spar'.ucfirst($t).$1/eg;
+	$l =~ s/(\}\s*spar)(\;)/$1.ucfirst($t).$2/eg;
+	$l =~ s/\s+$/\n/;
+	print G "\n".$l;
+}
+
+# Append function headers
+foreach my $t (@ts)
+{
+	$l = join('', @gs);
 	$l =~ s/sparType/$t/g;
 	$l =~ s/spar([\s\*\)])/'spar'.ucfirst($t).$1/eg;
 	$l =~ s/(\}\s*spar)(\;)/$1.ucfirst($t).$2/eg;
@@ -54,7 +89,7 @@ foreach my $t (@ts)
 		}
 		$l =~ s/^$f(\s*\()/$nf.$1/eg;
 		$l =~ s/\"$f(\s+)/'"'.$nf.$1/eg;
-		$l =~ s/(\s+)$f(\s*\()/$1.$nf.$2/eg;
+		$l =~ s/(\s+)$f(\s*[\(,\)])/$1.$nf.$2/eg;
 	}
 	print G "\n".$l;
 }
@@ -69,6 +104,12 @@ foreach my $t (@ts)
 	# Remove structs
 	$x = join('',@ls);
 	$x =~ s/\/*[^\r\n]*[\r\n]*typedef[^\{]+\{[^\}]+\}[^\r\n]*[\r\n]*//g;
+
+	# Remove conditional blocks
+	$x =~ s/(\/\/[^\r\n]*\r?\n)?^\#if[\s\S]*?^\#endif[^\r\n]*\r?\n//mg;
+
+	# Remove constants
+	$x =~ s/(\/\/[^\r\n]*[\r\n]+)?(\#define\s+SPAR_[^\r\n]*[\r\n]+)+[\r\n]*//g;
 	@ls = split(/(?<=\n)/, $x);
 
 	foreach my $l (@ls)
@@ -92,7 +133,7 @@ foreach my $t (@ts)
 			}
 			$l =~ s/^$f(\s*\()/$nf.$1/eg;
 			$l =~ s/\"$f(\s+)/'"'.$nf.$1/eg;
-			$l =~ s/(\s+)$f(\s*\()/$1.$nf.$2/eg;
+			$l =~ s/(\s+)$f(\s*[\(,\)])/$1.$nf.$2/eg;
 		}
 		print G $l;
 	}
@@ -1,19 +1,50 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <stdint.h>
+
+// Block locks, C11 atomic_flag or std::atomic_flag when compiled as C++
+#ifdef __cplusplus
+#include <atomic>
+using std::atomic_flag;
+using std::atomic_flag_clear;
+using std::atomic_flag_clear_explicit;
+using std::atomic_flag_test_and_set_explicit;
+using std::memory_order_acquire;
+using std::memory_order_release;
+#else
+#include <stdatomic.h>
+#endif
 
 // Arbitrary data type
 #define sparType int
 
+// Element-wise operations
+#define SPAR_ADD  1 // a + b
+#define SPAR_SUB  2 // a - b
+#define SPAR_MUL  3 // a * b
+#define SPAR_MIN  4 // Minimum of a and b
+#define SPAR_MAX  5 // Maximum of a and b
+#define SPAR_MASK 6 // a where b is non-zero, default value elsewhere
+
+// Reductions, besides SPAR_ADD (sum), SPAR_MIN and SPAR_MAX
+#define SPAR_COUNT 7 // Number of elements different from the default value
+#define SPAR_MEAN  8 // Mean value
+#define SPAR_MODE  9 // Most frequent value, smallest on ties
+
 // Matrix struct
 typedef struct spar
 {
-	int nx, ny, nz;       // Matrix size (nx,ny,nz)
-	int bs, bs3;          // Block size (bs,bs,bs)
-	int mx, my, mz;       // Block matrix size (mx,my,mz)
-	sparType *blockValue; // Uniform block data
-	sparType **blockData; // Heterogeneous block data
-	sparType def;         // Default value
+	int nx, ny, nz;         // Matrix size (nx,ny,nz)
+	int bs, bs3;            // Block size (bs,bs,bs)
+	int mx, my, mz;         // Block matrix size (mx,my,mz)
+	sparType *blockValue;   // Uniform block data
+	sparType **blockData;   // Heterogeneous block data
+	sparType def;           // Default value
+	atomic_flag *blockLock; // Block locks for thread-safe access
+	int ox, oy, oz;         // Ring buffer origin (ox,oy,oz) in world coordinates
 } spar;
 
 // Matrix constructor
@@ -78,9 +109,24 @@ spar* sparInit( int nx, int ny, int nz, int bs, sparType def )
 	   exit(1);
 	}
 
+	// Allocate space for block locks, cleared below
+	matrix->blockLock = (atomic_flag*) malloc( blocks * sizeof(atomic_flag) );
+
+	if( matrix->blockLock == NULL )
+	{
+	   fprintf(stderr, "sparInit error: Out of memory\n");
+	   exit(1);
+	}
+
 	// Set default value
 	matrix->def = def;
 
+	// Set ring buffer origin. Duplicate and Map copy it, Op requires equal origins and copies it, Permute permutes it and in-place operations keep it.
+	// Crop, Downsample and InitDense leave it at zero, their storage does not follow the ring layout of a source window.
+	matrix->ox = 0;
+	matrix->oy = 0;
+	matrix->oz = 0;
+
 	// Set matrix elemets to default value
 	int i;
 	for( i = 0 ; i < blocks ; i++ )
@@ -89,10 +135,23 @@ spar* sparInit( int nx, int ny, int nz, int bs, sparType def )
 		matrix->blockValue[i] = def;
 	}
 
+	// Unlock all blocks
+	sparClearLocks( matrix );
+
 	// Return pointer
 	return matrix;
 }
 
+// Clear (unlock) every block lock, flags are not assumed clear after allocation
+void sparClearLocks( spar *matrix )
+{
+	int n;
+	for( n = 0 ; n < matrix->mx * matrix->my * matrix->mz ; n++ )
+	{
+		atomic_flag_clear( &matrix->blockLock[n] );
+	}
+}
+
 // Matrix destructor
 void sparFree( spar *matrix )
 {
@@ -116,6 +175,9 @@ void sparFree( spar *matrix )
 	// Free block heterogeneous data array
 	free(matrix->blockData);
 
+	// Free block locks
+	free(matrix->blockLock);
+
 	// Free matrix instance
 	free(matrix);
 }
@@ -158,6 +220,9 @@ double sparMemory( spar *matrix )
 	// Heterogeneous block data arrays
 	size = size + (double)( blocks * sizeof(sparType*) );
 
+	// Block locks
+	size = size + (double)( blocks * sizeof(atomic_flag) );
+
 	// Heterogeneous block data
 	int i;
 	for( i = 0 ; i < blocks ; i++ )
@@ -172,6 +237,23 @@ double sparMemory( spar *matrix )
 	return size;
 }
 
+// Element equality, NaN equal to NaN so NaN regions compress like any other uniform value
+int sparEqual( sparType a, sparType b )
+{
+	return a == b || ( isnan( (double) a ) && isnan( (double) b ) );
+}
+
+// Convert x to the data type, rounding to nearest for integer types instead of truncating
+sparType sparRound( double x )
+{
+	// Integer types turn 0.5 into 0
+	if( (sparType)( 0.5 ) == 0 )
+	{
+		return (sparType)( floor( x + 0.5 ) );
+	}
+	return (sparType)( x );
+}
+
 // Check if block is uniform
 int sparUniformBlock( spar *matrix, int x, int y, int z )
 {
@@ -214,7 +296,7 @@ int sparUniformBlock( spar *matrix, int x, int y, int z )
 		int i;
 		for( i = 0 ; i < bs3 ; i++ )
 		{
-			if( blockData[i] != value )
+			if( sparEqual( blockData[i], value ) == 0 )
 			{
 				isUniform = 0;
 				i = bs3;
@@ -239,7 +321,7 @@ int sparUniformBlock( spar *matrix, int x, int y, int z )
 				for( i = 0 ; i < bs ; i++ )
 				{
 					if( x * bs + i < matrix->nx ) // Idem
-					if( blockData[ i + bs * ( j + bs * k ) ] != value )
+					if( sparEqual( blockData[ i + bs * ( j + bs * k ) ], value ) == 0 )
 					{
 						isUniform = 0;
 						i = j = k = bs;
@@ -252,6 +334,410 @@ int sparUniformBlock( spar *matrix, int x, int y, int z )
 	return isUniform;
 }
 
+// Expand uniform block (x,y,z) into heterogeneous block data
+void sparExpandBlock( spar *matrix, int x, int y, int z )
+{
+	// Linear block index (n) <-> (x,y,z)
+	int n;
+	n = x + matrix->mx * ( y + matrix->my * z );
+
+	// Already heterogeneous
+	if( matrix->blockData[n] != NULL )
+	{
+		return;
+	}
+
+	// Allocate block data
+	sparType *blockData;
+	blockData = (sparType*) calloc( matrix->bs3, sizeof(sparType) );
+
+	if( blockData == NULL )
+	{
+	   fprintf(stderr, "sparExpandBlock error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Set uniform value
+	sparType value;
+	value = matrix->blockValue[n];
+
+	int i;
+	for( i = 0 ; i < matrix->bs3 ; i++ )
+	{
+		blockData[i] = value;
+	}
+
+	matrix->blockData[n] = blockData;
+}
+
+// Reduce block (x,y,z) to uniform if possible, return 1 if uniform
+int sparReduceBlock( spar *matrix, int x, int y, int z )
+{
+	// Linear block index (n) <-> (x,y,z)
+	int n;
+	n = x + matrix->mx * ( y + matrix->my * z );
+
+	// Already uniform
+	if( matrix->blockData[n] == NULL )
+	{
+		return 1;
+	}
+
+	// Heterogeneous block
+	if( sparUniformBlock( matrix, x, y, z ) == 0 )
+	{
+		return 0;
+	}
+
+	// First element is always inside the matrix
+	matrix->blockValue[n] = matrix->blockData[n][0];
+	free(matrix->blockData[n]);
+	matrix->blockData[n] = NULL;
+
+	return 1;
+}
+
+// Check if every block overlapping box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) is uniform with the same value
+int sparUniformBox( spar *matrix, int x, int y, int z, int sx, int sy, int sz, sparType *value )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return 0;
+	}
+
+	// Reference value
+	int n;
+	n = x0 / bs + matrix->mx * ( y0 / bs + matrix->my * ( z0 / bs ) );
+	*value = matrix->blockValue[n];
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+				if( matrix->blockData[n] != NULL || sparEqual( matrix->blockValue[n], *value ) == 0 )
+				{
+					return 0;
+				}
+			}
+		}
+	}
+
+	return 1;
+}
+
+// Copy box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) into buffer[i+sx*(j+sy*k)], default value outside the matrix
+void sparGetBox( spar *matrix, int x, int y, int z, int sx, int sy, int sz, sparType *buffer )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	int i, j, k;
+
+	// Box partially outside the matrix, fill with default value
+	if( x0 != x || y0 != y || z0 != z || x1 != x + sx || y1 != y + sy || z1 != z + sz )
+	{
+		for( i = 0 ; i < sx * sy * sz ; i++ )
+		{
+			buffer[i] = matrix->def;
+		}
+	}
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+				sparType *blockData;
+				blockData = matrix->blockData[n];
+
+				// Copy block rows
+				for( k = bz0 ; k < bz1 ; k++ )
+				{
+					for( j = by0 ; j < by1 ; j++ )
+					{
+						sparType *row;
+						row = buffer + ( bx0 - x ) + sx * ( ( j - y ) + sy * ( k - z ) );
+
+						// Uniform block
+						if( blockData == NULL )
+						{
+							sparType value;
+							value = matrix->blockValue[n];
+							for( i = 0 ; i < bx1 - bx0 ; i++ )
+							{
+								row[i] = value;
+							}
+						}
+						// Heterogeneous block
+						else
+						{
+							memcpy( row, blockData + ( bx0 - i1 * bs ) + bs * ( ( j - j1 * bs ) + bs * ( k - k1 * bs ) ),
+									( bx1 - bx0 ) * sizeof(sparType) );
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// Copy buffer[i+sx*(j+sy*k)] into box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1), elements outside the matrix are ignored
+void sparSetBox( spar *matrix, int x, int y, int z, int sx, int sy, int sz, sparType *buffer )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	int i, j, k;
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+				// Block elements inside the matrix are fully covered
+				int covered;
+				covered = bx0 == i1 * bs && by0 == j1 * bs && bz0 == k1 * bs &&
+						  ( bx1 == ( i1 + 1 ) * bs || bx1 == matrix->nx ) &&
+						  ( by1 == ( j1 + 1 ) * bs || by1 == matrix->ny ) &&
+						  ( bz1 == ( k1 + 1 ) * bs || bz1 == matrix->nz );
+
+				// Covered block, check if input is uniform first
+				if( covered )
+				{
+					sparType value;
+					value = buffer[ ( bx0 - x ) + sx * ( ( by0 - y ) + sy * ( bz0 - z ) ) ];
+
+					int isUniform;
+					isUniform = 1;
+					for( k = bz0 ; k < bz1 && isUniform ; k++ )
+					{
+						for( j = by0 ; j < by1 && isUniform ; j++ )
+						{
+							sparType *row;
+							row = buffer + ( bx0 - x ) + sx * ( ( j - y ) + sy * ( k - z ) );
+							for( i = 0 ; i < bx1 - bx0 ; i++ )
+							{
+								if( sparEqual( row[i], value ) == 0 )
+								{
+									isUniform = 0;
+									break;
+								}
+							}
+						}
+					}
+
+					if( isUniform )
+					{
+						if( matrix->blockData[n] != NULL )
+						{
+							free(matrix->blockData[n]);
+							matrix->blockData[n] = NULL;
+						}
+						matrix->blockValue[n] = value;
+						continue;
+					}
+				}
+
+				// Copy block rows into heterogeneous block
+				sparExpandBlock( matrix, i1, j1, k1 );
+
+				sparType *blockData;
+				blockData = matrix->blockData[n];
+
+				for( k = bz0 ; k < bz1 ; k++ )
+				{
+					for( j = by0 ; j < by1 ; j++ )
+					{
+						memcpy( blockData + ( bx0 - i1 * bs ) + bs * ( ( j - j1 * bs ) + bs * ( k - k1 * bs ) ),
+								buffer + ( bx0 - x ) + sx * ( ( j - y ) + sy * ( k - z ) ),
+								( bx1 - bx0 ) * sizeof(sparType) );
+					}
+				}
+
+				// Partially covered blocks may have become uniform
+				if( !covered )
+				{
+					sparReduceBlock( matrix, i1, j1, k1 );
+				}
+			}
+		}
+	}
+}
+
+// Set every element of box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) to value, elements outside the matrix are ignored
+void sparFillBox( spar *matrix, int x, int y, int z, int sx, int sy, int sz, sparType value )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	int i, j, k;
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+				// Block elements inside the matrix are fully covered, uniform block
+				if( bx0 == i1 * bs && by0 == j1 * bs && bz0 == k1 * bs &&
+					( bx1 == ( i1 + 1 ) * bs || bx1 == matrix->nx ) &&
+					( by1 == ( j1 + 1 ) * bs || by1 == matrix->ny ) &&
+					( bz1 == ( k1 + 1 ) * bs || bz1 == matrix->nz ) )
+				{
+					if( matrix->blockData[n] != NULL )
+					{
+						free(matrix->blockData[n]);
+						matrix->blockData[n] = NULL;
+					}
+					matrix->blockValue[n] = value;
+					continue;
+				}
+
+				// Already uniform with the same value
+				if( matrix->blockData[n] == NULL && sparEqual( matrix->blockValue[n], value ) )
+				{
+					continue;
+				}
+
+				// Fill block rows and reduce if possible
+				sparExpandBlock( matrix, i1, j1, k1 );
+
+				sparType *blockData;
+				blockData = matrix->blockData[n];
+
+				for( k = bz0 ; k < bz1 ; k++ )
+				{
+					for( j = by0 ; j < by1 ; j++ )
+					{
+						sparType *row;
+						row = blockData + ( bx0 - i1 * bs ) + bs * ( ( j - j1 * bs ) + bs * ( k - k1 * bs ) );
+						for( i = 0 ; i < bx1 - bx0 ; i++ )
+						{
+							row[i] = value;
+						}
+					}
+				}
+
+				sparReduceBlock( matrix, i1, j1, k1 );
+			}
+		}
+	}
+}
+
 // Set matrix element (x,y,z)
 void sparSet( spar *matrix, int x, int y, int z, sparType value )
 {
@@ -288,7 +774,7 @@ void sparSet( spar *matrix, int x, int y, int z, sparType value )
 	if( blockData == NULL )
 	{
 		// Input value is different
-		if( value != blockValue )
+		if( sparEqual( value, blockValue ) == 0 )
 		{
 			// Expand block
 			blockData = (sparType*) calloc( bs3, sizeof(sparType) );
@@ -366,6 +852,51 @@ sparType sparGet( spar *matrix, int x, int y, int z )
 	}
 }
 
+// Set matrix element (x,y,z) locking its block, safe for parallel writers
+void sparSetSafe( spar *matrix, int x, int y, int z, sparType value )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Linear block index (n) <-> (x/bs,y/bs,z/bs)
+	int n;
+	n = x / bs + matrix->mx * ( y / bs + matrix->my * ( z / bs ) );
+
+	// Acquire block lock
+	while( atomic_flag_test_and_set_explicit( &matrix->blockLock[n], memory_order_acquire ) );
+
+	// Set element, may expand or reduce the block
+	sparSet( matrix, x, y, z, value );
+
+	// Release block lock
+	atomic_flag_clear_explicit( &matrix->blockLock[n], memory_order_release );
+}
+
+// Get matrix element (x,y,z) locking its block, safe with parallel writers
+sparType sparGetSafe( spar *matrix, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Linear block index (n) <-> (x/bs,y/bs,z/bs)
+	int n;
+	n = x / bs + matrix->mx * ( y / bs + matrix->my * ( z / bs ) );
+
+	// Acquire block lock
+	while( atomic_flag_test_and_set_explicit( &matrix->blockLock[n], memory_order_acquire ) );
+
+	// Get element
+	sparType value;
+	value = sparGet( matrix, x, y, z );
+
+	// Release block lock
+	atomic_flag_clear_explicit( &matrix->blockLock[n], memory_order_release );
+
+	return value;
+}
+
 // Duplicate matrix
 spar* sparDuplicate( spar *matrix )
 {
@@ -374,6 +905,11 @@ spar* sparDuplicate( spar *matrix )
 	matrix2 = sparInit( matrix->nx, matrix->ny, matrix->nz,
 						matrix->bs, matrix->def );
 
+	// Copy ring buffer origin
+	matrix2->ox = matrix->ox;
+	matrix2->oy = matrix->oy;
+	matrix2->oz = matrix->oz;
+
 	// Number of blocks
 	int blocks;
 	blocks = matrix2->mx * matrix2->my * matrix2->mz;
@@ -446,6 +982,9 @@ double sparMemoryBs( spar *matrix, int bs )
 	// Size of heterogeneous block data arrays
 	size = size + (double)( blocks * sizeof(sparType*) );
 
+	// Size of block locks
+	size = size + (double)( blocks * sizeof(atomic_flag) );
+
 	int i, j, k;
 	int i1, j1, k1;
 	int isUniform;
@@ -470,7 +1009,7 @@ double sparMemoryBs( spar *matrix, int bs )
 						for( i = i1 * bs ; i < ( i1 + 1 ) * bs ; i++ )
 						{
 							if( i < nx ) // Idem
-							if( sparGet( matrix, i, j, k ) != value )
+							if( sparEqual( sparGet( matrix, i, j, k ), value ) == 0 )
 							{
 								isUniform = 0;
 								i = ( i1 + 1 ) * bs;
@@ -535,10 +1074,15 @@ void sparChangeBs( spar *matrix, int bs )
 	// Free old blocks
 	free(matrix->blockValue);
 	free(matrix->blockData);
+	free(matrix->blockLock);
 
 	// Copy new blocks
 	matrix->blockValue = matrix2->blockValue;
 	matrix->blockData = matrix2->blockData;
+	matrix->blockLock = matrix2->blockLock;
+
+	// Unlock all blocks of the new grid
+	sparClearLocks( matrix );
 
 	// Free temporal matrix
 	free(matrix2);
@@ -588,415 +1132,4860 @@ void sparResize( spar *matrix, int nx, int ny, int nz )
 	sparType def;
 	def = matrix->def;
 
-	// Block grid size
+	// New block grid size
 	int mx, my, mz;
+	mx = (int)( ( nx + bs - 1 ) / bs );
+	my = (int)( ( ny + bs - 1 ) / bs );
+	mz = (int)( ( nz + bs - 1 ) / bs );
 
 	// New block data
 	sparType *blockValue;
 	sparType **blockData;
 
-	int i, j, k;
 	int blocks;
+	blocks = mx * my * mz;
+	blockValue = (sparType*) calloc( blocks, sizeof(sparType) ); // Sets to 0s
+	blockData = (sparType**) calloc( blocks, sizeof(sparType*) ); // Sets to NULLs
 
-	// Expand x
-	if( nx > matrix->nx )
+	if( blockValue == NULL || blockData == NULL )
 	{
-		// New block grid size
-		mx = (int)( ( nx + bs - 1 ) / bs );
-		my = matrix->my;
-		mz = matrix->mz;
-
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (sparType*) calloc( blocks, sizeof(sparType) ); // Sets to 0s
-		blockData = (sparType**) calloc( blocks, sizeof(sparType*) ); // Sets to NULLs
+	   fprintf(stderr, "sparResize error: Out of memory\n");
+	   exit(1);
+	}
 
-		if( blockValue == NULL || blockData == NULL )
-		{
-		   fprintf(stderr, "sparResize error: Out of memory\n");
-		   exit(1);
-		}
+	int i, j, k;
 
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+	// Move existing blocks, create new blocks
+	for( k = 0 ; k < mz ; k++ )
+	{
+		for( j = 0 ; j < my ; j++ )
 		{
-			for( j = 0 ; j < my ; j++ )
+			for( i = 0 ; i < mx ; i++ )
 			{
-				for( i = 0 ; i < matrix->mx ; i++ )
+				if( i < matrix->mx && j < matrix->my && k < matrix->mz )
 				{
 					blockValue[ i + mx * ( j + my * k ) ]
 						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
 					blockData[ i + mx * ( j + my * k ) ]
 						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
 				}
+				else
+				{
+					blockValue[ i + mx * ( j + my * k ) ] = def;
+				}
 			}
 		}
-		// Create new blocks
-		for( k = 0 ; k < mz ; k++ )
+	}
+
+	// Free excedent blocks
+	for( k = 0 ; k < matrix->mz ; k++ )
+	{
+		for( j = 0 ; j < matrix->my ; j++ )
 		{
-			for( j = 0 ; j < my ; j++ )
+			for( i = 0 ; i < matrix->mx ; i++ )
 			{
-				for( i = matrix->mx ; i < mx ; i++ )
+				if( ( i >= mx || j >= my || k >= mz ) &&
+					matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
 				{
-					blockValue[ i + mx * ( j +  my * k ) ] = def;
-					blockData[ i + mx * ( j +  my * k ) ] = NULL;
+					free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
 				}
 			}
 		}
+	}
 
-		int xi, xf;
-		xi = matrix->nx;
-		xf = matrix->bs * matrix->mx;
-		if( xf >= nx )
-		{
-			xf = nx - 1;
-		}
+	// Previous matrix size
+	int ox, oy, oz;
+	ox = matrix->nx;
+	oy = matrix->ny;
+	oz = matrix->nz;
 
-		matrix->nx = nx;
-		matrix->mx = mx;
+	matrix->nx = nx;
+	matrix->ny = ny;
+	matrix->nz = nz;
+	matrix->mx = mx;
+	matrix->my = my;
+	matrix->mz = mz;
 
-		free(matrix->blockData);
-		free(matrix->blockValue);
+	free(matrix->blockData);
+	free(matrix->blockValue);
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
+	matrix->blockData = blockData;
+	matrix->blockValue = blockValue;
 
-		// Set expanded elements to default
-		for( k = 0 ; k < matrix->nz ; k++ )
-		{
-			for( j = 0 ; j < matrix->ny ; j++ )
-			{
-				for( i = xi ; i < xf ; i++ )
-				{
-					sparSet( matrix, i, j, k, def );
-				}
-			}
-		}
+	// Set expanded elements of previous boundary blocks to default, block by block
+	if( nx > ox )
+	{
+		sparFillBox( matrix, ox, 0, 0, nx - ox, ny, nz, def );
 	}
-	// Shrink x
-	else if( nx < matrix->nx )
+	if( ny > oy )
 	{
-		// New block grid size
-		mx = (int)( ( nx + bs - 1 ) / bs );
-		my = matrix->my;
-		mz = matrix->mz;
+		sparFillBox( matrix, 0, oy, 0, nx, ny - oy, nz, def );
+	}
+	if( nz > oz )
+	{
+		sparFillBox( matrix, 0, 0, oz, nx, ny, nz - oz, def );
+	}
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (sparType*) calloc( blocks, sizeof(sparType) ); // Sets to 0s
-		blockData = (sparType**) calloc( blocks, sizeof(sparType*) ); // Sets to NULLs
+	// Reallocate block locks for the new block grid
+	free(matrix->blockLock);
+	matrix->blockLock = (atomic_flag*) malloc( matrix->mx * matrix->my * matrix->mz * sizeof(atomic_flag) );
 
-		if( blockValue == NULL || blockData == NULL )
+	if( matrix->blockLock == NULL )
+	{
+	   fprintf(stderr, "sparResize error: Out of memory\n");
+	   exit(1);
+	}
+
+	sparClearLocks( matrix );
+}
+
+// Sum of matrix elements
+double sparSum( spar *matrix )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	double sum;
+	sum = 0.0;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:sum) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		sparType *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, value times element count
+		if( blockData == NULL )
 		{
-		   fprintf(stderr, "sparResize error: Out of memory\n");
-		   exit(1);
+			sum += (double)( matrix->blockValue[n] ) * ex * ey * ez;
 		}
-
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
 		{
-			for( j = 0 ; j < my ; j++ )
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
-				}
+				sum += (double)( blockData[i] );
 			}
 		}
-
-		// Free excedent blocks
-		for( k = 0 ; k < mz ; k++ )
+		// Boundary heterogeneous block, skip outside elements
+		else
 		{
-			for( j = 0 ; j < my ; j++ )
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
 			{
-				for( i = mx ; i < matrix->mx ; i++ )
+				for( j = 0 ; j < ey ; j++ )
 				{
-					if( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
+					sparType *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
 					{
-						free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
+						sum += (double)( row[i] );
 					}
 				}
 			}
 		}
-
-		matrix->nx = nx;
-		matrix->mx = mx;
-
-		free(matrix->blockData);
-		free(matrix->blockValue);
-
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
 	}
 
-	// Expand y
-	if( ny > matrix->ny )
-	{
-		// New block grid size
-		mx = matrix->mx;
-		my = (int)( ( ny + bs - 1 ) / bs );
-		mz = matrix->mz;
+	return sum;
+}
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (sparType*) calloc( blocks, sizeof(sparType) ); // Sets to 0s
-		blockData = (sparType**) calloc( blocks, sizeof(sparType*) ); // Sets to NULLs
+// First matrix element in block order that is not NaN, NaN only if every element is NaN
+sparType sparFirstNumber( spar *matrix )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
 
-		if( blockValue == NULL || blockData == NULL )
-		{
-		   fprintf(stderr, "sparResize error: Out of memory\n");
-		   exit(1);
-		}
+	// For each block
+	int n;
+	for( n = 0 ; n < matrix->mx * matrix->my * matrix->mz ; n++ )
+	{
+		sparType *blockData;
+		blockData = matrix->blockData[n];
 
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+		// Uniform block
+		if( blockData == NULL )
 		{
-			for( j = 0 ; j < matrix->my ; j++ )
+			if( !isnan( (double) matrix->blockValue[n] ) )
 			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
-				}
+				return matrix->blockValue[n];
 			}
+			continue;
 		}
-		// Create new blocks
-		for( k = 0 ; k < mz ; k++ )
+
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % matrix->mx;
+		j1 = ( n / matrix->mx ) % matrix->my;
+		k1 = n / ( matrix->mx * matrix->my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs < bs ? matrix->nx - i1 * bs : bs;
+		ey = matrix->ny - j1 * bs < bs ? matrix->ny - j1 * bs : bs;
+		ez = matrix->nz - k1 * bs < bs ? matrix->nz - k1 * bs : bs;
+
+		// Heterogeneous block, skip outside elements
+		int i, j, k;
+		for( k = 0 ; k < ez ; k++ )
 		{
-			for( j = matrix->my ; j < my ; j++ )
+			for( j = 0 ; j < ey ; j++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				for( i = 0 ; i < ex ; i++ )
 				{
-					blockValue[ i + mx * ( j +  my * k ) ] = def;
-					blockData[ i + mx * ( j +  my * k ) ] = NULL;
+					if( !isnan( (double) blockData[ i + bs * ( j + bs * k ) ] ) )
+					{
+						return blockData[ i + bs * ( j + bs * k ) ];
+					}
 				}
 			}
 		}
+	}
 
-		int yi, yf;
-		yi = matrix->ny;
-		yf = matrix->bs * matrix->my;
-		if( yf >= ny )
-		{
-			yf = ny - 1;
-		}
+	return sparGet( matrix, 0, 0, 0 );
+}
 
-		matrix->ny = ny;
-		matrix->my = my;
+// Minimum matrix element, NaN elements ignored (NaN only if all are NaN)
+sparType sparMin( spar *matrix )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
 
-		free(matrix->blockData);
-		free(matrix->blockValue);
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
+	// Start with an element that is not NaN, comparisons with NaN are false so NaN never replaces it
+	sparType value;
+	value = sparFirstNumber( matrix );
 
-		// Set expanded elements to default
-		for( k = 0 ; k < matrix->nz ; k++ )
-		{
-			for( j = yi ; j < yf ; j++ )
-			{
-				for( i = 0 ; i < matrix->nx ; i++ )
-				{
-					sparSet( matrix, i, j, k, def );
-				}
-			}
-		}
-	}
-	// Shrink y
-	else if( ny < matrix->ny )
+	// Every element is NaN
+	if( isnan( (double) value ) )
 	{
-		// New block grid size
-		mx = matrix->mx;
-		my = (int)( ( ny + bs - 1 ) / bs );
-		mz = matrix->mz;
+		return value;
+	}
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (sparType*) calloc( blocks, sizeof(sparType) ); // Sets to 0s
-		blockData = (sparType**) calloc( blocks, sizeof(sparType*) ); // Sets to NULLs
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(min:value) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		sparType *blockData;
+		blockData = matrix->blockData[n];
 
-		if( blockValue == NULL || blockData == NULL )
+		// Uniform block
+		if( blockData == NULL )
 		{
-		   fprintf(stderr, "sparResize error: Out of memory\n");
-		   exit(1);
+			if( matrix->blockValue[n] < value )
+			{
+				value = matrix->blockValue[n];
+			}
 		}
-
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
 		{
-			for( j = 0 ; j < my ; j++ )
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
-				}
+				value = blockData[i] < value ? blockData[i] : value;
 			}
 		}
-
-		// Free excedent blocks
-		for( k = 0 ; k < mz ; k++ )
+		// Boundary heterogeneous block, skip outside elements
+		else
 		{
-			for( j = my ; j < matrix->my ; j++ )
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				for( j = 0 ; j < ey ; j++ )
 				{
-					if( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
+					sparType *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
 					{
-						free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
+						value = row[i] < value ? row[i] : value;
 					}
 				}
 			}
 		}
+	}
 
-		matrix->ny = ny;
-		matrix->my = my;
+	return value;
+}
 
-		free(matrix->blockData);
-		free(matrix->blockValue);
+// Maximum matrix element, NaN elements ignored (NaN only if all are NaN)
+sparType sparMax( spar *matrix )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
-	}
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Start with an element that is not NaN, comparisons with NaN are false so NaN never replaces it
+	sparType value;
+	value = sparFirstNumber( matrix );
 
-	// Expand z
-	if( nz > matrix->nz )
+	// Every element is NaN
+	if( isnan( (double) value ) )
 	{
-		// New block grid size
-		mx = matrix->mx;
-		my = matrix->my;
-		mz = (int)( ( nz + bs - 1 ) / bs );
+		return value;
+	}
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (sparType*) calloc( blocks, sizeof(sparType) ); // Sets to 0s
-		blockData = (sparType**) calloc( blocks, sizeof(sparType*) ); // Sets to NULLs
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(max:value) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		sparType *blockData;
+		blockData = matrix->blockData[n];
 
-		if( blockValue == NULL || blockData == NULL )
+		// Uniform block
+		if( blockData == NULL )
 		{
-		   fprintf(stderr, "sparResize error: Out of memory\n");
-		   exit(1);
+			if( matrix->blockValue[n] > value )
+			{
+				value = matrix->blockValue[n];
+			}
 		}
-
-		// Copy existing blocks
-		for( k = 0 ; k < matrix->mz ; k++ )
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
 		{
-			for( j = 0 ; j < my ; j++ )
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
-				}
+				value = blockData[i] > value ? blockData[i] : value;
 			}
 		}
-		// Create new blocks
-		for( k = matrix->mz ; k < mz ; k++ )
+		// Boundary heterogeneous block, skip outside elements
+		else
 		{
-			for( j = 0 ; j < my ; j++ )
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				for( j = 0 ; j < ey ; j++ )
 				{
-					blockValue[ i + mx * ( j +  my * k ) ] = def;
-					blockData[ i + mx * ( j +  my * k ) ] = NULL;
+					sparType *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						value = row[i] > value ? row[i] : value;
+					}
 				}
 			}
 		}
+	}
 
-		int zi, zf;
-		zi = matrix->nz;
-		zf = matrix->bs * matrix->mz;
-		if( zf >= nz )
-		{
-			zf = nz - 1;
-		}
+	return value;
+}
+
+// Number of matrix elements different from the default value
+double sparCount( spar *matrix )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
 
-		matrix->nz = nz;
-		matrix->mz = mz;
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
 
-		free(matrix->blockData);
-		free(matrix->blockValue);
+	// Default value
+	sparType def;
+	def = matrix->def;
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
+	double count;
+	count = 0.0;
 
-		// Set expanded elements to default
-		for( k = zi ; k < zf ; k++ )
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:count) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		sparType *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, all or none of its elements
+		if( blockData == NULL )
 		{
-			for( j = 0 ; j < matrix->ny ; j++ )
+			if( sparEqual( matrix->blockValue[n], def ) == 0 )
 			{
-				for( i = 0 ; i < matrix->nx ; i++ )
-				{
-					sparSet( matrix, i, j, k, def );
-				}
+				count += (double)( ex * ey * ez );
 			}
 		}
-	}
-	// Shrink z
-	else if( nz < matrix->nz )
-	{
-		// New block grid size
-		mx = matrix->mx;
-		my = matrix->my;
-		mz = (int)( ( nz + bs - 1 ) / bs );
-
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (sparType*) calloc( blocks, sizeof(sparType) ); // Sets to 0s
-		blockData = (sparType**) calloc( blocks, sizeof(sparType*) ); // Sets to NULLs
-
-		if( blockValue == NULL || blockData == NULL )
-		{
-		   fprintf(stderr, "sparResize error: Out of memory\n");
-		   exit(1);
-		}
-
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
 		{
-			for( j = 0 ; j < my ; j++ )
+			int i, c;
+			c = 0;
+			for( i = 0 ; i < bs3 ; i++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
-				}
+				c += ( sparEqual( blockData[i], def ) == 0 );
 			}
+			count += (double)( c );
 		}
-
-		// Free excedent blocks
-		for( k = mz ; k < matrix->mz ; k++ )
+		// Boundary heterogeneous block, skip outside elements
+		else
 		{
-			for( j = 0 ; j < my ; j++ )
+			int i, j, k, c;
+			c = 0;
+			for( k = 0 ; k < ez ; k++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				for( j = 0 ; j < ey ; j++ )
 				{
-					if( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
+					sparType *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
 					{
-						free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
+						c += ( sparEqual( row[i], def ) == 0 );
 					}
 				}
 			}
+			count += (double)( c );
 		}
+	}
 
-		matrix->nz = nz;
-		matrix->mz = mz;
-
-		free(matrix->blockData);
-		free(matrix->blockValue);
+	return count;
+}
+
+// Fold f over matrix elements from identity, f gets each uniform block once with its element count
+double sparReduce( spar *matrix, double (*f)( double acc, sparType value, int count ), double identity )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	double acc;
+	acc = identity;
+
+	// For each block, sequential so f needs no combine step
+	int n;
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		sparType *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, a single call for all its elements
+		if( blockData == NULL )
+		{
+			acc = f( acc, matrix->blockValue[n], ex * ey * ez );
+		}
+		// Heterogeneous block, skip outside elements
+		else
+		{
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					sparType *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						acc = f( acc, row[i], 1 );
+					}
+				}
+			}
+		}
+	}
+
+	return acc;
+}
+
+// Apply function f to every matrix element (and default value) in place
+void sparApply( spar *matrix, sparType (*f)( sparType ) )
+{
+	// Block size
+	int bs3;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		sparType *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, transform its value only
+		if( blockData == NULL )
+		{
+			matrix->blockValue[n] = f( matrix->blockValue[n] );
+		}
+		// Heterogeneous block, transform and reduce if possible
+		else
+		{
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				blockData[i] = f( blockData[i] );
+			}
+			sparReduceBlock( matrix, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
+	}
+
+	// Keep the background consistent with transformed uniform blocks
+	matrix->def = f( matrix->def );
+}
+
+// New matrix with function f applied to every element (and default value)
+spar* sparMap( spar *matrix, sparType (*f)( sparType ) )
+{
+	// Declare matrix and init
+	spar *matrix2;
+	matrix2 = sparInit( matrix->nx, matrix->ny, matrix->nz,
+						matrix->bs, f( matrix->def ) );
+
+	// Copy ring buffer origin
+	matrix2->ox = matrix->ox;
+	matrix2->oy = matrix->oy;
+	matrix2->oz = matrix->oz;
+
+	// Block size
+	int bs3;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		sparType *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, transform its value only
+		if( blockData == NULL )
+		{
+			matrix2->blockValue[n] = f( matrix->blockValue[n] );
+		}
+		// Heterogeneous block, transform into new block and reduce if possible
+		else
+		{
+			sparType *blockData2;
+			blockData2 = (sparType*) calloc( bs3, sizeof(sparType) );
+
+			if( blockData2 == NULL )
+			{
+			   fprintf(stderr, "sparMap error: Out of memory\n");
+			   exit(1);
+			}
+
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				blockData2[i] = f( blockData[i] );
+			}
+			matrix2->blockData[n] = blockData2;
+			sparReduceBlock( matrix2, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
+	}
+
+	return matrix2;
+}
+
+// Visit elements different from the default value, in block order
+void sparForEach( spar *matrix, void (*f)( int x, int y, int z, sparType value, void *data ), void *data )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Default value
+	sparType def;
+	def = matrix->def;
+
+	int i, j, k;
+	int i1, j1, k1;
+	int ex, ey, ez;
+	int n;
+
+	// For each block
+	for( k1 = 0 ; k1 < matrix->mz ; k1++ )
+	{
+		for( j1 = 0 ; j1 < matrix->my ; j1++ )
+		{
+			for( i1 = 0 ; i1 < matrix->mx ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				sparType *blockData;
+				blockData = matrix->blockData[n];
+
+				// Skip uniform blocks equal to the default value
+				if( blockData == NULL && sparEqual( matrix->blockValue[n], def ) )
+				{
+					continue;
+				}
+
+				// Block extent inside the matrix
+				ex = matrix->nx - i1 * bs;
+				ey = matrix->ny - j1 * bs;
+				ez = matrix->nz - k1 * bs;
+				if( ex > bs ) ex = bs;
+				if( ey > bs ) ey = bs;
+				if( ez > bs ) ez = bs;
+
+				// Uniform block, every element
+				if( blockData == NULL )
+				{
+					sparType value;
+					value = matrix->blockValue[n];
+					for( k = 0 ; k < ez ; k++ )
+					{
+						for( j = 0 ; j < ey ; j++ )
+						{
+							for( i = 0 ; i < ex ; i++ )
+							{
+								f( i1 * bs + i, j1 * bs + j, k1 * bs + k, value, data );
+							}
+						}
+					}
+				}
+				// Heterogeneous block, non-default elements
+				else
+				{
+					for( k = 0 ; k < ez ; k++ )
+					{
+						for( j = 0 ; j < ey ; j++ )
+						{
+							sparType *row;
+							row = blockData + bs * ( j + bs * k );
+							for( i = 0 ; i < ex ; i++ )
+							{
+								if( sparEqual( row[i], def ) == 0 )
+								{
+									f( i1 * bs + i, j1 * bs + j, k1 * bs + k, row[i], data );
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// Visit maximal runs of equal non-default elements along x, (x,y,z) to (x+n-1,y,z), merged across blocks
+void sparForEachRun( spar *matrix, void (*f)( int x, int y, int z, int n, sparType value, void *data ), void *data )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Default value
+	sparType def;
+	def = matrix->def;
+
+	int i, j, k;
+	int i1, j1, k1;
+	int ex, ey, ez;
+	int n;
+
+	// Current run (rx,y,z) to (rx+rn-1,y,z) of value rv
+	int rx, rn;
+	sparType rv;
+
+	// For each row of blocks
+	for( k1 = 0 ; k1 < matrix->mz ; k1++ )
+	{
+		for( j1 = 0 ; j1 < matrix->my ; j1++ )
+		{
+			// Block row extent inside the matrix
+			ey = matrix->ny - j1 * bs;
+			ez = matrix->nz - k1 * bs;
+			if( ey > bs ) ey = bs;
+			if( ez > bs ) ez = bs;
+
+			// For each matrix row, runs continue from one block into the next
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					rx = 0;
+					rn = 0;
+					rv = def;
+
+					for( i1 = 0 ; i1 < matrix->mx ; i1++ )
+					{
+						// Linear block index (n) <-> (i1,j1,k1)
+						n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+						ex = matrix->nx - i1 * bs;
+						if( ex > bs ) ex = bs;
+
+						sparType *blockData;
+						blockData = matrix->blockData[n];
+
+						// Uniform block, extend or restart the run with its whole row
+						if( blockData == NULL )
+						{
+							if( rn > 0 && sparEqual( matrix->blockValue[n], rv ) )
+							{
+								rn += ex;
+							}
+							else
+							{
+								if( rn > 0 && sparEqual( rv, def ) == 0 )
+								{
+									f( rx, j1 * bs + j, k1 * bs + k, rn, rv, data );
+								}
+								rx = i1 * bs;
+								rn = ex;
+								rv = matrix->blockValue[n];
+							}
+						}
+						// Heterogeneous block, element by element
+						else
+						{
+							sparType *row;
+							row = blockData + bs * ( j + bs * k );
+							for( i = 0 ; i < ex ; i++ )
+							{
+								if( rn > 0 && sparEqual( row[i], rv ) )
+								{
+									rn++;
+								}
+								else
+								{
+									if( rn > 0 && sparEqual( rv, def ) == 0 )
+									{
+										f( rx, j1 * bs + j, k1 * bs + k, rn, rv, data );
+									}
+									rx = i1 * bs + i;
+									rn = 1;
+									rv = row[i];
+								}
+							}
+						}
+					}
+
+					// End of row
+					if( rn > 0 && sparEqual( rv, def ) == 0 )
+					{
+						f( rx, j1 * bs + j, k1 * bs + k, rn, rv, data );
+					}
+				}
+			}
+		}
+	}
+}
+
+// Element-wise operation between arrays, c[i] = a[i] op b[i]
+void sparOpArray( sparType *c, sparType *a, sparType *b, int n, int op, sparType def )
+{
+	int i;
+	switch( op )
+	{
+		case SPAR_ADD:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] + b[i];
+			}
+			break;
+		case SPAR_SUB:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] - b[i];
+			}
+			break;
+		case SPAR_MUL:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] * b[i];
+			}
+			break;
+		case SPAR_MIN:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] < b[i] ? a[i] : b[i];
+			}
+			break;
+		case SPAR_MAX:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] > b[i] ? a[i] : b[i];
+			}
+			break;
+		case SPAR_MASK:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = b[i] != 0 ? a[i] : def;
+			}
+			break;
+		default:
+			fprintf(stderr, "sparOpArray error: Unknown operation\n");
+			exit(1);
+	}
+}
+
+// Element-wise operation between array and scalar, c[i] = a[i] op value
+void sparOpArrayScalar( sparType *c, sparType *a, sparType value, int n, int op, sparType def )
+{
+	int i;
+	switch( op )
+	{
+		case SPAR_ADD:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] + value;
+			}
+			break;
+		case SPAR_SUB:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] - value;
+			}
+			break;
+		case SPAR_MUL:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] * value;
+			}
+			break;
+		case SPAR_MIN:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] < value ? a[i] : value;
+			}
+			break;
+		case SPAR_MAX:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] > value ? a[i] : value;
+			}
+			break;
+		case SPAR_MASK:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = value != 0 ? a[i] : def;
+			}
+			break;
+		default:
+			fprintf(stderr, "sparOpArrayScalar error: Unknown operation\n");
+			exit(1);
+	}
+}
+
+// New matrix with element-wise operation between matrices, c = a op b
+spar* sparOp( spar *a, spar *b, int op )
+{
+	// Check matrix size
+	if( a->nx != b->nx || a->ny != b->ny || a->nz != b->nz )
+	{
+		fprintf(stderr, "sparOp error: Matrix sizes must agree\n");
+		exit(1);
+	}
+
+	// Check ring buffer origin, blocks are combined by storage index
+	if( a->ox != b->ox || a->oy != b->oy || a->oz != b->oz )
+	{
+		fprintf(stderr, "sparOp error: Ring buffer origins must agree\n");
+		exit(1);
+	}
+
+	// Result default value
+	sparType def;
+	sparOpArrayScalar( &def, &a->def, b->def, 1, op, a->def );
+
+	// Declare result matrix with block size of a
+	spar *c;
+	c = sparInit( a->nx, a->ny, a->nz, a->bs, def );
+
+	// Copy ring buffer origin of a
+	c->ox = a->ox;
+	c->oy = a->oy;
+	c->oz = a->oz;
+
+	// Block size
+	int bs, bs3;
+	bs = a->bs;
+	bs3 = a->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = a->mx;
+	my = a->my;
+	mz = a->mz;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block of b resampled on the block grid of a
+		sparType *buffer;
+		buffer = NULL;
+
+		if( b->bs != bs )
+		{
+			buffer = (sparType*) malloc( bs3 * sizeof(sparType) );
+
+			if( buffer == NULL )
+			{
+			   fprintf(stderr, "sparOp error: Out of memory\n");
+			   exit(1);
+			}
+		}
+
+		// For each block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < mx * my * mz ; n++ )
+		{
+			// Block (i1,j1,k1) <-> (n)
+			int i1, j1, k1;
+			i1 = n % mx;
+			j1 = ( n / mx ) % my;
+			k1 = n / ( mx * my );
+
+			// Block of b, uniform (blockB == NULL) or heterogeneous
+			sparType *blockB, valueB;
+			if( b->bs == bs )
+			{
+				blockB = b->blockData[n];
+				valueB = b->blockValue[n];
+			}
+			else if( sparUniformBox( b, i1 * bs, j1 * bs, k1 * bs, bs, bs, bs, &valueB ) )
+			{
+				blockB = NULL;
+			}
+			else
+			{
+				sparGetBox( b, i1 * bs, j1 * bs, k1 * bs, bs, bs, bs, buffer );
+				blockB = buffer;
+			}
+
+			// Block of a
+			sparType *blockA, valueA;
+			blockA = a->blockData[n];
+			valueA = a->blockValue[n];
+
+			// Both uniform, one operation
+			if( blockA == NULL && blockB == NULL )
+			{
+				sparOpArrayScalar( &c->blockValue[n], &valueA, valueB, 1, op, a->def );
+				continue;
+			}
+
+			// Heterogeneous result
+			sparType *blockC;
+			blockC = (sparType*) calloc( bs3, sizeof(sparType) );
+
+			if( blockC == NULL )
+			{
+			   fprintf(stderr, "sparOp error: Out of memory\n");
+			   exit(1);
+			}
+
+			// Uniform b, scalar operation
+			if( blockB == NULL )
+			{
+				sparOpArrayScalar( blockC, blockA, valueB, bs3, op, a->def );
+			}
+			// Uniform a, expand into result and operate in place
+			else if( blockA == NULL )
+			{
+				int i;
+				for( i = 0 ; i < bs3 ; i++ )
+				{
+					blockC[i] = valueA;
+				}
+				sparOpArray( blockC, blockC, blockB, bs3, op, a->def );
+			}
+			// Both heterogeneous
+			else
+			{
+				sparOpArray( blockC, blockA, blockB, bs3, op, a->def );
+			}
+
+			c->blockData[n] = blockC;
+			sparReduceBlock( c, i1, j1, k1 );
+		}
+
+		free(buffer);
+	}
+
+	return c;
+}
+
+// Element-wise operation with scalar in place, matrix = matrix op value
+void sparOpScalar( spar *matrix, sparType value, int op )
+{
+	// Block size
+	int bs3;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Default value of the operation (SPAR_MASK)
+	sparType def;
+	def = matrix->def;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		sparType *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, one operation
+		if( blockData == NULL )
+		{
+			sparOpArrayScalar( &matrix->blockValue[n], &matrix->blockValue[n], value, 1, op, def );
+		}
+		// Heterogeneous block, operate in place and reduce if possible
+		else
+		{
+			sparOpArrayScalar( blockData, blockData, value, bs3, op, def );
+			sparReduceBlock( matrix, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
+	}
+
+	// Keep the background consistent with updated uniform blocks
+	sparOpArrayScalar( &matrix->def, &matrix->def, value, 1, op, def );
+}
+
+// Stencil of radius r from src into dst, f(c) reads neighbours c[i+sy*j+sz*k] with -r <= i,j,k <= r
+void sparStencil( spar *dst, spar *src, int r, sparType (*f)( sparType *c, int r, int sy, int sz, void *data ), void *data )
+{
+	// Check matrices
+	if( dst == src )
+	{
+		fprintf(stderr, "sparStencil error: Source and destination must be different\n");
+		exit(1);
+	}
+
+	if( dst->nx != src->nx || dst->ny != src->ny || dst->nz != src->nz )
+	{
+		fprintf(stderr, "sparStencil error: Matrix sizes must agree\n");
+		exit(1);
+	}
+
+	if( r < 0 )
+	{
+		fprintf(stderr, "sparStencil error: Radius must be non-negative\n");
+		exit(1);
+	}
+
+	// Destination block size
+	int bs, bs3;
+	bs = dst->bs;
+	bs3 = dst->bs3;
+
+	// Destination block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = dst->mx;
+	my = dst->my;
+	mz = dst->mz;
+
+	// Block plus halo size (hs,hs,hs)
+	int hs;
+	hs = bs + 2 * r;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block plus halo of the source
+		sparType *halo;
+		halo = (sparType*) malloc( hs * hs * hs * sizeof(sparType) );
+
+		if( halo == NULL )
+		{
+		   fprintf(stderr, "sparStencil error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each destination block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < mx * my * mz ; n++ )
+		{
+			// Block (i1,j1,k1) <-> (n)
+			int i1, j1, k1;
+			i1 = n % mx;
+			j1 = ( n / mx ) % my;
+			k1 = n / ( mx * my );
+
+			// Block origin
+			int x, y, z;
+			x = i1 * bs;
+			y = j1 * bs;
+			z = k1 * bs;
+
+			// Free previous destination data
+			if( dst->blockData[n] != NULL )
+			{
+				free(dst->blockData[n]);
+				dst->blockData[n] = NULL;
+			}
+
+			// Uniform neighbourhood, uniform destination block
+			sparType value;
+			if( sparUniformBox( src, x - r, y - r, z - r, hs, hs, hs, &value ) &&
+				( sparEqual( value, src->def ) || ( x >= r && y >= r && z >= r &&
+				  x + bs + r <= src->nx && y + bs + r <= src->ny && z + bs + r <= src->nz ) ) )
+			{
+				int w, i;
+				w = 2 * r + 1;
+				for( i = 0 ; i < w * w * w ; i++ )
+				{
+					halo[i] = value;
+				}
+				dst->blockValue[n] = f( halo + r + w * ( r + w * r ), r, w, w * w, data );
+				continue;
+			}
+
+			// Read block plus halo
+			sparGetBox( src, x - r, y - r, z - r, hs, hs, hs, halo );
+
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = dst->nx - x;
+			ey = dst->ny - y;
+			ez = dst->nz - z;
+			if( ex > bs ) ex = bs;
+			if( ey > bs ) ey = bs;
+			if( ez > bs ) ez = bs;
+
+			// Apply stencil
+			sparType *blockData;
+			blockData = (sparType*) calloc( bs3, sizeof(sparType) );
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparStencil error: Out of memory\n");
+			   exit(1);
+			}
+
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					sparType *c;
+					c = halo + r + hs * ( ( j + r ) + hs * ( k + r ) );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						blockData[ i + bs * ( j + bs * k ) ] = f( c + i, r, hs, hs * hs, data );
+					}
+				}
+			}
+
+			// Write block and reduce if possible
+			dst->blockData[n] = blockData;
+			sparReduceBlock( dst, i1, j1, k1 );
+		}
+
+		free(halo);
+	}
+}
+
+// Stencil kernel, weighted sum of the neighbourhood with data holding (2r+1)^3 weights
+sparType sparConvolveKernel( sparType *c, int r, int sy, int sz, void *data )
+{
+	double *weights;
+	weights = (double*) data;
+
+	double sum;
+	sum = 0.0;
+
+	int i, j, k;
+	for( k = -r ; k <= r ; k++ )
+	{
+		for( j = -r ; j <= r ; j++ )
+		{
+			for( i = -r ; i <= r ; i++ )
+			{
+				sum += *weights++ * (double)( c[ i + sy * j + sz * k ] );
+			}
+		}
+	}
+
+	return sparRound( sum );
+}
+
+// Convolution of src into dst with weights[(i+r)+(2r+1)*((j+r)+(2r+1)*(k+r))]
+void sparConvolve( spar *dst, spar *src, int r, double *weights )
+{
+	sparStencil( dst, src, r, sparConvolveKernel, weights );
+}
+
+// One-dimensional filter of src into dst along axis (0 x, 1 y, 2 z) with 2r+1 weights, box (moving average) if weights is NULL
+void sparFilterAxis( spar *dst, spar *src, int axis, int r, double *weights )
+{
+	// Check matrices
+	if( dst == src )
+	{
+		fprintf(stderr, "sparFilterAxis error: Source and destination must be different\n");
+		exit(1);
+	}
+
+	if( dst->nx != src->nx || dst->ny != src->ny || dst->nz != src->nz )
+	{
+		fprintf(stderr, "sparFilterAxis error: Matrix sizes must agree\n");
+		exit(1);
+	}
+
+	if( axis < 0 || axis > 2 || r < 0 )
+	{
+		fprintf(stderr, "sparFilterAxis error: Invalid axis or radius\n");
+		exit(1);
+	}
+
+	// Destination block size
+	int bs, bs3;
+	bs = dst->bs;
+	bs3 = dst->bs3;
+
+	// Destination block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = dst->mx;
+	my = dst->my;
+	mz = dst->mz;
+
+	// Halo radius (rx,ry,rz) and block plus halo size (hx,hy,hz)
+	int rx, ry, rz;
+	rx = axis == 0 ? r : 0;
+	ry = axis == 1 ? r : 0;
+	rz = axis == 2 ? r : 0;
+
+	int hx, hy, hz;
+	hx = bs + 2 * rx;
+	hy = bs + 2 * ry;
+	hz = bs + 2 * rz;
+
+	// Element strides along the filter axis in the halo and in the block
+	int hstride, bstride;
+	hstride = axis == 0 ? 1 : ( axis == 1 ? hx : hx * hy );
+	bstride = axis == 0 ? 1 : ( axis == 1 ? bs : bs * bs );
+
+	// Sum of weights
+	double wsum;
+	wsum = 1.0;
+	if( weights != NULL )
+	{
+		int i;
+		wsum = 0.0;
+		for( i = 0 ; i < 2 * r + 1 ; i++ )
+		{
+			wsum += weights[i];
+		}
+
+		// Normalized kernel, keep uniform values exact
+		if( fabs( wsum - 1.0 ) < 1e-9 )
+		{
+			wsum = 1.0;
+		}
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block plus halo of the source and one line along the axis
+		sparType *halo;
+		double *line;
+		halo = (sparType*) malloc( hx * hy * hz * sizeof(sparType) );
+		line = (double*) malloc( ( bs + 2 * r ) * sizeof(double) );
+
+		if( halo == NULL || line == NULL )
+		{
+		   fprintf(stderr, "sparFilterAxis error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each destination block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < mx * my * mz ; n++ )
+		{
+			// Block (i1,j1,k1) <-> (n)
+			int i1, j1, k1;
+			i1 = n % mx;
+			j1 = ( n / mx ) % my;
+			k1 = n / ( mx * my );
+
+			// Block origin
+			int x, y, z;
+			x = i1 * bs;
+			y = j1 * bs;
+			z = k1 * bs;
+
+			// Free previous destination data
+			if( dst->blockData[n] != NULL )
+			{
+				free(dst->blockData[n]);
+				dst->blockData[n] = NULL;
+			}
+
+			// Run of uniform blocks along the axis, uniform destination block
+			sparType value;
+			if( sparUniformBox( src, x - rx, y - ry, z - rz, hx, hy, hz, &value ) &&
+				( sparEqual( value, src->def ) || ( x >= rx && y >= ry && z >= rz &&
+				  x + bs + rx <= src->nx && y + bs + ry <= src->ny && z + bs + rz <= src->nz ) ) )
+			{
+				dst->blockValue[n] = weights == NULL || wsum == 1.0 ? value : sparRound( wsum * value );
+				continue;
+			}
+
+			// Read block plus halo
+			sparGetBox( src, x - rx, y - ry, z - rz, hx, hy, hz, halo );
+
+			sparType *blockData;
+			blockData = (sparType*) calloc( bs3, sizeof(sparType) );
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparFilterAxis error: Out of memory\n");
+			   exit(1);
+			}
+
+			// For each line along the axis, (a,b) are the other two block indices
+			int a, b, i;
+			for( b = 0 ; b < bs ; b++ )
+			{
+				for( a = 0 ; a < bs ; a++ )
+				{
+					// First line element in the halo and in the block
+					sparType *hline, *bline;
+					if( axis == 0 )
+					{
+						hline = halo + hx * ( a + hy * b );
+						bline = blockData + bs * ( a + bs * b );
+					}
+					else if( axis == 1 )
+					{
+						hline = halo + a + hx * hy * b;
+						bline = blockData + a + bs * bs * b;
+					}
+					else
+					{
+						hline = halo + a + hx * b;
+						bline = blockData + a + bs * b;
+					}
+
+					// Gather line
+					for( i = 0 ; i < bs + 2 * r ; i++ )
+					{
+						line[i] = (double)( hline[ i * hstride ] );
+					}
+
+					// Box, sliding window sum
+					if( weights == NULL )
+					{
+						double sum;
+						sum = 0.0;
+						for( i = 0 ; i < 2 * r + 1 ; i++ )
+						{
+							sum += line[i];
+						}
+						for( i = 0 ; i < bs ; i++ )
+						{
+							bline[ i * bstride ] = sparRound( sum / ( 2 * r + 1 ) );
+							if( i + 1 < bs )
+							{
+								sum += line[ i + 2 * r + 1 ] - line[i];
+							}
+						}
+					}
+					// Weighted window as offsets from the centre element, exact on constant lines
+					else
+					{
+						int w;
+						for( i = 0 ; i < bs ; i++ )
+						{
+							double sum;
+							sum = 0.0;
+							for( w = 0 ; w < 2 * r + 1 ; w++ )
+							{
+								sum += weights[w] * ( line[ i + w ] - line[ i + r ] );
+							}
+							bline[ i * bstride ] = sparRound( wsum * line[ i + r ] + sum );
+						}
+					}
+				}
+			}
+
+			// Write block and reduce if possible
+			dst->blockData[n] = blockData;
+			sparReduceBlock( dst, i1, j1, k1 );
+		}
+
+		free(halo);
+		free(line);
+	}
+}
+
+// Box filter (mean over (2r+1)^3 neighbourhood) of src into dst, three one-dimensional passes
+void sparBoxFilter( spar *dst, spar *src, int r )
+{
+	// Temporal matrix for the second pass, intermediate passes see the source default value outside the matrix
+	spar *tmp;
+	tmp = sparInit( dst->nx, dst->ny, dst->nz, dst->bs, src->def );
+
+	sparType def;
+	def = dst->def;
+	dst->def = src->def;
+
+	sparFilterAxis( dst, src, 0, r, NULL );
+	sparFilterAxis( tmp, dst, 1, r, NULL );
+
+	dst->def = def;
+	sparFilterAxis( dst, tmp, 2, r, NULL );
+
+	sparFree( tmp );
+}
+
+// Gaussian filter of standard deviation sigma of src into dst, three one-dimensional passes
+void sparGaussianFilter( spar *dst, spar *src, double sigma )
+{
+	if( !( sigma > 0.0 ) )
+	{
+		fprintf(stderr, "sparGaussianFilter error: Standard deviation must be positive\n");
+		exit(1);
+	}
+
+	// Normalized kernel truncated at 3 sigma
+	int r;
+	r = (int)( ceil( 3.0 * sigma ) );
+
+	double *weights;
+	weights = (double*) malloc( ( 2 * r + 1 ) * sizeof(double) );
+
+	if( weights == NULL )
+	{
+	   fprintf(stderr, "sparGaussianFilter error: Out of memory\n");
+	   exit(1);
+	}
+
+	int i;
+	double sum;
+	sum = 0.0;
+	for( i = -r ; i <= r ; i++ )
+	{
+		weights[ i + r ] = exp( -0.5 * i * i / ( sigma * sigma ) );
+		sum += weights[ i + r ];
+	}
+	for( i = 0 ; i < 2 * r + 1 ; i++ )
+	{
+		weights[i] /= sum;
+	}
+
+	// Temporal matrix for the second pass, intermediate passes see the source default value outside the matrix
+	spar *tmp;
+	tmp = sparInit( dst->nx, dst->ny, dst->nz, dst->bs, src->def );
+
+	sparType def;
+	def = dst->def;
+	dst->def = src->def;
+
+	sparFilterAxis( dst, src, 0, r, weights );
+	sparFilterAxis( tmp, dst, 1, r, weights );
+
+	dst->def = def;
+	sparFilterAxis( dst, tmp, 2, r, weights );
+
+	sparFree( tmp );
+	free(weights);
+}
+
+// Union-find root of node i with path halving (connected component labeling)
+int sparLabelFind( int *parent, int i )
+{
+	while( parent[i] != i )
+	{
+		parent[i] = parent[ parent[i] ];
+		i = parent[i];
+	}
+	return i;
+}
+
+// Union-find merge of the sets of nodes i and j, the smallest node is kept as root
+void sparLabelUnion( int *parent, int i, int j )
+{
+	i = sparLabelFind( parent, i );
+	j = sparLabelFind( parent, j );
+	if( i < j )
+	{
+		parent[j] = i;
+	}
+	else if( j < i )
+	{
+		parent[i] = j;
+	}
+}
+
+// Union-find node of element (x,y,z), -1 for elements equal to the default value
+int sparLabelNode( spar *matrix, int *offset, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Linear block index (n) <-> (x/bs,y/bs,z/bs)
+	int n;
+	n = x / bs + matrix->mx * ( y / bs + matrix->my * ( z / bs ) );
+
+	// Uniform block, one node or none
+	if( matrix->blockData[n] == NULL )
+	{
+		return offset[n];
+	}
+
+	// Heterogeneous block, one node per element
+	int i;
+	i = x % bs + bs * ( y % bs + bs * ( z % bs ) );
+	if( sparEqual( matrix->blockData[n][i], matrix->def ) )
+	{
+		return -1;
+	}
+	return offset[n] + i;
+}
+
+// Connect block (x,y,z) with its neighbour block across the lower face along axis (0 x, 1 y, 2 z)
+void sparLabelFace( spar *matrix, int *offset, int *parent, int x, int y, int z, int axis )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Neighbour block
+	int x2, y2, z2;
+	x2 = x - ( axis == 0 );
+	y2 = y - ( axis == 1 );
+	z2 = z - ( axis == 2 );
+
+	// Linear block indices
+	int n, n2;
+	n = x + matrix->mx * ( y + matrix->my * z );
+	n2 = x2 + matrix->mx * ( y2 + matrix->my * z2 );
+
+	// Any default uniform block, nothing to connect
+	if( offset[n] < 0 || offset[n2] < 0 )
+	{
+		return;
+	}
+
+	// Both uniform, one connection
+	if( matrix->blockData[n] == NULL && matrix->blockData[n2] == NULL )
+	{
+		sparLabelUnion( parent, offset[n], offset[n2] );
+		return;
+	}
+
+	// Block extent inside the matrix
+	int ex, ey, ez;
+	ex = matrix->nx - x * bs;
+	ey = matrix->ny - y * bs;
+	ez = matrix->nz - z * bs;
+	if( ex > bs ) ex = bs;
+	if( ey > bs ) ey = bs;
+	if( ez > bs ) ez = bs;
+
+	// Face elements
+	int a, b, na, nb;
+	na = axis == 0 ? ey : ex;
+	nb = axis == 2 ? ey : ez;
+	for( b = 0 ; b < nb ; b++ )
+	{
+		for( a = 0 ; a < na ; a++ )
+		{
+			// Element (i,j,k) on the face and its neighbour
+			int i, j, k, node, node2;
+			i = x * bs + ( axis == 0 ? 0 : a );
+			j = y * bs + ( axis == 0 ? a : ( axis == 1 ? 0 : b ) );
+			k = z * bs + ( axis == 2 ? 0 : b );
+
+			node = sparLabelNode( matrix, offset, i, j, k );
+			if( node < 0 )
+			{
+				continue;
+			}
+			node2 = sparLabelNode( matrix, offset, i - ( axis == 0 ), j - ( axis == 1 ), k - ( axis == 2 ) );
+			if( node2 < 0 )
+			{
+				continue;
+			}
+			sparLabelUnion( parent, node, node2 );
+		}
+	}
+}
+
+// Connect elements inside heterogeneous block (x,y,z)
+void sparLabelBlock( spar *matrix, int *offset, int *parent, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Linear block index (n) <-> (x,y,z)
+	int n;
+	n = x + matrix->mx * ( y + matrix->my * z );
+
+	sparType *blockData;
+	blockData = matrix->blockData[n];
+
+	// Uniform block is a single node
+	if( blockData == NULL )
+	{
+		return;
+	}
+
+	// Block extent inside the matrix
+	int ex, ey, ez;
+	ex = matrix->nx - x * bs;
+	ey = matrix->ny - y * bs;
+	ez = matrix->nz - z * bs;
+	if( ex > bs ) ex = bs;
+	if( ey > bs ) ey = bs;
+	if( ez > bs ) ez = bs;
+
+	// Connect each non-default element with its lower neighbours
+	sparType def;
+	def = matrix->def;
+
+	int i, j, k, e;
+	for( k = 0 ; k < ez ; k++ )
+	{
+		for( j = 0 ; j < ey ; j++ )
+		{
+			for( i = 0 ; i < ex ; i++ )
+			{
+				e = i + bs * ( j + bs * k );
+				if( sparEqual( blockData[e], def ) )
+				{
+					continue;
+				}
+				if( i > 0 && sparEqual( blockData[ e - 1 ], def ) == 0 )
+				{
+					sparLabelUnion( parent, offset[n] + e, offset[n] + e - 1 );
+				}
+				if( j > 0 && sparEqual( blockData[ e - bs ], def ) == 0 )
+				{
+					sparLabelUnion( parent, offset[n] + e, offset[n] + e - bs );
+				}
+				if( k > 0 && sparEqual( blockData[ e - bs * bs ], def ) == 0 )
+				{
+					sparLabelUnion( parent, offset[n] + e, offset[n] + e - bs * bs );
+				}
+			}
+		}
+	}
+}
+
+// Label 6-connected regions of non-default elements into labels (0 elsewhere), return number of regions
+int sparLabel( spar *matrix, sparInt *labels )
+{
+	// Check matrices
+	if( labels->nx != matrix->nx || labels->ny != matrix->ny || labels->nz != matrix->nz ||
+		labels->bs != matrix->bs )
+	{
+		fprintf(stderr, "sparLabel error: Matrix and block sizes must agree\n");
+		exit(1);
+	}
+
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Number of blocks
+	int blocks;
+	blocks = mx * my * mz;
+
+	// First node of each block: one for non-default uniform blocks, one per element for heterogeneous blocks
+	int *offset;
+	offset = (int*) malloc( blocks * sizeof(int) );
+
+	if( offset == NULL )
+	{
+	   fprintf(stderr, "sparLabel error: Out of memory\n");
+	   exit(1);
+	}
+
+	double nodes;
+	nodes = 0.0;
+
+	int n;
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		if( matrix->blockData[n] != NULL )
+		{
+			offset[n] = (int)( nodes );
+			nodes += bs3;
+		}
+		else if( sparEqual( matrix->blockValue[n], matrix->def ) == 0 )
+		{
+			offset[n] = (int)( nodes );
+			nodes += 1;
+		}
+		else
+		{
+			offset[n] = -1;
+		}
+	}
+
+	if( nodes > INT_MAX )
+	{
+		fprintf(stderr, "sparLabel error: Too many heterogeneous blocks\n");
+		exit(1);
+	}
+
+	// Union-find forest, -1 for unused nodes of default elements
+	int *parent;
+	parent = (int*) malloc( ( (int)( nodes ) + 1 ) * sizeof(int) );
+
+	if( parent == NULL )
+	{
+	   fprintf(stderr, "sparLabel error: Out of memory\n");
+	   exit(1);
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		if( offset[n] < 0 )
+		{
+			continue;
+		}
+
+		sparType *blockData;
+		blockData = matrix->blockData[n];
+
+		if( blockData == NULL )
+		{
+			parent[ offset[n] ] = offset[n];
+			continue;
+		}
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - ( n % mx ) * bs;
+		ey = matrix->ny - ( ( n / mx ) % my ) * bs;
+		ez = matrix->nz - ( n / ( mx * my ) ) * bs;
+
+		int i, j, k, e;
+		for( k = 0 ; k < bs ; k++ )
+		{
+			for( j = 0 ; j < bs ; j++ )
+			{
+				for( i = 0 ; i < bs ; i++ )
+				{
+					e = i + bs * ( j + bs * k );
+					if( i < ex && j < ey && k < ez && sparEqual( blockData[e], matrix->def ) == 0 )
+					{
+						parent[ offset[n] + e ] = offset[n] + e;
+					}
+					else
+					{
+						parent[ offset[n] + e ] = -1;
+					}
+				}
+			}
+		}
+	}
+
+	// Connect blocks within slabs of block layers in parallel, slabs hold disjoint node ranges
+	int slab, slabs;
+	slab = 8;
+	slabs = ( mz + slab - 1 ) / slab;
+
+	int s;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(dynamic)
+	#endif
+	for( s = 0 ; s < slabs ; s++ )
+	{
+		int i1, j1, k1;
+		for( k1 = s * slab ; k1 < ( s + 1 ) * slab && k1 < mz ; k1++ )
+		{
+			for( j1 = 0 ; j1 < my ; j1++ )
+			{
+				for( i1 = 0 ; i1 < mx ; i1++ )
+				{
+					sparLabelBlock( matrix, offset, parent, i1, j1, k1 );
+					if( i1 > 0 )
+					{
+						sparLabelFace( matrix, offset, parent, i1, j1, k1, 0 );
+					}
+					if( j1 > 0 )
+					{
+						sparLabelFace( matrix, offset, parent, i1, j1, k1, 1 );
+					}
+					if( k1 > s * slab )
+					{
+						sparLabelFace( matrix, offset, parent, i1, j1, k1, 2 );
+					}
+				}
+			}
+		}
+	}
+
+	// Merge slabs across their boundary layers
+	int i1, j1;
+	for( s = 1 ; s < slabs ; s++ )
+	{
+		for( j1 = 0 ; j1 < my ; j1++ )
+		{
+			for( i1 = 0 ; i1 < mx ; i1++ )
+			{
+				sparLabelFace( matrix, offset, parent, i1, j1, s * slab, 2 );
+			}
+		}
+	}
+
+	// Consecutive labels from 1, roots are the smallest node of each set and parents precede children
+	int count;
+	count = 0;
+
+	int i;
+	for( i = 0 ; i < (int)( nodes ) ; i++ )
+	{
+		if( parent[i] == i )
+		{
+			parent[i] = ++count;
+		}
+		else if( parent[i] >= 0 )
+		{
+			parent[i] = parent[ parent[i] ];
+		}
+	}
+
+	// Write labels
+	labels->def = 0;
+
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		// Free previous labels
+		if( labels->blockData[n] != NULL )
+		{
+			free(labels->blockData[n]);
+			labels->blockData[n] = NULL;
+		}
+
+		// Default uniform block
+		if( offset[n] < 0 )
+		{
+			labels->blockValue[n] = 0;
+		}
+		// Non-default uniform block
+		else if( matrix->blockData[n] == NULL )
+		{
+			labels->blockValue[n] = parent[ offset[n] ];
+		}
+		// Heterogeneous block
+		else
+		{
+			int *blockData;
+			blockData = (int*) calloc( bs3, sizeof(int) );
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparLabel error: Out of memory\n");
+			   exit(1);
+			}
+
+			int e;
+			for( e = 0 ; e < bs3 ; e++ )
+			{
+				blockData[e] = parent[ offset[n] + e ] < 0 ? 0 : parent[ offset[n] + e ];
+			}
+
+			labels->blockData[n] = blockData;
+			sparIntReduceBlock( labels, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
+	}
+
+	free(offset);
+	free(parent);
+
+	return count;
+}
+
+// Squared distance transform of sampled function f into d (Felzenszwalb), v and z hold n and n+1 elements
+void sparDistanceLine( double *f, double *d, int n, int *v, double *z )
+{
+	int q, k;
+	double s;
+
+	// Lower envelope of parabolas rooted at (q,f[q])
+	k = 0;
+	v[0] = 0;
+	z[0] = -HUGE_VAL;
+	z[1] = HUGE_VAL;
+	for( q = 1 ; q < n ; q++ )
+	{
+		s = ( ( f[q] + (double)q * q ) - ( f[ v[k] ] + (double)v[k] * v[k] ) ) / ( 2.0 * ( q - v[k] ) );
+		while( s <= z[k] )
+		{
+			k--;
+			s = ( ( f[q] + (double)q * q ) - ( f[ v[k] ] + (double)v[k] * v[k] ) ) / ( 2.0 * ( q - v[k] ) );
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[ k + 1 ] = HUGE_VAL;
+	}
+
+	// Sample the envelope
+	k = 0;
+	for( q = 0 ; q < n ; q++ )
+	{
+		while( z[ k + 1 ] < q )
+		{
+			k++;
+		}
+		d[q] = (double)( q - v[k] ) * ( q - v[k] ) + f[ v[k] ];
+	}
+}
+
+// Squared distance pass along axis (0 x, 1 y, 2 z) in place, or from features of matrix if not NULL (default elements if inside)
+void sparDistanceAxis( spar *matrix, sparFloat *distance, int axis, float big, int inside )
+{
+	// Distance block size
+	int bs;
+	bs = distance->bs;
+
+	// Line length and number of block rows along the other two axes
+	int nl, ma, mb;
+	nl = axis == 0 ? distance->nx : ( axis == 1 ? distance->ny : distance->nz );
+	ma = axis == 0 ? distance->my : distance->mx;
+	mb = axis == 2 ? distance->my : distance->mz;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Row of blocks and one line
+		float *box;
+		sparType *source;
+		double *f, *d, *z;
+		int *v;
+		box = (float*) malloc( nl * bs * bs * sizeof(float) );
+		source = (sparType*) malloc( nl * bs * bs * sizeof(sparType) );
+		f = (double*) malloc( nl * sizeof(double) );
+		d = (double*) malloc( nl * sizeof(double) );
+		z = (double*) malloc( ( nl + 1 ) * sizeof(double) );
+		v = (int*) malloc( nl * sizeof(int) );
+
+		if( box == NULL || source == NULL || f == NULL || d == NULL || z == NULL || v == NULL )
+		{
+		   fprintf(stderr, "sparDistanceAxis error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each row of blocks along the axis, lines are independent
+		int g;
+		#ifdef _OPENMP
+		#pragma omp for schedule(dynamic)
+		#endif
+		for( g = 0 ; g < ma * mb ; g++ )
+		{
+			// Box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) inside the matrix
+			int x, y, zz, sx, sy, sz;
+			x = axis == 0 ? 0 : ( g % ma ) * bs;
+			y = axis == 1 ? 0 : ( axis == 0 ? ( g % ma ) * bs : ( g / ma ) * bs );
+			zz = axis == 2 ? 0 : ( g / ma ) * bs;
+			sx = axis == 0 ? distance->nx : ( distance->nx - x < bs ? distance->nx - x : bs );
+			sy = axis == 1 ? distance->ny : ( distance->ny - y < bs ? distance->ny - y : bs );
+			sz = axis == 2 ? distance->nz : ( distance->nz - zz < bs ? distance->nz - zz : bs );
+
+			int i;
+
+			// First pass, features of matrix
+			if( matrix != NULL )
+			{
+				sparType value;
+				if( sparUniformBox( matrix, x, y, zz, sx, sy, sz, &value ) )
+				{
+					sparFloatFillBox( distance, x, y, zz, sx, sy, sz,
+									  ( ( sparEqual( value, matrix->def ) == 0 ) != inside ) ? 0.0f : big );
+					continue;
+				}
+				sparGetBox( matrix, x, y, zz, sx, sy, sz, source );
+				for( i = 0 ; i < sx * sy * sz ; i++ )
+				{
+					box[i] = ( ( sparEqual( source[i], matrix->def ) == 0 ) != inside ) ? 0.0f : big;
+				}
+			}
+			// Next passes, constant lines are left unchanged
+			else
+			{
+				float value;
+				if( sparFloatUniformBox( distance, x, y, zz, sx, sy, sz, &value ) )
+				{
+					continue;
+				}
+				sparFloatGetBox( distance, x, y, zz, sx, sy, sz, box );
+			}
+
+			// Line stride and number of lines
+			int stride, lines;
+			stride = axis == 0 ? 1 : ( axis == 1 ? sx : sx * sy );
+			lines = sx * sy * sz / nl;
+
+			// For each line
+			int l;
+			for( l = 0 ; l < lines ; l++ )
+			{
+				// First line element
+				float *line;
+				if( axis == 0 )
+				{
+					line = box + nl * l;
+				}
+				else if( axis == 1 )
+				{
+					line = box + ( l % sx ) + sx * sy * ( l / sx );
+				}
+				else
+				{
+					line = box + l;
+				}
+
+				for( i = 0 ; i < nl ; i++ )
+				{
+					f[i] = line[ i * stride ];
+				}
+
+				sparDistanceLine( f, d, nl, v, z );
+
+				// Clamp at big
+				for( i = 0 ; i < nl ; i++ )
+				{
+					line[ i * stride ] = d[i] < big ? (float)( d[i] ) : big;
+				}
+			}
+
+			sparFloatSetBox( distance, x, y, zz, sx, sy, sz, box );
+		}
+
+		free(box);
+		free(source);
+		free(f);
+		free(d);
+		free(z);
+		free(v);
+	}
+}
+
+// Euclidean distance from each element to the nearest non-default element clamped at maxDistance, negative inside if sign
+void sparDistance( spar *matrix, sparFloat *distance, float maxDistance, int sign )
+{
+	// Check matrices
+	if( distance->nx != matrix->nx || distance->ny != matrix->ny || distance->nz != matrix->nz )
+	{
+		fprintf(stderr, "sparDistance error: Matrix sizes must agree\n");
+		exit(1);
+	}
+
+	if( !( maxDistance > 0.0f ) )
+	{
+		fprintf(stderr, "sparDistance error: Maximum distance must be positive\n");
+		exit(1);
+	}
+
+	// Squared distances are clamped, far regions become uniform
+	float big;
+	big = maxDistance * maxDistance;
+
+	// Squared distance to non-default elements
+	sparDistanceAxis( matrix, distance, 0, big, 0 );
+	sparDistanceAxis( NULL, distance, 1, big, 0 );
+	sparDistanceAxis( NULL, distance, 2, big, 0 );
+
+	// Squared distance to default elements
+	sparFloat *inner;
+	inner = NULL;
+	if( sign )
+	{
+		inner = sparFloatInit( distance->nx, distance->ny, distance->nz, distance->bs, big );
+		sparDistanceAxis( matrix, inner, 0, big, 1 );
+		sparDistanceAxis( NULL, inner, 1, big, 1 );
+		sparDistanceAxis( NULL, inner, 2, big, 1 );
+	}
+
+	// Distance, outer minus inner if signed
+	int mx, my, mz;
+	mx = distance->mx;
+	my = distance->my;
+	mz = distance->mz;
+
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		float *blockData, *innerData, innerValue;
+		blockData = distance->blockData[n];
+		innerData = inner == NULL ? NULL : inner->blockData[n];
+		innerValue = inner == NULL ? 0.0f : inner->blockValue[n];
+
+		// Uniform blocks
+		if( blockData == NULL && innerData == NULL )
+		{
+			distance->blockValue[n] = sqrtf( distance->blockValue[n] ) - sqrtf( innerValue );
+			continue;
+		}
+
+		// Heterogeneous blocks
+		sparFloatExpandBlock( distance, i1, j1, k1 );
+		blockData = distance->blockData[n];
+
+		int i;
+		for( i = 0 ; i < distance->bs3 ; i++ )
+		{
+			blockData[i] = sqrtf( blockData[i] ) - sqrtf( innerData == NULL ? innerValue : innerData[i] );
+		}
+
+		sparFloatReduceBlock( distance, i1, j1, k1 );
+	}
+
+	distance->def = maxDistance;
+
+	if( inner != NULL )
+	{
+		sparFloatFree( inner );
+	}
+}
+
+// Cast ray o+t*d (element (x,y,z) spans [x,x+1)) for 0 <= t <= tmax, return 1 with first non-default element hit[3] at t
+int sparRay( spar *matrix, double *o, double *d, double tmax, int *hit, double *t )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Matrix size
+	int size[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+
+	// Clip ray to the matrix bounds
+	double t0, t1;
+	t0 = 0.0;
+	t1 = tmax;
+
+	int a;
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		if( d[a] == 0.0 )
+		{
+			if( o[a] < 0.0 || o[a] >= size[a] )
+			{
+				return 0;
+			}
+		}
+		else
+		{
+			double ta, tb;
+			ta = ( 0.0 - o[a] ) / d[a];
+			tb = ( size[a] - o[a] ) / d[a];
+			if( ta > tb )
+			{
+				double tc;
+				tc = ta;
+				ta = tb;
+				tb = tc;
+			}
+			t0 = ta > t0 ? ta : t0;
+			t1 = tb < t1 ? tb : t1;
+		}
+	}
+
+	if( t0 > t1 )
+	{
+		return 0;
+	}
+
+	// Entry element, step direction, next element boundary and boundary spacing per axis
+	int v[3], step[3];
+	double tnext[3], tdelta[3];
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		v[a] = (int)( floor( o[a] + t0 * d[a] ) );
+		v[a] = v[a] < 0 ? 0 : ( v[a] >= size[a] ? size[a] - 1 : v[a] );
+		step[a] = d[a] > 0.0 ? 1 : -1;
+		tdelta[a] = d[a] == 0.0 ? HUGE_VAL : fabs( 1.0 / d[a] );
+		tnext[a] = d[a] == 0.0 ? HUGE_VAL : ( v[a] + ( step[a] > 0 ) - o[a] ) / d[a];
+	}
+
+	double tc;
+	tc = t0;
+
+	while( tc <= t1 )
+	{
+		// Linear block index (n) of element v
+		int b[3], n;
+		b[0] = v[0] / bs;
+		b[1] = v[1] / bs;
+		b[2] = v[2] / bs;
+		n = b[0] + matrix->mx * ( b[1] + matrix->my * b[2] );
+
+		// Uniform block
+		if( matrix->blockData[n] == NULL )
+		{
+			// Hit on entry
+			if( sparEqual( matrix->blockValue[n], matrix->def ) == 0 )
+			{
+				break;
+			}
+
+			// Skip to the block exit
+			int amin;
+			double tb[3];
+			amin = 0;
+			for( a = 0 ; a < 3 ; a++ )
+			{
+				tb[a] = d[a] == 0.0 ? HUGE_VAL : ( ( b[a] + ( step[a] > 0 ) ) * bs - o[a] ) / d[a];
+				if( tb[a] < tb[amin] )
+				{
+					amin = a;
+				}
+			}
+			tc = tb[amin];
+
+			// Element of the next block, stay inside the current block on the other axes
+			for( a = 0 ; a < 3 ; a++ )
+			{
+				if( a == amin )
+				{
+					v[a] = step[a] > 0 ? ( b[a] + 1 ) * bs : b[a] * bs - 1;
+				}
+				else
+				{
+					v[a] = (int)( floor( o[a] + tc * d[a] ) );
+					v[a] = v[a] < b[a] * bs ? b[a] * bs : ( v[a] >= ( b[a] + 1 ) * bs ? ( b[a] + 1 ) * bs - 1 : v[a] );
+				}
+				tnext[a] = d[a] == 0.0 ? HUGE_VAL : ( v[a] + ( step[a] > 0 ) - o[a] ) / d[a];
+			}
+		}
+		// Heterogeneous block, element by element
+		else
+		{
+			// Hit
+			int i;
+			i = v[0] % bs + bs * ( v[1] % bs + bs * ( v[2] % bs ) );
+			if( sparEqual( matrix->blockData[n][i], matrix->def ) == 0 )
+			{
+				break;
+			}
+
+			// Step to the next element
+			int amin;
+			amin = 0;
+			for( a = 1 ; a < 3 ; a++ )
+			{
+				if( tnext[a] < tnext[amin] )
+				{
+					amin = a;
+				}
+			}
+			tc = tnext[amin];
+			v[amin] += step[amin];
+			tnext[amin] += tdelta[amin];
+		}
+
+		// Left the matrix
+		if( v[0] < 0 || v[1] < 0 || v[2] < 0 || v[0] >= size[0] || v[1] >= size[1] || v[2] >= size[2] )
+		{
+			return 0;
+		}
+	}
+
+	// Beyond tmax or matrix exit
+	if( tc > t1 )
+	{
+		return 0;
+	}
+
+	hit[0] = v[0];
+	hit[1] = v[1];
+	hit[2] = v[2];
+	*t = tc;
+
+	return 1;
+}
+
+// Cast n rays o[3*i]+t*d[3*i] in parallel, hits[3*i] and t[i] (-1 if missed), return number of hits
+int sparRays( spar *matrix, int n, double *o, double *d, double tmax, int *hits, double *t )
+{
+	int count;
+	count = 0;
+
+	int i;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:count) schedule(guided)
+	#endif
+	for( i = 0 ; i < n ; i++ )
+	{
+		if( sparRay( matrix, o + 3 * i, d + 3 * i, tmax, hits + 3 * i, t + i ) )
+		{
+			count++;
+		}
+		else
+		{
+			t[i] = -1.0;
+		}
+	}
+
+	return count;
+}
+
+// Copy plane at index along axis into buffer, YZ (axis 0) y+ny*z, XZ (axis 1) x+nx*z, XY (axis 2) x+nx*y
+void sparSlice( spar *matrix, int axis, int index, sparType *buffer )
+{
+	// Matrix size
+	int nx, ny, nz;
+	nx = matrix->nx;
+	ny = matrix->ny;
+	nz = matrix->nz;
+
+	// Check plane
+	if( axis < 0 || axis > 2 || index < 0 ||
+		index >= ( axis == 0 ? nx : ( axis == 1 ? ny : nz ) ) )
+	{
+		fprintf(stderr, "sparSlice error: Plane outside the matrix\n");
+		exit(1);
+	}
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Block layer and element layer in the block
+	int b1, b2;
+	b1 = index / bs;
+	b2 = index % bs;
+
+	// XY plane, contiguous block rows
+	if( axis == 2 )
+	{
+		int j1;
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(guided)
+		#endif
+		for( j1 = 0 ; j1 < my ; j1++ )
+		{
+			int i1, i, j, ex, ey, n;
+			ey = ny - j1 * bs < bs ? ny - j1 * bs : bs;
+			for( i1 = 0 ; i1 < mx ; i1++ )
+			{
+				ex = nx - i1 * bs < bs ? nx - i1 * bs : bs;
+				n = i1 + mx * ( j1 + my * b1 );
+				for( j = 0 ; j < ey ; j++ )
+				{
+					sparType *row;
+					row = buffer + i1 * bs + nx * ( j1 * bs + j );
+
+					// Uniform block
+					if( matrix->blockData[n] == NULL )
+					{
+						for( i = 0 ; i < ex ; i++ )
+						{
+							row[i] = matrix->blockValue[n];
+						}
+					}
+					// Heterogeneous block
+					else
+					{
+						memcpy( row, matrix->blockData[n] + bs * ( j + bs * b2 ), ex * sizeof(sparType) );
+					}
+				}
+			}
+		}
+	}
+	// XZ plane, contiguous block rows
+	else if( axis == 1 )
+	{
+		int k1;
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(guided)
+		#endif
+		for( k1 = 0 ; k1 < mz ; k1++ )
+		{
+			int i1, i, k, ex, ez, n;
+			ez = nz - k1 * bs < bs ? nz - k1 * bs : bs;
+			for( i1 = 0 ; i1 < mx ; i1++ )
+			{
+				ex = nx - i1 * bs < bs ? nx - i1 * bs : bs;
+				n = i1 + mx * ( b1 + my * k1 );
+				for( k = 0 ; k < ez ; k++ )
+				{
+					sparType *row;
+					row = buffer + i1 * bs + nx * ( k1 * bs + k );
+
+					// Uniform block
+					if( matrix->blockData[n] == NULL )
+					{
+						for( i = 0 ; i < ex ; i++ )
+						{
+							row[i] = matrix->blockValue[n];
+						}
+					}
+					// Heterogeneous block
+					else
+					{
+						memcpy( row, matrix->blockData[n] + bs * ( b2 + bs * k ), ex * sizeof(sparType) );
+					}
+				}
+			}
+		}
+	}
+	// YZ plane, block elements are strided by bs
+	else
+	{
+		int k1;
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(guided)
+		#endif
+		for( k1 = 0 ; k1 < mz ; k1++ )
+		{
+			int j1, j, k, ey, ez, n;
+			ez = nz - k1 * bs < bs ? nz - k1 * bs : bs;
+			for( j1 = 0 ; j1 < my ; j1++ )
+			{
+				ey = ny - j1 * bs < bs ? ny - j1 * bs : bs;
+				n = b1 + mx * ( j1 + my * k1 );
+				for( k = 0 ; k < ez ; k++ )
+				{
+					sparType *row;
+					row = buffer + j1 * bs + ny * ( k1 * bs + k );
+
+					// Uniform block
+					if( matrix->blockData[n] == NULL )
+					{
+						for( j = 0 ; j < ey ; j++ )
+						{
+							row[j] = matrix->blockValue[n];
+						}
+					}
+					// Heterogeneous block, gather column of the block
+					else
+					{
+						sparType *column;
+						column = matrix->blockData[n] + b2 + bs * bs * k;
+						for( j = 0 ; j < ey ; j++ )
+						{
+							row[j] = column[ bs * j ];
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// Accumulate value, repeated count times, into o[0..n-1] with op (projection kernel)
+void sparProjectValue( double *o, int n, sparType value, int count, int op, sparType def )
+{
+	int i;
+	switch( op )
+	{
+		case SPAR_ADD:
+			for( i = 0 ; i < n ; i++ )
+			{
+				o[i] += (double)( value ) * count;
+			}
+			break;
+		case SPAR_MIN:
+			for( i = 0 ; i < n ; i++ )
+			{
+				o[i] = value < o[i] ? value : o[i];
+			}
+			break;
+		case SPAR_MAX:
+			for( i = 0 ; i < n ; i++ )
+			{
+				o[i] = value > o[i] ? value : o[i];
+			}
+			break;
+		case SPAR_COUNT:
+			if( sparEqual( value, def ) == 0 )
+			{
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] += count;
+				}
+			}
+			break;
+	}
+}
+
+// Accumulate row[0..n-1] into o[0..n-1], or into o[0] if reduce, with op (projection kernel)
+void sparProjectRow( double *o, sparType *row, int n, int op, int reduce, sparType def )
+{
+	int i;
+
+	// Row along the projection axis
+	if( reduce )
+	{
+		double value;
+		value = o[0];
+		switch( op )
+		{
+			case SPAR_ADD:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value += row[i];
+				}
+				break;
+			case SPAR_MIN:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value = row[i] < value ? row[i] : value;
+				}
+				break;
+			case SPAR_MAX:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value = row[i] > value ? row[i] : value;
+				}
+				break;
+			case SPAR_COUNT:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value += ( sparEqual( row[i], def ) == 0 );
+				}
+				break;
+		}
+		o[0] = value;
+	}
+	// Row across the projection axis
+	else
+	{
+		switch( op )
+		{
+			case SPAR_ADD:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] += row[i];
+				}
+				break;
+			case SPAR_MIN:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] = row[i] < o[i] ? row[i] : o[i];
+				}
+				break;
+			case SPAR_MAX:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] = row[i] > o[i] ? row[i] : o[i];
+				}
+				break;
+			case SPAR_COUNT:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] += ( sparEqual( row[i], def ) == 0 );
+				}
+				break;
+		}
+	}
+}
+
+// Project along axis with op (SPAR_ADD, SPAR_MIN, SPAR_MAX, SPAR_COUNT) into dense plane, same layout as slices
+void sparProject( spar *matrix, int axis, int op, double *buffer )
+{
+	// Check axis and operation
+	if( axis < 0 || axis > 2 )
+	{
+		fprintf(stderr, "sparProject error: Invalid axis\n");
+		exit(1);
+	}
+
+	if( op != SPAR_ADD && op != SPAR_MIN && op != SPAR_MAX && op != SPAR_COUNT )
+	{
+		fprintf(stderr, "sparProject error: Unknown operation\n");
+		exit(1);
+	}
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Matrix size (nx,ny,nz)
+	int nx, ny, nz;
+	nx = matrix->nx;
+	ny = matrix->ny;
+	nz = matrix->nz;
+
+	// Plane size (pa,pb), plane and axis block sizes (ma,mb,mc)
+	int pa, pb, ma, mb, mc;
+	pa = axis == 0 ? ny : nx;
+	pb = axis == 2 ? ny : nz;
+	ma = axis == 0 ? matrix->my : matrix->mx;
+	mb = axis == 2 ? matrix->my : matrix->mz;
+	mc = axis == 0 ? matrix->mx : ( axis == 1 ? matrix->my : matrix->mz );
+
+	// Initial values
+	int i;
+	for( i = 0 ; i < pa * pb ; i++ )
+	{
+		buffer[i] = op == SPAR_MIN ? HUGE_VAL : ( op == SPAR_MAX ? -HUGE_VAL : 0.0 );
+	}
+
+	// For each output tile
+	int t;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( t = 0 ; t < ma * mb ; t++ )
+	{
+		int a1, b1, c1;
+		a1 = t % ma;
+		b1 = t / ma;
+
+		// Tile extent
+		int ea, eb;
+		ea = pa - a1 * bs < bs ? pa - a1 * bs : bs;
+		eb = pb - b1 * bs < bs ? pb - b1 * bs : bs;
+
+		// For each block along the axis
+		for( c1 = 0 ; c1 < mc ; c1++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = axis == 0 ? c1 : a1;
+			j1 = axis == 0 ? a1 : ( axis == 1 ? c1 : b1 );
+			k1 = axis == 2 ? c1 : b1;
+
+			// Linear block index (n) <-> (i1,j1,k1)
+			int n;
+			n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = nx - i1 * bs < bs ? nx - i1 * bs : bs;
+			ey = ny - j1 * bs < bs ? ny - j1 * bs : bs;
+			ez = nz - k1 * bs < bs ? nz - k1 * bs : bs;
+
+			int b, j, k;
+
+			// Uniform block, whole column of elements at once
+			if( matrix->blockData[n] == NULL )
+			{
+				for( b = 0 ; b < eb ; b++ )
+				{
+					sparProjectValue( buffer + a1 * bs + pa * ( b1 * bs + b ), ea, matrix->blockValue[n],
+									  axis == 0 ? ex : ( axis == 1 ? ey : ez ), op, matrix->def );
+				}
+			}
+			// Heterogeneous block, row by row
+			else
+			{
+				for( k = 0 ; k < ez ; k++ )
+				{
+					for( j = 0 ; j < ey ; j++ )
+					{
+						sparType *row;
+						row = matrix->blockData[n] + bs * ( j + bs * k );
+						if( axis == 0 )
+						{
+							sparProjectRow( buffer + ( j1 * bs + j ) + pa * ( k1 * bs + k ), row, ex, op, 1, matrix->def );
+						}
+						else if( axis == 1 )
+						{
+							sparProjectRow( buffer + i1 * bs + pa * ( k1 * bs + k ), row, ex, op, 0, matrix->def );
+						}
+						else
+						{
+							sparProjectRow( buffer + i1 * bs + pa * ( j1 * bs + j ), row, ex, op, 0, matrix->def );
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// Order of two elements for qsort, NaN last
+int sparCompare( const void *a, const void *b )
+{
+	sparType va, vb;
+	va = *(const sparType*) a;
+	vb = *(const sparType*) b;
+
+	// NaN after any number
+	if( isnan( (double) va ) || isnan( (double) vb ) )
+	{
+		return ( isnan( (double) va ) != 0 ) - ( isnan( (double) vb ) != 0 );
+	}
+
+	return ( va > vb ) - ( va < vb );
+}
+
+// Recompute blocks of dst overlapping box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) from factor^3 cells of src, op SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE
+void sparDownsampleBox( spar *dst, spar *src, int factor, int op, int x, int y, int z, int sx, int sy, int sz )
+{
+	// Check matrices
+	if( factor < 1 || dst->nx != ( src->nx + factor - 1 ) / factor ||
+		dst->ny != ( src->ny + factor - 1 ) / factor || dst->nz != ( src->nz + factor - 1 ) / factor )
+	{
+		fprintf(stderr, "sparDownsampleBox error: Matrix sizes do not match the factor\n");
+		exit(1);
+	}
+
+	if( op != SPAR_MEAN && op != SPAR_MIN && op != SPAR_MAX && op != SPAR_MODE )
+	{
+		fprintf(stderr, "sparDownsampleBox error: Unknown operation\n");
+		exit(1);
+	}
+
+	// Clip box to dst
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > dst->nx ? dst->nx : x + sx;
+	y1 = y + sy > dst->ny ? dst->ny : y + sy;
+	z1 = z + sz > dst->nz ? dst->nz : z + sz;
+
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	// Destination block size
+	int bs, bs3;
+	bs = dst->bs;
+	bs3 = dst->bs3;
+
+	// Source box size of one destination block
+	int cs;
+	cs = bs * factor;
+
+	// Range of destination blocks
+	int bx, by, bz, cx, cy, cz;
+	bx = x0 / bs;
+	by = y0 / bs;
+	bz = z0 / bs;
+	cx = ( x1 - 1 ) / bs - bx + 1;
+	cy = ( y1 - 1 ) / bs - by + 1;
+	cz = ( z1 - 1 ) / bs - bz + 1;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Source elements of one destination block and of one cell
+		sparType *buffer, *cell;
+		buffer = (sparType*) malloc( cs * cs * cs * sizeof(sparType) );
+		cell = (sparType*) malloc( factor * factor * factor * sizeof(sparType) );
+
+		if( buffer == NULL || cell == NULL )
+		{
+		   fprintf(stderr, "sparDownsampleBox error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each destination block
+		int t;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( t = 0 ; t < cx * cy * cz ; t++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = bx + t % cx;
+			j1 = by + ( t / cx ) % cy;
+			k1 = bz + t / ( cx * cy );
+
+			// Linear block index (n) <-> (i1,j1,k1)
+			int n;
+			n = i1 + dst->mx * ( j1 + dst->my * k1 );
+
+			// Free previous data
+			if( dst->blockData[n] != NULL )
+			{
+				free(dst->blockData[n]);
+				dst->blockData[n] = NULL;
+			}
+
+			// Uniform source region, uniform destination block
+			sparType value;
+			if( sparUniformBox( src, i1 * cs, j1 * cs, k1 * cs, cs, cs, cs, &value ) )
+			{
+				dst->blockValue[n] = value;
+				continue;
+			}
+
+			// Read source region
+			sparGetBox( src, i1 * cs, j1 * cs, k1 * cs, cs, cs, cs, buffer );
+
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = dst->nx - i1 * bs < bs ? dst->nx - i1 * bs : bs;
+			ey = dst->ny - j1 * bs < bs ? dst->ny - j1 * bs : bs;
+			ez = dst->nz - k1 * bs < bs ? dst->nz - k1 * bs : bs;
+
+			sparType *blockData;
+			blockData = (sparType*) calloc( bs3, sizeof(sparType) );
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparDownsampleBox error: Out of memory\n");
+			   exit(1);
+			}
+
+			// For each destination element
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					for( i = 0 ; i < ex ; i++ )
+					{
+						// Cell extent inside the source matrix
+						int fx, fy, fz;
+						fx = src->nx - ( i1 * bs + i ) * factor < factor ? src->nx - ( i1 * bs + i ) * factor : factor;
+						fy = src->ny - ( j1 * bs + j ) * factor < factor ? src->ny - ( j1 * bs + j ) * factor : factor;
+						fz = src->nz - ( k1 * bs + k ) * factor < factor ? src->nz - ( k1 * bs + k ) * factor : factor;
+
+						// Reduce cell, one tight loop per operation
+						int a, b, c, m;
+						int best, run;
+						double sum;
+						sparType *row, *r;
+						row = buffer + i * factor + cs * ( j * factor + cs * k * factor );
+						value = row[0];
+						switch( op )
+						{
+							case SPAR_MEAN:
+								sum = 0.0;
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											sum += r[a];
+										}
+									}
+								}
+								value = sparRound( sum / ( fx * fy * fz ) );
+								break;
+							case SPAR_MIN:
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											value = r[a] < value ? r[a] : value;
+										}
+									}
+								}
+								break;
+							case SPAR_MAX:
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											value = r[a] > value ? r[a] : value;
+										}
+									}
+								}
+								break;
+							case SPAR_MODE:
+								// Gather cell
+								m = 0;
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											cell[ m + a ] = r[a];
+										}
+										m += fx;
+									}
+								}
+
+								// Longest run of sorted values
+								qsort( cell, m, sizeof(sparType), sparCompare );
+								value = cell[0];
+								best = 0;
+								run = 0;
+								for( a = 0 ; a < m ; a++ )
+								{
+									run = ( a > 0 && sparEqual( cell[a], cell[ a - 1 ] ) ) ? run + 1 : 1;
+									if( run > best )
+									{
+										best = run;
+										value = cell[a];
+									}
+								}
+								break;
+						}
+
+						blockData[ i + bs * ( j + bs * k ) ] = value;
+					}
+				}
+			}
+
+			// Write block and reduce if possible
+			dst->blockData[n] = blockData;
+			sparReduceBlock( dst, i1, j1, k1 );
+		}
+
+		free(buffer);
+		free(cell);
+	}
+}
+
+// New matrix downsampled by factor with op (SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE)
+spar* sparDownsample( spar *matrix, int factor, int op )
+{
+	if( factor < 1 )
+	{
+		fprintf(stderr, "sparDownsample error: Factor must be positive\n");
+		exit(1);
+	}
+
+	// Declare matrix and init
+	spar *matrix2;
+	matrix2 = sparInit( ( matrix->nx + factor - 1 ) / factor, ( matrix->ny + factor - 1 ) / factor,
+						( matrix->nz + factor - 1 ) / factor, matrix->bs, matrix->def );
+
+	sparDownsampleBox( matrix2, matrix, factor, op, 0, 0, 0, matrix2->nx, matrix2->ny, matrix2->nz );
+
+	return matrix2;
+}
+
+// Pyramid of levels matrices downsampled by 2, 4, 8... with op (SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE)
+void sparPyramid( spar *matrix, int levels, int op, spar **pyramid )
+{
+	int l;
+	for( l = 0 ; l < levels ; l++ )
+	{
+		pyramid[l] = sparDownsample( l == 0 ? matrix : pyramid[ l - 1 ], 2, op );
+	}
+}
+
+// Update pyramid after changes of matrix in box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1)
+void sparPyramidUpdate( spar *matrix, int levels, int op, spar **pyramid, int x, int y, int z, int sx, int sy, int sz )
+{
+	int l;
+	for( l = 0 ; l < levels ; l++ )
+	{
+		// Affected box in the next level
+		int x1, y1, z1;
+		x1 = ( x + sx + 1 ) / 2;
+		y1 = ( y + sy + 1 ) / 2;
+		z1 = ( z + sz + 1 ) / 2;
+		x = x / 2;
+		y = y / 2;
+		z = z / 2;
+		sx = x1 - x;
+		sy = y1 - y;
+		sz = z1 - z;
+
+		sparDownsampleBox( pyramid[l], l == 0 ? matrix : pyramid[ l - 1 ], 2, op, x, y, z, sx, sy, sz );
+	}
+}
+
+// Trilinear interpolation at (x,y,z), element (i,j,k) at integer coordinates, clamped to the matrix bounds
+double sparSample( spar *matrix, double x, double y, double z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Matrix size
+	int size[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+
+	double p[3];
+	p[0] = x;
+	p[1] = y;
+	p[2] = z;
+
+	// Lower (v0) and upper (v1) corners and fractions per axis
+	int a, v0[3], v1[3];
+	double f[3];
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		double q;
+		q = p[a] < 0.0 ? 0.0 : ( p[a] > size[a] - 1 ? size[a] - 1 : p[a] );
+		v0[a] = (int)( floor( q ) );
+		v1[a] = v0[a] + 1 < size[a] ? v0[a] + 1 : v0[a];
+		f[a] = q - v0[a];
+	}
+
+	// Corner values
+	sparType c[8];
+
+	// All corners in one block
+	if( v0[0] / bs == v1[0] / bs && v0[1] / bs == v1[1] / bs && v0[2] / bs == v1[2] / bs )
+	{
+		// Linear block index (n)
+		int n;
+		n = v0[0] / bs + matrix->mx * ( v0[1] / bs + matrix->my * ( v0[2] / bs ) );
+
+		sparType *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block
+		if( blockData == NULL )
+		{
+			return (double) matrix->blockValue[n];
+		}
+
+		// Lower corner and steps in the block
+		int i, dx, dy, dz;
+		i = v0[0] % bs + bs * ( v0[1] % bs + bs * ( v0[2] % bs ) );
+		dx = v1[0] - v0[0];
+		dy = bs * ( v1[1] - v0[1] );
+		dz = bs * bs * ( v1[2] - v0[2] );
+
+		c[0] = blockData[i];
+		c[1] = blockData[ i + dx ];
+		c[2] = blockData[ i + dy ];
+		c[3] = blockData[ i + dx + dy ];
+		c[4] = blockData[ i + dz ];
+		c[5] = blockData[ i + dx + dz ];
+		c[6] = blockData[ i + dy + dz ];
+		c[7] = blockData[ i + dx + dy + dz ];
+	}
+	// Corners across blocks
+	else
+	{
+		c[0] = sparGet( matrix, v0[0], v0[1], v0[2] );
+		c[1] = sparGet( matrix, v1[0], v0[1], v0[2] );
+		c[2] = sparGet( matrix, v0[0], v1[1], v0[2] );
+		c[3] = sparGet( matrix, v1[0], v1[1], v0[2] );
+		c[4] = sparGet( matrix, v0[0], v0[1], v1[2] );
+		c[5] = sparGet( matrix, v1[0], v0[1], v1[2] );
+		c[6] = sparGet( matrix, v0[0], v1[1], v1[2] );
+		c[7] = sparGet( matrix, v1[0], v1[1], v1[2] );
+	}
+
+	// Interpolate along x, y and z
+	double c0, c1, c2, c3;
+	c0 = c[0] + f[0] * ( (double) c[1] - c[0] );
+	c1 = c[2] + f[0] * ( (double) c[3] - c[2] );
+	c2 = c[4] + f[0] * ( (double) c[5] - c[4] );
+	c3 = c[6] + f[0] * ( (double) c[7] - c[6] );
+	c0 = c0 + f[1] * ( c1 - c0 );
+	c2 = c2 + f[1] * ( c3 - c2 );
+
+	return c0 + f[2] * ( c2 - c0 );
+}
+
+// Trilinear interpolation at n points p[3*i] in parallel into values[i]
+void sparSamples( spar *matrix, int n, double *p, double *values )
+{
+	int i;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( i = 0 ; i < n ; i++ )
+	{
+		values[i] = sparSample( matrix, p[ 3 * i ], p[ 3 * i + 1 ], p[ 3 * i + 2 ] );
+	}
+}
+
+// Marching cubes triangle edges of cube case c (bit i set if corner i is above the iso value), return number of triangles
+int sparCubeTriangles( int c, int *edges )
+{
+	// Triangle edges per case, -1 terminated, counter-clockwise seen from below the iso value
+	static const signed char table[256][16] =
+	{
+		{ -1 },
+		{ 0, 3, 8, -1 },
+		{ 0, 9, 1, -1 },
+		{ 3, 8, 9, 1, 3, 9, -1 },
+		{ 1, 10, 2, -1 },
+		{ 0, 3, 8, 1, 10, 2, -1 },
+		{ 9, 10, 2, 0, 9, 2, -1 },
+		{ 8, 9, 10, 3, 8, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, -1 },
+		{ 2, 11, 8, 0, 2, 8, -1 },
+		{ 0, 9, 1, 2, 11, 3, -1 },
+		{ 11, 8, 9, 2, 11, 9, 1, 2, 9, -1 },
+		{ 10, 11, 3, 1, 10, 3, -1 },
+		{ 10, 11, 8, 1, 10, 8, 0, 1, 8, -1 },
+		{ 10, 11, 3, 9, 10, 3, 0, 9, 3, -1 },
+		{ 9, 10, 11, 8, 9, 11, -1 },
+		{ 4, 8, 7, -1 },
+		{ 3, 7, 4, 0, 3, 4, -1 },
+		{ 0, 9, 1, 4, 8, 7, -1 },
+		{ 7, 4, 9, 3, 7, 9, 1, 3, 9, -1 },
+		{ 1, 10, 2, 4, 8, 7, -1 },
+		{ 3, 7, 4, 0, 3, 4, 1, 10, 2, -1 },
+		{ 9, 10, 2, 0, 9, 2, 4, 8, 7, -1 },
+		{ 4, 9, 10, 7, 4, 10, 3, 7, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, 4, 8, 7, -1 },
+		{ 11, 7, 4, 2, 11, 4, 0, 2, 4, -1 },
+		{ 0, 9, 1, 2, 11, 3, 4, 8, 7, -1 },
+		{ 7, 4, 9, 11, 7, 9, 2, 11, 9, 1, 2, 9, -1 },
+		{ 10, 11, 3, 1, 10, 3, 4, 8, 7, -1 },
+		{ 11, 7, 4, 10, 11, 4, 1, 10, 4, 0, 1, 4, -1 },
+		{ 10, 11, 3, 9, 10, 3, 0, 9, 3, 4, 8, 7, -1 },
+		{ 10, 11, 7, 9, 10, 7, 4, 9, 7, -1 },
+		{ 4, 5, 9, -1 },
+		{ 0, 3, 8, 4, 5, 9, -1 },
+		{ 4, 5, 1, 0, 4, 1, -1 },
+		{ 8, 4, 5, 3, 8, 5, 1, 3, 5, -1 },
+		{ 1, 10, 2, 4, 5, 9, -1 },
+		{ 0, 3, 8, 1, 10, 2, 4, 5, 9, -1 },
+		{ 5, 10, 2, 4, 5, 2, 0, 4, 2, -1 },
+		{ 4, 5, 10, 8, 4, 10, 3, 8, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, 4, 5, 9, -1 },
+		{ 2, 11, 8, 0, 2, 8, 4, 5, 9, -1 },
+		{ 4, 5, 1, 0, 4, 1, 2, 11, 3, -1 },
+		{ 8, 4, 5, 11, 8, 5, 2, 11, 5, 1, 2, 5, -1 },
+		{ 10, 11, 3, 1, 10, 3, 4, 5, 9, -1 },
+		{ 10, 11, 8, 1, 10, 8, 0, 1, 8, 4, 5, 9, -1 },
+		{ 10, 11, 3, 5, 10, 3, 4, 5, 3, 0, 4, 3, -1 },
+		{ 10, 11, 8, 5, 10, 8, 4, 5, 8, -1 },
+		{ 9, 8, 7, 5, 9, 7, -1 },
+		{ 7, 5, 9, 3, 7, 9, 0, 3, 9, -1 },
+		{ 7, 5, 1, 8, 7, 1, 0, 8, 1, -1 },
+		{ 3, 7, 5, 1, 3, 5, -1 },
+		{ 1, 10, 2, 9, 8, 7, 5, 9, 7, -1 },
+		{ 7, 5, 9, 3, 7, 9, 0, 3, 9, 1, 10, 2, -1 },
+		{ 5, 10, 2, 7, 5, 2, 8, 7, 2, 0, 8, 2, -1 },
+		{ 7, 5, 10, 3, 7, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, 9, 8, 7, 5, 9, 7, -1 },
+		{ 7, 5, 9, 11, 7, 9, 2, 11, 9, 0, 2, 9, -1 },
+		{ 7, 5, 1, 8, 7, 1, 0, 8, 1, 2, 11, 3, -1 },
+		{ 11, 7, 5, 2, 11, 5, 1, 2, 5, -1 },
+		{ 10, 11, 3, 1, 10, 3, 9, 8, 7, 5, 9, 7, -1 },
+		{ 1, 10, 11, 0, 1, 11, 7, 5, 9, 11, 7, 9, 0, 11, 9, -1 },
+		{ 8, 7, 5, 0, 8, 5, 10, 11, 3, 5, 10, 3, 0, 5, 3, -1 },
+		{ 10, 11, 7, 5, 10, 7, -1 },
+		{ 5, 6, 10, -1 },
+		{ 0, 3, 8, 5, 6, 10, -1 },
+		{ 0, 9, 1, 5, 6, 10, -1 },
+		{ 3, 8, 9, 1, 3, 9, 5, 6, 10, -1 },
+		{ 5, 6, 2, 1, 5, 2, -1 },
+		{ 0, 3, 8, 5, 6, 2, 1, 5, 2, -1 },
+		{ 5, 6, 2, 9, 5, 2, 0, 9, 2, -1 },
+		{ 9, 5, 6, 8, 9, 6, 3, 8, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 5, 6, 10, -1 },
+		{ 2, 11, 8, 0, 2, 8, 5, 6, 10, -1 },
+		{ 0, 9, 1, 2, 11, 3, 5, 6, 10, -1 },
+		{ 11, 8, 9, 2, 11, 9, 1, 2, 9, 5, 6, 10, -1 },
+		{ 6, 11, 3, 5, 6, 3, 1, 5, 3, -1 },
+		{ 6, 11, 8, 5, 6, 8, 1, 5, 8, 0, 1, 8, -1 },
+		{ 6, 11, 3, 5, 6, 3, 9, 5, 3, 0, 9, 3, -1 },
+		{ 11, 8, 9, 6, 11, 9, 5, 6, 9, -1 },
+		{ 4, 8, 7, 5, 6, 10, -1 },
+		{ 3, 7, 4, 0, 3, 4, 5, 6, 10, -1 },
+		{ 0, 9, 1, 4, 8, 7, 5, 6, 10, -1 },
+		{ 7, 4, 9, 3, 7, 9, 1, 3, 9, 5, 6, 10, -1 },
+		{ 5, 6, 2, 1, 5, 2, 4, 8, 7, -1 },
+		{ 3, 7, 4, 0, 3, 4, 5, 6, 2, 1, 5, 2, -1 },
+		{ 5, 6, 2, 9, 5, 2, 0, 9, 2, 4, 8, 7, -1 },
+		{ 7, 4, 9, 3, 7, 9, 9, 5, 6, 3, 9, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 4, 8, 7, 5, 6, 10, -1 },
+		{ 11, 7, 4, 2, 11, 4, 0, 2, 4, 5, 6, 10, -1 },
+		{ 0, 9, 1, 2, 11, 3, 4, 8, 7, 5, 6, 10, -1 },
+		{ 7, 4, 9, 11, 7, 9, 2, 11, 9, 1, 2, 9, 5, 6, 10, -1 },
+		{ 6, 11, 3, 5, 6, 3, 1, 5, 3, 4, 8, 7, -1 },
+		{ 5, 6, 11, 1, 5, 11, 11, 7, 4, 1, 11, 4, 0, 1, 4, -1 },
+		{ 6, 11, 3, 5, 6, 3, 9, 5, 3, 0, 9, 3, 4, 8, 7, -1 },
+		{ 5, 6, 11, 9, 5, 11, 9, 11, 7, 4, 9, 7, -1 },
+		{ 6, 10, 9, 4, 6, 9, -1 },
+		{ 0, 3, 8, 6, 10, 9, 4, 6, 9, -1 },
+		{ 6, 10, 1, 4, 6, 1, 0, 4, 1, -1 },
+		{ 4, 6, 10, 8, 4, 10, 3, 8, 10, 1, 3, 10, -1 },
+		{ 4, 6, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 0, 3, 8, 4, 6, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 4, 6, 2, 0, 4, 2, -1 },
+		{ 8, 4, 6, 3, 8, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 6, 10, 9, 4, 6, 9, -1 },
+		{ 2, 11, 8, 0, 2, 8, 6, 10, 9, 4, 6, 9, -1 },
+		{ 6, 10, 1, 4, 6, 1, 0, 4, 1, 2, 11, 3, -1 },
+		{ 2, 11, 8, 1, 2, 8, 4, 6, 10, 8, 4, 10, 1, 8, 10, -1 },
+		{ 6, 11, 3, 4, 6, 3, 9, 4, 3, 1, 9, 3, -1 },
+		{ 9, 4, 6, 1, 9, 6, 6, 11, 8, 1, 6, 8, 0, 1, 8, -1 },
+		{ 6, 11, 3, 4, 6, 3, 0, 4, 3, -1 },
+		{ 6, 11, 8, 4, 6, 8, -1 },
+		{ 9, 8, 7, 10, 9, 7, 6, 10, 7, -1 },
+		{ 6, 10, 9, 7, 6, 9, 3, 7, 9, 0, 3, 9, -1 },
+		{ 6, 10, 1, 7, 6, 1, 8, 7, 1, 0, 8, 1, -1 },
+		{ 7, 6, 10, 3, 7, 10, 1, 3, 10, -1 },
+		{ 7, 6, 2, 8, 7, 2, 9, 8, 2, 1, 9, 2, -1 },
+		{ 2, 1, 9, 6, 2, 9, 7, 6, 9, 3, 7, 9, 0, 3, 9, -1 },
+		{ 7, 6, 2, 8, 7, 2, 0, 8, 2, -1 },
+		{ 3, 7, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 9, 8, 7, 10, 9, 7, 6, 10, 7, -1 },
+		{ 6, 10, 9, 7, 6, 9, 11, 7, 9, 2, 11, 9, 0, 2, 9, -1 },
+		{ 6, 10, 1, 7, 6, 1, 8, 7, 1, 0, 8, 1, 2, 11, 3, -1 },
+		{ 2, 11, 7, 1, 2, 7, 7, 6, 10, 1, 7, 10, -1 },
+		{ 8, 7, 6, 9, 8, 6, 6, 11, 3, 9, 6, 3, 1, 9, 3, -1 },
+		{ 0, 1, 9, 6, 11, 7, -1 },
+		{ 8, 7, 6, 0, 8, 6, 6, 11, 3, 0, 6, 3, -1 },
+		{ 6, 11, 7, -1 },
+		{ 6, 7, 11, -1 },
+		{ 0, 3, 8, 6, 7, 11, -1 },
+		{ 0, 9, 1, 6, 7, 11, -1 },
+		{ 3, 8, 9, 1, 3, 9, 6, 7, 11, -1 },
+		{ 1, 10, 2, 6, 7, 11, -1 },
+		{ 0, 3, 8, 1, 10, 2, 6, 7, 11, -1 },
+		{ 9, 10, 2, 0, 9, 2, 6, 7, 11, -1 },
+		{ 8, 9, 10, 3, 8, 10, 2, 3, 10, 6, 7, 11, -1 },
+		{ 6, 7, 3, 2, 6, 3, -1 },
+		{ 6, 7, 8, 2, 6, 8, 0, 2, 8, -1 },
+		{ 0, 9, 1, 6, 7, 3, 2, 6, 3, -1 },
+		{ 7, 8, 9, 6, 7, 9, 2, 6, 9, 1, 2, 9, -1 },
+		{ 6, 7, 3, 10, 6, 3, 1, 10, 3, -1 },
+		{ 6, 7, 8, 10, 6, 8, 1, 10, 8, 0, 1, 8, -1 },
+		{ 6, 7, 3, 10, 6, 3, 9, 10, 3, 0, 9, 3, -1 },
+		{ 8, 9, 10, 7, 8, 10, 6, 7, 10, -1 },
+		{ 8, 11, 6, 4, 8, 6, -1 },
+		{ 11, 6, 4, 3, 11, 4, 0, 3, 4, -1 },
+		{ 0, 9, 1, 8, 11, 6, 4, 8, 6, -1 },
+		{ 6, 4, 9, 11, 6, 9, 3, 11, 9, 1, 3, 9, -1 },
+		{ 1, 10, 2, 8, 11, 6, 4, 8, 6, -1 },
+		{ 11, 6, 4, 3, 11, 4, 0, 3, 4, 1, 10, 2, -1 },
+		{ 9, 10, 2, 0, 9, 2, 8, 11, 6, 4, 8, 6, -1 },
+		{ 11, 6, 4, 3, 11, 4, 4, 9, 10, 3, 4, 10, 2, 3, 10, -1 },
+		{ 4, 8, 3, 6, 4, 3, 2, 6, 3, -1 },
+		{ 2, 6, 4, 0, 2, 4, -1 },
+		{ 0, 9, 1, 4, 8, 3, 6, 4, 3, 2, 6, 3, -1 },
+		{ 6, 4, 9, 2, 6, 9, 1, 2, 9, -1 },
+		{ 4, 8, 3, 6, 4, 3, 10, 6, 3, 1, 10, 3, -1 },
+		{ 10, 6, 4, 1, 10, 4, 0, 1, 4, -1 },
+		{ 4, 8, 3, 6, 4, 3, 10, 6, 3, 9, 10, 3, 0, 9, 3, -1 },
+		{ 9, 10, 6, 4, 9, 6, -1 },
+		{ 4, 5, 9, 6, 7, 11, -1 },
+		{ 0, 3, 8, 4, 5, 9, 6, 7, 11, -1 },
+		{ 4, 5, 1, 0, 4, 1, 6, 7, 11, -1 },
+		{ 8, 4, 5, 3, 8, 5, 1, 3, 5, 6, 7, 11, -1 },
+		{ 1, 10, 2, 4, 5, 9, 6, 7, 11, -1 },
+		{ 0, 3, 8, 1, 10, 2, 4, 5, 9, 6, 7, 11, -1 },
+		{ 5, 10, 2, 4, 5, 2, 0, 4, 2, 6, 7, 11, -1 },
+		{ 4, 5, 10, 8, 4, 10, 3, 8, 10, 2, 3, 10, 6, 7, 11, -1 },
+		{ 6, 7, 3, 2, 6, 3, 4, 5, 9, -1 },
+		{ 6, 7, 8, 2, 6, 8, 0, 2, 8, 4, 5, 9, -1 },
+		{ 4, 5, 1, 0, 4, 1, 6, 7, 3, 2, 6, 3, -1 },
+		{ 6, 7, 8, 2, 6, 8, 8, 4, 5, 2, 8, 5, 1, 2, 5, -1 },
+		{ 6, 7, 3, 10, 6, 3, 1, 10, 3, 4, 5, 9, -1 },
+		{ 6, 7, 8, 10, 6, 8, 1, 10, 8, 0, 1, 8, 4, 5, 9, -1 },
+		{ 6, 7, 3, 10, 6, 3, 5, 10, 3, 4, 5, 3, 0, 4, 3, -1 },
+		{ 6, 7, 8, 10, 6, 8, 5, 10, 8, 4, 5, 8, -1 },
+		{ 8, 11, 6, 9, 8, 6, 5, 9, 6, -1 },
+		{ 6, 5, 9, 11, 6, 9, 3, 11, 9, 0, 3, 9, -1 },
+		{ 6, 5, 1, 11, 6, 1, 8, 11, 1, 0, 8, 1, -1 },
+		{ 11, 6, 5, 3, 11, 5, 1, 3, 5, -1 },
+		{ 1, 10, 2, 8, 11, 6, 9, 8, 6, 5, 9, 6, -1 },
+		{ 6, 5, 9, 11, 6, 9, 3, 11, 9, 0, 3, 9, 1, 10, 2, -1 },
+		{ 11, 6, 5, 8, 11, 5, 5, 10, 2, 8, 5, 2, 0, 8, 2, -1 },
+		{ 11, 6, 5, 3, 11, 5, 3, 5, 10, 2, 3, 10, -1 },
+		{ 9, 8, 3, 5, 9, 3, 6, 5, 3, 2, 6, 3, -1 },
+		{ 6, 5, 9, 2, 6, 9, 0, 2, 9, -1 },
+		{ 3, 2, 6, 8, 3, 6, 6, 5, 1, 8, 6, 1, 0, 8, 1, -1 },
+		{ 2, 6, 5, 1, 2, 5, -1 },
+		{ 9, 8, 3, 5, 9, 3, 6, 5, 3, 10, 6, 3, 1, 10, 3, -1 },
+		{ 1, 10, 6, 0, 1, 6, 6, 5, 9, 0, 6, 9, -1 },
+		{ 0, 8, 3, 5, 10, 6, -1 },
+		{ 5, 10, 6, -1 },
+		{ 7, 11, 10, 5, 7, 10, -1 },
+		{ 0, 3, 8, 7, 11, 10, 5, 7, 10, -1 },
+		{ 0, 9, 1, 7, 11, 10, 5, 7, 10, -1 },
+		{ 3, 8, 9, 1, 3, 9, 7, 11, 10, 5, 7, 10, -1 },
+		{ 7, 11, 2, 5, 7, 2, 1, 5, 2, -1 },
+		{ 0, 3, 8, 7, 11, 2, 5, 7, 2, 1, 5, 2, -1 },
+		{ 7, 11, 2, 5, 7, 2, 9, 5, 2, 0, 9, 2, -1 },
+		{ 3, 8, 9, 2, 3, 9, 5, 7, 11, 9, 5, 11, 2, 9, 11, -1 },
+		{ 5, 7, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 5, 7, 8, 10, 5, 8, 2, 10, 8, 0, 2, 8, -1 },
+		{ 0, 9, 1, 5, 7, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 10, 5, 7, 2, 10, 7, 7, 8, 9, 2, 7, 9, 1, 2, 9, -1 },
+		{ 5, 7, 3, 1, 5, 3, -1 },
+		{ 5, 7, 8, 1, 5, 8, 0, 1, 8, -1 },
+		{ 5, 7, 3, 9, 5, 3, 0, 9, 3, -1 },
+		{ 7, 8, 9, 5, 7, 9, -1 },
+		{ 11, 10, 5, 8, 11, 5, 4, 8, 5, -1 },
+		{ 10, 5, 4, 11, 10, 4, 3, 11, 4, 0, 3, 4, -1 },
+		{ 0, 9, 1, 11, 10, 5, 8, 11, 5, 4, 8, 5, -1 },
+		{ 10, 5, 4, 11, 10, 4, 11, 4, 9, 3, 11, 9, 1, 3, 9, -1 },
+		{ 8, 11, 2, 4, 8, 2, 5, 4, 2, 1, 5, 2, -1 },
+		{ 1, 5, 4, 2, 1, 4, 11, 2, 4, 3, 11, 4, 0, 3, 4, -1 },
+		{ 8, 11, 2, 4, 8, 2, 5, 4, 2, 9, 5, 2, 0, 9, 2, -1 },
+		{ 2, 3, 11, 4, 9, 5, -1 },
+		{ 4, 8, 3, 5, 4, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 10, 5, 4, 2, 10, 4, 0, 2, 4, -1 },
+		{ 0, 9, 1, 4, 8, 3, 5, 4, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 10, 5, 4, 2, 10, 4, 2, 4, 9, 1, 2, 9, -1 },
+		{ 4, 8, 3, 5, 4, 3, 1, 5, 3, -1 },
+		{ 1, 5, 4, 0, 1, 4, -1 },
+		{ 4, 8, 3, 5, 4, 3, 9, 5, 3, 0, 9, 3, -1 },
+		{ 4, 9, 5, -1 },
+		{ 11, 10, 9, 7, 11, 9, 4, 7, 9, -1 },
+		{ 0, 3, 8, 11, 10, 9, 7, 11, 9, 4, 7, 9, -1 },
+		{ 11, 10, 1, 7, 11, 1, 4, 7, 1, 0, 4, 1, -1 },
+		{ 7, 11, 10, 4, 7, 10, 8, 4, 10, 3, 8, 10, 1, 3, 10, -1 },
+		{ 7, 11, 2, 4, 7, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 0, 3, 8, 7, 11, 2, 4, 7, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 7, 11, 2, 4, 7, 2, 0, 4, 2, -1 },
+		{ 3, 8, 4, 2, 3, 4, 4, 7, 11, 2, 4, 11, -1 },
+		{ 4, 7, 3, 9, 4, 3, 10, 9, 3, 2, 10, 3, -1 },
+		{ 9, 4, 7, 10, 9, 7, 10, 7, 8, 2, 10, 8, 0, 2, 8, -1 },
+		{ 3, 2, 10, 7, 3, 10, 7, 10, 1, 4, 7, 1, 0, 4, 1, -1 },
+		{ 1, 2, 10, 4, 7, 8, -1 },
+		{ 4, 7, 3, 9, 4, 3, 1, 9, 3, -1 },
+		{ 9, 4, 7, 1, 9, 7, 1, 7, 8, 0, 1, 8, -1 },
+		{ 4, 7, 3, 0, 4, 3, -1 },
+		{ 4, 7, 8, -1 },
+		{ 11, 10, 9, 8, 11, 9, -1 },
+		{ 11, 10, 9, 3, 11, 9, 0, 3, 9, -1 },
+		{ 11, 10, 1, 8, 11, 1, 0, 8, 1, -1 },
+		{ 3, 11, 10, 1, 3, 10, -1 },
+		{ 8, 11, 2, 9, 8, 2, 1, 9, 2, -1 },
+		{ 2, 1, 9, 11, 2, 9, 3, 11, 9, 0, 3, 9, -1 },
+		{ 8, 11, 2, 0, 8, 2, -1 },
+		{ 2, 3, 11, -1 },
+		{ 9, 8, 3, 10, 9, 3, 2, 10, 3, -1 },
+		{ 2, 10, 9, 0, 2, 9, -1 },
+		{ 3, 2, 10, 8, 3, 10, 8, 10, 1, 0, 8, 1, -1 },
+		{ 1, 2, 10, -1 },
+		{ 9, 8, 3, 1, 9, 3, -1 },
+		{ 0, 1, 9, -1 },
+		{ 0, 8, 3, -1 },
+		{ -1 }
+	};
+
+	int i;
+	for( i = 0 ; table[c][i] >= 0 ; i++ )
+	{
+		edges[i] = table[c][i];
+	}
+
+	return i / 3;
+}
+
+// Order of two edge keys for qsort
+int sparCompareKey( const void *a, const void *b )
+{
+	long long ka, kb;
+	ka = *(const long long*) a;
+	kb = *(const long long*) b;
+	return ( ka > kb ) - ( ka < kb );
+}
+
+// Marching cubes isosurface at iso into vertices[3*i] and triangles[3*j] (malloc, free after use), nt triangles, return number of vertices
+int sparIsosurface( spar *matrix, double iso, double **vertices, int **triangles, int *nt )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Matrix size
+	int nx, ny, nz;
+	nx = matrix->nx;
+	ny = matrix->ny;
+	nz = matrix->nz;
+
+	// Cube corner offsets, and edge lower corner offset and axis
+	static const int corner[8][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 },
+									  { 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 } };
+	static const int edge[12][4] = { { 0, 0, 0, 0 }, { 1, 0, 0, 1 }, { 0, 1, 0, 0 }, { 0, 0, 0, 1 },
+									 { 0, 0, 1, 0 }, { 1, 0, 1, 1 }, { 0, 1, 1, 0 }, { 0, 0, 1, 1 },
+									 { 0, 0, 0, 2 }, { 1, 0, 0, 2 }, { 1, 1, 0, 2 }, { 0, 1, 0, 2 } };
+
+	// Triangle edge keys and triangle count per block
+	int nb;
+	nb = matrix->mx * matrix->my * matrix->mz;
+
+	long long **keys;
+	int *count;
+	keys = (long long**) calloc( nb, sizeof(long long*) );
+	count = (int*) calloc( nb, sizeof(int) );
+
+	if( keys == NULL || count == NULL )
+	{
+	   fprintf(stderr, "sparIsosurface error: Out of memory\n");
+	   exit(1);
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block corners, including the next block first plane on each axis
+		int s;
+		sparType *buffer;
+		s = bs + 1;
+		buffer = (sparType*) malloc( s * s * s * sizeof(sparType) );
+
+		if( buffer == NULL )
+		{
+		   fprintf(stderr, "sparIsosurface error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < nb ; n++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = n % matrix->mx;
+			j1 = ( n / matrix->mx ) % matrix->my;
+			k1 = n / ( matrix->mx * matrix->my );
+
+			// Cells with lower corner in the block
+			int ex, ey, ez;
+			ex = nx - 1 - i1 * bs < bs ? nx - 1 - i1 * bs : bs;
+			ey = ny - 1 - j1 * bs < bs ? ny - 1 - j1 * bs : bs;
+			ez = nz - 1 - k1 * bs < bs ? nz - 1 - k1 * bs : bs;
+
+			if( ex <= 0 || ey <= 0 || ez <= 0 )
+			{
+				continue;
+			}
+
+			// Uniform corners, no crossing
+			sparType value;
+			if( sparUniformBox( matrix, i1 * bs, j1 * bs, k1 * bs, s, s, s, &value ) )
+			{
+				continue;
+			}
+
+			sparGetBox( matrix, i1 * bs, j1 * bs, k1 * bs, s, s, s, buffer );
+
+			// Corner offsets in the buffer
+			int offset[8], c;
+			for( c = 0 ; c < 8 ; c++ )
+			{
+				offset[c] = corner[c][0] + s * ( corner[c][1] + s * corner[c][2] );
+			}
+
+			int size;
+			size = 0;
+
+			// For each cell
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					for( i = 0 ; i < ex ; i++ )
+					{
+						// Cube case
+						sparType *cell;
+						int cube;
+						cell = buffer + i + s * ( j + s * k );
+						cube = 0;
+						for( c = 0 ; c < 8 ; c++ )
+						{
+							cube |= ( cell[ offset[c] ] > iso ) << c;
+						}
+
+						if( cube == 0 || cube == 255 )
+						{
+							continue;
+						}
+
+						int edges[15], t;
+						t = sparCubeTriangles( cube, edges );
+
+						// Grow keys
+						if( ( count[n] + t ) * 3 > size )
+						{
+							size = size == 0 ? 48 : 2 * size;
+							keys[n] = (long long*) realloc( keys[n], size * sizeof(long long) );
+
+							if( keys[n] == NULL )
+							{
+							   fprintf(stderr, "sparIsosurface error: Out of memory\n");
+							   exit(1);
+							}
+						}
+
+						// Edge key of lower element (x,y,z) and axis a, 3*(x+nx*(y+ny*z))+a
+						for( c = 0 ; c < 3 * t ; c++ )
+						{
+							const int *e;
+							e = edge[ edges[c] ];
+							keys[n][ 3 * count[n] + c ] = 3 * ( i1 * bs + i + e[0] + nx *
+								( j1 * bs + j + e[1] + (long long) ny * ( k1 * bs + k + e[2] ) ) ) + e[3];
+						}
+						count[n] += t;
+					}
+				}
+			}
+		}
+
+		free(buffer);
+	}
+
+	// Triangle offset per block
+	int m, total;
+	total = 0;
+	for( m = 0 ; m < nb ; m++ )
+	{
+		int c;
+		c = count[m];
+		count[m] = total;
+		total += c;
+	}
+	*nt = total;
+
+	if( total == 0 )
+	{
+		free(keys);
+		free(count);
+		*vertices = NULL;
+		*triangles = NULL;
+		return 0;
+	}
+
+	// All edge keys, then sorted unique keys as vertices
+	long long *all, *unique;
+	all = (long long*) malloc( 3 * total * sizeof(long long) );
+	unique = (long long*) malloc( 3 * total * sizeof(long long) );
+
+	if( all == NULL || unique == NULL )
+	{
+	   fprintf(stderr, "sparIsosurface error: Out of memory\n");
+	   exit(1);
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( m = 0 ; m < nb ; m++ )
+	{
+		if( keys[m] != NULL )
+		{
+			int c;
+			c = ( m + 1 < nb ? count[ m + 1 ] : total ) - count[m];
+			memcpy( all + 3 * count[m], keys[m], 3 * c * sizeof(long long) );
+			free(keys[m]);
+		}
+	}
+	free(keys);
+	free(count);
+
+	memcpy( unique, all, 3 * total * sizeof(long long) );
+	qsort( unique, 3 * total, sizeof(long long), sparCompareKey );
+
+	int nv;
+	nv = 1;
+	for( m = 1 ; m < 3 * total ; m++ )
+	{
+		if( unique[m] != unique[ nv - 1 ] )
+		{
+			unique[ nv++ ] = unique[m];
+		}
+	}
+
+	*vertices = (double*) malloc( 3 * nv * sizeof(double) );
+	*triangles = (int*) malloc( 3 * total * sizeof(int) );
+
+	if( *vertices == NULL || *triangles == NULL )
+	{
+	   fprintf(stderr, "sparIsosurface error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Vertex on edge by linear interpolation
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( m = 0 ; m < nv ; m++ )
+	{
+		// Lower element (x,y,z) and axis a
+		int a, p[3];
+		long long key;
+		key = unique[m] / 3;
+		a = (int)( unique[m] % 3 );
+		p[0] = (int)( key % nx );
+		p[1] = (int)( ( key / nx ) % ny );
+		p[2] = (int)( key / ( (long long) nx * ny ) );
+
+		double v0, v1, t;
+		v0 = sparGet( matrix, p[0], p[1], p[2] );
+		v1 = sparGet( matrix, p[0] + ( a == 0 ), p[1] + ( a == 1 ), p[2] + ( a == 2 ) );
+		t = ( iso - v0 ) / ( v1 - v0 );
+
+		(*vertices)[ 3 * m ] = p[0] + ( a == 0 ) * t;
+		(*vertices)[ 3 * m + 1 ] = p[1] + ( a == 1 ) * t;
+		(*vertices)[ 3 * m + 2 ] = p[2] + ( a == 2 ) * t;
+	}
+
+	// Triangle vertex indices
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( m = 0 ; m < 3 * total ; m++ )
+	{
+		long long *v;
+		v = (long long*) bsearch( all + m, unique, nv, sizeof(long long), sparCompareKey );
+		(*triangles)[m] = (int)( v - unique );
+	}
+
+	free(all);
+	free(unique);
+
+	return nv;
+}
+
+// Copy block (i,j,k) of src into block (x,y,z) of dst, same block size
+void sparCopyBlock( spar *dst, int x, int y, int z, spar *src, int i, int j, int k )
+{
+	// Linear block indices
+	int n, m;
+	n = x + dst->mx * ( y + dst->my * z );
+	m = i + src->mx * ( j + src->my * k );
+
+	// Uniform block
+	if( src->blockData[m] == NULL )
+	{
+		if( dst->blockData[n] != NULL )
+		{
+			free(dst->blockData[n]);
+			dst->blockData[n] = NULL;
+		}
+		dst->blockValue[n] = src->blockValue[m];
+		return;
+	}
+
+	// Heterogeneous block, reuse destination data if any
+	if( dst->blockData[n] == NULL )
+	{
+		dst->blockData[n] = (sparType*) malloc( dst->bs3 * sizeof(sparType) );
+
+		if( dst->blockData[n] == NULL )
+		{
+		   fprintf(stderr, "sparCopyBlock error: Out of memory\n");
+		   exit(1);
+		}
+	}
+
+	memcpy( dst->blockData[n], src->blockData[m], dst->bs3 * sizeof(sparType) );
+
+	// Boundary block may become uniform inside the matrix
+	if( x == dst->mx - 1 || y == dst->my - 1 || z == dst->mz - 1 )
+	{
+		sparReduceBlock( dst, x, y, z );
+	}
+}
+
+// New matrix with box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1), elements outside the matrix set to default, ring buffer origin reset
+spar* sparCrop( spar *matrix, int x, int y, int z, int sx, int sy, int sz )
+{
+	// Declare matrix and init
+	spar *matrix2;
+	matrix2 = sparInit( sx, sy, sz, matrix->bs, matrix->def );
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Box aligned with source blocks
+	int aligned;
+	aligned = x >= 0 && y >= 0 && z >= 0 && x % bs == 0 && y % bs == 0 && z % bs == 0;
+
+	// Number of blocks
+	int blocks;
+	blocks = matrix2->mx * matrix2->my * matrix2->mz;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		// Block (i1,j1,k1) and source box origin
+		int i1, j1, k1, x0, y0, z0;
+		i1 = n % matrix2->mx;
+		j1 = ( n / matrix2->mx ) % matrix2->my;
+		k1 = n / ( matrix2->mx * matrix2->my );
+		x0 = x + i1 * bs;
+		y0 = y + j1 * bs;
+		z0 = z + k1 * bs;
+
+		// Aligned source block covering the block elements inside the matrix, copy block
+		if( aligned && x0 < matrix->nx && y0 < matrix->ny && z0 < matrix->nz &&
+			matrix->nx - x0 >= ( sx - i1 * bs < bs ? sx - i1 * bs : bs ) &&
+			matrix->ny - y0 >= ( sy - j1 * bs < bs ? sy - j1 * bs : bs ) &&
+			matrix->nz - z0 >= ( sz - k1 * bs < bs ? sz - k1 * bs : bs ) )
+		{
+			sparCopyBlock( matrix2, i1, j1, k1, matrix, x0 / bs, y0 / bs, z0 / bs );
+			continue;
+		}
+
+		// Uniform source box
+		sparType value;
+		if( sparUniformBox( matrix, x0, y0, z0, bs, bs, bs, &value ) &&
+			x0 >= 0 && y0 >= 0 && z0 >= 0 && x0 + bs <= matrix->nx && y0 + bs <= matrix->ny && z0 + bs <= matrix->nz )
+		{
+			matrix2->blockValue[n] = value;
+			continue;
+		}
+
+		// Read source box rows into the block, reduce if possible
+		matrix2->blockData[n] = (sparType*) malloc( matrix2->bs3 * sizeof(sparType) );
+
+		if( matrix2->blockData[n] == NULL )
+		{
+		   fprintf(stderr, "sparCrop error: Out of memory\n");
+		   exit(1);
+		}
+
+		sparGetBox( matrix, x0, y0, z0, bs, bs, bs, matrix2->blockData[n] );
+		sparReduceBlock( matrix2, i1, j1, k1 );
+	}
+
+	return matrix2;
+}
+
+// Write src into matrix at (x,y,z), clipped to the matrix
+void sparPaste( spar *matrix, spar *src, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + src->nx > matrix->nx ? matrix->nx : x + src->nx;
+	y1 = y + src->ny > matrix->ny ? matrix->ny : y + src->ny;
+	z1 = z + src->nz > matrix->nz ? matrix->nz : z + src->nz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	// Box aligned with blocks of the same size
+	int aligned;
+	aligned = src->bs == bs && x >= 0 && y >= 0 && z >= 0 && x % bs == 0 && y % bs == 0 && z % bs == 0;
+
+	// Range of blocks
+	int bx, by, bz, cx, cy, cz;
+	bx = x0 / bs;
+	by = y0 / bs;
+	bz = z0 / bs;
+	cx = ( x1 - 1 ) / bs - bx + 1;
+	cy = ( y1 - 1 ) / bs - by + 1;
+	cz = ( z1 - 1 ) / bs - bz + 1;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		sparType *buffer;
+		buffer = (sparType*) malloc( bs * bs * bs * sizeof(sparType) );
+
+		if( buffer == NULL )
+		{
+		   fprintf(stderr, "sparPaste error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each block overlapping the box
+		int t;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( t = 0 ; t < cx * cy * cz ; t++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = bx + t % cx;
+			j1 = by + ( t / cx ) % cy;
+			k1 = bz + t / ( cx * cy );
+
+			// Block and box intersection
+			int bx0, by0, bz0, bx1, by1, bz1;
+			bx0 = i1 * bs > x0 ? i1 * bs : x0;
+			by0 = j1 * bs > y0 ? j1 * bs : y0;
+			bz0 = k1 * bs > z0 ? k1 * bs : z0;
+			bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+			by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+			bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+			// Aligned block with elements inside the matrix fully covered, copy block
+			if( aligned && bx0 == i1 * bs && by0 == j1 * bs && bz0 == k1 * bs &&
+				( bx1 == ( i1 + 1 ) * bs || bx1 == matrix->nx ) &&
+				( by1 == ( j1 + 1 ) * bs || by1 == matrix->ny ) &&
+				( bz1 == ( k1 + 1 ) * bs || bz1 == matrix->nz ) )
+			{
+				sparCopyBlock( matrix, i1, j1, k1, src, i1 - x / bs, j1 - y / bs, k1 - z / bs );
+				continue;
+			}
+
+			// Copy intersection rows
+			sparGetBox( src, bx0 - x, by0 - y, bz0 - z, bx1 - bx0, by1 - by0, bz1 - bz0, buffer );
+			sparSetBox( matrix, bx0, by0, bz0, bx1 - bx0, by1 - by0, bz1 - bz0, buffer );
+		}
+
+		free(buffer);
+	}
+}
+
+// Shift contents by (dx,dy,dz), element (x,y,z) moves to (x+dx,y+dy,z+dz), vacated elements set to default
+void sparShift( spar *matrix, int dx, int dy, int dz )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Shift in blocks (qx,qy,qz) and remainder (rx,ry,rz), same sign so no data is dropped early
+	int qx, qy, qz, rx, ry, rz;
+	qx = dx / bs;
+	qy = dy / bs;
+	qz = dz / bs;
+	rx = dx % bs;
+	ry = dy % bs;
+	rz = dz % bs;
+
+	// Move blocks
+	if( qx != 0 || qy != 0 || qz != 0 )
+	{
+		// New block data
+		sparType *blockValue;
+		sparType **blockData;
+
+		int blocks;
+		blocks = mx * my * mz;
+		blockValue = (sparType*) calloc( blocks, sizeof(sparType) ); // Sets to 0s
+		blockData = (sparType**) calloc( blocks, sizeof(sparType*) ); // Sets to NULLs
+
+		if( blockValue == NULL || blockData == NULL )
+		{
+		   fprintf(stderr, "sparShift error: Out of memory\n");
+		   exit(1);
+		}
+
+		int i, j, k;
+		for( k = 0 ; k < mz ; k++ )
+		{
+			for( j = 0 ; j < my ; j++ )
+			{
+				for( i = 0 ; i < mx ; i++ )
+				{
+					// Source block
+					int i2, j2, k2, n;
+					i2 = i - qx;
+					j2 = j - qy;
+					k2 = k - qz;
+					n = i + mx * ( j + my * k );
+
+					if( i2 >= 0 && j2 >= 0 && k2 >= 0 && i2 < mx && j2 < my && k2 < mz )
+					{
+						int m;
+						m = i2 + mx * ( j2 + my * k2 );
+						blockValue[n] = matrix->blockValue[m];
+						blockData[n] = matrix->blockData[m];
+						matrix->blockData[m] = NULL;
+					}
+					else
+					{
+						blockValue[n] = matrix->def;
+					}
+				}
+			}
+		}
+
+		// Free blocks moved outside
+		for( i = 0 ; i < blocks ; i++ )
+		{
+			if( matrix->blockData[i] != NULL )
+			{
+				free(matrix->blockData[i]);
+			}
+		}
+
+		free(matrix->blockData);
+		free(matrix->blockValue);
 
 		matrix->blockData = blockData;
 		matrix->blockValue = blockValue;
+
+		// Previous boundary blocks moved inside, set outside elements to default
+		int ex, ey, ez;
+		ex = matrix->nx - ( mx - 1 ) * bs;
+		ey = matrix->ny - ( my - 1 ) * bs;
+		ez = matrix->nz - ( mz - 1 ) * bs;
+
+		if( ex < bs && qx < 0 && mx - 1 + qx >= 0 )
+		{
+			sparFillBox( matrix, ( mx - 1 + qx ) * bs + ex, 0, 0, bs - ex, matrix->ny, matrix->nz, matrix->def );
+		}
+		if( ey < bs && qy < 0 && my - 1 + qy >= 0 )
+		{
+			sparFillBox( matrix, 0, ( my - 1 + qy ) * bs + ey, 0, matrix->nx, bs - ey, matrix->nz, matrix->def );
+		}
+		if( ez < bs && qz < 0 && mz - 1 + qz >= 0 )
+		{
+			sparFillBox( matrix, 0, 0, ( mz - 1 + qz ) * bs + ez, matrix->nx, matrix->ny, bs - ez, matrix->def );
+		}
+
+		// Blocks moved to the boundary may be uniform inside the matrix
+		for( k = 0 ; k < mz ; k++ )
+		{
+			for( j = 0 ; j < my ; j++ )
+			{
+				for( i = 0 ; i < mx ; i++ )
+				{
+					if( ( i == mx - 1 && ex < bs && qx != 0 ) || ( j == my - 1 && ey < bs && qy != 0 ) ||
+						( k == mz - 1 && ez < bs && qz != 0 ) )
+					{
+						sparReduceBlock( matrix, i, j, k );
+					}
+				}
+			}
+		}
+	}
+
+	// Recombine blocks for the remainder
+	if( rx != 0 || ry != 0 || rz != 0 )
+	{
+		spar *shifted;
+		shifted = sparCrop( matrix, -rx, -ry, -rz, matrix->nx, matrix->ny, matrix->nz );
+
+		// Swap block data
+		sparType *blockValue;
+		sparType **blockData;
+		blockValue = matrix->blockValue;
+		blockData = matrix->blockData;
+		matrix->blockValue = shifted->blockValue;
+		matrix->blockData = shifted->blockData;
+		shifted->blockValue = blockValue;
+		shifted->blockData = blockData;
+
+		sparFree( shifted );
+	}
+}
+
+// Ring buffer index of world coordinate w in a ring of size n
+int sparRingIndex( int w, int n )
+{
+	return ( w % n + n ) % n;
+}
+
+// Set element at world coordinates (x,y,z) of the ring buffer window, ignored outside the window
+void sparRingSet( spar *matrix, int x, int y, int z, sparType value )
+{
+	if( x < matrix->ox || y < matrix->oy || z < matrix->oz ||
+		x >= matrix->ox + matrix->nx || y >= matrix->oy + matrix->ny || z >= matrix->oz + matrix->nz )
+	{
+		return;
+	}
+
+	sparSet( matrix, sparRingIndex( x, matrix->nx ), sparRingIndex( y, matrix->ny ), sparRingIndex( z, matrix->nz ), value );
+}
+
+// Get element at world coordinates (x,y,z) of the ring buffer window, default value outside the window
+sparType sparRingGet( spar *matrix, int x, int y, int z )
+{
+	if( x < matrix->ox || y < matrix->oy || z < matrix->oz ||
+		x >= matrix->ox + matrix->nx || y >= matrix->oy + matrix->ny || z >= matrix->oz + matrix->nz )
+	{
+		return matrix->def;
+	}
+
+	return sparGet( matrix, sparRingIndex( x, matrix->nx ), sparRingIndex( y, matrix->ny ), sparRingIndex( z, matrix->nz ) );
+}
+
+// Move the ring buffer window origin to world coordinates (x,y,z), elements entering the window set to default
+void sparRingMove( spar *matrix, int x, int y, int z )
+{
+	// Matrix size, previous and new origin
+	int size[3], o[3], p[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+	o[0] = matrix->ox;
+	o[1] = matrix->oy;
+	o[2] = matrix->oz;
+	p[0] = x;
+	p[1] = y;
+	p[2] = z;
+
+	// Window moved by at least its size on one axis, reset all
+	int a;
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		if( abs( p[a] - o[a] ) >= size[a] )
+		{
+			sparFillBox( matrix, 0, 0, 0, matrix->nx, matrix->ny, matrix->nz, matrix->def );
+			matrix->ox = x;
+			matrix->oy = y;
+			matrix->oz = z;
+			return;
+		}
+	}
+
+	// For each axis, reset the slab of elements entering the window, in up to two boxes of ring indices
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		if( p[a] == o[a] )
+		{
+			continue;
+		}
+
+		// First entering world coordinate and slab thickness
+		int w, t;
+		w = p[a] > o[a] ? o[a] + size[a] : p[a];
+		t = abs( p[a] - o[a] );
+
+		// Ring index ranges [s0,s0+t0) and [0,t-t0)
+		int s0, t0;
+		s0 = sparRingIndex( w, size[a] );
+		t0 = s0 + t > size[a] ? size[a] - s0 : t;
+
+		int b[3], c[3];
+		b[0] = 0;
+		b[1] = 0;
+		b[2] = 0;
+		c[0] = matrix->nx;
+		c[1] = matrix->ny;
+		c[2] = matrix->nz;
+
+		b[a] = s0;
+		c[a] = t0;
+		sparFillBox( matrix, b[0], b[1], b[2], c[0], c[1], c[2], matrix->def );
+
+		if( t0 < t )
+		{
+			b[a] = 0;
+			c[a] = t - t0;
+			sparFillBox( matrix, b[0], b[1], b[2], c[0], c[1], c[2], matrix->def );
+		}
+	}
+
+	matrix->ox = x;
+	matrix->oy = y;
+	matrix->oz = z;
+}
+
+// New matrix with permuted axes, new x, y and z axes are the axes ax, ay and az (0 x, 1 y, 2 z) of matrix
+spar* sparPermute( spar *matrix, int ax, int ay, int az )
+{
+	// Check permutation
+	if( ax < 0 || ay < 0 || az < 0 || ax > 2 || ay > 2 || az > 2 || ax == ay || ay == az || az == ax )
+	{
+		fprintf(stderr, "sparPermute error: Axes must be a permutation of 0, 1 and 2\n");
+		exit(1);
+	}
+
+	// Matrix and block matrix size
+	int size[3], blockSize[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+	blockSize[0] = matrix->mx;
+	blockSize[1] = matrix->my;
+	blockSize[2] = matrix->mz;
+
+	// Declare matrix and init
+	spar *matrix2;
+	matrix2 = sparInit( size[ax], size[ay], size[az], matrix->bs, matrix->def );
+
+	// Permute ring buffer origin
+	int origin[3];
+	origin[0] = matrix->ox;
+	origin[1] = matrix->oy;
+	origin[2] = matrix->oz;
+	matrix2->ox = origin[ax];
+	matrix2->oy = origin[ay];
+	matrix2->oz = origin[az];
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Source strides of the new axes, blocks and elements
+	int stride[3], blockStride[3];
+	stride[0] = 1;
+	stride[1] = bs;
+	stride[2] = bs * bs;
+	blockStride[0] = 1;
+	blockStride[1] = blockSize[0];
+	blockStride[2] = blockSize[0] * blockSize[1];
+
+	int sx, sy, sz, bx, by, bz;
+	sx = stride[ax];
+	sy = stride[ay];
+	sz = stride[az];
+	bx = blockStride[ax];
+	by = blockStride[ay];
+	bz = blockStride[az];
+
+	// Number of blocks
+	int blocks;
+	blocks = matrix2->mx * matrix2->my * matrix2->mz;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		// Block (i1,j1,k1) and source block
+		int i1, j1, k1, m;
+		i1 = n % matrix2->mx;
+		j1 = ( n / matrix2->mx ) % matrix2->my;
+		k1 = n / ( matrix2->mx * matrix2->my );
+		m = i1 * bx + j1 * by + k1 * bz;
+
+		// Uniform block
+		if( matrix->blockData[m] == NULL )
+		{
+			matrix2->blockValue[n] = matrix->blockValue[m];
+			continue;
+		}
+
+		// Heterogeneous block, transpose in cache
+		sparType *blockData, *source;
+		blockData = (sparType*) malloc( matrix2->bs3 * sizeof(sparType) );
+		source = matrix->blockData[m];
+
+		if( blockData == NULL )
+		{
+		   fprintf(stderr, "sparPermute error: Out of memory\n");
+		   exit(1);
+		}
+
+		int i, j, k;
+		for( k = 0 ; k < bs ; k++ )
+		{
+			for( j = 0 ; j < bs ; j++ )
+			{
+				sparType *row, *column;
+				row = blockData + bs * ( j + bs * k );
+				column = source + j * sy + k * sz;
+				for( i = 0 ; i < bs ; i++ )
+				{
+					row[i] = column[ i * sx ];
+				}
+			}
+		}
+
+		matrix2->blockData[n] = blockData;
+	}
+
+	return matrix2;
+}
+
+// Allocate n elements 64-byte aligned with plain malloc (no C11 aligned_alloc), release with the matching DenseFree
+sparType* sparDenseAlloc( long n )
+{
+	// Room for the alignment offset and the original pointer
+	char *base;
+	base = (char*) malloc( n * sizeof(sparType) + 64 + sizeof(void*) );
+
+	if( base == NULL )
+	{
+		return NULL;
+	}
+
+	// First 64-byte boundary after the stored original pointer
+	char *aligned;
+	aligned = base + sizeof(void*);
+	aligned = aligned + ( 64 - (uintptr_t)( aligned ) % 64 ) % 64;
+	((void**) aligned)[-1] = base;
+
+	return (sparType*) aligned;
+}
+
+// Free dense buffer returned by Densify or DenseAlloc
+void sparDenseFree( sparType *buffer )
+{
+	if( buffer != NULL )
+	{
+		free( ((void**) buffer)[-1] );
+	}
+}
+
+// Dense copy padded to (px,py,pz) with the default value, rows along axis contiguous and 64-byte aligned every pitch elements (free with sparDenseFree)
+sparType* sparDensify( spar *matrix, int axis, int px, int py, int pz, int *pitch )
+{
+	// Check padded size
+	if( px < matrix->nx || py < matrix->ny || pz < matrix->nz || axis < 0 || axis > 2 )
+	{
+		fprintf(stderr, "sparDensify error: Padded size must contain the matrix\n");
+		exit(1);
+	}
+
+	// Padded size and the other two axes (b,c)
+	int p[3], b, c;
+	p[0] = px;
+	p[1] = py;
+	p[2] = pz;
+	b = axis == 0 ? 1 : 0;
+	c = axis == 2 ? 1 : 2;
+
+	// Row pitch, multiple of 64 bytes
+	int align;
+	align = 64 % sizeof(sparType) == 0 ? 64 / sizeof(sparType) : 1;
+	*pitch = ( p[axis] + align - 1 ) / align * align;
+
+	// Element (x,y,z) at x*s[0]+y*s[1]+z*s[2]
+	long s[3];
+	s[axis] = 1;
+	s[b] = *pitch;
+	s[c] = (long) *pitch * p[b];
+
+	sparType *buffer;
+	buffer = sparDenseAlloc( s[c] * p[c] );
+
+	if( buffer == NULL )
+	{
+	   fprintf(stderr, "sparDensify error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Matrix size
+	int size[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+
+	// Padding, row by row
+	int r;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( r = 0 ; r < p[b] * p[c] ; r++ )
+	{
+		// Row (j,k) along axes (b,c)
+		int i, j, k;
+		j = r % p[b];
+		k = r / p[b];
+
+		sparType *row;
+		row = buffer + j * s[b] + k * s[c];
+		for( i = ( j < size[b] && k < size[c] ) ? size[axis] : 0 ; i < *pitch ; i++ )
+		{
+			row[i] = matrix->def;
+		}
+	}
+
+	sparGetDense( matrix, buffer, s[0], s[1], s[2] );
+
+	return buffer;
+}
+
+// Copy dense buffer with element (x,y,z) at x*sx+y*sy+z*sz into matrix, uniform blocks detected
+void sparSetDense( spar *matrix, sparType *buffer, long sx, long sy, long sz )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Element strides
+	long s[3];
+	s[0] = sx;
+	s[1] = sy;
+	s[2] = sz;
+
+	// Number of blocks
+	int blocks;
+	blocks = matrix->mx * matrix->my * matrix->mz;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block elements
+		sparType *temp;
+		temp = (sparType*) malloc( bs3 * sizeof(sparType) );
+
+		if( temp == NULL )
+		{
+		   fprintf(stderr, "sparSetDense error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < blocks ; n++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = n % matrix->mx;
+			j1 = ( n / matrix->mx ) % matrix->my;
+			k1 = n / ( matrix->mx * matrix->my );
+
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = matrix->nx - i1 * bs < bs ? matrix->nx - i1 * bs : bs;
+			ey = matrix->ny - j1 * bs < bs ? matrix->ny - j1 * bs : bs;
+			ez = matrix->nz - k1 * bs < bs ? matrix->nz - k1 * bs : bs;
+
+			// Gather block and check uniformity in a single scan
+			sparType value;
+			int isUniform;
+			value = buffer[ i1 * bs * s[0] + j1 * bs * s[1] + k1 * bs * s[2] ];
+			isUniform = 1;
+
+			int i, j, k;
+			for( k = 0 ; k < bs ; k++ )
+			{
+				for( j = 0 ; j < bs ; j++ )
+				{
+					sparType *row, *blockRow;
+					row = buffer + i1 * bs * s[0] + ( j1 * bs + j ) * s[1] + ( k1 * bs + k ) * s[2];
+					blockRow = temp + bs * ( j + bs * k );
+
+					// Outside elements set to default
+					if( j >= ey || k >= ez )
+					{
+						for( i = 0 ; i < bs ; i++ )
+						{
+							blockRow[i] = matrix->def;
+						}
+						continue;
+					}
+
+					for( i = 0 ; i < ex ; i++ )
+					{
+						blockRow[i] = row[ i * s[0] ];
+						isUniform &= sparEqual( blockRow[i], value );
+					}
+					for( i = ex ; i < bs ; i++ )
+					{
+						blockRow[i] = matrix->def;
+					}
+				}
+			}
+
+			// Uniform block
+			if( isUniform )
+			{
+				if( matrix->blockData[n] != NULL )
+				{
+					free(matrix->blockData[n]);
+					matrix->blockData[n] = NULL;
+				}
+				matrix->blockValue[n] = value;
+			}
+			// Heterogeneous block, reuse previous data if any
+			else if( matrix->blockData[n] != NULL )
+			{
+				memcpy( matrix->blockData[n], temp, bs3 * sizeof(sparType) );
+			}
+			// Heterogeneous block, keep gathered elements
+			else
+			{
+				matrix->blockData[n] = temp;
+				temp = (sparType*) malloc( bs3 * sizeof(sparType) );
+
+				if( temp == NULL )
+				{
+				   fprintf(stderr, "sparSetDense error: Out of memory\n");
+				   exit(1);
+				}
+			}
+		}
+
+		free(temp);
 	}
 }
+
+// Copy dense buffer with the densify layout (axis, pitch and padded size) into matrix, uniform blocks detected
+void sparSparsify( spar *matrix, sparType *buffer, int axis, int pitch, int px, int py, int pz )
+{
+	// Check padded size and pitch
+	if( px < matrix->nx || py < matrix->ny || pz < matrix->nz || axis < 0 || axis > 2 )
+	{
+		fprintf(stderr, "sparSparsify error: Padded size must contain the matrix\n");
+		exit(1);
+	}
+
+	if( pitch < ( axis == 0 ? px : ( axis == 1 ? py : pz ) ) )
+	{
+		fprintf(stderr, "sparSparsify error: Pitch must be at least the padded row length\n");
+		exit(1);
+	}
+
+	// Padded size and the other two axes (b,c)
+	int p[3], b, c;
+	p[0] = px;
+	p[1] = py;
+	p[2] = pz;
+	b = axis == 0 ? 1 : 0;
+	c = axis == 2 ? 1 : 2;
+
+	// Element (x,y,z) at x*s[0]+y*s[1]+z*s[2]
+	long s[3];
+	s[axis] = 1;
+	s[b] = pitch;
+	s[c] = (long) pitch * p[b];
+
+	sparSetDense( matrix, buffer, s[0], s[1], s[2] );
+}
+
+// New matrix from dense buffer with element (x,y,z) at x*sx+y*sy+z*sz, only heterogeneous blocks allocated
+spar* sparInitDense( sparType *buffer, int nx, int ny, int nz, long sx, long sy, long sz, int bs, sparType def )
+{
+	// Declare matrix and init
+	spar *matrix;
+	matrix = sparInit( nx, ny, nz, bs, def );
+
+	sparSetDense( matrix, buffer, sx, sy, sz );
+
+	return matrix;
+}
+
+// Copy matrix into dense buffer with element (x,y,z) at x*sx+y*sy+z*sz
+void sparGetDense( spar *matrix, sparType *buffer, long sx, long sy, long sz )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// For each row along x, in contiguous slabs per thread
+	int r;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( r = 0 ; r < matrix->ny * matrix->nz ; r++ )
+	{
+		// Row (y,z), its blocks and offset in the block
+		int y, z, j1, k1, offset;
+		y = r % matrix->ny;
+		z = r / matrix->ny;
+		j1 = y / bs;
+		k1 = z / bs;
+		offset = bs * ( y % bs + bs * ( z % bs ) );
+
+		sparType *row;
+		row = buffer + y * sy + z * sz;
+
+		// For each block along the row
+		int i1;
+		for( i1 = 0 ; i1 < matrix->mx ; i1++ )
+		{
+			// Linear block index (n) <-> (i1,j1,k1)
+			int n;
+			n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+			// Block extent inside the matrix
+			int ex;
+			ex = matrix->nx - i1 * bs < bs ? matrix->nx - i1 * bs : bs;
+
+			sparType *blockData, *out, value;
+			blockData = matrix->blockData[n];
+			value = matrix->blockValue[n];
+			out = row + i1 * bs * sx;
+
+			int i;
+
+			// Uniform block, contiguous row
+			if( blockData == NULL && sx == 1 )
+			{
+				for( i = 0 ; i < ex ; i++ )
+				{
+					out[i] = value;
+				}
+			}
+			// Uniform block, strided row
+			else if( blockData == NULL )
+			{
+				for( i = 0 ; i < ex ; i++ )
+				{
+					out[ i * sx ] = value;
+				}
+			}
+			// Heterogeneous block, contiguous row
+			else if( sx == 1 )
+			{
+				memcpy( out, blockData + offset, ex * sizeof(sparType) );
+			}
+			// Heterogeneous block, strided row
+			else
+			{
+				for( i = 0 ; i < ex ; i++ )
+				{
+					out[ i * sx ] = blockData[ offset + i ];
+				}
+			}
+		}
+	}
+}
+
+// Change the default value, uniform blocks with the previous default value set to the new one
+void sparSetDefault( spar *matrix, sparType def )
+{
+	// Number of blocks
+	int blocks;
+	blocks = matrix->mx * matrix->my * matrix->mz;
+
+	int i;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( i = 0 ; i < blocks ; i++ )
+	{
+		if( matrix->blockData[i] == NULL && sparEqual( matrix->blockValue[i], matrix->def ) )
+		{
+			matrix->blockValue[i] = def;
+		}
+	}
+
+	matrix->def = def;
+}
+
+// Most frequent value in box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) clipped to the matrix, smallest on ties, its count in count if not NULL
+sparType sparDominant( spar *matrix, int x, int y, int z, int sx, int sy, int sz, double *count )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		if( count != NULL )
+		{
+			*count = 0.0;
+		}
+		return matrix->def;
+	}
+
+	// Runs of equal values, one per uniform block and per distinct value of heterogeneous blocks
+	int runs, size;
+	sparType *runValue, *temp;
+	double *runCount;
+	runs = 0;
+	size = 64;
+	runValue = (sparType*) malloc( size * sizeof(sparType) );
+	runCount = (double*) malloc( size * sizeof(double) );
+	temp = (sparType*) malloc( matrix->bs3 * sizeof(sparType) );
+
+	if( runValue == NULL || runCount == NULL || temp == NULL )
+	{
+	   fprintf(stderr, "sparDominant error: Out of memory\n");
+	   exit(1);
+	}
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1, m;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+				m = ( bx1 - bx0 ) * ( by1 - by0 ) * ( bz1 - bz0 );
+
+				// Grow runs
+				if( runs + m > size )
+				{
+					size = 2 * ( runs + m );
+					runValue = (sparType*) realloc( runValue, size * sizeof(sparType) );
+					runCount = (double*) realloc( runCount, size * sizeof(double) );
+
+					if( runValue == NULL || runCount == NULL )
+					{
+					   fprintf(stderr, "sparDominant error: Out of memory\n");
+					   exit(1);
+					}
+				}
+
+				// Uniform block, one run
+				if( matrix->blockData[n] == NULL )
+				{
+					runValue[runs] = matrix->blockValue[n];
+					runCount[runs] = m;
+					runs++;
+					continue;
+				}
+
+				// Heterogeneous block, sorted intersection elements
+				sparGetBox( matrix, bx0, by0, bz0, bx1 - bx0, by1 - by0, bz1 - bz0, temp );
+				qsort( temp, m, sizeof(sparType), sparCompare );
+
+				int i;
+				for( i = 0 ; i < m ; i++ )
+				{
+					if( i > 0 && sparEqual( temp[i], temp[ i - 1 ] ) )
+					{
+						runCount[ runs - 1 ] += 1.0;
+					}
+					else
+					{
+						runValue[runs] = temp[i];
+						runCount[runs] = 1.0;
+						runs++;
+					}
+				}
+			}
+		}
+	}
+
+	// Distinct values, sorted
+	int distinct, i;
+	sparType *values;
+	double *counts;
+	values = (sparType*) malloc( runs * sizeof(sparType) );
+	counts = (double*) calloc( runs, sizeof(double) );
+
+	if( values == NULL || counts == NULL )
+	{
+	   fprintf(stderr, "sparDominant error: Out of memory\n");
+	   exit(1);
+	}
+
+	memcpy( values, runValue, runs * sizeof(sparType) );
+	qsort( values, runs, sizeof(sparType), sparCompare );
+	distinct = 1;
+	for( i = 1 ; i < runs ; i++ )
+	{
+		if( sparEqual( values[i], values[ distinct - 1 ] ) == 0 )
+		{
+			values[ distinct++ ] = values[i];
+		}
+	}
+
+	// Count per distinct value
+	for( i = 0 ; i < runs ; i++ )
+	{
+		sparType *v;
+		v = (sparType*) bsearch( runValue + i, values, distinct, sizeof(sparType), sparCompare );
+		counts[ v - values ] += runCount[i];
+	}
+
+	// Most frequent, first in sorted order on ties
+	int best;
+	best = 0;
+	for( i = 1 ; i < distinct ; i++ )
+	{
+		if( counts[i] > counts[best] )
+		{
+			best = i;
+		}
+	}
+
+	sparType value;
+	value = values[best];
+
+	if( count != NULL )
+	{
+		*count = counts[best];
+	}
+
+	free(runValue);
+	free(runCount);
+	free(temp);
+	free(values);
+	free(counts);
+
+	return value;
+}
@@ -1,35 +1,140 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <stdint.h>
+
+// Block locks, C11 atomic_flag or std::atomic_flag when compiled as C++
+#ifdef __cplusplus
+#include <atomic>
+using std::atomic_flag;
+using std::atomic_flag_clear;
+using std::atomic_flag_clear_explicit;
+using std::atomic_flag_test_and_set_explicit;
+using std::memory_order_acquire;
+using std::memory_order_release;
+#else
+#include <stdatomic.h>
+#endif
 
 // Do not edit!
 // Automatically-generated file from sparTemplate.h
 
+// Element-wise operations
+#define SPAR_ADD  1 // a + b
+#define SPAR_SUB  2 // a - b
+#define SPAR_MUL  3 // a * b
+#define SPAR_MIN  4 // Minimum of a and b
+#define SPAR_MAX  5 // Maximum of a and b
+#define SPAR_MASK 6 // a where b is non-zero, default value elsewhere
+
+// Reductions, besides SPAR_ADD (sum), SPAR_MIN and SPAR_MAX
+#define SPAR_COUNT 7 // Number of elements different from the default value
+#define SPAR_MEAN  8 // Mean value
+#define SPAR_MODE  9 // Most frequent value, smallest on ties
+
 // Matrix struct
 typedef struct sparChar
 {
-	int nx, ny, nz;       // Matrix size (nx,ny,nz)
-	int bs, bs3;          // Block size (bs,bs,bs)
-	int mx, my, mz;       // Block matrix size (mx,my,mz)
-	char *blockValue; // Uniform block data
-	char **blockData; // Heterogeneous block data
-	char def;         // Default value
+	int nx, ny, nz;         // Matrix size (nx,ny,nz)
+	int bs, bs3;            // Block size (bs,bs,bs)
+	int mx, my, mz;         // Block matrix size (mx,my,mz)
+	char *blockValue;   // Uniform block data
+	char **blockData;   // Heterogeneous block data
+	char def;           // Default value
+	atomic_flag *blockLock; // Block locks for thread-safe access
+	int ox, oy, oz;         // Ring buffer origin (ox,oy,oz) in world coordinates
 } sparChar;
 
+// Matrix struct
+typedef struct sparInt
+{
+	int nx, ny, nz;         // Matrix size (nx,ny,nz)
+	int bs, bs3;            // Block size (bs,bs,bs)
+	int mx, my, mz;         // Block matrix size (mx,my,mz)
+	int *blockValue;   // Uniform block data
+	int **blockData;   // Heterogeneous block data
+	int def;           // Default value
+	atomic_flag *blockLock; // Block locks for thread-safe access
+	int ox, oy, oz;         // Ring buffer origin (ox,oy,oz) in world coordinates
+} sparInt;
+
+// Matrix struct
+typedef struct sparLong
+{
+	int nx, ny, nz;         // Matrix size (nx,ny,nz)
+	int bs, bs3;            // Block size (bs,bs,bs)
+	int mx, my, mz;         // Block matrix size (mx,my,mz)
+	long *blockValue;   // Uniform block data
+	long **blockData;   // Heterogeneous block data
+	long def;           // Default value
+	atomic_flag *blockLock; // Block locks for thread-safe access
+	int ox, oy, oz;         // Ring buffer origin (ox,oy,oz) in world coordinates
+} sparLong;
+
+// Matrix struct
+typedef struct sparFloat
+{
+	int nx, ny, nz;         // Matrix size (nx,ny,nz)
+	int bs, bs3;            // Block size (bs,bs,bs)
+	int mx, my, mz;         // Block matrix size (mx,my,mz)
+	float *blockValue;   // Uniform block data
+	float **blockData;   // Heterogeneous block data
+	float def;           // Default value
+	atomic_flag *blockLock; // Block locks for thread-safe access
+	int ox, oy, oz;         // Ring buffer origin (ox,oy,oz) in world coordinates
+} sparFloat;
+
+// Matrix struct
+typedef struct sparDouble
+{
+	int nx, ny, nz;         // Matrix size (nx,ny,nz)
+	int bs, bs3;            // Block size (bs,bs,bs)
+	int mx, my, mz;         // Block matrix size (mx,my,mz)
+	double *blockValue;   // Uniform block data
+	double **blockData;   // Heterogeneous block data
+	double def;           // Default value
+	atomic_flag *blockLock; // Block locks for thread-safe access
+	int ox, oy, oz;         // Ring buffer origin (ox,oy,oz) in world coordinates
+} sparDouble;
+
 // Matrix constructor
 sparChar* sparCharInit( int nx, int ny, int nz, int bs, char def );
+// Clear (unlock) every block lock, flags are not assumed clear after allocation
+void sparCharClearLocks( sparChar *matrix );
 // Matrix destructor
 void sparCharFree( sparChar *matrix );
 // Reset matrix values
 void sparCharReset( sparChar *matrix );
 // Get matrix memory usage in bytes
 double sparCharMemory( sparChar *matrix );
+// Element equality, NaN equal to NaN so NaN regions compress like any other uniform value
+int sparCharEqual( char a, char b );
+// Convert x to the data type, rounding to nearest for integer types instead of truncating
+char sparCharRound( double x );
 // Check if block is uniform
 int sparCharUniformBlock( sparChar *matrix, int x, int y, int z );
+// Expand uniform block (x,y,z) into heterogeneous block data
+void sparCharExpandBlock( sparChar *matrix, int x, int y, int z );
+// Reduce block (x,y,z) to uniform if possible, return 1 if uniform
+int sparCharReduceBlock( sparChar *matrix, int x, int y, int z );
+// Check if every block overlapping box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) is uniform with the same value
+int sparCharUniformBox( sparChar *matrix, int x, int y, int z, int sx, int sy, int sz, char *value );
+// Copy box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) into buffer[i+sx*(j+sy*k)], default value outside the matrix
+void sparCharGetBox( sparChar *matrix, int x, int y, int z, int sx, int sy, int sz, char *buffer );
+// Copy buffer[i+sx*(j+sy*k)] into box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1), elements outside the matrix are ignored
+void sparCharSetBox( sparChar *matrix, int x, int y, int z, int sx, int sy, int sz, char *buffer );
+// Set every element of box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) to value, elements outside the matrix are ignored
+void sparCharFillBox( sparChar *matrix, int x, int y, int z, int sx, int sy, int sz, char value );
 // Set matrix element (x,y,z)
 void sparCharSet( sparChar *matrix, int x, int y, int z, char value );
 // Get matrix element (x,y,z)
 char sparCharGet( sparChar *matrix, int x, int y, int z );
+// Set matrix element (x,y,z) locking its block, safe for parallel writers
+void sparCharSetSafe( sparChar *matrix, int x, int y, int z, char value );
+// Get matrix element (x,y,z) locking its block, safe with parallel writers
+char sparCharGetSafe( sparChar *matrix, int x, int y, int z );
 // Duplicate matrix
 sparChar* sparCharDuplicate( sparChar *matrix );
 // Get matrix memory usage in bytes under certain block size
@@ -40,32 +145,169 @@ void sparCharChangeBs( sparChar *matrix, int bs );
 void sparCharOptimizeBs( sparChar *matrix );
 // Resize matrix
 void sparCharResize( sparChar *matrix, int nx, int ny, int nz );
-
-// Matrix struct
-typedef struct sparInt
-{
-	int nx, ny, nz;       // Matrix size (nx,ny,nz)
-	int bs, bs3;          // Block size (bs,bs,bs)
-	int mx, my, mz;       // Block matrix size (mx,my,mz)
-	int *blockValue; // Uniform block data
-	int **blockData; // Heterogeneous block data
-	int def;         // Default value
-} sparInt;
+// Sum of matrix elements
+double sparCharSum( sparChar *matrix );
+// First matrix element in block order that is not NaN, NaN only if every element is NaN
+char sparCharFirstNumber( sparChar *matrix );
+// Minimum matrix element, NaN elements ignored (NaN only if all are NaN)
+char sparCharMin( sparChar *matrix );
+// Maximum matrix element, NaN elements ignored (NaN only if all are NaN)
+char sparCharMax( sparChar *matrix );
+// Number of matrix elements different from the default value
+double sparCharCount( sparChar *matrix );
+// Fold f over matrix elements from identity, f gets each uniform block once with its element count
+double sparCharReduce( sparChar *matrix, double (*f)( double acc, char value, int count ), double identity );
+// Apply function f to every matrix element (and default value) in place
+void sparCharApply( sparChar *matrix, char (*f)( char ) );
+// New matrix with function f applied to every element (and default value)
+sparChar* sparCharMap( sparChar *matrix, char (*f)( char ) );
+// Visit elements different from the default value, in block order
+void sparCharForEach( sparChar *matrix, void (*f)( int x, int y, int z, char value, void *data ), void *data );
+// Visit maximal runs of equal non-default elements along x, (x,y,z) to (x+n-1,y,z), merged across blocks
+void sparCharForEachRun( sparChar *matrix, void (*f)( int x, int y, int z, int n, char value, void *data ), void *data );
+// Element-wise operation between arrays, c[i] = a[i] op b[i]
+void sparCharOpArray( char *c, char *a, char *b, int n, int op, char def );
+// Element-wise operation between array and scalar, c[i] = a[i] op value
+void sparCharOpArrayScalar( char *c, char *a, char value, int n, int op, char def );
+// New matrix with element-wise operation between matrices, c = a op b
+sparChar* sparCharOp( sparChar *a, sparChar *b, int op );
+// Element-wise operation with scalar in place, matrix = matrix op value
+void sparCharOpScalar( sparChar *matrix, char value, int op );
+// Stencil of radius r from src into dst, f(c) reads neighbours c[i+sy*j+sz*k] with -r <= i,j,k <= r
+void sparCharStencil( sparChar *dst, sparChar *src, int r, char (*f)( char *c, int r, int sy, int sz, void *data ), void *data );
+// Stencil kernel, weighted sum of the neighbourhood with data holding (2r+1)^3 weights
+char sparCharConvolveKernel( char *c, int r, int sy, int sz, void *data );
+// Convolution of src into dst with weights[(i+r)+(2r+1)*((j+r)+(2r+1)*(k+r))]
+void sparCharConvolve( sparChar *dst, sparChar *src, int r, double *weights );
+// One-dimensional filter of src into dst along axis (0 x, 1 y, 2 z) with 2r+1 weights, box (moving average) if weights is NULL
+void sparCharFilterAxis( sparChar *dst, sparChar *src, int axis, int r, double *weights );
+// Box filter (mean over (2r+1)^3 neighbourhood) of src into dst, three one-dimensional passes
+void sparCharBoxFilter( sparChar *dst, sparChar *src, int r );
+// Gaussian filter of standard deviation sigma of src into dst, three one-dimensional passes
+void sparCharGaussianFilter( sparChar *dst, sparChar *src, double sigma );
+// Union-find root of node i with path halving (connected component labeling)
+int sparCharLabelFind( int *parent, int i );
+// Union-find merge of the sets of nodes i and j, the smallest node is kept as root
+void sparCharLabelUnion( int *parent, int i, int j );
+// Union-find node of element (x,y,z), -1 for elements equal to the default value
+int sparCharLabelNode( sparChar *matrix, int *offset, int x, int y, int z );
+// Connect block (x,y,z) with its neighbour block across the lower face along axis (0 x, 1 y, 2 z)
+void sparCharLabelFace( sparChar *matrix, int *offset, int *parent, int x, int y, int z, int axis );
+// Connect elements inside heterogeneous block (x,y,z)
+void sparCharLabelBlock( sparChar *matrix, int *offset, int *parent, int x, int y, int z );
+// Label 6-connected regions of non-default elements into labels (0 elsewhere), return number of regions
+int sparCharLabel( sparChar *matrix, sparInt *labels );
+// Squared distance transform of sampled function f into d (Felzenszwalb), v and z hold n and n+1 elements
+void sparCharDistanceLine( double *f, double *d, int n, int *v, double *z );
+// Squared distance pass along axis (0 x, 1 y, 2 z) in place, or from features of matrix if not NULL (default elements if inside)
+void sparCharDistanceAxis( sparChar *matrix, sparFloat *distance, int axis, float big, int inside );
+// Euclidean distance from each element to the nearest non-default element clamped at maxDistance, negative inside if sign
+void sparCharDistance( sparChar *matrix, sparFloat *distance, float maxDistance, int sign );
+// Cast ray o+t*d (element (x,y,z) spans [x,x+1)) for 0 <= t <= tmax, return 1 with first non-default element hit[3] at t
+int sparCharRay( sparChar *matrix, double *o, double *d, double tmax, int *hit, double *t );
+// Cast n rays o[3*i]+t*d[3*i] in parallel, hits[3*i] and t[i] (-1 if missed), return number of hits
+int sparCharRays( sparChar *matrix, int n, double *o, double *d, double tmax, int *hits, double *t );
+// Copy plane at index along axis into buffer, YZ (axis 0) y+ny*z, XZ (axis 1) x+nx*z, XY (axis 2) x+nx*y
+void sparCharSlice( sparChar *matrix, int axis, int index, char *buffer );
+// Accumulate value, repeated count times, into o[0..n-1] with op (projection kernel)
+void sparCharProjectValue( double *o, int n, char value, int count, int op, char def );
+// Accumulate row[0..n-1] into o[0..n-1], or into o[0] if reduce, with op (projection kernel)
+void sparCharProjectRow( double *o, char *row, int n, int op, int reduce, char def );
+// Project along axis with op (SPAR_ADD, SPAR_MIN, SPAR_MAX, SPAR_COUNT) into dense plane, same layout as slices
+void sparCharProject( sparChar *matrix, int axis, int op, double *buffer );
+// Order of two elements for qsort, NaN last
+int sparCharCompare( const void *a, const void *b );
+// Recompute blocks of dst overlapping box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) from factor^3 cells of src, op SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE
+void sparCharDownsampleBox( sparChar *dst, sparChar *src, int factor, int op, int x, int y, int z, int sx, int sy, int sz );
+// New matrix downsampled by factor with op (SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE)
+sparChar* sparCharDownsample( sparChar *matrix, int factor, int op );
+// Pyramid of levels matrices downsampled by 2, 4, 8... with op (SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE)
+void sparCharPyramid( sparChar *matrix, int levels, int op, sparChar **pyramid );
+// Update pyramid after changes of matrix in box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1)
+void sparCharPyramidUpdate( sparChar *matrix, int levels, int op, sparChar **pyramid, int x, int y, int z, int sx, int sy, int sz );
+// Trilinear interpolation at (x,y,z), element (i,j,k) at integer coordinates, clamped to the matrix bounds
+double sparCharSample( sparChar *matrix, double x, double y, double z );
+// Trilinear interpolation at n points p[3*i] in parallel into values[i]
+void sparCharSamples( sparChar *matrix, int n, double *p, double *values );
+// Marching cubes triangle edges of cube case c (bit i set if corner i is above the iso value), return number of triangles
+int sparCharCubeTriangles( int c, int *edges );
+// Order of two edge keys for qsort
+int sparCharCompareKey( const void *a, const void *b );
+// Marching cubes isosurface at iso into vertices[3*i] and triangles[3*j] (malloc, free after use), nt triangles, return number of vertices
+int sparCharIsosurface( sparChar *matrix, double iso, double **vertices, int **triangles, int *nt );
+// Copy block (i,j,k) of src into block (x,y,z) of dst, same block size
+void sparCharCopyBlock( sparChar *dst, int x, int y, int z, sparChar *src, int i, int j, int k );
+// New matrix with box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1), elements outside the matrix set to default, ring buffer origin reset
+sparChar* sparCharCrop( sparChar *matrix, int x, int y, int z, int sx, int sy, int sz );
+// Write src into matrix at (x,y,z), clipped to the matrix
+void sparCharPaste( sparChar *matrix, sparChar *src, int x, int y, int z );
+// Shift contents by (dx,dy,dz), element (x,y,z) moves to (x+dx,y+dy,z+dz), vacated elements set to default
+void sparCharShift( sparChar *matrix, int dx, int dy, int dz );
+// Ring buffer index of world coordinate w in a ring of size n
+int sparCharRingIndex( int w, int n );
+// Set element at world coordinates (x,y,z) of the ring buffer window, ignored outside the window
+void sparCharRingSet( sparChar *matrix, int x, int y, int z, char value );
+// Get element at world coordinates (x,y,z) of the ring buffer window, default value outside the window
+char sparCharRingGet( sparChar *matrix, int x, int y, int z );
+// Move the ring buffer window origin to world coordinates (x,y,z), elements entering the window set to default
+void sparCharRingMove( sparChar *matrix, int x, int y, int z );
+// New matrix with permuted axes, new x, y and z axes are the axes ax, ay and az (0 x, 1 y, 2 z) of matrix
+sparChar* sparCharPermute( sparChar *matrix, int ax, int ay, int az );
+// Allocate n elements 64-byte aligned with plain malloc (no C11 aligned_alloc), release with the matching DenseFree
+char* sparCharDenseAlloc( long n );
+// Free dense buffer returned by Densify or DenseAlloc
+void sparCharDenseFree( char *buffer );
+// Dense copy padded to (px,py,pz) with the default value, rows along axis contiguous and 64-byte aligned every pitch elements (free with sparCharDenseFree)
+char* sparCharDensify( sparChar *matrix, int axis, int px, int py, int pz, int *pitch );
+// Copy dense buffer with element (x,y,z) at x*sx+y*sy+z*sz into matrix, uniform blocks detected
+void sparCharSetDense( sparChar *matrix, char *buffer, long sx, long sy, long sz );
+// Copy dense buffer with the densify layout (axis, pitch and padded size) into matrix, uniform blocks detected
+void sparCharSparsify( sparChar *matrix, char *buffer, int axis, int pitch, int px, int py, int pz );
+// New matrix from dense buffer with element (x,y,z) at x*sx+y*sy+z*sz, only heterogeneous blocks allocated
+sparChar* sparCharInitDense( char *buffer, int nx, int ny, int nz, long sx, long sy, long sz, int bs, char def );
+// Copy matrix into dense buffer with element (x,y,z) at x*sx+y*sy+z*sz
+void sparCharGetDense( sparChar *matrix, char *buffer, long sx, long sy, long sz );
+// Change the default value, uniform blocks with the previous default value set to the new one
+void sparCharSetDefault( sparChar *matrix, char def );
+// Most frequent value in box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) clipped to the matrix, smallest on ties, its count in count if not NULL
+char sparCharDominant( sparChar *matrix, int x, int y, int z, int sx, int sy, int sz, double *count );
 
 // Matrix constructor
 sparInt* sparIntInit( int nx, int ny, int nz, int bs, int def );
+// Clear (unlock) every block lock, flags are not assumed clear after allocation
+void sparIntClearLocks( sparInt *matrix );
 // Matrix destructor
 void sparIntFree( sparInt *matrix );
 // Reset matrix values
 void sparIntReset( sparInt *matrix );
 // Get matrix memory usage in bytes
 double sparIntMemory( sparInt *matrix );
+// Element equality, NaN equal to NaN so NaN regions compress like any other uniform value
+int sparIntEqual( int a, int b );
+// Convert x to the data type, rounding to nearest for integer types instead of truncating
+int sparIntRound( double x );
 // Check if block is uniform
 int sparIntUniformBlock( sparInt *matrix, int x, int y, int z );
+// Expand uniform block (x,y,z) into heterogeneous block data
+void sparIntExpandBlock( sparInt *matrix, int x, int y, int z );
+// Reduce block (x,y,z) to uniform if possible, return 1 if uniform
+int sparIntReduceBlock( sparInt *matrix, int x, int y, int z );
+// Check if every block overlapping box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) is uniform with the same value
+int sparIntUniformBox( sparInt *matrix, int x, int y, int z, int sx, int sy, int sz, int *value );
+// Copy box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) into buffer[i+sx*(j+sy*k)], default value outside the matrix
+void sparIntGetBox( sparInt *matrix, int x, int y, int z, int sx, int sy, int sz, int *buffer );
+// Copy buffer[i+sx*(j+sy*k)] into box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1), elements outside the matrix are ignored
+void sparIntSetBox( sparInt *matrix, int x, int y, int z, int sx, int sy, int sz, int *buffer );
+// Set every element of box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) to value, elements outside the matrix are ignored
+void sparIntFillBox( sparInt *matrix, int x, int y, int z, int sx, int sy, int sz, int value );
 // Set matrix element (x,y,z)
 void sparIntSet( sparInt *matrix, int x, int y, int z, int value );
 // Get matrix element (x,y,z)
 int sparIntGet( sparInt *matrix, int x, int y, int z );
+// Set matrix element (x,y,z) locking its block, safe for parallel writers
+void sparIntSetSafe( sparInt *matrix, int x, int y, int z, int value );
+// Get matrix element (x,y,z) locking its block, safe with parallel writers
+int sparIntGetSafe( sparInt *matrix, int x, int y, int z );
 // Duplicate matrix
 sparInt* sparIntDuplicate( sparInt *matrix );
 // Get matrix memory usage in bytes under certain block size
@@ -76,32 +318,169 @@ void sparIntChangeBs( sparInt *matrix, int bs );
 void sparIntOptimizeBs( sparInt *matrix );
 // Resize matrix
 void sparIntResize( sparInt *matrix, int nx, int ny, int nz );
-
-// Matrix struct
-typedef struct sparLong
-{
-	int nx, ny, nz;       // Matrix size (nx,ny,nz)
-	int bs, bs3;          // Block size (bs,bs,bs)
-	int mx, my, mz;       // Block matrix size (mx,my,mz)
-	long *blockValue; // Uniform block data
-	long **blockData; // Heterogeneous block data
-	long def;         // Default value
-} sparLong;
+// Sum of matrix elements
+double sparIntSum( sparInt *matrix );
+// First matrix element in block order that is not NaN, NaN only if every element is NaN
+int sparIntFirstNumber( sparInt *matrix );
+// Minimum matrix element, NaN elements ignored (NaN only if all are NaN)
+int sparIntMin( sparInt *matrix );
+// Maximum matrix element, NaN elements ignored (NaN only if all are NaN)
+int sparIntMax( sparInt *matrix );
+// Number of matrix elements different from the default value
+double sparIntCount( sparInt *matrix );
+// Fold f over matrix elements from identity, f gets each uniform block once with its element count
+double sparIntReduce( sparInt *matrix, double (*f)( double acc, int value, int count ), double identity );
+// Apply function f to every matrix element (and default value) in place
+void sparIntApply( sparInt *matrix, int (*f)( int ) );
+// New matrix with function f applied to every element (and default value)
+sparInt* sparIntMap( sparInt *matrix, int (*f)( int ) );
+// Visit elements different from the default value, in block order
+void sparIntForEach( sparInt *matrix, void (*f)( int x, int y, int z, int value, void *data ), void *data );
+// Visit maximal runs of equal non-default elements along x, (x,y,z) to (x+n-1,y,z), merged across blocks
+void sparIntForEachRun( sparInt *matrix, void (*f)( int x, int y, int z, int n, int value, void *data ), void *data );
+// Element-wise operation between arrays, c[i] = a[i] op b[i]
+void sparIntOpArray( int *c, int *a, int *b, int n, int op, int def );
+// Element-wise operation between array and scalar, c[i] = a[i] op value
+void sparIntOpArrayScalar( int *c, int *a, int value, int n, int op, int def );
+// New matrix with element-wise operation between matrices, c = a op b
+sparInt* sparIntOp( sparInt *a, sparInt *b, int op );
+// Element-wise operation with scalar in place, matrix = matrix op value
+void sparIntOpScalar( sparInt *matrix, int value, int op );
+// Stencil of radius r from src into dst, f(c) reads neighbours c[i+sy*j+sz*k] with -r <= i,j,k <= r
+void sparIntStencil( sparInt *dst, sparInt *src, int r, int (*f)( int *c, int r, int sy, int sz, void *data ), void *data );
+// Stencil kernel, weighted sum of the neighbourhood with data holding (2r+1)^3 weights
+int sparIntConvolveKernel( int *c, int r, int sy, int sz, void *data );
+// Convolution of src into dst with weights[(i+r)+(2r+1)*((j+r)+(2r+1)*(k+r))]
+void sparIntConvolve( sparInt *dst, sparInt *src, int r, double *weights );
+// One-dimensional filter of src into dst along axis (0 x, 1 y, 2 z) with 2r+1 weights, box (moving average) if weights is NULL
+void sparIntFilterAxis( sparInt *dst, sparInt *src, int axis, int r, double *weights );
+// Box filter (mean over (2r+1)^3 neighbourhood) of src into dst, three one-dimensional passes
+void sparIntBoxFilter( sparInt *dst, sparInt *src, int r );
+// Gaussian filter of standard deviation sigma of src into dst, three one-dimensional passes
+void sparIntGaussianFilter( sparInt *dst, sparInt *src, double sigma );
+// Union-find root of node i with path halving (connected component labeling)
+int sparIntLabelFind( int *parent, int i );
+// Union-find merge of the sets of nodes i and j, the smallest node is kept as root
+void sparIntLabelUnion( int *parent, int i, int j );
+// Union-find node of element (x,y,z), -1 for elements equal to the default value
+int sparIntLabelNode( sparInt *matrix, int *offset, int x, int y, int z );
+// Connect block (x,y,z) with its neighbour block across the lower face along axis (0 x, 1 y, 2 z)
+void sparIntLabelFace( sparInt *matrix, int *offset, int *parent, int x, int y, int z, int axis );
+// Connect elements inside heterogeneous block (x,y,z)
+void sparIntLabelBlock( sparInt *matrix, int *offset, int *parent, int x, int y, int z );
+// Label 6-connected regions of non-default elements into labels (0 elsewhere), return number of regions
+int sparIntLabel( sparInt *matrix, sparInt *labels );
+// Squared distance transform of sampled function f into d (Felzenszwalb), v and z hold n and n+1 elements
+void sparIntDistanceLine( double *f, double *d, int n, int *v, double *z );
+// Squared distance pass along axis (0 x, 1 y, 2 z) in place, or from features of matrix if not NULL (default elements if inside)
+void sparIntDistanceAxis( sparInt *matrix, sparFloat *distance, int axis, float big, int inside );
+// Euclidean distance from each element to the nearest non-default element clamped at maxDistance, negative inside if sign
+void sparIntDistance( sparInt *matrix, sparFloat *distance, float maxDistance, int sign );
+// Cast ray o+t*d (element (x,y,z) spans [x,x+1)) for 0 <= t <= tmax, return 1 with first non-default element hit[3] at t
+int sparIntRay( sparInt *matrix, double *o, double *d, double tmax, int *hit, double *t );
+// Cast n rays o[3*i]+t*d[3*i] in parallel, hits[3*i] and t[i] (-1 if missed), return number of hits
+int sparIntRays( sparInt *matrix, int n, double *o, double *d, double tmax, int *hits, double *t );
+// Copy plane at index along axis into buffer, YZ (axis 0) y+ny*z, XZ (axis 1) x+nx*z, XY (axis 2) x+nx*y
+void sparIntSlice( sparInt *matrix, int axis, int index, int *buffer );
+// Accumulate value, repeated count times, into o[0..n-1] with op (projection kernel)
+void sparIntProjectValue( double *o, int n, int value, int count, int op, int def );
+// Accumulate row[0..n-1] into o[0..n-1], or into o[0] if reduce, with op (projection kernel)
+void sparIntProjectRow( double *o, int *row, int n, int op, int reduce, int def );
+// Project along axis with op (SPAR_ADD, SPAR_MIN, SPAR_MAX, SPAR_COUNT) into dense plane, same layout as slices
+void sparIntProject( sparInt *matrix, int axis, int op, double *buffer );
+// Order of two elements for qsort, NaN last
+int sparIntCompare( const void *a, const void *b );
+// Recompute blocks of dst overlapping box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) from factor^3 cells of src, op SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE
+void sparIntDownsampleBox( sparInt *dst, sparInt *src, int factor, int op, int x, int y, int z, int sx, int sy, int sz );
+// New matrix downsampled by factor with op (SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE)
+sparInt* sparIntDownsample( sparInt *matrix, int factor, int op );
+// Pyramid of levels matrices downsampled by 2, 4, 8... with op (SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE)
+void sparIntPyramid( sparInt *matrix, int levels, int op, sparInt **pyramid );
+// Update pyramid after changes of matrix in box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1)
+void sparIntPyramidUpdate( sparInt *matrix, int levels, int op, sparInt **pyramid, int x, int y, int z, int sx, int sy, int sz );
+// Trilinear interpolation at (x,y,z), element (i,j,k) at integer coordinates, clamped to the matrix bounds
+double sparIntSample( sparInt *matrix, double x, double y, double z );
+// Trilinear interpolation at n points p[3*i] in parallel into values[i]
+void sparIntSamples( sparInt *matrix, int n, double *p, double *values );
+// Marching cubes triangle edges of cube case c (bit i set if corner i is above the iso value), return number of triangles
+int sparIntCubeTriangles( int c, int *edges );
+// Order of two edge keys for qsort
+int sparIntCompareKey( const void *a, const void *b );
+// Marching cubes isosurface at iso into vertices[3*i] and triangles[3*j] (malloc, free after use), nt triangles, return number of vertices
+int sparIntIsosurface( sparInt *matrix, double iso, double **vertices, int **triangles, int *nt );
+// Copy block (i,j,k) of src into block (x,y,z) of dst, same block size
+void sparIntCopyBlock( sparInt *dst, int x, int y, int z, sparInt *src, int i, int j, int k );
+// New matrix with box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1), elements outside the matrix set to default, ring buffer origin reset
+sparInt* sparIntCrop( sparInt *matrix, int x, int y, int z, int sx, int sy, int sz );
+// Write src into matrix at (x,y,z), clipped to the matrix
+void sparIntPaste( sparInt *matrix, sparInt *src, int x, int y, int z );
+// Shift contents by (dx,dy,dz), element (x,y,z) moves to (x+dx,y+dy,z+dz), vacated elements set to default
+void sparIntShift( sparInt *matrix, int dx, int dy, int dz );
+// Ring buffer index of world coordinate w in a ring of size n
+int sparIntRingIndex( int w, int n );
+// Set element at world coordinates (x,y,z) of the ring buffer window, ignored outside the window
+void sparIntRingSet( sparInt *matrix, int x, int y, int z, int value );
+// Get element at world coordinates (x,y,z) of the ring buffer window, default value outside the window
+int sparIntRingGet( sparInt *matrix, int x, int y, int z );
+// Move the ring buffer window origin to world coordinates (x,y,z), elements entering the window set to default
+void sparIntRingMove( sparInt *matrix, int x, int y, int z );
+// New matrix with permuted axes, new x, y and z axes are the axes ax, ay and az (0 x, 1 y, 2 z) of matrix
+sparInt* sparIntPermute( sparInt *matrix, int ax, int ay, int az );
+// Allocate n elements 64-byte aligned with plain malloc (no C11 aligned_alloc), release with the matching DenseFree
+int* sparIntDenseAlloc( long n );
+// Free dense buffer returned by Densify or DenseAlloc
+void sparIntDenseFree( int *buffer );
+// Dense copy padded to (px,py,pz) with the default value, rows along axis contiguous and 64-byte aligned every pitch elements (free with sparIntDenseFree)
+int* sparIntDensify( sparInt *matrix, int axis, int px, int py, int pz, int *pitch );
+// Copy dense buffer with element (x,y,z) at x*sx+y*sy+z*sz into matrix, uniform blocks detected
+void sparIntSetDense( sparInt *matrix, int *buffer, long sx, long sy, long sz );
+// Copy dense buffer with the densify layout (axis, pitch and padded size) into matrix, uniform blocks detected
+void sparIntSparsify( sparInt *matrix, int *buffer, int axis, int pitch, int px, int py, int pz );
+// New matrix from dense buffer with element (x,y,z) at x*sx+y*sy+z*sz, only heterogeneous blocks allocated
+sparInt* sparIntInitDense( int *buffer, int nx, int ny, int nz, long sx, long sy, long sz, int bs, int def );
+// Copy matrix into dense buffer with element (x,y,z) at x*sx+y*sy+z*sz
+void sparIntGetDense( sparInt *matrix, int *buffer, long sx, long sy, long sz );
+// Change the default value, uniform blocks with the previous default value set to the new one
+void sparIntSetDefault( sparInt *matrix, int def );
+// Most frequent value in box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) clipped to the matrix, smallest on ties, its count in count if not NULL
+int sparIntDominant( sparInt *matrix, int x, int y, int z, int sx, int sy, int sz, double *count );
 
 // Matrix constructor
 sparLong* sparLongInit( int nx, int ny, int nz, int bs, long def );
+// Clear (unlock) every block lock, flags are not assumed clear after allocation
+void sparLongClearLocks( sparLong *matrix );
 // Matrix destructor
 void sparLongFree( sparLong *matrix );
 // Reset matrix values
 void sparLongReset( sparLong *matrix );
 // Get matrix memory usage in bytes
 double sparLongMemory( sparLong *matrix );
+// Element equality, NaN equal to NaN so NaN regions compress like any other uniform value
+int sparLongEqual( long a, long b );
+// Convert x to the data type, rounding to nearest for integer types instead of truncating
+long sparLongRound( double x );
 // Check if block is uniform
 int sparLongUniformBlock( sparLong *matrix, int x, int y, int z );
+// Expand uniform block (x,y,z) into heterogeneous block data
+void sparLongExpandBlock( sparLong *matrix, int x, int y, int z );
+// Reduce block (x,y,z) to uniform if possible, return 1 if uniform
+int sparLongReduceBlock( sparLong *matrix, int x, int y, int z );
+// Check if every block overlapping box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) is uniform with the same value
+int sparLongUniformBox( sparLong *matrix, int x, int y, int z, int sx, int sy, int sz, long *value );
+// Copy box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) into buffer[i+sx*(j+sy*k)], default value outside the matrix
+void sparLongGetBox( sparLong *matrix, int x, int y, int z, int sx, int sy, int sz, long *buffer );
+// Copy buffer[i+sx*(j+sy*k)] into box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1), elements outside the matrix are ignored
+void sparLongSetBox( sparLong *matrix, int x, int y, int z, int sx, int sy, int sz, long *buffer );
+// Set every element of box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) to value, elements outside the matrix are ignored
+void sparLongFillBox( sparLong *matrix, int x, int y, int z, int sx, int sy, int sz, long value );
 // Set matrix element (x,y,z)
 void sparLongSet( sparLong *matrix, int x, int y, int z, long value );
 // Get matrix element (x,y,z)
 long sparLongGet( sparLong *matrix, int x, int y, int z );
+// Set matrix element (x,y,z) locking its block, safe for parallel writers
+void sparLongSetSafe( sparLong *matrix, int x, int y, int z, long value );
+// Get matrix element (x,y,z) locking its block, safe with parallel writers
+long sparLongGetSafe( sparLong *matrix, int x, int y, int z );
 // Duplicate matrix
 sparLong* sparLongDuplicate( sparLong *matrix );
 // Get matrix memory usage in bytes under certain block size
@@ -112,32 +491,169 @@ void sparLongChangeBs( sparLong *matrix, int bs );
 void sparLongOptimizeBs( sparLong *matrix );
 // Resize matrix
 void sparLongResize( sparLong *matrix, int nx, int ny, int nz );
-
-// Matrix struct
-typedef struct sparFloat
-{
-	int nx, ny, nz;       // Matrix size (nx,ny,nz)
-	int bs, bs3;          // Block size (bs,bs,bs)
-	int mx, my, mz;       // Block matrix size (mx,my,mz)
-	float *blockValue; // Uniform block data
-	float **blockData; // Heterogeneous block data
-	float def;         // Default value
-} sparFloat;
+// Sum of matrix elements
+double sparLongSum( sparLong *matrix );
+// First matrix element in block order that is not NaN, NaN only if every element is NaN
+long sparLongFirstNumber( sparLong *matrix );
+// Minimum matrix element, NaN elements ignored (NaN only if all are NaN)
+long sparLongMin( sparLong *matrix );
+// Maximum matrix element, NaN elements ignored (NaN only if all are NaN)
+long sparLongMax( sparLong *matrix );
+// Number of matrix elements different from the default value
+double sparLongCount( sparLong *matrix );
+// Fold f over matrix elements from identity, f gets each uniform block once with its element count
+double sparLongReduce( sparLong *matrix, double (*f)( double acc, long value, int count ), double identity );
+// Apply function f to every matrix element (and default value) in place
+void sparLongApply( sparLong *matrix, long (*f)( long ) );
+// New matrix with function f applied to every element (and default value)
+sparLong* sparLongMap( sparLong *matrix, long (*f)( long ) );
+// Visit elements different from the default value, in block order
+void sparLongForEach( sparLong *matrix, void (*f)( int x, int y, int z, long value, void *data ), void *data );
+// Visit maximal runs of equal non-default elements along x, (x,y,z) to (x+n-1,y,z), merged across blocks
+void sparLongForEachRun( sparLong *matrix, void (*f)( int x, int y, int z, int n, long value, void *data ), void *data );
+// Element-wise operation between arrays, c[i] = a[i] op b[i]
+void sparLongOpArray( long *c, long *a, long *b, int n, int op, long def );
+// Element-wise operation between array and scalar, c[i] = a[i] op value
+void sparLongOpArrayScalar( long *c, long *a, long value, int n, int op, long def );
+// New matrix with element-wise operation between matrices, c = a op b
+sparLong* sparLongOp( sparLong *a, sparLong *b, int op );
+// Element-wise operation with scalar in place, matrix = matrix op value
+void sparLongOpScalar( sparLong *matrix, long value, int op );
+// Stencil of radius r from src into dst, f(c) reads neighbours c[i+sy*j+sz*k] with -r <= i,j,k <= r
+void sparLongStencil( sparLong *dst, sparLong *src, int r, long (*f)( long *c, int r, int sy, int sz, void *data ), void *data );
+// Stencil kernel, weighted sum of the neighbourhood with data holding (2r+1)^3 weights
+long sparLongConvolveKernel( long *c, int r, int sy, int sz, void *data );
+// Convolution of src into dst with weights[(i+r)+(2r+1)*((j+r)+(2r+1)*(k+r))]
+void sparLongConvolve( sparLong *dst, sparLong *src, int r, double *weights );
+// One-dimensional filter of src into dst along axis (0 x, 1 y, 2 z) with 2r+1 weights, box (moving average) if weights is NULL
+void sparLongFilterAxis( sparLong *dst, sparLong *src, int axis, int r, double *weights );
+// Box filter (mean over (2r+1)^3 neighbourhood) of src into dst, three one-dimensional passes
+void sparLongBoxFilter( sparLong *dst, sparLong *src, int r );
+// Gaussian filter of standard deviation sigma of src into dst, three one-dimensional passes
+void sparLongGaussianFilter( sparLong *dst, sparLong *src, double sigma );
+// Union-find root of node i with path halving (connected component labeling)
+int sparLongLabelFind( int *parent, int i );
+// Union-find merge of the sets of nodes i and j, the smallest node is kept as root
+void sparLongLabelUnion( int *parent, int i, int j );
+// Union-find node of element (x,y,z), -1 for elements equal to the default value
+int sparLongLabelNode( sparLong *matrix, int *offset, int x, int y, int z );
+// Connect block (x,y,z) with its neighbour block across the lower face along axis (0 x, 1 y, 2 z)
+void sparLongLabelFace( sparLong *matrix, int *offset, int *parent, int x, int y, int z, int axis );
+// Connect elements inside heterogeneous block (x,y,z)
+void sparLongLabelBlock( sparLong *matrix, int *offset, int *parent, int x, int y, int z );
+// Label 6-connected regions of non-default elements into labels (0 elsewhere), return number of regions
+int sparLongLabel( sparLong *matrix, sparInt *labels );
+// Squared distance transform of sampled function f into d (Felzenszwalb), v and z hold n and n+1 elements
+void sparLongDistanceLine( double *f, double *d, int n, int *v, double *z );
+// Squared distance pass along axis (0 x, 1 y, 2 z) in place, or from features of matrix if not NULL (default elements if inside)
+void sparLongDistanceAxis( sparLong *matrix, sparFloat *distance, int axis, float big, int inside );
+// Euclidean distance from each element to the nearest non-default element clamped at maxDistance, negative inside if sign
+void sparLongDistance( sparLong *matrix, sparFloat *distance, float maxDistance, int sign );
+// Cast ray o+t*d (element (x,y,z) spans [x,x+1)) for 0 <= t <= tmax, return 1 with first non-default element hit[3] at t
+int sparLongRay( sparLong *matrix, double *o, double *d, double tmax, int *hit, double *t );
+// Cast n rays o[3*i]+t*d[3*i] in parallel, hits[3*i] and t[i] (-1 if missed), return number of hits
+int sparLongRays( sparLong *matrix, int n, double *o, double *d, double tmax, int *hits, double *t );
+// Copy plane at index along axis into buffer, YZ (axis 0) y+ny*z, XZ (axis 1) x+nx*z, XY (axis 2) x+nx*y
+void sparLongSlice( sparLong *matrix, int axis, int index, long *buffer );
+// Accumulate value, repeated count times, into o[0..n-1] with op (projection kernel)
+void sparLongProjectValue( double *o, int n, long value, int count, int op, long def );
+// Accumulate row[0..n-1] into o[0..n-1], or into o[0] if reduce, with op (projection kernel)
+void sparLongProjectRow( double *o, long *row, int n, int op, int reduce, long def );
+// Project along axis with op (SPAR_ADD, SPAR_MIN, SPAR_MAX, SPAR_COUNT) into dense plane, same layout as slices
+void sparLongProject( sparLong *matrix, int axis, int op, double *buffer );
+// Order of two elements for qsort, NaN last
+int sparLongCompare( const void *a, const void *b );
+// Recompute blocks of dst overlapping box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) from factor^3 cells of src, op SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE
+void sparLongDownsampleBox( sparLong *dst, sparLong *src, int factor, int op, int x, int y, int z, int sx, int sy, int sz );
+// New matrix downsampled by factor with op (SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE)
+sparLong* sparLongDownsample( sparLong *matrix, int factor, int op );
+// Pyramid of levels matrices downsampled by 2, 4, 8... with op (SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE)
+void sparLongPyramid( sparLong *matrix, int levels, int op, sparLong **pyramid );
+// Update pyramid after changes of matrix in box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1)
+void sparLongPyramidUpdate( sparLong *matrix, int levels, int op, sparLong **pyramid, int x, int y, int z, int sx, int sy, int sz );
+// Trilinear interpolation at (x,y,z), element (i,j,k) at integer coordinates, clamped to the matrix bounds
+double sparLongSample( sparLong *matrix, double x, double y, double z );
+// Trilinear interpolation at n points p[3*i] in parallel into values[i]
+void sparLongSamples( sparLong *matrix, int n, double *p, double *values );
+// Marching cubes triangle edges of cube case c (bit i set if corner i is above the iso value), return number of triangles
+int sparLongCubeTriangles( int c, int *edges );
+// Order of two edge keys for qsort
+int sparLongCompareKey( const void *a, const void *b );
+// Marching cubes isosurface at iso into vertices[3*i] and triangles[3*j] (malloc, free after use), nt triangles, return number of vertices
+int sparLongIsosurface( sparLong *matrix, double iso, double **vertices, int **triangles, int *nt );
+// Copy block (i,j,k) of src into block (x,y,z) of dst, same block size
+void sparLongCopyBlock( sparLong *dst, int x, int y, int z, sparLong *src, int i, int j, int k );
+// New matrix with box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1), elements outside the matrix set to default, ring buffer origin reset
+sparLong* sparLongCrop( sparLong *matrix, int x, int y, int z, int sx, int sy, int sz );
+// Write src into matrix at (x,y,z), clipped to the matrix
+void sparLongPaste( sparLong *matrix, sparLong *src, int x, int y, int z );
+// Shift contents by (dx,dy,dz), element (x,y,z) moves to (x+dx,y+dy,z+dz), vacated elements set to default
+void sparLongShift( sparLong *matrix, int dx, int dy, int dz );
+// Ring buffer index of world coordinate w in a ring of size n
+int sparLongRingIndex( int w, int n );
+// Set element at world coordinates (x,y,z) of the ring buffer window, ignored outside the window
+void sparLongRingSet( sparLong *matrix, int x, int y, int z, long value );
+// Get element at world coordinates (x,y,z) of the ring buffer window, default value outside the window
+long sparLongRingGet( sparLong *matrix, int x, int y, int z );
+// Move the ring buffer window origin to world coordinates (x,y,z), elements entering the window set to default
+void sparLongRingMove( sparLong *matrix, int x, int y, int z );
+// New matrix with permuted axes, new x, y and z axes are the axes ax, ay and az (0 x, 1 y, 2 z) of matrix
+sparLong* sparLongPermute( sparLong *matrix, int ax, int ay, int az );
+// Allocate n elements 64-byte aligned with plain malloc (no C11 aligned_alloc), release with the matching DenseFree
+long* sparLongDenseAlloc( long n );
+// Free dense buffer returned by Densify or DenseAlloc
+void sparLongDenseFree( long *buffer );
+// Dense copy padded to (px,py,pz) with the default value, rows along axis contiguous and 64-byte aligned every pitch elements (free with sparLongDenseFree)
+long* sparLongDensify( sparLong *matrix, int axis, int px, int py, int pz, int *pitch );
+// Copy dense buffer with element (x,y,z) at x*sx+y*sy+z*sz into matrix, uniform blocks detected
+void sparLongSetDense( sparLong *matrix, long *buffer, long sx, long sy, long sz );
+// Copy dense buffer with the densify layout (axis, pitch and padded size) into matrix, uniform blocks detected
+void sparLongSparsify( sparLong *matrix, long *buffer, int axis, int pitch, int px, int py, int pz );
+// New matrix from dense buffer with element (x,y,z) at x*sx+y*sy+z*sz, only heterogeneous blocks allocated
+sparLong* sparLongInitDense( long *buffer, int nx, int ny, int nz, long sx, long sy, long sz, int bs, long def );
+// Copy matrix into dense buffer with element (x,y,z) at x*sx+y*sy+z*sz
+void sparLongGetDense( sparLong *matrix, long *buffer, long sx, long sy, long sz );
+// Change the default value, uniform blocks with the previous default value set to the new one
+void sparLongSetDefault( sparLong *matrix, long def );
+// Most frequent value in box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) clipped to the matrix, smallest on ties, its count in count if not NULL
+long sparLongDominant( sparLong *matrix, int x, int y, int z, int sx, int sy, int sz, double *count );
 
 // Matrix constructor
 sparFloat* sparFloatInit( int nx, int ny, int nz, int bs, float def );
+// Clear (unlock) every block lock, flags are not assumed clear after allocation
+void sparFloatClearLocks( sparFloat *matrix );
 // Matrix destructor
 void sparFloatFree( sparFloat *matrix );
 // Reset matrix values
 void sparFloatReset( sparFloat *matrix );
 // Get matrix memory usage in bytes
 double sparFloatMemory( sparFloat *matrix );
+// Element equality, NaN equal to NaN so NaN regions compress like any other uniform value
+int sparFloatEqual( float a, float b );
+// Convert x to the data type, rounding to nearest for integer types instead of truncating
+float sparFloatRound( double x );
 // Check if block is uniform
 int sparFloatUniformBlock( sparFloat *matrix, int x, int y, int z );
+// Expand uniform block (x,y,z) into heterogeneous block data
+void sparFloatExpandBlock( sparFloat *matrix, int x, int y, int z );
+// Reduce block (x,y,z) to uniform if possible, return 1 if uniform
+int sparFloatReduceBlock( sparFloat *matrix, int x, int y, int z );
+// Check if every block overlapping box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) is uniform with the same value
+int sparFloatUniformBox( sparFloat *matrix, int x, int y, int z, int sx, int sy, int sz, float *value );
+// Copy box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) into buffer[i+sx*(j+sy*k)], default value outside the matrix
+void sparFloatGetBox( sparFloat *matrix, int x, int y, int z, int sx, int sy, int sz, float *buffer );
+// Copy buffer[i+sx*(j+sy*k)] into box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1), elements outside the matrix are ignored
+void sparFloatSetBox( sparFloat *matrix, int x, int y, int z, int sx, int sy, int sz, float *buffer );
+// Set every element of box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) to value, elements outside the matrix are ignored
+void sparFloatFillBox( sparFloat *matrix, int x, int y, int z, int sx, int sy, int sz, float value );
 // Set matrix element (x,y,z)
 void sparFloatSet( sparFloat *matrix, int x, int y, int z, float value );
 // Get matrix element (x,y,z)
 float sparFloatGet( sparFloat *matrix, int x, int y, int z );
+// Set matrix element (x,y,z) locking its block, safe for parallel writers
+void sparFloatSetSafe( sparFloat *matrix, int x, int y, int z, float value );
+// Get matrix element (x,y,z) locking its block, safe with parallel writers
+float sparFloatGetSafe( sparFloat *matrix, int x, int y, int z );
 // Duplicate matrix
 sparFloat* sparFloatDuplicate( sparFloat *matrix );
 // Get matrix memory usage in bytes under certain block size
@@ -148,32 +664,169 @@ void sparFloatChangeBs( sparFloat *matrix, int bs );
 void sparFloatOptimizeBs( sparFloat *matrix );
 // Resize matrix
 void sparFloatResize( sparFloat *matrix, int nx, int ny, int nz );
-
-// Matrix struct
-typedef struct sparDouble
-{
-	int nx, ny, nz;       // Matrix size (nx,ny,nz)
-	int bs, bs3;          // Block size (bs,bs,bs)
-	int mx, my, mz;       // Block matrix size (mx,my,mz)
-	double *blockValue; // Uniform block data
-	double **blockData; // Heterogeneous block data
-	double def;         // Default value
-} sparDouble;
+// Sum of matrix elements
+double sparFloatSum( sparFloat *matrix );
+// First matrix element in block order that is not NaN, NaN only if every element is NaN
+float sparFloatFirstNumber( sparFloat *matrix );
+// Minimum matrix element, NaN elements ignored (NaN only if all are NaN)
+float sparFloatMin( sparFloat *matrix );
+// Maximum matrix element, NaN elements ignored (NaN only if all are NaN)
+float sparFloatMax( sparFloat *matrix );
+// Number of matrix elements different from the default value
+double sparFloatCount( sparFloat *matrix );
+// Fold f over matrix elements from identity, f gets each uniform block once with its element count
+double sparFloatReduce( sparFloat *matrix, double (*f)( double acc, float value, int count ), double identity );
+// Apply function f to every matrix element (and default value) in place
+void sparFloatApply( sparFloat *matrix, float (*f)( float ) );
+// New matrix with function f applied to every element (and default value)
+sparFloat* sparFloatMap( sparFloat *matrix, float (*f)( float ) );
+// Visit elements different from the default value, in block order
+void sparFloatForEach( sparFloat *matrix, void (*f)( int x, int y, int z, float value, void *data ), void *data );
+// Visit maximal runs of equal non-default elements along x, (x,y,z) to (x+n-1,y,z), merged across blocks
+void sparFloatForEachRun( sparFloat *matrix, void (*f)( int x, int y, int z, int n, float value, void *data ), void *data );
+// Element-wise operation between arrays, c[i] = a[i] op b[i]
+void sparFloatOpArray( float *c, float *a, float *b, int n, int op, float def );
+// Element-wise operation between array and scalar, c[i] = a[i] op value
+void sparFloatOpArrayScalar( float *c, float *a, float value, int n, int op, float def );
+// New matrix with element-wise operation between matrices, c = a op b
+sparFloat* sparFloatOp( sparFloat *a, sparFloat *b, int op );
+// Element-wise operation with scalar in place, matrix = matrix op value
+void sparFloatOpScalar( sparFloat *matrix, float value, int op );
+// Stencil of radius r from src into dst, f(c) reads neighbours c[i+sy*j+sz*k] with -r <= i,j,k <= r
+void sparFloatStencil( sparFloat *dst, sparFloat *src, int r, float (*f)( float *c, int r, int sy, int sz, void *data ), void *data );
+// Stencil kernel, weighted sum of the neighbourhood with data holding (2r+1)^3 weights
+float sparFloatConvolveKernel( float *c, int r, int sy, int sz, void *data );
+// Convolution of src into dst with weights[(i+r)+(2r+1)*((j+r)+(2r+1)*(k+r))]
+void sparFloatConvolve( sparFloat *dst, sparFloat *src, int r, double *weights );
+// One-dimensional filter of src into dst along axis (0 x, 1 y, 2 z) with 2r+1 weights, box (moving average) if weights is NULL
+void sparFloatFilterAxis( sparFloat *dst, sparFloat *src, int axis, int r, double *weights );
+// Box filter (mean over (2r+1)^3 neighbourhood) of src into dst, three one-dimensional passes
+void sparFloatBoxFilter( sparFloat *dst, sparFloat *src, int r );
+// Gaussian filter of standard deviation sigma of src into dst, three one-dimensional passes
+void sparFloatGaussianFilter( sparFloat *dst, sparFloat *src, double sigma );
+// Union-find root of node i with path halving (connected component labeling)
+int sparFloatLabelFind( int *parent, int i );
+// Union-find merge of the sets of nodes i and j, the smallest node is kept as root
+void sparFloatLabelUnion( int *parent, int i, int j );
+// Union-find node of element (x,y,z), -1 for elements equal to the default value
+int sparFloatLabelNode( sparFloat *matrix, int *offset, int x, int y, int z );
+// Connect block (x,y,z) with its neighbour block across the lower face along axis (0 x, 1 y, 2 z)
+void sparFloatLabelFace( sparFloat *matrix, int *offset, int *parent, int x, int y, int z, int axis );
+// Connect elements inside heterogeneous block (x,y,z)
+void sparFloatLabelBlock( sparFloat *matrix, int *offset, int *parent, int x, int y, int z );
+// Label 6-connected regions of non-default elements into labels (0 elsewhere), return number of regions
+int sparFloatLabel( sparFloat *matrix, sparInt *labels );
+// Squared distance transform of sampled function f into d (Felzenszwalb), v and z hold n and n+1 elements
+void sparFloatDistanceLine( double *f, double *d, int n, int *v, double *z );
+// Squared distance pass along axis (0 x, 1 y, 2 z) in place, or from features of matrix if not NULL (default elements if inside)
+void sparFloatDistanceAxis( sparFloat *matrix, sparFloat *distance, int axis, float big, int inside );
+// Euclidean distance from each element to the nearest non-default element clamped at maxDistance, negative inside if sign
+void sparFloatDistance( sparFloat *matrix, sparFloat *distance, float maxDistance, int sign );
+// Cast ray o+t*d (element (x,y,z) spans [x,x+1)) for 0 <= t <= tmax, return 1 with first non-default element hit[3] at t
+int sparFloatRay( sparFloat *matrix, double *o, double *d, double tmax, int *hit, double *t );
+// Cast n rays o[3*i]+t*d[3*i] in parallel, hits[3*i] and t[i] (-1 if missed), return number of hits
+int sparFloatRays( sparFloat *matrix, int n, double *o, double *d, double tmax, int *hits, double *t );
+// Copy plane at index along axis into buffer, YZ (axis 0) y+ny*z, XZ (axis 1) x+nx*z, XY (axis 2) x+nx*y
+void sparFloatSlice( sparFloat *matrix, int axis, int index, float *buffer );
+// Accumulate value, repeated count times, into o[0..n-1] with op (projection kernel)
+void sparFloatProjectValue( double *o, int n, float value, int count, int op, float def );
+// Accumulate row[0..n-1] into o[0..n-1], or into o[0] if reduce, with op (projection kernel)
+void sparFloatProjectRow( double *o, float *row, int n, int op, int reduce, float def );
+// Project along axis with op (SPAR_ADD, SPAR_MIN, SPAR_MAX, SPAR_COUNT) into dense plane, same layout as slices
+void sparFloatProject( sparFloat *matrix, int axis, int op, double *buffer );
+// Order of two elements for qsort, NaN last
+int sparFloatCompare( const void *a, const void *b );
+// Recompute blocks of dst overlapping box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) from factor^3 cells of src, op SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE
+void sparFloatDownsampleBox( sparFloat *dst, sparFloat *src, int factor, int op, int x, int y, int z, int sx, int sy, int sz );
+// New matrix downsampled by factor with op (SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE)
+sparFloat* sparFloatDownsample( sparFloat *matrix, int factor, int op );
+// Pyramid of levels matrices downsampled by 2, 4, 8... with op (SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE)
+void sparFloatPyramid( sparFloat *matrix, int levels, int op, sparFloat **pyramid );
+// Update pyramid after changes of matrix in box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1)
+void sparFloatPyramidUpdate( sparFloat *matrix, int levels, int op, sparFloat **pyramid, int x, int y, int z, int sx, int sy, int sz );
+// Trilinear interpolation at (x,y,z), element (i,j,k) at integer coordinates, clamped to the matrix bounds
+double sparFloatSample( sparFloat *matrix, double x, double y, double z );
+// Trilinear interpolation at n points p[3*i] in parallel into values[i]
+void sparFloatSamples( sparFloat *matrix, int n, double *p, double *values );
+// Marching cubes triangle edges of cube case c (bit i set if corner i is above the iso value), return number of triangles
+int sparFloatCubeTriangles( int c, int *edges );
+// Order of two edge keys for qsort
+int sparFloatCompareKey( const void *a, const void *b );
+// Marching cubes isosurface at iso into vertices[3*i] and triangles[3*j] (malloc, free after use), nt triangles, return number of vertices
+int sparFloatIsosurface( sparFloat *matrix, double iso, double **vertices, int **triangles, int *nt );
+// Copy block (i,j,k) of src into block (x,y,z) of dst, same block size
+void sparFloatCopyBlock( sparFloat *dst, int x, int y, int z, sparFloat *src, int i, int j, int k );
+// New matrix with box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1), elements outside the matrix set to default, ring buffer origin reset
+sparFloat* sparFloatCrop( sparFloat *matrix, int x, int y, int z, int sx, int sy, int sz );
+// Write src into matrix at (x,y,z), clipped to the matrix
+void sparFloatPaste( sparFloat *matrix, sparFloat *src, int x, int y, int z );
+// Shift contents by (dx,dy,dz), element (x,y,z) moves to (x+dx,y+dy,z+dz), vacated elements set to default
+void sparFloatShift( sparFloat *matrix, int dx, int dy, int dz );
+// Ring buffer index of world coordinate w in a ring of size n
+int sparFloatRingIndex( int w, int n );
+// Set element at world coordinates (x,y,z) of the ring buffer window, ignored outside the window
+void sparFloatRingSet( sparFloat *matrix, int x, int y, int z, float value );
+// Get element at world coordinates (x,y,z) of the ring buffer window, default value outside the window
+float sparFloatRingGet( sparFloat *matrix, int x, int y, int z );
+// Move the ring buffer window origin to world coordinates (x,y,z), elements entering the window set to default
+void sparFloatRingMove( sparFloat *matrix, int x, int y, int z );
+// New matrix with permuted axes, new x, y and z axes are the axes ax, ay and az (0 x, 1 y, 2 z) of matrix
+sparFloat* sparFloatPermute( sparFloat *matrix, int ax, int ay, int az );
+// Allocate n elements 64-byte aligned with plain malloc (no C11 aligned_alloc), release with the matching DenseFree
+float* sparFloatDenseAlloc( long n );
+// Free dense buffer returned by Densify or DenseAlloc
+void sparFloatDenseFree( float *buffer );
+// Dense copy padded to (px,py,pz) with the default value, rows along axis contiguous and 64-byte aligned every pitch elements (free with sparFloatDenseFree)
+float* sparFloatDensify( sparFloat *matrix, int axis, int px, int py, int pz, int *pitch );
+// Copy dense buffer with element (x,y,z) at x*sx+y*sy+z*sz into matrix, uniform blocks detected
+void sparFloatSetDense( sparFloat *matrix, float *buffer, long sx, long sy, long sz );
+// Copy dense buffer with the densify layout (axis, pitch and padded size) into matrix, uniform blocks detected
+void sparFloatSparsify( sparFloat *matrix, float *buffer, int axis, int pitch, int px, int py, int pz );
+// New matrix from dense buffer with element (x,y,z) at x*sx+y*sy+z*sz, only heterogeneous blocks allocated
+sparFloat* sparFloatInitDense( float *buffer, int nx, int ny, int nz, long sx, long sy, long sz, int bs, float def );
+// Copy matrix into dense buffer with element (x,y,z) at x*sx+y*sy+z*sz
+void sparFloatGetDense( sparFloat *matrix, float *buffer, long sx, long sy, long sz );
+// Change the default value, uniform blocks with the previous default value set to the new one
+void sparFloatSetDefault( sparFloat *matrix, float def );
+// Most frequent value in box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) clipped to the matrix, smallest on ties, its count in count if not NULL
+float sparFloatDominant( sparFloat *matrix, int x, int y, int z, int sx, int sy, int sz, double *count );
 
 // Matrix constructor
 sparDouble* sparDoubleInit( int nx, int ny, int nz, int bs, double def );
+// Clear (unlock) every block lock, flags are not assumed clear after allocation
+void sparDoubleClearLocks( sparDouble *matrix );
 // Matrix destructor
 void sparDoubleFree( sparDouble *matrix );
 // Reset matrix values
 void sparDoubleReset( sparDouble *matrix );
 // Get matrix memory usage in bytes
 double sparDoubleMemory( sparDouble *matrix );
+// Element equality, NaN equal to NaN so NaN regions compress like any other uniform value
+int sparDoubleEqual( double a, double b );
+// Convert x to the data type, rounding to nearest for integer types instead of truncating
+double sparDoubleRound( double x );
 // Check if block is uniform
 int sparDoubleUniformBlock( sparDouble *matrix, int x, int y, int z );
+// Expand uniform block (x,y,z) into heterogeneous block data
+void sparDoubleExpandBlock( sparDouble *matrix, int x, int y, int z );
+// Reduce block (x,y,z) to uniform if possible, return 1 if uniform
+int sparDoubleReduceBlock( sparDouble *matrix, int x, int y, int z );
+// Check if every block overlapping box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) is uniform with the same value
+int sparDoubleUniformBox( sparDouble *matrix, int x, int y, int z, int sx, int sy, int sz, double *value );
+// Copy box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) into buffer[i+sx*(j+sy*k)], default value outside the matrix
+void sparDoubleGetBox( sparDouble *matrix, int x, int y, int z, int sx, int sy, int sz, double *buffer );
+// Copy buffer[i+sx*(j+sy*k)] into box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1), elements outside the matrix are ignored
+void sparDoubleSetBox( sparDouble *matrix, int x, int y, int z, int sx, int sy, int sz, double *buffer );
+// Set every element of box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) to value, elements outside the matrix are ignored
+void sparDoubleFillBox( sparDouble *matrix, int x, int y, int z, int sx, int sy, int sz, double value );
 // Set matrix element (x,y,z)
 void sparDoubleSet( sparDouble *matrix, int x, int y, int z, double value );
 // Get matrix element (x,y,z)
 double sparDoubleGet( sparDouble *matrix, int x, int y, int z );
+// Set matrix element (x,y,z) locking its block, safe for parallel writers
+void sparDoubleSetSafe( sparDouble *matrix, int x, int y, int z, double value );
+// Get matrix element (x,y,z) locking its block, safe with parallel writers
+double sparDoubleGetSafe( sparDouble *matrix, int x, int y, int z );
 // Duplicate matrix
 sparDouble* sparDoubleDuplicate( sparDouble *matrix );
 // Get matrix memory usage in bytes under certain block size
@@ -184,6 +837,133 @@ void sparDoubleChangeBs( sparDouble *matrix, int bs );
 void sparDoubleOptimizeBs( sparDouble *matrix );
 // Resize matrix
 void sparDoubleResize( sparDouble *matrix, int nx, int ny, int nz );
+// Sum of matrix elements
+double sparDoubleSum( sparDouble *matrix );
+// First matrix element in block order that is not NaN, NaN only if every element is NaN
+double sparDoubleFirstNumber( sparDouble *matrix );
+// Minimum matrix element, NaN elements ignored (NaN only if all are NaN)
+double sparDoubleMin( sparDouble *matrix );
+// Maximum matrix element, NaN elements ignored (NaN only if all are NaN)
+double sparDoubleMax( sparDouble *matrix );
+// Number of matrix elements different from the default value
+double sparDoubleCount( sparDouble *matrix );
+// Fold f over matrix elements from identity, f gets each uniform block once with its element count
+double sparDoubleReduce( sparDouble *matrix, double (*f)( double acc, double value, int count ), double identity );
+// Apply function f to every matrix element (and default value) in place
+void sparDoubleApply( sparDouble *matrix, double (*f)( double ) );
+// New matrix with function f applied to every element (and default value)
+sparDouble* sparDoubleMap( sparDouble *matrix, double (*f)( double ) );
+// Visit elements different from the default value, in block order
+void sparDoubleForEach( sparDouble *matrix, void (*f)( int x, int y, int z, double value, void *data ), void *data );
+// Visit maximal runs of equal non-default elements along x, (x,y,z) to (x+n-1,y,z), merged across blocks
+void sparDoubleForEachRun( sparDouble *matrix, void (*f)( int x, int y, int z, int n, double value, void *data ), void *data );
+// Element-wise operation between arrays, c[i] = a[i] op b[i]
+void sparDoubleOpArray( double *c, double *a, double *b, int n, int op, double def );
+// Element-wise operation between array and scalar, c[i] = a[i] op value
+void sparDoubleOpArrayScalar( double *c, double *a, double value, int n, int op, double def );
+// New matrix with element-wise operation between matrices, c = a op b
+sparDouble* sparDoubleOp( sparDouble *a, sparDouble *b, int op );
+// Element-wise operation with scalar in place, matrix = matrix op value
+void sparDoubleOpScalar( sparDouble *matrix, double value, int op );
+// Stencil of radius r from src into dst, f(c) reads neighbours c[i+sy*j+sz*k] with -r <= i,j,k <= r
+void sparDoubleStencil( sparDouble *dst, sparDouble *src, int r, double (*f)( double *c, int r, int sy, int sz, void *data ), void *data );
+// Stencil kernel, weighted sum of the neighbourhood with data holding (2r+1)^3 weights
+double sparDoubleConvolveKernel( double *c, int r, int sy, int sz, void *data );
+// Convolution of src into dst with weights[(i+r)+(2r+1)*((j+r)+(2r+1)*(k+r))]
+void sparDoubleConvolve( sparDouble *dst, sparDouble *src, int r, double *weights );
+// One-dimensional filter of src into dst along axis (0 x, 1 y, 2 z) with 2r+1 weights, box (moving average) if weights is NULL
+void sparDoubleFilterAxis( sparDouble *dst, sparDouble *src, int axis, int r, double *weights );
+// Box filter (mean over (2r+1)^3 neighbourhood) of src into dst, three one-dimensional passes
+void sparDoubleBoxFilter( sparDouble *dst, sparDouble *src, int r );
+// Gaussian filter of standard deviation sigma of src into dst, three one-dimensional passes
+void sparDoubleGaussianFilter( sparDouble *dst, sparDouble *src, double sigma );
+// Union-find root of node i with path halving (connected component labeling)
+int sparDoubleLabelFind( int *parent, int i );
+// Union-find merge of the sets of nodes i and j, the smallest node is kept as root
+void sparDoubleLabelUnion( int *parent, int i, int j );
+// Union-find node of element (x,y,z), -1 for elements equal to the default value
+int sparDoubleLabelNode( sparDouble *matrix, int *offset, int x, int y, int z );
+// Connect block (x,y,z) with its neighbour block across the lower face along axis (0 x, 1 y, 2 z)
+void sparDoubleLabelFace( sparDouble *matrix, int *offset, int *parent, int x, int y, int z, int axis );
+// Connect elements inside heterogeneous block (x,y,z)
+void sparDoubleLabelBlock( sparDouble *matrix, int *offset, int *parent, int x, int y, int z );
+// Label 6-connected regions of non-default elements into labels (0 elsewhere), return number of regions
+int sparDoubleLabel( sparDouble *matrix, sparInt *labels );
+// Squared distance transform of sampled function f into d (Felzenszwalb), v and z hold n and n+1 elements
+void sparDoubleDistanceLine( double *f, double *d, int n, int *v, double *z );
+// Squared distance pass along axis (0 x, 1 y, 2 z) in place, or from features of matrix if not NULL (default elements if inside)
+void sparDoubleDistanceAxis( sparDouble *matrix, sparFloat *distance, int axis, float big, int inside );
+// Euclidean distance from each element to the nearest non-default element clamped at maxDistance, negative inside if sign
+void sparDoubleDistance( sparDouble *matrix, sparFloat *distance, float maxDistance, int sign );
+// Cast ray o+t*d (element (x,y,z) spans [x,x+1)) for 0 <= t <= tmax, return 1 with first non-default element hit[3] at t
+int sparDoubleRay( sparDouble *matrix, double *o, double *d, double tmax, int *hit, double *t );
+// Cast n rays o[3*i]+t*d[3*i] in parallel, hits[3*i] and t[i] (-1 if missed), return number of hits
+int sparDoubleRays( sparDouble *matrix, int n, double *o, double *d, double tmax, int *hits, double *t );
+// Copy plane at index along axis into buffer, YZ (axis 0) y+ny*z, XZ (axis 1) x+nx*z, XY (axis 2) x+nx*y
+void sparDoubleSlice( sparDouble *matrix, int axis, int index, double *buffer );
+// Accumulate value, repeated count times, into o[0..n-1] with op (projection kernel)
+void sparDoubleProjectValue( double *o, int n, double value, int count, int op, double def );
+// Accumulate row[0..n-1] into o[0..n-1], or into o[0] if reduce, with op (projection kernel)
+void sparDoubleProjectRow( double *o, double *row, int n, int op, int reduce, double def );
+// Project along axis with op (SPAR_ADD, SPAR_MIN, SPAR_MAX, SPAR_COUNT) into dense plane, same layout as slices
+void sparDoubleProject( sparDouble *matrix, int axis, int op, double *buffer );
+// Order of two elements for qsort, NaN last
+int sparDoubleCompare( const void *a, const void *b );
+// Recompute blocks of dst overlapping box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) from factor^3 cells of src, op SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE
+void sparDoubleDownsampleBox( sparDouble *dst, sparDouble *src, int factor, int op, int x, int y, int z, int sx, int sy, int sz );
+// New matrix downsampled by factor with op (SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE)
+sparDouble* sparDoubleDownsample( sparDouble *matrix, int factor, int op );
+// Pyramid of levels matrices downsampled by 2, 4, 8... with op (SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE)
+void sparDoublePyramid( sparDouble *matrix, int levels, int op, sparDouble **pyramid );
+// Update pyramid after changes of matrix in box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1)
+void sparDoublePyramidUpdate( sparDouble *matrix, int levels, int op, sparDouble **pyramid, int x, int y, int z, int sx, int sy, int sz );
+// Trilinear interpolation at (x,y,z), element (i,j,k) at integer coordinates, clamped to the matrix bounds
+double sparDoubleSample( sparDouble *matrix, double x, double y, double z );
+// Trilinear interpolation at n points p[3*i] in parallel into values[i]
+void sparDoubleSamples( sparDouble *matrix, int n, double *p, double *values );
+// Marching cubes triangle edges of cube case c (bit i set if corner i is above the iso value), return number of triangles
+int sparDoubleCubeTriangles( int c, int *edges );
+// Order of two edge keys for qsort
+int sparDoubleCompareKey( const void *a, const void *b );
+// Marching cubes isosurface at iso into vertices[3*i] and triangles[3*j] (malloc, free after use), nt triangles, return number of vertices
+int sparDoubleIsosurface( sparDouble *matrix, double iso, double **vertices, int **triangles, int *nt );
+// Copy block (i,j,k) of src into block (x,y,z) of dst, same block size
+void sparDoubleCopyBlock( sparDouble *dst, int x, int y, int z, sparDouble *src, int i, int j, int k );
+// New matrix with box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1), elements outside the matrix set to default, ring buffer origin reset
+sparDouble* sparDoubleCrop( sparDouble *matrix, int x, int y, int z, int sx, int sy, int sz );
+// Write src into matrix at (x,y,z), clipped to the matrix
+void sparDoublePaste( sparDouble *matrix, sparDouble *src, int x, int y, int z );
+// Shift contents by (dx,dy,dz), element (x,y,z) moves to (x+dx,y+dy,z+dz), vacated elements set to default
+void sparDoubleShift( sparDouble *matrix, int dx, int dy, int dz );
+// Ring buffer index of world coordinate w in a ring of size n
+int sparDoubleRingIndex( int w, int n );
+// Set element at world coordinates (x,y,z) of the ring buffer window, ignored outside the window
+void sparDoubleRingSet( sparDouble *matrix, int x, int y, int z, double value );
+// Get element at world coordinates (x,y,z) of the ring buffer window, default value outside the window
+double sparDoubleRingGet( sparDouble *matrix, int x, int y, int z );
+// Move the ring buffer window origin to world coordinates (x,y,z), elements entering the window set to default
+void sparDoubleRingMove( sparDouble *matrix, int x, int y, int z );
+// New matrix with permuted axes, new x, y and z axes are the axes ax, ay and az (0 x, 1 y, 2 z) of matrix
+sparDouble* sparDoublePermute( sparDouble *matrix, int ax, int ay, int az );
+// Allocate n elements 64-byte aligned with plain malloc (no C11 aligned_alloc), release with the matching DenseFree
+double* sparDoubleDenseAlloc( long n );
+// Free dense buffer returned by Densify or DenseAlloc
+void sparDoubleDenseFree( double *buffer );
+// Dense copy padded to (px,py,pz) with the default value, rows along axis contiguous and 64-byte aligned every pitch elements (free with sparDoubleDenseFree)
+double* sparDoubleDensify( sparDouble *matrix, int axis, int px, int py, int pz, int *pitch );
+// Copy dense buffer with element (x,y,z) at x*sx+y*sy+z*sz into matrix, uniform blocks detected
+void sparDoubleSetDense( sparDouble *matrix, double *buffer, long sx, long sy, long sz );
+// Copy dense buffer with the densify layout (axis, pitch and padded size) into matrix, uniform blocks detected
+void sparDoubleSparsify( sparDouble *matrix, double *buffer, int axis, int pitch, int px, int py, int pz );
+// New matrix from dense buffer with element (x,y,z) at x*sx+y*sy+z*sz, only heterogeneous blocks allocated
+sparDouble* sparDoubleInitDense( double *buffer, int nx, int ny, int nz, long sx, long sy, long sz, int bs, double def );
+// Copy matrix into dense buffer with element (x,y,z) at x*sx+y*sy+z*sz
+void sparDoubleGetDense( sparDouble *matrix, double *buffer, long sx, long sy, long sz );
+// Change the default value, uniform blocks with the previous default value set to the new one
+void sparDoubleSetDefault( sparDouble *matrix, double def );
+// Most frequent value in box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) clipped to the matrix, smallest on ties, its count in count if not NULL
+double sparDoubleDominant( sparDouble *matrix, int x, int y, int z, int sx, int sy, int sz, double *count );
+
 
 
 // Matrix constructor
@@ -248,9 +1028,24 @@ sparChar* sparCharInit( int nx, int ny, int nz, int bs, char def )
 	   exit(1);
 	}
 
+	// Allocate space for block locks, cleared below
+	matrix->blockLock = (atomic_flag*) malloc( blocks * sizeof(atomic_flag) );
+
+	if( matrix->blockLock == NULL )
+	{
+	   fprintf(stderr, "sparCharInit error: Out of memory\n");
+	   exit(1);
+	}
+
 	// Set default value
 	matrix->def = def;
 
+	// Set ring buffer origin. Duplicate and Map copy it, Op requires equal origins and copies it, Permute permutes it and in-place operations keep it.
+	// Crop, Downsample and InitDense leave it at zero, their storage does not follow the ring layout of a source window.
+	matrix->ox = 0;
+	matrix->oy = 0;
+	matrix->oz = 0;
+
 	// Set matrix elemets to default value
 	int i;
 	for( i = 0 ; i < blocks ; i++ )
@@ -259,10 +1054,23 @@ sparChar* sparCharInit( int nx, int ny, int nz, int bs, char def )
 		matrix->blockValue[i] = def;
 	}
 
+	// Unlock all blocks
+	sparCharClearLocks( matrix );
+
 	// Return pointer
 	return matrix;
 }
 
+// Clear (unlock) every block lock, flags are not assumed clear after allocation
+void sparCharClearLocks( sparChar *matrix )
+{
+	int n;
+	for( n = 0 ; n < matrix->mx * matrix->my * matrix->mz ; n++ )
+	{
+		atomic_flag_clear( &matrix->blockLock[n] );
+	}
+}
+
 // Matrix destructor
 void sparCharFree( sparChar *matrix )
 {
@@ -286,6 +1094,9 @@ void sparCharFree( sparChar *matrix )
 	// Free block heterogeneous data array
 	free(matrix->blockData);
 
+	// Free block locks
+	free(matrix->blockLock);
+
 	// Free matrix instance
 	free(matrix);
 }
@@ -328,6 +1139,9 @@ double sparCharMemory( sparChar *matrix )
 	// Heterogeneous block data arrays
 	size = size + (double)( blocks * sizeof(char*) );
 
+	// Block locks
+	size = size + (double)( blocks * sizeof(atomic_flag) );
+
 	// Heterogeneous block data
 	int i;
 	for( i = 0 ; i < blocks ; i++ )
@@ -342,6 +1156,23 @@ double sparCharMemory( sparChar *matrix )
 	return size;
 }
 
+// Element equality, NaN equal to NaN so NaN regions compress like any other uniform value
+int sparCharEqual( char a, char b )
+{
+	return a == b || ( isnan( (double) a ) && isnan( (double) b ) );
+}
+
+// Convert x to the data type, rounding to nearest for integer types instead of truncating
+char sparCharRound( double x )
+{
+	// Integer types turn 0.5 into 0
+	if( (char)( 0.5 ) == 0 )
+	{
+		return (char)( floor( x + 0.5 ) );
+	}
+	return (char)( x );
+}
+
 // Check if block is uniform
 int sparCharUniformBlock( sparChar *matrix, int x, int y, int z )
 {
@@ -384,7 +1215,7 @@ int sparCharUniformBlock( sparChar *matrix, int x, int y, int z )
 		int i;
 		for( i = 0 ; i < bs3 ; i++ )
 		{
-			if( blockData[i] != value )
+			if( sparCharEqual( blockData[i], value ) == 0 )
 			{
 				isUniform = 0;
 				i = bs3;
@@ -409,7 +1240,7 @@ int sparCharUniformBlock( sparChar *matrix, int x, int y, int z )
 				for( i = 0 ; i < bs ; i++ )
 				{
 					if( x * bs + i < matrix->nx ) // Idem
-					if( blockData[ i + bs * ( j + bs * k ) ] != value )
+					if( sparCharEqual( blockData[ i + bs * ( j + bs * k ) ], value ) == 0 )
 					{
 						isUniform = 0;
 						i = j = k = bs;
@@ -422,6 +1253,410 @@ int sparCharUniformBlock( sparChar *matrix, int x, int y, int z )
 	return isUniform;
 }
 
+// Expand uniform block (x,y,z) into heterogeneous block data
+void sparCharExpandBlock( sparChar *matrix, int x, int y, int z )
+{
+	// Linear block index (n) <-> (x,y,z)
+	int n;
+	n = x + matrix->mx * ( y + matrix->my * z );
+
+	// Already heterogeneous
+	if( matrix->blockData[n] != NULL )
+	{
+		return;
+	}
+
+	// Allocate block data
+	char *blockData;
+	blockData = (char*) calloc( matrix->bs3, sizeof(char) );
+
+	if( blockData == NULL )
+	{
+	   fprintf(stderr, "sparCharExpandBlock error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Set uniform value
+	char value;
+	value = matrix->blockValue[n];
+
+	int i;
+	for( i = 0 ; i < matrix->bs3 ; i++ )
+	{
+		blockData[i] = value;
+	}
+
+	matrix->blockData[n] = blockData;
+}
+
+// Reduce block (x,y,z) to uniform if possible, return 1 if uniform
+int sparCharReduceBlock( sparChar *matrix, int x, int y, int z )
+{
+	// Linear block index (n) <-> (x,y,z)
+	int n;
+	n = x + matrix->mx * ( y + matrix->my * z );
+
+	// Already uniform
+	if( matrix->blockData[n] == NULL )
+	{
+		return 1;
+	}
+
+	// Heterogeneous block
+	if( sparCharUniformBlock( matrix, x, y, z ) == 0 )
+	{
+		return 0;
+	}
+
+	// First element is always inside the matrix
+	matrix->blockValue[n] = matrix->blockData[n][0];
+	free(matrix->blockData[n]);
+	matrix->blockData[n] = NULL;
+
+	return 1;
+}
+
+// Check if every block overlapping box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) is uniform with the same value
+int sparCharUniformBox( sparChar *matrix, int x, int y, int z, int sx, int sy, int sz, char *value )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return 0;
+	}
+
+	// Reference value
+	int n;
+	n = x0 / bs + matrix->mx * ( y0 / bs + matrix->my * ( z0 / bs ) );
+	*value = matrix->blockValue[n];
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+				if( matrix->blockData[n] != NULL || sparCharEqual( matrix->blockValue[n], *value ) == 0 )
+				{
+					return 0;
+				}
+			}
+		}
+	}
+
+	return 1;
+}
+
+// Copy box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) into buffer[i+sx*(j+sy*k)], default value outside the matrix
+void sparCharGetBox( sparChar *matrix, int x, int y, int z, int sx, int sy, int sz, char *buffer )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	int i, j, k;
+
+	// Box partially outside the matrix, fill with default value
+	if( x0 != x || y0 != y || z0 != z || x1 != x + sx || y1 != y + sy || z1 != z + sz )
+	{
+		for( i = 0 ; i < sx * sy * sz ; i++ )
+		{
+			buffer[i] = matrix->def;
+		}
+	}
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+				char *blockData;
+				blockData = matrix->blockData[n];
+
+				// Copy block rows
+				for( k = bz0 ; k < bz1 ; k++ )
+				{
+					for( j = by0 ; j < by1 ; j++ )
+					{
+						char *row;
+						row = buffer + ( bx0 - x ) + sx * ( ( j - y ) + sy * ( k - z ) );
+
+						// Uniform block
+						if( blockData == NULL )
+						{
+							char value;
+							value = matrix->blockValue[n];
+							for( i = 0 ; i < bx1 - bx0 ; i++ )
+							{
+								row[i] = value;
+							}
+						}
+						// Heterogeneous block
+						else
+						{
+							memcpy( row, blockData + ( bx0 - i1 * bs ) + bs * ( ( j - j1 * bs ) + bs * ( k - k1 * bs ) ),
+									( bx1 - bx0 ) * sizeof(char) );
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// Copy buffer[i+sx*(j+sy*k)] into box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1), elements outside the matrix are ignored
+void sparCharSetBox( sparChar *matrix, int x, int y, int z, int sx, int sy, int sz, char *buffer )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	int i, j, k;
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+				// Block elements inside the matrix are fully covered
+				int covered;
+				covered = bx0 == i1 * bs && by0 == j1 * bs && bz0 == k1 * bs &&
+						  ( bx1 == ( i1 + 1 ) * bs || bx1 == matrix->nx ) &&
+						  ( by1 == ( j1 + 1 ) * bs || by1 == matrix->ny ) &&
+						  ( bz1 == ( k1 + 1 ) * bs || bz1 == matrix->nz );
+
+				// Covered block, check if input is uniform first
+				if( covered )
+				{
+					char value;
+					value = buffer[ ( bx0 - x ) + sx * ( ( by0 - y ) + sy * ( bz0 - z ) ) ];
+
+					int isUniform;
+					isUniform = 1;
+					for( k = bz0 ; k < bz1 && isUniform ; k++ )
+					{
+						for( j = by0 ; j < by1 && isUniform ; j++ )
+						{
+							char *row;
+							row = buffer + ( bx0 - x ) + sx * ( ( j - y ) + sy * ( k - z ) );
+							for( i = 0 ; i < bx1 - bx0 ; i++ )
+							{
+								if( sparCharEqual( row[i], value ) == 0 )
+								{
+									isUniform = 0;
+									break;
+								}
+							}
+						}
+					}
+
+					if( isUniform )
+					{
+						if( matrix->blockData[n] != NULL )
+						{
+							free(matrix->blockData[n]);
+							matrix->blockData[n] = NULL;
+						}
+						matrix->blockValue[n] = value;
+						continue;
+					}
+				}
+
+				// Copy block rows into heterogeneous block
+				sparCharExpandBlock( matrix, i1, j1, k1 );
+
+				char *blockData;
+				blockData = matrix->blockData[n];
+
+				for( k = bz0 ; k < bz1 ; k++ )
+				{
+					for( j = by0 ; j < by1 ; j++ )
+					{
+						memcpy( blockData + ( bx0 - i1 * bs ) + bs * ( ( j - j1 * bs ) + bs * ( k - k1 * bs ) ),
+								buffer + ( bx0 - x ) + sx * ( ( j - y ) + sy * ( k - z ) ),
+								( bx1 - bx0 ) * sizeof(char) );
+					}
+				}
+
+				// Partially covered blocks may have become uniform
+				if( !covered )
+				{
+					sparCharReduceBlock( matrix, i1, j1, k1 );
+				}
+			}
+		}
+	}
+}
+
+// Set every element of box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) to value, elements outside the matrix are ignored
+void sparCharFillBox( sparChar *matrix, int x, int y, int z, int sx, int sy, int sz, char value )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	int i, j, k;
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+				// Block elements inside the matrix are fully covered, uniform block
+				if( bx0 == i1 * bs && by0 == j1 * bs && bz0 == k1 * bs &&
+					( bx1 == ( i1 + 1 ) * bs || bx1 == matrix->nx ) &&
+					( by1 == ( j1 + 1 ) * bs || by1 == matrix->ny ) &&
+					( bz1 == ( k1 + 1 ) * bs || bz1 == matrix->nz ) )
+				{
+					if( matrix->blockData[n] != NULL )
+					{
+						free(matrix->blockData[n]);
+						matrix->blockData[n] = NULL;
+					}
+					matrix->blockValue[n] = value;
+					continue;
+				}
+
+				// Already uniform with the same value
+				if( matrix->blockData[n] == NULL && sparCharEqual( matrix->blockValue[n], value ) )
+				{
+					continue;
+				}
+
+				// Fill block rows and reduce if possible
+				sparCharExpandBlock( matrix, i1, j1, k1 );
+
+				char *blockData;
+				blockData = matrix->blockData[n];
+
+				for( k = bz0 ; k < bz1 ; k++ )
+				{
+					for( j = by0 ; j < by1 ; j++ )
+					{
+						char *row;
+						row = blockData + ( bx0 - i1 * bs ) + bs * ( ( j - j1 * bs ) + bs * ( k - k1 * bs ) );
+						for( i = 0 ; i < bx1 - bx0 ; i++ )
+						{
+							row[i] = value;
+						}
+					}
+				}
+
+				sparCharReduceBlock( matrix, i1, j1, k1 );
+			}
+		}
+	}
+}
+
 // Set matrix element (x,y,z)
 void sparCharSet( sparChar *matrix, int x, int y, int z, char value )
 {
@@ -458,7 +1693,7 @@ void sparCharSet( sparChar *matrix, int x, int y, int z, char value )
 	if( blockData == NULL )
 	{
 		// Input value is different
-		if( value != blockValue )
+		if( sparCharEqual( value, blockValue ) == 0 )
 		{
 			// Expand block
 			blockData = (char*) calloc( bs3, sizeof(char) );
@@ -536,20 +1771,70 @@ char sparCharGet( sparChar *matrix, int x, int y, int z )
 	}
 }
 
-// Duplicate matrix
-sparChar* sparCharDuplicate( sparChar *matrix )
+// Set matrix element (x,y,z) locking its block, safe for parallel writers
+void sparCharSetSafe( sparChar *matrix, int x, int y, int z, char value )
 {
-	// Declare matrix and init
-	sparChar *matrix2;
-	matrix2 = sparCharInit( matrix->nx, matrix->ny, matrix->nz,
-						matrix->bs, matrix->def );
+	// Block size
+	int bs;
+	bs = matrix->bs;
 
-	// Number of blocks
-	int blocks;
-	blocks = matrix2->mx * matrix2->my * matrix2->mz;
+	// Linear block index (n) <-> (x/bs,y/bs,z/bs)
+	int n;
+	n = x / bs + matrix->mx * ( y / bs + matrix->my * ( z / bs ) );
 
-	// Copy blocks
-	int i;
+	// Acquire block lock
+	while( atomic_flag_test_and_set_explicit( &matrix->blockLock[n], memory_order_acquire ) );
+
+	// Set element, may expand or reduce the block
+	sparCharSet( matrix, x, y, z, value );
+
+	// Release block lock
+	atomic_flag_clear_explicit( &matrix->blockLock[n], memory_order_release );
+}
+
+// Get matrix element (x,y,z) locking its block, safe with parallel writers
+char sparCharGetSafe( sparChar *matrix, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Linear block index (n) <-> (x/bs,y/bs,z/bs)
+	int n;
+	n = x / bs + matrix->mx * ( y / bs + matrix->my * ( z / bs ) );
+
+	// Acquire block lock
+	while( atomic_flag_test_and_set_explicit( &matrix->blockLock[n], memory_order_acquire ) );
+
+	// Get element
+	char value;
+	value = sparCharGet( matrix, x, y, z );
+
+	// Release block lock
+	atomic_flag_clear_explicit( &matrix->blockLock[n], memory_order_release );
+
+	return value;
+}
+
+// Duplicate matrix
+sparChar* sparCharDuplicate( sparChar *matrix )
+{
+	// Declare matrix and init
+	sparChar *matrix2;
+	matrix2 = sparCharInit( matrix->nx, matrix->ny, matrix->nz,
+						matrix->bs, matrix->def );
+
+	// Copy ring buffer origin
+	matrix2->ox = matrix->ox;
+	matrix2->oy = matrix->oy;
+	matrix2->oz = matrix->oz;
+
+	// Number of blocks
+	int blocks;
+	blocks = matrix2->mx * matrix2->my * matrix2->mz;
+
+	// Copy blocks
+	int i;
 	for( i = 0 ; i < blocks ; i++ )
 	{
 		// Heterogeneous block
@@ -616,6 +1901,9 @@ double sparCharMemoryBs( sparChar *matrix, int bs )
 	// Size of heterogeneous block data arrays
 	size = size + (double)( blocks * sizeof(char*) );
 
+	// Size of block locks
+	size = size + (double)( blocks * sizeof(atomic_flag) );
+
 	int i, j, k;
 	int i1, j1, k1;
 	int isUniform;
@@ -640,7 +1928,7 @@ double sparCharMemoryBs( sparChar *matrix, int bs )
 						for( i = i1 * bs ; i < ( i1 + 1 ) * bs ; i++ )
 						{
 							if( i < nx ) // Idem
-							if( sparCharGet( matrix, i, j, k ) != value )
+							if( sparCharEqual( sparCharGet( matrix, i, j, k ), value ) == 0 )
 							{
 								isUniform = 0;
 								i = ( i1 + 1 ) * bs;
@@ -705,10 +1993,15 @@ void sparCharChangeBs( sparChar *matrix, int bs )
 	// Free old blocks
 	free(matrix->blockValue);
 	free(matrix->blockData);
+	free(matrix->blockLock);
 
 	// Copy new blocks
 	matrix->blockValue = matrix2->blockValue;
 	matrix->blockData = matrix2->blockData;
+	matrix->blockLock = matrix2->blockLock;
+
+	// Unlock all blocks of the new grid
+	sparCharClearLocks( matrix );
 
 	// Free temporal matrix
 	free(matrix2);
@@ -758,1430 +2051,22725 @@ void sparCharResize( sparChar *matrix, int nx, int ny, int nz )
 	char def;
 	def = matrix->def;
 
-	// Block grid size
+	// New block grid size
 	int mx, my, mz;
+	mx = (int)( ( nx + bs - 1 ) / bs );
+	my = (int)( ( ny + bs - 1 ) / bs );
+	mz = (int)( ( nz + bs - 1 ) / bs );
 
 	// New block data
 	char *blockValue;
 	char **blockData;
 
-	int i, j, k;
 	int blocks;
+	blocks = mx * my * mz;
+	blockValue = (char*) calloc( blocks, sizeof(char) ); // Sets to 0s
+	blockData = (char**) calloc( blocks, sizeof(char*) ); // Sets to NULLs
 
-	// Expand x
-	if( nx > matrix->nx )
+	if( blockValue == NULL || blockData == NULL )
 	{
-		// New block grid size
-		mx = (int)( ( nx + bs - 1 ) / bs );
-		my = matrix->my;
-		mz = matrix->mz;
-
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (char*) calloc( blocks, sizeof(char) ); // Sets to 0s
-		blockData = (char**) calloc( blocks, sizeof(char*) ); // Sets to NULLs
+	   fprintf(stderr, "sparCharResize error: Out of memory\n");
+	   exit(1);
+	}
 
-		if( blockValue == NULL || blockData == NULL )
-		{
-		   fprintf(stderr, "sparCharResize error: Out of memory\n");
-		   exit(1);
-		}
+	int i, j, k;
 
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+	// Move existing blocks, create new blocks
+	for( k = 0 ; k < mz ; k++ )
+	{
+		for( j = 0 ; j < my ; j++ )
 		{
-			for( j = 0 ; j < my ; j++ )
+			for( i = 0 ; i < mx ; i++ )
 			{
-				for( i = 0 ; i < matrix->mx ; i++ )
+				if( i < matrix->mx && j < matrix->my && k < matrix->mz )
 				{
 					blockValue[ i + mx * ( j + my * k ) ]
 						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
 					blockData[ i + mx * ( j + my * k ) ]
 						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
 				}
+				else
+				{
+					blockValue[ i + mx * ( j + my * k ) ] = def;
+				}
 			}
 		}
-		// Create new blocks
-		for( k = 0 ; k < mz ; k++ )
+	}
+
+	// Free excedent blocks
+	for( k = 0 ; k < matrix->mz ; k++ )
+	{
+		for( j = 0 ; j < matrix->my ; j++ )
 		{
-			for( j = 0 ; j < my ; j++ )
+			for( i = 0 ; i < matrix->mx ; i++ )
 			{
-				for( i = matrix->mx ; i < mx ; i++ )
+				if( ( i >= mx || j >= my || k >= mz ) &&
+					matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
 				{
-					blockValue[ i + mx * ( j +  my * k ) ] = def;
-					blockData[ i + mx * ( j +  my * k ) ] = NULL;
+					free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
 				}
 			}
 		}
+	}
 
-		int xi, xf;
-		xi = matrix->nx;
-		xf = matrix->bs * matrix->mx;
-		if( xf >= nx )
-		{
-			xf = nx - 1;
-		}
+	// Previous matrix size
+	int ox, oy, oz;
+	ox = matrix->nx;
+	oy = matrix->ny;
+	oz = matrix->nz;
 
-		matrix->nx = nx;
-		matrix->mx = mx;
+	matrix->nx = nx;
+	matrix->ny = ny;
+	matrix->nz = nz;
+	matrix->mx = mx;
+	matrix->my = my;
+	matrix->mz = mz;
 
-		free(matrix->blockData);
-		free(matrix->blockValue);
+	free(matrix->blockData);
+	free(matrix->blockValue);
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
+	matrix->blockData = blockData;
+	matrix->blockValue = blockValue;
 
-		// Set expanded elements to default
-		for( k = 0 ; k < matrix->nz ; k++ )
-		{
-			for( j = 0 ; j < matrix->ny ; j++ )
-			{
-				for( i = xi ; i < xf ; i++ )
-				{
-					sparCharSet( matrix, i, j, k, def );
-				}
-			}
-		}
+	// Set expanded elements of previous boundary blocks to default, block by block
+	if( nx > ox )
+	{
+		sparCharFillBox( matrix, ox, 0, 0, nx - ox, ny, nz, def );
+	}
+	if( ny > oy )
+	{
+		sparCharFillBox( matrix, 0, oy, 0, nx, ny - oy, nz, def );
 	}
-	// Shrink x
-	else if( nx < matrix->nx )
+	if( nz > oz )
 	{
-		// New block grid size
-		mx = (int)( ( nx + bs - 1 ) / bs );
-		my = matrix->my;
-		mz = matrix->mz;
+		sparCharFillBox( matrix, 0, 0, oz, nx, ny, nz - oz, def );
+	}
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (char*) calloc( blocks, sizeof(char) ); // Sets to 0s
-		blockData = (char**) calloc( blocks, sizeof(char*) ); // Sets to NULLs
+	// Reallocate block locks for the new block grid
+	free(matrix->blockLock);
+	matrix->blockLock = (atomic_flag*) malloc( matrix->mx * matrix->my * matrix->mz * sizeof(atomic_flag) );
 
-		if( blockValue == NULL || blockData == NULL )
+	if( matrix->blockLock == NULL )
+	{
+	   fprintf(stderr, "sparCharResize error: Out of memory\n");
+	   exit(1);
+	}
+
+	sparCharClearLocks( matrix );
+}
+
+// Sum of matrix elements
+double sparCharSum( sparChar *matrix )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	double sum;
+	sum = 0.0;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:sum) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		char *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, value times element count
+		if( blockData == NULL )
 		{
-		   fprintf(stderr, "sparCharResize error: Out of memory\n");
-		   exit(1);
+			sum += (double)( matrix->blockValue[n] ) * ex * ey * ez;
 		}
-
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
 		{
-			for( j = 0 ; j < my ; j++ )
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
-				}
+				sum += (double)( blockData[i] );
 			}
 		}
-
-		// Free excedent blocks
-		for( k = 0 ; k < mz ; k++ )
+		// Boundary heterogeneous block, skip outside elements
+		else
 		{
-			for( j = 0 ; j < my ; j++ )
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
 			{
-				for( i = mx ; i < matrix->mx ; i++ )
+				for( j = 0 ; j < ey ; j++ )
 				{
-					if( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
+					char *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
 					{
-						free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
+						sum += (double)( row[i] );
 					}
 				}
 			}
 		}
-
-		matrix->nx = nx;
-		matrix->mx = mx;
-
-		free(matrix->blockData);
-		free(matrix->blockValue);
-
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
 	}
 
-	// Expand y
-	if( ny > matrix->ny )
-	{
-		// New block grid size
-		mx = matrix->mx;
-		my = (int)( ( ny + bs - 1 ) / bs );
-		mz = matrix->mz;
+	return sum;
+}
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (char*) calloc( blocks, sizeof(char) ); // Sets to 0s
-		blockData = (char**) calloc( blocks, sizeof(char*) ); // Sets to NULLs
+// First matrix element in block order that is not NaN, NaN only if every element is NaN
+char sparCharFirstNumber( sparChar *matrix )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
 
-		if( blockValue == NULL || blockData == NULL )
-		{
-		   fprintf(stderr, "sparCharResize error: Out of memory\n");
-		   exit(1);
-		}
+	// For each block
+	int n;
+	for( n = 0 ; n < matrix->mx * matrix->my * matrix->mz ; n++ )
+	{
+		char *blockData;
+		blockData = matrix->blockData[n];
 
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+		// Uniform block
+		if( blockData == NULL )
 		{
-			for( j = 0 ; j < matrix->my ; j++ )
+			if( !isnan( (double) matrix->blockValue[n] ) )
 			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
-				}
+				return matrix->blockValue[n];
 			}
+			continue;
 		}
-		// Create new blocks
-		for( k = 0 ; k < mz ; k++ )
+
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % matrix->mx;
+		j1 = ( n / matrix->mx ) % matrix->my;
+		k1 = n / ( matrix->mx * matrix->my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs < bs ? matrix->nx - i1 * bs : bs;
+		ey = matrix->ny - j1 * bs < bs ? matrix->ny - j1 * bs : bs;
+		ez = matrix->nz - k1 * bs < bs ? matrix->nz - k1 * bs : bs;
+
+		// Heterogeneous block, skip outside elements
+		int i, j, k;
+		for( k = 0 ; k < ez ; k++ )
 		{
-			for( j = matrix->my ; j < my ; j++ )
+			for( j = 0 ; j < ey ; j++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				for( i = 0 ; i < ex ; i++ )
 				{
-					blockValue[ i + mx * ( j +  my * k ) ] = def;
-					blockData[ i + mx * ( j +  my * k ) ] = NULL;
+					if( !isnan( (double) blockData[ i + bs * ( j + bs * k ) ] ) )
+					{
+						return blockData[ i + bs * ( j + bs * k ) ];
+					}
 				}
 			}
 		}
+	}
 
-		int yi, yf;
-		yi = matrix->ny;
-		yf = matrix->bs * matrix->my;
-		if( yf >= ny )
-		{
-			yf = ny - 1;
-		}
+	return sparCharGet( matrix, 0, 0, 0 );
+}
 
-		matrix->ny = ny;
-		matrix->my = my;
+// Minimum matrix element, NaN elements ignored (NaN only if all are NaN)
+char sparCharMin( sparChar *matrix )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
 
-		free(matrix->blockData);
-		free(matrix->blockValue);
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
+	// Start with an element that is not NaN, comparisons with NaN are false so NaN never replaces it
+	char value;
+	value = sparCharFirstNumber( matrix );
 
-		// Set expanded elements to default
-		for( k = 0 ; k < matrix->nz ; k++ )
-		{
-			for( j = yi ; j < yf ; j++ )
-			{
-				for( i = 0 ; i < matrix->nx ; i++ )
-				{
-					sparCharSet( matrix, i, j, k, def );
-				}
-			}
-		}
-	}
-	// Shrink y
-	else if( ny < matrix->ny )
+	// Every element is NaN
+	if( isnan( (double) value ) )
 	{
-		// New block grid size
-		mx = matrix->mx;
-		my = (int)( ( ny + bs - 1 ) / bs );
-		mz = matrix->mz;
+		return value;
+	}
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (char*) calloc( blocks, sizeof(char) ); // Sets to 0s
-		blockData = (char**) calloc( blocks, sizeof(char*) ); // Sets to NULLs
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(min:value) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		char *blockData;
+		blockData = matrix->blockData[n];
 
-		if( blockValue == NULL || blockData == NULL )
+		// Uniform block
+		if( blockData == NULL )
 		{
-		   fprintf(stderr, "sparCharResize error: Out of memory\n");
-		   exit(1);
+			if( matrix->blockValue[n] < value )
+			{
+				value = matrix->blockValue[n];
+			}
 		}
-
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
 		{
-			for( j = 0 ; j < my ; j++ )
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
-				}
+				value = blockData[i] < value ? blockData[i] : value;
 			}
 		}
-
-		// Free excedent blocks
-		for( k = 0 ; k < mz ; k++ )
+		// Boundary heterogeneous block, skip outside elements
+		else
 		{
-			for( j = my ; j < matrix->my ; j++ )
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				for( j = 0 ; j < ey ; j++ )
 				{
-					if( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
+					char *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
 					{
-						free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
+						value = row[i] < value ? row[i] : value;
 					}
 				}
 			}
 		}
+	}
 
-		matrix->ny = ny;
-		matrix->my = my;
+	return value;
+}
 
-		free(matrix->blockData);
-		free(matrix->blockValue);
+// Maximum matrix element, NaN elements ignored (NaN only if all are NaN)
+char sparCharMax( sparChar *matrix )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
-	}
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
 
-	// Expand z
-	if( nz > matrix->nz )
-	{
-		// New block grid size
-		mx = matrix->mx;
-		my = matrix->my;
-		mz = (int)( ( nz + bs - 1 ) / bs );
+	// Start with an element that is not NaN, comparisons with NaN are false so NaN never replaces it
+	char value;
+	value = sparCharFirstNumber( matrix );
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (char*) calloc( blocks, sizeof(char) ); // Sets to 0s
-		blockData = (char**) calloc( blocks, sizeof(char*) ); // Sets to NULLs
+	// Every element is NaN
+	if( isnan( (double) value ) )
+	{
+		return value;
+	}
 
-		if( blockValue == NULL || blockData == NULL )
-		{
-		   fprintf(stderr, "sparCharResize error: Out of memory\n");
-		   exit(1);
-		}
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(max:value) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		char *blockData;
+		blockData = matrix->blockData[n];
 
-		// Copy existing blocks
-		for( k = 0 ; k < matrix->mz ; k++ )
+		// Uniform block
+		if( blockData == NULL )
 		{
-			for( j = 0 ; j < my ; j++ )
+			if( matrix->blockValue[n] > value )
 			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
-				}
+				value = matrix->blockValue[n];
 			}
 		}
-		// Create new blocks
-		for( k = matrix->mz ; k < mz ; k++ )
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
 		{
-			for( j = 0 ; j < my ; j++ )
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				value = blockData[i] > value ? blockData[i] : value;
+			}
+		}
+		// Boundary heterogeneous block, skip outside elements
+		else
+		{
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
 				{
-					blockValue[ i + mx * ( j +  my * k ) ] = def;
-					blockData[ i + mx * ( j +  my * k ) ] = NULL;
+					char *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						value = row[i] > value ? row[i] : value;
+					}
 				}
 			}
 		}
+	}
 
-		int zi, zf;
-		zi = matrix->nz;
-		zf = matrix->bs * matrix->mz;
-		if( zf >= nz )
-		{
-			zf = nz - 1;
-		}
+	return value;
+}
+
+// Number of matrix elements different from the default value
+double sparCharCount( sparChar *matrix )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
 
-		matrix->nz = nz;
-		matrix->mz = mz;
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
 
-		free(matrix->blockData);
-		free(matrix->blockValue);
+	// Default value
+	char def;
+	def = matrix->def;
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
+	double count;
+	count = 0.0;
 
-		// Set expanded elements to default
-		for( k = zi ; k < zf ; k++ )
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:count) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		char *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, all or none of its elements
+		if( blockData == NULL )
 		{
-			for( j = 0 ; j < matrix->ny ; j++ )
+			if( sparCharEqual( matrix->blockValue[n], def ) == 0 )
 			{
-				for( i = 0 ; i < matrix->nx ; i++ )
-				{
-					sparCharSet( matrix, i, j, k, def );
-				}
+				count += (double)( ex * ey * ez );
 			}
 		}
-	}
-	// Shrink z
-	else if( nz < matrix->nz )
-	{
-		// New block grid size
-		mx = matrix->mx;
-		my = matrix->my;
-		mz = (int)( ( nz + bs - 1 ) / bs );
-
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (char*) calloc( blocks, sizeof(char) ); // Sets to 0s
-		blockData = (char**) calloc( blocks, sizeof(char*) ); // Sets to NULLs
-
-		if( blockValue == NULL || blockData == NULL )
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
 		{
-		   fprintf(stderr, "sparCharResize error: Out of memory\n");
-		   exit(1);
+			int i, c;
+			c = 0;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				c += ( sparCharEqual( blockData[i], def ) == 0 );
+			}
+			count += (double)( c );
 		}
-
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+		// Boundary heterogeneous block, skip outside elements
+		else
 		{
-			for( j = 0 ; j < my ; j++ )
+			int i, j, k, c;
+			c = 0;
+			for( k = 0 ; k < ez ; k++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				for( j = 0 ; j < ey ; j++ )
 				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
+					char *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						c += ( sparCharEqual( row[i], def ) == 0 );
+					}
 				}
 			}
+			count += (double)( c );
 		}
+	}
+
+	return count;
+}
+
+// Fold f over matrix elements from identity, f gets each uniform block once with its element count
+double sparCharReduce( sparChar *matrix, double (*f)( double acc, char value, int count ), double identity )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	double acc;
+	acc = identity;
 
-		// Free excedent blocks
-		for( k = mz ; k < matrix->mz ; k++ )
+	// For each block, sequential so f needs no combine step
+	int n;
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		char *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, a single call for all its elements
+		if( blockData == NULL )
 		{
-			for( j = 0 ; j < my ; j++ )
+			acc = f( acc, matrix->blockValue[n], ex * ey * ez );
+		}
+		// Heterogeneous block, skip outside elements
+		else
+		{
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				for( j = 0 ; j < ey ; j++ )
 				{
-					if( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
+					char *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
 					{
-						free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
+						acc = f( acc, row[i], 1 );
 					}
 				}
 			}
 		}
-
-		matrix->nz = nz;
-		matrix->mz = mz;
-
-		free(matrix->blockData);
-		free(matrix->blockValue);
-
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
 	}
-}
 
+	return acc;
+}
 
-// Matrix constructor
-sparInt* sparIntInit( int nx, int ny, int nz, int bs, int def )
+// Apply function f to every matrix element (and default value) in place
+void sparCharApply( sparChar *matrix, char (*f)( char ) )
 {
-	// Check matrix size
-	if( !( nx > 0 && ny > 0 && nz > 0 ) )
-	{
-		fprintf(stderr, "sparIntInit error: Matrix size must be positive\n");
-		exit(1);
-	}
-
-	// Check block size
-	if( !( bs > 1 ) )
-	{
-		fprintf(stderr, "sparIntInit error: Block size must be greater than 1\n");
-		exit(1);
-	}
+	// Block size
+	int bs3;
+	bs3 = matrix->bs3;
 
-	// Declare struct and allocate space
-	sparInt *matrix;
-	matrix = (sparInt*) malloc(sizeof(sparInt));
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
 
-	if( matrix == NULL )
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
 	{
-	   fprintf(stderr, "sparIntInit error: Out of memory\n");
-	   exit(1);
+		char *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, transform its value only
+		if( blockData == NULL )
+		{
+			matrix->blockValue[n] = f( matrix->blockValue[n] );
+		}
+		// Heterogeneous block, transform and reduce if possible
+		else
+		{
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				blockData[i] = f( blockData[i] );
+			}
+			sparCharReduceBlock( matrix, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
 	}
 
-	// Set matrix size (nx,ny,nz)
-	matrix->nx = nx;
-	matrix->ny = ny;
-	matrix->nz = nz;
+	// Keep the background consistent with transformed uniform blocks
+	matrix->def = f( matrix->def );
+}
 
-	// Set block size (bs,bs,bs)
-	matrix->bs  = bs;
-	matrix->bs3 = bs * bs * bs;
+// New matrix with function f applied to every element (and default value)
+sparChar* sparCharMap( sparChar *matrix, char (*f)( char ) )
+{
+	// Declare matrix and init
+	sparChar *matrix2;
+	matrix2 = sparCharInit( matrix->nx, matrix->ny, matrix->nz,
+						matrix->bs, f( matrix->def ) );
 
-	// Set block matrix size (mx,my,mz)
-	matrix->mx = (int)( ( nx + bs - 1 ) / bs );
-	matrix->my = (int)( ( ny + bs - 1 ) / bs );
-	matrix->mz = (int)( ( nz + bs - 1 ) / bs );
+	// Copy ring buffer origin
+	matrix2->ox = matrix->ox;
+	matrix2->oy = matrix->oy;
+	matrix2->oz = matrix->oz;
 
-	// Number of blocks
-	int blocks = matrix->mx * matrix->my * matrix->mz;
+	// Block size
+	int bs3;
+	bs3 = matrix->bs3;
 
-	// Allocate space for block uniform data
-	matrix->blockValue = (int*) calloc( blocks, sizeof(int) );
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
 
-	if( matrix->blockValue == NULL )
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
 	{
-	   fprintf(stderr, "sparIntInit error: Out of memory\n");
-	   exit(1);
-	}
-
-	// Allocate space for block heterogeneous data arrays
-	matrix->blockData = (int**) calloc( blocks, sizeof(int*) );
+		char *blockData;
+		blockData = matrix->blockData[n];
 
-	if( matrix->blockData == NULL )
-	{
-	   fprintf(stderr, "sparIntInit error: Out of memory\n");
-	   exit(1);
-	}
+		// Uniform block, transform its value only
+		if( blockData == NULL )
+		{
+			matrix2->blockValue[n] = f( matrix->blockValue[n] );
+		}
+		// Heterogeneous block, transform into new block and reduce if possible
+		else
+		{
+			char *blockData2;
+			blockData2 = (char*) calloc( bs3, sizeof(char) );
 
-	// Set default value
-	matrix->def = def;
+			if( blockData2 == NULL )
+			{
+			   fprintf(stderr, "sparCharMap error: Out of memory\n");
+			   exit(1);
+			}
 
-	// Set matrix elemets to default value
-	int i;
-	for( i = 0 ; i < blocks ; i++ )
-	{
-		matrix->blockData[i] = NULL; // Flag for uniform block
-		matrix->blockValue[i] = def;
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				blockData2[i] = f( blockData[i] );
+			}
+			matrix2->blockData[n] = blockData2;
+			sparCharReduceBlock( matrix2, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
 	}
 
-	// Return pointer
-	return matrix;
+	return matrix2;
 }
 
-// Matrix destructor
-void sparIntFree( sparInt *matrix )
+// Visit elements different from the default value, in block order
+void sparCharForEach( sparChar *matrix, void (*f)( int x, int y, int z, char value, void *data ), void *data )
 {
-	// Number of blocks
-	int blocks;
-	blocks = matrix->mx * matrix->my * matrix->mz;
+	// Block size
+	int bs;
+	bs = matrix->bs;
 
-	// Free heterogeneous blocks
-	int i;
-	for( i = 0 ; i < blocks ; i++ )
+	// Default value
+	char def;
+	def = matrix->def;
+
+	int i, j, k;
+	int i1, j1, k1;
+	int ex, ey, ez;
+	int n;
+
+	// For each block
+	for( k1 = 0 ; k1 < matrix->mz ; k1++ )
 	{
-		if( matrix->blockData[i] != NULL ) // Flag for uniform block
+		for( j1 = 0 ; j1 < matrix->my ; j1++ )
 		{
-			free( matrix->blockData[i] );
-		}
-	}
+			for( i1 = 0 ; i1 < matrix->mx ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
 
-	// Free block uniform data
-	free(matrix->blockValue);
+				char *blockData;
+				blockData = matrix->blockData[n];
 
-	// Free block heterogeneous data array
-	free(matrix->blockData);
+				// Skip uniform blocks equal to the default value
+				if( blockData == NULL && sparCharEqual( matrix->blockValue[n], def ) )
+				{
+					continue;
+				}
 
-	// Free matrix instance
-	free(matrix);
+				// Block extent inside the matrix
+				ex = matrix->nx - i1 * bs;
+				ey = matrix->ny - j1 * bs;
+				ez = matrix->nz - k1 * bs;
+				if( ex > bs ) ex = bs;
+				if( ey > bs ) ey = bs;
+				if( ez > bs ) ez = bs;
+
+				// Uniform block, every element
+				if( blockData == NULL )
+				{
+					char value;
+					value = matrix->blockValue[n];
+					for( k = 0 ; k < ez ; k++ )
+					{
+						for( j = 0 ; j < ey ; j++ )
+						{
+							for( i = 0 ; i < ex ; i++ )
+							{
+								f( i1 * bs + i, j1 * bs + j, k1 * bs + k, value, data );
+							}
+						}
+					}
+				}
+				// Heterogeneous block, non-default elements
+				else
+				{
+					for( k = 0 ; k < ez ; k++ )
+					{
+						for( j = 0 ; j < ey ; j++ )
+						{
+							char *row;
+							row = blockData + bs * ( j + bs * k );
+							for( i = 0 ; i < ex ; i++ )
+							{
+								if( sparCharEqual( row[i], def ) == 0 )
+								{
+									f( i1 * bs + i, j1 * bs + j, k1 * bs + k, row[i], data );
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+	}
 }
 
-// Reset matrix values
-void sparIntReset( sparInt *matrix )
+// Visit maximal runs of equal non-default elements along x, (x,y,z) to (x+n-1,y,z), merged across blocks
+void sparCharForEachRun( sparChar *matrix, void (*f)( int x, int y, int z, int n, char value, void *data ), void *data )
 {
-	// Number of blocks
-	int blocks;
-	blocks = matrix->mx * matrix->my * matrix->mz;
+	// Block size
+	int bs;
+	bs = matrix->bs;
 
-	// Reduce blocks and set to default value
-	int i;
+	// Default value
+	char def;
+	def = matrix->def;
+
+	int i, j, k;
+	int i1, j1, k1;
+	int ex, ey, ez;
+	int n;
+
+	// Current run (rx,y,z) to (rx+rn-1,y,z) of value rv
+	int rx, rn;
+	char rv;
+
+	// For each row of blocks
+	for( k1 = 0 ; k1 < matrix->mz ; k1++ )
+	{
+		for( j1 = 0 ; j1 < matrix->my ; j1++ )
+		{
+			// Block row extent inside the matrix
+			ey = matrix->ny - j1 * bs;
+			ez = matrix->nz - k1 * bs;
+			if( ey > bs ) ey = bs;
+			if( ez > bs ) ez = bs;
+
+			// For each matrix row, runs continue from one block into the next
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					rx = 0;
+					rn = 0;
+					rv = def;
+
+					for( i1 = 0 ; i1 < matrix->mx ; i1++ )
+					{
+						// Linear block index (n) <-> (i1,j1,k1)
+						n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+						ex = matrix->nx - i1 * bs;
+						if( ex > bs ) ex = bs;
+
+						char *blockData;
+						blockData = matrix->blockData[n];
+
+						// Uniform block, extend or restart the run with its whole row
+						if( blockData == NULL )
+						{
+							if( rn > 0 && sparCharEqual( matrix->blockValue[n], rv ) )
+							{
+								rn += ex;
+							}
+							else
+							{
+								if( rn > 0 && sparCharEqual( rv, def ) == 0 )
+								{
+									f( rx, j1 * bs + j, k1 * bs + k, rn, rv, data );
+								}
+								rx = i1 * bs;
+								rn = ex;
+								rv = matrix->blockValue[n];
+							}
+						}
+						// Heterogeneous block, element by element
+						else
+						{
+							char *row;
+							row = blockData + bs * ( j + bs * k );
+							for( i = 0 ; i < ex ; i++ )
+							{
+								if( rn > 0 && sparCharEqual( row[i], rv ) )
+								{
+									rn++;
+								}
+								else
+								{
+									if( rn > 0 && sparCharEqual( rv, def ) == 0 )
+									{
+										f( rx, j1 * bs + j, k1 * bs + k, rn, rv, data );
+									}
+									rx = i1 * bs + i;
+									rn = 1;
+									rv = row[i];
+								}
+							}
+						}
+					}
+
+					// End of row
+					if( rn > 0 && sparCharEqual( rv, def ) == 0 )
+					{
+						f( rx, j1 * bs + j, k1 * bs + k, rn, rv, data );
+					}
+				}
+			}
+		}
+	}
+}
+
+// Element-wise operation between arrays, c[i] = a[i] op b[i]
+void sparCharOpArray( char *c, char *a, char *b, int n, int op, char def )
+{
+	int i;
+	switch( op )
+	{
+		case SPAR_ADD:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] + b[i];
+			}
+			break;
+		case SPAR_SUB:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] - b[i];
+			}
+			break;
+		case SPAR_MUL:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] * b[i];
+			}
+			break;
+		case SPAR_MIN:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] < b[i] ? a[i] : b[i];
+			}
+			break;
+		case SPAR_MAX:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] > b[i] ? a[i] : b[i];
+			}
+			break;
+		case SPAR_MASK:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = b[i] != 0 ? a[i] : def;
+			}
+			break;
+		default:
+			fprintf(stderr, "sparCharOpArray error: Unknown operation\n");
+			exit(1);
+	}
+}
+
+// Element-wise operation between array and scalar, c[i] = a[i] op value
+void sparCharOpArrayScalar( char *c, char *a, char value, int n, int op, char def )
+{
+	int i;
+	switch( op )
+	{
+		case SPAR_ADD:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] + value;
+			}
+			break;
+		case SPAR_SUB:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] - value;
+			}
+			break;
+		case SPAR_MUL:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] * value;
+			}
+			break;
+		case SPAR_MIN:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] < value ? a[i] : value;
+			}
+			break;
+		case SPAR_MAX:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] > value ? a[i] : value;
+			}
+			break;
+		case SPAR_MASK:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = value != 0 ? a[i] : def;
+			}
+			break;
+		default:
+			fprintf(stderr, "sparCharOpArrayScalar error: Unknown operation\n");
+			exit(1);
+	}
+}
+
+// New matrix with element-wise operation between matrices, c = a op b
+sparChar* sparCharOp( sparChar *a, sparChar *b, int op )
+{
+	// Check matrix size
+	if( a->nx != b->nx || a->ny != b->ny || a->nz != b->nz )
+	{
+		fprintf(stderr, "sparCharOp error: Matrix sizes must agree\n");
+		exit(1);
+	}
+
+	// Check ring buffer origin, blocks are combined by storage index
+	if( a->ox != b->ox || a->oy != b->oy || a->oz != b->oz )
+	{
+		fprintf(stderr, "sparCharOp error: Ring buffer origins must agree\n");
+		exit(1);
+	}
+
+	// Result default value
+	char def;
+	sparCharOpArrayScalar( &def, &a->def, b->def, 1, op, a->def );
+
+	// Declare result matrix with block size of a
+	sparChar *c;
+	c = sparCharInit( a->nx, a->ny, a->nz, a->bs, def );
+
+	// Copy ring buffer origin of a
+	c->ox = a->ox;
+	c->oy = a->oy;
+	c->oz = a->oz;
+
+	// Block size
+	int bs, bs3;
+	bs = a->bs;
+	bs3 = a->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = a->mx;
+	my = a->my;
+	mz = a->mz;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block of b resampled on the block grid of a
+		char *buffer;
+		buffer = NULL;
+
+		if( b->bs != bs )
+		{
+			buffer = (char*) malloc( bs3 * sizeof(char) );
+
+			if( buffer == NULL )
+			{
+			   fprintf(stderr, "sparCharOp error: Out of memory\n");
+			   exit(1);
+			}
+		}
+
+		// For each block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < mx * my * mz ; n++ )
+		{
+			// Block (i1,j1,k1) <-> (n)
+			int i1, j1, k1;
+			i1 = n % mx;
+			j1 = ( n / mx ) % my;
+			k1 = n / ( mx * my );
+
+			// Block of b, uniform (blockB == NULL) or heterogeneous
+			char *blockB, valueB;
+			if( b->bs == bs )
+			{
+				blockB = b->blockData[n];
+				valueB = b->blockValue[n];
+			}
+			else if( sparCharUniformBox( b, i1 * bs, j1 * bs, k1 * bs, bs, bs, bs, &valueB ) )
+			{
+				blockB = NULL;
+			}
+			else
+			{
+				sparCharGetBox( b, i1 * bs, j1 * bs, k1 * bs, bs, bs, bs, buffer );
+				blockB = buffer;
+			}
+
+			// Block of a
+			char *blockA, valueA;
+			blockA = a->blockData[n];
+			valueA = a->blockValue[n];
+
+			// Both uniform, one operation
+			if( blockA == NULL && blockB == NULL )
+			{
+				sparCharOpArrayScalar( &c->blockValue[n], &valueA, valueB, 1, op, a->def );
+				continue;
+			}
+
+			// Heterogeneous result
+			char *blockC;
+			blockC = (char*) calloc( bs3, sizeof(char) );
+
+			if( blockC == NULL )
+			{
+			   fprintf(stderr, "sparCharOp error: Out of memory\n");
+			   exit(1);
+			}
+
+			// Uniform b, scalar operation
+			if( blockB == NULL )
+			{
+				sparCharOpArrayScalar( blockC, blockA, valueB, bs3, op, a->def );
+			}
+			// Uniform a, expand into result and operate in place
+			else if( blockA == NULL )
+			{
+				int i;
+				for( i = 0 ; i < bs3 ; i++ )
+				{
+					blockC[i] = valueA;
+				}
+				sparCharOpArray( blockC, blockC, blockB, bs3, op, a->def );
+			}
+			// Both heterogeneous
+			else
+			{
+				sparCharOpArray( blockC, blockA, blockB, bs3, op, a->def );
+			}
+
+			c->blockData[n] = blockC;
+			sparCharReduceBlock( c, i1, j1, k1 );
+		}
+
+		free(buffer);
+	}
+
+	return c;
+}
+
+// Element-wise operation with scalar in place, matrix = matrix op value
+void sparCharOpScalar( sparChar *matrix, char value, int op )
+{
+	// Block size
+	int bs3;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Default value of the operation (SPAR_MASK)
+	char def;
+	def = matrix->def;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		char *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, one operation
+		if( blockData == NULL )
+		{
+			sparCharOpArrayScalar( &matrix->blockValue[n], &matrix->blockValue[n], value, 1, op, def );
+		}
+		// Heterogeneous block, operate in place and reduce if possible
+		else
+		{
+			sparCharOpArrayScalar( blockData, blockData, value, bs3, op, def );
+			sparCharReduceBlock( matrix, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
+	}
+
+	// Keep the background consistent with updated uniform blocks
+	sparCharOpArrayScalar( &matrix->def, &matrix->def, value, 1, op, def );
+}
+
+// Stencil of radius r from src into dst, f(c) reads neighbours c[i+sy*j+sz*k] with -r <= i,j,k <= r
+void sparCharStencil( sparChar *dst, sparChar *src, int r, char (*f)( char *c, int r, int sy, int sz, void *data ), void *data )
+{
+	// Check matrices
+	if( dst == src )
+	{
+		fprintf(stderr, "sparCharStencil error: Source and destination must be different\n");
+		exit(1);
+	}
+
+	if( dst->nx != src->nx || dst->ny != src->ny || dst->nz != src->nz )
+	{
+		fprintf(stderr, "sparCharStencil error: Matrix sizes must agree\n");
+		exit(1);
+	}
+
+	if( r < 0 )
+	{
+		fprintf(stderr, "sparCharStencil error: Radius must be non-negative\n");
+		exit(1);
+	}
+
+	// Destination block size
+	int bs, bs3;
+	bs = dst->bs;
+	bs3 = dst->bs3;
+
+	// Destination block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = dst->mx;
+	my = dst->my;
+	mz = dst->mz;
+
+	// Block plus halo size (hs,hs,hs)
+	int hs;
+	hs = bs + 2 * r;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block plus halo of the source
+		char *halo;
+		halo = (char*) malloc( hs * hs * hs * sizeof(char) );
+
+		if( halo == NULL )
+		{
+		   fprintf(stderr, "sparCharStencil error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each destination block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < mx * my * mz ; n++ )
+		{
+			// Block (i1,j1,k1) <-> (n)
+			int i1, j1, k1;
+			i1 = n % mx;
+			j1 = ( n / mx ) % my;
+			k1 = n / ( mx * my );
+
+			// Block origin
+			int x, y, z;
+			x = i1 * bs;
+			y = j1 * bs;
+			z = k1 * bs;
+
+			// Free previous destination data
+			if( dst->blockData[n] != NULL )
+			{
+				free(dst->blockData[n]);
+				dst->blockData[n] = NULL;
+			}
+
+			// Uniform neighbourhood, uniform destination block
+			char value;
+			if( sparCharUniformBox( src, x - r, y - r, z - r, hs, hs, hs, &value ) &&
+				( sparCharEqual( value, src->def ) || ( x >= r && y >= r && z >= r &&
+				  x + bs + r <= src->nx && y + bs + r <= src->ny && z + bs + r <= src->nz ) ) )
+			{
+				int w, i;
+				w = 2 * r + 1;
+				for( i = 0 ; i < w * w * w ; i++ )
+				{
+					halo[i] = value;
+				}
+				dst->blockValue[n] = f( halo + r + w * ( r + w * r ), r, w, w * w, data );
+				continue;
+			}
+
+			// Read block plus halo
+			sparCharGetBox( src, x - r, y - r, z - r, hs, hs, hs, halo );
+
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = dst->nx - x;
+			ey = dst->ny - y;
+			ez = dst->nz - z;
+			if( ex > bs ) ex = bs;
+			if( ey > bs ) ey = bs;
+			if( ez > bs ) ez = bs;
+
+			// Apply stencil
+			char *blockData;
+			blockData = (char*) calloc( bs3, sizeof(char) );
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparCharStencil error: Out of memory\n");
+			   exit(1);
+			}
+
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					char *c;
+					c = halo + r + hs * ( ( j + r ) + hs * ( k + r ) );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						blockData[ i + bs * ( j + bs * k ) ] = f( c + i, r, hs, hs * hs, data );
+					}
+				}
+			}
+
+			// Write block and reduce if possible
+			dst->blockData[n] = blockData;
+			sparCharReduceBlock( dst, i1, j1, k1 );
+		}
+
+		free(halo);
+	}
+}
+
+// Stencil kernel, weighted sum of the neighbourhood with data holding (2r+1)^3 weights
+char sparCharConvolveKernel( char *c, int r, int sy, int sz, void *data )
+{
+	double *weights;
+	weights = (double*) data;
+
+	double sum;
+	sum = 0.0;
+
+	int i, j, k;
+	for( k = -r ; k <= r ; k++ )
+	{
+		for( j = -r ; j <= r ; j++ )
+		{
+			for( i = -r ; i <= r ; i++ )
+			{
+				sum += *weights++ * (double)( c[ i + sy * j + sz * k ] );
+			}
+		}
+	}
+
+	return sparCharRound( sum );
+}
+
+// Convolution of src into dst with weights[(i+r)+(2r+1)*((j+r)+(2r+1)*(k+r))]
+void sparCharConvolve( sparChar *dst, sparChar *src, int r, double *weights )
+{
+	sparCharStencil( dst, src, r, sparCharConvolveKernel, weights );
+}
+
+// One-dimensional filter of src into dst along axis (0 x, 1 y, 2 z) with 2r+1 weights, box (moving average) if weights is NULL
+void sparCharFilterAxis( sparChar *dst, sparChar *src, int axis, int r, double *weights )
+{
+	// Check matrices
+	if( dst == src )
+	{
+		fprintf(stderr, "sparCharFilterAxis error: Source and destination must be different\n");
+		exit(1);
+	}
+
+	if( dst->nx != src->nx || dst->ny != src->ny || dst->nz != src->nz )
+	{
+		fprintf(stderr, "sparCharFilterAxis error: Matrix sizes must agree\n");
+		exit(1);
+	}
+
+	if( axis < 0 || axis > 2 || r < 0 )
+	{
+		fprintf(stderr, "sparCharFilterAxis error: Invalid axis or radius\n");
+		exit(1);
+	}
+
+	// Destination block size
+	int bs, bs3;
+	bs = dst->bs;
+	bs3 = dst->bs3;
+
+	// Destination block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = dst->mx;
+	my = dst->my;
+	mz = dst->mz;
+
+	// Halo radius (rx,ry,rz) and block plus halo size (hx,hy,hz)
+	int rx, ry, rz;
+	rx = axis == 0 ? r : 0;
+	ry = axis == 1 ? r : 0;
+	rz = axis == 2 ? r : 0;
+
+	int hx, hy, hz;
+	hx = bs + 2 * rx;
+	hy = bs + 2 * ry;
+	hz = bs + 2 * rz;
+
+	// Element strides along the filter axis in the halo and in the block
+	int hstride, bstride;
+	hstride = axis == 0 ? 1 : ( axis == 1 ? hx : hx * hy );
+	bstride = axis == 0 ? 1 : ( axis == 1 ? bs : bs * bs );
+
+	// Sum of weights
+	double wsum;
+	wsum = 1.0;
+	if( weights != NULL )
+	{
+		int i;
+		wsum = 0.0;
+		for( i = 0 ; i < 2 * r + 1 ; i++ )
+		{
+			wsum += weights[i];
+		}
+
+		// Normalized kernel, keep uniform values exact
+		if( fabs( wsum - 1.0 ) < 1e-9 )
+		{
+			wsum = 1.0;
+		}
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block plus halo of the source and one line along the axis
+		char *halo;
+		double *line;
+		halo = (char*) malloc( hx * hy * hz * sizeof(char) );
+		line = (double*) malloc( ( bs + 2 * r ) * sizeof(double) );
+
+		if( halo == NULL || line == NULL )
+		{
+		   fprintf(stderr, "sparCharFilterAxis error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each destination block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < mx * my * mz ; n++ )
+		{
+			// Block (i1,j1,k1) <-> (n)
+			int i1, j1, k1;
+			i1 = n % mx;
+			j1 = ( n / mx ) % my;
+			k1 = n / ( mx * my );
+
+			// Block origin
+			int x, y, z;
+			x = i1 * bs;
+			y = j1 * bs;
+			z = k1 * bs;
+
+			// Free previous destination data
+			if( dst->blockData[n] != NULL )
+			{
+				free(dst->blockData[n]);
+				dst->blockData[n] = NULL;
+			}
+
+			// Run of uniform blocks along the axis, uniform destination block
+			char value;
+			if( sparCharUniformBox( src, x - rx, y - ry, z - rz, hx, hy, hz, &value ) &&
+				( sparCharEqual( value, src->def ) || ( x >= rx && y >= ry && z >= rz &&
+				  x + bs + rx <= src->nx && y + bs + ry <= src->ny && z + bs + rz <= src->nz ) ) )
+			{
+				dst->blockValue[n] = weights == NULL || wsum == 1.0 ? value : sparCharRound( wsum * value );
+				continue;
+			}
+
+			// Read block plus halo
+			sparCharGetBox( src, x - rx, y - ry, z - rz, hx, hy, hz, halo );
+
+			char *blockData;
+			blockData = (char*) calloc( bs3, sizeof(char) );
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparCharFilterAxis error: Out of memory\n");
+			   exit(1);
+			}
+
+			// For each line along the axis, (a,b) are the other two block indices
+			int a, b, i;
+			for( b = 0 ; b < bs ; b++ )
+			{
+				for( a = 0 ; a < bs ; a++ )
+				{
+					// First line element in the halo and in the block
+					char *hline, *bline;
+					if( axis == 0 )
+					{
+						hline = halo + hx * ( a + hy * b );
+						bline = blockData + bs * ( a + bs * b );
+					}
+					else if( axis == 1 )
+					{
+						hline = halo + a + hx * hy * b;
+						bline = blockData + a + bs * bs * b;
+					}
+					else
+					{
+						hline = halo + a + hx * b;
+						bline = blockData + a + bs * b;
+					}
+
+					// Gather line
+					for( i = 0 ; i < bs + 2 * r ; i++ )
+					{
+						line[i] = (double)( hline[ i * hstride ] );
+					}
+
+					// Box, sliding window sum
+					if( weights == NULL )
+					{
+						double sum;
+						sum = 0.0;
+						for( i = 0 ; i < 2 * r + 1 ; i++ )
+						{
+							sum += line[i];
+						}
+						for( i = 0 ; i < bs ; i++ )
+						{
+							bline[ i * bstride ] = sparCharRound( sum / ( 2 * r + 1 ) );
+							if( i + 1 < bs )
+							{
+								sum += line[ i + 2 * r + 1 ] - line[i];
+							}
+						}
+					}
+					// Weighted window as offsets from the centre element, exact on constant lines
+					else
+					{
+						int w;
+						for( i = 0 ; i < bs ; i++ )
+						{
+							double sum;
+							sum = 0.0;
+							for( w = 0 ; w < 2 * r + 1 ; w++ )
+							{
+								sum += weights[w] * ( line[ i + w ] - line[ i + r ] );
+							}
+							bline[ i * bstride ] = sparCharRound( wsum * line[ i + r ] + sum );
+						}
+					}
+				}
+			}
+
+			// Write block and reduce if possible
+			dst->blockData[n] = blockData;
+			sparCharReduceBlock( dst, i1, j1, k1 );
+		}
+
+		free(halo);
+		free(line);
+	}
+}
+
+// Box filter (mean over (2r+1)^3 neighbourhood) of src into dst, three one-dimensional passes
+void sparCharBoxFilter( sparChar *dst, sparChar *src, int r )
+{
+	// Temporal matrix for the second pass, intermediate passes see the source default value outside the matrix
+	sparChar *tmp;
+	tmp = sparCharInit( dst->nx, dst->ny, dst->nz, dst->bs, src->def );
+
+	char def;
+	def = dst->def;
+	dst->def = src->def;
+
+	sparCharFilterAxis( dst, src, 0, r, NULL );
+	sparCharFilterAxis( tmp, dst, 1, r, NULL );
+
+	dst->def = def;
+	sparCharFilterAxis( dst, tmp, 2, r, NULL );
+
+	sparCharFree( tmp );
+}
+
+// Gaussian filter of standard deviation sigma of src into dst, three one-dimensional passes
+void sparCharGaussianFilter( sparChar *dst, sparChar *src, double sigma )
+{
+	if( !( sigma > 0.0 ) )
+	{
+		fprintf(stderr, "sparCharGaussianFilter error: Standard deviation must be positive\n");
+		exit(1);
+	}
+
+	// Normalized kernel truncated at 3 sigma
+	int r;
+	r = (int)( ceil( 3.0 * sigma ) );
+
+	double *weights;
+	weights = (double*) malloc( ( 2 * r + 1 ) * sizeof(double) );
+
+	if( weights == NULL )
+	{
+	   fprintf(stderr, "sparCharGaussianFilter error: Out of memory\n");
+	   exit(1);
+	}
+
+	int i;
+	double sum;
+	sum = 0.0;
+	for( i = -r ; i <= r ; i++ )
+	{
+		weights[ i + r ] = exp( -0.5 * i * i / ( sigma * sigma ) );
+		sum += weights[ i + r ];
+	}
+	for( i = 0 ; i < 2 * r + 1 ; i++ )
+	{
+		weights[i] /= sum;
+	}
+
+	// Temporal matrix for the second pass, intermediate passes see the source default value outside the matrix
+	sparChar *tmp;
+	tmp = sparCharInit( dst->nx, dst->ny, dst->nz, dst->bs, src->def );
+
+	char def;
+	def = dst->def;
+	dst->def = src->def;
+
+	sparCharFilterAxis( dst, src, 0, r, weights );
+	sparCharFilterAxis( tmp, dst, 1, r, weights );
+
+	dst->def = def;
+	sparCharFilterAxis( dst, tmp, 2, r, weights );
+
+	sparCharFree( tmp );
+	free(weights);
+}
+
+// Union-find root of node i with path halving (connected component labeling)
+int sparCharLabelFind( int *parent, int i )
+{
+	while( parent[i] != i )
+	{
+		parent[i] = parent[ parent[i] ];
+		i = parent[i];
+	}
+	return i;
+}
+
+// Union-find merge of the sets of nodes i and j, the smallest node is kept as root
+void sparCharLabelUnion( int *parent, int i, int j )
+{
+	i = sparCharLabelFind( parent, i );
+	j = sparCharLabelFind( parent, j );
+	if( i < j )
+	{
+		parent[j] = i;
+	}
+	else if( j < i )
+	{
+		parent[i] = j;
+	}
+}
+
+// Union-find node of element (x,y,z), -1 for elements equal to the default value
+int sparCharLabelNode( sparChar *matrix, int *offset, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Linear block index (n) <-> (x/bs,y/bs,z/bs)
+	int n;
+	n = x / bs + matrix->mx * ( y / bs + matrix->my * ( z / bs ) );
+
+	// Uniform block, one node or none
+	if( matrix->blockData[n] == NULL )
+	{
+		return offset[n];
+	}
+
+	// Heterogeneous block, one node per element
+	int i;
+	i = x % bs + bs * ( y % bs + bs * ( z % bs ) );
+	if( sparCharEqual( matrix->blockData[n][i], matrix->def ) )
+	{
+		return -1;
+	}
+	return offset[n] + i;
+}
+
+// Connect block (x,y,z) with its neighbour block across the lower face along axis (0 x, 1 y, 2 z)
+void sparCharLabelFace( sparChar *matrix, int *offset, int *parent, int x, int y, int z, int axis )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Neighbour block
+	int x2, y2, z2;
+	x2 = x - ( axis == 0 );
+	y2 = y - ( axis == 1 );
+	z2 = z - ( axis == 2 );
+
+	// Linear block indices
+	int n, n2;
+	n = x + matrix->mx * ( y + matrix->my * z );
+	n2 = x2 + matrix->mx * ( y2 + matrix->my * z2 );
+
+	// Any default uniform block, nothing to connect
+	if( offset[n] < 0 || offset[n2] < 0 )
+	{
+		return;
+	}
+
+	// Both uniform, one connection
+	if( matrix->blockData[n] == NULL && matrix->blockData[n2] == NULL )
+	{
+		sparCharLabelUnion( parent, offset[n], offset[n2] );
+		return;
+	}
+
+	// Block extent inside the matrix
+	int ex, ey, ez;
+	ex = matrix->nx - x * bs;
+	ey = matrix->ny - y * bs;
+	ez = matrix->nz - z * bs;
+	if( ex > bs ) ex = bs;
+	if( ey > bs ) ey = bs;
+	if( ez > bs ) ez = bs;
+
+	// Face elements
+	int a, b, na, nb;
+	na = axis == 0 ? ey : ex;
+	nb = axis == 2 ? ey : ez;
+	for( b = 0 ; b < nb ; b++ )
+	{
+		for( a = 0 ; a < na ; a++ )
+		{
+			// Element (i,j,k) on the face and its neighbour
+			int i, j, k, node, node2;
+			i = x * bs + ( axis == 0 ? 0 : a );
+			j = y * bs + ( axis == 0 ? a : ( axis == 1 ? 0 : b ) );
+			k = z * bs + ( axis == 2 ? 0 : b );
+
+			node = sparCharLabelNode( matrix, offset, i, j, k );
+			if( node < 0 )
+			{
+				continue;
+			}
+			node2 = sparCharLabelNode( matrix, offset, i - ( axis == 0 ), j - ( axis == 1 ), k - ( axis == 2 ) );
+			if( node2 < 0 )
+			{
+				continue;
+			}
+			sparCharLabelUnion( parent, node, node2 );
+		}
+	}
+}
+
+// Connect elements inside heterogeneous block (x,y,z)
+void sparCharLabelBlock( sparChar *matrix, int *offset, int *parent, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Linear block index (n) <-> (x,y,z)
+	int n;
+	n = x + matrix->mx * ( y + matrix->my * z );
+
+	char *blockData;
+	blockData = matrix->blockData[n];
+
+	// Uniform block is a single node
+	if( blockData == NULL )
+	{
+		return;
+	}
+
+	// Block extent inside the matrix
+	int ex, ey, ez;
+	ex = matrix->nx - x * bs;
+	ey = matrix->ny - y * bs;
+	ez = matrix->nz - z * bs;
+	if( ex > bs ) ex = bs;
+	if( ey > bs ) ey = bs;
+	if( ez > bs ) ez = bs;
+
+	// Connect each non-default element with its lower neighbours
+	char def;
+	def = matrix->def;
+
+	int i, j, k, e;
+	for( k = 0 ; k < ez ; k++ )
+	{
+		for( j = 0 ; j < ey ; j++ )
+		{
+			for( i = 0 ; i < ex ; i++ )
+			{
+				e = i + bs * ( j + bs * k );
+				if( sparCharEqual( blockData[e], def ) )
+				{
+					continue;
+				}
+				if( i > 0 && sparCharEqual( blockData[ e - 1 ], def ) == 0 )
+				{
+					sparCharLabelUnion( parent, offset[n] + e, offset[n] + e - 1 );
+				}
+				if( j > 0 && sparCharEqual( blockData[ e - bs ], def ) == 0 )
+				{
+					sparCharLabelUnion( parent, offset[n] + e, offset[n] + e - bs );
+				}
+				if( k > 0 && sparCharEqual( blockData[ e - bs * bs ], def ) == 0 )
+				{
+					sparCharLabelUnion( parent, offset[n] + e, offset[n] + e - bs * bs );
+				}
+			}
+		}
+	}
+}
+
+// Label 6-connected regions of non-default elements into labels (0 elsewhere), return number of regions
+int sparCharLabel( sparChar *matrix, sparInt *labels )
+{
+	// Check matrices
+	if( labels->nx != matrix->nx || labels->ny != matrix->ny || labels->nz != matrix->nz ||
+		labels->bs != matrix->bs )
+	{
+		fprintf(stderr, "sparCharLabel error: Matrix and block sizes must agree\n");
+		exit(1);
+	}
+
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Number of blocks
+	int blocks;
+	blocks = mx * my * mz;
+
+	// First node of each block: one for non-default uniform blocks, one per element for heterogeneous blocks
+	int *offset;
+	offset = (int*) malloc( blocks * sizeof(int) );
+
+	if( offset == NULL )
+	{
+	   fprintf(stderr, "sparCharLabel error: Out of memory\n");
+	   exit(1);
+	}
+
+	double nodes;
+	nodes = 0.0;
+
+	int n;
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		if( matrix->blockData[n] != NULL )
+		{
+			offset[n] = (int)( nodes );
+			nodes += bs3;
+		}
+		else if( sparCharEqual( matrix->blockValue[n], matrix->def ) == 0 )
+		{
+			offset[n] = (int)( nodes );
+			nodes += 1;
+		}
+		else
+		{
+			offset[n] = -1;
+		}
+	}
+
+	if( nodes > INT_MAX )
+	{
+		fprintf(stderr, "sparCharLabel error: Too many heterogeneous blocks\n");
+		exit(1);
+	}
+
+	// Union-find forest, -1 for unused nodes of default elements
+	int *parent;
+	parent = (int*) malloc( ( (int)( nodes ) + 1 ) * sizeof(int) );
+
+	if( parent == NULL )
+	{
+	   fprintf(stderr, "sparCharLabel error: Out of memory\n");
+	   exit(1);
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		if( offset[n] < 0 )
+		{
+			continue;
+		}
+
+		char *blockData;
+		blockData = matrix->blockData[n];
+
+		if( blockData == NULL )
+		{
+			parent[ offset[n] ] = offset[n];
+			continue;
+		}
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - ( n % mx ) * bs;
+		ey = matrix->ny - ( ( n / mx ) % my ) * bs;
+		ez = matrix->nz - ( n / ( mx * my ) ) * bs;
+
+		int i, j, k, e;
+		for( k = 0 ; k < bs ; k++ )
+		{
+			for( j = 0 ; j < bs ; j++ )
+			{
+				for( i = 0 ; i < bs ; i++ )
+				{
+					e = i + bs * ( j + bs * k );
+					if( i < ex && j < ey && k < ez && sparCharEqual( blockData[e], matrix->def ) == 0 )
+					{
+						parent[ offset[n] + e ] = offset[n] + e;
+					}
+					else
+					{
+						parent[ offset[n] + e ] = -1;
+					}
+				}
+			}
+		}
+	}
+
+	// Connect blocks within slabs of block layers in parallel, slabs hold disjoint node ranges
+	int slab, slabs;
+	slab = 8;
+	slabs = ( mz + slab - 1 ) / slab;
+
+	int s;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(dynamic)
+	#endif
+	for( s = 0 ; s < slabs ; s++ )
+	{
+		int i1, j1, k1;
+		for( k1 = s * slab ; k1 < ( s + 1 ) * slab && k1 < mz ; k1++ )
+		{
+			for( j1 = 0 ; j1 < my ; j1++ )
+			{
+				for( i1 = 0 ; i1 < mx ; i1++ )
+				{
+					sparCharLabelBlock( matrix, offset, parent, i1, j1, k1 );
+					if( i1 > 0 )
+					{
+						sparCharLabelFace( matrix, offset, parent, i1, j1, k1, 0 );
+					}
+					if( j1 > 0 )
+					{
+						sparCharLabelFace( matrix, offset, parent, i1, j1, k1, 1 );
+					}
+					if( k1 > s * slab )
+					{
+						sparCharLabelFace( matrix, offset, parent, i1, j1, k1, 2 );
+					}
+				}
+			}
+		}
+	}
+
+	// Merge slabs across their boundary layers
+	int i1, j1;
+	for( s = 1 ; s < slabs ; s++ )
+	{
+		for( j1 = 0 ; j1 < my ; j1++ )
+		{
+			for( i1 = 0 ; i1 < mx ; i1++ )
+			{
+				sparCharLabelFace( matrix, offset, parent, i1, j1, s * slab, 2 );
+			}
+		}
+	}
+
+	// Consecutive labels from 1, roots are the smallest node of each set and parents precede children
+	int count;
+	count = 0;
+
+	int i;
+	for( i = 0 ; i < (int)( nodes ) ; i++ )
+	{
+		if( parent[i] == i )
+		{
+			parent[i] = ++count;
+		}
+		else if( parent[i] >= 0 )
+		{
+			parent[i] = parent[ parent[i] ];
+		}
+	}
+
+	// Write labels
+	labels->def = 0;
+
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		// Free previous labels
+		if( labels->blockData[n] != NULL )
+		{
+			free(labels->blockData[n]);
+			labels->blockData[n] = NULL;
+		}
+
+		// Default uniform block
+		if( offset[n] < 0 )
+		{
+			labels->blockValue[n] = 0;
+		}
+		// Non-default uniform block
+		else if( matrix->blockData[n] == NULL )
+		{
+			labels->blockValue[n] = parent[ offset[n] ];
+		}
+		// Heterogeneous block
+		else
+		{
+			int *blockData;
+			blockData = (int*) calloc( bs3, sizeof(int) );
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparCharLabel error: Out of memory\n");
+			   exit(1);
+			}
+
+			int e;
+			for( e = 0 ; e < bs3 ; e++ )
+			{
+				blockData[e] = parent[ offset[n] + e ] < 0 ? 0 : parent[ offset[n] + e ];
+			}
+
+			labels->blockData[n] = blockData;
+			sparIntReduceBlock( labels, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
+	}
+
+	free(offset);
+	free(parent);
+
+	return count;
+}
+
+// Squared distance transform of sampled function f into d (Felzenszwalb), v and z hold n and n+1 elements
+void sparCharDistanceLine( double *f, double *d, int n, int *v, double *z )
+{
+	int q, k;
+	double s;
+
+	// Lower envelope of parabolas rooted at (q,f[q])
+	k = 0;
+	v[0] = 0;
+	z[0] = -HUGE_VAL;
+	z[1] = HUGE_VAL;
+	for( q = 1 ; q < n ; q++ )
+	{
+		s = ( ( f[q] + (double)q * q ) - ( f[ v[k] ] + (double)v[k] * v[k] ) ) / ( 2.0 * ( q - v[k] ) );
+		while( s <= z[k] )
+		{
+			k--;
+			s = ( ( f[q] + (double)q * q ) - ( f[ v[k] ] + (double)v[k] * v[k] ) ) / ( 2.0 * ( q - v[k] ) );
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[ k + 1 ] = HUGE_VAL;
+	}
+
+	// Sample the envelope
+	k = 0;
+	for( q = 0 ; q < n ; q++ )
+	{
+		while( z[ k + 1 ] < q )
+		{
+			k++;
+		}
+		d[q] = (double)( q - v[k] ) * ( q - v[k] ) + f[ v[k] ];
+	}
+}
+
+// Squared distance pass along axis (0 x, 1 y, 2 z) in place, or from features of matrix if not NULL (default elements if inside)
+void sparCharDistanceAxis( sparChar *matrix, sparFloat *distance, int axis, float big, int inside )
+{
+	// Distance block size
+	int bs;
+	bs = distance->bs;
+
+	// Line length and number of block rows along the other two axes
+	int nl, ma, mb;
+	nl = axis == 0 ? distance->nx : ( axis == 1 ? distance->ny : distance->nz );
+	ma = axis == 0 ? distance->my : distance->mx;
+	mb = axis == 2 ? distance->my : distance->mz;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Row of blocks and one line
+		float *box;
+		char *source;
+		double *f, *d, *z;
+		int *v;
+		box = (float*) malloc( nl * bs * bs * sizeof(float) );
+		source = (char*) malloc( nl * bs * bs * sizeof(char) );
+		f = (double*) malloc( nl * sizeof(double) );
+		d = (double*) malloc( nl * sizeof(double) );
+		z = (double*) malloc( ( nl + 1 ) * sizeof(double) );
+		v = (int*) malloc( nl * sizeof(int) );
+
+		if( box == NULL || source == NULL || f == NULL || d == NULL || z == NULL || v == NULL )
+		{
+		   fprintf(stderr, "sparCharDistanceAxis error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each row of blocks along the axis, lines are independent
+		int g;
+		#ifdef _OPENMP
+		#pragma omp for schedule(dynamic)
+		#endif
+		for( g = 0 ; g < ma * mb ; g++ )
+		{
+			// Box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) inside the matrix
+			int x, y, zz, sx, sy, sz;
+			x = axis == 0 ? 0 : ( g % ma ) * bs;
+			y = axis == 1 ? 0 : ( axis == 0 ? ( g % ma ) * bs : ( g / ma ) * bs );
+			zz = axis == 2 ? 0 : ( g / ma ) * bs;
+			sx = axis == 0 ? distance->nx : ( distance->nx - x < bs ? distance->nx - x : bs );
+			sy = axis == 1 ? distance->ny : ( distance->ny - y < bs ? distance->ny - y : bs );
+			sz = axis == 2 ? distance->nz : ( distance->nz - zz < bs ? distance->nz - zz : bs );
+
+			int i;
+
+			// First pass, features of matrix
+			if( matrix != NULL )
+			{
+				char value;
+				if( sparCharUniformBox( matrix, x, y, zz, sx, sy, sz, &value ) )
+				{
+					sparFloatFillBox( distance, x, y, zz, sx, sy, sz,
+									  ( ( sparCharEqual( value, matrix->def ) == 0 ) != inside ) ? 0.0f : big );
+					continue;
+				}
+				sparCharGetBox( matrix, x, y, zz, sx, sy, sz, source );
+				for( i = 0 ; i < sx * sy * sz ; i++ )
+				{
+					box[i] = ( ( sparCharEqual( source[i], matrix->def ) == 0 ) != inside ) ? 0.0f : big;
+				}
+			}
+			// Next passes, constant lines are left unchanged
+			else
+			{
+				float value;
+				if( sparFloatUniformBox( distance, x, y, zz, sx, sy, sz, &value ) )
+				{
+					continue;
+				}
+				sparFloatGetBox( distance, x, y, zz, sx, sy, sz, box );
+			}
+
+			// Line stride and number of lines
+			int stride, lines;
+			stride = axis == 0 ? 1 : ( axis == 1 ? sx : sx * sy );
+			lines = sx * sy * sz / nl;
+
+			// For each line
+			int l;
+			for( l = 0 ; l < lines ; l++ )
+			{
+				// First line element
+				float *line;
+				if( axis == 0 )
+				{
+					line = box + nl * l;
+				}
+				else if( axis == 1 )
+				{
+					line = box + ( l % sx ) + sx * sy * ( l / sx );
+				}
+				else
+				{
+					line = box + l;
+				}
+
+				for( i = 0 ; i < nl ; i++ )
+				{
+					f[i] = line[ i * stride ];
+				}
+
+				sparCharDistanceLine( f, d, nl, v, z );
+
+				// Clamp at big
+				for( i = 0 ; i < nl ; i++ )
+				{
+					line[ i * stride ] = d[i] < big ? (float)( d[i] ) : big;
+				}
+			}
+
+			sparFloatSetBox( distance, x, y, zz, sx, sy, sz, box );
+		}
+
+		free(box);
+		free(source);
+		free(f);
+		free(d);
+		free(z);
+		free(v);
+	}
+}
+
+// Euclidean distance from each element to the nearest non-default element clamped at maxDistance, negative inside if sign
+void sparCharDistance( sparChar *matrix, sparFloat *distance, float maxDistance, int sign )
+{
+	// Check matrices
+	if( distance->nx != matrix->nx || distance->ny != matrix->ny || distance->nz != matrix->nz )
+	{
+		fprintf(stderr, "sparCharDistance error: Matrix sizes must agree\n");
+		exit(1);
+	}
+
+	if( !( maxDistance > 0.0f ) )
+	{
+		fprintf(stderr, "sparCharDistance error: Maximum distance must be positive\n");
+		exit(1);
+	}
+
+	// Squared distances are clamped, far regions become uniform
+	float big;
+	big = maxDistance * maxDistance;
+
+	// Squared distance to non-default elements
+	sparCharDistanceAxis( matrix, distance, 0, big, 0 );
+	sparCharDistanceAxis( NULL, distance, 1, big, 0 );
+	sparCharDistanceAxis( NULL, distance, 2, big, 0 );
+
+	// Squared distance to default elements
+	sparFloat *inner;
+	inner = NULL;
+	if( sign )
+	{
+		inner = sparFloatInit( distance->nx, distance->ny, distance->nz, distance->bs, big );
+		sparCharDistanceAxis( matrix, inner, 0, big, 1 );
+		sparCharDistanceAxis( NULL, inner, 1, big, 1 );
+		sparCharDistanceAxis( NULL, inner, 2, big, 1 );
+	}
+
+	// Distance, outer minus inner if signed
+	int mx, my, mz;
+	mx = distance->mx;
+	my = distance->my;
+	mz = distance->mz;
+
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		float *blockData, *innerData, innerValue;
+		blockData = distance->blockData[n];
+		innerData = inner == NULL ? NULL : inner->blockData[n];
+		innerValue = inner == NULL ? 0.0f : inner->blockValue[n];
+
+		// Uniform blocks
+		if( blockData == NULL && innerData == NULL )
+		{
+			distance->blockValue[n] = sqrtf( distance->blockValue[n] ) - sqrtf( innerValue );
+			continue;
+		}
+
+		// Heterogeneous blocks
+		sparFloatExpandBlock( distance, i1, j1, k1 );
+		blockData = distance->blockData[n];
+
+		int i;
+		for( i = 0 ; i < distance->bs3 ; i++ )
+		{
+			blockData[i] = sqrtf( blockData[i] ) - sqrtf( innerData == NULL ? innerValue : innerData[i] );
+		}
+
+		sparFloatReduceBlock( distance, i1, j1, k1 );
+	}
+
+	distance->def = maxDistance;
+
+	if( inner != NULL )
+	{
+		sparFloatFree( inner );
+	}
+}
+
+// Cast ray o+t*d (element (x,y,z) spans [x,x+1)) for 0 <= t <= tmax, return 1 with first non-default element hit[3] at t
+int sparCharRay( sparChar *matrix, double *o, double *d, double tmax, int *hit, double *t )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Matrix size
+	int size[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+
+	// Clip ray to the matrix bounds
+	double t0, t1;
+	t0 = 0.0;
+	t1 = tmax;
+
+	int a;
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		if( d[a] == 0.0 )
+		{
+			if( o[a] < 0.0 || o[a] >= size[a] )
+			{
+				return 0;
+			}
+		}
+		else
+		{
+			double ta, tb;
+			ta = ( 0.0 - o[a] ) / d[a];
+			tb = ( size[a] - o[a] ) / d[a];
+			if( ta > tb )
+			{
+				double tc;
+				tc = ta;
+				ta = tb;
+				tb = tc;
+			}
+			t0 = ta > t0 ? ta : t0;
+			t1 = tb < t1 ? tb : t1;
+		}
+	}
+
+	if( t0 > t1 )
+	{
+		return 0;
+	}
+
+	// Entry element, step direction, next element boundary and boundary spacing per axis
+	int v[3], step[3];
+	double tnext[3], tdelta[3];
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		v[a] = (int)( floor( o[a] + t0 * d[a] ) );
+		v[a] = v[a] < 0 ? 0 : ( v[a] >= size[a] ? size[a] - 1 : v[a] );
+		step[a] = d[a] > 0.0 ? 1 : -1;
+		tdelta[a] = d[a] == 0.0 ? HUGE_VAL : fabs( 1.0 / d[a] );
+		tnext[a] = d[a] == 0.0 ? HUGE_VAL : ( v[a] + ( step[a] > 0 ) - o[a] ) / d[a];
+	}
+
+	double tc;
+	tc = t0;
+
+	while( tc <= t1 )
+	{
+		// Linear block index (n) of element v
+		int b[3], n;
+		b[0] = v[0] / bs;
+		b[1] = v[1] / bs;
+		b[2] = v[2] / bs;
+		n = b[0] + matrix->mx * ( b[1] + matrix->my * b[2] );
+
+		// Uniform block
+		if( matrix->blockData[n] == NULL )
+		{
+			// Hit on entry
+			if( sparCharEqual( matrix->blockValue[n], matrix->def ) == 0 )
+			{
+				break;
+			}
+
+			// Skip to the block exit
+			int amin;
+			double tb[3];
+			amin = 0;
+			for( a = 0 ; a < 3 ; a++ )
+			{
+				tb[a] = d[a] == 0.0 ? HUGE_VAL : ( ( b[a] + ( step[a] > 0 ) ) * bs - o[a] ) / d[a];
+				if( tb[a] < tb[amin] )
+				{
+					amin = a;
+				}
+			}
+			tc = tb[amin];
+
+			// Element of the next block, stay inside the current block on the other axes
+			for( a = 0 ; a < 3 ; a++ )
+			{
+				if( a == amin )
+				{
+					v[a] = step[a] > 0 ? ( b[a] + 1 ) * bs : b[a] * bs - 1;
+				}
+				else
+				{
+					v[a] = (int)( floor( o[a] + tc * d[a] ) );
+					v[a] = v[a] < b[a] * bs ? b[a] * bs : ( v[a] >= ( b[a] + 1 ) * bs ? ( b[a] + 1 ) * bs - 1 : v[a] );
+				}
+				tnext[a] = d[a] == 0.0 ? HUGE_VAL : ( v[a] + ( step[a] > 0 ) - o[a] ) / d[a];
+			}
+		}
+		// Heterogeneous block, element by element
+		else
+		{
+			// Hit
+			int i;
+			i = v[0] % bs + bs * ( v[1] % bs + bs * ( v[2] % bs ) );
+			if( sparCharEqual( matrix->blockData[n][i], matrix->def ) == 0 )
+			{
+				break;
+			}
+
+			// Step to the next element
+			int amin;
+			amin = 0;
+			for( a = 1 ; a < 3 ; a++ )
+			{
+				if( tnext[a] < tnext[amin] )
+				{
+					amin = a;
+				}
+			}
+			tc = tnext[amin];
+			v[amin] += step[amin];
+			tnext[amin] += tdelta[amin];
+		}
+
+		// Left the matrix
+		if( v[0] < 0 || v[1] < 0 || v[2] < 0 || v[0] >= size[0] || v[1] >= size[1] || v[2] >= size[2] )
+		{
+			return 0;
+		}
+	}
+
+	// Beyond tmax or matrix exit
+	if( tc > t1 )
+	{
+		return 0;
+	}
+
+	hit[0] = v[0];
+	hit[1] = v[1];
+	hit[2] = v[2];
+	*t = tc;
+
+	return 1;
+}
+
+// Cast n rays o[3*i]+t*d[3*i] in parallel, hits[3*i] and t[i] (-1 if missed), return number of hits
+int sparCharRays( sparChar *matrix, int n, double *o, double *d, double tmax, int *hits, double *t )
+{
+	int count;
+	count = 0;
+
+	int i;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:count) schedule(guided)
+	#endif
+	for( i = 0 ; i < n ; i++ )
+	{
+		if( sparCharRay( matrix, o + 3 * i, d + 3 * i, tmax, hits + 3 * i, t + i ) )
+		{
+			count++;
+		}
+		else
+		{
+			t[i] = -1.0;
+		}
+	}
+
+	return count;
+}
+
+// Copy plane at index along axis into buffer, YZ (axis 0) y+ny*z, XZ (axis 1) x+nx*z, XY (axis 2) x+nx*y
+void sparCharSlice( sparChar *matrix, int axis, int index, char *buffer )
+{
+	// Matrix size
+	int nx, ny, nz;
+	nx = matrix->nx;
+	ny = matrix->ny;
+	nz = matrix->nz;
+
+	// Check plane
+	if( axis < 0 || axis > 2 || index < 0 ||
+		index >= ( axis == 0 ? nx : ( axis == 1 ? ny : nz ) ) )
+	{
+		fprintf(stderr, "sparCharSlice error: Plane outside the matrix\n");
+		exit(1);
+	}
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Block layer and element layer in the block
+	int b1, b2;
+	b1 = index / bs;
+	b2 = index % bs;
+
+	// XY plane, contiguous block rows
+	if( axis == 2 )
+	{
+		int j1;
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(guided)
+		#endif
+		for( j1 = 0 ; j1 < my ; j1++ )
+		{
+			int i1, i, j, ex, ey, n;
+			ey = ny - j1 * bs < bs ? ny - j1 * bs : bs;
+			for( i1 = 0 ; i1 < mx ; i1++ )
+			{
+				ex = nx - i1 * bs < bs ? nx - i1 * bs : bs;
+				n = i1 + mx * ( j1 + my * b1 );
+				for( j = 0 ; j < ey ; j++ )
+				{
+					char *row;
+					row = buffer + i1 * bs + nx * ( j1 * bs + j );
+
+					// Uniform block
+					if( matrix->blockData[n] == NULL )
+					{
+						for( i = 0 ; i < ex ; i++ )
+						{
+							row[i] = matrix->blockValue[n];
+						}
+					}
+					// Heterogeneous block
+					else
+					{
+						memcpy( row, matrix->blockData[n] + bs * ( j + bs * b2 ), ex * sizeof(char) );
+					}
+				}
+			}
+		}
+	}
+	// XZ plane, contiguous block rows
+	else if( axis == 1 )
+	{
+		int k1;
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(guided)
+		#endif
+		for( k1 = 0 ; k1 < mz ; k1++ )
+		{
+			int i1, i, k, ex, ez, n;
+			ez = nz - k1 * bs < bs ? nz - k1 * bs : bs;
+			for( i1 = 0 ; i1 < mx ; i1++ )
+			{
+				ex = nx - i1 * bs < bs ? nx - i1 * bs : bs;
+				n = i1 + mx * ( b1 + my * k1 );
+				for( k = 0 ; k < ez ; k++ )
+				{
+					char *row;
+					row = buffer + i1 * bs + nx * ( k1 * bs + k );
+
+					// Uniform block
+					if( matrix->blockData[n] == NULL )
+					{
+						for( i = 0 ; i < ex ; i++ )
+						{
+							row[i] = matrix->blockValue[n];
+						}
+					}
+					// Heterogeneous block
+					else
+					{
+						memcpy( row, matrix->blockData[n] + bs * ( b2 + bs * k ), ex * sizeof(char) );
+					}
+				}
+			}
+		}
+	}
+	// YZ plane, block elements are strided by bs
+	else
+	{
+		int k1;
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(guided)
+		#endif
+		for( k1 = 0 ; k1 < mz ; k1++ )
+		{
+			int j1, j, k, ey, ez, n;
+			ez = nz - k1 * bs < bs ? nz - k1 * bs : bs;
+			for( j1 = 0 ; j1 < my ; j1++ )
+			{
+				ey = ny - j1 * bs < bs ? ny - j1 * bs : bs;
+				n = b1 + mx * ( j1 + my * k1 );
+				for( k = 0 ; k < ez ; k++ )
+				{
+					char *row;
+					row = buffer + j1 * bs + ny * ( k1 * bs + k );
+
+					// Uniform block
+					if( matrix->blockData[n] == NULL )
+					{
+						for( j = 0 ; j < ey ; j++ )
+						{
+							row[j] = matrix->blockValue[n];
+						}
+					}
+					// Heterogeneous block, gather column of the block
+					else
+					{
+						char *column;
+						column = matrix->blockData[n] + b2 + bs * bs * k;
+						for( j = 0 ; j < ey ; j++ )
+						{
+							row[j] = column[ bs * j ];
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// Accumulate value, repeated count times, into o[0..n-1] with op (projection kernel)
+void sparCharProjectValue( double *o, int n, char value, int count, int op, char def )
+{
+	int i;
+	switch( op )
+	{
+		case SPAR_ADD:
+			for( i = 0 ; i < n ; i++ )
+			{
+				o[i] += (double)( value ) * count;
+			}
+			break;
+		case SPAR_MIN:
+			for( i = 0 ; i < n ; i++ )
+			{
+				o[i] = value < o[i] ? value : o[i];
+			}
+			break;
+		case SPAR_MAX:
+			for( i = 0 ; i < n ; i++ )
+			{
+				o[i] = value > o[i] ? value : o[i];
+			}
+			break;
+		case SPAR_COUNT:
+			if( sparCharEqual( value, def ) == 0 )
+			{
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] += count;
+				}
+			}
+			break;
+	}
+}
+
+// Accumulate row[0..n-1] into o[0..n-1], or into o[0] if reduce, with op (projection kernel)
+void sparCharProjectRow( double *o, char *row, int n, int op, int reduce, char def )
+{
+	int i;
+
+	// Row along the projection axis
+	if( reduce )
+	{
+		double value;
+		value = o[0];
+		switch( op )
+		{
+			case SPAR_ADD:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value += row[i];
+				}
+				break;
+			case SPAR_MIN:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value = row[i] < value ? row[i] : value;
+				}
+				break;
+			case SPAR_MAX:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value = row[i] > value ? row[i] : value;
+				}
+				break;
+			case SPAR_COUNT:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value += ( sparCharEqual( row[i], def ) == 0 );
+				}
+				break;
+		}
+		o[0] = value;
+	}
+	// Row across the projection axis
+	else
+	{
+		switch( op )
+		{
+			case SPAR_ADD:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] += row[i];
+				}
+				break;
+			case SPAR_MIN:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] = row[i] < o[i] ? row[i] : o[i];
+				}
+				break;
+			case SPAR_MAX:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] = row[i] > o[i] ? row[i] : o[i];
+				}
+				break;
+			case SPAR_COUNT:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] += ( sparCharEqual( row[i], def ) == 0 );
+				}
+				break;
+		}
+	}
+}
+
+// Project along axis with op (SPAR_ADD, SPAR_MIN, SPAR_MAX, SPAR_COUNT) into dense plane, same layout as slices
+void sparCharProject( sparChar *matrix, int axis, int op, double *buffer )
+{
+	// Check axis and operation
+	if( axis < 0 || axis > 2 )
+	{
+		fprintf(stderr, "sparCharProject error: Invalid axis\n");
+		exit(1);
+	}
+
+	if( op != SPAR_ADD && op != SPAR_MIN && op != SPAR_MAX && op != SPAR_COUNT )
+	{
+		fprintf(stderr, "sparCharProject error: Unknown operation\n");
+		exit(1);
+	}
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Matrix size (nx,ny,nz)
+	int nx, ny, nz;
+	nx = matrix->nx;
+	ny = matrix->ny;
+	nz = matrix->nz;
+
+	// Plane size (pa,pb), plane and axis block sizes (ma,mb,mc)
+	int pa, pb, ma, mb, mc;
+	pa = axis == 0 ? ny : nx;
+	pb = axis == 2 ? ny : nz;
+	ma = axis == 0 ? matrix->my : matrix->mx;
+	mb = axis == 2 ? matrix->my : matrix->mz;
+	mc = axis == 0 ? matrix->mx : ( axis == 1 ? matrix->my : matrix->mz );
+
+	// Initial values
+	int i;
+	for( i = 0 ; i < pa * pb ; i++ )
+	{
+		buffer[i] = op == SPAR_MIN ? HUGE_VAL : ( op == SPAR_MAX ? -HUGE_VAL : 0.0 );
+	}
+
+	// For each output tile
+	int t;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( t = 0 ; t < ma * mb ; t++ )
+	{
+		int a1, b1, c1;
+		a1 = t % ma;
+		b1 = t / ma;
+
+		// Tile extent
+		int ea, eb;
+		ea = pa - a1 * bs < bs ? pa - a1 * bs : bs;
+		eb = pb - b1 * bs < bs ? pb - b1 * bs : bs;
+
+		// For each block along the axis
+		for( c1 = 0 ; c1 < mc ; c1++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = axis == 0 ? c1 : a1;
+			j1 = axis == 0 ? a1 : ( axis == 1 ? c1 : b1 );
+			k1 = axis == 2 ? c1 : b1;
+
+			// Linear block index (n) <-> (i1,j1,k1)
+			int n;
+			n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = nx - i1 * bs < bs ? nx - i1 * bs : bs;
+			ey = ny - j1 * bs < bs ? ny - j1 * bs : bs;
+			ez = nz - k1 * bs < bs ? nz - k1 * bs : bs;
+
+			int b, j, k;
+
+			// Uniform block, whole column of elements at once
+			if( matrix->blockData[n] == NULL )
+			{
+				for( b = 0 ; b < eb ; b++ )
+				{
+					sparCharProjectValue( buffer + a1 * bs + pa * ( b1 * bs + b ), ea, matrix->blockValue[n],
+									  axis == 0 ? ex : ( axis == 1 ? ey : ez ), op, matrix->def );
+				}
+			}
+			// Heterogeneous block, row by row
+			else
+			{
+				for( k = 0 ; k < ez ; k++ )
+				{
+					for( j = 0 ; j < ey ; j++ )
+					{
+						char *row;
+						row = matrix->blockData[n] + bs * ( j + bs * k );
+						if( axis == 0 )
+						{
+							sparCharProjectRow( buffer + ( j1 * bs + j ) + pa * ( k1 * bs + k ), row, ex, op, 1, matrix->def );
+						}
+						else if( axis == 1 )
+						{
+							sparCharProjectRow( buffer + i1 * bs + pa * ( k1 * bs + k ), row, ex, op, 0, matrix->def );
+						}
+						else
+						{
+							sparCharProjectRow( buffer + i1 * bs + pa * ( j1 * bs + j ), row, ex, op, 0, matrix->def );
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// Order of two elements for qsort, NaN last
+int sparCharCompare( const void *a, const void *b )
+{
+	char va, vb;
+	va = *(const char*) a;
+	vb = *(const char*) b;
+
+	// NaN after any number
+	if( isnan( (double) va ) || isnan( (double) vb ) )
+	{
+		return ( isnan( (double) va ) != 0 ) - ( isnan( (double) vb ) != 0 );
+	}
+
+	return ( va > vb ) - ( va < vb );
+}
+
+// Recompute blocks of dst overlapping box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) from factor^3 cells of src, op SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE
+void sparCharDownsampleBox( sparChar *dst, sparChar *src, int factor, int op, int x, int y, int z, int sx, int sy, int sz )
+{
+	// Check matrices
+	if( factor < 1 || dst->nx != ( src->nx + factor - 1 ) / factor ||
+		dst->ny != ( src->ny + factor - 1 ) / factor || dst->nz != ( src->nz + factor - 1 ) / factor )
+	{
+		fprintf(stderr, "sparCharDownsampleBox error: Matrix sizes do not match the factor\n");
+		exit(1);
+	}
+
+	if( op != SPAR_MEAN && op != SPAR_MIN && op != SPAR_MAX && op != SPAR_MODE )
+	{
+		fprintf(stderr, "sparCharDownsampleBox error: Unknown operation\n");
+		exit(1);
+	}
+
+	// Clip box to dst
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > dst->nx ? dst->nx : x + sx;
+	y1 = y + sy > dst->ny ? dst->ny : y + sy;
+	z1 = z + sz > dst->nz ? dst->nz : z + sz;
+
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	// Destination block size
+	int bs, bs3;
+	bs = dst->bs;
+	bs3 = dst->bs3;
+
+	// Source box size of one destination block
+	int cs;
+	cs = bs * factor;
+
+	// Range of destination blocks
+	int bx, by, bz, cx, cy, cz;
+	bx = x0 / bs;
+	by = y0 / bs;
+	bz = z0 / bs;
+	cx = ( x1 - 1 ) / bs - bx + 1;
+	cy = ( y1 - 1 ) / bs - by + 1;
+	cz = ( z1 - 1 ) / bs - bz + 1;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Source elements of one destination block and of one cell
+		char *buffer, *cell;
+		buffer = (char*) malloc( cs * cs * cs * sizeof(char) );
+		cell = (char*) malloc( factor * factor * factor * sizeof(char) );
+
+		if( buffer == NULL || cell == NULL )
+		{
+		   fprintf(stderr, "sparCharDownsampleBox error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each destination block
+		int t;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( t = 0 ; t < cx * cy * cz ; t++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = bx + t % cx;
+			j1 = by + ( t / cx ) % cy;
+			k1 = bz + t / ( cx * cy );
+
+			// Linear block index (n) <-> (i1,j1,k1)
+			int n;
+			n = i1 + dst->mx * ( j1 + dst->my * k1 );
+
+			// Free previous data
+			if( dst->blockData[n] != NULL )
+			{
+				free(dst->blockData[n]);
+				dst->blockData[n] = NULL;
+			}
+
+			// Uniform source region, uniform destination block
+			char value;
+			if( sparCharUniformBox( src, i1 * cs, j1 * cs, k1 * cs, cs, cs, cs, &value ) )
+			{
+				dst->blockValue[n] = value;
+				continue;
+			}
+
+			// Read source region
+			sparCharGetBox( src, i1 * cs, j1 * cs, k1 * cs, cs, cs, cs, buffer );
+
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = dst->nx - i1 * bs < bs ? dst->nx - i1 * bs : bs;
+			ey = dst->ny - j1 * bs < bs ? dst->ny - j1 * bs : bs;
+			ez = dst->nz - k1 * bs < bs ? dst->nz - k1 * bs : bs;
+
+			char *blockData;
+			blockData = (char*) calloc( bs3, sizeof(char) );
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparCharDownsampleBox error: Out of memory\n");
+			   exit(1);
+			}
+
+			// For each destination element
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					for( i = 0 ; i < ex ; i++ )
+					{
+						// Cell extent inside the source matrix
+						int fx, fy, fz;
+						fx = src->nx - ( i1 * bs + i ) * factor < factor ? src->nx - ( i1 * bs + i ) * factor : factor;
+						fy = src->ny - ( j1 * bs + j ) * factor < factor ? src->ny - ( j1 * bs + j ) * factor : factor;
+						fz = src->nz - ( k1 * bs + k ) * factor < factor ? src->nz - ( k1 * bs + k ) * factor : factor;
+
+						// Reduce cell, one tight loop per operation
+						int a, b, c, m;
+						int best, run;
+						double sum;
+						char *row, *r;
+						row = buffer + i * factor + cs * ( j * factor + cs * k * factor );
+						value = row[0];
+						switch( op )
+						{
+							case SPAR_MEAN:
+								sum = 0.0;
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											sum += r[a];
+										}
+									}
+								}
+								value = sparCharRound( sum / ( fx * fy * fz ) );
+								break;
+							case SPAR_MIN:
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											value = r[a] < value ? r[a] : value;
+										}
+									}
+								}
+								break;
+							case SPAR_MAX:
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											value = r[a] > value ? r[a] : value;
+										}
+									}
+								}
+								break;
+							case SPAR_MODE:
+								// Gather cell
+								m = 0;
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											cell[ m + a ] = r[a];
+										}
+										m += fx;
+									}
+								}
+
+								// Longest run of sorted values
+								qsort( cell, m, sizeof(char), sparCharCompare );
+								value = cell[0];
+								best = 0;
+								run = 0;
+								for( a = 0 ; a < m ; a++ )
+								{
+									run = ( a > 0 && sparCharEqual( cell[a], cell[ a - 1 ] ) ) ? run + 1 : 1;
+									if( run > best )
+									{
+										best = run;
+										value = cell[a];
+									}
+								}
+								break;
+						}
+
+						blockData[ i + bs * ( j + bs * k ) ] = value;
+					}
+				}
+			}
+
+			// Write block and reduce if possible
+			dst->blockData[n] = blockData;
+			sparCharReduceBlock( dst, i1, j1, k1 );
+		}
+
+		free(buffer);
+		free(cell);
+	}
+}
+
+// New matrix downsampled by factor with op (SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE)
+sparChar* sparCharDownsample( sparChar *matrix, int factor, int op )
+{
+	if( factor < 1 )
+	{
+		fprintf(stderr, "sparCharDownsample error: Factor must be positive\n");
+		exit(1);
+	}
+
+	// Declare matrix and init
+	sparChar *matrix2;
+	matrix2 = sparCharInit( ( matrix->nx + factor - 1 ) / factor, ( matrix->ny + factor - 1 ) / factor,
+						( matrix->nz + factor - 1 ) / factor, matrix->bs, matrix->def );
+
+	sparCharDownsampleBox( matrix2, matrix, factor, op, 0, 0, 0, matrix2->nx, matrix2->ny, matrix2->nz );
+
+	return matrix2;
+}
+
+// Pyramid of levels matrices downsampled by 2, 4, 8... with op (SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE)
+void sparCharPyramid( sparChar *matrix, int levels, int op, sparChar **pyramid )
+{
+	int l;
+	for( l = 0 ; l < levels ; l++ )
+	{
+		pyramid[l] = sparCharDownsample( l == 0 ? matrix : pyramid[ l - 1 ], 2, op );
+	}
+}
+
+// Update pyramid after changes of matrix in box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1)
+void sparCharPyramidUpdate( sparChar *matrix, int levels, int op, sparChar **pyramid, int x, int y, int z, int sx, int sy, int sz )
+{
+	int l;
+	for( l = 0 ; l < levels ; l++ )
+	{
+		// Affected box in the next level
+		int x1, y1, z1;
+		x1 = ( x + sx + 1 ) / 2;
+		y1 = ( y + sy + 1 ) / 2;
+		z1 = ( z + sz + 1 ) / 2;
+		x = x / 2;
+		y = y / 2;
+		z = z / 2;
+		sx = x1 - x;
+		sy = y1 - y;
+		sz = z1 - z;
+
+		sparCharDownsampleBox( pyramid[l], l == 0 ? matrix : pyramid[ l - 1 ], 2, op, x, y, z, sx, sy, sz );
+	}
+}
+
+// Trilinear interpolation at (x,y,z), element (i,j,k) at integer coordinates, clamped to the matrix bounds
+double sparCharSample( sparChar *matrix, double x, double y, double z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Matrix size
+	int size[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+
+	double p[3];
+	p[0] = x;
+	p[1] = y;
+	p[2] = z;
+
+	// Lower (v0) and upper (v1) corners and fractions per axis
+	int a, v0[3], v1[3];
+	double f[3];
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		double q;
+		q = p[a] < 0.0 ? 0.0 : ( p[a] > size[a] - 1 ? size[a] - 1 : p[a] );
+		v0[a] = (int)( floor( q ) );
+		v1[a] = v0[a] + 1 < size[a] ? v0[a] + 1 : v0[a];
+		f[a] = q - v0[a];
+	}
+
+	// Corner values
+	char c[8];
+
+	// All corners in one block
+	if( v0[0] / bs == v1[0] / bs && v0[1] / bs == v1[1] / bs && v0[2] / bs == v1[2] / bs )
+	{
+		// Linear block index (n)
+		int n;
+		n = v0[0] / bs + matrix->mx * ( v0[1] / bs + matrix->my * ( v0[2] / bs ) );
+
+		char *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block
+		if( blockData == NULL )
+		{
+			return (double) matrix->blockValue[n];
+		}
+
+		// Lower corner and steps in the block
+		int i, dx, dy, dz;
+		i = v0[0] % bs + bs * ( v0[1] % bs + bs * ( v0[2] % bs ) );
+		dx = v1[0] - v0[0];
+		dy = bs * ( v1[1] - v0[1] );
+		dz = bs * bs * ( v1[2] - v0[2] );
+
+		c[0] = blockData[i];
+		c[1] = blockData[ i + dx ];
+		c[2] = blockData[ i + dy ];
+		c[3] = blockData[ i + dx + dy ];
+		c[4] = blockData[ i + dz ];
+		c[5] = blockData[ i + dx + dz ];
+		c[6] = blockData[ i + dy + dz ];
+		c[7] = blockData[ i + dx + dy + dz ];
+	}
+	// Corners across blocks
+	else
+	{
+		c[0] = sparCharGet( matrix, v0[0], v0[1], v0[2] );
+		c[1] = sparCharGet( matrix, v1[0], v0[1], v0[2] );
+		c[2] = sparCharGet( matrix, v0[0], v1[1], v0[2] );
+		c[3] = sparCharGet( matrix, v1[0], v1[1], v0[2] );
+		c[4] = sparCharGet( matrix, v0[0], v0[1], v1[2] );
+		c[5] = sparCharGet( matrix, v1[0], v0[1], v1[2] );
+		c[6] = sparCharGet( matrix, v0[0], v1[1], v1[2] );
+		c[7] = sparCharGet( matrix, v1[0], v1[1], v1[2] );
+	}
+
+	// Interpolate along x, y and z
+	double c0, c1, c2, c3;
+	c0 = c[0] + f[0] * ( (double) c[1] - c[0] );
+	c1 = c[2] + f[0] * ( (double) c[3] - c[2] );
+	c2 = c[4] + f[0] * ( (double) c[5] - c[4] );
+	c3 = c[6] + f[0] * ( (double) c[7] - c[6] );
+	c0 = c0 + f[1] * ( c1 - c0 );
+	c2 = c2 + f[1] * ( c3 - c2 );
+
+	return c0 + f[2] * ( c2 - c0 );
+}
+
+// Trilinear interpolation at n points p[3*i] in parallel into values[i]
+void sparCharSamples( sparChar *matrix, int n, double *p, double *values )
+{
+	int i;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( i = 0 ; i < n ; i++ )
+	{
+		values[i] = sparCharSample( matrix, p[ 3 * i ], p[ 3 * i + 1 ], p[ 3 * i + 2 ] );
+	}
+}
+
+// Marching cubes triangle edges of cube case c (bit i set if corner i is above the iso value), return number of triangles
+int sparCharCubeTriangles( int c, int *edges )
+{
+	// Triangle edges per case, -1 terminated, counter-clockwise seen from below the iso value
+	static const signed char table[256][16] =
+	{
+		{ -1 },
+		{ 0, 3, 8, -1 },
+		{ 0, 9, 1, -1 },
+		{ 3, 8, 9, 1, 3, 9, -1 },
+		{ 1, 10, 2, -1 },
+		{ 0, 3, 8, 1, 10, 2, -1 },
+		{ 9, 10, 2, 0, 9, 2, -1 },
+		{ 8, 9, 10, 3, 8, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, -1 },
+		{ 2, 11, 8, 0, 2, 8, -1 },
+		{ 0, 9, 1, 2, 11, 3, -1 },
+		{ 11, 8, 9, 2, 11, 9, 1, 2, 9, -1 },
+		{ 10, 11, 3, 1, 10, 3, -1 },
+		{ 10, 11, 8, 1, 10, 8, 0, 1, 8, -1 },
+		{ 10, 11, 3, 9, 10, 3, 0, 9, 3, -1 },
+		{ 9, 10, 11, 8, 9, 11, -1 },
+		{ 4, 8, 7, -1 },
+		{ 3, 7, 4, 0, 3, 4, -1 },
+		{ 0, 9, 1, 4, 8, 7, -1 },
+		{ 7, 4, 9, 3, 7, 9, 1, 3, 9, -1 },
+		{ 1, 10, 2, 4, 8, 7, -1 },
+		{ 3, 7, 4, 0, 3, 4, 1, 10, 2, -1 },
+		{ 9, 10, 2, 0, 9, 2, 4, 8, 7, -1 },
+		{ 4, 9, 10, 7, 4, 10, 3, 7, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, 4, 8, 7, -1 },
+		{ 11, 7, 4, 2, 11, 4, 0, 2, 4, -1 },
+		{ 0, 9, 1, 2, 11, 3, 4, 8, 7, -1 },
+		{ 7, 4, 9, 11, 7, 9, 2, 11, 9, 1, 2, 9, -1 },
+		{ 10, 11, 3, 1, 10, 3, 4, 8, 7, -1 },
+		{ 11, 7, 4, 10, 11, 4, 1, 10, 4, 0, 1, 4, -1 },
+		{ 10, 11, 3, 9, 10, 3, 0, 9, 3, 4, 8, 7, -1 },
+		{ 10, 11, 7, 9, 10, 7, 4, 9, 7, -1 },
+		{ 4, 5, 9, -1 },
+		{ 0, 3, 8, 4, 5, 9, -1 },
+		{ 4, 5, 1, 0, 4, 1, -1 },
+		{ 8, 4, 5, 3, 8, 5, 1, 3, 5, -1 },
+		{ 1, 10, 2, 4, 5, 9, -1 },
+		{ 0, 3, 8, 1, 10, 2, 4, 5, 9, -1 },
+		{ 5, 10, 2, 4, 5, 2, 0, 4, 2, -1 },
+		{ 4, 5, 10, 8, 4, 10, 3, 8, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, 4, 5, 9, -1 },
+		{ 2, 11, 8, 0, 2, 8, 4, 5, 9, -1 },
+		{ 4, 5, 1, 0, 4, 1, 2, 11, 3, -1 },
+		{ 8, 4, 5, 11, 8, 5, 2, 11, 5, 1, 2, 5, -1 },
+		{ 10, 11, 3, 1, 10, 3, 4, 5, 9, -1 },
+		{ 10, 11, 8, 1, 10, 8, 0, 1, 8, 4, 5, 9, -1 },
+		{ 10, 11, 3, 5, 10, 3, 4, 5, 3, 0, 4, 3, -1 },
+		{ 10, 11, 8, 5, 10, 8, 4, 5, 8, -1 },
+		{ 9, 8, 7, 5, 9, 7, -1 },
+		{ 7, 5, 9, 3, 7, 9, 0, 3, 9, -1 },
+		{ 7, 5, 1, 8, 7, 1, 0, 8, 1, -1 },
+		{ 3, 7, 5, 1, 3, 5, -1 },
+		{ 1, 10, 2, 9, 8, 7, 5, 9, 7, -1 },
+		{ 7, 5, 9, 3, 7, 9, 0, 3, 9, 1, 10, 2, -1 },
+		{ 5, 10, 2, 7, 5, 2, 8, 7, 2, 0, 8, 2, -1 },
+		{ 7, 5, 10, 3, 7, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, 9, 8, 7, 5, 9, 7, -1 },
+		{ 7, 5, 9, 11, 7, 9, 2, 11, 9, 0, 2, 9, -1 },
+		{ 7, 5, 1, 8, 7, 1, 0, 8, 1, 2, 11, 3, -1 },
+		{ 11, 7, 5, 2, 11, 5, 1, 2, 5, -1 },
+		{ 10, 11, 3, 1, 10, 3, 9, 8, 7, 5, 9, 7, -1 },
+		{ 1, 10, 11, 0, 1, 11, 7, 5, 9, 11, 7, 9, 0, 11, 9, -1 },
+		{ 8, 7, 5, 0, 8, 5, 10, 11, 3, 5, 10, 3, 0, 5, 3, -1 },
+		{ 10, 11, 7, 5, 10, 7, -1 },
+		{ 5, 6, 10, -1 },
+		{ 0, 3, 8, 5, 6, 10, -1 },
+		{ 0, 9, 1, 5, 6, 10, -1 },
+		{ 3, 8, 9, 1, 3, 9, 5, 6, 10, -1 },
+		{ 5, 6, 2, 1, 5, 2, -1 },
+		{ 0, 3, 8, 5, 6, 2, 1, 5, 2, -1 },
+		{ 5, 6, 2, 9, 5, 2, 0, 9, 2, -1 },
+		{ 9, 5, 6, 8, 9, 6, 3, 8, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 5, 6, 10, -1 },
+		{ 2, 11, 8, 0, 2, 8, 5, 6, 10, -1 },
+		{ 0, 9, 1, 2, 11, 3, 5, 6, 10, -1 },
+		{ 11, 8, 9, 2, 11, 9, 1, 2, 9, 5, 6, 10, -1 },
+		{ 6, 11, 3, 5, 6, 3, 1, 5, 3, -1 },
+		{ 6, 11, 8, 5, 6, 8, 1, 5, 8, 0, 1, 8, -1 },
+		{ 6, 11, 3, 5, 6, 3, 9, 5, 3, 0, 9, 3, -1 },
+		{ 11, 8, 9, 6, 11, 9, 5, 6, 9, -1 },
+		{ 4, 8, 7, 5, 6, 10, -1 },
+		{ 3, 7, 4, 0, 3, 4, 5, 6, 10, -1 },
+		{ 0, 9, 1, 4, 8, 7, 5, 6, 10, -1 },
+		{ 7, 4, 9, 3, 7, 9, 1, 3, 9, 5, 6, 10, -1 },
+		{ 5, 6, 2, 1, 5, 2, 4, 8, 7, -1 },
+		{ 3, 7, 4, 0, 3, 4, 5, 6, 2, 1, 5, 2, -1 },
+		{ 5, 6, 2, 9, 5, 2, 0, 9, 2, 4, 8, 7, -1 },
+		{ 7, 4, 9, 3, 7, 9, 9, 5, 6, 3, 9, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 4, 8, 7, 5, 6, 10, -1 },
+		{ 11, 7, 4, 2, 11, 4, 0, 2, 4, 5, 6, 10, -1 },
+		{ 0, 9, 1, 2, 11, 3, 4, 8, 7, 5, 6, 10, -1 },
+		{ 7, 4, 9, 11, 7, 9, 2, 11, 9, 1, 2, 9, 5, 6, 10, -1 },
+		{ 6, 11, 3, 5, 6, 3, 1, 5, 3, 4, 8, 7, -1 },
+		{ 5, 6, 11, 1, 5, 11, 11, 7, 4, 1, 11, 4, 0, 1, 4, -1 },
+		{ 6, 11, 3, 5, 6, 3, 9, 5, 3, 0, 9, 3, 4, 8, 7, -1 },
+		{ 5, 6, 11, 9, 5, 11, 9, 11, 7, 4, 9, 7, -1 },
+		{ 6, 10, 9, 4, 6, 9, -1 },
+		{ 0, 3, 8, 6, 10, 9, 4, 6, 9, -1 },
+		{ 6, 10, 1, 4, 6, 1, 0, 4, 1, -1 },
+		{ 4, 6, 10, 8, 4, 10, 3, 8, 10, 1, 3, 10, -1 },
+		{ 4, 6, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 0, 3, 8, 4, 6, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 4, 6, 2, 0, 4, 2, -1 },
+		{ 8, 4, 6, 3, 8, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 6, 10, 9, 4, 6, 9, -1 },
+		{ 2, 11, 8, 0, 2, 8, 6, 10, 9, 4, 6, 9, -1 },
+		{ 6, 10, 1, 4, 6, 1, 0, 4, 1, 2, 11, 3, -1 },
+		{ 2, 11, 8, 1, 2, 8, 4, 6, 10, 8, 4, 10, 1, 8, 10, -1 },
+		{ 6, 11, 3, 4, 6, 3, 9, 4, 3, 1, 9, 3, -1 },
+		{ 9, 4, 6, 1, 9, 6, 6, 11, 8, 1, 6, 8, 0, 1, 8, -1 },
+		{ 6, 11, 3, 4, 6, 3, 0, 4, 3, -1 },
+		{ 6, 11, 8, 4, 6, 8, -1 },
+		{ 9, 8, 7, 10, 9, 7, 6, 10, 7, -1 },
+		{ 6, 10, 9, 7, 6, 9, 3, 7, 9, 0, 3, 9, -1 },
+		{ 6, 10, 1, 7, 6, 1, 8, 7, 1, 0, 8, 1, -1 },
+		{ 7, 6, 10, 3, 7, 10, 1, 3, 10, -1 },
+		{ 7, 6, 2, 8, 7, 2, 9, 8, 2, 1, 9, 2, -1 },
+		{ 2, 1, 9, 6, 2, 9, 7, 6, 9, 3, 7, 9, 0, 3, 9, -1 },
+		{ 7, 6, 2, 8, 7, 2, 0, 8, 2, -1 },
+		{ 3, 7, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 9, 8, 7, 10, 9, 7, 6, 10, 7, -1 },
+		{ 6, 10, 9, 7, 6, 9, 11, 7, 9, 2, 11, 9, 0, 2, 9, -1 },
+		{ 6, 10, 1, 7, 6, 1, 8, 7, 1, 0, 8, 1, 2, 11, 3, -1 },
+		{ 2, 11, 7, 1, 2, 7, 7, 6, 10, 1, 7, 10, -1 },
+		{ 8, 7, 6, 9, 8, 6, 6, 11, 3, 9, 6, 3, 1, 9, 3, -1 },
+		{ 0, 1, 9, 6, 11, 7, -1 },
+		{ 8, 7, 6, 0, 8, 6, 6, 11, 3, 0, 6, 3, -1 },
+		{ 6, 11, 7, -1 },
+		{ 6, 7, 11, -1 },
+		{ 0, 3, 8, 6, 7, 11, -1 },
+		{ 0, 9, 1, 6, 7, 11, -1 },
+		{ 3, 8, 9, 1, 3, 9, 6, 7, 11, -1 },
+		{ 1, 10, 2, 6, 7, 11, -1 },
+		{ 0, 3, 8, 1, 10, 2, 6, 7, 11, -1 },
+		{ 9, 10, 2, 0, 9, 2, 6, 7, 11, -1 },
+		{ 8, 9, 10, 3, 8, 10, 2, 3, 10, 6, 7, 11, -1 },
+		{ 6, 7, 3, 2, 6, 3, -1 },
+		{ 6, 7, 8, 2, 6, 8, 0, 2, 8, -1 },
+		{ 0, 9, 1, 6, 7, 3, 2, 6, 3, -1 },
+		{ 7, 8, 9, 6, 7, 9, 2, 6, 9, 1, 2, 9, -1 },
+		{ 6, 7, 3, 10, 6, 3, 1, 10, 3, -1 },
+		{ 6, 7, 8, 10, 6, 8, 1, 10, 8, 0, 1, 8, -1 },
+		{ 6, 7, 3, 10, 6, 3, 9, 10, 3, 0, 9, 3, -1 },
+		{ 8, 9, 10, 7, 8, 10, 6, 7, 10, -1 },
+		{ 8, 11, 6, 4, 8, 6, -1 },
+		{ 11, 6, 4, 3, 11, 4, 0, 3, 4, -1 },
+		{ 0, 9, 1, 8, 11, 6, 4, 8, 6, -1 },
+		{ 6, 4, 9, 11, 6, 9, 3, 11, 9, 1, 3, 9, -1 },
+		{ 1, 10, 2, 8, 11, 6, 4, 8, 6, -1 },
+		{ 11, 6, 4, 3, 11, 4, 0, 3, 4, 1, 10, 2, -1 },
+		{ 9, 10, 2, 0, 9, 2, 8, 11, 6, 4, 8, 6, -1 },
+		{ 11, 6, 4, 3, 11, 4, 4, 9, 10, 3, 4, 10, 2, 3, 10, -1 },
+		{ 4, 8, 3, 6, 4, 3, 2, 6, 3, -1 },
+		{ 2, 6, 4, 0, 2, 4, -1 },
+		{ 0, 9, 1, 4, 8, 3, 6, 4, 3, 2, 6, 3, -1 },
+		{ 6, 4, 9, 2, 6, 9, 1, 2, 9, -1 },
+		{ 4, 8, 3, 6, 4, 3, 10, 6, 3, 1, 10, 3, -1 },
+		{ 10, 6, 4, 1, 10, 4, 0, 1, 4, -1 },
+		{ 4, 8, 3, 6, 4, 3, 10, 6, 3, 9, 10, 3, 0, 9, 3, -1 },
+		{ 9, 10, 6, 4, 9, 6, -1 },
+		{ 4, 5, 9, 6, 7, 11, -1 },
+		{ 0, 3, 8, 4, 5, 9, 6, 7, 11, -1 },
+		{ 4, 5, 1, 0, 4, 1, 6, 7, 11, -1 },
+		{ 8, 4, 5, 3, 8, 5, 1, 3, 5, 6, 7, 11, -1 },
+		{ 1, 10, 2, 4, 5, 9, 6, 7, 11, -1 },
+		{ 0, 3, 8, 1, 10, 2, 4, 5, 9, 6, 7, 11, -1 },
+		{ 5, 10, 2, 4, 5, 2, 0, 4, 2, 6, 7, 11, -1 },
+		{ 4, 5, 10, 8, 4, 10, 3, 8, 10, 2, 3, 10, 6, 7, 11, -1 },
+		{ 6, 7, 3, 2, 6, 3, 4, 5, 9, -1 },
+		{ 6, 7, 8, 2, 6, 8, 0, 2, 8, 4, 5, 9, -1 },
+		{ 4, 5, 1, 0, 4, 1, 6, 7, 3, 2, 6, 3, -1 },
+		{ 6, 7, 8, 2, 6, 8, 8, 4, 5, 2, 8, 5, 1, 2, 5, -1 },
+		{ 6, 7, 3, 10, 6, 3, 1, 10, 3, 4, 5, 9, -1 },
+		{ 6, 7, 8, 10, 6, 8, 1, 10, 8, 0, 1, 8, 4, 5, 9, -1 },
+		{ 6, 7, 3, 10, 6, 3, 5, 10, 3, 4, 5, 3, 0, 4, 3, -1 },
+		{ 6, 7, 8, 10, 6, 8, 5, 10, 8, 4, 5, 8, -1 },
+		{ 8, 11, 6, 9, 8, 6, 5, 9, 6, -1 },
+		{ 6, 5, 9, 11, 6, 9, 3, 11, 9, 0, 3, 9, -1 },
+		{ 6, 5, 1, 11, 6, 1, 8, 11, 1, 0, 8, 1, -1 },
+		{ 11, 6, 5, 3, 11, 5, 1, 3, 5, -1 },
+		{ 1, 10, 2, 8, 11, 6, 9, 8, 6, 5, 9, 6, -1 },
+		{ 6, 5, 9, 11, 6, 9, 3, 11, 9, 0, 3, 9, 1, 10, 2, -1 },
+		{ 11, 6, 5, 8, 11, 5, 5, 10, 2, 8, 5, 2, 0, 8, 2, -1 },
+		{ 11, 6, 5, 3, 11, 5, 3, 5, 10, 2, 3, 10, -1 },
+		{ 9, 8, 3, 5, 9, 3, 6, 5, 3, 2, 6, 3, -1 },
+		{ 6, 5, 9, 2, 6, 9, 0, 2, 9, -1 },
+		{ 3, 2, 6, 8, 3, 6, 6, 5, 1, 8, 6, 1, 0, 8, 1, -1 },
+		{ 2, 6, 5, 1, 2, 5, -1 },
+		{ 9, 8, 3, 5, 9, 3, 6, 5, 3, 10, 6, 3, 1, 10, 3, -1 },
+		{ 1, 10, 6, 0, 1, 6, 6, 5, 9, 0, 6, 9, -1 },
+		{ 0, 8, 3, 5, 10, 6, -1 },
+		{ 5, 10, 6, -1 },
+		{ 7, 11, 10, 5, 7, 10, -1 },
+		{ 0, 3, 8, 7, 11, 10, 5, 7, 10, -1 },
+		{ 0, 9, 1, 7, 11, 10, 5, 7, 10, -1 },
+		{ 3, 8, 9, 1, 3, 9, 7, 11, 10, 5, 7, 10, -1 },
+		{ 7, 11, 2, 5, 7, 2, 1, 5, 2, -1 },
+		{ 0, 3, 8, 7, 11, 2, 5, 7, 2, 1, 5, 2, -1 },
+		{ 7, 11, 2, 5, 7, 2, 9, 5, 2, 0, 9, 2, -1 },
+		{ 3, 8, 9, 2, 3, 9, 5, 7, 11, 9, 5, 11, 2, 9, 11, -1 },
+		{ 5, 7, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 5, 7, 8, 10, 5, 8, 2, 10, 8, 0, 2, 8, -1 },
+		{ 0, 9, 1, 5, 7, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 10, 5, 7, 2, 10, 7, 7, 8, 9, 2, 7, 9, 1, 2, 9, -1 },
+		{ 5, 7, 3, 1, 5, 3, -1 },
+		{ 5, 7, 8, 1, 5, 8, 0, 1, 8, -1 },
+		{ 5, 7, 3, 9, 5, 3, 0, 9, 3, -1 },
+		{ 7, 8, 9, 5, 7, 9, -1 },
+		{ 11, 10, 5, 8, 11, 5, 4, 8, 5, -1 },
+		{ 10, 5, 4, 11, 10, 4, 3, 11, 4, 0, 3, 4, -1 },
+		{ 0, 9, 1, 11, 10, 5, 8, 11, 5, 4, 8, 5, -1 },
+		{ 10, 5, 4, 11, 10, 4, 11, 4, 9, 3, 11, 9, 1, 3, 9, -1 },
+		{ 8, 11, 2, 4, 8, 2, 5, 4, 2, 1, 5, 2, -1 },
+		{ 1, 5, 4, 2, 1, 4, 11, 2, 4, 3, 11, 4, 0, 3, 4, -1 },
+		{ 8, 11, 2, 4, 8, 2, 5, 4, 2, 9, 5, 2, 0, 9, 2, -1 },
+		{ 2, 3, 11, 4, 9, 5, -1 },
+		{ 4, 8, 3, 5, 4, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 10, 5, 4, 2, 10, 4, 0, 2, 4, -1 },
+		{ 0, 9, 1, 4, 8, 3, 5, 4, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 10, 5, 4, 2, 10, 4, 2, 4, 9, 1, 2, 9, -1 },
+		{ 4, 8, 3, 5, 4, 3, 1, 5, 3, -1 },
+		{ 1, 5, 4, 0, 1, 4, -1 },
+		{ 4, 8, 3, 5, 4, 3, 9, 5, 3, 0, 9, 3, -1 },
+		{ 4, 9, 5, -1 },
+		{ 11, 10, 9, 7, 11, 9, 4, 7, 9, -1 },
+		{ 0, 3, 8, 11, 10, 9, 7, 11, 9, 4, 7, 9, -1 },
+		{ 11, 10, 1, 7, 11, 1, 4, 7, 1, 0, 4, 1, -1 },
+		{ 7, 11, 10, 4, 7, 10, 8, 4, 10, 3, 8, 10, 1, 3, 10, -1 },
+		{ 7, 11, 2, 4, 7, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 0, 3, 8, 7, 11, 2, 4, 7, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 7, 11, 2, 4, 7, 2, 0, 4, 2, -1 },
+		{ 3, 8, 4, 2, 3, 4, 4, 7, 11, 2, 4, 11, -1 },
+		{ 4, 7, 3, 9, 4, 3, 10, 9, 3, 2, 10, 3, -1 },
+		{ 9, 4, 7, 10, 9, 7, 10, 7, 8, 2, 10, 8, 0, 2, 8, -1 },
+		{ 3, 2, 10, 7, 3, 10, 7, 10, 1, 4, 7, 1, 0, 4, 1, -1 },
+		{ 1, 2, 10, 4, 7, 8, -1 },
+		{ 4, 7, 3, 9, 4, 3, 1, 9, 3, -1 },
+		{ 9, 4, 7, 1, 9, 7, 1, 7, 8, 0, 1, 8, -1 },
+		{ 4, 7, 3, 0, 4, 3, -1 },
+		{ 4, 7, 8, -1 },
+		{ 11, 10, 9, 8, 11, 9, -1 },
+		{ 11, 10, 9, 3, 11, 9, 0, 3, 9, -1 },
+		{ 11, 10, 1, 8, 11, 1, 0, 8, 1, -1 },
+		{ 3, 11, 10, 1, 3, 10, -1 },
+		{ 8, 11, 2, 9, 8, 2, 1, 9, 2, -1 },
+		{ 2, 1, 9, 11, 2, 9, 3, 11, 9, 0, 3, 9, -1 },
+		{ 8, 11, 2, 0, 8, 2, -1 },
+		{ 2, 3, 11, -1 },
+		{ 9, 8, 3, 10, 9, 3, 2, 10, 3, -1 },
+		{ 2, 10, 9, 0, 2, 9, -1 },
+		{ 3, 2, 10, 8, 3, 10, 8, 10, 1, 0, 8, 1, -1 },
+		{ 1, 2, 10, -1 },
+		{ 9, 8, 3, 1, 9, 3, -1 },
+		{ 0, 1, 9, -1 },
+		{ 0, 8, 3, -1 },
+		{ -1 }
+	};
+
+	int i;
+	for( i = 0 ; table[c][i] >= 0 ; i++ )
+	{
+		edges[i] = table[c][i];
+	}
+
+	return i / 3;
+}
+
+// Order of two edge keys for qsort
+int sparCharCompareKey( const void *a, const void *b )
+{
+	long long ka, kb;
+	ka = *(const long long*) a;
+	kb = *(const long long*) b;
+	return ( ka > kb ) - ( ka < kb );
+}
+
+// Marching cubes isosurface at iso into vertices[3*i] and triangles[3*j] (malloc, free after use), nt triangles, return number of vertices
+int sparCharIsosurface( sparChar *matrix, double iso, double **vertices, int **triangles, int *nt )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Matrix size
+	int nx, ny, nz;
+	nx = matrix->nx;
+	ny = matrix->ny;
+	nz = matrix->nz;
+
+	// Cube corner offsets, and edge lower corner offset and axis
+	static const int corner[8][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 },
+									  { 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 } };
+	static const int edge[12][4] = { { 0, 0, 0, 0 }, { 1, 0, 0, 1 }, { 0, 1, 0, 0 }, { 0, 0, 0, 1 },
+									 { 0, 0, 1, 0 }, { 1, 0, 1, 1 }, { 0, 1, 1, 0 }, { 0, 0, 1, 1 },
+									 { 0, 0, 0, 2 }, { 1, 0, 0, 2 }, { 1, 1, 0, 2 }, { 0, 1, 0, 2 } };
+
+	// Triangle edge keys and triangle count per block
+	int nb;
+	nb = matrix->mx * matrix->my * matrix->mz;
+
+	long long **keys;
+	int *count;
+	keys = (long long**) calloc( nb, sizeof(long long*) );
+	count = (int*) calloc( nb, sizeof(int) );
+
+	if( keys == NULL || count == NULL )
+	{
+	   fprintf(stderr, "sparCharIsosurface error: Out of memory\n");
+	   exit(1);
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block corners, including the next block first plane on each axis
+		int s;
+		char *buffer;
+		s = bs + 1;
+		buffer = (char*) malloc( s * s * s * sizeof(char) );
+
+		if( buffer == NULL )
+		{
+		   fprintf(stderr, "sparCharIsosurface error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < nb ; n++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = n % matrix->mx;
+			j1 = ( n / matrix->mx ) % matrix->my;
+			k1 = n / ( matrix->mx * matrix->my );
+
+			// Cells with lower corner in the block
+			int ex, ey, ez;
+			ex = nx - 1 - i1 * bs < bs ? nx - 1 - i1 * bs : bs;
+			ey = ny - 1 - j1 * bs < bs ? ny - 1 - j1 * bs : bs;
+			ez = nz - 1 - k1 * bs < bs ? nz - 1 - k1 * bs : bs;
+
+			if( ex <= 0 || ey <= 0 || ez <= 0 )
+			{
+				continue;
+			}
+
+			// Uniform corners, no crossing
+			char value;
+			if( sparCharUniformBox( matrix, i1 * bs, j1 * bs, k1 * bs, s, s, s, &value ) )
+			{
+				continue;
+			}
+
+			sparCharGetBox( matrix, i1 * bs, j1 * bs, k1 * bs, s, s, s, buffer );
+
+			// Corner offsets in the buffer
+			int offset[8], c;
+			for( c = 0 ; c < 8 ; c++ )
+			{
+				offset[c] = corner[c][0] + s * ( corner[c][1] + s * corner[c][2] );
+			}
+
+			int size;
+			size = 0;
+
+			// For each cell
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					for( i = 0 ; i < ex ; i++ )
+					{
+						// Cube case
+						char *cell;
+						int cube;
+						cell = buffer + i + s * ( j + s * k );
+						cube = 0;
+						for( c = 0 ; c < 8 ; c++ )
+						{
+							cube |= ( cell[ offset[c] ] > iso ) << c;
+						}
+
+						if( cube == 0 || cube == 255 )
+						{
+							continue;
+						}
+
+						int edges[15], t;
+						t = sparCharCubeTriangles( cube, edges );
+
+						// Grow keys
+						if( ( count[n] + t ) * 3 > size )
+						{
+							size = size == 0 ? 48 : 2 * size;
+							keys[n] = (long long*) realloc( keys[n], size * sizeof(long long) );
+
+							if( keys[n] == NULL )
+							{
+							   fprintf(stderr, "sparCharIsosurface error: Out of memory\n");
+							   exit(1);
+							}
+						}
+
+						// Edge key of lower element (x,y,z) and axis a, 3*(x+nx*(y+ny*z))+a
+						for( c = 0 ; c < 3 * t ; c++ )
+						{
+							const int *e;
+							e = edge[ edges[c] ];
+							keys[n][ 3 * count[n] + c ] = 3 * ( i1 * bs + i + e[0] + nx *
+								( j1 * bs + j + e[1] + (long long) ny * ( k1 * bs + k + e[2] ) ) ) + e[3];
+						}
+						count[n] += t;
+					}
+				}
+			}
+		}
+
+		free(buffer);
+	}
+
+	// Triangle offset per block
+	int m, total;
+	total = 0;
+	for( m = 0 ; m < nb ; m++ )
+	{
+		int c;
+		c = count[m];
+		count[m] = total;
+		total += c;
+	}
+	*nt = total;
+
+	if( total == 0 )
+	{
+		free(keys);
+		free(count);
+		*vertices = NULL;
+		*triangles = NULL;
+		return 0;
+	}
+
+	// All edge keys, then sorted unique keys as vertices
+	long long *all, *unique;
+	all = (long long*) malloc( 3 * total * sizeof(long long) );
+	unique = (long long*) malloc( 3 * total * sizeof(long long) );
+
+	if( all == NULL || unique == NULL )
+	{
+	   fprintf(stderr, "sparCharIsosurface error: Out of memory\n");
+	   exit(1);
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( m = 0 ; m < nb ; m++ )
+	{
+		if( keys[m] != NULL )
+		{
+			int c;
+			c = ( m + 1 < nb ? count[ m + 1 ] : total ) - count[m];
+			memcpy( all + 3 * count[m], keys[m], 3 * c * sizeof(long long) );
+			free(keys[m]);
+		}
+	}
+	free(keys);
+	free(count);
+
+	memcpy( unique, all, 3 * total * sizeof(long long) );
+	qsort( unique, 3 * total, sizeof(long long), sparCharCompareKey );
+
+	int nv;
+	nv = 1;
+	for( m = 1 ; m < 3 * total ; m++ )
+	{
+		if( unique[m] != unique[ nv - 1 ] )
+		{
+			unique[ nv++ ] = unique[m];
+		}
+	}
+
+	*vertices = (double*) malloc( 3 * nv * sizeof(double) );
+	*triangles = (int*) malloc( 3 * total * sizeof(int) );
+
+	if( *vertices == NULL || *triangles == NULL )
+	{
+	   fprintf(stderr, "sparCharIsosurface error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Vertex on edge by linear interpolation
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( m = 0 ; m < nv ; m++ )
+	{
+		// Lower element (x,y,z) and axis a
+		int a, p[3];
+		long long key;
+		key = unique[m] / 3;
+		a = (int)( unique[m] % 3 );
+		p[0] = (int)( key % nx );
+		p[1] = (int)( ( key / nx ) % ny );
+		p[2] = (int)( key / ( (long long) nx * ny ) );
+
+		double v0, v1, t;
+		v0 = sparCharGet( matrix, p[0], p[1], p[2] );
+		v1 = sparCharGet( matrix, p[0] + ( a == 0 ), p[1] + ( a == 1 ), p[2] + ( a == 2 ) );
+		t = ( iso - v0 ) / ( v1 - v0 );
+
+		(*vertices)[ 3 * m ] = p[0] + ( a == 0 ) * t;
+		(*vertices)[ 3 * m + 1 ] = p[1] + ( a == 1 ) * t;
+		(*vertices)[ 3 * m + 2 ] = p[2] + ( a == 2 ) * t;
+	}
+
+	// Triangle vertex indices
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( m = 0 ; m < 3 * total ; m++ )
+	{
+		long long *v;
+		v = (long long*) bsearch( all + m, unique, nv, sizeof(long long), sparCharCompareKey );
+		(*triangles)[m] = (int)( v - unique );
+	}
+
+	free(all);
+	free(unique);
+
+	return nv;
+}
+
+// Copy block (i,j,k) of src into block (x,y,z) of dst, same block size
+void sparCharCopyBlock( sparChar *dst, int x, int y, int z, sparChar *src, int i, int j, int k )
+{
+	// Linear block indices
+	int n, m;
+	n = x + dst->mx * ( y + dst->my * z );
+	m = i + src->mx * ( j + src->my * k );
+
+	// Uniform block
+	if( src->blockData[m] == NULL )
+	{
+		if( dst->blockData[n] != NULL )
+		{
+			free(dst->blockData[n]);
+			dst->blockData[n] = NULL;
+		}
+		dst->blockValue[n] = src->blockValue[m];
+		return;
+	}
+
+	// Heterogeneous block, reuse destination data if any
+	if( dst->blockData[n] == NULL )
+	{
+		dst->blockData[n] = (char*) malloc( dst->bs3 * sizeof(char) );
+
+		if( dst->blockData[n] == NULL )
+		{
+		   fprintf(stderr, "sparCharCopyBlock error: Out of memory\n");
+		   exit(1);
+		}
+	}
+
+	memcpy( dst->blockData[n], src->blockData[m], dst->bs3 * sizeof(char) );
+
+	// Boundary block may become uniform inside the matrix
+	if( x == dst->mx - 1 || y == dst->my - 1 || z == dst->mz - 1 )
+	{
+		sparCharReduceBlock( dst, x, y, z );
+	}
+}
+
+// New matrix with box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1), elements outside the matrix set to default, ring buffer origin reset
+sparChar* sparCharCrop( sparChar *matrix, int x, int y, int z, int sx, int sy, int sz )
+{
+	// Declare matrix and init
+	sparChar *matrix2;
+	matrix2 = sparCharInit( sx, sy, sz, matrix->bs, matrix->def );
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Box aligned with source blocks
+	int aligned;
+	aligned = x >= 0 && y >= 0 && z >= 0 && x % bs == 0 && y % bs == 0 && z % bs == 0;
+
+	// Number of blocks
+	int blocks;
+	blocks = matrix2->mx * matrix2->my * matrix2->mz;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		// Block (i1,j1,k1) and source box origin
+		int i1, j1, k1, x0, y0, z0;
+		i1 = n % matrix2->mx;
+		j1 = ( n / matrix2->mx ) % matrix2->my;
+		k1 = n / ( matrix2->mx * matrix2->my );
+		x0 = x + i1 * bs;
+		y0 = y + j1 * bs;
+		z0 = z + k1 * bs;
+
+		// Aligned source block covering the block elements inside the matrix, copy block
+		if( aligned && x0 < matrix->nx && y0 < matrix->ny && z0 < matrix->nz &&
+			matrix->nx - x0 >= ( sx - i1 * bs < bs ? sx - i1 * bs : bs ) &&
+			matrix->ny - y0 >= ( sy - j1 * bs < bs ? sy - j1 * bs : bs ) &&
+			matrix->nz - z0 >= ( sz - k1 * bs < bs ? sz - k1 * bs : bs ) )
+		{
+			sparCharCopyBlock( matrix2, i1, j1, k1, matrix, x0 / bs, y0 / bs, z0 / bs );
+			continue;
+		}
+
+		// Uniform source box
+		char value;
+		if( sparCharUniformBox( matrix, x0, y0, z0, bs, bs, bs, &value ) &&
+			x0 >= 0 && y0 >= 0 && z0 >= 0 && x0 + bs <= matrix->nx && y0 + bs <= matrix->ny && z0 + bs <= matrix->nz )
+		{
+			matrix2->blockValue[n] = value;
+			continue;
+		}
+
+		// Read source box rows into the block, reduce if possible
+		matrix2->blockData[n] = (char*) malloc( matrix2->bs3 * sizeof(char) );
+
+		if( matrix2->blockData[n] == NULL )
+		{
+		   fprintf(stderr, "sparCharCrop error: Out of memory\n");
+		   exit(1);
+		}
+
+		sparCharGetBox( matrix, x0, y0, z0, bs, bs, bs, matrix2->blockData[n] );
+		sparCharReduceBlock( matrix2, i1, j1, k1 );
+	}
+
+	return matrix2;
+}
+
+// Write src into matrix at (x,y,z), clipped to the matrix
+void sparCharPaste( sparChar *matrix, sparChar *src, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + src->nx > matrix->nx ? matrix->nx : x + src->nx;
+	y1 = y + src->ny > matrix->ny ? matrix->ny : y + src->ny;
+	z1 = z + src->nz > matrix->nz ? matrix->nz : z + src->nz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	// Box aligned with blocks of the same size
+	int aligned;
+	aligned = src->bs == bs && x >= 0 && y >= 0 && z >= 0 && x % bs == 0 && y % bs == 0 && z % bs == 0;
+
+	// Range of blocks
+	int bx, by, bz, cx, cy, cz;
+	bx = x0 / bs;
+	by = y0 / bs;
+	bz = z0 / bs;
+	cx = ( x1 - 1 ) / bs - bx + 1;
+	cy = ( y1 - 1 ) / bs - by + 1;
+	cz = ( z1 - 1 ) / bs - bz + 1;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		char *buffer;
+		buffer = (char*) malloc( bs * bs * bs * sizeof(char) );
+
+		if( buffer == NULL )
+		{
+		   fprintf(stderr, "sparCharPaste error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each block overlapping the box
+		int t;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( t = 0 ; t < cx * cy * cz ; t++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = bx + t % cx;
+			j1 = by + ( t / cx ) % cy;
+			k1 = bz + t / ( cx * cy );
+
+			// Block and box intersection
+			int bx0, by0, bz0, bx1, by1, bz1;
+			bx0 = i1 * bs > x0 ? i1 * bs : x0;
+			by0 = j1 * bs > y0 ? j1 * bs : y0;
+			bz0 = k1 * bs > z0 ? k1 * bs : z0;
+			bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+			by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+			bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+			// Aligned block with elements inside the matrix fully covered, copy block
+			if( aligned && bx0 == i1 * bs && by0 == j1 * bs && bz0 == k1 * bs &&
+				( bx1 == ( i1 + 1 ) * bs || bx1 == matrix->nx ) &&
+				( by1 == ( j1 + 1 ) * bs || by1 == matrix->ny ) &&
+				( bz1 == ( k1 + 1 ) * bs || bz1 == matrix->nz ) )
+			{
+				sparCharCopyBlock( matrix, i1, j1, k1, src, i1 - x / bs, j1 - y / bs, k1 - z / bs );
+				continue;
+			}
+
+			// Copy intersection rows
+			sparCharGetBox( src, bx0 - x, by0 - y, bz0 - z, bx1 - bx0, by1 - by0, bz1 - bz0, buffer );
+			sparCharSetBox( matrix, bx0, by0, bz0, bx1 - bx0, by1 - by0, bz1 - bz0, buffer );
+		}
+
+		free(buffer);
+	}
+}
+
+// Shift contents by (dx,dy,dz), element (x,y,z) moves to (x+dx,y+dy,z+dz), vacated elements set to default
+void sparCharShift( sparChar *matrix, int dx, int dy, int dz )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Shift in blocks (qx,qy,qz) and remainder (rx,ry,rz), same sign so no data is dropped early
+	int qx, qy, qz, rx, ry, rz;
+	qx = dx / bs;
+	qy = dy / bs;
+	qz = dz / bs;
+	rx = dx % bs;
+	ry = dy % bs;
+	rz = dz % bs;
+
+	// Move blocks
+	if( qx != 0 || qy != 0 || qz != 0 )
+	{
+		// New block data
+		char *blockValue;
+		char **blockData;
+
+		int blocks;
+		blocks = mx * my * mz;
+		blockValue = (char*) calloc( blocks, sizeof(char) ); // Sets to 0s
+		blockData = (char**) calloc( blocks, sizeof(char*) ); // Sets to NULLs
+
+		if( blockValue == NULL || blockData == NULL )
+		{
+		   fprintf(stderr, "sparCharShift error: Out of memory\n");
+		   exit(1);
+		}
+
+		int i, j, k;
+		for( k = 0 ; k < mz ; k++ )
+		{
+			for( j = 0 ; j < my ; j++ )
+			{
+				for( i = 0 ; i < mx ; i++ )
+				{
+					// Source block
+					int i2, j2, k2, n;
+					i2 = i - qx;
+					j2 = j - qy;
+					k2 = k - qz;
+					n = i + mx * ( j + my * k );
+
+					if( i2 >= 0 && j2 >= 0 && k2 >= 0 && i2 < mx && j2 < my && k2 < mz )
+					{
+						int m;
+						m = i2 + mx * ( j2 + my * k2 );
+						blockValue[n] = matrix->blockValue[m];
+						blockData[n] = matrix->blockData[m];
+						matrix->blockData[m] = NULL;
+					}
+					else
+					{
+						blockValue[n] = matrix->def;
+					}
+				}
+			}
+		}
+
+		// Free blocks moved outside
+		for( i = 0 ; i < blocks ; i++ )
+		{
+			if( matrix->blockData[i] != NULL )
+			{
+				free(matrix->blockData[i]);
+			}
+		}
+
+		free(matrix->blockData);
+		free(matrix->blockValue);
+
+		matrix->blockData = blockData;
+		matrix->blockValue = blockValue;
+
+		// Previous boundary blocks moved inside, set outside elements to default
+		int ex, ey, ez;
+		ex = matrix->nx - ( mx - 1 ) * bs;
+		ey = matrix->ny - ( my - 1 ) * bs;
+		ez = matrix->nz - ( mz - 1 ) * bs;
+
+		if( ex < bs && qx < 0 && mx - 1 + qx >= 0 )
+		{
+			sparCharFillBox( matrix, ( mx - 1 + qx ) * bs + ex, 0, 0, bs - ex, matrix->ny, matrix->nz, matrix->def );
+		}
+		if( ey < bs && qy < 0 && my - 1 + qy >= 0 )
+		{
+			sparCharFillBox( matrix, 0, ( my - 1 + qy ) * bs + ey, 0, matrix->nx, bs - ey, matrix->nz, matrix->def );
+		}
+		if( ez < bs && qz < 0 && mz - 1 + qz >= 0 )
+		{
+			sparCharFillBox( matrix, 0, 0, ( mz - 1 + qz ) * bs + ez, matrix->nx, matrix->ny, bs - ez, matrix->def );
+		}
+
+		// Blocks moved to the boundary may be uniform inside the matrix
+		for( k = 0 ; k < mz ; k++ )
+		{
+			for( j = 0 ; j < my ; j++ )
+			{
+				for( i = 0 ; i < mx ; i++ )
+				{
+					if( ( i == mx - 1 && ex < bs && qx != 0 ) || ( j == my - 1 && ey < bs && qy != 0 ) ||
+						( k == mz - 1 && ez < bs && qz != 0 ) )
+					{
+						sparCharReduceBlock( matrix, i, j, k );
+					}
+				}
+			}
+		}
+	}
+
+	// Recombine blocks for the remainder
+	if( rx != 0 || ry != 0 || rz != 0 )
+	{
+		sparChar *shifted;
+		shifted = sparCharCrop( matrix, -rx, -ry, -rz, matrix->nx, matrix->ny, matrix->nz );
+
+		// Swap block data
+		char *blockValue;
+		char **blockData;
+		blockValue = matrix->blockValue;
+		blockData = matrix->blockData;
+		matrix->blockValue = shifted->blockValue;
+		matrix->blockData = shifted->blockData;
+		shifted->blockValue = blockValue;
+		shifted->blockData = blockData;
+
+		sparCharFree( shifted );
+	}
+}
+
+// Ring buffer index of world coordinate w in a ring of size n
+int sparCharRingIndex( int w, int n )
+{
+	return ( w % n + n ) % n;
+}
+
+// Set element at world coordinates (x,y,z) of the ring buffer window, ignored outside the window
+void sparCharRingSet( sparChar *matrix, int x, int y, int z, char value )
+{
+	if( x < matrix->ox || y < matrix->oy || z < matrix->oz ||
+		x >= matrix->ox + matrix->nx || y >= matrix->oy + matrix->ny || z >= matrix->oz + matrix->nz )
+	{
+		return;
+	}
+
+	sparCharSet( matrix, sparCharRingIndex( x, matrix->nx ), sparCharRingIndex( y, matrix->ny ), sparCharRingIndex( z, matrix->nz ), value );
+}
+
+// Get element at world coordinates (x,y,z) of the ring buffer window, default value outside the window
+char sparCharRingGet( sparChar *matrix, int x, int y, int z )
+{
+	if( x < matrix->ox || y < matrix->oy || z < matrix->oz ||
+		x >= matrix->ox + matrix->nx || y >= matrix->oy + matrix->ny || z >= matrix->oz + matrix->nz )
+	{
+		return matrix->def;
+	}
+
+	return sparCharGet( matrix, sparCharRingIndex( x, matrix->nx ), sparCharRingIndex( y, matrix->ny ), sparCharRingIndex( z, matrix->nz ) );
+}
+
+// Move the ring buffer window origin to world coordinates (x,y,z), elements entering the window set to default
+void sparCharRingMove( sparChar *matrix, int x, int y, int z )
+{
+	// Matrix size, previous and new origin
+	int size[3], o[3], p[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+	o[0] = matrix->ox;
+	o[1] = matrix->oy;
+	o[2] = matrix->oz;
+	p[0] = x;
+	p[1] = y;
+	p[2] = z;
+
+	// Window moved by at least its size on one axis, reset all
+	int a;
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		if( abs( p[a] - o[a] ) >= size[a] )
+		{
+			sparCharFillBox( matrix, 0, 0, 0, matrix->nx, matrix->ny, matrix->nz, matrix->def );
+			matrix->ox = x;
+			matrix->oy = y;
+			matrix->oz = z;
+			return;
+		}
+	}
+
+	// For each axis, reset the slab of elements entering the window, in up to two boxes of ring indices
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		if( p[a] == o[a] )
+		{
+			continue;
+		}
+
+		// First entering world coordinate and slab thickness
+		int w, t;
+		w = p[a] > o[a] ? o[a] + size[a] : p[a];
+		t = abs( p[a] - o[a] );
+
+		// Ring index ranges [s0,s0+t0) and [0,t-t0)
+		int s0, t0;
+		s0 = sparCharRingIndex( w, size[a] );
+		t0 = s0 + t > size[a] ? size[a] - s0 : t;
+
+		int b[3], c[3];
+		b[0] = 0;
+		b[1] = 0;
+		b[2] = 0;
+		c[0] = matrix->nx;
+		c[1] = matrix->ny;
+		c[2] = matrix->nz;
+
+		b[a] = s0;
+		c[a] = t0;
+		sparCharFillBox( matrix, b[0], b[1], b[2], c[0], c[1], c[2], matrix->def );
+
+		if( t0 < t )
+		{
+			b[a] = 0;
+			c[a] = t - t0;
+			sparCharFillBox( matrix, b[0], b[1], b[2], c[0], c[1], c[2], matrix->def );
+		}
+	}
+
+	matrix->ox = x;
+	matrix->oy = y;
+	matrix->oz = z;
+}
+
+// New matrix with permuted axes, new x, y and z axes are the axes ax, ay and az (0 x, 1 y, 2 z) of matrix
+sparChar* sparCharPermute( sparChar *matrix, int ax, int ay, int az )
+{
+	// Check permutation
+	if( ax < 0 || ay < 0 || az < 0 || ax > 2 || ay > 2 || az > 2 || ax == ay || ay == az || az == ax )
+	{
+		fprintf(stderr, "sparCharPermute error: Axes must be a permutation of 0, 1 and 2\n");
+		exit(1);
+	}
+
+	// Matrix and block matrix size
+	int size[3], blockSize[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+	blockSize[0] = matrix->mx;
+	blockSize[1] = matrix->my;
+	blockSize[2] = matrix->mz;
+
+	// Declare matrix and init
+	sparChar *matrix2;
+	matrix2 = sparCharInit( size[ax], size[ay], size[az], matrix->bs, matrix->def );
+
+	// Permute ring buffer origin
+	int origin[3];
+	origin[0] = matrix->ox;
+	origin[1] = matrix->oy;
+	origin[2] = matrix->oz;
+	matrix2->ox = origin[ax];
+	matrix2->oy = origin[ay];
+	matrix2->oz = origin[az];
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Source strides of the new axes, blocks and elements
+	int stride[3], blockStride[3];
+	stride[0] = 1;
+	stride[1] = bs;
+	stride[2] = bs * bs;
+	blockStride[0] = 1;
+	blockStride[1] = blockSize[0];
+	blockStride[2] = blockSize[0] * blockSize[1];
+
+	int sx, sy, sz, bx, by, bz;
+	sx = stride[ax];
+	sy = stride[ay];
+	sz = stride[az];
+	bx = blockStride[ax];
+	by = blockStride[ay];
+	bz = blockStride[az];
+
+	// Number of blocks
+	int blocks;
+	blocks = matrix2->mx * matrix2->my * matrix2->mz;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		// Block (i1,j1,k1) and source block
+		int i1, j1, k1, m;
+		i1 = n % matrix2->mx;
+		j1 = ( n / matrix2->mx ) % matrix2->my;
+		k1 = n / ( matrix2->mx * matrix2->my );
+		m = i1 * bx + j1 * by + k1 * bz;
+
+		// Uniform block
+		if( matrix->blockData[m] == NULL )
+		{
+			matrix2->blockValue[n] = matrix->blockValue[m];
+			continue;
+		}
+
+		// Heterogeneous block, transpose in cache
+		char *blockData, *source;
+		blockData = (char*) malloc( matrix2->bs3 * sizeof(char) );
+		source = matrix->blockData[m];
+
+		if( blockData == NULL )
+		{
+		   fprintf(stderr, "sparCharPermute error: Out of memory\n");
+		   exit(1);
+		}
+
+		int i, j, k;
+		for( k = 0 ; k < bs ; k++ )
+		{
+			for( j = 0 ; j < bs ; j++ )
+			{
+				char *row, *column;
+				row = blockData + bs * ( j + bs * k );
+				column = source + j * sy + k * sz;
+				for( i = 0 ; i < bs ; i++ )
+				{
+					row[i] = column[ i * sx ];
+				}
+			}
+		}
+
+		matrix2->blockData[n] = blockData;
+	}
+
+	return matrix2;
+}
+
+// Allocate n elements 64-byte aligned with plain malloc (no C11 aligned_alloc), release with the matching DenseFree
+char* sparCharDenseAlloc( long n )
+{
+	// Room for the alignment offset and the original pointer
+	char *base;
+	base = (char*) malloc( n * sizeof(char) + 64 + sizeof(void*) );
+
+	if( base == NULL )
+	{
+		return NULL;
+	}
+
+	// First 64-byte boundary after the stored original pointer
+	char *aligned;
+	aligned = base + sizeof(void*);
+	aligned = aligned + ( 64 - (uintptr_t)( aligned ) % 64 ) % 64;
+	((void**) aligned)[-1] = base;
+
+	return (char*) aligned;
+}
+
+// Free dense buffer returned by Densify or DenseAlloc
+void sparCharDenseFree( char *buffer )
+{
+	if( buffer != NULL )
+	{
+		free( ((void**) buffer)[-1] );
+	}
+}
+
+// Dense copy padded to (px,py,pz) with the default value, rows along axis contiguous and 64-byte aligned every pitch elements (free with sparCharDenseFree)
+char* sparCharDensify( sparChar *matrix, int axis, int px, int py, int pz, int *pitch )
+{
+	// Check padded size
+	if( px < matrix->nx || py < matrix->ny || pz < matrix->nz || axis < 0 || axis > 2 )
+	{
+		fprintf(stderr, "sparCharDensify error: Padded size must contain the matrix\n");
+		exit(1);
+	}
+
+	// Padded size and the other two axes (b,c)
+	int p[3], b, c;
+	p[0] = px;
+	p[1] = py;
+	p[2] = pz;
+	b = axis == 0 ? 1 : 0;
+	c = axis == 2 ? 1 : 2;
+
+	// Row pitch, multiple of 64 bytes
+	int align;
+	align = 64 % sizeof(char) == 0 ? 64 / sizeof(char) : 1;
+	*pitch = ( p[axis] + align - 1 ) / align * align;
+
+	// Element (x,y,z) at x*s[0]+y*s[1]+z*s[2]
+	long s[3];
+	s[axis] = 1;
+	s[b] = *pitch;
+	s[c] = (long) *pitch * p[b];
+
+	char *buffer;
+	buffer = sparCharDenseAlloc( s[c] * p[c] );
+
+	if( buffer == NULL )
+	{
+	   fprintf(stderr, "sparCharDensify error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Matrix size
+	int size[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+
+	// Padding, row by row
+	int r;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( r = 0 ; r < p[b] * p[c] ; r++ )
+	{
+		// Row (j,k) along axes (b,c)
+		int i, j, k;
+		j = r % p[b];
+		k = r / p[b];
+
+		char *row;
+		row = buffer + j * s[b] + k * s[c];
+		for( i = ( j < size[b] && k < size[c] ) ? size[axis] : 0 ; i < *pitch ; i++ )
+		{
+			row[i] = matrix->def;
+		}
+	}
+
+	sparCharGetDense( matrix, buffer, s[0], s[1], s[2] );
+
+	return buffer;
+}
+
+// Copy dense buffer with element (x,y,z) at x*sx+y*sy+z*sz into matrix, uniform blocks detected
+void sparCharSetDense( sparChar *matrix, char *buffer, long sx, long sy, long sz )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Element strides
+	long s[3];
+	s[0] = sx;
+	s[1] = sy;
+	s[2] = sz;
+
+	// Number of blocks
+	int blocks;
+	blocks = matrix->mx * matrix->my * matrix->mz;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block elements
+		char *temp;
+		temp = (char*) malloc( bs3 * sizeof(char) );
+
+		if( temp == NULL )
+		{
+		   fprintf(stderr, "sparCharSetDense error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < blocks ; n++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = n % matrix->mx;
+			j1 = ( n / matrix->mx ) % matrix->my;
+			k1 = n / ( matrix->mx * matrix->my );
+
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = matrix->nx - i1 * bs < bs ? matrix->nx - i1 * bs : bs;
+			ey = matrix->ny - j1 * bs < bs ? matrix->ny - j1 * bs : bs;
+			ez = matrix->nz - k1 * bs < bs ? matrix->nz - k1 * bs : bs;
+
+			// Gather block and check uniformity in a single scan
+			char value;
+			int isUniform;
+			value = buffer[ i1 * bs * s[0] + j1 * bs * s[1] + k1 * bs * s[2] ];
+			isUniform = 1;
+
+			int i, j, k;
+			for( k = 0 ; k < bs ; k++ )
+			{
+				for( j = 0 ; j < bs ; j++ )
+				{
+					char *row, *blockRow;
+					row = buffer + i1 * bs * s[0] + ( j1 * bs + j ) * s[1] + ( k1 * bs + k ) * s[2];
+					blockRow = temp + bs * ( j + bs * k );
+
+					// Outside elements set to default
+					if( j >= ey || k >= ez )
+					{
+						for( i = 0 ; i < bs ; i++ )
+						{
+							blockRow[i] = matrix->def;
+						}
+						continue;
+					}
+
+					for( i = 0 ; i < ex ; i++ )
+					{
+						blockRow[i] = row[ i * s[0] ];
+						isUniform &= sparCharEqual( blockRow[i], value );
+					}
+					for( i = ex ; i < bs ; i++ )
+					{
+						blockRow[i] = matrix->def;
+					}
+				}
+			}
+
+			// Uniform block
+			if( isUniform )
+			{
+				if( matrix->blockData[n] != NULL )
+				{
+					free(matrix->blockData[n]);
+					matrix->blockData[n] = NULL;
+				}
+				matrix->blockValue[n] = value;
+			}
+			// Heterogeneous block, reuse previous data if any
+			else if( matrix->blockData[n] != NULL )
+			{
+				memcpy( matrix->blockData[n], temp, bs3 * sizeof(char) );
+			}
+			// Heterogeneous block, keep gathered elements
+			else
+			{
+				matrix->blockData[n] = temp;
+				temp = (char*) malloc( bs3 * sizeof(char) );
+
+				if( temp == NULL )
+				{
+				   fprintf(stderr, "sparCharSetDense error: Out of memory\n");
+				   exit(1);
+				}
+			}
+		}
+
+		free(temp);
+	}
+}
+
+// Copy dense buffer with the densify layout (axis, pitch and padded size) into matrix, uniform blocks detected
+void sparCharSparsify( sparChar *matrix, char *buffer, int axis, int pitch, int px, int py, int pz )
+{
+	// Check padded size and pitch
+	if( px < matrix->nx || py < matrix->ny || pz < matrix->nz || axis < 0 || axis > 2 )
+	{
+		fprintf(stderr, "sparCharSparsify error: Padded size must contain the matrix\n");
+		exit(1);
+	}
+
+	if( pitch < ( axis == 0 ? px : ( axis == 1 ? py : pz ) ) )
+	{
+		fprintf(stderr, "sparCharSparsify error: Pitch must be at least the padded row length\n");
+		exit(1);
+	}
+
+	// Padded size and the other two axes (b,c)
+	int p[3], b, c;
+	p[0] = px;
+	p[1] = py;
+	p[2] = pz;
+	b = axis == 0 ? 1 : 0;
+	c = axis == 2 ? 1 : 2;
+
+	// Element (x,y,z) at x*s[0]+y*s[1]+z*s[2]
+	long s[3];
+	s[axis] = 1;
+	s[b] = pitch;
+	s[c] = (long) pitch * p[b];
+
+	sparCharSetDense( matrix, buffer, s[0], s[1], s[2] );
+}
+
+// New matrix from dense buffer with element (x,y,z) at x*sx+y*sy+z*sz, only heterogeneous blocks allocated
+sparChar* sparCharInitDense( char *buffer, int nx, int ny, int nz, long sx, long sy, long sz, int bs, char def )
+{
+	// Declare matrix and init
+	sparChar *matrix;
+	matrix = sparCharInit( nx, ny, nz, bs, def );
+
+	sparCharSetDense( matrix, buffer, sx, sy, sz );
+
+	return matrix;
+}
+
+// Copy matrix into dense buffer with element (x,y,z) at x*sx+y*sy+z*sz
+void sparCharGetDense( sparChar *matrix, char *buffer, long sx, long sy, long sz )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// For each row along x, in contiguous slabs per thread
+	int r;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( r = 0 ; r < matrix->ny * matrix->nz ; r++ )
+	{
+		// Row (y,z), its blocks and offset in the block
+		int y, z, j1, k1, offset;
+		y = r % matrix->ny;
+		z = r / matrix->ny;
+		j1 = y / bs;
+		k1 = z / bs;
+		offset = bs * ( y % bs + bs * ( z % bs ) );
+
+		char *row;
+		row = buffer + y * sy + z * sz;
+
+		// For each block along the row
+		int i1;
+		for( i1 = 0 ; i1 < matrix->mx ; i1++ )
+		{
+			// Linear block index (n) <-> (i1,j1,k1)
+			int n;
+			n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+			// Block extent inside the matrix
+			int ex;
+			ex = matrix->nx - i1 * bs < bs ? matrix->nx - i1 * bs : bs;
+
+			char *blockData, *out, value;
+			blockData = matrix->blockData[n];
+			value = matrix->blockValue[n];
+			out = row + i1 * bs * sx;
+
+			int i;
+
+			// Uniform block, contiguous row
+			if( blockData == NULL && sx == 1 )
+			{
+				for( i = 0 ; i < ex ; i++ )
+				{
+					out[i] = value;
+				}
+			}
+			// Uniform block, strided row
+			else if( blockData == NULL )
+			{
+				for( i = 0 ; i < ex ; i++ )
+				{
+					out[ i * sx ] = value;
+				}
+			}
+			// Heterogeneous block, contiguous row
+			else if( sx == 1 )
+			{
+				memcpy( out, blockData + offset, ex * sizeof(char) );
+			}
+			// Heterogeneous block, strided row
+			else
+			{
+				for( i = 0 ; i < ex ; i++ )
+				{
+					out[ i * sx ] = blockData[ offset + i ];
+				}
+			}
+		}
+	}
+}
+
+// Change the default value, uniform blocks with the previous default value set to the new one
+void sparCharSetDefault( sparChar *matrix, char def )
+{
+	// Number of blocks
+	int blocks;
+	blocks = matrix->mx * matrix->my * matrix->mz;
+
+	int i;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( i = 0 ; i < blocks ; i++ )
+	{
+		if( matrix->blockData[i] == NULL && sparCharEqual( matrix->blockValue[i], matrix->def ) )
+		{
+			matrix->blockValue[i] = def;
+		}
+	}
+
+	matrix->def = def;
+}
+
+// Most frequent value in box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) clipped to the matrix, smallest on ties, its count in count if not NULL
+char sparCharDominant( sparChar *matrix, int x, int y, int z, int sx, int sy, int sz, double *count )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		if( count != NULL )
+		{
+			*count = 0.0;
+		}
+		return matrix->def;
+	}
+
+	// Runs of equal values, one per uniform block and per distinct value of heterogeneous blocks
+	int runs, size;
+	char *runValue, *temp;
+	double *runCount;
+	runs = 0;
+	size = 64;
+	runValue = (char*) malloc( size * sizeof(char) );
+	runCount = (double*) malloc( size * sizeof(double) );
+	temp = (char*) malloc( matrix->bs3 * sizeof(char) );
+
+	if( runValue == NULL || runCount == NULL || temp == NULL )
+	{
+	   fprintf(stderr, "sparCharDominant error: Out of memory\n");
+	   exit(1);
+	}
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1, m;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+				m = ( bx1 - bx0 ) * ( by1 - by0 ) * ( bz1 - bz0 );
+
+				// Grow runs
+				if( runs + m > size )
+				{
+					size = 2 * ( runs + m );
+					runValue = (char*) realloc( runValue, size * sizeof(char) );
+					runCount = (double*) realloc( runCount, size * sizeof(double) );
+
+					if( runValue == NULL || runCount == NULL )
+					{
+					   fprintf(stderr, "sparCharDominant error: Out of memory\n");
+					   exit(1);
+					}
+				}
+
+				// Uniform block, one run
+				if( matrix->blockData[n] == NULL )
+				{
+					runValue[runs] = matrix->blockValue[n];
+					runCount[runs] = m;
+					runs++;
+					continue;
+				}
+
+				// Heterogeneous block, sorted intersection elements
+				sparCharGetBox( matrix, bx0, by0, bz0, bx1 - bx0, by1 - by0, bz1 - bz0, temp );
+				qsort( temp, m, sizeof(char), sparCharCompare );
+
+				int i;
+				for( i = 0 ; i < m ; i++ )
+				{
+					if( i > 0 && sparCharEqual( temp[i], temp[ i - 1 ] ) )
+					{
+						runCount[ runs - 1 ] += 1.0;
+					}
+					else
+					{
+						runValue[runs] = temp[i];
+						runCount[runs] = 1.0;
+						runs++;
+					}
+				}
+			}
+		}
+	}
+
+	// Distinct values, sorted
+	int distinct, i;
+	char *values;
+	double *counts;
+	values = (char*) malloc( runs * sizeof(char) );
+	counts = (double*) calloc( runs, sizeof(double) );
+
+	if( values == NULL || counts == NULL )
+	{
+	   fprintf(stderr, "sparCharDominant error: Out of memory\n");
+	   exit(1);
+	}
+
+	memcpy( values, runValue, runs * sizeof(char) );
+	qsort( values, runs, sizeof(char), sparCharCompare );
+	distinct = 1;
+	for( i = 1 ; i < runs ; i++ )
+	{
+		if( sparCharEqual( values[i], values[ distinct - 1 ] ) == 0 )
+		{
+			values[ distinct++ ] = values[i];
+		}
+	}
+
+	// Count per distinct value
+	for( i = 0 ; i < runs ; i++ )
+	{
+		char *v;
+		v = (char*) bsearch( runValue + i, values, distinct, sizeof(char), sparCharCompare );
+		counts[ v - values ] += runCount[i];
+	}
+
+	// Most frequent, first in sorted order on ties
+	int best;
+	best = 0;
+	for( i = 1 ; i < distinct ; i++ )
+	{
+		if( counts[i] > counts[best] )
+		{
+			best = i;
+		}
+	}
+
+	char value;
+	value = values[best];
+
+	if( count != NULL )
+	{
+		*count = counts[best];
+	}
+
+	free(runValue);
+	free(runCount);
+	free(temp);
+	free(values);
+	free(counts);
+
+	return value;
+}
+
+
+
+// Matrix constructor
+sparInt* sparIntInit( int nx, int ny, int nz, int bs, int def )
+{
+	// Check matrix size
+	if( !( nx > 0 && ny > 0 && nz > 0 ) )
+	{
+		fprintf(stderr, "sparIntInit error: Matrix size must be positive\n");
+		exit(1);
+	}
+
+	// Check block size
+	if( !( bs > 1 ) )
+	{
+		fprintf(stderr, "sparIntInit error: Block size must be greater than 1\n");
+		exit(1);
+	}
+
+	// Declare struct and allocate space
+	sparInt *matrix;
+	matrix = (sparInt*) malloc(sizeof(sparInt));
+
+	if( matrix == NULL )
+	{
+	   fprintf(stderr, "sparIntInit error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Set matrix size (nx,ny,nz)
+	matrix->nx = nx;
+	matrix->ny = ny;
+	matrix->nz = nz;
+
+	// Set block size (bs,bs,bs)
+	matrix->bs  = bs;
+	matrix->bs3 = bs * bs * bs;
+
+	// Set block matrix size (mx,my,mz)
+	matrix->mx = (int)( ( nx + bs - 1 ) / bs );
+	matrix->my = (int)( ( ny + bs - 1 ) / bs );
+	matrix->mz = (int)( ( nz + bs - 1 ) / bs );
+
+	// Number of blocks
+	int blocks = matrix->mx * matrix->my * matrix->mz;
+
+	// Allocate space for block uniform data
+	matrix->blockValue = (int*) calloc( blocks, sizeof(int) );
+
+	if( matrix->blockValue == NULL )
+	{
+	   fprintf(stderr, "sparIntInit error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Allocate space for block heterogeneous data arrays
+	matrix->blockData = (int**) calloc( blocks, sizeof(int*) );
+
+	if( matrix->blockData == NULL )
+	{
+	   fprintf(stderr, "sparIntInit error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Allocate space for block locks, cleared below
+	matrix->blockLock = (atomic_flag*) malloc( blocks * sizeof(atomic_flag) );
+
+	if( matrix->blockLock == NULL )
+	{
+	   fprintf(stderr, "sparIntInit error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Set default value
+	matrix->def = def;
+
+	// Set ring buffer origin. Duplicate and Map copy it, Op requires equal origins and copies it, Permute permutes it and in-place operations keep it.
+	// Crop, Downsample and InitDense leave it at zero, their storage does not follow the ring layout of a source window.
+	matrix->ox = 0;
+	matrix->oy = 0;
+	matrix->oz = 0;
+
+	// Set matrix elemets to default value
+	int i;
+	for( i = 0 ; i < blocks ; i++ )
+	{
+		matrix->blockData[i] = NULL; // Flag for uniform block
+		matrix->blockValue[i] = def;
+	}
+
+	// Unlock all blocks
+	sparIntClearLocks( matrix );
+
+	// Return pointer
+	return matrix;
+}
+
+// Clear (unlock) every block lock, flags are not assumed clear after allocation
+void sparIntClearLocks( sparInt *matrix )
+{
+	int n;
+	for( n = 0 ; n < matrix->mx * matrix->my * matrix->mz ; n++ )
+	{
+		atomic_flag_clear( &matrix->blockLock[n] );
+	}
+}
+
+// Matrix destructor
+void sparIntFree( sparInt *matrix )
+{
+	// Number of blocks
+	int blocks;
+	blocks = matrix->mx * matrix->my * matrix->mz;
+
+	// Free heterogeneous blocks
+	int i;
+	for( i = 0 ; i < blocks ; i++ )
+	{
+		if( matrix->blockData[i] != NULL ) // Flag for uniform block
+		{
+			free( matrix->blockData[i] );
+		}
+	}
+
+	// Free block uniform data
+	free(matrix->blockValue);
+
+	// Free block heterogeneous data array
+	free(matrix->blockData);
+
+	// Free block locks
+	free(matrix->blockLock);
+
+	// Free matrix instance
+	free(matrix);
+}
+
+// Reset matrix values
+void sparIntReset( sparInt *matrix )
+{
+	// Number of blocks
+	int blocks;
+	blocks = matrix->mx * matrix->my * matrix->mz;
+
+	// Reduce blocks and set to default value
+	int i;
+	for( i = 0 ; i < blocks ; i++ )
+	{
+		// Heterogeneous block
+		if( matrix->blockData[i] != NULL )
+		{
+			free( matrix->blockData[i] );
+			matrix->blockData[i] = NULL;
+		}
+		matrix->blockValue[i] = matrix->def;
+	}
+}
+
+// Get matrix memory usage in bytes
+double sparIntMemory( sparInt *matrix )
+{
+	// Number of blocks
+	int blocks;
+	blocks = matrix->mx * matrix->my * matrix->mz;
+
+	// Matrix instance
+	double size;
+	size = (double)( sizeof(sparInt) );
+
+	// Uniform block data
+	size = size + (double)( blocks * sizeof(int) );
+
+	// Heterogeneous block data arrays
+	size = size + (double)( blocks * sizeof(int*) );
+
+	// Block locks
+	size = size + (double)( blocks * sizeof(atomic_flag) );
+
+	// Heterogeneous block data
+	int i;
+	for( i = 0 ; i < blocks ; i++ )
+	{
+		// Heterogeneous block
+		if( matrix->blockData[i] != NULL )
+		{
+			size = size + (double)( sizeof(int) * matrix->bs3 );
+		}
+	}
+
+	return size;
+}
+
+// Element equality, NaN equal to NaN so NaN regions compress like any other uniform value
+int sparIntEqual( int a, int b )
+{
+	return a == b || ( isnan( (double) a ) && isnan( (double) b ) );
+}
+
+// Convert x to the data type, rounding to nearest for integer types instead of truncating
+int sparIntRound( double x )
+{
+	// Integer types turn 0.5 into 0
+	if( (int)( 0.5 ) == 0 )
+	{
+		return (int)( floor( x + 0.5 ) );
+	}
+	return (int)( x );
+}
+
+// Check if block is uniform
+int sparIntUniformBlock( sparInt *matrix, int x, int y, int z )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Linear block index (n) <-> (x,y,z)
+	int n;
+	n = x + mx * ( y + my * z );
+
+	// Block data array
+	int *blockData;
+	blockData = matrix->blockData[n];
+
+	// Uniform block
+	if( blockData == NULL )
+	{
+		return 1;
+	}
+
+	int isUniform;
+	isUniform = 1;
+
+	// Inner block
+	if( x < mx - 1 && y < my - 1 && z < mz - 1)
+	{
+		// Start with last element
+		int value;
+		value = blockData[ bs3 - 1 ];
+
+		// Read block elements
+		int i;
+		for( i = 0 ; i < bs3 ; i++ )
+		{
+			if( sparIntEqual( blockData[i], value ) == 0 )
+			{
+				isUniform = 0;
+				i = bs3;
+			}
+		}
+	}
+	// Boundary block, with outside elements?
+	else
+	{
+		// Start with first element
+		int value;
+		value = blockData[0];
+
+		// Read block elements
+		int i, j, k;
+		for( k = 0 ; k < bs ; k++ )
+		{
+			if( z * bs + k < matrix->nz ) // Avoid outside elements
+			for( j = 0 ; j < bs ; j++ )
+			{
+				if( y * bs + j < matrix->ny ) // Idem
+				for( i = 0 ; i < bs ; i++ )
+				{
+					if( x * bs + i < matrix->nx ) // Idem
+					if( sparIntEqual( blockData[ i + bs * ( j + bs * k ) ], value ) == 0 )
+					{
+						isUniform = 0;
+						i = j = k = bs;
+					}
+				}
+			}
+		}
+	}
+
+	return isUniform;
+}
+
+// Expand uniform block (x,y,z) into heterogeneous block data
+void sparIntExpandBlock( sparInt *matrix, int x, int y, int z )
+{
+	// Linear block index (n) <-> (x,y,z)
+	int n;
+	n = x + matrix->mx * ( y + matrix->my * z );
+
+	// Already heterogeneous
+	if( matrix->blockData[n] != NULL )
+	{
+		return;
+	}
+
+	// Allocate block data
+	int *blockData;
+	blockData = (int*) calloc( matrix->bs3, sizeof(int) );
+
+	if( blockData == NULL )
+	{
+	   fprintf(stderr, "sparIntExpandBlock error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Set uniform value
+	int value;
+	value = matrix->blockValue[n];
+
+	int i;
+	for( i = 0 ; i < matrix->bs3 ; i++ )
+	{
+		blockData[i] = value;
+	}
+
+	matrix->blockData[n] = blockData;
+}
+
+// Reduce block (x,y,z) to uniform if possible, return 1 if uniform
+int sparIntReduceBlock( sparInt *matrix, int x, int y, int z )
+{
+	// Linear block index (n) <-> (x,y,z)
+	int n;
+	n = x + matrix->mx * ( y + matrix->my * z );
+
+	// Already uniform
+	if( matrix->blockData[n] == NULL )
+	{
+		return 1;
+	}
+
+	// Heterogeneous block
+	if( sparIntUniformBlock( matrix, x, y, z ) == 0 )
+	{
+		return 0;
+	}
+
+	// First element is always inside the matrix
+	matrix->blockValue[n] = matrix->blockData[n][0];
+	free(matrix->blockData[n]);
+	matrix->blockData[n] = NULL;
+
+	return 1;
+}
+
+// Check if every block overlapping box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) is uniform with the same value
+int sparIntUniformBox( sparInt *matrix, int x, int y, int z, int sx, int sy, int sz, int *value )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return 0;
+	}
+
+	// Reference value
+	int n;
+	n = x0 / bs + matrix->mx * ( y0 / bs + matrix->my * ( z0 / bs ) );
+	*value = matrix->blockValue[n];
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+				if( matrix->blockData[n] != NULL || sparIntEqual( matrix->blockValue[n], *value ) == 0 )
+				{
+					return 0;
+				}
+			}
+		}
+	}
+
+	return 1;
+}
+
+// Copy box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) into buffer[i+sx*(j+sy*k)], default value outside the matrix
+void sparIntGetBox( sparInt *matrix, int x, int y, int z, int sx, int sy, int sz, int *buffer )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	int i, j, k;
+
+	// Box partially outside the matrix, fill with default value
+	if( x0 != x || y0 != y || z0 != z || x1 != x + sx || y1 != y + sy || z1 != z + sz )
+	{
+		for( i = 0 ; i < sx * sy * sz ; i++ )
+		{
+			buffer[i] = matrix->def;
+		}
+	}
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+				int *blockData;
+				blockData = matrix->blockData[n];
+
+				// Copy block rows
+				for( k = bz0 ; k < bz1 ; k++ )
+				{
+					for( j = by0 ; j < by1 ; j++ )
+					{
+						int *row;
+						row = buffer + ( bx0 - x ) + sx * ( ( j - y ) + sy * ( k - z ) );
+
+						// Uniform block
+						if( blockData == NULL )
+						{
+							int value;
+							value = matrix->blockValue[n];
+							for( i = 0 ; i < bx1 - bx0 ; i++ )
+							{
+								row[i] = value;
+							}
+						}
+						// Heterogeneous block
+						else
+						{
+							memcpy( row, blockData + ( bx0 - i1 * bs ) + bs * ( ( j - j1 * bs ) + bs * ( k - k1 * bs ) ),
+									( bx1 - bx0 ) * sizeof(int) );
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// Copy buffer[i+sx*(j+sy*k)] into box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1), elements outside the matrix are ignored
+void sparIntSetBox( sparInt *matrix, int x, int y, int z, int sx, int sy, int sz, int *buffer )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	int i, j, k;
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+				// Block elements inside the matrix are fully covered
+				int covered;
+				covered = bx0 == i1 * bs && by0 == j1 * bs && bz0 == k1 * bs &&
+						  ( bx1 == ( i1 + 1 ) * bs || bx1 == matrix->nx ) &&
+						  ( by1 == ( j1 + 1 ) * bs || by1 == matrix->ny ) &&
+						  ( bz1 == ( k1 + 1 ) * bs || bz1 == matrix->nz );
+
+				// Covered block, check if input is uniform first
+				if( covered )
+				{
+					int value;
+					value = buffer[ ( bx0 - x ) + sx * ( ( by0 - y ) + sy * ( bz0 - z ) ) ];
+
+					int isUniform;
+					isUniform = 1;
+					for( k = bz0 ; k < bz1 && isUniform ; k++ )
+					{
+						for( j = by0 ; j < by1 && isUniform ; j++ )
+						{
+							int *row;
+							row = buffer + ( bx0 - x ) + sx * ( ( j - y ) + sy * ( k - z ) );
+							for( i = 0 ; i < bx1 - bx0 ; i++ )
+							{
+								if( sparIntEqual( row[i], value ) == 0 )
+								{
+									isUniform = 0;
+									break;
+								}
+							}
+						}
+					}
+
+					if( isUniform )
+					{
+						if( matrix->blockData[n] != NULL )
+						{
+							free(matrix->blockData[n]);
+							matrix->blockData[n] = NULL;
+						}
+						matrix->blockValue[n] = value;
+						continue;
+					}
+				}
+
+				// Copy block rows into heterogeneous block
+				sparIntExpandBlock( matrix, i1, j1, k1 );
+
+				int *blockData;
+				blockData = matrix->blockData[n];
+
+				for( k = bz0 ; k < bz1 ; k++ )
+				{
+					for( j = by0 ; j < by1 ; j++ )
+					{
+						memcpy( blockData + ( bx0 - i1 * bs ) + bs * ( ( j - j1 * bs ) + bs * ( k - k1 * bs ) ),
+								buffer + ( bx0 - x ) + sx * ( ( j - y ) + sy * ( k - z ) ),
+								( bx1 - bx0 ) * sizeof(int) );
+					}
+				}
+
+				// Partially covered blocks may have become uniform
+				if( !covered )
+				{
+					sparIntReduceBlock( matrix, i1, j1, k1 );
+				}
+			}
+		}
+	}
+}
+
+// Set every element of box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) to value, elements outside the matrix are ignored
+void sparIntFillBox( sparInt *matrix, int x, int y, int z, int sx, int sy, int sz, int value )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	int i, j, k;
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+				// Block elements inside the matrix are fully covered, uniform block
+				if( bx0 == i1 * bs && by0 == j1 * bs && bz0 == k1 * bs &&
+					( bx1 == ( i1 + 1 ) * bs || bx1 == matrix->nx ) &&
+					( by1 == ( j1 + 1 ) * bs || by1 == matrix->ny ) &&
+					( bz1 == ( k1 + 1 ) * bs || bz1 == matrix->nz ) )
+				{
+					if( matrix->blockData[n] != NULL )
+					{
+						free(matrix->blockData[n]);
+						matrix->blockData[n] = NULL;
+					}
+					matrix->blockValue[n] = value;
+					continue;
+				}
+
+				// Already uniform with the same value
+				if( matrix->blockData[n] == NULL && sparIntEqual( matrix->blockValue[n], value ) )
+				{
+					continue;
+				}
+
+				// Fill block rows and reduce if possible
+				sparIntExpandBlock( matrix, i1, j1, k1 );
+
+				int *blockData;
+				blockData = matrix->blockData[n];
+
+				for( k = bz0 ; k < bz1 ; k++ )
+				{
+					for( j = by0 ; j < by1 ; j++ )
+					{
+						int *row;
+						row = blockData + ( bx0 - i1 * bs ) + bs * ( ( j - j1 * bs ) + bs * ( k - k1 * bs ) );
+						for( i = 0 ; i < bx1 - bx0 ; i++ )
+						{
+							row[i] = value;
+						}
+					}
+				}
+
+				sparIntReduceBlock( matrix, i1, j1, k1 );
+			}
+		}
+	}
+}
+
+// Set matrix element (x,y,z)
+void sparIntSet( sparInt *matrix, int x, int y, int z, int value )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block (i1,j1,k1) contains the element (x,y,z)
+	int i1, j1, k1;
+	i1 = x / bs;
+	j1 = y / bs;
+	k1 = z / bs;
+
+	// Element indices in the block
+	int i2, j2, k2;
+	i2 = x % bs;
+	j2 = y % bs;
+	k2 = z % bs;
+
+	// Linear block index (n) <-> (i1,j1,k1)
+	int n;
+	n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+	// Block uniform value
+	int blockValue;
+	blockValue = matrix->blockValue[n];
+
+	// Block data array
+	int *blockData;
+	blockData = matrix->blockData[n];
+
+	// Uniform block
+	if( blockData == NULL )
+	{
+		// Input value is different
+		if( sparIntEqual( value, blockValue ) == 0 )
+		{
+			// Expand block
+			blockData = (int*) calloc( bs3, sizeof(int) );
+			matrix->blockData[n] = blockData;
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparIntSet error: Out of memory\n");
+			   exit(1);
+			}
+
+			// Set previous value
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				blockData[i] = blockValue;
+			}
+
+			// Set input value
+			blockData[ i2 + bs * ( j2 + bs * k2 ) ] = value;
+		}
+		// Else, do nothing
+	}
+	// Heterogeneous block
+	else
+	{
+		// Set input value
+		blockData[ i2 + bs * ( j2 + bs * k2 ) ] = value;
+
+		// Reduce block
+		if( sparIntUniformBlock( matrix, i1, j1, k1 ) )
+		{
+			matrix->blockValue[n] = value;
+			free(matrix->blockData[n]);
+			matrix->blockData[n] = NULL;
+		}
+	}
+}
+
+// Get matrix element (x,y,z)
+int sparIntGet( sparInt *matrix, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Block (i1,j1,k1) contains the element (x,y,z)
+	int i1, j1, k1;
+	i1 = x / bs;
+	j1 = y / bs;
+	k1 = z / bs;
+
+	// Linear block index (n) <-> (i1,j1,k1)
+	int n;
+	n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+	int *blockData;
+	blockData = matrix->blockData[n];
+
+	// Uniform block
+	if( blockData == NULL )
+	{
+		return matrix->blockValue[n];
+	}
+	// Heterogeneous block
+	else
+	{
+		// Element indices in the block
+		int i2, j2, k2;
+		i2 = x % bs;
+		j2 = y % bs;
+		k2 = z % bs;
+		// Return element value
+		return blockData[ i2 + bs * ( j2 + bs * k2 ) ];
+	}
+}
+
+// Set matrix element (x,y,z) locking its block, safe for parallel writers
+void sparIntSetSafe( sparInt *matrix, int x, int y, int z, int value )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Linear block index (n) <-> (x/bs,y/bs,z/bs)
+	int n;
+	n = x / bs + matrix->mx * ( y / bs + matrix->my * ( z / bs ) );
+
+	// Acquire block lock
+	while( atomic_flag_test_and_set_explicit( &matrix->blockLock[n], memory_order_acquire ) );
+
+	// Set element, may expand or reduce the block
+	sparIntSet( matrix, x, y, z, value );
+
+	// Release block lock
+	atomic_flag_clear_explicit( &matrix->blockLock[n], memory_order_release );
+}
+
+// Get matrix element (x,y,z) locking its block, safe with parallel writers
+int sparIntGetSafe( sparInt *matrix, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Linear block index (n) <-> (x/bs,y/bs,z/bs)
+	int n;
+	n = x / bs + matrix->mx * ( y / bs + matrix->my * ( z / bs ) );
+
+	// Acquire block lock
+	while( atomic_flag_test_and_set_explicit( &matrix->blockLock[n], memory_order_acquire ) );
+
+	// Get element
+	int value;
+	value = sparIntGet( matrix, x, y, z );
+
+	// Release block lock
+	atomic_flag_clear_explicit( &matrix->blockLock[n], memory_order_release );
+
+	return value;
+}
+
+// Duplicate matrix
+sparInt* sparIntDuplicate( sparInt *matrix )
+{
+	// Declare matrix and init
+	sparInt *matrix2;
+	matrix2 = sparIntInit( matrix->nx, matrix->ny, matrix->nz,
+						matrix->bs, matrix->def );
+
+	// Copy ring buffer origin
+	matrix2->ox = matrix->ox;
+	matrix2->oy = matrix->oy;
+	matrix2->oz = matrix->oz;
+
+	// Number of blocks
+	int blocks;
+	blocks = matrix2->mx * matrix2->my * matrix2->mz;
+
+	// Copy blocks
+	int i;
+	for( i = 0 ; i < blocks ; i++ )
+	{
+		// Heterogeneous block
+		if( matrix->blockData[i] != NULL )
+		{
+			// Allocate space for block data
+			matrix2->blockData[i] = (int*) calloc( matrix2->bs3, sizeof(int) );
+
+			if( matrix2->blockData[i] == NULL )
+			{
+			   fprintf(stderr, "sparIntDuplicate error: Out of memory\n");
+			   exit(1);
+			}
+
+			// Copy block data
+			memcpy( matrix2->blockData[i], matrix->blockData[i], matrix2->bs3 * sizeof(int) );
+		}
+		// Uniform block
+		else
+		{
+			matrix2->blockValue[i] = matrix->blockValue[i];
+			matrix2->blockData[i] = NULL;
+		}
+	}
+
+	return matrix2;
+}
+
+// Get matrix memory usage in bytes under certain block size
+double sparIntMemoryBs( sparInt *matrix, int bs )
+{
+	if( bs == matrix->bs )
+	{
+		return sparIntMemory( matrix );
+	}
+
+	// Matrix size (nx,ny,nz)
+	int nx, ny, nz;
+	nx = matrix->nx;
+	ny = matrix->ny;
+	nz = matrix->nz;
+
+	// Block size (bs,bs,bs)
+	int bs3;
+	bs3 = bs * bs * bs;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = (int)( ( nx + bs - 1 ) / bs );
+	my = (int)( ( ny + bs - 1 ) / bs );
+	mz = (int)( ( nz + bs - 1 ) / bs );
+
+	// Number of blocks
+	int blocks;
+	blocks = mx * my * mz;
+
+	// Size of matrix instance
+	double size;
+	size = (double)( sizeof(sparInt) );
+
+	// Size of uniform block data
+	size = size + (double)( blocks * sizeof(int) );
+
+	// Size of heterogeneous block data arrays
+	size = size + (double)( blocks * sizeof(int*) );
+
+	// Size of block locks
+	size = size + (double)( blocks * sizeof(atomic_flag) );
+
+	int i, j, k;
+	int i1, j1, k1;
+	int isUniform;
+	int value;
+
+	// For each virtual block
+	for( k1 = 0 ; k1 < mz ; k1++ )
+	{
+		for( j1 = 0 ; j1 < my ; j1++ )
+		{
+			for( i1 = 0 ; i1 < mx ; i1++ )
+			{
+				// Check if block is uniform 
+				isUniform = 1;
+				value = sparIntGet( matrix, i1 * bs, j1 * bs, k1 * bs );
+				for( k = k1 * bs ; k < ( k1 + 1 ) * bs ; k++ )
+				{
+					if( k < nz ) // Avoid outside elements
+					for( j = j1 * bs ; j < ( j1 + 1 ) * bs ; j++ )
+					{
+						if( j < ny ) // Idem
+						for( i = i1 * bs ; i < ( i1 + 1 ) * bs ; i++ )
+						{
+							if( i < nx ) // Idem
+							if( sparIntEqual( sparIntGet( matrix, i, j, k ), value ) == 0 )
+							{
+								isUniform = 0;
+								i = ( i1 + 1 ) * bs;
+								j = ( j1 + 1 ) * bs;
+								k = ( k1 + 1 ) * bs;
+							}
+						}
+					}
+				}
+				if( isUniform == 0 )
+				{
+					size = size + (double)( sizeof(int) * bs3 );
+				}
+			}
+		}
+	}
+
+	return size;
+}
+
+// Change matrix block size
+void sparIntChangeBs( sparInt *matrix, int bs )
+{
+	// Matrix size (nx,ny,nz)
+	int nx, ny, nz;
+	nx = matrix->nx;
+	ny = matrix->ny;
+	nz = matrix->nz;
+
+	// Default value
+	int def;
+	def = matrix->def;
+
+	// Declare temporal matrix and init
+	sparInt *matrix2;
+	matrix2 = sparIntInit( nx, ny, nz, bs, def );
+
+	// Copy values and clear original matrix
+	int i, j, k;
+	for( k=0 ; k<nz ; k++ )
+	{
+		for( j=0 ; j<ny ; j++ )
+		{
+			for( i=0 ; i<nx ; i++ )
+			{
+				// Copy element
+				sparIntSet( matrix2, i, j, k, sparIntGet( matrix, i, j, k ) );
+
+				// Set uniform to free memory
+				sparIntSet( matrix, i, j, k, def);
+			}
+		}
+	}
+
+	// Set new block size and grid
+	matrix->bs  = matrix2->bs;
+	matrix->bs3 = matrix2->bs3;
+	matrix->mx  = matrix2->mx;
+	matrix->my  = matrix2->my;
+	matrix->mz  = matrix2->mz;
+
+	// Free old blocks
+	free(matrix->blockValue);
+	free(matrix->blockData);
+	free(matrix->blockLock);
+
+	// Copy new blocks
+	matrix->blockValue = matrix2->blockValue;
+	matrix->blockData = matrix2->blockData;
+	matrix->blockLock = matrix2->blockLock;
+
+	// Unlock all blocks of the new grid
+	sparIntClearLocks( matrix );
+
+	// Free temporal matrix
+	free(matrix2);
+}
+
+// Optimize matrix block size
+void sparIntOptimizeBs( sparInt *matrix )
+{
+	// Test block size and store optimal
+	int bestBs;
+	double memory, bestMemory;
+	int bs[10] = { 2, 3, 4, 6, 8, 10 };
+
+	bestBs = bs[0];
+	bestMemory = sparIntMemoryBs( matrix, bs[0] );
+
+	int i;
+	for( i=1 ; i<6 ; i++ )
+	{
+		memory = sparIntMemoryBs( matrix, bs[i] );
+		if( memory < bestMemory )
+		{
+			bestBs = bs[i];
+			bestMemory = memory;
+		}
+	}
+
+	// Change matrix block size
+	sparIntChangeBs( matrix, bestBs );
+}
+
+// Resize matrix
+void sparIntResize( sparInt *matrix, int nx, int ny, int nz )
+{
+	// Check matrix size
+	if( !( nx > 0 && ny > 0 && nz > 0 ) )
+	{
+		fprintf(stderr, "sparIntResize error: Matrix size must be positive\n");
+		exit(1);
+	}
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Default value
+	int def;
+	def = matrix->def;
+
+	// New block grid size
+	int mx, my, mz;
+	mx = (int)( ( nx + bs - 1 ) / bs );
+	my = (int)( ( ny + bs - 1 ) / bs );
+	mz = (int)( ( nz + bs - 1 ) / bs );
+
+	// New block data
+	int *blockValue;
+	int **blockData;
+
+	int blocks;
+	blocks = mx * my * mz;
+	blockValue = (int*) calloc( blocks, sizeof(int) ); // Sets to 0s
+	blockData = (int**) calloc( blocks, sizeof(int*) ); // Sets to NULLs
+
+	if( blockValue == NULL || blockData == NULL )
+	{
+	   fprintf(stderr, "sparIntResize error: Out of memory\n");
+	   exit(1);
+	}
+
+	int i, j, k;
+
+	// Move existing blocks, create new blocks
+	for( k = 0 ; k < mz ; k++ )
+	{
+		for( j = 0 ; j < my ; j++ )
+		{
+			for( i = 0 ; i < mx ; i++ )
+			{
+				if( i < matrix->mx && j < matrix->my && k < matrix->mz )
+				{
+					blockValue[ i + mx * ( j + my * k ) ]
+						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
+					blockData[ i + mx * ( j + my * k ) ]
+						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
+				}
+				else
+				{
+					blockValue[ i + mx * ( j + my * k ) ] = def;
+				}
+			}
+		}
+	}
+
+	// Free excedent blocks
+	for( k = 0 ; k < matrix->mz ; k++ )
+	{
+		for( j = 0 ; j < matrix->my ; j++ )
+		{
+			for( i = 0 ; i < matrix->mx ; i++ )
+			{
+				if( ( i >= mx || j >= my || k >= mz ) &&
+					matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
+				{
+					free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
+				}
+			}
+		}
+	}
+
+	// Previous matrix size
+	int ox, oy, oz;
+	ox = matrix->nx;
+	oy = matrix->ny;
+	oz = matrix->nz;
+
+	matrix->nx = nx;
+	matrix->ny = ny;
+	matrix->nz = nz;
+	matrix->mx = mx;
+	matrix->my = my;
+	matrix->mz = mz;
+
+	free(matrix->blockData);
+	free(matrix->blockValue);
+
+	matrix->blockData = blockData;
+	matrix->blockValue = blockValue;
+
+	// Set expanded elements of previous boundary blocks to default, block by block
+	if( nx > ox )
+	{
+		sparIntFillBox( matrix, ox, 0, 0, nx - ox, ny, nz, def );
+	}
+	if( ny > oy )
+	{
+		sparIntFillBox( matrix, 0, oy, 0, nx, ny - oy, nz, def );
+	}
+	if( nz > oz )
+	{
+		sparIntFillBox( matrix, 0, 0, oz, nx, ny, nz - oz, def );
+	}
+
+	// Reallocate block locks for the new block grid
+	free(matrix->blockLock);
+	matrix->blockLock = (atomic_flag*) malloc( matrix->mx * matrix->my * matrix->mz * sizeof(atomic_flag) );
+
+	if( matrix->blockLock == NULL )
+	{
+	   fprintf(stderr, "sparIntResize error: Out of memory\n");
+	   exit(1);
+	}
+
+	sparIntClearLocks( matrix );
+}
+
+// Sum of matrix elements
+double sparIntSum( sparInt *matrix )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	double sum;
+	sum = 0.0;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:sum) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		int *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, value times element count
+		if( blockData == NULL )
+		{
+			sum += (double)( matrix->blockValue[n] ) * ex * ey * ez;
+		}
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
+		{
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				sum += (double)( blockData[i] );
+			}
+		}
+		// Boundary heterogeneous block, skip outside elements
+		else
+		{
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					int *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						sum += (double)( row[i] );
+					}
+				}
+			}
+		}
+	}
+
+	return sum;
+}
+
+// First matrix element in block order that is not NaN, NaN only if every element is NaN
+int sparIntFirstNumber( sparInt *matrix )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// For each block
+	int n;
+	for( n = 0 ; n < matrix->mx * matrix->my * matrix->mz ; n++ )
+	{
+		int *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block
+		if( blockData == NULL )
+		{
+			if( !isnan( (double) matrix->blockValue[n] ) )
+			{
+				return matrix->blockValue[n];
+			}
+			continue;
+		}
+
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % matrix->mx;
+		j1 = ( n / matrix->mx ) % matrix->my;
+		k1 = n / ( matrix->mx * matrix->my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs < bs ? matrix->nx - i1 * bs : bs;
+		ey = matrix->ny - j1 * bs < bs ? matrix->ny - j1 * bs : bs;
+		ez = matrix->nz - k1 * bs < bs ? matrix->nz - k1 * bs : bs;
+
+		// Heterogeneous block, skip outside elements
+		int i, j, k;
+		for( k = 0 ; k < ez ; k++ )
+		{
+			for( j = 0 ; j < ey ; j++ )
+			{
+				for( i = 0 ; i < ex ; i++ )
+				{
+					if( !isnan( (double) blockData[ i + bs * ( j + bs * k ) ] ) )
+					{
+						return blockData[ i + bs * ( j + bs * k ) ];
+					}
+				}
+			}
+		}
+	}
+
+	return sparIntGet( matrix, 0, 0, 0 );
+}
+
+// Minimum matrix element, NaN elements ignored (NaN only if all are NaN)
+int sparIntMin( sparInt *matrix )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Start with an element that is not NaN, comparisons with NaN are false so NaN never replaces it
+	int value;
+	value = sparIntFirstNumber( matrix );
+
+	// Every element is NaN
+	if( isnan( (double) value ) )
+	{
+		return value;
+	}
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(min:value) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		int *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block
+		if( blockData == NULL )
+		{
+			if( matrix->blockValue[n] < value )
+			{
+				value = matrix->blockValue[n];
+			}
+		}
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
+		{
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				value = blockData[i] < value ? blockData[i] : value;
+			}
+		}
+		// Boundary heterogeneous block, skip outside elements
+		else
+		{
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					int *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						value = row[i] < value ? row[i] : value;
+					}
+				}
+			}
+		}
+	}
+
+	return value;
+}
+
+// Maximum matrix element, NaN elements ignored (NaN only if all are NaN)
+int sparIntMax( sparInt *matrix )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Start with an element that is not NaN, comparisons with NaN are false so NaN never replaces it
+	int value;
+	value = sparIntFirstNumber( matrix );
+
+	// Every element is NaN
+	if( isnan( (double) value ) )
+	{
+		return value;
+	}
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(max:value) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		int *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block
+		if( blockData == NULL )
+		{
+			if( matrix->blockValue[n] > value )
+			{
+				value = matrix->blockValue[n];
+			}
+		}
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
+		{
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				value = blockData[i] > value ? blockData[i] : value;
+			}
+		}
+		// Boundary heterogeneous block, skip outside elements
+		else
+		{
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					int *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						value = row[i] > value ? row[i] : value;
+					}
+				}
+			}
+		}
+	}
+
+	return value;
+}
+
+// Number of matrix elements different from the default value
+double sparIntCount( sparInt *matrix )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Default value
+	int def;
+	def = matrix->def;
+
+	double count;
+	count = 0.0;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:count) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		int *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, all or none of its elements
+		if( blockData == NULL )
+		{
+			if( sparIntEqual( matrix->blockValue[n], def ) == 0 )
+			{
+				count += (double)( ex * ey * ez );
+			}
+		}
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
+		{
+			int i, c;
+			c = 0;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				c += ( sparIntEqual( blockData[i], def ) == 0 );
+			}
+			count += (double)( c );
+		}
+		// Boundary heterogeneous block, skip outside elements
+		else
+		{
+			int i, j, k, c;
+			c = 0;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					int *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						c += ( sparIntEqual( row[i], def ) == 0 );
+					}
+				}
+			}
+			count += (double)( c );
+		}
+	}
+
+	return count;
+}
+
+// Fold f over matrix elements from identity, f gets each uniform block once with its element count
+double sparIntReduce( sparInt *matrix, double (*f)( double acc, int value, int count ), double identity )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	double acc;
+	acc = identity;
+
+	// For each block, sequential so f needs no combine step
+	int n;
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		int *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, a single call for all its elements
+		if( blockData == NULL )
+		{
+			acc = f( acc, matrix->blockValue[n], ex * ey * ez );
+		}
+		// Heterogeneous block, skip outside elements
+		else
+		{
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					int *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						acc = f( acc, row[i], 1 );
+					}
+				}
+			}
+		}
+	}
+
+	return acc;
+}
+
+// Apply function f to every matrix element (and default value) in place
+void sparIntApply( sparInt *matrix, int (*f)( int ) )
+{
+	// Block size
+	int bs3;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		int *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, transform its value only
+		if( blockData == NULL )
+		{
+			matrix->blockValue[n] = f( matrix->blockValue[n] );
+		}
+		// Heterogeneous block, transform and reduce if possible
+		else
+		{
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				blockData[i] = f( blockData[i] );
+			}
+			sparIntReduceBlock( matrix, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
+	}
+
+	// Keep the background consistent with transformed uniform blocks
+	matrix->def = f( matrix->def );
+}
+
+// New matrix with function f applied to every element (and default value)
+sparInt* sparIntMap( sparInt *matrix, int (*f)( int ) )
+{
+	// Declare matrix and init
+	sparInt *matrix2;
+	matrix2 = sparIntInit( matrix->nx, matrix->ny, matrix->nz,
+						matrix->bs, f( matrix->def ) );
+
+	// Copy ring buffer origin
+	matrix2->ox = matrix->ox;
+	matrix2->oy = matrix->oy;
+	matrix2->oz = matrix->oz;
+
+	// Block size
+	int bs3;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		int *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, transform its value only
+		if( blockData == NULL )
+		{
+			matrix2->blockValue[n] = f( matrix->blockValue[n] );
+		}
+		// Heterogeneous block, transform into new block and reduce if possible
+		else
+		{
+			int *blockData2;
+			blockData2 = (int*) calloc( bs3, sizeof(int) );
+
+			if( blockData2 == NULL )
+			{
+			   fprintf(stderr, "sparIntMap error: Out of memory\n");
+			   exit(1);
+			}
+
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				blockData2[i] = f( blockData[i] );
+			}
+			matrix2->blockData[n] = blockData2;
+			sparIntReduceBlock( matrix2, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
+	}
+
+	return matrix2;
+}
+
+// Visit elements different from the default value, in block order
+void sparIntForEach( sparInt *matrix, void (*f)( int x, int y, int z, int value, void *data ), void *data )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Default value
+	int def;
+	def = matrix->def;
+
+	int i, j, k;
+	int i1, j1, k1;
+	int ex, ey, ez;
+	int n;
+
+	// For each block
+	for( k1 = 0 ; k1 < matrix->mz ; k1++ )
+	{
+		for( j1 = 0 ; j1 < matrix->my ; j1++ )
+		{
+			for( i1 = 0 ; i1 < matrix->mx ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				int *blockData;
+				blockData = matrix->blockData[n];
+
+				// Skip uniform blocks equal to the default value
+				if( blockData == NULL && sparIntEqual( matrix->blockValue[n], def ) )
+				{
+					continue;
+				}
+
+				// Block extent inside the matrix
+				ex = matrix->nx - i1 * bs;
+				ey = matrix->ny - j1 * bs;
+				ez = matrix->nz - k1 * bs;
+				if( ex > bs ) ex = bs;
+				if( ey > bs ) ey = bs;
+				if( ez > bs ) ez = bs;
+
+				// Uniform block, every element
+				if( blockData == NULL )
+				{
+					int value;
+					value = matrix->blockValue[n];
+					for( k = 0 ; k < ez ; k++ )
+					{
+						for( j = 0 ; j < ey ; j++ )
+						{
+							for( i = 0 ; i < ex ; i++ )
+							{
+								f( i1 * bs + i, j1 * bs + j, k1 * bs + k, value, data );
+							}
+						}
+					}
+				}
+				// Heterogeneous block, non-default elements
+				else
+				{
+					for( k = 0 ; k < ez ; k++ )
+					{
+						for( j = 0 ; j < ey ; j++ )
+						{
+							int *row;
+							row = blockData + bs * ( j + bs * k );
+							for( i = 0 ; i < ex ; i++ )
+							{
+								if( sparIntEqual( row[i], def ) == 0 )
+								{
+									f( i1 * bs + i, j1 * bs + j, k1 * bs + k, row[i], data );
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// Visit maximal runs of equal non-default elements along x, (x,y,z) to (x+n-1,y,z), merged across blocks
+void sparIntForEachRun( sparInt *matrix, void (*f)( int x, int y, int z, int n, int value, void *data ), void *data )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Default value
+	int def;
+	def = matrix->def;
+
+	int i, j, k;
+	int i1, j1, k1;
+	int ex, ey, ez;
+	int n;
+
+	// Current run (rx,y,z) to (rx+rn-1,y,z) of value rv
+	int rx, rn;
+	int rv;
+
+	// For each row of blocks
+	for( k1 = 0 ; k1 < matrix->mz ; k1++ )
+	{
+		for( j1 = 0 ; j1 < matrix->my ; j1++ )
+		{
+			// Block row extent inside the matrix
+			ey = matrix->ny - j1 * bs;
+			ez = matrix->nz - k1 * bs;
+			if( ey > bs ) ey = bs;
+			if( ez > bs ) ez = bs;
+
+			// For each matrix row, runs continue from one block into the next
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					rx = 0;
+					rn = 0;
+					rv = def;
+
+					for( i1 = 0 ; i1 < matrix->mx ; i1++ )
+					{
+						// Linear block index (n) <-> (i1,j1,k1)
+						n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+						ex = matrix->nx - i1 * bs;
+						if( ex > bs ) ex = bs;
+
+						int *blockData;
+						blockData = matrix->blockData[n];
+
+						// Uniform block, extend or restart the run with its whole row
+						if( blockData == NULL )
+						{
+							if( rn > 0 && sparIntEqual( matrix->blockValue[n], rv ) )
+							{
+								rn += ex;
+							}
+							else
+							{
+								if( rn > 0 && sparIntEqual( rv, def ) == 0 )
+								{
+									f( rx, j1 * bs + j, k1 * bs + k, rn, rv, data );
+								}
+								rx = i1 * bs;
+								rn = ex;
+								rv = matrix->blockValue[n];
+							}
+						}
+						// Heterogeneous block, element by element
+						else
+						{
+							int *row;
+							row = blockData + bs * ( j + bs * k );
+							for( i = 0 ; i < ex ; i++ )
+							{
+								if( rn > 0 && sparIntEqual( row[i], rv ) )
+								{
+									rn++;
+								}
+								else
+								{
+									if( rn > 0 && sparIntEqual( rv, def ) == 0 )
+									{
+										f( rx, j1 * bs + j, k1 * bs + k, rn, rv, data );
+									}
+									rx = i1 * bs + i;
+									rn = 1;
+									rv = row[i];
+								}
+							}
+						}
+					}
+
+					// End of row
+					if( rn > 0 && sparIntEqual( rv, def ) == 0 )
+					{
+						f( rx, j1 * bs + j, k1 * bs + k, rn, rv, data );
+					}
+				}
+			}
+		}
+	}
+}
+
+// Element-wise operation between arrays, c[i] = a[i] op b[i]
+void sparIntOpArray( int *c, int *a, int *b, int n, int op, int def )
+{
+	int i;
+	switch( op )
+	{
+		case SPAR_ADD:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] + b[i];
+			}
+			break;
+		case SPAR_SUB:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] - b[i];
+			}
+			break;
+		case SPAR_MUL:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] * b[i];
+			}
+			break;
+		case SPAR_MIN:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] < b[i] ? a[i] : b[i];
+			}
+			break;
+		case SPAR_MAX:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] > b[i] ? a[i] : b[i];
+			}
+			break;
+		case SPAR_MASK:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = b[i] != 0 ? a[i] : def;
+			}
+			break;
+		default:
+			fprintf(stderr, "sparIntOpArray error: Unknown operation\n");
+			exit(1);
+	}
+}
+
+// Element-wise operation between array and scalar, c[i] = a[i] op value
+void sparIntOpArrayScalar( int *c, int *a, int value, int n, int op, int def )
+{
+	int i;
+	switch( op )
+	{
+		case SPAR_ADD:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] + value;
+			}
+			break;
+		case SPAR_SUB:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] - value;
+			}
+			break;
+		case SPAR_MUL:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] * value;
+			}
+			break;
+		case SPAR_MIN:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] < value ? a[i] : value;
+			}
+			break;
+		case SPAR_MAX:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] > value ? a[i] : value;
+			}
+			break;
+		case SPAR_MASK:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = value != 0 ? a[i] : def;
+			}
+			break;
+		default:
+			fprintf(stderr, "sparIntOpArrayScalar error: Unknown operation\n");
+			exit(1);
+	}
+}
+
+// New matrix with element-wise operation between matrices, c = a op b
+sparInt* sparIntOp( sparInt *a, sparInt *b, int op )
+{
+	// Check matrix size
+	if( a->nx != b->nx || a->ny != b->ny || a->nz != b->nz )
+	{
+		fprintf(stderr, "sparIntOp error: Matrix sizes must agree\n");
+		exit(1);
+	}
+
+	// Check ring buffer origin, blocks are combined by storage index
+	if( a->ox != b->ox || a->oy != b->oy || a->oz != b->oz )
+	{
+		fprintf(stderr, "sparIntOp error: Ring buffer origins must agree\n");
+		exit(1);
+	}
+
+	// Result default value
+	int def;
+	sparIntOpArrayScalar( &def, &a->def, b->def, 1, op, a->def );
+
+	// Declare result matrix with block size of a
+	sparInt *c;
+	c = sparIntInit( a->nx, a->ny, a->nz, a->bs, def );
+
+	// Copy ring buffer origin of a
+	c->ox = a->ox;
+	c->oy = a->oy;
+	c->oz = a->oz;
+
+	// Block size
+	int bs, bs3;
+	bs = a->bs;
+	bs3 = a->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = a->mx;
+	my = a->my;
+	mz = a->mz;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block of b resampled on the block grid of a
+		int *buffer;
+		buffer = NULL;
+
+		if( b->bs != bs )
+		{
+			buffer = (int*) malloc( bs3 * sizeof(int) );
+
+			if( buffer == NULL )
+			{
+			   fprintf(stderr, "sparIntOp error: Out of memory\n");
+			   exit(1);
+			}
+		}
+
+		// For each block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < mx * my * mz ; n++ )
+		{
+			// Block (i1,j1,k1) <-> (n)
+			int i1, j1, k1;
+			i1 = n % mx;
+			j1 = ( n / mx ) % my;
+			k1 = n / ( mx * my );
+
+			// Block of b, uniform (blockB == NULL) or heterogeneous
+			int *blockB, valueB;
+			if( b->bs == bs )
+			{
+				blockB = b->blockData[n];
+				valueB = b->blockValue[n];
+			}
+			else if( sparIntUniformBox( b, i1 * bs, j1 * bs, k1 * bs, bs, bs, bs, &valueB ) )
+			{
+				blockB = NULL;
+			}
+			else
+			{
+				sparIntGetBox( b, i1 * bs, j1 * bs, k1 * bs, bs, bs, bs, buffer );
+				blockB = buffer;
+			}
+
+			// Block of a
+			int *blockA, valueA;
+			blockA = a->blockData[n];
+			valueA = a->blockValue[n];
+
+			// Both uniform, one operation
+			if( blockA == NULL && blockB == NULL )
+			{
+				sparIntOpArrayScalar( &c->blockValue[n], &valueA, valueB, 1, op, a->def );
+				continue;
+			}
+
+			// Heterogeneous result
+			int *blockC;
+			blockC = (int*) calloc( bs3, sizeof(int) );
+
+			if( blockC == NULL )
+			{
+			   fprintf(stderr, "sparIntOp error: Out of memory\n");
+			   exit(1);
+			}
+
+			// Uniform b, scalar operation
+			if( blockB == NULL )
+			{
+				sparIntOpArrayScalar( blockC, blockA, valueB, bs3, op, a->def );
+			}
+			// Uniform a, expand into result and operate in place
+			else if( blockA == NULL )
+			{
+				int i;
+				for( i = 0 ; i < bs3 ; i++ )
+				{
+					blockC[i] = valueA;
+				}
+				sparIntOpArray( blockC, blockC, blockB, bs3, op, a->def );
+			}
+			// Both heterogeneous
+			else
+			{
+				sparIntOpArray( blockC, blockA, blockB, bs3, op, a->def );
+			}
+
+			c->blockData[n] = blockC;
+			sparIntReduceBlock( c, i1, j1, k1 );
+		}
+
+		free(buffer);
+	}
+
+	return c;
+}
+
+// Element-wise operation with scalar in place, matrix = matrix op value
+void sparIntOpScalar( sparInt *matrix, int value, int op )
+{
+	// Block size
+	int bs3;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Default value of the operation (SPAR_MASK)
+	int def;
+	def = matrix->def;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		int *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, one operation
+		if( blockData == NULL )
+		{
+			sparIntOpArrayScalar( &matrix->blockValue[n], &matrix->blockValue[n], value, 1, op, def );
+		}
+		// Heterogeneous block, operate in place and reduce if possible
+		else
+		{
+			sparIntOpArrayScalar( blockData, blockData, value, bs3, op, def );
+			sparIntReduceBlock( matrix, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
+	}
+
+	// Keep the background consistent with updated uniform blocks
+	sparIntOpArrayScalar( &matrix->def, &matrix->def, value, 1, op, def );
+}
+
+// Stencil of radius r from src into dst, f(c) reads neighbours c[i+sy*j+sz*k] with -r <= i,j,k <= r
+void sparIntStencil( sparInt *dst, sparInt *src, int r, int (*f)( int *c, int r, int sy, int sz, void *data ), void *data )
+{
+	// Check matrices
+	if( dst == src )
+	{
+		fprintf(stderr, "sparIntStencil error: Source and destination must be different\n");
+		exit(1);
+	}
+
+	if( dst->nx != src->nx || dst->ny != src->ny || dst->nz != src->nz )
+	{
+		fprintf(stderr, "sparIntStencil error: Matrix sizes must agree\n");
+		exit(1);
+	}
+
+	if( r < 0 )
+	{
+		fprintf(stderr, "sparIntStencil error: Radius must be non-negative\n");
+		exit(1);
+	}
+
+	// Destination block size
+	int bs, bs3;
+	bs = dst->bs;
+	bs3 = dst->bs3;
+
+	// Destination block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = dst->mx;
+	my = dst->my;
+	mz = dst->mz;
+
+	// Block plus halo size (hs,hs,hs)
+	int hs;
+	hs = bs + 2 * r;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block plus halo of the source
+		int *halo;
+		halo = (int*) malloc( hs * hs * hs * sizeof(int) );
+
+		if( halo == NULL )
+		{
+		   fprintf(stderr, "sparIntStencil error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each destination block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < mx * my * mz ; n++ )
+		{
+			// Block (i1,j1,k1) <-> (n)
+			int i1, j1, k1;
+			i1 = n % mx;
+			j1 = ( n / mx ) % my;
+			k1 = n / ( mx * my );
+
+			// Block origin
+			int x, y, z;
+			x = i1 * bs;
+			y = j1 * bs;
+			z = k1 * bs;
+
+			// Free previous destination data
+			if( dst->blockData[n] != NULL )
+			{
+				free(dst->blockData[n]);
+				dst->blockData[n] = NULL;
+			}
+
+			// Uniform neighbourhood, uniform destination block
+			int value;
+			if( sparIntUniformBox( src, x - r, y - r, z - r, hs, hs, hs, &value ) &&
+				( sparIntEqual( value, src->def ) || ( x >= r && y >= r && z >= r &&
+				  x + bs + r <= src->nx && y + bs + r <= src->ny && z + bs + r <= src->nz ) ) )
+			{
+				int w, i;
+				w = 2 * r + 1;
+				for( i = 0 ; i < w * w * w ; i++ )
+				{
+					halo[i] = value;
+				}
+				dst->blockValue[n] = f( halo + r + w * ( r + w * r ), r, w, w * w, data );
+				continue;
+			}
+
+			// Read block plus halo
+			sparIntGetBox( src, x - r, y - r, z - r, hs, hs, hs, halo );
+
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = dst->nx - x;
+			ey = dst->ny - y;
+			ez = dst->nz - z;
+			if( ex > bs ) ex = bs;
+			if( ey > bs ) ey = bs;
+			if( ez > bs ) ez = bs;
+
+			// Apply stencil
+			int *blockData;
+			blockData = (int*) calloc( bs3, sizeof(int) );
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparIntStencil error: Out of memory\n");
+			   exit(1);
+			}
+
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					int *c;
+					c = halo + r + hs * ( ( j + r ) + hs * ( k + r ) );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						blockData[ i + bs * ( j + bs * k ) ] = f( c + i, r, hs, hs * hs, data );
+					}
+				}
+			}
+
+			// Write block and reduce if possible
+			dst->blockData[n] = blockData;
+			sparIntReduceBlock( dst, i1, j1, k1 );
+		}
+
+		free(halo);
+	}
+}
+
+// Stencil kernel, weighted sum of the neighbourhood with data holding (2r+1)^3 weights
+int sparIntConvolveKernel( int *c, int r, int sy, int sz, void *data )
+{
+	double *weights;
+	weights = (double*) data;
+
+	double sum;
+	sum = 0.0;
+
+	int i, j, k;
+	for( k = -r ; k <= r ; k++ )
+	{
+		for( j = -r ; j <= r ; j++ )
+		{
+			for( i = -r ; i <= r ; i++ )
+			{
+				sum += *weights++ * (double)( c[ i + sy * j + sz * k ] );
+			}
+		}
+	}
+
+	return sparIntRound( sum );
+}
+
+// Convolution of src into dst with weights[(i+r)+(2r+1)*((j+r)+(2r+1)*(k+r))]
+void sparIntConvolve( sparInt *dst, sparInt *src, int r, double *weights )
+{
+	sparIntStencil( dst, src, r, sparIntConvolveKernel, weights );
+}
+
+// One-dimensional filter of src into dst along axis (0 x, 1 y, 2 z) with 2r+1 weights, box (moving average) if weights is NULL
+void sparIntFilterAxis( sparInt *dst, sparInt *src, int axis, int r, double *weights )
+{
+	// Check matrices
+	if( dst == src )
+	{
+		fprintf(stderr, "sparIntFilterAxis error: Source and destination must be different\n");
+		exit(1);
+	}
+
+	if( dst->nx != src->nx || dst->ny != src->ny || dst->nz != src->nz )
+	{
+		fprintf(stderr, "sparIntFilterAxis error: Matrix sizes must agree\n");
+		exit(1);
+	}
+
+	if( axis < 0 || axis > 2 || r < 0 )
+	{
+		fprintf(stderr, "sparIntFilterAxis error: Invalid axis or radius\n");
+		exit(1);
+	}
+
+	// Destination block size
+	int bs, bs3;
+	bs = dst->bs;
+	bs3 = dst->bs3;
+
+	// Destination block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = dst->mx;
+	my = dst->my;
+	mz = dst->mz;
+
+	// Halo radius (rx,ry,rz) and block plus halo size (hx,hy,hz)
+	int rx, ry, rz;
+	rx = axis == 0 ? r : 0;
+	ry = axis == 1 ? r : 0;
+	rz = axis == 2 ? r : 0;
+
+	int hx, hy, hz;
+	hx = bs + 2 * rx;
+	hy = bs + 2 * ry;
+	hz = bs + 2 * rz;
+
+	// Element strides along the filter axis in the halo and in the block
+	int hstride, bstride;
+	hstride = axis == 0 ? 1 : ( axis == 1 ? hx : hx * hy );
+	bstride = axis == 0 ? 1 : ( axis == 1 ? bs : bs * bs );
+
+	// Sum of weights
+	double wsum;
+	wsum = 1.0;
+	if( weights != NULL )
+	{
+		int i;
+		wsum = 0.0;
+		for( i = 0 ; i < 2 * r + 1 ; i++ )
+		{
+			wsum += weights[i];
+		}
+
+		// Normalized kernel, keep uniform values exact
+		if( fabs( wsum - 1.0 ) < 1e-9 )
+		{
+			wsum = 1.0;
+		}
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block plus halo of the source and one line along the axis
+		int *halo;
+		double *line;
+		halo = (int*) malloc( hx * hy * hz * sizeof(int) );
+		line = (double*) malloc( ( bs + 2 * r ) * sizeof(double) );
+
+		if( halo == NULL || line == NULL )
+		{
+		   fprintf(stderr, "sparIntFilterAxis error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each destination block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < mx * my * mz ; n++ )
+		{
+			// Block (i1,j1,k1) <-> (n)
+			int i1, j1, k1;
+			i1 = n % mx;
+			j1 = ( n / mx ) % my;
+			k1 = n / ( mx * my );
+
+			// Block origin
+			int x, y, z;
+			x = i1 * bs;
+			y = j1 * bs;
+			z = k1 * bs;
+
+			// Free previous destination data
+			if( dst->blockData[n] != NULL )
+			{
+				free(dst->blockData[n]);
+				dst->blockData[n] = NULL;
+			}
+
+			// Run of uniform blocks along the axis, uniform destination block
+			int value;
+			if( sparIntUniformBox( src, x - rx, y - ry, z - rz, hx, hy, hz, &value ) &&
+				( sparIntEqual( value, src->def ) || ( x >= rx && y >= ry && z >= rz &&
+				  x + bs + rx <= src->nx && y + bs + ry <= src->ny && z + bs + rz <= src->nz ) ) )
+			{
+				dst->blockValue[n] = weights == NULL || wsum == 1.0 ? value : sparIntRound( wsum * value );
+				continue;
+			}
+
+			// Read block plus halo
+			sparIntGetBox( src, x - rx, y - ry, z - rz, hx, hy, hz, halo );
+
+			int *blockData;
+			blockData = (int*) calloc( bs3, sizeof(int) );
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparIntFilterAxis error: Out of memory\n");
+			   exit(1);
+			}
+
+			// For each line along the axis, (a,b) are the other two block indices
+			int a, b, i;
+			for( b = 0 ; b < bs ; b++ )
+			{
+				for( a = 0 ; a < bs ; a++ )
+				{
+					// First line element in the halo and in the block
+					int *hline, *bline;
+					if( axis == 0 )
+					{
+						hline = halo + hx * ( a + hy * b );
+						bline = blockData + bs * ( a + bs * b );
+					}
+					else if( axis == 1 )
+					{
+						hline = halo + a + hx * hy * b;
+						bline = blockData + a + bs * bs * b;
+					}
+					else
+					{
+						hline = halo + a + hx * b;
+						bline = blockData + a + bs * b;
+					}
+
+					// Gather line
+					for( i = 0 ; i < bs + 2 * r ; i++ )
+					{
+						line[i] = (double)( hline[ i * hstride ] );
+					}
+
+					// Box, sliding window sum
+					if( weights == NULL )
+					{
+						double sum;
+						sum = 0.0;
+						for( i = 0 ; i < 2 * r + 1 ; i++ )
+						{
+							sum += line[i];
+						}
+						for( i = 0 ; i < bs ; i++ )
+						{
+							bline[ i * bstride ] = sparIntRound( sum / ( 2 * r + 1 ) );
+							if( i + 1 < bs )
+							{
+								sum += line[ i + 2 * r + 1 ] - line[i];
+							}
+						}
+					}
+					// Weighted window as offsets from the centre element, exact on constant lines
+					else
+					{
+						int w;
+						for( i = 0 ; i < bs ; i++ )
+						{
+							double sum;
+							sum = 0.0;
+							for( w = 0 ; w < 2 * r + 1 ; w++ )
+							{
+								sum += weights[w] * ( line[ i + w ] - line[ i + r ] );
+							}
+							bline[ i * bstride ] = sparIntRound( wsum * line[ i + r ] + sum );
+						}
+					}
+				}
+			}
+
+			// Write block and reduce if possible
+			dst->blockData[n] = blockData;
+			sparIntReduceBlock( dst, i1, j1, k1 );
+		}
+
+		free(halo);
+		free(line);
+	}
+}
+
+// Box filter (mean over (2r+1)^3 neighbourhood) of src into dst, three one-dimensional passes
+void sparIntBoxFilter( sparInt *dst, sparInt *src, int r )
+{
+	// Temporal matrix for the second pass, intermediate passes see the source default value outside the matrix
+	sparInt *tmp;
+	tmp = sparIntInit( dst->nx, dst->ny, dst->nz, dst->bs, src->def );
+
+	int def;
+	def = dst->def;
+	dst->def = src->def;
+
+	sparIntFilterAxis( dst, src, 0, r, NULL );
+	sparIntFilterAxis( tmp, dst, 1, r, NULL );
+
+	dst->def = def;
+	sparIntFilterAxis( dst, tmp, 2, r, NULL );
+
+	sparIntFree( tmp );
+}
+
+// Gaussian filter of standard deviation sigma of src into dst, three one-dimensional passes
+void sparIntGaussianFilter( sparInt *dst, sparInt *src, double sigma )
+{
+	if( !( sigma > 0.0 ) )
+	{
+		fprintf(stderr, "sparIntGaussianFilter error: Standard deviation must be positive\n");
+		exit(1);
+	}
+
+	// Normalized kernel truncated at 3 sigma
+	int r;
+	r = (int)( ceil( 3.0 * sigma ) );
+
+	double *weights;
+	weights = (double*) malloc( ( 2 * r + 1 ) * sizeof(double) );
+
+	if( weights == NULL )
+	{
+	   fprintf(stderr, "sparIntGaussianFilter error: Out of memory\n");
+	   exit(1);
+	}
+
+	int i;
+	double sum;
+	sum = 0.0;
+	for( i = -r ; i <= r ; i++ )
+	{
+		weights[ i + r ] = exp( -0.5 * i * i / ( sigma * sigma ) );
+		sum += weights[ i + r ];
+	}
+	for( i = 0 ; i < 2 * r + 1 ; i++ )
+	{
+		weights[i] /= sum;
+	}
+
+	// Temporal matrix for the second pass, intermediate passes see the source default value outside the matrix
+	sparInt *tmp;
+	tmp = sparIntInit( dst->nx, dst->ny, dst->nz, dst->bs, src->def );
+
+	int def;
+	def = dst->def;
+	dst->def = src->def;
+
+	sparIntFilterAxis( dst, src, 0, r, weights );
+	sparIntFilterAxis( tmp, dst, 1, r, weights );
+
+	dst->def = def;
+	sparIntFilterAxis( dst, tmp, 2, r, weights );
+
+	sparIntFree( tmp );
+	free(weights);
+}
+
+// Union-find root of node i with path halving (connected component labeling)
+int sparIntLabelFind( int *parent, int i )
+{
+	while( parent[i] != i )
+	{
+		parent[i] = parent[ parent[i] ];
+		i = parent[i];
+	}
+	return i;
+}
+
+// Union-find merge of the sets of nodes i and j, the smallest node is kept as root
+void sparIntLabelUnion( int *parent, int i, int j )
+{
+	i = sparIntLabelFind( parent, i );
+	j = sparIntLabelFind( parent, j );
+	if( i < j )
+	{
+		parent[j] = i;
+	}
+	else if( j < i )
+	{
+		parent[i] = j;
+	}
+}
+
+// Union-find node of element (x,y,z), -1 for elements equal to the default value
+int sparIntLabelNode( sparInt *matrix, int *offset, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Linear block index (n) <-> (x/bs,y/bs,z/bs)
+	int n;
+	n = x / bs + matrix->mx * ( y / bs + matrix->my * ( z / bs ) );
+
+	// Uniform block, one node or none
+	if( matrix->blockData[n] == NULL )
+	{
+		return offset[n];
+	}
+
+	// Heterogeneous block, one node per element
+	int i;
+	i = x % bs + bs * ( y % bs + bs * ( z % bs ) );
+	if( sparIntEqual( matrix->blockData[n][i], matrix->def ) )
+	{
+		return -1;
+	}
+	return offset[n] + i;
+}
+
+// Connect block (x,y,z) with its neighbour block across the lower face along axis (0 x, 1 y, 2 z)
+void sparIntLabelFace( sparInt *matrix, int *offset, int *parent, int x, int y, int z, int axis )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Neighbour block
+	int x2, y2, z2;
+	x2 = x - ( axis == 0 );
+	y2 = y - ( axis == 1 );
+	z2 = z - ( axis == 2 );
+
+	// Linear block indices
+	int n, n2;
+	n = x + matrix->mx * ( y + matrix->my * z );
+	n2 = x2 + matrix->mx * ( y2 + matrix->my * z2 );
+
+	// Any default uniform block, nothing to connect
+	if( offset[n] < 0 || offset[n2] < 0 )
+	{
+		return;
+	}
+
+	// Both uniform, one connection
+	if( matrix->blockData[n] == NULL && matrix->blockData[n2] == NULL )
+	{
+		sparIntLabelUnion( parent, offset[n], offset[n2] );
+		return;
+	}
+
+	// Block extent inside the matrix
+	int ex, ey, ez;
+	ex = matrix->nx - x * bs;
+	ey = matrix->ny - y * bs;
+	ez = matrix->nz - z * bs;
+	if( ex > bs ) ex = bs;
+	if( ey > bs ) ey = bs;
+	if( ez > bs ) ez = bs;
+
+	// Face elements
+	int a, b, na, nb;
+	na = axis == 0 ? ey : ex;
+	nb = axis == 2 ? ey : ez;
+	for( b = 0 ; b < nb ; b++ )
+	{
+		for( a = 0 ; a < na ; a++ )
+		{
+			// Element (i,j,k) on the face and its neighbour
+			int i, j, k, node, node2;
+			i = x * bs + ( axis == 0 ? 0 : a );
+			j = y * bs + ( axis == 0 ? a : ( axis == 1 ? 0 : b ) );
+			k = z * bs + ( axis == 2 ? 0 : b );
+
+			node = sparIntLabelNode( matrix, offset, i, j, k );
+			if( node < 0 )
+			{
+				continue;
+			}
+			node2 = sparIntLabelNode( matrix, offset, i - ( axis == 0 ), j - ( axis == 1 ), k - ( axis == 2 ) );
+			if( node2 < 0 )
+			{
+				continue;
+			}
+			sparIntLabelUnion( parent, node, node2 );
+		}
+	}
+}
+
+// Connect elements inside heterogeneous block (x,y,z)
+void sparIntLabelBlock( sparInt *matrix, int *offset, int *parent, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Linear block index (n) <-> (x,y,z)
+	int n;
+	n = x + matrix->mx * ( y + matrix->my * z );
+
+	int *blockData;
+	blockData = matrix->blockData[n];
+
+	// Uniform block is a single node
+	if( blockData == NULL )
+	{
+		return;
+	}
+
+	// Block extent inside the matrix
+	int ex, ey, ez;
+	ex = matrix->nx - x * bs;
+	ey = matrix->ny - y * bs;
+	ez = matrix->nz - z * bs;
+	if( ex > bs ) ex = bs;
+	if( ey > bs ) ey = bs;
+	if( ez > bs ) ez = bs;
+
+	// Connect each non-default element with its lower neighbours
+	int def;
+	def = matrix->def;
+
+	int i, j, k, e;
+	for( k = 0 ; k < ez ; k++ )
+	{
+		for( j = 0 ; j < ey ; j++ )
+		{
+			for( i = 0 ; i < ex ; i++ )
+			{
+				e = i + bs * ( j + bs * k );
+				if( sparIntEqual( blockData[e], def ) )
+				{
+					continue;
+				}
+				if( i > 0 && sparIntEqual( blockData[ e - 1 ], def ) == 0 )
+				{
+					sparIntLabelUnion( parent, offset[n] + e, offset[n] + e - 1 );
+				}
+				if( j > 0 && sparIntEqual( blockData[ e - bs ], def ) == 0 )
+				{
+					sparIntLabelUnion( parent, offset[n] + e, offset[n] + e - bs );
+				}
+				if( k > 0 && sparIntEqual( blockData[ e - bs * bs ], def ) == 0 )
+				{
+					sparIntLabelUnion( parent, offset[n] + e, offset[n] + e - bs * bs );
+				}
+			}
+		}
+	}
+}
+
+// Label 6-connected regions of non-default elements into labels (0 elsewhere), return number of regions
+int sparIntLabel( sparInt *matrix, sparInt *labels )
+{
+	// Check matrices
+	if( labels->nx != matrix->nx || labels->ny != matrix->ny || labels->nz != matrix->nz ||
+		labels->bs != matrix->bs )
+	{
+		fprintf(stderr, "sparIntLabel error: Matrix and block sizes must agree\n");
+		exit(1);
+	}
+
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Number of blocks
+	int blocks;
+	blocks = mx * my * mz;
+
+	// First node of each block: one for non-default uniform blocks, one per element for heterogeneous blocks
+	int *offset;
+	offset = (int*) malloc( blocks * sizeof(int) );
+
+	if( offset == NULL )
+	{
+	   fprintf(stderr, "sparIntLabel error: Out of memory\n");
+	   exit(1);
+	}
+
+	double nodes;
+	nodes = 0.0;
+
+	int n;
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		if( matrix->blockData[n] != NULL )
+		{
+			offset[n] = (int)( nodes );
+			nodes += bs3;
+		}
+		else if( sparIntEqual( matrix->blockValue[n], matrix->def ) == 0 )
+		{
+			offset[n] = (int)( nodes );
+			nodes += 1;
+		}
+		else
+		{
+			offset[n] = -1;
+		}
+	}
+
+	if( nodes > INT_MAX )
+	{
+		fprintf(stderr, "sparIntLabel error: Too many heterogeneous blocks\n");
+		exit(1);
+	}
+
+	// Union-find forest, -1 for unused nodes of default elements
+	int *parent;
+	parent = (int*) malloc( ( (int)( nodes ) + 1 ) * sizeof(int) );
+
+	if( parent == NULL )
+	{
+	   fprintf(stderr, "sparIntLabel error: Out of memory\n");
+	   exit(1);
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		if( offset[n] < 0 )
+		{
+			continue;
+		}
+
+		int *blockData;
+		blockData = matrix->blockData[n];
+
+		if( blockData == NULL )
+		{
+			parent[ offset[n] ] = offset[n];
+			continue;
+		}
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - ( n % mx ) * bs;
+		ey = matrix->ny - ( ( n / mx ) % my ) * bs;
+		ez = matrix->nz - ( n / ( mx * my ) ) * bs;
+
+		int i, j, k, e;
+		for( k = 0 ; k < bs ; k++ )
+		{
+			for( j = 0 ; j < bs ; j++ )
+			{
+				for( i = 0 ; i < bs ; i++ )
+				{
+					e = i + bs * ( j + bs * k );
+					if( i < ex && j < ey && k < ez && sparIntEqual( blockData[e], matrix->def ) == 0 )
+					{
+						parent[ offset[n] + e ] = offset[n] + e;
+					}
+					else
+					{
+						parent[ offset[n] + e ] = -1;
+					}
+				}
+			}
+		}
+	}
+
+	// Connect blocks within slabs of block layers in parallel, slabs hold disjoint node ranges
+	int slab, slabs;
+	slab = 8;
+	slabs = ( mz + slab - 1 ) / slab;
+
+	int s;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(dynamic)
+	#endif
+	for( s = 0 ; s < slabs ; s++ )
+	{
+		int i1, j1, k1;
+		for( k1 = s * slab ; k1 < ( s + 1 ) * slab && k1 < mz ; k1++ )
+		{
+			for( j1 = 0 ; j1 < my ; j1++ )
+			{
+				for( i1 = 0 ; i1 < mx ; i1++ )
+				{
+					sparIntLabelBlock( matrix, offset, parent, i1, j1, k1 );
+					if( i1 > 0 )
+					{
+						sparIntLabelFace( matrix, offset, parent, i1, j1, k1, 0 );
+					}
+					if( j1 > 0 )
+					{
+						sparIntLabelFace( matrix, offset, parent, i1, j1, k1, 1 );
+					}
+					if( k1 > s * slab )
+					{
+						sparIntLabelFace( matrix, offset, parent, i1, j1, k1, 2 );
+					}
+				}
+			}
+		}
+	}
+
+	// Merge slabs across their boundary layers
+	int i1, j1;
+	for( s = 1 ; s < slabs ; s++ )
+	{
+		for( j1 = 0 ; j1 < my ; j1++ )
+		{
+			for( i1 = 0 ; i1 < mx ; i1++ )
+			{
+				sparIntLabelFace( matrix, offset, parent, i1, j1, s * slab, 2 );
+			}
+		}
+	}
+
+	// Consecutive labels from 1, roots are the smallest node of each set and parents precede children
+	int count;
+	count = 0;
+
+	int i;
+	for( i = 0 ; i < (int)( nodes ) ; i++ )
+	{
+		if( parent[i] == i )
+		{
+			parent[i] = ++count;
+		}
+		else if( parent[i] >= 0 )
+		{
+			parent[i] = parent[ parent[i] ];
+		}
+	}
+
+	// Write labels
+	labels->def = 0;
+
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		// Free previous labels
+		if( labels->blockData[n] != NULL )
+		{
+			free(labels->blockData[n]);
+			labels->blockData[n] = NULL;
+		}
+
+		// Default uniform block
+		if( offset[n] < 0 )
+		{
+			labels->blockValue[n] = 0;
+		}
+		// Non-default uniform block
+		else if( matrix->blockData[n] == NULL )
+		{
+			labels->blockValue[n] = parent[ offset[n] ];
+		}
+		// Heterogeneous block
+		else
+		{
+			int *blockData;
+			blockData = (int*) calloc( bs3, sizeof(int) );
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparIntLabel error: Out of memory\n");
+			   exit(1);
+			}
+
+			int e;
+			for( e = 0 ; e < bs3 ; e++ )
+			{
+				blockData[e] = parent[ offset[n] + e ] < 0 ? 0 : parent[ offset[n] + e ];
+			}
+
+			labels->blockData[n] = blockData;
+			sparIntReduceBlock( labels, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
+	}
+
+	free(offset);
+	free(parent);
+
+	return count;
+}
+
+// Squared distance transform of sampled function f into d (Felzenszwalb), v and z hold n and n+1 elements
+void sparIntDistanceLine( double *f, double *d, int n, int *v, double *z )
+{
+	int q, k;
+	double s;
+
+	// Lower envelope of parabolas rooted at (q,f[q])
+	k = 0;
+	v[0] = 0;
+	z[0] = -HUGE_VAL;
+	z[1] = HUGE_VAL;
+	for( q = 1 ; q < n ; q++ )
+	{
+		s = ( ( f[q] + (double)q * q ) - ( f[ v[k] ] + (double)v[k] * v[k] ) ) / ( 2.0 * ( q - v[k] ) );
+		while( s <= z[k] )
+		{
+			k--;
+			s = ( ( f[q] + (double)q * q ) - ( f[ v[k] ] + (double)v[k] * v[k] ) ) / ( 2.0 * ( q - v[k] ) );
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[ k + 1 ] = HUGE_VAL;
+	}
+
+	// Sample the envelope
+	k = 0;
+	for( q = 0 ; q < n ; q++ )
+	{
+		while( z[ k + 1 ] < q )
+		{
+			k++;
+		}
+		d[q] = (double)( q - v[k] ) * ( q - v[k] ) + f[ v[k] ];
+	}
+}
+
+// Squared distance pass along axis (0 x, 1 y, 2 z) in place, or from features of matrix if not NULL (default elements if inside)
+void sparIntDistanceAxis( sparInt *matrix, sparFloat *distance, int axis, float big, int inside )
+{
+	// Distance block size
+	int bs;
+	bs = distance->bs;
+
+	// Line length and number of block rows along the other two axes
+	int nl, ma, mb;
+	nl = axis == 0 ? distance->nx : ( axis == 1 ? distance->ny : distance->nz );
+	ma = axis == 0 ? distance->my : distance->mx;
+	mb = axis == 2 ? distance->my : distance->mz;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Row of blocks and one line
+		float *box;
+		int *source;
+		double *f, *d, *z;
+		int *v;
+		box = (float*) malloc( nl * bs * bs * sizeof(float) );
+		source = (int*) malloc( nl * bs * bs * sizeof(int) );
+		f = (double*) malloc( nl * sizeof(double) );
+		d = (double*) malloc( nl * sizeof(double) );
+		z = (double*) malloc( ( nl + 1 ) * sizeof(double) );
+		v = (int*) malloc( nl * sizeof(int) );
+
+		if( box == NULL || source == NULL || f == NULL || d == NULL || z == NULL || v == NULL )
+		{
+		   fprintf(stderr, "sparIntDistanceAxis error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each row of blocks along the axis, lines are independent
+		int g;
+		#ifdef _OPENMP
+		#pragma omp for schedule(dynamic)
+		#endif
+		for( g = 0 ; g < ma * mb ; g++ )
+		{
+			// Box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) inside the matrix
+			int x, y, zz, sx, sy, sz;
+			x = axis == 0 ? 0 : ( g % ma ) * bs;
+			y = axis == 1 ? 0 : ( axis == 0 ? ( g % ma ) * bs : ( g / ma ) * bs );
+			zz = axis == 2 ? 0 : ( g / ma ) * bs;
+			sx = axis == 0 ? distance->nx : ( distance->nx - x < bs ? distance->nx - x : bs );
+			sy = axis == 1 ? distance->ny : ( distance->ny - y < bs ? distance->ny - y : bs );
+			sz = axis == 2 ? distance->nz : ( distance->nz - zz < bs ? distance->nz - zz : bs );
+
+			int i;
+
+			// First pass, features of matrix
+			if( matrix != NULL )
+			{
+				int value;
+				if( sparIntUniformBox( matrix, x, y, zz, sx, sy, sz, &value ) )
+				{
+					sparFloatFillBox( distance, x, y, zz, sx, sy, sz,
+									  ( ( sparIntEqual( value, matrix->def ) == 0 ) != inside ) ? 0.0f : big );
+					continue;
+				}
+				sparIntGetBox( matrix, x, y, zz, sx, sy, sz, source );
+				for( i = 0 ; i < sx * sy * sz ; i++ )
+				{
+					box[i] = ( ( sparIntEqual( source[i], matrix->def ) == 0 ) != inside ) ? 0.0f : big;
+				}
+			}
+			// Next passes, constant lines are left unchanged
+			else
+			{
+				float value;
+				if( sparFloatUniformBox( distance, x, y, zz, sx, sy, sz, &value ) )
+				{
+					continue;
+				}
+				sparFloatGetBox( distance, x, y, zz, sx, sy, sz, box );
+			}
+
+			// Line stride and number of lines
+			int stride, lines;
+			stride = axis == 0 ? 1 : ( axis == 1 ? sx : sx * sy );
+			lines = sx * sy * sz / nl;
+
+			// For each line
+			int l;
+			for( l = 0 ; l < lines ; l++ )
+			{
+				// First line element
+				float *line;
+				if( axis == 0 )
+				{
+					line = box + nl * l;
+				}
+				else if( axis == 1 )
+				{
+					line = box + ( l % sx ) + sx * sy * ( l / sx );
+				}
+				else
+				{
+					line = box + l;
+				}
+
+				for( i = 0 ; i < nl ; i++ )
+				{
+					f[i] = line[ i * stride ];
+				}
+
+				sparIntDistanceLine( f, d, nl, v, z );
+
+				// Clamp at big
+				for( i = 0 ; i < nl ; i++ )
+				{
+					line[ i * stride ] = d[i] < big ? (float)( d[i] ) : big;
+				}
+			}
+
+			sparFloatSetBox( distance, x, y, zz, sx, sy, sz, box );
+		}
+
+		free(box);
+		free(source);
+		free(f);
+		free(d);
+		free(z);
+		free(v);
+	}
+}
+
+// Euclidean distance from each element to the nearest non-default element clamped at maxDistance, negative inside if sign
+void sparIntDistance( sparInt *matrix, sparFloat *distance, float maxDistance, int sign )
+{
+	// Check matrices
+	if( distance->nx != matrix->nx || distance->ny != matrix->ny || distance->nz != matrix->nz )
+	{
+		fprintf(stderr, "sparIntDistance error: Matrix sizes must agree\n");
+		exit(1);
+	}
+
+	if( !( maxDistance > 0.0f ) )
+	{
+		fprintf(stderr, "sparIntDistance error: Maximum distance must be positive\n");
+		exit(1);
+	}
+
+	// Squared distances are clamped, far regions become uniform
+	float big;
+	big = maxDistance * maxDistance;
+
+	// Squared distance to non-default elements
+	sparIntDistanceAxis( matrix, distance, 0, big, 0 );
+	sparIntDistanceAxis( NULL, distance, 1, big, 0 );
+	sparIntDistanceAxis( NULL, distance, 2, big, 0 );
+
+	// Squared distance to default elements
+	sparFloat *inner;
+	inner = NULL;
+	if( sign )
+	{
+		inner = sparFloatInit( distance->nx, distance->ny, distance->nz, distance->bs, big );
+		sparIntDistanceAxis( matrix, inner, 0, big, 1 );
+		sparIntDistanceAxis( NULL, inner, 1, big, 1 );
+		sparIntDistanceAxis( NULL, inner, 2, big, 1 );
+	}
+
+	// Distance, outer minus inner if signed
+	int mx, my, mz;
+	mx = distance->mx;
+	my = distance->my;
+	mz = distance->mz;
+
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		float *blockData, *innerData, innerValue;
+		blockData = distance->blockData[n];
+		innerData = inner == NULL ? NULL : inner->blockData[n];
+		innerValue = inner == NULL ? 0.0f : inner->blockValue[n];
+
+		// Uniform blocks
+		if( blockData == NULL && innerData == NULL )
+		{
+			distance->blockValue[n] = sqrtf( distance->blockValue[n] ) - sqrtf( innerValue );
+			continue;
+		}
+
+		// Heterogeneous blocks
+		sparFloatExpandBlock( distance, i1, j1, k1 );
+		blockData = distance->blockData[n];
+
+		int i;
+		for( i = 0 ; i < distance->bs3 ; i++ )
+		{
+			blockData[i] = sqrtf( blockData[i] ) - sqrtf( innerData == NULL ? innerValue : innerData[i] );
+		}
+
+		sparFloatReduceBlock( distance, i1, j1, k1 );
+	}
+
+	distance->def = maxDistance;
+
+	if( inner != NULL )
+	{
+		sparFloatFree( inner );
+	}
+}
+
+// Cast ray o+t*d (element (x,y,z) spans [x,x+1)) for 0 <= t <= tmax, return 1 with first non-default element hit[3] at t
+int sparIntRay( sparInt *matrix, double *o, double *d, double tmax, int *hit, double *t )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Matrix size
+	int size[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+
+	// Clip ray to the matrix bounds
+	double t0, t1;
+	t0 = 0.0;
+	t1 = tmax;
+
+	int a;
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		if( d[a] == 0.0 )
+		{
+			if( o[a] < 0.0 || o[a] >= size[a] )
+			{
+				return 0;
+			}
+		}
+		else
+		{
+			double ta, tb;
+			ta = ( 0.0 - o[a] ) / d[a];
+			tb = ( size[a] - o[a] ) / d[a];
+			if( ta > tb )
+			{
+				double tc;
+				tc = ta;
+				ta = tb;
+				tb = tc;
+			}
+			t0 = ta > t0 ? ta : t0;
+			t1 = tb < t1 ? tb : t1;
+		}
+	}
+
+	if( t0 > t1 )
+	{
+		return 0;
+	}
+
+	// Entry element, step direction, next element boundary and boundary spacing per axis
+	int v[3], step[3];
+	double tnext[3], tdelta[3];
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		v[a] = (int)( floor( o[a] + t0 * d[a] ) );
+		v[a] = v[a] < 0 ? 0 : ( v[a] >= size[a] ? size[a] - 1 : v[a] );
+		step[a] = d[a] > 0.0 ? 1 : -1;
+		tdelta[a] = d[a] == 0.0 ? HUGE_VAL : fabs( 1.0 / d[a] );
+		tnext[a] = d[a] == 0.0 ? HUGE_VAL : ( v[a] + ( step[a] > 0 ) - o[a] ) / d[a];
+	}
+
+	double tc;
+	tc = t0;
+
+	while( tc <= t1 )
+	{
+		// Linear block index (n) of element v
+		int b[3], n;
+		b[0] = v[0] / bs;
+		b[1] = v[1] / bs;
+		b[2] = v[2] / bs;
+		n = b[0] + matrix->mx * ( b[1] + matrix->my * b[2] );
+
+		// Uniform block
+		if( matrix->blockData[n] == NULL )
+		{
+			// Hit on entry
+			if( sparIntEqual( matrix->blockValue[n], matrix->def ) == 0 )
+			{
+				break;
+			}
+
+			// Skip to the block exit
+			int amin;
+			double tb[3];
+			amin = 0;
+			for( a = 0 ; a < 3 ; a++ )
+			{
+				tb[a] = d[a] == 0.0 ? HUGE_VAL : ( ( b[a] + ( step[a] > 0 ) ) * bs - o[a] ) / d[a];
+				if( tb[a] < tb[amin] )
+				{
+					amin = a;
+				}
+			}
+			tc = tb[amin];
+
+			// Element of the next block, stay inside the current block on the other axes
+			for( a = 0 ; a < 3 ; a++ )
+			{
+				if( a == amin )
+				{
+					v[a] = step[a] > 0 ? ( b[a] + 1 ) * bs : b[a] * bs - 1;
+				}
+				else
+				{
+					v[a] = (int)( floor( o[a] + tc * d[a] ) );
+					v[a] = v[a] < b[a] * bs ? b[a] * bs : ( v[a] >= ( b[a] + 1 ) * bs ? ( b[a] + 1 ) * bs - 1 : v[a] );
+				}
+				tnext[a] = d[a] == 0.0 ? HUGE_VAL : ( v[a] + ( step[a] > 0 ) - o[a] ) / d[a];
+			}
+		}
+		// Heterogeneous block, element by element
+		else
+		{
+			// Hit
+			int i;
+			i = v[0] % bs + bs * ( v[1] % bs + bs * ( v[2] % bs ) );
+			if( sparIntEqual( matrix->blockData[n][i], matrix->def ) == 0 )
+			{
+				break;
+			}
+
+			// Step to the next element
+			int amin;
+			amin = 0;
+			for( a = 1 ; a < 3 ; a++ )
+			{
+				if( tnext[a] < tnext[amin] )
+				{
+					amin = a;
+				}
+			}
+			tc = tnext[amin];
+			v[amin] += step[amin];
+			tnext[amin] += tdelta[amin];
+		}
+
+		// Left the matrix
+		if( v[0] < 0 || v[1] < 0 || v[2] < 0 || v[0] >= size[0] || v[1] >= size[1] || v[2] >= size[2] )
+		{
+			return 0;
+		}
+	}
+
+	// Beyond tmax or matrix exit
+	if( tc > t1 )
+	{
+		return 0;
+	}
+
+	hit[0] = v[0];
+	hit[1] = v[1];
+	hit[2] = v[2];
+	*t = tc;
+
+	return 1;
+}
+
+// Cast n rays o[3*i]+t*d[3*i] in parallel, hits[3*i] and t[i] (-1 if missed), return number of hits
+int sparIntRays( sparInt *matrix, int n, double *o, double *d, double tmax, int *hits, double *t )
+{
+	int count;
+	count = 0;
+
+	int i;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:count) schedule(guided)
+	#endif
+	for( i = 0 ; i < n ; i++ )
+	{
+		if( sparIntRay( matrix, o + 3 * i, d + 3 * i, tmax, hits + 3 * i, t + i ) )
+		{
+			count++;
+		}
+		else
+		{
+			t[i] = -1.0;
+		}
+	}
+
+	return count;
+}
+
+// Copy plane at index along axis into buffer, YZ (axis 0) y+ny*z, XZ (axis 1) x+nx*z, XY (axis 2) x+nx*y
+void sparIntSlice( sparInt *matrix, int axis, int index, int *buffer )
+{
+	// Matrix size
+	int nx, ny, nz;
+	nx = matrix->nx;
+	ny = matrix->ny;
+	nz = matrix->nz;
+
+	// Check plane
+	if( axis < 0 || axis > 2 || index < 0 ||
+		index >= ( axis == 0 ? nx : ( axis == 1 ? ny : nz ) ) )
+	{
+		fprintf(stderr, "sparIntSlice error: Plane outside the matrix\n");
+		exit(1);
+	}
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Block layer and element layer in the block
+	int b1, b2;
+	b1 = index / bs;
+	b2 = index % bs;
+
+	// XY plane, contiguous block rows
+	if( axis == 2 )
+	{
+		int j1;
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(guided)
+		#endif
+		for( j1 = 0 ; j1 < my ; j1++ )
+		{
+			int i1, i, j, ex, ey, n;
+			ey = ny - j1 * bs < bs ? ny - j1 * bs : bs;
+			for( i1 = 0 ; i1 < mx ; i1++ )
+			{
+				ex = nx - i1 * bs < bs ? nx - i1 * bs : bs;
+				n = i1 + mx * ( j1 + my * b1 );
+				for( j = 0 ; j < ey ; j++ )
+				{
+					int *row;
+					row = buffer + i1 * bs + nx * ( j1 * bs + j );
+
+					// Uniform block
+					if( matrix->blockData[n] == NULL )
+					{
+						for( i = 0 ; i < ex ; i++ )
+						{
+							row[i] = matrix->blockValue[n];
+						}
+					}
+					// Heterogeneous block
+					else
+					{
+						memcpy( row, matrix->blockData[n] + bs * ( j + bs * b2 ), ex * sizeof(int) );
+					}
+				}
+			}
+		}
+	}
+	// XZ plane, contiguous block rows
+	else if( axis == 1 )
+	{
+		int k1;
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(guided)
+		#endif
+		for( k1 = 0 ; k1 < mz ; k1++ )
+		{
+			int i1, i, k, ex, ez, n;
+			ez = nz - k1 * bs < bs ? nz - k1 * bs : bs;
+			for( i1 = 0 ; i1 < mx ; i1++ )
+			{
+				ex = nx - i1 * bs < bs ? nx - i1 * bs : bs;
+				n = i1 + mx * ( b1 + my * k1 );
+				for( k = 0 ; k < ez ; k++ )
+				{
+					int *row;
+					row = buffer + i1 * bs + nx * ( k1 * bs + k );
+
+					// Uniform block
+					if( matrix->blockData[n] == NULL )
+					{
+						for( i = 0 ; i < ex ; i++ )
+						{
+							row[i] = matrix->blockValue[n];
+						}
+					}
+					// Heterogeneous block
+					else
+					{
+						memcpy( row, matrix->blockData[n] + bs * ( b2 + bs * k ), ex * sizeof(int) );
+					}
+				}
+			}
+		}
+	}
+	// YZ plane, block elements are strided by bs
+	else
+	{
+		int k1;
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(guided)
+		#endif
+		for( k1 = 0 ; k1 < mz ; k1++ )
+		{
+			int j1, j, k, ey, ez, n;
+			ez = nz - k1 * bs < bs ? nz - k1 * bs : bs;
+			for( j1 = 0 ; j1 < my ; j1++ )
+			{
+				ey = ny - j1 * bs < bs ? ny - j1 * bs : bs;
+				n = b1 + mx * ( j1 + my * k1 );
+				for( k = 0 ; k < ez ; k++ )
+				{
+					int *row;
+					row = buffer + j1 * bs + ny * ( k1 * bs + k );
+
+					// Uniform block
+					if( matrix->blockData[n] == NULL )
+					{
+						for( j = 0 ; j < ey ; j++ )
+						{
+							row[j] = matrix->blockValue[n];
+						}
+					}
+					// Heterogeneous block, gather column of the block
+					else
+					{
+						int *column;
+						column = matrix->blockData[n] + b2 + bs * bs * k;
+						for( j = 0 ; j < ey ; j++ )
+						{
+							row[j] = column[ bs * j ];
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// Accumulate value, repeated count times, into o[0..n-1] with op (projection kernel)
+void sparIntProjectValue( double *o, int n, int value, int count, int op, int def )
+{
+	int i;
+	switch( op )
+	{
+		case SPAR_ADD:
+			for( i = 0 ; i < n ; i++ )
+			{
+				o[i] += (double)( value ) * count;
+			}
+			break;
+		case SPAR_MIN:
+			for( i = 0 ; i < n ; i++ )
+			{
+				o[i] = value < o[i] ? value : o[i];
+			}
+			break;
+		case SPAR_MAX:
+			for( i = 0 ; i < n ; i++ )
+			{
+				o[i] = value > o[i] ? value : o[i];
+			}
+			break;
+		case SPAR_COUNT:
+			if( sparIntEqual( value, def ) == 0 )
+			{
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] += count;
+				}
+			}
+			break;
+	}
+}
+
+// Accumulate row[0..n-1] into o[0..n-1], or into o[0] if reduce, with op (projection kernel)
+void sparIntProjectRow( double *o, int *row, int n, int op, int reduce, int def )
+{
+	int i;
+
+	// Row along the projection axis
+	if( reduce )
+	{
+		double value;
+		value = o[0];
+		switch( op )
+		{
+			case SPAR_ADD:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value += row[i];
+				}
+				break;
+			case SPAR_MIN:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value = row[i] < value ? row[i] : value;
+				}
+				break;
+			case SPAR_MAX:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value = row[i] > value ? row[i] : value;
+				}
+				break;
+			case SPAR_COUNT:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value += ( sparIntEqual( row[i], def ) == 0 );
+				}
+				break;
+		}
+		o[0] = value;
+	}
+	// Row across the projection axis
+	else
+	{
+		switch( op )
+		{
+			case SPAR_ADD:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] += row[i];
+				}
+				break;
+			case SPAR_MIN:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] = row[i] < o[i] ? row[i] : o[i];
+				}
+				break;
+			case SPAR_MAX:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] = row[i] > o[i] ? row[i] : o[i];
+				}
+				break;
+			case SPAR_COUNT:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] += ( sparIntEqual( row[i], def ) == 0 );
+				}
+				break;
+		}
+	}
+}
+
+// Project along axis with op (SPAR_ADD, SPAR_MIN, SPAR_MAX, SPAR_COUNT) into dense plane, same layout as slices
+void sparIntProject( sparInt *matrix, int axis, int op, double *buffer )
+{
+	// Check axis and operation
+	if( axis < 0 || axis > 2 )
+	{
+		fprintf(stderr, "sparIntProject error: Invalid axis\n");
+		exit(1);
+	}
+
+	if( op != SPAR_ADD && op != SPAR_MIN && op != SPAR_MAX && op != SPAR_COUNT )
+	{
+		fprintf(stderr, "sparIntProject error: Unknown operation\n");
+		exit(1);
+	}
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Matrix size (nx,ny,nz)
+	int nx, ny, nz;
+	nx = matrix->nx;
+	ny = matrix->ny;
+	nz = matrix->nz;
+
+	// Plane size (pa,pb), plane and axis block sizes (ma,mb,mc)
+	int pa, pb, ma, mb, mc;
+	pa = axis == 0 ? ny : nx;
+	pb = axis == 2 ? ny : nz;
+	ma = axis == 0 ? matrix->my : matrix->mx;
+	mb = axis == 2 ? matrix->my : matrix->mz;
+	mc = axis == 0 ? matrix->mx : ( axis == 1 ? matrix->my : matrix->mz );
+
+	// Initial values
+	int i;
+	for( i = 0 ; i < pa * pb ; i++ )
+	{
+		buffer[i] = op == SPAR_MIN ? HUGE_VAL : ( op == SPAR_MAX ? -HUGE_VAL : 0.0 );
+	}
+
+	// For each output tile
+	int t;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( t = 0 ; t < ma * mb ; t++ )
+	{
+		int a1, b1, c1;
+		a1 = t % ma;
+		b1 = t / ma;
+
+		// Tile extent
+		int ea, eb;
+		ea = pa - a1 * bs < bs ? pa - a1 * bs : bs;
+		eb = pb - b1 * bs < bs ? pb - b1 * bs : bs;
+
+		// For each block along the axis
+		for( c1 = 0 ; c1 < mc ; c1++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = axis == 0 ? c1 : a1;
+			j1 = axis == 0 ? a1 : ( axis == 1 ? c1 : b1 );
+			k1 = axis == 2 ? c1 : b1;
+
+			// Linear block index (n) <-> (i1,j1,k1)
+			int n;
+			n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = nx - i1 * bs < bs ? nx - i1 * bs : bs;
+			ey = ny - j1 * bs < bs ? ny - j1 * bs : bs;
+			ez = nz - k1 * bs < bs ? nz - k1 * bs : bs;
+
+			int b, j, k;
+
+			// Uniform block, whole column of elements at once
+			if( matrix->blockData[n] == NULL )
+			{
+				for( b = 0 ; b < eb ; b++ )
+				{
+					sparIntProjectValue( buffer + a1 * bs + pa * ( b1 * bs + b ), ea, matrix->blockValue[n],
+									  axis == 0 ? ex : ( axis == 1 ? ey : ez ), op, matrix->def );
+				}
+			}
+			// Heterogeneous block, row by row
+			else
+			{
+				for( k = 0 ; k < ez ; k++ )
+				{
+					for( j = 0 ; j < ey ; j++ )
+					{
+						int *row;
+						row = matrix->blockData[n] + bs * ( j + bs * k );
+						if( axis == 0 )
+						{
+							sparIntProjectRow( buffer + ( j1 * bs + j ) + pa * ( k1 * bs + k ), row, ex, op, 1, matrix->def );
+						}
+						else if( axis == 1 )
+						{
+							sparIntProjectRow( buffer + i1 * bs + pa * ( k1 * bs + k ), row, ex, op, 0, matrix->def );
+						}
+						else
+						{
+							sparIntProjectRow( buffer + i1 * bs + pa * ( j1 * bs + j ), row, ex, op, 0, matrix->def );
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// Order of two elements for qsort, NaN last
+int sparIntCompare( const void *a, const void *b )
+{
+	int va, vb;
+	va = *(const int*) a;
+	vb = *(const int*) b;
+
+	// NaN after any number
+	if( isnan( (double) va ) || isnan( (double) vb ) )
+	{
+		return ( isnan( (double) va ) != 0 ) - ( isnan( (double) vb ) != 0 );
+	}
+
+	return ( va > vb ) - ( va < vb );
+}
+
+// Recompute blocks of dst overlapping box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) from factor^3 cells of src, op SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE
+void sparIntDownsampleBox( sparInt *dst, sparInt *src, int factor, int op, int x, int y, int z, int sx, int sy, int sz )
+{
+	// Check matrices
+	if( factor < 1 || dst->nx != ( src->nx + factor - 1 ) / factor ||
+		dst->ny != ( src->ny + factor - 1 ) / factor || dst->nz != ( src->nz + factor - 1 ) / factor )
+	{
+		fprintf(stderr, "sparIntDownsampleBox error: Matrix sizes do not match the factor\n");
+		exit(1);
+	}
+
+	if( op != SPAR_MEAN && op != SPAR_MIN && op != SPAR_MAX && op != SPAR_MODE )
+	{
+		fprintf(stderr, "sparIntDownsampleBox error: Unknown operation\n");
+		exit(1);
+	}
+
+	// Clip box to dst
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > dst->nx ? dst->nx : x + sx;
+	y1 = y + sy > dst->ny ? dst->ny : y + sy;
+	z1 = z + sz > dst->nz ? dst->nz : z + sz;
+
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	// Destination block size
+	int bs, bs3;
+	bs = dst->bs;
+	bs3 = dst->bs3;
+
+	// Source box size of one destination block
+	int cs;
+	cs = bs * factor;
+
+	// Range of destination blocks
+	int bx, by, bz, cx, cy, cz;
+	bx = x0 / bs;
+	by = y0 / bs;
+	bz = z0 / bs;
+	cx = ( x1 - 1 ) / bs - bx + 1;
+	cy = ( y1 - 1 ) / bs - by + 1;
+	cz = ( z1 - 1 ) / bs - bz + 1;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Source elements of one destination block and of one cell
+		int *buffer, *cell;
+		buffer = (int*) malloc( cs * cs * cs * sizeof(int) );
+		cell = (int*) malloc( factor * factor * factor * sizeof(int) );
+
+		if( buffer == NULL || cell == NULL )
+		{
+		   fprintf(stderr, "sparIntDownsampleBox error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each destination block
+		int t;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( t = 0 ; t < cx * cy * cz ; t++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = bx + t % cx;
+			j1 = by + ( t / cx ) % cy;
+			k1 = bz + t / ( cx * cy );
+
+			// Linear block index (n) <-> (i1,j1,k1)
+			int n;
+			n = i1 + dst->mx * ( j1 + dst->my * k1 );
+
+			// Free previous data
+			if( dst->blockData[n] != NULL )
+			{
+				free(dst->blockData[n]);
+				dst->blockData[n] = NULL;
+			}
+
+			// Uniform source region, uniform destination block
+			int value;
+			if( sparIntUniformBox( src, i1 * cs, j1 * cs, k1 * cs, cs, cs, cs, &value ) )
+			{
+				dst->blockValue[n] = value;
+				continue;
+			}
+
+			// Read source region
+			sparIntGetBox( src, i1 * cs, j1 * cs, k1 * cs, cs, cs, cs, buffer );
+
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = dst->nx - i1 * bs < bs ? dst->nx - i1 * bs : bs;
+			ey = dst->ny - j1 * bs < bs ? dst->ny - j1 * bs : bs;
+			ez = dst->nz - k1 * bs < bs ? dst->nz - k1 * bs : bs;
+
+			int *blockData;
+			blockData = (int*) calloc( bs3, sizeof(int) );
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparIntDownsampleBox error: Out of memory\n");
+			   exit(1);
+			}
+
+			// For each destination element
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					for( i = 0 ; i < ex ; i++ )
+					{
+						// Cell extent inside the source matrix
+						int fx, fy, fz;
+						fx = src->nx - ( i1 * bs + i ) * factor < factor ? src->nx - ( i1 * bs + i ) * factor : factor;
+						fy = src->ny - ( j1 * bs + j ) * factor < factor ? src->ny - ( j1 * bs + j ) * factor : factor;
+						fz = src->nz - ( k1 * bs + k ) * factor < factor ? src->nz - ( k1 * bs + k ) * factor : factor;
+
+						// Reduce cell, one tight loop per operation
+						int a, b, c, m;
+						int best, run;
+						double sum;
+						int *row, *r;
+						row = buffer + i * factor + cs * ( j * factor + cs * k * factor );
+						value = row[0];
+						switch( op )
+						{
+							case SPAR_MEAN:
+								sum = 0.0;
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											sum += r[a];
+										}
+									}
+								}
+								value = sparIntRound( sum / ( fx * fy * fz ) );
+								break;
+							case SPAR_MIN:
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											value = r[a] < value ? r[a] : value;
+										}
+									}
+								}
+								break;
+							case SPAR_MAX:
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											value = r[a] > value ? r[a] : value;
+										}
+									}
+								}
+								break;
+							case SPAR_MODE:
+								// Gather cell
+								m = 0;
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											cell[ m + a ] = r[a];
+										}
+										m += fx;
+									}
+								}
+
+								// Longest run of sorted values
+								qsort( cell, m, sizeof(int), sparIntCompare );
+								value = cell[0];
+								best = 0;
+								run = 0;
+								for( a = 0 ; a < m ; a++ )
+								{
+									run = ( a > 0 && sparIntEqual( cell[a], cell[ a - 1 ] ) ) ? run + 1 : 1;
+									if( run > best )
+									{
+										best = run;
+										value = cell[a];
+									}
+								}
+								break;
+						}
+
+						blockData[ i + bs * ( j + bs * k ) ] = value;
+					}
+				}
+			}
+
+			// Write block and reduce if possible
+			dst->blockData[n] = blockData;
+			sparIntReduceBlock( dst, i1, j1, k1 );
+		}
+
+		free(buffer);
+		free(cell);
+	}
+}
+
+// New matrix downsampled by factor with op (SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE)
+sparInt* sparIntDownsample( sparInt *matrix, int factor, int op )
+{
+	if( factor < 1 )
+	{
+		fprintf(stderr, "sparIntDownsample error: Factor must be positive\n");
+		exit(1);
+	}
+
+	// Declare matrix and init
+	sparInt *matrix2;
+	matrix2 = sparIntInit( ( matrix->nx + factor - 1 ) / factor, ( matrix->ny + factor - 1 ) / factor,
+						( matrix->nz + factor - 1 ) / factor, matrix->bs, matrix->def );
+
+	sparIntDownsampleBox( matrix2, matrix, factor, op, 0, 0, 0, matrix2->nx, matrix2->ny, matrix2->nz );
+
+	return matrix2;
+}
+
+// Pyramid of levels matrices downsampled by 2, 4, 8... with op (SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE)
+void sparIntPyramid( sparInt *matrix, int levels, int op, sparInt **pyramid )
+{
+	int l;
+	for( l = 0 ; l < levels ; l++ )
+	{
+		pyramid[l] = sparIntDownsample( l == 0 ? matrix : pyramid[ l - 1 ], 2, op );
+	}
+}
+
+// Update pyramid after changes of matrix in box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1)
+void sparIntPyramidUpdate( sparInt *matrix, int levels, int op, sparInt **pyramid, int x, int y, int z, int sx, int sy, int sz )
+{
+	int l;
+	for( l = 0 ; l < levels ; l++ )
+	{
+		// Affected box in the next level
+		int x1, y1, z1;
+		x1 = ( x + sx + 1 ) / 2;
+		y1 = ( y + sy + 1 ) / 2;
+		z1 = ( z + sz + 1 ) / 2;
+		x = x / 2;
+		y = y / 2;
+		z = z / 2;
+		sx = x1 - x;
+		sy = y1 - y;
+		sz = z1 - z;
+
+		sparIntDownsampleBox( pyramid[l], l == 0 ? matrix : pyramid[ l - 1 ], 2, op, x, y, z, sx, sy, sz );
+	}
+}
+
+// Trilinear interpolation at (x,y,z), element (i,j,k) at integer coordinates, clamped to the matrix bounds
+double sparIntSample( sparInt *matrix, double x, double y, double z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Matrix size
+	int size[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+
+	double p[3];
+	p[0] = x;
+	p[1] = y;
+	p[2] = z;
+
+	// Lower (v0) and upper (v1) corners and fractions per axis
+	int a, v0[3], v1[3];
+	double f[3];
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		double q;
+		q = p[a] < 0.0 ? 0.0 : ( p[a] > size[a] - 1 ? size[a] - 1 : p[a] );
+		v0[a] = (int)( floor( q ) );
+		v1[a] = v0[a] + 1 < size[a] ? v0[a] + 1 : v0[a];
+		f[a] = q - v0[a];
+	}
+
+	// Corner values
+	int c[8];
+
+	// All corners in one block
+	if( v0[0] / bs == v1[0] / bs && v0[1] / bs == v1[1] / bs && v0[2] / bs == v1[2] / bs )
+	{
+		// Linear block index (n)
+		int n;
+		n = v0[0] / bs + matrix->mx * ( v0[1] / bs + matrix->my * ( v0[2] / bs ) );
+
+		int *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block
+		if( blockData == NULL )
+		{
+			return (double) matrix->blockValue[n];
+		}
+
+		// Lower corner and steps in the block
+		int i, dx, dy, dz;
+		i = v0[0] % bs + bs * ( v0[1] % bs + bs * ( v0[2] % bs ) );
+		dx = v1[0] - v0[0];
+		dy = bs * ( v1[1] - v0[1] );
+		dz = bs * bs * ( v1[2] - v0[2] );
+
+		c[0] = blockData[i];
+		c[1] = blockData[ i + dx ];
+		c[2] = blockData[ i + dy ];
+		c[3] = blockData[ i + dx + dy ];
+		c[4] = blockData[ i + dz ];
+		c[5] = blockData[ i + dx + dz ];
+		c[6] = blockData[ i + dy + dz ];
+		c[7] = blockData[ i + dx + dy + dz ];
+	}
+	// Corners across blocks
+	else
+	{
+		c[0] = sparIntGet( matrix, v0[0], v0[1], v0[2] );
+		c[1] = sparIntGet( matrix, v1[0], v0[1], v0[2] );
+		c[2] = sparIntGet( matrix, v0[0], v1[1], v0[2] );
+		c[3] = sparIntGet( matrix, v1[0], v1[1], v0[2] );
+		c[4] = sparIntGet( matrix, v0[0], v0[1], v1[2] );
+		c[5] = sparIntGet( matrix, v1[0], v0[1], v1[2] );
+		c[6] = sparIntGet( matrix, v0[0], v1[1], v1[2] );
+		c[7] = sparIntGet( matrix, v1[0], v1[1], v1[2] );
+	}
+
+	// Interpolate along x, y and z
+	double c0, c1, c2, c3;
+	c0 = c[0] + f[0] * ( (double) c[1] - c[0] );
+	c1 = c[2] + f[0] * ( (double) c[3] - c[2] );
+	c2 = c[4] + f[0] * ( (double) c[5] - c[4] );
+	c3 = c[6] + f[0] * ( (double) c[7] - c[6] );
+	c0 = c0 + f[1] * ( c1 - c0 );
+	c2 = c2 + f[1] * ( c3 - c2 );
+
+	return c0 + f[2] * ( c2 - c0 );
+}
+
+// Trilinear interpolation at n points p[3*i] in parallel into values[i]
+void sparIntSamples( sparInt *matrix, int n, double *p, double *values )
+{
+	int i;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( i = 0 ; i < n ; i++ )
+	{
+		values[i] = sparIntSample( matrix, p[ 3 * i ], p[ 3 * i + 1 ], p[ 3 * i + 2 ] );
+	}
+}
+
+// Marching cubes triangle edges of cube case c (bit i set if corner i is above the iso value), return number of triangles
+int sparIntCubeTriangles( int c, int *edges )
+{
+	// Triangle edges per case, -1 terminated, counter-clockwise seen from below the iso value
+	static const signed char table[256][16] =
+	{
+		{ -1 },
+		{ 0, 3, 8, -1 },
+		{ 0, 9, 1, -1 },
+		{ 3, 8, 9, 1, 3, 9, -1 },
+		{ 1, 10, 2, -1 },
+		{ 0, 3, 8, 1, 10, 2, -1 },
+		{ 9, 10, 2, 0, 9, 2, -1 },
+		{ 8, 9, 10, 3, 8, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, -1 },
+		{ 2, 11, 8, 0, 2, 8, -1 },
+		{ 0, 9, 1, 2, 11, 3, -1 },
+		{ 11, 8, 9, 2, 11, 9, 1, 2, 9, -1 },
+		{ 10, 11, 3, 1, 10, 3, -1 },
+		{ 10, 11, 8, 1, 10, 8, 0, 1, 8, -1 },
+		{ 10, 11, 3, 9, 10, 3, 0, 9, 3, -1 },
+		{ 9, 10, 11, 8, 9, 11, -1 },
+		{ 4, 8, 7, -1 },
+		{ 3, 7, 4, 0, 3, 4, -1 },
+		{ 0, 9, 1, 4, 8, 7, -1 },
+		{ 7, 4, 9, 3, 7, 9, 1, 3, 9, -1 },
+		{ 1, 10, 2, 4, 8, 7, -1 },
+		{ 3, 7, 4, 0, 3, 4, 1, 10, 2, -1 },
+		{ 9, 10, 2, 0, 9, 2, 4, 8, 7, -1 },
+		{ 4, 9, 10, 7, 4, 10, 3, 7, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, 4, 8, 7, -1 },
+		{ 11, 7, 4, 2, 11, 4, 0, 2, 4, -1 },
+		{ 0, 9, 1, 2, 11, 3, 4, 8, 7, -1 },
+		{ 7, 4, 9, 11, 7, 9, 2, 11, 9, 1, 2, 9, -1 },
+		{ 10, 11, 3, 1, 10, 3, 4, 8, 7, -1 },
+		{ 11, 7, 4, 10, 11, 4, 1, 10, 4, 0, 1, 4, -1 },
+		{ 10, 11, 3, 9, 10, 3, 0, 9, 3, 4, 8, 7, -1 },
+		{ 10, 11, 7, 9, 10, 7, 4, 9, 7, -1 },
+		{ 4, 5, 9, -1 },
+		{ 0, 3, 8, 4, 5, 9, -1 },
+		{ 4, 5, 1, 0, 4, 1, -1 },
+		{ 8, 4, 5, 3, 8, 5, 1, 3, 5, -1 },
+		{ 1, 10, 2, 4, 5, 9, -1 },
+		{ 0, 3, 8, 1, 10, 2, 4, 5, 9, -1 },
+		{ 5, 10, 2, 4, 5, 2, 0, 4, 2, -1 },
+		{ 4, 5, 10, 8, 4, 10, 3, 8, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, 4, 5, 9, -1 },
+		{ 2, 11, 8, 0, 2, 8, 4, 5, 9, -1 },
+		{ 4, 5, 1, 0, 4, 1, 2, 11, 3, -1 },
+		{ 8, 4, 5, 11, 8, 5, 2, 11, 5, 1, 2, 5, -1 },
+		{ 10, 11, 3, 1, 10, 3, 4, 5, 9, -1 },
+		{ 10, 11, 8, 1, 10, 8, 0, 1, 8, 4, 5, 9, -1 },
+		{ 10, 11, 3, 5, 10, 3, 4, 5, 3, 0, 4, 3, -1 },
+		{ 10, 11, 8, 5, 10, 8, 4, 5, 8, -1 },
+		{ 9, 8, 7, 5, 9, 7, -1 },
+		{ 7, 5, 9, 3, 7, 9, 0, 3, 9, -1 },
+		{ 7, 5, 1, 8, 7, 1, 0, 8, 1, -1 },
+		{ 3, 7, 5, 1, 3, 5, -1 },
+		{ 1, 10, 2, 9, 8, 7, 5, 9, 7, -1 },
+		{ 7, 5, 9, 3, 7, 9, 0, 3, 9, 1, 10, 2, -1 },
+		{ 5, 10, 2, 7, 5, 2, 8, 7, 2, 0, 8, 2, -1 },
+		{ 7, 5, 10, 3, 7, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, 9, 8, 7, 5, 9, 7, -1 },
+		{ 7, 5, 9, 11, 7, 9, 2, 11, 9, 0, 2, 9, -1 },
+		{ 7, 5, 1, 8, 7, 1, 0, 8, 1, 2, 11, 3, -1 },
+		{ 11, 7, 5, 2, 11, 5, 1, 2, 5, -1 },
+		{ 10, 11, 3, 1, 10, 3, 9, 8, 7, 5, 9, 7, -1 },
+		{ 1, 10, 11, 0, 1, 11, 7, 5, 9, 11, 7, 9, 0, 11, 9, -1 },
+		{ 8, 7, 5, 0, 8, 5, 10, 11, 3, 5, 10, 3, 0, 5, 3, -1 },
+		{ 10, 11, 7, 5, 10, 7, -1 },
+		{ 5, 6, 10, -1 },
+		{ 0, 3, 8, 5, 6, 10, -1 },
+		{ 0, 9, 1, 5, 6, 10, -1 },
+		{ 3, 8, 9, 1, 3, 9, 5, 6, 10, -1 },
+		{ 5, 6, 2, 1, 5, 2, -1 },
+		{ 0, 3, 8, 5, 6, 2, 1, 5, 2, -1 },
+		{ 5, 6, 2, 9, 5, 2, 0, 9, 2, -1 },
+		{ 9, 5, 6, 8, 9, 6, 3, 8, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 5, 6, 10, -1 },
+		{ 2, 11, 8, 0, 2, 8, 5, 6, 10, -1 },
+		{ 0, 9, 1, 2, 11, 3, 5, 6, 10, -1 },
+		{ 11, 8, 9, 2, 11, 9, 1, 2, 9, 5, 6, 10, -1 },
+		{ 6, 11, 3, 5, 6, 3, 1, 5, 3, -1 },
+		{ 6, 11, 8, 5, 6, 8, 1, 5, 8, 0, 1, 8, -1 },
+		{ 6, 11, 3, 5, 6, 3, 9, 5, 3, 0, 9, 3, -1 },
+		{ 11, 8, 9, 6, 11, 9, 5, 6, 9, -1 },
+		{ 4, 8, 7, 5, 6, 10, -1 },
+		{ 3, 7, 4, 0, 3, 4, 5, 6, 10, -1 },
+		{ 0, 9, 1, 4, 8, 7, 5, 6, 10, -1 },
+		{ 7, 4, 9, 3, 7, 9, 1, 3, 9, 5, 6, 10, -1 },
+		{ 5, 6, 2, 1, 5, 2, 4, 8, 7, -1 },
+		{ 3, 7, 4, 0, 3, 4, 5, 6, 2, 1, 5, 2, -1 },
+		{ 5, 6, 2, 9, 5, 2, 0, 9, 2, 4, 8, 7, -1 },
+		{ 7, 4, 9, 3, 7, 9, 9, 5, 6, 3, 9, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 4, 8, 7, 5, 6, 10, -1 },
+		{ 11, 7, 4, 2, 11, 4, 0, 2, 4, 5, 6, 10, -1 },
+		{ 0, 9, 1, 2, 11, 3, 4, 8, 7, 5, 6, 10, -1 },
+		{ 7, 4, 9, 11, 7, 9, 2, 11, 9, 1, 2, 9, 5, 6, 10, -1 },
+		{ 6, 11, 3, 5, 6, 3, 1, 5, 3, 4, 8, 7, -1 },
+		{ 5, 6, 11, 1, 5, 11, 11, 7, 4, 1, 11, 4, 0, 1, 4, -1 },
+		{ 6, 11, 3, 5, 6, 3, 9, 5, 3, 0, 9, 3, 4, 8, 7, -1 },
+		{ 5, 6, 11, 9, 5, 11, 9, 11, 7, 4, 9, 7, -1 },
+		{ 6, 10, 9, 4, 6, 9, -1 },
+		{ 0, 3, 8, 6, 10, 9, 4, 6, 9, -1 },
+		{ 6, 10, 1, 4, 6, 1, 0, 4, 1, -1 },
+		{ 4, 6, 10, 8, 4, 10, 3, 8, 10, 1, 3, 10, -1 },
+		{ 4, 6, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 0, 3, 8, 4, 6, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 4, 6, 2, 0, 4, 2, -1 },
+		{ 8, 4, 6, 3, 8, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 6, 10, 9, 4, 6, 9, -1 },
+		{ 2, 11, 8, 0, 2, 8, 6, 10, 9, 4, 6, 9, -1 },
+		{ 6, 10, 1, 4, 6, 1, 0, 4, 1, 2, 11, 3, -1 },
+		{ 2, 11, 8, 1, 2, 8, 4, 6, 10, 8, 4, 10, 1, 8, 10, -1 },
+		{ 6, 11, 3, 4, 6, 3, 9, 4, 3, 1, 9, 3, -1 },
+		{ 9, 4, 6, 1, 9, 6, 6, 11, 8, 1, 6, 8, 0, 1, 8, -1 },
+		{ 6, 11, 3, 4, 6, 3, 0, 4, 3, -1 },
+		{ 6, 11, 8, 4, 6, 8, -1 },
+		{ 9, 8, 7, 10, 9, 7, 6, 10, 7, -1 },
+		{ 6, 10, 9, 7, 6, 9, 3, 7, 9, 0, 3, 9, -1 },
+		{ 6, 10, 1, 7, 6, 1, 8, 7, 1, 0, 8, 1, -1 },
+		{ 7, 6, 10, 3, 7, 10, 1, 3, 10, -1 },
+		{ 7, 6, 2, 8, 7, 2, 9, 8, 2, 1, 9, 2, -1 },
+		{ 2, 1, 9, 6, 2, 9, 7, 6, 9, 3, 7, 9, 0, 3, 9, -1 },
+		{ 7, 6, 2, 8, 7, 2, 0, 8, 2, -1 },
+		{ 3, 7, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 9, 8, 7, 10, 9, 7, 6, 10, 7, -1 },
+		{ 6, 10, 9, 7, 6, 9, 11, 7, 9, 2, 11, 9, 0, 2, 9, -1 },
+		{ 6, 10, 1, 7, 6, 1, 8, 7, 1, 0, 8, 1, 2, 11, 3, -1 },
+		{ 2, 11, 7, 1, 2, 7, 7, 6, 10, 1, 7, 10, -1 },
+		{ 8, 7, 6, 9, 8, 6, 6, 11, 3, 9, 6, 3, 1, 9, 3, -1 },
+		{ 0, 1, 9, 6, 11, 7, -1 },
+		{ 8, 7, 6, 0, 8, 6, 6, 11, 3, 0, 6, 3, -1 },
+		{ 6, 11, 7, -1 },
+		{ 6, 7, 11, -1 },
+		{ 0, 3, 8, 6, 7, 11, -1 },
+		{ 0, 9, 1, 6, 7, 11, -1 },
+		{ 3, 8, 9, 1, 3, 9, 6, 7, 11, -1 },
+		{ 1, 10, 2, 6, 7, 11, -1 },
+		{ 0, 3, 8, 1, 10, 2, 6, 7, 11, -1 },
+		{ 9, 10, 2, 0, 9, 2, 6, 7, 11, -1 },
+		{ 8, 9, 10, 3, 8, 10, 2, 3, 10, 6, 7, 11, -1 },
+		{ 6, 7, 3, 2, 6, 3, -1 },
+		{ 6, 7, 8, 2, 6, 8, 0, 2, 8, -1 },
+		{ 0, 9, 1, 6, 7, 3, 2, 6, 3, -1 },
+		{ 7, 8, 9, 6, 7, 9, 2, 6, 9, 1, 2, 9, -1 },
+		{ 6, 7, 3, 10, 6, 3, 1, 10, 3, -1 },
+		{ 6, 7, 8, 10, 6, 8, 1, 10, 8, 0, 1, 8, -1 },
+		{ 6, 7, 3, 10, 6, 3, 9, 10, 3, 0, 9, 3, -1 },
+		{ 8, 9, 10, 7, 8, 10, 6, 7, 10, -1 },
+		{ 8, 11, 6, 4, 8, 6, -1 },
+		{ 11, 6, 4, 3, 11, 4, 0, 3, 4, -1 },
+		{ 0, 9, 1, 8, 11, 6, 4, 8, 6, -1 },
+		{ 6, 4, 9, 11, 6, 9, 3, 11, 9, 1, 3, 9, -1 },
+		{ 1, 10, 2, 8, 11, 6, 4, 8, 6, -1 },
+		{ 11, 6, 4, 3, 11, 4, 0, 3, 4, 1, 10, 2, -1 },
+		{ 9, 10, 2, 0, 9, 2, 8, 11, 6, 4, 8, 6, -1 },
+		{ 11, 6, 4, 3, 11, 4, 4, 9, 10, 3, 4, 10, 2, 3, 10, -1 },
+		{ 4, 8, 3, 6, 4, 3, 2, 6, 3, -1 },
+		{ 2, 6, 4, 0, 2, 4, -1 },
+		{ 0, 9, 1, 4, 8, 3, 6, 4, 3, 2, 6, 3, -1 },
+		{ 6, 4, 9, 2, 6, 9, 1, 2, 9, -1 },
+		{ 4, 8, 3, 6, 4, 3, 10, 6, 3, 1, 10, 3, -1 },
+		{ 10, 6, 4, 1, 10, 4, 0, 1, 4, -1 },
+		{ 4, 8, 3, 6, 4, 3, 10, 6, 3, 9, 10, 3, 0, 9, 3, -1 },
+		{ 9, 10, 6, 4, 9, 6, -1 },
+		{ 4, 5, 9, 6, 7, 11, -1 },
+		{ 0, 3, 8, 4, 5, 9, 6, 7, 11, -1 },
+		{ 4, 5, 1, 0, 4, 1, 6, 7, 11, -1 },
+		{ 8, 4, 5, 3, 8, 5, 1, 3, 5, 6, 7, 11, -1 },
+		{ 1, 10, 2, 4, 5, 9, 6, 7, 11, -1 },
+		{ 0, 3, 8, 1, 10, 2, 4, 5, 9, 6, 7, 11, -1 },
+		{ 5, 10, 2, 4, 5, 2, 0, 4, 2, 6, 7, 11, -1 },
+		{ 4, 5, 10, 8, 4, 10, 3, 8, 10, 2, 3, 10, 6, 7, 11, -1 },
+		{ 6, 7, 3, 2, 6, 3, 4, 5, 9, -1 },
+		{ 6, 7, 8, 2, 6, 8, 0, 2, 8, 4, 5, 9, -1 },
+		{ 4, 5, 1, 0, 4, 1, 6, 7, 3, 2, 6, 3, -1 },
+		{ 6, 7, 8, 2, 6, 8, 8, 4, 5, 2, 8, 5, 1, 2, 5, -1 },
+		{ 6, 7, 3, 10, 6, 3, 1, 10, 3, 4, 5, 9, -1 },
+		{ 6, 7, 8, 10, 6, 8, 1, 10, 8, 0, 1, 8, 4, 5, 9, -1 },
+		{ 6, 7, 3, 10, 6, 3, 5, 10, 3, 4, 5, 3, 0, 4, 3, -1 },
+		{ 6, 7, 8, 10, 6, 8, 5, 10, 8, 4, 5, 8, -1 },
+		{ 8, 11, 6, 9, 8, 6, 5, 9, 6, -1 },
+		{ 6, 5, 9, 11, 6, 9, 3, 11, 9, 0, 3, 9, -1 },
+		{ 6, 5, 1, 11, 6, 1, 8, 11, 1, 0, 8, 1, -1 },
+		{ 11, 6, 5, 3, 11, 5, 1, 3, 5, -1 },
+		{ 1, 10, 2, 8, 11, 6, 9, 8, 6, 5, 9, 6, -1 },
+		{ 6, 5, 9, 11, 6, 9, 3, 11, 9, 0, 3, 9, 1, 10, 2, -1 },
+		{ 11, 6, 5, 8, 11, 5, 5, 10, 2, 8, 5, 2, 0, 8, 2, -1 },
+		{ 11, 6, 5, 3, 11, 5, 3, 5, 10, 2, 3, 10, -1 },
+		{ 9, 8, 3, 5, 9, 3, 6, 5, 3, 2, 6, 3, -1 },
+		{ 6, 5, 9, 2, 6, 9, 0, 2, 9, -1 },
+		{ 3, 2, 6, 8, 3, 6, 6, 5, 1, 8, 6, 1, 0, 8, 1, -1 },
+		{ 2, 6, 5, 1, 2, 5, -1 },
+		{ 9, 8, 3, 5, 9, 3, 6, 5, 3, 10, 6, 3, 1, 10, 3, -1 },
+		{ 1, 10, 6, 0, 1, 6, 6, 5, 9, 0, 6, 9, -1 },
+		{ 0, 8, 3, 5, 10, 6, -1 },
+		{ 5, 10, 6, -1 },
+		{ 7, 11, 10, 5, 7, 10, -1 },
+		{ 0, 3, 8, 7, 11, 10, 5, 7, 10, -1 },
+		{ 0, 9, 1, 7, 11, 10, 5, 7, 10, -1 },
+		{ 3, 8, 9, 1, 3, 9, 7, 11, 10, 5, 7, 10, -1 },
+		{ 7, 11, 2, 5, 7, 2, 1, 5, 2, -1 },
+		{ 0, 3, 8, 7, 11, 2, 5, 7, 2, 1, 5, 2, -1 },
+		{ 7, 11, 2, 5, 7, 2, 9, 5, 2, 0, 9, 2, -1 },
+		{ 3, 8, 9, 2, 3, 9, 5, 7, 11, 9, 5, 11, 2, 9, 11, -1 },
+		{ 5, 7, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 5, 7, 8, 10, 5, 8, 2, 10, 8, 0, 2, 8, -1 },
+		{ 0, 9, 1, 5, 7, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 10, 5, 7, 2, 10, 7, 7, 8, 9, 2, 7, 9, 1, 2, 9, -1 },
+		{ 5, 7, 3, 1, 5, 3, -1 },
+		{ 5, 7, 8, 1, 5, 8, 0, 1, 8, -1 },
+		{ 5, 7, 3, 9, 5, 3, 0, 9, 3, -1 },
+		{ 7, 8, 9, 5, 7, 9, -1 },
+		{ 11, 10, 5, 8, 11, 5, 4, 8, 5, -1 },
+		{ 10, 5, 4, 11, 10, 4, 3, 11, 4, 0, 3, 4, -1 },
+		{ 0, 9, 1, 11, 10, 5, 8, 11, 5, 4, 8, 5, -1 },
+		{ 10, 5, 4, 11, 10, 4, 11, 4, 9, 3, 11, 9, 1, 3, 9, -1 },
+		{ 8, 11, 2, 4, 8, 2, 5, 4, 2, 1, 5, 2, -1 },
+		{ 1, 5, 4, 2, 1, 4, 11, 2, 4, 3, 11, 4, 0, 3, 4, -1 },
+		{ 8, 11, 2, 4, 8, 2, 5, 4, 2, 9, 5, 2, 0, 9, 2, -1 },
+		{ 2, 3, 11, 4, 9, 5, -1 },
+		{ 4, 8, 3, 5, 4, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 10, 5, 4, 2, 10, 4, 0, 2, 4, -1 },
+		{ 0, 9, 1, 4, 8, 3, 5, 4, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 10, 5, 4, 2, 10, 4, 2, 4, 9, 1, 2, 9, -1 },
+		{ 4, 8, 3, 5, 4, 3, 1, 5, 3, -1 },
+		{ 1, 5, 4, 0, 1, 4, -1 },
+		{ 4, 8, 3, 5, 4, 3, 9, 5, 3, 0, 9, 3, -1 },
+		{ 4, 9, 5, -1 },
+		{ 11, 10, 9, 7, 11, 9, 4, 7, 9, -1 },
+		{ 0, 3, 8, 11, 10, 9, 7, 11, 9, 4, 7, 9, -1 },
+		{ 11, 10, 1, 7, 11, 1, 4, 7, 1, 0, 4, 1, -1 },
+		{ 7, 11, 10, 4, 7, 10, 8, 4, 10, 3, 8, 10, 1, 3, 10, -1 },
+		{ 7, 11, 2, 4, 7, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 0, 3, 8, 7, 11, 2, 4, 7, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 7, 11, 2, 4, 7, 2, 0, 4, 2, -1 },
+		{ 3, 8, 4, 2, 3, 4, 4, 7, 11, 2, 4, 11, -1 },
+		{ 4, 7, 3, 9, 4, 3, 10, 9, 3, 2, 10, 3, -1 },
+		{ 9, 4, 7, 10, 9, 7, 10, 7, 8, 2, 10, 8, 0, 2, 8, -1 },
+		{ 3, 2, 10, 7, 3, 10, 7, 10, 1, 4, 7, 1, 0, 4, 1, -1 },
+		{ 1, 2, 10, 4, 7, 8, -1 },
+		{ 4, 7, 3, 9, 4, 3, 1, 9, 3, -1 },
+		{ 9, 4, 7, 1, 9, 7, 1, 7, 8, 0, 1, 8, -1 },
+		{ 4, 7, 3, 0, 4, 3, -1 },
+		{ 4, 7, 8, -1 },
+		{ 11, 10, 9, 8, 11, 9, -1 },
+		{ 11, 10, 9, 3, 11, 9, 0, 3, 9, -1 },
+		{ 11, 10, 1, 8, 11, 1, 0, 8, 1, -1 },
+		{ 3, 11, 10, 1, 3, 10, -1 },
+		{ 8, 11, 2, 9, 8, 2, 1, 9, 2, -1 },
+		{ 2, 1, 9, 11, 2, 9, 3, 11, 9, 0, 3, 9, -1 },
+		{ 8, 11, 2, 0, 8, 2, -1 },
+		{ 2, 3, 11, -1 },
+		{ 9, 8, 3, 10, 9, 3, 2, 10, 3, -1 },
+		{ 2, 10, 9, 0, 2, 9, -1 },
+		{ 3, 2, 10, 8, 3, 10, 8, 10, 1, 0, 8, 1, -1 },
+		{ 1, 2, 10, -1 },
+		{ 9, 8, 3, 1, 9, 3, -1 },
+		{ 0, 1, 9, -1 },
+		{ 0, 8, 3, -1 },
+		{ -1 }
+	};
+
+	int i;
+	for( i = 0 ; table[c][i] >= 0 ; i++ )
+	{
+		edges[i] = table[c][i];
+	}
+
+	return i / 3;
+}
+
+// Order of two edge keys for qsort
+int sparIntCompareKey( const void *a, const void *b )
+{
+	long long ka, kb;
+	ka = *(const long long*) a;
+	kb = *(const long long*) b;
+	return ( ka > kb ) - ( ka < kb );
+}
+
+// Marching cubes isosurface at iso into vertices[3*i] and triangles[3*j] (malloc, free after use), nt triangles, return number of vertices
+int sparIntIsosurface( sparInt *matrix, double iso, double **vertices, int **triangles, int *nt )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Matrix size
+	int nx, ny, nz;
+	nx = matrix->nx;
+	ny = matrix->ny;
+	nz = matrix->nz;
+
+	// Cube corner offsets, and edge lower corner offset and axis
+	static const int corner[8][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 },
+									  { 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 } };
+	static const int edge[12][4] = { { 0, 0, 0, 0 }, { 1, 0, 0, 1 }, { 0, 1, 0, 0 }, { 0, 0, 0, 1 },
+									 { 0, 0, 1, 0 }, { 1, 0, 1, 1 }, { 0, 1, 1, 0 }, { 0, 0, 1, 1 },
+									 { 0, 0, 0, 2 }, { 1, 0, 0, 2 }, { 1, 1, 0, 2 }, { 0, 1, 0, 2 } };
+
+	// Triangle edge keys and triangle count per block
+	int nb;
+	nb = matrix->mx * matrix->my * matrix->mz;
+
+	long long **keys;
+	int *count;
+	keys = (long long**) calloc( nb, sizeof(long long*) );
+	count = (int*) calloc( nb, sizeof(int) );
+
+	if( keys == NULL || count == NULL )
+	{
+	   fprintf(stderr, "sparIntIsosurface error: Out of memory\n");
+	   exit(1);
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block corners, including the next block first plane on each axis
+		int s;
+		int *buffer;
+		s = bs + 1;
+		buffer = (int*) malloc( s * s * s * sizeof(int) );
+
+		if( buffer == NULL )
+		{
+		   fprintf(stderr, "sparIntIsosurface error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < nb ; n++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = n % matrix->mx;
+			j1 = ( n / matrix->mx ) % matrix->my;
+			k1 = n / ( matrix->mx * matrix->my );
+
+			// Cells with lower corner in the block
+			int ex, ey, ez;
+			ex = nx - 1 - i1 * bs < bs ? nx - 1 - i1 * bs : bs;
+			ey = ny - 1 - j1 * bs < bs ? ny - 1 - j1 * bs : bs;
+			ez = nz - 1 - k1 * bs < bs ? nz - 1 - k1 * bs : bs;
+
+			if( ex <= 0 || ey <= 0 || ez <= 0 )
+			{
+				continue;
+			}
+
+			// Uniform corners, no crossing
+			int value;
+			if( sparIntUniformBox( matrix, i1 * bs, j1 * bs, k1 * bs, s, s, s, &value ) )
+			{
+				continue;
+			}
+
+			sparIntGetBox( matrix, i1 * bs, j1 * bs, k1 * bs, s, s, s, buffer );
+
+			// Corner offsets in the buffer
+			int offset[8], c;
+			for( c = 0 ; c < 8 ; c++ )
+			{
+				offset[c] = corner[c][0] + s * ( corner[c][1] + s * corner[c][2] );
+			}
+
+			int size;
+			size = 0;
+
+			// For each cell
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					for( i = 0 ; i < ex ; i++ )
+					{
+						// Cube case
+						int *cell;
+						int cube;
+						cell = buffer + i + s * ( j + s * k );
+						cube = 0;
+						for( c = 0 ; c < 8 ; c++ )
+						{
+							cube |= ( cell[ offset[c] ] > iso ) << c;
+						}
+
+						if( cube == 0 || cube == 255 )
+						{
+							continue;
+						}
+
+						int edges[15], t;
+						t = sparIntCubeTriangles( cube, edges );
+
+						// Grow keys
+						if( ( count[n] + t ) * 3 > size )
+						{
+							size = size == 0 ? 48 : 2 * size;
+							keys[n] = (long long*) realloc( keys[n], size * sizeof(long long) );
+
+							if( keys[n] == NULL )
+							{
+							   fprintf(stderr, "sparIntIsosurface error: Out of memory\n");
+							   exit(1);
+							}
+						}
+
+						// Edge key of lower element (x,y,z) and axis a, 3*(x+nx*(y+ny*z))+a
+						for( c = 0 ; c < 3 * t ; c++ )
+						{
+							const int *e;
+							e = edge[ edges[c] ];
+							keys[n][ 3 * count[n] + c ] = 3 * ( i1 * bs + i + e[0] + nx *
+								( j1 * bs + j + e[1] + (long long) ny * ( k1 * bs + k + e[2] ) ) ) + e[3];
+						}
+						count[n] += t;
+					}
+				}
+			}
+		}
+
+		free(buffer);
+	}
+
+	// Triangle offset per block
+	int m, total;
+	total = 0;
+	for( m = 0 ; m < nb ; m++ )
+	{
+		int c;
+		c = count[m];
+		count[m] = total;
+		total += c;
+	}
+	*nt = total;
+
+	if( total == 0 )
+	{
+		free(keys);
+		free(count);
+		*vertices = NULL;
+		*triangles = NULL;
+		return 0;
+	}
+
+	// All edge keys, then sorted unique keys as vertices
+	long long *all, *unique;
+	all = (long long*) malloc( 3 * total * sizeof(long long) );
+	unique = (long long*) malloc( 3 * total * sizeof(long long) );
+
+	if( all == NULL || unique == NULL )
+	{
+	   fprintf(stderr, "sparIntIsosurface error: Out of memory\n");
+	   exit(1);
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( m = 0 ; m < nb ; m++ )
+	{
+		if( keys[m] != NULL )
+		{
+			int c;
+			c = ( m + 1 < nb ? count[ m + 1 ] : total ) - count[m];
+			memcpy( all + 3 * count[m], keys[m], 3 * c * sizeof(long long) );
+			free(keys[m]);
+		}
+	}
+	free(keys);
+	free(count);
+
+	memcpy( unique, all, 3 * total * sizeof(long long) );
+	qsort( unique, 3 * total, sizeof(long long), sparIntCompareKey );
+
+	int nv;
+	nv = 1;
+	for( m = 1 ; m < 3 * total ; m++ )
+	{
+		if( unique[m] != unique[ nv - 1 ] )
+		{
+			unique[ nv++ ] = unique[m];
+		}
+	}
+
+	*vertices = (double*) malloc( 3 * nv * sizeof(double) );
+	*triangles = (int*) malloc( 3 * total * sizeof(int) );
+
+	if( *vertices == NULL || *triangles == NULL )
+	{
+	   fprintf(stderr, "sparIntIsosurface error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Vertex on edge by linear interpolation
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( m = 0 ; m < nv ; m++ )
+	{
+		// Lower element (x,y,z) and axis a
+		int a, p[3];
+		long long key;
+		key = unique[m] / 3;
+		a = (int)( unique[m] % 3 );
+		p[0] = (int)( key % nx );
+		p[1] = (int)( ( key / nx ) % ny );
+		p[2] = (int)( key / ( (long long) nx * ny ) );
+
+		double v0, v1, t;
+		v0 = sparIntGet( matrix, p[0], p[1], p[2] );
+		v1 = sparIntGet( matrix, p[0] + ( a == 0 ), p[1] + ( a == 1 ), p[2] + ( a == 2 ) );
+		t = ( iso - v0 ) / ( v1 - v0 );
+
+		(*vertices)[ 3 * m ] = p[0] + ( a == 0 ) * t;
+		(*vertices)[ 3 * m + 1 ] = p[1] + ( a == 1 ) * t;
+		(*vertices)[ 3 * m + 2 ] = p[2] + ( a == 2 ) * t;
+	}
+
+	// Triangle vertex indices
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( m = 0 ; m < 3 * total ; m++ )
+	{
+		long long *v;
+		v = (long long*) bsearch( all + m, unique, nv, sizeof(long long), sparIntCompareKey );
+		(*triangles)[m] = (int)( v - unique );
+	}
+
+	free(all);
+	free(unique);
+
+	return nv;
+}
+
+// Copy block (i,j,k) of src into block (x,y,z) of dst, same block size
+void sparIntCopyBlock( sparInt *dst, int x, int y, int z, sparInt *src, int i, int j, int k )
+{
+	// Linear block indices
+	int n, m;
+	n = x + dst->mx * ( y + dst->my * z );
+	m = i + src->mx * ( j + src->my * k );
+
+	// Uniform block
+	if( src->blockData[m] == NULL )
+	{
+		if( dst->blockData[n] != NULL )
+		{
+			free(dst->blockData[n]);
+			dst->blockData[n] = NULL;
+		}
+		dst->blockValue[n] = src->blockValue[m];
+		return;
+	}
+
+	// Heterogeneous block, reuse destination data if any
+	if( dst->blockData[n] == NULL )
+	{
+		dst->blockData[n] = (int*) malloc( dst->bs3 * sizeof(int) );
+
+		if( dst->blockData[n] == NULL )
+		{
+		   fprintf(stderr, "sparIntCopyBlock error: Out of memory\n");
+		   exit(1);
+		}
+	}
+
+	memcpy( dst->blockData[n], src->blockData[m], dst->bs3 * sizeof(int) );
+
+	// Boundary block may become uniform inside the matrix
+	if( x == dst->mx - 1 || y == dst->my - 1 || z == dst->mz - 1 )
+	{
+		sparIntReduceBlock( dst, x, y, z );
+	}
+}
+
+// New matrix with box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1), elements outside the matrix set to default, ring buffer origin reset
+sparInt* sparIntCrop( sparInt *matrix, int x, int y, int z, int sx, int sy, int sz )
+{
+	// Declare matrix and init
+	sparInt *matrix2;
+	matrix2 = sparIntInit( sx, sy, sz, matrix->bs, matrix->def );
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Box aligned with source blocks
+	int aligned;
+	aligned = x >= 0 && y >= 0 && z >= 0 && x % bs == 0 && y % bs == 0 && z % bs == 0;
+
+	// Number of blocks
+	int blocks;
+	blocks = matrix2->mx * matrix2->my * matrix2->mz;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		// Block (i1,j1,k1) and source box origin
+		int i1, j1, k1, x0, y0, z0;
+		i1 = n % matrix2->mx;
+		j1 = ( n / matrix2->mx ) % matrix2->my;
+		k1 = n / ( matrix2->mx * matrix2->my );
+		x0 = x + i1 * bs;
+		y0 = y + j1 * bs;
+		z0 = z + k1 * bs;
+
+		// Aligned source block covering the block elements inside the matrix, copy block
+		if( aligned && x0 < matrix->nx && y0 < matrix->ny && z0 < matrix->nz &&
+			matrix->nx - x0 >= ( sx - i1 * bs < bs ? sx - i1 * bs : bs ) &&
+			matrix->ny - y0 >= ( sy - j1 * bs < bs ? sy - j1 * bs : bs ) &&
+			matrix->nz - z0 >= ( sz - k1 * bs < bs ? sz - k1 * bs : bs ) )
+		{
+			sparIntCopyBlock( matrix2, i1, j1, k1, matrix, x0 / bs, y0 / bs, z0 / bs );
+			continue;
+		}
+
+		// Uniform source box
+		int value;
+		if( sparIntUniformBox( matrix, x0, y0, z0, bs, bs, bs, &value ) &&
+			x0 >= 0 && y0 >= 0 && z0 >= 0 && x0 + bs <= matrix->nx && y0 + bs <= matrix->ny && z0 + bs <= matrix->nz )
+		{
+			matrix2->blockValue[n] = value;
+			continue;
+		}
+
+		// Read source box rows into the block, reduce if possible
+		matrix2->blockData[n] = (int*) malloc( matrix2->bs3 * sizeof(int) );
+
+		if( matrix2->blockData[n] == NULL )
+		{
+		   fprintf(stderr, "sparIntCrop error: Out of memory\n");
+		   exit(1);
+		}
+
+		sparIntGetBox( matrix, x0, y0, z0, bs, bs, bs, matrix2->blockData[n] );
+		sparIntReduceBlock( matrix2, i1, j1, k1 );
+	}
+
+	return matrix2;
+}
+
+// Write src into matrix at (x,y,z), clipped to the matrix
+void sparIntPaste( sparInt *matrix, sparInt *src, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + src->nx > matrix->nx ? matrix->nx : x + src->nx;
+	y1 = y + src->ny > matrix->ny ? matrix->ny : y + src->ny;
+	z1 = z + src->nz > matrix->nz ? matrix->nz : z + src->nz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	// Box aligned with blocks of the same size
+	int aligned;
+	aligned = src->bs == bs && x >= 0 && y >= 0 && z >= 0 && x % bs == 0 && y % bs == 0 && z % bs == 0;
+
+	// Range of blocks
+	int bx, by, bz, cx, cy, cz;
+	bx = x0 / bs;
+	by = y0 / bs;
+	bz = z0 / bs;
+	cx = ( x1 - 1 ) / bs - bx + 1;
+	cy = ( y1 - 1 ) / bs - by + 1;
+	cz = ( z1 - 1 ) / bs - bz + 1;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		int *buffer;
+		buffer = (int*) malloc( bs * bs * bs * sizeof(int) );
+
+		if( buffer == NULL )
+		{
+		   fprintf(stderr, "sparIntPaste error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each block overlapping the box
+		int t;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( t = 0 ; t < cx * cy * cz ; t++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = bx + t % cx;
+			j1 = by + ( t / cx ) % cy;
+			k1 = bz + t / ( cx * cy );
+
+			// Block and box intersection
+			int bx0, by0, bz0, bx1, by1, bz1;
+			bx0 = i1 * bs > x0 ? i1 * bs : x0;
+			by0 = j1 * bs > y0 ? j1 * bs : y0;
+			bz0 = k1 * bs > z0 ? k1 * bs : z0;
+			bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+			by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+			bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+			// Aligned block with elements inside the matrix fully covered, copy block
+			if( aligned && bx0 == i1 * bs && by0 == j1 * bs && bz0 == k1 * bs &&
+				( bx1 == ( i1 + 1 ) * bs || bx1 == matrix->nx ) &&
+				( by1 == ( j1 + 1 ) * bs || by1 == matrix->ny ) &&
+				( bz1 == ( k1 + 1 ) * bs || bz1 == matrix->nz ) )
+			{
+				sparIntCopyBlock( matrix, i1, j1, k1, src, i1 - x / bs, j1 - y / bs, k1 - z / bs );
+				continue;
+			}
+
+			// Copy intersection rows
+			sparIntGetBox( src, bx0 - x, by0 - y, bz0 - z, bx1 - bx0, by1 - by0, bz1 - bz0, buffer );
+			sparIntSetBox( matrix, bx0, by0, bz0, bx1 - bx0, by1 - by0, bz1 - bz0, buffer );
+		}
+
+		free(buffer);
+	}
+}
+
+// Shift contents by (dx,dy,dz), element (x,y,z) moves to (x+dx,y+dy,z+dz), vacated elements set to default
+void sparIntShift( sparInt *matrix, int dx, int dy, int dz )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Shift in blocks (qx,qy,qz) and remainder (rx,ry,rz), same sign so no data is dropped early
+	int qx, qy, qz, rx, ry, rz;
+	qx = dx / bs;
+	qy = dy / bs;
+	qz = dz / bs;
+	rx = dx % bs;
+	ry = dy % bs;
+	rz = dz % bs;
+
+	// Move blocks
+	if( qx != 0 || qy != 0 || qz != 0 )
+	{
+		// New block data
+		int *blockValue;
+		int **blockData;
+
+		int blocks;
+		blocks = mx * my * mz;
+		blockValue = (int*) calloc( blocks, sizeof(int) ); // Sets to 0s
+		blockData = (int**) calloc( blocks, sizeof(int*) ); // Sets to NULLs
+
+		if( blockValue == NULL || blockData == NULL )
+		{
+		   fprintf(stderr, "sparIntShift error: Out of memory\n");
+		   exit(1);
+		}
+
+		int i, j, k;
+		for( k = 0 ; k < mz ; k++ )
+		{
+			for( j = 0 ; j < my ; j++ )
+			{
+				for( i = 0 ; i < mx ; i++ )
+				{
+					// Source block
+					int i2, j2, k2, n;
+					i2 = i - qx;
+					j2 = j - qy;
+					k2 = k - qz;
+					n = i + mx * ( j + my * k );
+
+					if( i2 >= 0 && j2 >= 0 && k2 >= 0 && i2 < mx && j2 < my && k2 < mz )
+					{
+						int m;
+						m = i2 + mx * ( j2 + my * k2 );
+						blockValue[n] = matrix->blockValue[m];
+						blockData[n] = matrix->blockData[m];
+						matrix->blockData[m] = NULL;
+					}
+					else
+					{
+						blockValue[n] = matrix->def;
+					}
+				}
+			}
+		}
+
+		// Free blocks moved outside
+		for( i = 0 ; i < blocks ; i++ )
+		{
+			if( matrix->blockData[i] != NULL )
+			{
+				free(matrix->blockData[i]);
+			}
+		}
+
+		free(matrix->blockData);
+		free(matrix->blockValue);
+
+		matrix->blockData = blockData;
+		matrix->blockValue = blockValue;
+
+		// Previous boundary blocks moved inside, set outside elements to default
+		int ex, ey, ez;
+		ex = matrix->nx - ( mx - 1 ) * bs;
+		ey = matrix->ny - ( my - 1 ) * bs;
+		ez = matrix->nz - ( mz - 1 ) * bs;
+
+		if( ex < bs && qx < 0 && mx - 1 + qx >= 0 )
+		{
+			sparIntFillBox( matrix, ( mx - 1 + qx ) * bs + ex, 0, 0, bs - ex, matrix->ny, matrix->nz, matrix->def );
+		}
+		if( ey < bs && qy < 0 && my - 1 + qy >= 0 )
+		{
+			sparIntFillBox( matrix, 0, ( my - 1 + qy ) * bs + ey, 0, matrix->nx, bs - ey, matrix->nz, matrix->def );
+		}
+		if( ez < bs && qz < 0 && mz - 1 + qz >= 0 )
+		{
+			sparIntFillBox( matrix, 0, 0, ( mz - 1 + qz ) * bs + ez, matrix->nx, matrix->ny, bs - ez, matrix->def );
+		}
+
+		// Blocks moved to the boundary may be uniform inside the matrix
+		for( k = 0 ; k < mz ; k++ )
+		{
+			for( j = 0 ; j < my ; j++ )
+			{
+				for( i = 0 ; i < mx ; i++ )
+				{
+					if( ( i == mx - 1 && ex < bs && qx != 0 ) || ( j == my - 1 && ey < bs && qy != 0 ) ||
+						( k == mz - 1 && ez < bs && qz != 0 ) )
+					{
+						sparIntReduceBlock( matrix, i, j, k );
+					}
+				}
+			}
+		}
+	}
+
+	// Recombine blocks for the remainder
+	if( rx != 0 || ry != 0 || rz != 0 )
+	{
+		sparInt *shifted;
+		shifted = sparIntCrop( matrix, -rx, -ry, -rz, matrix->nx, matrix->ny, matrix->nz );
+
+		// Swap block data
+		int *blockValue;
+		int **blockData;
+		blockValue = matrix->blockValue;
+		blockData = matrix->blockData;
+		matrix->blockValue = shifted->blockValue;
+		matrix->blockData = shifted->blockData;
+		shifted->blockValue = blockValue;
+		shifted->blockData = blockData;
+
+		sparIntFree( shifted );
+	}
+}
+
+// Ring buffer index of world coordinate w in a ring of size n
+int sparIntRingIndex( int w, int n )
+{
+	return ( w % n + n ) % n;
+}
+
+// Set element at world coordinates (x,y,z) of the ring buffer window, ignored outside the window
+void sparIntRingSet( sparInt *matrix, int x, int y, int z, int value )
+{
+	if( x < matrix->ox || y < matrix->oy || z < matrix->oz ||
+		x >= matrix->ox + matrix->nx || y >= matrix->oy + matrix->ny || z >= matrix->oz + matrix->nz )
+	{
+		return;
+	}
+
+	sparIntSet( matrix, sparIntRingIndex( x, matrix->nx ), sparIntRingIndex( y, matrix->ny ), sparIntRingIndex( z, matrix->nz ), value );
+}
+
+// Get element at world coordinates (x,y,z) of the ring buffer window, default value outside the window
+int sparIntRingGet( sparInt *matrix, int x, int y, int z )
+{
+	if( x < matrix->ox || y < matrix->oy || z < matrix->oz ||
+		x >= matrix->ox + matrix->nx || y >= matrix->oy + matrix->ny || z >= matrix->oz + matrix->nz )
+	{
+		return matrix->def;
+	}
+
+	return sparIntGet( matrix, sparIntRingIndex( x, matrix->nx ), sparIntRingIndex( y, matrix->ny ), sparIntRingIndex( z, matrix->nz ) );
+}
+
+// Move the ring buffer window origin to world coordinates (x,y,z), elements entering the window set to default
+void sparIntRingMove( sparInt *matrix, int x, int y, int z )
+{
+	// Matrix size, previous and new origin
+	int size[3], o[3], p[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+	o[0] = matrix->ox;
+	o[1] = matrix->oy;
+	o[2] = matrix->oz;
+	p[0] = x;
+	p[1] = y;
+	p[2] = z;
+
+	// Window moved by at least its size on one axis, reset all
+	int a;
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		if( abs( p[a] - o[a] ) >= size[a] )
+		{
+			sparIntFillBox( matrix, 0, 0, 0, matrix->nx, matrix->ny, matrix->nz, matrix->def );
+			matrix->ox = x;
+			matrix->oy = y;
+			matrix->oz = z;
+			return;
+		}
+	}
+
+	// For each axis, reset the slab of elements entering the window, in up to two boxes of ring indices
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		if( p[a] == o[a] )
+		{
+			continue;
+		}
+
+		// First entering world coordinate and slab thickness
+		int w, t;
+		w = p[a] > o[a] ? o[a] + size[a] : p[a];
+		t = abs( p[a] - o[a] );
+
+		// Ring index ranges [s0,s0+t0) and [0,t-t0)
+		int s0, t0;
+		s0 = sparIntRingIndex( w, size[a] );
+		t0 = s0 + t > size[a] ? size[a] - s0 : t;
+
+		int b[3], c[3];
+		b[0] = 0;
+		b[1] = 0;
+		b[2] = 0;
+		c[0] = matrix->nx;
+		c[1] = matrix->ny;
+		c[2] = matrix->nz;
+
+		b[a] = s0;
+		c[a] = t0;
+		sparIntFillBox( matrix, b[0], b[1], b[2], c[0], c[1], c[2], matrix->def );
+
+		if( t0 < t )
+		{
+			b[a] = 0;
+			c[a] = t - t0;
+			sparIntFillBox( matrix, b[0], b[1], b[2], c[0], c[1], c[2], matrix->def );
+		}
+	}
+
+	matrix->ox = x;
+	matrix->oy = y;
+	matrix->oz = z;
+}
+
+// New matrix with permuted axes, new x, y and z axes are the axes ax, ay and az (0 x, 1 y, 2 z) of matrix
+sparInt* sparIntPermute( sparInt *matrix, int ax, int ay, int az )
+{
+	// Check permutation
+	if( ax < 0 || ay < 0 || az < 0 || ax > 2 || ay > 2 || az > 2 || ax == ay || ay == az || az == ax )
+	{
+		fprintf(stderr, "sparIntPermute error: Axes must be a permutation of 0, 1 and 2\n");
+		exit(1);
+	}
+
+	// Matrix and block matrix size
+	int size[3], blockSize[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+	blockSize[0] = matrix->mx;
+	blockSize[1] = matrix->my;
+	blockSize[2] = matrix->mz;
+
+	// Declare matrix and init
+	sparInt *matrix2;
+	matrix2 = sparIntInit( size[ax], size[ay], size[az], matrix->bs, matrix->def );
+
+	// Permute ring buffer origin
+	int origin[3];
+	origin[0] = matrix->ox;
+	origin[1] = matrix->oy;
+	origin[2] = matrix->oz;
+	matrix2->ox = origin[ax];
+	matrix2->oy = origin[ay];
+	matrix2->oz = origin[az];
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Source strides of the new axes, blocks and elements
+	int stride[3], blockStride[3];
+	stride[0] = 1;
+	stride[1] = bs;
+	stride[2] = bs * bs;
+	blockStride[0] = 1;
+	blockStride[1] = blockSize[0];
+	blockStride[2] = blockSize[0] * blockSize[1];
+
+	int sx, sy, sz, bx, by, bz;
+	sx = stride[ax];
+	sy = stride[ay];
+	sz = stride[az];
+	bx = blockStride[ax];
+	by = blockStride[ay];
+	bz = blockStride[az];
+
+	// Number of blocks
+	int blocks;
+	blocks = matrix2->mx * matrix2->my * matrix2->mz;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		// Block (i1,j1,k1) and source block
+		int i1, j1, k1, m;
+		i1 = n % matrix2->mx;
+		j1 = ( n / matrix2->mx ) % matrix2->my;
+		k1 = n / ( matrix2->mx * matrix2->my );
+		m = i1 * bx + j1 * by + k1 * bz;
+
+		// Uniform block
+		if( matrix->blockData[m] == NULL )
+		{
+			matrix2->blockValue[n] = matrix->blockValue[m];
+			continue;
+		}
+
+		// Heterogeneous block, transpose in cache
+		int *blockData, *source;
+		blockData = (int*) malloc( matrix2->bs3 * sizeof(int) );
+		source = matrix->blockData[m];
+
+		if( blockData == NULL )
+		{
+		   fprintf(stderr, "sparIntPermute error: Out of memory\n");
+		   exit(1);
+		}
+
+		int i, j, k;
+		for( k = 0 ; k < bs ; k++ )
+		{
+			for( j = 0 ; j < bs ; j++ )
+			{
+				int *row, *column;
+				row = blockData + bs * ( j + bs * k );
+				column = source + j * sy + k * sz;
+				for( i = 0 ; i < bs ; i++ )
+				{
+					row[i] = column[ i * sx ];
+				}
+			}
+		}
+
+		matrix2->blockData[n] = blockData;
+	}
+
+	return matrix2;
+}
+
+// Allocate n elements 64-byte aligned with plain malloc (no C11 aligned_alloc), release with the matching DenseFree
+int* sparIntDenseAlloc( long n )
+{
+	// Room for the alignment offset and the original pointer
+	char *base;
+	base = (char*) malloc( n * sizeof(int) + 64 + sizeof(void*) );
+
+	if( base == NULL )
+	{
+		return NULL;
+	}
+
+	// First 64-byte boundary after the stored original pointer
+	char *aligned;
+	aligned = base + sizeof(void*);
+	aligned = aligned + ( 64 - (uintptr_t)( aligned ) % 64 ) % 64;
+	((void**) aligned)[-1] = base;
+
+	return (int*) aligned;
+}
+
+// Free dense buffer returned by Densify or DenseAlloc
+void sparIntDenseFree( int *buffer )
+{
+	if( buffer != NULL )
+	{
+		free( ((void**) buffer)[-1] );
+	}
+}
+
+// Dense copy padded to (px,py,pz) with the default value, rows along axis contiguous and 64-byte aligned every pitch elements (free with sparIntDenseFree)
+int* sparIntDensify( sparInt *matrix, int axis, int px, int py, int pz, int *pitch )
+{
+	// Check padded size
+	if( px < matrix->nx || py < matrix->ny || pz < matrix->nz || axis < 0 || axis > 2 )
+	{
+		fprintf(stderr, "sparIntDensify error: Padded size must contain the matrix\n");
+		exit(1);
+	}
+
+	// Padded size and the other two axes (b,c)
+	int p[3], b, c;
+	p[0] = px;
+	p[1] = py;
+	p[2] = pz;
+	b = axis == 0 ? 1 : 0;
+	c = axis == 2 ? 1 : 2;
+
+	// Row pitch, multiple of 64 bytes
+	int align;
+	align = 64 % sizeof(int) == 0 ? 64 / sizeof(int) : 1;
+	*pitch = ( p[axis] + align - 1 ) / align * align;
+
+	// Element (x,y,z) at x*s[0]+y*s[1]+z*s[2]
+	long s[3];
+	s[axis] = 1;
+	s[b] = *pitch;
+	s[c] = (long) *pitch * p[b];
+
+	int *buffer;
+	buffer = sparIntDenseAlloc( s[c] * p[c] );
+
+	if( buffer == NULL )
+	{
+	   fprintf(stderr, "sparIntDensify error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Matrix size
+	int size[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+
+	// Padding, row by row
+	int r;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( r = 0 ; r < p[b] * p[c] ; r++ )
+	{
+		// Row (j,k) along axes (b,c)
+		int i, j, k;
+		j = r % p[b];
+		k = r / p[b];
+
+		int *row;
+		row = buffer + j * s[b] + k * s[c];
+		for( i = ( j < size[b] && k < size[c] ) ? size[axis] : 0 ; i < *pitch ; i++ )
+		{
+			row[i] = matrix->def;
+		}
+	}
+
+	sparIntGetDense( matrix, buffer, s[0], s[1], s[2] );
+
+	return buffer;
+}
+
+// Copy dense buffer with element (x,y,z) at x*sx+y*sy+z*sz into matrix, uniform blocks detected
+void sparIntSetDense( sparInt *matrix, int *buffer, long sx, long sy, long sz )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Element strides
+	long s[3];
+	s[0] = sx;
+	s[1] = sy;
+	s[2] = sz;
+
+	// Number of blocks
+	int blocks;
+	blocks = matrix->mx * matrix->my * matrix->mz;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block elements
+		int *temp;
+		temp = (int*) malloc( bs3 * sizeof(int) );
+
+		if( temp == NULL )
+		{
+		   fprintf(stderr, "sparIntSetDense error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < blocks ; n++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = n % matrix->mx;
+			j1 = ( n / matrix->mx ) % matrix->my;
+			k1 = n / ( matrix->mx * matrix->my );
+
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = matrix->nx - i1 * bs < bs ? matrix->nx - i1 * bs : bs;
+			ey = matrix->ny - j1 * bs < bs ? matrix->ny - j1 * bs : bs;
+			ez = matrix->nz - k1 * bs < bs ? matrix->nz - k1 * bs : bs;
+
+			// Gather block and check uniformity in a single scan
+			int value;
+			int isUniform;
+			value = buffer[ i1 * bs * s[0] + j1 * bs * s[1] + k1 * bs * s[2] ];
+			isUniform = 1;
+
+			int i, j, k;
+			for( k = 0 ; k < bs ; k++ )
+			{
+				for( j = 0 ; j < bs ; j++ )
+				{
+					int *row, *blockRow;
+					row = buffer + i1 * bs * s[0] + ( j1 * bs + j ) * s[1] + ( k1 * bs + k ) * s[2];
+					blockRow = temp + bs * ( j + bs * k );
+
+					// Outside elements set to default
+					if( j >= ey || k >= ez )
+					{
+						for( i = 0 ; i < bs ; i++ )
+						{
+							blockRow[i] = matrix->def;
+						}
+						continue;
+					}
+
+					for( i = 0 ; i < ex ; i++ )
+					{
+						blockRow[i] = row[ i * s[0] ];
+						isUniform &= sparIntEqual( blockRow[i], value );
+					}
+					for( i = ex ; i < bs ; i++ )
+					{
+						blockRow[i] = matrix->def;
+					}
+				}
+			}
+
+			// Uniform block
+			if( isUniform )
+			{
+				if( matrix->blockData[n] != NULL )
+				{
+					free(matrix->blockData[n]);
+					matrix->blockData[n] = NULL;
+				}
+				matrix->blockValue[n] = value;
+			}
+			// Heterogeneous block, reuse previous data if any
+			else if( matrix->blockData[n] != NULL )
+			{
+				memcpy( matrix->blockData[n], temp, bs3 * sizeof(int) );
+			}
+			// Heterogeneous block, keep gathered elements
+			else
+			{
+				matrix->blockData[n] = temp;
+				temp = (int*) malloc( bs3 * sizeof(int) );
+
+				if( temp == NULL )
+				{
+				   fprintf(stderr, "sparIntSetDense error: Out of memory\n");
+				   exit(1);
+				}
+			}
+		}
+
+		free(temp);
+	}
+}
+
+// Copy dense buffer with the densify layout (axis, pitch and padded size) into matrix, uniform blocks detected
+void sparIntSparsify( sparInt *matrix, int *buffer, int axis, int pitch, int px, int py, int pz )
+{
+	// Check padded size and pitch
+	if( px < matrix->nx || py < matrix->ny || pz < matrix->nz || axis < 0 || axis > 2 )
+	{
+		fprintf(stderr, "sparIntSparsify error: Padded size must contain the matrix\n");
+		exit(1);
+	}
+
+	if( pitch < ( axis == 0 ? px : ( axis == 1 ? py : pz ) ) )
+	{
+		fprintf(stderr, "sparIntSparsify error: Pitch must be at least the padded row length\n");
+		exit(1);
+	}
+
+	// Padded size and the other two axes (b,c)
+	int p[3], b, c;
+	p[0] = px;
+	p[1] = py;
+	p[2] = pz;
+	b = axis == 0 ? 1 : 0;
+	c = axis == 2 ? 1 : 2;
+
+	// Element (x,y,z) at x*s[0]+y*s[1]+z*s[2]
+	long s[3];
+	s[axis] = 1;
+	s[b] = pitch;
+	s[c] = (long) pitch * p[b];
+
+	sparIntSetDense( matrix, buffer, s[0], s[1], s[2] );
+}
+
+// New matrix from dense buffer with element (x,y,z) at x*sx+y*sy+z*sz, only heterogeneous blocks allocated
+sparInt* sparIntInitDense( int *buffer, int nx, int ny, int nz, long sx, long sy, long sz, int bs, int def )
+{
+	// Declare matrix and init
+	sparInt *matrix;
+	matrix = sparIntInit( nx, ny, nz, bs, def );
+
+	sparIntSetDense( matrix, buffer, sx, sy, sz );
+
+	return matrix;
+}
+
+// Copy matrix into dense buffer with element (x,y,z) at x*sx+y*sy+z*sz
+void sparIntGetDense( sparInt *matrix, int *buffer, long sx, long sy, long sz )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// For each row along x, in contiguous slabs per thread
+	int r;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( r = 0 ; r < matrix->ny * matrix->nz ; r++ )
+	{
+		// Row (y,z), its blocks and offset in the block
+		int y, z, j1, k1, offset;
+		y = r % matrix->ny;
+		z = r / matrix->ny;
+		j1 = y / bs;
+		k1 = z / bs;
+		offset = bs * ( y % bs + bs * ( z % bs ) );
+
+		int *row;
+		row = buffer + y * sy + z * sz;
+
+		// For each block along the row
+		int i1;
+		for( i1 = 0 ; i1 < matrix->mx ; i1++ )
+		{
+			// Linear block index (n) <-> (i1,j1,k1)
+			int n;
+			n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+			// Block extent inside the matrix
+			int ex;
+			ex = matrix->nx - i1 * bs < bs ? matrix->nx - i1 * bs : bs;
+
+			int *blockData, *out, value;
+			blockData = matrix->blockData[n];
+			value = matrix->blockValue[n];
+			out = row + i1 * bs * sx;
+
+			int i;
+
+			// Uniform block, contiguous row
+			if( blockData == NULL && sx == 1 )
+			{
+				for( i = 0 ; i < ex ; i++ )
+				{
+					out[i] = value;
+				}
+			}
+			// Uniform block, strided row
+			else if( blockData == NULL )
+			{
+				for( i = 0 ; i < ex ; i++ )
+				{
+					out[ i * sx ] = value;
+				}
+			}
+			// Heterogeneous block, contiguous row
+			else if( sx == 1 )
+			{
+				memcpy( out, blockData + offset, ex * sizeof(int) );
+			}
+			// Heterogeneous block, strided row
+			else
+			{
+				for( i = 0 ; i < ex ; i++ )
+				{
+					out[ i * sx ] = blockData[ offset + i ];
+				}
+			}
+		}
+	}
+}
+
+// Change the default value, uniform blocks with the previous default value set to the new one
+void sparIntSetDefault( sparInt *matrix, int def )
+{
+	// Number of blocks
+	int blocks;
+	blocks = matrix->mx * matrix->my * matrix->mz;
+
+	int i;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( i = 0 ; i < blocks ; i++ )
+	{
+		if( matrix->blockData[i] == NULL && sparIntEqual( matrix->blockValue[i], matrix->def ) )
+		{
+			matrix->blockValue[i] = def;
+		}
+	}
+
+	matrix->def = def;
+}
+
+// Most frequent value in box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) clipped to the matrix, smallest on ties, its count in count if not NULL
+int sparIntDominant( sparInt *matrix, int x, int y, int z, int sx, int sy, int sz, double *count )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		if( count != NULL )
+		{
+			*count = 0.0;
+		}
+		return matrix->def;
+	}
+
+	// Runs of equal values, one per uniform block and per distinct value of heterogeneous blocks
+	int runs, size;
+	int *runValue, *temp;
+	double *runCount;
+	runs = 0;
+	size = 64;
+	runValue = (int*) malloc( size * sizeof(int) );
+	runCount = (double*) malloc( size * sizeof(double) );
+	temp = (int*) malloc( matrix->bs3 * sizeof(int) );
+
+	if( runValue == NULL || runCount == NULL || temp == NULL )
+	{
+	   fprintf(stderr, "sparIntDominant error: Out of memory\n");
+	   exit(1);
+	}
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1, m;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+				m = ( bx1 - bx0 ) * ( by1 - by0 ) * ( bz1 - bz0 );
+
+				// Grow runs
+				if( runs + m > size )
+				{
+					size = 2 * ( runs + m );
+					runValue = (int*) realloc( runValue, size * sizeof(int) );
+					runCount = (double*) realloc( runCount, size * sizeof(double) );
+
+					if( runValue == NULL || runCount == NULL )
+					{
+					   fprintf(stderr, "sparIntDominant error: Out of memory\n");
+					   exit(1);
+					}
+				}
+
+				// Uniform block, one run
+				if( matrix->blockData[n] == NULL )
+				{
+					runValue[runs] = matrix->blockValue[n];
+					runCount[runs] = m;
+					runs++;
+					continue;
+				}
+
+				// Heterogeneous block, sorted intersection elements
+				sparIntGetBox( matrix, bx0, by0, bz0, bx1 - bx0, by1 - by0, bz1 - bz0, temp );
+				qsort( temp, m, sizeof(int), sparIntCompare );
+
+				int i;
+				for( i = 0 ; i < m ; i++ )
+				{
+					if( i > 0 && sparIntEqual( temp[i], temp[ i - 1 ] ) )
+					{
+						runCount[ runs - 1 ] += 1.0;
+					}
+					else
+					{
+						runValue[runs] = temp[i];
+						runCount[runs] = 1.0;
+						runs++;
+					}
+				}
+			}
+		}
+	}
+
+	// Distinct values, sorted
+	int distinct, i;
+	int *values;
+	double *counts;
+	values = (int*) malloc( runs * sizeof(int) );
+	counts = (double*) calloc( runs, sizeof(double) );
+
+	if( values == NULL || counts == NULL )
+	{
+	   fprintf(stderr, "sparIntDominant error: Out of memory\n");
+	   exit(1);
+	}
+
+	memcpy( values, runValue, runs * sizeof(int) );
+	qsort( values, runs, sizeof(int), sparIntCompare );
+	distinct = 1;
+	for( i = 1 ; i < runs ; i++ )
+	{
+		if( sparIntEqual( values[i], values[ distinct - 1 ] ) == 0 )
+		{
+			values[ distinct++ ] = values[i];
+		}
+	}
+
+	// Count per distinct value
+	for( i = 0 ; i < runs ; i++ )
+	{
+		int *v;
+		v = (int*) bsearch( runValue + i, values, distinct, sizeof(int), sparIntCompare );
+		counts[ v - values ] += runCount[i];
+	}
+
+	// Most frequent, first in sorted order on ties
+	int best;
+	best = 0;
+	for( i = 1 ; i < distinct ; i++ )
+	{
+		if( counts[i] > counts[best] )
+		{
+			best = i;
+		}
+	}
+
+	int value;
+	value = values[best];
+
+	if( count != NULL )
+	{
+		*count = counts[best];
+	}
+
+	free(runValue);
+	free(runCount);
+	free(temp);
+	free(values);
+	free(counts);
+
+	return value;
+}
+
+
+
+// Matrix constructor
+sparLong* sparLongInit( int nx, int ny, int nz, int bs, long def )
+{
+	// Check matrix size
+	if( !( nx > 0 && ny > 0 && nz > 0 ) )
+	{
+		fprintf(stderr, "sparLongInit error: Matrix size must be positive\n");
+		exit(1);
+	}
+
+	// Check block size
+	if( !( bs > 1 ) )
+	{
+		fprintf(stderr, "sparLongInit error: Block size must be greater than 1\n");
+		exit(1);
+	}
+
+	// Declare struct and allocate space
+	sparLong *matrix;
+	matrix = (sparLong*) malloc(sizeof(sparLong));
+
+	if( matrix == NULL )
+	{
+	   fprintf(stderr, "sparLongInit error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Set matrix size (nx,ny,nz)
+	matrix->nx = nx;
+	matrix->ny = ny;
+	matrix->nz = nz;
+
+	// Set block size (bs,bs,bs)
+	matrix->bs  = bs;
+	matrix->bs3 = bs * bs * bs;
+
+	// Set block matrix size (mx,my,mz)
+	matrix->mx = (int)( ( nx + bs - 1 ) / bs );
+	matrix->my = (int)( ( ny + bs - 1 ) / bs );
+	matrix->mz = (int)( ( nz + bs - 1 ) / bs );
+
+	// Number of blocks
+	int blocks = matrix->mx * matrix->my * matrix->mz;
+
+	// Allocate space for block uniform data
+	matrix->blockValue = (long*) calloc( blocks, sizeof(long) );
+
+	if( matrix->blockValue == NULL )
+	{
+	   fprintf(stderr, "sparLongInit error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Allocate space for block heterogeneous data arrays
+	matrix->blockData = (long**) calloc( blocks, sizeof(long*) );
+
+	if( matrix->blockData == NULL )
+	{
+	   fprintf(stderr, "sparLongInit error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Allocate space for block locks, cleared below
+	matrix->blockLock = (atomic_flag*) malloc( blocks * sizeof(atomic_flag) );
+
+	if( matrix->blockLock == NULL )
+	{
+	   fprintf(stderr, "sparLongInit error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Set default value
+	matrix->def = def;
+
+	// Set ring buffer origin. Duplicate and Map copy it, Op requires equal origins and copies it, Permute permutes it and in-place operations keep it.
+	// Crop, Downsample and InitDense leave it at zero, their storage does not follow the ring layout of a source window.
+	matrix->ox = 0;
+	matrix->oy = 0;
+	matrix->oz = 0;
+
+	// Set matrix elemets to default value
+	int i;
+	for( i = 0 ; i < blocks ; i++ )
+	{
+		matrix->blockData[i] = NULL; // Flag for uniform block
+		matrix->blockValue[i] = def;
+	}
+
+	// Unlock all blocks
+	sparLongClearLocks( matrix );
+
+	// Return pointer
+	return matrix;
+}
+
+// Clear (unlock) every block lock, flags are not assumed clear after allocation
+void sparLongClearLocks( sparLong *matrix )
+{
+	int n;
+	for( n = 0 ; n < matrix->mx * matrix->my * matrix->mz ; n++ )
+	{
+		atomic_flag_clear( &matrix->blockLock[n] );
+	}
+}
+
+// Matrix destructor
+void sparLongFree( sparLong *matrix )
+{
+	// Number of blocks
+	int blocks;
+	blocks = matrix->mx * matrix->my * matrix->mz;
+
+	// Free heterogeneous blocks
+	int i;
+	for( i = 0 ; i < blocks ; i++ )
+	{
+		if( matrix->blockData[i] != NULL ) // Flag for uniform block
+		{
+			free( matrix->blockData[i] );
+		}
+	}
+
+	// Free block uniform data
+	free(matrix->blockValue);
+
+	// Free block heterogeneous data array
+	free(matrix->blockData);
+
+	// Free block locks
+	free(matrix->blockLock);
+
+	// Free matrix instance
+	free(matrix);
+}
+
+// Reset matrix values
+void sparLongReset( sparLong *matrix )
+{
+	// Number of blocks
+	int blocks;
+	blocks = matrix->mx * matrix->my * matrix->mz;
+
+	// Reduce blocks and set to default value
+	int i;
+	for( i = 0 ; i < blocks ; i++ )
+	{
+		// Heterogeneous block
+		if( matrix->blockData[i] != NULL )
+		{
+			free( matrix->blockData[i] );
+			matrix->blockData[i] = NULL;
+		}
+		matrix->blockValue[i] = matrix->def;
+	}
+}
+
+// Get matrix memory usage in bytes
+double sparLongMemory( sparLong *matrix )
+{
+	// Number of blocks
+	int blocks;
+	blocks = matrix->mx * matrix->my * matrix->mz;
+
+	// Matrix instance
+	double size;
+	size = (double)( sizeof(sparLong) );
+
+	// Uniform block data
+	size = size + (double)( blocks * sizeof(long) );
+
+	// Heterogeneous block data arrays
+	size = size + (double)( blocks * sizeof(long*) );
+
+	// Block locks
+	size = size + (double)( blocks * sizeof(atomic_flag) );
+
+	// Heterogeneous block data
+	int i;
+	for( i = 0 ; i < blocks ; i++ )
+	{
+		// Heterogeneous block
+		if( matrix->blockData[i] != NULL )
+		{
+			size = size + (double)( sizeof(long) * matrix->bs3 );
+		}
+	}
+
+	return size;
+}
+
+// Element equality, NaN equal to NaN so NaN regions compress like any other uniform value
+int sparLongEqual( long a, long b )
+{
+	return a == b || ( isnan( (double) a ) && isnan( (double) b ) );
+}
+
+// Convert x to the data type, rounding to nearest for integer types instead of truncating
+long sparLongRound( double x )
+{
+	// Integer types turn 0.5 into 0
+	if( (long)( 0.5 ) == 0 )
+	{
+		return (long)( floor( x + 0.5 ) );
+	}
+	return (long)( x );
+}
+
+// Check if block is uniform
+int sparLongUniformBlock( sparLong *matrix, int x, int y, int z )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Linear block index (n) <-> (x,y,z)
+	int n;
+	n = x + mx * ( y + my * z );
+
+	// Block data array
+	long *blockData;
+	blockData = matrix->blockData[n];
+
+	// Uniform block
+	if( blockData == NULL )
+	{
+		return 1;
+	}
+
+	int isUniform;
+	isUniform = 1;
+
+	// Inner block
+	if( x < mx - 1 && y < my - 1 && z < mz - 1)
+	{
+		// Start with last element
+		long value;
+		value = blockData[ bs3 - 1 ];
+
+		// Read block elements
+		int i;
+		for( i = 0 ; i < bs3 ; i++ )
+		{
+			if( sparLongEqual( blockData[i], value ) == 0 )
+			{
+				isUniform = 0;
+				i = bs3;
+			}
+		}
+	}
+	// Boundary block, with outside elements?
+	else
+	{
+		// Start with first element
+		long value;
+		value = blockData[0];
+
+		// Read block elements
+		int i, j, k;
+		for( k = 0 ; k < bs ; k++ )
+		{
+			if( z * bs + k < matrix->nz ) // Avoid outside elements
+			for( j = 0 ; j < bs ; j++ )
+			{
+				if( y * bs + j < matrix->ny ) // Idem
+				for( i = 0 ; i < bs ; i++ )
+				{
+					if( x * bs + i < matrix->nx ) // Idem
+					if( sparLongEqual( blockData[ i + bs * ( j + bs * k ) ], value ) == 0 )
+					{
+						isUniform = 0;
+						i = j = k = bs;
+					}
+				}
+			}
+		}
+	}
+
+	return isUniform;
+}
+
+// Expand uniform block (x,y,z) into heterogeneous block data
+void sparLongExpandBlock( sparLong *matrix, int x, int y, int z )
+{
+	// Linear block index (n) <-> (x,y,z)
+	int n;
+	n = x + matrix->mx * ( y + matrix->my * z );
+
+	// Already heterogeneous
+	if( matrix->blockData[n] != NULL )
+	{
+		return;
+	}
+
+	// Allocate block data
+	long *blockData;
+	blockData = (long*) calloc( matrix->bs3, sizeof(long) );
+
+	if( blockData == NULL )
+	{
+	   fprintf(stderr, "sparLongExpandBlock error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Set uniform value
+	long value;
+	value = matrix->blockValue[n];
+
+	int i;
+	for( i = 0 ; i < matrix->bs3 ; i++ )
+	{
+		blockData[i] = value;
+	}
+
+	matrix->blockData[n] = blockData;
+}
+
+// Reduce block (x,y,z) to uniform if possible, return 1 if uniform
+int sparLongReduceBlock( sparLong *matrix, int x, int y, int z )
+{
+	// Linear block index (n) <-> (x,y,z)
+	int n;
+	n = x + matrix->mx * ( y + matrix->my * z );
+
+	// Already uniform
+	if( matrix->blockData[n] == NULL )
+	{
+		return 1;
+	}
+
+	// Heterogeneous block
+	if( sparLongUniformBlock( matrix, x, y, z ) == 0 )
+	{
+		return 0;
+	}
+
+	// First element is always inside the matrix
+	matrix->blockValue[n] = matrix->blockData[n][0];
+	free(matrix->blockData[n]);
+	matrix->blockData[n] = NULL;
+
+	return 1;
+}
+
+// Check if every block overlapping box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) is uniform with the same value
+int sparLongUniformBox( sparLong *matrix, int x, int y, int z, int sx, int sy, int sz, long *value )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return 0;
+	}
+
+	// Reference value
+	int n;
+	n = x0 / bs + matrix->mx * ( y0 / bs + matrix->my * ( z0 / bs ) );
+	*value = matrix->blockValue[n];
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+				if( matrix->blockData[n] != NULL || sparLongEqual( matrix->blockValue[n], *value ) == 0 )
+				{
+					return 0;
+				}
+			}
+		}
+	}
+
+	return 1;
+}
+
+// Copy box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) into buffer[i+sx*(j+sy*k)], default value outside the matrix
+void sparLongGetBox( sparLong *matrix, int x, int y, int z, int sx, int sy, int sz, long *buffer )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	int i, j, k;
+
+	// Box partially outside the matrix, fill with default value
+	if( x0 != x || y0 != y || z0 != z || x1 != x + sx || y1 != y + sy || z1 != z + sz )
+	{
+		for( i = 0 ; i < sx * sy * sz ; i++ )
+		{
+			buffer[i] = matrix->def;
+		}
+	}
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+				long *blockData;
+				blockData = matrix->blockData[n];
+
+				// Copy block rows
+				for( k = bz0 ; k < bz1 ; k++ )
+				{
+					for( j = by0 ; j < by1 ; j++ )
+					{
+						long *row;
+						row = buffer + ( bx0 - x ) + sx * ( ( j - y ) + sy * ( k - z ) );
+
+						// Uniform block
+						if( blockData == NULL )
+						{
+							long value;
+							value = matrix->blockValue[n];
+							for( i = 0 ; i < bx1 - bx0 ; i++ )
+							{
+								row[i] = value;
+							}
+						}
+						// Heterogeneous block
+						else
+						{
+							memcpy( row, blockData + ( bx0 - i1 * bs ) + bs * ( ( j - j1 * bs ) + bs * ( k - k1 * bs ) ),
+									( bx1 - bx0 ) * sizeof(long) );
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// Copy buffer[i+sx*(j+sy*k)] into box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1), elements outside the matrix are ignored
+void sparLongSetBox( sparLong *matrix, int x, int y, int z, int sx, int sy, int sz, long *buffer )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	int i, j, k;
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+				// Block elements inside the matrix are fully covered
+				int covered;
+				covered = bx0 == i1 * bs && by0 == j1 * bs && bz0 == k1 * bs &&
+						  ( bx1 == ( i1 + 1 ) * bs || bx1 == matrix->nx ) &&
+						  ( by1 == ( j1 + 1 ) * bs || by1 == matrix->ny ) &&
+						  ( bz1 == ( k1 + 1 ) * bs || bz1 == matrix->nz );
+
+				// Covered block, check if input is uniform first
+				if( covered )
+				{
+					long value;
+					value = buffer[ ( bx0 - x ) + sx * ( ( by0 - y ) + sy * ( bz0 - z ) ) ];
+
+					int isUniform;
+					isUniform = 1;
+					for( k = bz0 ; k < bz1 && isUniform ; k++ )
+					{
+						for( j = by0 ; j < by1 && isUniform ; j++ )
+						{
+							long *row;
+							row = buffer + ( bx0 - x ) + sx * ( ( j - y ) + sy * ( k - z ) );
+							for( i = 0 ; i < bx1 - bx0 ; i++ )
+							{
+								if( sparLongEqual( row[i], value ) == 0 )
+								{
+									isUniform = 0;
+									break;
+								}
+							}
+						}
+					}
+
+					if( isUniform )
+					{
+						if( matrix->blockData[n] != NULL )
+						{
+							free(matrix->blockData[n]);
+							matrix->blockData[n] = NULL;
+						}
+						matrix->blockValue[n] = value;
+						continue;
+					}
+				}
+
+				// Copy block rows into heterogeneous block
+				sparLongExpandBlock( matrix, i1, j1, k1 );
+
+				long *blockData;
+				blockData = matrix->blockData[n];
+
+				for( k = bz0 ; k < bz1 ; k++ )
+				{
+					for( j = by0 ; j < by1 ; j++ )
+					{
+						memcpy( blockData + ( bx0 - i1 * bs ) + bs * ( ( j - j1 * bs ) + bs * ( k - k1 * bs ) ),
+								buffer + ( bx0 - x ) + sx * ( ( j - y ) + sy * ( k - z ) ),
+								( bx1 - bx0 ) * sizeof(long) );
+					}
+				}
+
+				// Partially covered blocks may have become uniform
+				if( !covered )
+				{
+					sparLongReduceBlock( matrix, i1, j1, k1 );
+				}
+			}
+		}
+	}
+}
+
+// Set every element of box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) to value, elements outside the matrix are ignored
+void sparLongFillBox( sparLong *matrix, int x, int y, int z, int sx, int sy, int sz, long value )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	int i, j, k;
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+				// Block elements inside the matrix are fully covered, uniform block
+				if( bx0 == i1 * bs && by0 == j1 * bs && bz0 == k1 * bs &&
+					( bx1 == ( i1 + 1 ) * bs || bx1 == matrix->nx ) &&
+					( by1 == ( j1 + 1 ) * bs || by1 == matrix->ny ) &&
+					( bz1 == ( k1 + 1 ) * bs || bz1 == matrix->nz ) )
+				{
+					if( matrix->blockData[n] != NULL )
+					{
+						free(matrix->blockData[n]);
+						matrix->blockData[n] = NULL;
+					}
+					matrix->blockValue[n] = value;
+					continue;
+				}
+
+				// Already uniform with the same value
+				if( matrix->blockData[n] == NULL && sparLongEqual( matrix->blockValue[n], value ) )
+				{
+					continue;
+				}
+
+				// Fill block rows and reduce if possible
+				sparLongExpandBlock( matrix, i1, j1, k1 );
+
+				long *blockData;
+				blockData = matrix->blockData[n];
+
+				for( k = bz0 ; k < bz1 ; k++ )
+				{
+					for( j = by0 ; j < by1 ; j++ )
+					{
+						long *row;
+						row = blockData + ( bx0 - i1 * bs ) + bs * ( ( j - j1 * bs ) + bs * ( k - k1 * bs ) );
+						for( i = 0 ; i < bx1 - bx0 ; i++ )
+						{
+							row[i] = value;
+						}
+					}
+				}
+
+				sparLongReduceBlock( matrix, i1, j1, k1 );
+			}
+		}
+	}
+}
+
+// Set matrix element (x,y,z)
+void sparLongSet( sparLong *matrix, int x, int y, int z, long value )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block (i1,j1,k1) contains the element (x,y,z)
+	int i1, j1, k1;
+	i1 = x / bs;
+	j1 = y / bs;
+	k1 = z / bs;
+
+	// Element indices in the block
+	int i2, j2, k2;
+	i2 = x % bs;
+	j2 = y % bs;
+	k2 = z % bs;
+
+	// Linear block index (n) <-> (i1,j1,k1)
+	int n;
+	n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+	// Block uniform value
+	long blockValue;
+	blockValue = matrix->blockValue[n];
+
+	// Block data array
+	long *blockData;
+	blockData = matrix->blockData[n];
+
+	// Uniform block
+	if( blockData == NULL )
+	{
+		// Input value is different
+		if( sparLongEqual( value, blockValue ) == 0 )
+		{
+			// Expand block
+			blockData = (long*) calloc( bs3, sizeof(long) );
+			matrix->blockData[n] = blockData;
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparLongSet error: Out of memory\n");
+			   exit(1);
+			}
+
+			// Set previous value
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				blockData[i] = blockValue;
+			}
+
+			// Set input value
+			blockData[ i2 + bs * ( j2 + bs * k2 ) ] = value;
+		}
+		// Else, do nothing
+	}
+	// Heterogeneous block
+	else
+	{
+		// Set input value
+		blockData[ i2 + bs * ( j2 + bs * k2 ) ] = value;
+
+		// Reduce block
+		if( sparLongUniformBlock( matrix, i1, j1, k1 ) )
+		{
+			matrix->blockValue[n] = value;
+			free(matrix->blockData[n]);
+			matrix->blockData[n] = NULL;
+		}
+	}
+}
+
+// Get matrix element (x,y,z)
+long sparLongGet( sparLong *matrix, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Block (i1,j1,k1) contains the element (x,y,z)
+	int i1, j1, k1;
+	i1 = x / bs;
+	j1 = y / bs;
+	k1 = z / bs;
+
+	// Linear block index (n) <-> (i1,j1,k1)
+	int n;
+	n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+	long *blockData;
+	blockData = matrix->blockData[n];
+
+	// Uniform block
+	if( blockData == NULL )
+	{
+		return matrix->blockValue[n];
+	}
+	// Heterogeneous block
+	else
+	{
+		// Element indices in the block
+		int i2, j2, k2;
+		i2 = x % bs;
+		j2 = y % bs;
+		k2 = z % bs;
+		// Return element value
+		return blockData[ i2 + bs * ( j2 + bs * k2 ) ];
+	}
+}
+
+// Set matrix element (x,y,z) locking its block, safe for parallel writers
+void sparLongSetSafe( sparLong *matrix, int x, int y, int z, long value )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Linear block index (n) <-> (x/bs,y/bs,z/bs)
+	int n;
+	n = x / bs + matrix->mx * ( y / bs + matrix->my * ( z / bs ) );
+
+	// Acquire block lock
+	while( atomic_flag_test_and_set_explicit( &matrix->blockLock[n], memory_order_acquire ) );
+
+	// Set element, may expand or reduce the block
+	sparLongSet( matrix, x, y, z, value );
+
+	// Release block lock
+	atomic_flag_clear_explicit( &matrix->blockLock[n], memory_order_release );
+}
+
+// Get matrix element (x,y,z) locking its block, safe with parallel writers
+long sparLongGetSafe( sparLong *matrix, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Linear block index (n) <-> (x/bs,y/bs,z/bs)
+	int n;
+	n = x / bs + matrix->mx * ( y / bs + matrix->my * ( z / bs ) );
+
+	// Acquire block lock
+	while( atomic_flag_test_and_set_explicit( &matrix->blockLock[n], memory_order_acquire ) );
+
+	// Get element
+	long value;
+	value = sparLongGet( matrix, x, y, z );
+
+	// Release block lock
+	atomic_flag_clear_explicit( &matrix->blockLock[n], memory_order_release );
+
+	return value;
+}
+
+// Duplicate matrix
+sparLong* sparLongDuplicate( sparLong *matrix )
+{
+	// Declare matrix and init
+	sparLong *matrix2;
+	matrix2 = sparLongInit( matrix->nx, matrix->ny, matrix->nz,
+						matrix->bs, matrix->def );
+
+	// Copy ring buffer origin
+	matrix2->ox = matrix->ox;
+	matrix2->oy = matrix->oy;
+	matrix2->oz = matrix->oz;
+
+	// Number of blocks
+	int blocks;
+	blocks = matrix2->mx * matrix2->my * matrix2->mz;
+
+	// Copy blocks
+	int i;
+	for( i = 0 ; i < blocks ; i++ )
+	{
+		// Heterogeneous block
+		if( matrix->blockData[i] != NULL )
+		{
+			// Allocate space for block data
+			matrix2->blockData[i] = (long*) calloc( matrix2->bs3, sizeof(long) );
+
+			if( matrix2->blockData[i] == NULL )
+			{
+			   fprintf(stderr, "sparLongDuplicate error: Out of memory\n");
+			   exit(1);
+			}
+
+			// Copy block data
+			memcpy( matrix2->blockData[i], matrix->blockData[i], matrix2->bs3 * sizeof(long) );
+		}
+		// Uniform block
+		else
+		{
+			matrix2->blockValue[i] = matrix->blockValue[i];
+			matrix2->blockData[i] = NULL;
+		}
+	}
+
+	return matrix2;
+}
+
+// Get matrix memory usage in bytes under certain block size
+double sparLongMemoryBs( sparLong *matrix, int bs )
+{
+	if( bs == matrix->bs )
+	{
+		return sparLongMemory( matrix );
+	}
+
+	// Matrix size (nx,ny,nz)
+	int nx, ny, nz;
+	nx = matrix->nx;
+	ny = matrix->ny;
+	nz = matrix->nz;
+
+	// Block size (bs,bs,bs)
+	int bs3;
+	bs3 = bs * bs * bs;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = (int)( ( nx + bs - 1 ) / bs );
+	my = (int)( ( ny + bs - 1 ) / bs );
+	mz = (int)( ( nz + bs - 1 ) / bs );
+
+	// Number of blocks
+	int blocks;
+	blocks = mx * my * mz;
+
+	// Size of matrix instance
+	double size;
+	size = (double)( sizeof(sparLong) );
+
+	// Size of uniform block data
+	size = size + (double)( blocks * sizeof(long) );
+
+	// Size of heterogeneous block data arrays
+	size = size + (double)( blocks * sizeof(long*) );
+
+	// Size of block locks
+	size = size + (double)( blocks * sizeof(atomic_flag) );
+
+	int i, j, k;
+	int i1, j1, k1;
+	int isUniform;
+	long value;
+
+	// For each virtual block
+	for( k1 = 0 ; k1 < mz ; k1++ )
+	{
+		for( j1 = 0 ; j1 < my ; j1++ )
+		{
+			for( i1 = 0 ; i1 < mx ; i1++ )
+			{
+				// Check if block is uniform 
+				isUniform = 1;
+				value = sparLongGet( matrix, i1 * bs, j1 * bs, k1 * bs );
+				for( k = k1 * bs ; k < ( k1 + 1 ) * bs ; k++ )
+				{
+					if( k < nz ) // Avoid outside elements
+					for( j = j1 * bs ; j < ( j1 + 1 ) * bs ; j++ )
+					{
+						if( j < ny ) // Idem
+						for( i = i1 * bs ; i < ( i1 + 1 ) * bs ; i++ )
+						{
+							if( i < nx ) // Idem
+							if( sparLongEqual( sparLongGet( matrix, i, j, k ), value ) == 0 )
+							{
+								isUniform = 0;
+								i = ( i1 + 1 ) * bs;
+								j = ( j1 + 1 ) * bs;
+								k = ( k1 + 1 ) * bs;
+							}
+						}
+					}
+				}
+				if( isUniform == 0 )
+				{
+					size = size + (double)( sizeof(long) * bs3 );
+				}
+			}
+		}
+	}
+
+	return size;
+}
+
+// Change matrix block size
+void sparLongChangeBs( sparLong *matrix, int bs )
+{
+	// Matrix size (nx,ny,nz)
+	int nx, ny, nz;
+	nx = matrix->nx;
+	ny = matrix->ny;
+	nz = matrix->nz;
+
+	// Default value
+	long def;
+	def = matrix->def;
+
+	// Declare temporal matrix and init
+	sparLong *matrix2;
+	matrix2 = sparLongInit( nx, ny, nz, bs, def );
+
+	// Copy values and clear original matrix
+	int i, j, k;
+	for( k=0 ; k<nz ; k++ )
+	{
+		for( j=0 ; j<ny ; j++ )
+		{
+			for( i=0 ; i<nx ; i++ )
+			{
+				// Copy element
+				sparLongSet( matrix2, i, j, k, sparLongGet( matrix, i, j, k ) );
+
+				// Set uniform to free memory
+				sparLongSet( matrix, i, j, k, def);
+			}
+		}
+	}
+
+	// Set new block size and grid
+	matrix->bs  = matrix2->bs;
+	matrix->bs3 = matrix2->bs3;
+	matrix->mx  = matrix2->mx;
+	matrix->my  = matrix2->my;
+	matrix->mz  = matrix2->mz;
+
+	// Free old blocks
+	free(matrix->blockValue);
+	free(matrix->blockData);
+	free(matrix->blockLock);
+
+	// Copy new blocks
+	matrix->blockValue = matrix2->blockValue;
+	matrix->blockData = matrix2->blockData;
+	matrix->blockLock = matrix2->blockLock;
+
+	// Unlock all blocks of the new grid
+	sparLongClearLocks( matrix );
+
+	// Free temporal matrix
+	free(matrix2);
+}
+
+// Optimize matrix block size
+void sparLongOptimizeBs( sparLong *matrix )
+{
+	// Test block size and store optimal
+	int bestBs;
+	double memory, bestMemory;
+	int bs[10] = { 2, 3, 4, 6, 8, 10 };
+
+	bestBs = bs[0];
+	bestMemory = sparLongMemoryBs( matrix, bs[0] );
+
+	int i;
+	for( i=1 ; i<6 ; i++ )
+	{
+		memory = sparLongMemoryBs( matrix, bs[i] );
+		if( memory < bestMemory )
+		{
+			bestBs = bs[i];
+			bestMemory = memory;
+		}
+	}
+
+	// Change matrix block size
+	sparLongChangeBs( matrix, bestBs );
+}
+
+// Resize matrix
+void sparLongResize( sparLong *matrix, int nx, int ny, int nz )
+{
+	// Check matrix size
+	if( !( nx > 0 && ny > 0 && nz > 0 ) )
+	{
+		fprintf(stderr, "sparLongResize error: Matrix size must be positive\n");
+		exit(1);
+	}
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Default value
+	long def;
+	def = matrix->def;
+
+	// New block grid size
+	int mx, my, mz;
+	mx = (int)( ( nx + bs - 1 ) / bs );
+	my = (int)( ( ny + bs - 1 ) / bs );
+	mz = (int)( ( nz + bs - 1 ) / bs );
+
+	// New block data
+	long *blockValue;
+	long **blockData;
+
+	int blocks;
+	blocks = mx * my * mz;
+	blockValue = (long*) calloc( blocks, sizeof(long) ); // Sets to 0s
+	blockData = (long**) calloc( blocks, sizeof(long*) ); // Sets to NULLs
+
+	if( blockValue == NULL || blockData == NULL )
+	{
+	   fprintf(stderr, "sparLongResize error: Out of memory\n");
+	   exit(1);
+	}
+
+	int i, j, k;
+
+	// Move existing blocks, create new blocks
+	for( k = 0 ; k < mz ; k++ )
+	{
+		for( j = 0 ; j < my ; j++ )
+		{
+			for( i = 0 ; i < mx ; i++ )
+			{
+				if( i < matrix->mx && j < matrix->my && k < matrix->mz )
+				{
+					blockValue[ i + mx * ( j + my * k ) ]
+						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
+					blockData[ i + mx * ( j + my * k ) ]
+						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
+				}
+				else
+				{
+					blockValue[ i + mx * ( j + my * k ) ] = def;
+				}
+			}
+		}
+	}
+
+	// Free excedent blocks
+	for( k = 0 ; k < matrix->mz ; k++ )
+	{
+		for( j = 0 ; j < matrix->my ; j++ )
+		{
+			for( i = 0 ; i < matrix->mx ; i++ )
+			{
+				if( ( i >= mx || j >= my || k >= mz ) &&
+					matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
+				{
+					free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
+				}
+			}
+		}
+	}
+
+	// Previous matrix size
+	int ox, oy, oz;
+	ox = matrix->nx;
+	oy = matrix->ny;
+	oz = matrix->nz;
+
+	matrix->nx = nx;
+	matrix->ny = ny;
+	matrix->nz = nz;
+	matrix->mx = mx;
+	matrix->my = my;
+	matrix->mz = mz;
+
+	free(matrix->blockData);
+	free(matrix->blockValue);
+
+	matrix->blockData = blockData;
+	matrix->blockValue = blockValue;
+
+	// Set expanded elements of previous boundary blocks to default, block by block
+	if( nx > ox )
+	{
+		sparLongFillBox( matrix, ox, 0, 0, nx - ox, ny, nz, def );
+	}
+	if( ny > oy )
+	{
+		sparLongFillBox( matrix, 0, oy, 0, nx, ny - oy, nz, def );
+	}
+	if( nz > oz )
+	{
+		sparLongFillBox( matrix, 0, 0, oz, nx, ny, nz - oz, def );
+	}
+
+	// Reallocate block locks for the new block grid
+	free(matrix->blockLock);
+	matrix->blockLock = (atomic_flag*) malloc( matrix->mx * matrix->my * matrix->mz * sizeof(atomic_flag) );
+
+	if( matrix->blockLock == NULL )
+	{
+	   fprintf(stderr, "sparLongResize error: Out of memory\n");
+	   exit(1);
+	}
+
+	sparLongClearLocks( matrix );
+}
+
+// Sum of matrix elements
+double sparLongSum( sparLong *matrix )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	double sum;
+	sum = 0.0;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:sum) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		long *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, value times element count
+		if( blockData == NULL )
+		{
+			sum += (double)( matrix->blockValue[n] ) * ex * ey * ez;
+		}
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
+		{
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				sum += (double)( blockData[i] );
+			}
+		}
+		// Boundary heterogeneous block, skip outside elements
+		else
+		{
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					long *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						sum += (double)( row[i] );
+					}
+				}
+			}
+		}
+	}
+
+	return sum;
+}
+
+// First matrix element in block order that is not NaN, NaN only if every element is NaN
+long sparLongFirstNumber( sparLong *matrix )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// For each block
+	int n;
+	for( n = 0 ; n < matrix->mx * matrix->my * matrix->mz ; n++ )
+	{
+		long *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block
+		if( blockData == NULL )
+		{
+			if( !isnan( (double) matrix->blockValue[n] ) )
+			{
+				return matrix->blockValue[n];
+			}
+			continue;
+		}
+
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % matrix->mx;
+		j1 = ( n / matrix->mx ) % matrix->my;
+		k1 = n / ( matrix->mx * matrix->my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs < bs ? matrix->nx - i1 * bs : bs;
+		ey = matrix->ny - j1 * bs < bs ? matrix->ny - j1 * bs : bs;
+		ez = matrix->nz - k1 * bs < bs ? matrix->nz - k1 * bs : bs;
+
+		// Heterogeneous block, skip outside elements
+		int i, j, k;
+		for( k = 0 ; k < ez ; k++ )
+		{
+			for( j = 0 ; j < ey ; j++ )
+			{
+				for( i = 0 ; i < ex ; i++ )
+				{
+					if( !isnan( (double) blockData[ i + bs * ( j + bs * k ) ] ) )
+					{
+						return blockData[ i + bs * ( j + bs * k ) ];
+					}
+				}
+			}
+		}
+	}
+
+	return sparLongGet( matrix, 0, 0, 0 );
+}
+
+// Minimum matrix element, NaN elements ignored (NaN only if all are NaN)
+long sparLongMin( sparLong *matrix )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Start with an element that is not NaN, comparisons with NaN are false so NaN never replaces it
+	long value;
+	value = sparLongFirstNumber( matrix );
+
+	// Every element is NaN
+	if( isnan( (double) value ) )
+	{
+		return value;
+	}
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(min:value) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		long *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block
+		if( blockData == NULL )
+		{
+			if( matrix->blockValue[n] < value )
+			{
+				value = matrix->blockValue[n];
+			}
+		}
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
+		{
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				value = blockData[i] < value ? blockData[i] : value;
+			}
+		}
+		// Boundary heterogeneous block, skip outside elements
+		else
+		{
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					long *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						value = row[i] < value ? row[i] : value;
+					}
+				}
+			}
+		}
+	}
+
+	return value;
+}
+
+// Maximum matrix element, NaN elements ignored (NaN only if all are NaN)
+long sparLongMax( sparLong *matrix )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Start with an element that is not NaN, comparisons with NaN are false so NaN never replaces it
+	long value;
+	value = sparLongFirstNumber( matrix );
+
+	// Every element is NaN
+	if( isnan( (double) value ) )
+	{
+		return value;
+	}
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(max:value) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		long *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block
+		if( blockData == NULL )
+		{
+			if( matrix->blockValue[n] > value )
+			{
+				value = matrix->blockValue[n];
+			}
+		}
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
+		{
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				value = blockData[i] > value ? blockData[i] : value;
+			}
+		}
+		// Boundary heterogeneous block, skip outside elements
+		else
+		{
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					long *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						value = row[i] > value ? row[i] : value;
+					}
+				}
+			}
+		}
+	}
+
+	return value;
+}
+
+// Number of matrix elements different from the default value
+double sparLongCount( sparLong *matrix )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Default value
+	long def;
+	def = matrix->def;
+
+	double count;
+	count = 0.0;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:count) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		long *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, all or none of its elements
+		if( blockData == NULL )
+		{
+			if( sparLongEqual( matrix->blockValue[n], def ) == 0 )
+			{
+				count += (double)( ex * ey * ez );
+			}
+		}
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
+		{
+			int i, c;
+			c = 0;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				c += ( sparLongEqual( blockData[i], def ) == 0 );
+			}
+			count += (double)( c );
+		}
+		// Boundary heterogeneous block, skip outside elements
+		else
+		{
+			int i, j, k, c;
+			c = 0;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					long *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						c += ( sparLongEqual( row[i], def ) == 0 );
+					}
+				}
+			}
+			count += (double)( c );
+		}
+	}
+
+	return count;
+}
+
+// Fold f over matrix elements from identity, f gets each uniform block once with its element count
+double sparLongReduce( sparLong *matrix, double (*f)( double acc, long value, int count ), double identity )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	double acc;
+	acc = identity;
+
+	// For each block, sequential so f needs no combine step
+	int n;
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		long *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, a single call for all its elements
+		if( blockData == NULL )
+		{
+			acc = f( acc, matrix->blockValue[n], ex * ey * ez );
+		}
+		// Heterogeneous block, skip outside elements
+		else
+		{
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					long *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						acc = f( acc, row[i], 1 );
+					}
+				}
+			}
+		}
+	}
+
+	return acc;
+}
+
+// Apply function f to every matrix element (and default value) in place
+void sparLongApply( sparLong *matrix, long (*f)( long ) )
+{
+	// Block size
+	int bs3;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		long *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, transform its value only
+		if( blockData == NULL )
+		{
+			matrix->blockValue[n] = f( matrix->blockValue[n] );
+		}
+		// Heterogeneous block, transform and reduce if possible
+		else
+		{
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				blockData[i] = f( blockData[i] );
+			}
+			sparLongReduceBlock( matrix, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
+	}
+
+	// Keep the background consistent with transformed uniform blocks
+	matrix->def = f( matrix->def );
+}
+
+// New matrix with function f applied to every element (and default value)
+sparLong* sparLongMap( sparLong *matrix, long (*f)( long ) )
+{
+	// Declare matrix and init
+	sparLong *matrix2;
+	matrix2 = sparLongInit( matrix->nx, matrix->ny, matrix->nz,
+						matrix->bs, f( matrix->def ) );
+
+	// Copy ring buffer origin
+	matrix2->ox = matrix->ox;
+	matrix2->oy = matrix->oy;
+	matrix2->oz = matrix->oz;
+
+	// Block size
+	int bs3;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		long *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, transform its value only
+		if( blockData == NULL )
+		{
+			matrix2->blockValue[n] = f( matrix->blockValue[n] );
+		}
+		// Heterogeneous block, transform into new block and reduce if possible
+		else
+		{
+			long *blockData2;
+			blockData2 = (long*) calloc( bs3, sizeof(long) );
+
+			if( blockData2 == NULL )
+			{
+			   fprintf(stderr, "sparLongMap error: Out of memory\n");
+			   exit(1);
+			}
+
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				blockData2[i] = f( blockData[i] );
+			}
+			matrix2->blockData[n] = blockData2;
+			sparLongReduceBlock( matrix2, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
+	}
+
+	return matrix2;
+}
+
+// Visit elements different from the default value, in block order
+void sparLongForEach( sparLong *matrix, void (*f)( int x, int y, int z, long value, void *data ), void *data )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Default value
+	long def;
+	def = matrix->def;
+
+	int i, j, k;
+	int i1, j1, k1;
+	int ex, ey, ez;
+	int n;
+
+	// For each block
+	for( k1 = 0 ; k1 < matrix->mz ; k1++ )
+	{
+		for( j1 = 0 ; j1 < matrix->my ; j1++ )
+		{
+			for( i1 = 0 ; i1 < matrix->mx ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				long *blockData;
+				blockData = matrix->blockData[n];
+
+				// Skip uniform blocks equal to the default value
+				if( blockData == NULL && sparLongEqual( matrix->blockValue[n], def ) )
+				{
+					continue;
+				}
+
+				// Block extent inside the matrix
+				ex = matrix->nx - i1 * bs;
+				ey = matrix->ny - j1 * bs;
+				ez = matrix->nz - k1 * bs;
+				if( ex > bs ) ex = bs;
+				if( ey > bs ) ey = bs;
+				if( ez > bs ) ez = bs;
+
+				// Uniform block, every element
+				if( blockData == NULL )
+				{
+					long value;
+					value = matrix->blockValue[n];
+					for( k = 0 ; k < ez ; k++ )
+					{
+						for( j = 0 ; j < ey ; j++ )
+						{
+							for( i = 0 ; i < ex ; i++ )
+							{
+								f( i1 * bs + i, j1 * bs + j, k1 * bs + k, value, data );
+							}
+						}
+					}
+				}
+				// Heterogeneous block, non-default elements
+				else
+				{
+					for( k = 0 ; k < ez ; k++ )
+					{
+						for( j = 0 ; j < ey ; j++ )
+						{
+							long *row;
+							row = blockData + bs * ( j + bs * k );
+							for( i = 0 ; i < ex ; i++ )
+							{
+								if( sparLongEqual( row[i], def ) == 0 )
+								{
+									f( i1 * bs + i, j1 * bs + j, k1 * bs + k, row[i], data );
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// Visit maximal runs of equal non-default elements along x, (x,y,z) to (x+n-1,y,z), merged across blocks
+void sparLongForEachRun( sparLong *matrix, void (*f)( int x, int y, int z, int n, long value, void *data ), void *data )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Default value
+	long def;
+	def = matrix->def;
+
+	int i, j, k;
+	int i1, j1, k1;
+	int ex, ey, ez;
+	int n;
+
+	// Current run (rx,y,z) to (rx+rn-1,y,z) of value rv
+	int rx, rn;
+	long rv;
+
+	// For each row of blocks
+	for( k1 = 0 ; k1 < matrix->mz ; k1++ )
+	{
+		for( j1 = 0 ; j1 < matrix->my ; j1++ )
+		{
+			// Block row extent inside the matrix
+			ey = matrix->ny - j1 * bs;
+			ez = matrix->nz - k1 * bs;
+			if( ey > bs ) ey = bs;
+			if( ez > bs ) ez = bs;
+
+			// For each matrix row, runs continue from one block into the next
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					rx = 0;
+					rn = 0;
+					rv = def;
+
+					for( i1 = 0 ; i1 < matrix->mx ; i1++ )
+					{
+						// Linear block index (n) <-> (i1,j1,k1)
+						n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+						ex = matrix->nx - i1 * bs;
+						if( ex > bs ) ex = bs;
+
+						long *blockData;
+						blockData = matrix->blockData[n];
+
+						// Uniform block, extend or restart the run with its whole row
+						if( blockData == NULL )
+						{
+							if( rn > 0 && sparLongEqual( matrix->blockValue[n], rv ) )
+							{
+								rn += ex;
+							}
+							else
+							{
+								if( rn > 0 && sparLongEqual( rv, def ) == 0 )
+								{
+									f( rx, j1 * bs + j, k1 * bs + k, rn, rv, data );
+								}
+								rx = i1 * bs;
+								rn = ex;
+								rv = matrix->blockValue[n];
+							}
+						}
+						// Heterogeneous block, element by element
+						else
+						{
+							long *row;
+							row = blockData + bs * ( j + bs * k );
+							for( i = 0 ; i < ex ; i++ )
+							{
+								if( rn > 0 && sparLongEqual( row[i], rv ) )
+								{
+									rn++;
+								}
+								else
+								{
+									if( rn > 0 && sparLongEqual( rv, def ) == 0 )
+									{
+										f( rx, j1 * bs + j, k1 * bs + k, rn, rv, data );
+									}
+									rx = i1 * bs + i;
+									rn = 1;
+									rv = row[i];
+								}
+							}
+						}
+					}
+
+					// End of row
+					if( rn > 0 && sparLongEqual( rv, def ) == 0 )
+					{
+						f( rx, j1 * bs + j, k1 * bs + k, rn, rv, data );
+					}
+				}
+			}
+		}
+	}
+}
+
+// Element-wise operation between arrays, c[i] = a[i] op b[i]
+void sparLongOpArray( long *c, long *a, long *b, int n, int op, long def )
+{
+	int i;
+	switch( op )
+	{
+		case SPAR_ADD:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] + b[i];
+			}
+			break;
+		case SPAR_SUB:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] - b[i];
+			}
+			break;
+		case SPAR_MUL:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] * b[i];
+			}
+			break;
+		case SPAR_MIN:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] < b[i] ? a[i] : b[i];
+			}
+			break;
+		case SPAR_MAX:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] > b[i] ? a[i] : b[i];
+			}
+			break;
+		case SPAR_MASK:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = b[i] != 0 ? a[i] : def;
+			}
+			break;
+		default:
+			fprintf(stderr, "sparLongOpArray error: Unknown operation\n");
+			exit(1);
+	}
+}
+
+// Element-wise operation between array and scalar, c[i] = a[i] op value
+void sparLongOpArrayScalar( long *c, long *a, long value, int n, int op, long def )
+{
+	int i;
+	switch( op )
+	{
+		case SPAR_ADD:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] + value;
+			}
+			break;
+		case SPAR_SUB:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] - value;
+			}
+			break;
+		case SPAR_MUL:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] * value;
+			}
+			break;
+		case SPAR_MIN:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] < value ? a[i] : value;
+			}
+			break;
+		case SPAR_MAX:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] > value ? a[i] : value;
+			}
+			break;
+		case SPAR_MASK:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = value != 0 ? a[i] : def;
+			}
+			break;
+		default:
+			fprintf(stderr, "sparLongOpArrayScalar error: Unknown operation\n");
+			exit(1);
+	}
+}
+
+// New matrix with element-wise operation between matrices, c = a op b
+sparLong* sparLongOp( sparLong *a, sparLong *b, int op )
+{
+	// Check matrix size
+	if( a->nx != b->nx || a->ny != b->ny || a->nz != b->nz )
+	{
+		fprintf(stderr, "sparLongOp error: Matrix sizes must agree\n");
+		exit(1);
+	}
+
+	// Check ring buffer origin, blocks are combined by storage index
+	if( a->ox != b->ox || a->oy != b->oy || a->oz != b->oz )
+	{
+		fprintf(stderr, "sparLongOp error: Ring buffer origins must agree\n");
+		exit(1);
+	}
+
+	// Result default value
+	long def;
+	sparLongOpArrayScalar( &def, &a->def, b->def, 1, op, a->def );
+
+	// Declare result matrix with block size of a
+	sparLong *c;
+	c = sparLongInit( a->nx, a->ny, a->nz, a->bs, def );
+
+	// Copy ring buffer origin of a
+	c->ox = a->ox;
+	c->oy = a->oy;
+	c->oz = a->oz;
+
+	// Block size
+	int bs, bs3;
+	bs = a->bs;
+	bs3 = a->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = a->mx;
+	my = a->my;
+	mz = a->mz;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block of b resampled on the block grid of a
+		long *buffer;
+		buffer = NULL;
+
+		if( b->bs != bs )
+		{
+			buffer = (long*) malloc( bs3 * sizeof(long) );
+
+			if( buffer == NULL )
+			{
+			   fprintf(stderr, "sparLongOp error: Out of memory\n");
+			   exit(1);
+			}
+		}
+
+		// For each block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < mx * my * mz ; n++ )
+		{
+			// Block (i1,j1,k1) <-> (n)
+			int i1, j1, k1;
+			i1 = n % mx;
+			j1 = ( n / mx ) % my;
+			k1 = n / ( mx * my );
+
+			// Block of b, uniform (blockB == NULL) or heterogeneous
+			long *blockB, valueB;
+			if( b->bs == bs )
+			{
+				blockB = b->blockData[n];
+				valueB = b->blockValue[n];
+			}
+			else if( sparLongUniformBox( b, i1 * bs, j1 * bs, k1 * bs, bs, bs, bs, &valueB ) )
+			{
+				blockB = NULL;
+			}
+			else
+			{
+				sparLongGetBox( b, i1 * bs, j1 * bs, k1 * bs, bs, bs, bs, buffer );
+				blockB = buffer;
+			}
+
+			// Block of a
+			long *blockA, valueA;
+			blockA = a->blockData[n];
+			valueA = a->blockValue[n];
+
+			// Both uniform, one operation
+			if( blockA == NULL && blockB == NULL )
+			{
+				sparLongOpArrayScalar( &c->blockValue[n], &valueA, valueB, 1, op, a->def );
+				continue;
+			}
+
+			// Heterogeneous result
+			long *blockC;
+			blockC = (long*) calloc( bs3, sizeof(long) );
+
+			if( blockC == NULL )
+			{
+			   fprintf(stderr, "sparLongOp error: Out of memory\n");
+			   exit(1);
+			}
+
+			// Uniform b, scalar operation
+			if( blockB == NULL )
+			{
+				sparLongOpArrayScalar( blockC, blockA, valueB, bs3, op, a->def );
+			}
+			// Uniform a, expand into result and operate in place
+			else if( blockA == NULL )
+			{
+				int i;
+				for( i = 0 ; i < bs3 ; i++ )
+				{
+					blockC[i] = valueA;
+				}
+				sparLongOpArray( blockC, blockC, blockB, bs3, op, a->def );
+			}
+			// Both heterogeneous
+			else
+			{
+				sparLongOpArray( blockC, blockA, blockB, bs3, op, a->def );
+			}
+
+			c->blockData[n] = blockC;
+			sparLongReduceBlock( c, i1, j1, k1 );
+		}
+
+		free(buffer);
+	}
+
+	return c;
+}
+
+// Element-wise operation with scalar in place, matrix = matrix op value
+void sparLongOpScalar( sparLong *matrix, long value, int op )
+{
+	// Block size
+	int bs3;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Default value of the operation (SPAR_MASK)
+	long def;
+	def = matrix->def;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		long *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, one operation
+		if( blockData == NULL )
+		{
+			sparLongOpArrayScalar( &matrix->blockValue[n], &matrix->blockValue[n], value, 1, op, def );
+		}
+		// Heterogeneous block, operate in place and reduce if possible
+		else
+		{
+			sparLongOpArrayScalar( blockData, blockData, value, bs3, op, def );
+			sparLongReduceBlock( matrix, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
+	}
+
+	// Keep the background consistent with updated uniform blocks
+	sparLongOpArrayScalar( &matrix->def, &matrix->def, value, 1, op, def );
+}
+
+// Stencil of radius r from src into dst, f(c) reads neighbours c[i+sy*j+sz*k] with -r <= i,j,k <= r
+void sparLongStencil( sparLong *dst, sparLong *src, int r, long (*f)( long *c, int r, int sy, int sz, void *data ), void *data )
+{
+	// Check matrices
+	if( dst == src )
+	{
+		fprintf(stderr, "sparLongStencil error: Source and destination must be different\n");
+		exit(1);
+	}
+
+	if( dst->nx != src->nx || dst->ny != src->ny || dst->nz != src->nz )
+	{
+		fprintf(stderr, "sparLongStencil error: Matrix sizes must agree\n");
+		exit(1);
+	}
+
+	if( r < 0 )
+	{
+		fprintf(stderr, "sparLongStencil error: Radius must be non-negative\n");
+		exit(1);
+	}
+
+	// Destination block size
+	int bs, bs3;
+	bs = dst->bs;
+	bs3 = dst->bs3;
+
+	// Destination block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = dst->mx;
+	my = dst->my;
+	mz = dst->mz;
+
+	// Block plus halo size (hs,hs,hs)
+	int hs;
+	hs = bs + 2 * r;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block plus halo of the source
+		long *halo;
+		halo = (long*) malloc( hs * hs * hs * sizeof(long) );
+
+		if( halo == NULL )
+		{
+		   fprintf(stderr, "sparLongStencil error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each destination block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < mx * my * mz ; n++ )
+		{
+			// Block (i1,j1,k1) <-> (n)
+			int i1, j1, k1;
+			i1 = n % mx;
+			j1 = ( n / mx ) % my;
+			k1 = n / ( mx * my );
+
+			// Block origin
+			int x, y, z;
+			x = i1 * bs;
+			y = j1 * bs;
+			z = k1 * bs;
+
+			// Free previous destination data
+			if( dst->blockData[n] != NULL )
+			{
+				free(dst->blockData[n]);
+				dst->blockData[n] = NULL;
+			}
+
+			// Uniform neighbourhood, uniform destination block
+			long value;
+			if( sparLongUniformBox( src, x - r, y - r, z - r, hs, hs, hs, &value ) &&
+				( sparLongEqual( value, src->def ) || ( x >= r && y >= r && z >= r &&
+				  x + bs + r <= src->nx && y + bs + r <= src->ny && z + bs + r <= src->nz ) ) )
+			{
+				int w, i;
+				w = 2 * r + 1;
+				for( i = 0 ; i < w * w * w ; i++ )
+				{
+					halo[i] = value;
+				}
+				dst->blockValue[n] = f( halo + r + w * ( r + w * r ), r, w, w * w, data );
+				continue;
+			}
+
+			// Read block plus halo
+			sparLongGetBox( src, x - r, y - r, z - r, hs, hs, hs, halo );
+
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = dst->nx - x;
+			ey = dst->ny - y;
+			ez = dst->nz - z;
+			if( ex > bs ) ex = bs;
+			if( ey > bs ) ey = bs;
+			if( ez > bs ) ez = bs;
+
+			// Apply stencil
+			long *blockData;
+			blockData = (long*) calloc( bs3, sizeof(long) );
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparLongStencil error: Out of memory\n");
+			   exit(1);
+			}
+
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					long *c;
+					c = halo + r + hs * ( ( j + r ) + hs * ( k + r ) );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						blockData[ i + bs * ( j + bs * k ) ] = f( c + i, r, hs, hs * hs, data );
+					}
+				}
+			}
+
+			// Write block and reduce if possible
+			dst->blockData[n] = blockData;
+			sparLongReduceBlock( dst, i1, j1, k1 );
+		}
+
+		free(halo);
+	}
+}
+
+// Stencil kernel, weighted sum of the neighbourhood with data holding (2r+1)^3 weights
+long sparLongConvolveKernel( long *c, int r, int sy, int sz, void *data )
+{
+	double *weights;
+	weights = (double*) data;
+
+	double sum;
+	sum = 0.0;
+
+	int i, j, k;
+	for( k = -r ; k <= r ; k++ )
+	{
+		for( j = -r ; j <= r ; j++ )
+		{
+			for( i = -r ; i <= r ; i++ )
+			{
+				sum += *weights++ * (double)( c[ i + sy * j + sz * k ] );
+			}
+		}
+	}
+
+	return sparLongRound( sum );
+}
+
+// Convolution of src into dst with weights[(i+r)+(2r+1)*((j+r)+(2r+1)*(k+r))]
+void sparLongConvolve( sparLong *dst, sparLong *src, int r, double *weights )
+{
+	sparLongStencil( dst, src, r, sparLongConvolveKernel, weights );
+}
+
+// One-dimensional filter of src into dst along axis (0 x, 1 y, 2 z) with 2r+1 weights, box (moving average) if weights is NULL
+void sparLongFilterAxis( sparLong *dst, sparLong *src, int axis, int r, double *weights )
+{
+	// Check matrices
+	if( dst == src )
+	{
+		fprintf(stderr, "sparLongFilterAxis error: Source and destination must be different\n");
+		exit(1);
+	}
+
+	if( dst->nx != src->nx || dst->ny != src->ny || dst->nz != src->nz )
+	{
+		fprintf(stderr, "sparLongFilterAxis error: Matrix sizes must agree\n");
+		exit(1);
+	}
+
+	if( axis < 0 || axis > 2 || r < 0 )
+	{
+		fprintf(stderr, "sparLongFilterAxis error: Invalid axis or radius\n");
+		exit(1);
+	}
+
+	// Destination block size
+	int bs, bs3;
+	bs = dst->bs;
+	bs3 = dst->bs3;
+
+	// Destination block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = dst->mx;
+	my = dst->my;
+	mz = dst->mz;
+
+	// Halo radius (rx,ry,rz) and block plus halo size (hx,hy,hz)
+	int rx, ry, rz;
+	rx = axis == 0 ? r : 0;
+	ry = axis == 1 ? r : 0;
+	rz = axis == 2 ? r : 0;
+
+	int hx, hy, hz;
+	hx = bs + 2 * rx;
+	hy = bs + 2 * ry;
+	hz = bs + 2 * rz;
+
+	// Element strides along the filter axis in the halo and in the block
+	int hstride, bstride;
+	hstride = axis == 0 ? 1 : ( axis == 1 ? hx : hx * hy );
+	bstride = axis == 0 ? 1 : ( axis == 1 ? bs : bs * bs );
+
+	// Sum of weights
+	double wsum;
+	wsum = 1.0;
+	if( weights != NULL )
+	{
+		int i;
+		wsum = 0.0;
+		for( i = 0 ; i < 2 * r + 1 ; i++ )
+		{
+			wsum += weights[i];
+		}
+
+		// Normalized kernel, keep uniform values exact
+		if( fabs( wsum - 1.0 ) < 1e-9 )
+		{
+			wsum = 1.0;
+		}
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block plus halo of the source and one line along the axis
+		long *halo;
+		double *line;
+		halo = (long*) malloc( hx * hy * hz * sizeof(long) );
+		line = (double*) malloc( ( bs + 2 * r ) * sizeof(double) );
+
+		if( halo == NULL || line == NULL )
+		{
+		   fprintf(stderr, "sparLongFilterAxis error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each destination block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < mx * my * mz ; n++ )
+		{
+			// Block (i1,j1,k1) <-> (n)
+			int i1, j1, k1;
+			i1 = n % mx;
+			j1 = ( n / mx ) % my;
+			k1 = n / ( mx * my );
+
+			// Block origin
+			int x, y, z;
+			x = i1 * bs;
+			y = j1 * bs;
+			z = k1 * bs;
+
+			// Free previous destination data
+			if( dst->blockData[n] != NULL )
+			{
+				free(dst->blockData[n]);
+				dst->blockData[n] = NULL;
+			}
+
+			// Run of uniform blocks along the axis, uniform destination block
+			long value;
+			if( sparLongUniformBox( src, x - rx, y - ry, z - rz, hx, hy, hz, &value ) &&
+				( sparLongEqual( value, src->def ) || ( x >= rx && y >= ry && z >= rz &&
+				  x + bs + rx <= src->nx && y + bs + ry <= src->ny && z + bs + rz <= src->nz ) ) )
+			{
+				dst->blockValue[n] = weights == NULL || wsum == 1.0 ? value : sparLongRound( wsum * value );
+				continue;
+			}
+
+			// Read block plus halo
+			sparLongGetBox( src, x - rx, y - ry, z - rz, hx, hy, hz, halo );
+
+			long *blockData;
+			blockData = (long*) calloc( bs3, sizeof(long) );
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparLongFilterAxis error: Out of memory\n");
+			   exit(1);
+			}
+
+			// For each line along the axis, (a,b) are the other two block indices
+			int a, b, i;
+			for( b = 0 ; b < bs ; b++ )
+			{
+				for( a = 0 ; a < bs ; a++ )
+				{
+					// First line element in the halo and in the block
+					long *hline, *bline;
+					if( axis == 0 )
+					{
+						hline = halo + hx * ( a + hy * b );
+						bline = blockData + bs * ( a + bs * b );
+					}
+					else if( axis == 1 )
+					{
+						hline = halo + a + hx * hy * b;
+						bline = blockData + a + bs * bs * b;
+					}
+					else
+					{
+						hline = halo + a + hx * b;
+						bline = blockData + a + bs * b;
+					}
+
+					// Gather line
+					for( i = 0 ; i < bs + 2 * r ; i++ )
+					{
+						line[i] = (double)( hline[ i * hstride ] );
+					}
+
+					// Box, sliding window sum
+					if( weights == NULL )
+					{
+						double sum;
+						sum = 0.0;
+						for( i = 0 ; i < 2 * r + 1 ; i++ )
+						{
+							sum += line[i];
+						}
+						for( i = 0 ; i < bs ; i++ )
+						{
+							bline[ i * bstride ] = sparLongRound( sum / ( 2 * r + 1 ) );
+							if( i + 1 < bs )
+							{
+								sum += line[ i + 2 * r + 1 ] - line[i];
+							}
+						}
+					}
+					// Weighted window as offsets from the centre element, exact on constant lines
+					else
+					{
+						int w;
+						for( i = 0 ; i < bs ; i++ )
+						{
+							double sum;
+							sum = 0.0;
+							for( w = 0 ; w < 2 * r + 1 ; w++ )
+							{
+								sum += weights[w] * ( line[ i + w ] - line[ i + r ] );
+							}
+							bline[ i * bstride ] = sparLongRound( wsum * line[ i + r ] + sum );
+						}
+					}
+				}
+			}
+
+			// Write block and reduce if possible
+			dst->blockData[n] = blockData;
+			sparLongReduceBlock( dst, i1, j1, k1 );
+		}
+
+		free(halo);
+		free(line);
+	}
+}
+
+// Box filter (mean over (2r+1)^3 neighbourhood) of src into dst, three one-dimensional passes
+void sparLongBoxFilter( sparLong *dst, sparLong *src, int r )
+{
+	// Temporal matrix for the second pass, intermediate passes see the source default value outside the matrix
+	sparLong *tmp;
+	tmp = sparLongInit( dst->nx, dst->ny, dst->nz, dst->bs, src->def );
+
+	long def;
+	def = dst->def;
+	dst->def = src->def;
+
+	sparLongFilterAxis( dst, src, 0, r, NULL );
+	sparLongFilterAxis( tmp, dst, 1, r, NULL );
+
+	dst->def = def;
+	sparLongFilterAxis( dst, tmp, 2, r, NULL );
+
+	sparLongFree( tmp );
+}
+
+// Gaussian filter of standard deviation sigma of src into dst, three one-dimensional passes
+void sparLongGaussianFilter( sparLong *dst, sparLong *src, double sigma )
+{
+	if( !( sigma > 0.0 ) )
+	{
+		fprintf(stderr, "sparLongGaussianFilter error: Standard deviation must be positive\n");
+		exit(1);
+	}
+
+	// Normalized kernel truncated at 3 sigma
+	int r;
+	r = (int)( ceil( 3.0 * sigma ) );
+
+	double *weights;
+	weights = (double*) malloc( ( 2 * r + 1 ) * sizeof(double) );
+
+	if( weights == NULL )
+	{
+	   fprintf(stderr, "sparLongGaussianFilter error: Out of memory\n");
+	   exit(1);
+	}
+
+	int i;
+	double sum;
+	sum = 0.0;
+	for( i = -r ; i <= r ; i++ )
+	{
+		weights[ i + r ] = exp( -0.5 * i * i / ( sigma * sigma ) );
+		sum += weights[ i + r ];
+	}
+	for( i = 0 ; i < 2 * r + 1 ; i++ )
+	{
+		weights[i] /= sum;
+	}
+
+	// Temporal matrix for the second pass, intermediate passes see the source default value outside the matrix
+	sparLong *tmp;
+	tmp = sparLongInit( dst->nx, dst->ny, dst->nz, dst->bs, src->def );
+
+	long def;
+	def = dst->def;
+	dst->def = src->def;
+
+	sparLongFilterAxis( dst, src, 0, r, weights );
+	sparLongFilterAxis( tmp, dst, 1, r, weights );
+
+	dst->def = def;
+	sparLongFilterAxis( dst, tmp, 2, r, weights );
+
+	sparLongFree( tmp );
+	free(weights);
+}
+
+// Union-find root of node i with path halving (connected component labeling)
+int sparLongLabelFind( int *parent, int i )
+{
+	while( parent[i] != i )
+	{
+		parent[i] = parent[ parent[i] ];
+		i = parent[i];
+	}
+	return i;
+}
+
+// Union-find merge of the sets of nodes i and j, the smallest node is kept as root
+void sparLongLabelUnion( int *parent, int i, int j )
+{
+	i = sparLongLabelFind( parent, i );
+	j = sparLongLabelFind( parent, j );
+	if( i < j )
+	{
+		parent[j] = i;
+	}
+	else if( j < i )
+	{
+		parent[i] = j;
+	}
+}
+
+// Union-find node of element (x,y,z), -1 for elements equal to the default value
+int sparLongLabelNode( sparLong *matrix, int *offset, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Linear block index (n) <-> (x/bs,y/bs,z/bs)
+	int n;
+	n = x / bs + matrix->mx * ( y / bs + matrix->my * ( z / bs ) );
+
+	// Uniform block, one node or none
+	if( matrix->blockData[n] == NULL )
+	{
+		return offset[n];
+	}
+
+	// Heterogeneous block, one node per element
+	int i;
+	i = x % bs + bs * ( y % bs + bs * ( z % bs ) );
+	if( sparLongEqual( matrix->blockData[n][i], matrix->def ) )
+	{
+		return -1;
+	}
+	return offset[n] + i;
+}
+
+// Connect block (x,y,z) with its neighbour block across the lower face along axis (0 x, 1 y, 2 z)
+void sparLongLabelFace( sparLong *matrix, int *offset, int *parent, int x, int y, int z, int axis )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Neighbour block
+	int x2, y2, z2;
+	x2 = x - ( axis == 0 );
+	y2 = y - ( axis == 1 );
+	z2 = z - ( axis == 2 );
+
+	// Linear block indices
+	int n, n2;
+	n = x + matrix->mx * ( y + matrix->my * z );
+	n2 = x2 + matrix->mx * ( y2 + matrix->my * z2 );
+
+	// Any default uniform block, nothing to connect
+	if( offset[n] < 0 || offset[n2] < 0 )
+	{
+		return;
+	}
+
+	// Both uniform, one connection
+	if( matrix->blockData[n] == NULL && matrix->blockData[n2] == NULL )
+	{
+		sparLongLabelUnion( parent, offset[n], offset[n2] );
+		return;
+	}
+
+	// Block extent inside the matrix
+	int ex, ey, ez;
+	ex = matrix->nx - x * bs;
+	ey = matrix->ny - y * bs;
+	ez = matrix->nz - z * bs;
+	if( ex > bs ) ex = bs;
+	if( ey > bs ) ey = bs;
+	if( ez > bs ) ez = bs;
+
+	// Face elements
+	int a, b, na, nb;
+	na = axis == 0 ? ey : ex;
+	nb = axis == 2 ? ey : ez;
+	for( b = 0 ; b < nb ; b++ )
+	{
+		for( a = 0 ; a < na ; a++ )
+		{
+			// Element (i,j,k) on the face and its neighbour
+			int i, j, k, node, node2;
+			i = x * bs + ( axis == 0 ? 0 : a );
+			j = y * bs + ( axis == 0 ? a : ( axis == 1 ? 0 : b ) );
+			k = z * bs + ( axis == 2 ? 0 : b );
+
+			node = sparLongLabelNode( matrix, offset, i, j, k );
+			if( node < 0 )
+			{
+				continue;
+			}
+			node2 = sparLongLabelNode( matrix, offset, i - ( axis == 0 ), j - ( axis == 1 ), k - ( axis == 2 ) );
+			if( node2 < 0 )
+			{
+				continue;
+			}
+			sparLongLabelUnion( parent, node, node2 );
+		}
+	}
+}
+
+// Connect elements inside heterogeneous block (x,y,z)
+void sparLongLabelBlock( sparLong *matrix, int *offset, int *parent, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Linear block index (n) <-> (x,y,z)
+	int n;
+	n = x + matrix->mx * ( y + matrix->my * z );
+
+	long *blockData;
+	blockData = matrix->blockData[n];
+
+	// Uniform block is a single node
+	if( blockData == NULL )
+	{
+		return;
+	}
+
+	// Block extent inside the matrix
+	int ex, ey, ez;
+	ex = matrix->nx - x * bs;
+	ey = matrix->ny - y * bs;
+	ez = matrix->nz - z * bs;
+	if( ex > bs ) ex = bs;
+	if( ey > bs ) ey = bs;
+	if( ez > bs ) ez = bs;
+
+	// Connect each non-default element with its lower neighbours
+	long def;
+	def = matrix->def;
+
+	int i, j, k, e;
+	for( k = 0 ; k < ez ; k++ )
+	{
+		for( j = 0 ; j < ey ; j++ )
+		{
+			for( i = 0 ; i < ex ; i++ )
+			{
+				e = i + bs * ( j + bs * k );
+				if( sparLongEqual( blockData[e], def ) )
+				{
+					continue;
+				}
+				if( i > 0 && sparLongEqual( blockData[ e - 1 ], def ) == 0 )
+				{
+					sparLongLabelUnion( parent, offset[n] + e, offset[n] + e - 1 );
+				}
+				if( j > 0 && sparLongEqual( blockData[ e - bs ], def ) == 0 )
+				{
+					sparLongLabelUnion( parent, offset[n] + e, offset[n] + e - bs );
+				}
+				if( k > 0 && sparLongEqual( blockData[ e - bs * bs ], def ) == 0 )
+				{
+					sparLongLabelUnion( parent, offset[n] + e, offset[n] + e - bs * bs );
+				}
+			}
+		}
+	}
+}
+
+// Label 6-connected regions of non-default elements into labels (0 elsewhere), return number of regions
+int sparLongLabel( sparLong *matrix, sparInt *labels )
+{
+	// Check matrices
+	if( labels->nx != matrix->nx || labels->ny != matrix->ny || labels->nz != matrix->nz ||
+		labels->bs != matrix->bs )
+	{
+		fprintf(stderr, "sparLongLabel error: Matrix and block sizes must agree\n");
+		exit(1);
+	}
+
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Number of blocks
+	int blocks;
+	blocks = mx * my * mz;
+
+	// First node of each block: one for non-default uniform blocks, one per element for heterogeneous blocks
+	int *offset;
+	offset = (int*) malloc( blocks * sizeof(int) );
+
+	if( offset == NULL )
+	{
+	   fprintf(stderr, "sparLongLabel error: Out of memory\n");
+	   exit(1);
+	}
+
+	double nodes;
+	nodes = 0.0;
+
+	int n;
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		if( matrix->blockData[n] != NULL )
+		{
+			offset[n] = (int)( nodes );
+			nodes += bs3;
+		}
+		else if( sparLongEqual( matrix->blockValue[n], matrix->def ) == 0 )
+		{
+			offset[n] = (int)( nodes );
+			nodes += 1;
+		}
+		else
+		{
+			offset[n] = -1;
+		}
+	}
+
+	if( nodes > INT_MAX )
+	{
+		fprintf(stderr, "sparLongLabel error: Too many heterogeneous blocks\n");
+		exit(1);
+	}
+
+	// Union-find forest, -1 for unused nodes of default elements
+	int *parent;
+	parent = (int*) malloc( ( (int)( nodes ) + 1 ) * sizeof(int) );
+
+	if( parent == NULL )
+	{
+	   fprintf(stderr, "sparLongLabel error: Out of memory\n");
+	   exit(1);
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		if( offset[n] < 0 )
+		{
+			continue;
+		}
+
+		long *blockData;
+		blockData = matrix->blockData[n];
+
+		if( blockData == NULL )
+		{
+			parent[ offset[n] ] = offset[n];
+			continue;
+		}
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - ( n % mx ) * bs;
+		ey = matrix->ny - ( ( n / mx ) % my ) * bs;
+		ez = matrix->nz - ( n / ( mx * my ) ) * bs;
+
+		int i, j, k, e;
+		for( k = 0 ; k < bs ; k++ )
+		{
+			for( j = 0 ; j < bs ; j++ )
+			{
+				for( i = 0 ; i < bs ; i++ )
+				{
+					e = i + bs * ( j + bs * k );
+					if( i < ex && j < ey && k < ez && sparLongEqual( blockData[e], matrix->def ) == 0 )
+					{
+						parent[ offset[n] + e ] = offset[n] + e;
+					}
+					else
+					{
+						parent[ offset[n] + e ] = -1;
+					}
+				}
+			}
+		}
+	}
+
+	// Connect blocks within slabs of block layers in parallel, slabs hold disjoint node ranges
+	int slab, slabs;
+	slab = 8;
+	slabs = ( mz + slab - 1 ) / slab;
+
+	int s;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(dynamic)
+	#endif
+	for( s = 0 ; s < slabs ; s++ )
+	{
+		int i1, j1, k1;
+		for( k1 = s * slab ; k1 < ( s + 1 ) * slab && k1 < mz ; k1++ )
+		{
+			for( j1 = 0 ; j1 < my ; j1++ )
+			{
+				for( i1 = 0 ; i1 < mx ; i1++ )
+				{
+					sparLongLabelBlock( matrix, offset, parent, i1, j1, k1 );
+					if( i1 > 0 )
+					{
+						sparLongLabelFace( matrix, offset, parent, i1, j1, k1, 0 );
+					}
+					if( j1 > 0 )
+					{
+						sparLongLabelFace( matrix, offset, parent, i1, j1, k1, 1 );
+					}
+					if( k1 > s * slab )
+					{
+						sparLongLabelFace( matrix, offset, parent, i1, j1, k1, 2 );
+					}
+				}
+			}
+		}
+	}
+
+	// Merge slabs across their boundary layers
+	int i1, j1;
+	for( s = 1 ; s < slabs ; s++ )
+	{
+		for( j1 = 0 ; j1 < my ; j1++ )
+		{
+			for( i1 = 0 ; i1 < mx ; i1++ )
+			{
+				sparLongLabelFace( matrix, offset, parent, i1, j1, s * slab, 2 );
+			}
+		}
+	}
+
+	// Consecutive labels from 1, roots are the smallest node of each set and parents precede children
+	int count;
+	count = 0;
+
+	int i;
+	for( i = 0 ; i < (int)( nodes ) ; i++ )
+	{
+		if( parent[i] == i )
+		{
+			parent[i] = ++count;
+		}
+		else if( parent[i] >= 0 )
+		{
+			parent[i] = parent[ parent[i] ];
+		}
+	}
+
+	// Write labels
+	labels->def = 0;
+
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		// Free previous labels
+		if( labels->blockData[n] != NULL )
+		{
+			free(labels->blockData[n]);
+			labels->blockData[n] = NULL;
+		}
+
+		// Default uniform block
+		if( offset[n] < 0 )
+		{
+			labels->blockValue[n] = 0;
+		}
+		// Non-default uniform block
+		else if( matrix->blockData[n] == NULL )
+		{
+			labels->blockValue[n] = parent[ offset[n] ];
+		}
+		// Heterogeneous block
+		else
+		{
+			int *blockData;
+			blockData = (int*) calloc( bs3, sizeof(int) );
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparLongLabel error: Out of memory\n");
+			   exit(1);
+			}
+
+			int e;
+			for( e = 0 ; e < bs3 ; e++ )
+			{
+				blockData[e] = parent[ offset[n] + e ] < 0 ? 0 : parent[ offset[n] + e ];
+			}
+
+			labels->blockData[n] = blockData;
+			sparIntReduceBlock( labels, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
+	}
+
+	free(offset);
+	free(parent);
+
+	return count;
+}
+
+// Squared distance transform of sampled function f into d (Felzenszwalb), v and z hold n and n+1 elements
+void sparLongDistanceLine( double *f, double *d, int n, int *v, double *z )
+{
+	int q, k;
+	double s;
+
+	// Lower envelope of parabolas rooted at (q,f[q])
+	k = 0;
+	v[0] = 0;
+	z[0] = -HUGE_VAL;
+	z[1] = HUGE_VAL;
+	for( q = 1 ; q < n ; q++ )
+	{
+		s = ( ( f[q] + (double)q * q ) - ( f[ v[k] ] + (double)v[k] * v[k] ) ) / ( 2.0 * ( q - v[k] ) );
+		while( s <= z[k] )
+		{
+			k--;
+			s = ( ( f[q] + (double)q * q ) - ( f[ v[k] ] + (double)v[k] * v[k] ) ) / ( 2.0 * ( q - v[k] ) );
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[ k + 1 ] = HUGE_VAL;
+	}
+
+	// Sample the envelope
+	k = 0;
+	for( q = 0 ; q < n ; q++ )
+	{
+		while( z[ k + 1 ] < q )
+		{
+			k++;
+		}
+		d[q] = (double)( q - v[k] ) * ( q - v[k] ) + f[ v[k] ];
+	}
+}
+
+// Squared distance pass along axis (0 x, 1 y, 2 z) in place, or from features of matrix if not NULL (default elements if inside)
+void sparLongDistanceAxis( sparLong *matrix, sparFloat *distance, int axis, float big, int inside )
+{
+	// Distance block size
+	int bs;
+	bs = distance->bs;
+
+	// Line length and number of block rows along the other two axes
+	int nl, ma, mb;
+	nl = axis == 0 ? distance->nx : ( axis == 1 ? distance->ny : distance->nz );
+	ma = axis == 0 ? distance->my : distance->mx;
+	mb = axis == 2 ? distance->my : distance->mz;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Row of blocks and one line
+		float *box;
+		long *source;
+		double *f, *d, *z;
+		int *v;
+		box = (float*) malloc( nl * bs * bs * sizeof(float) );
+		source = (long*) malloc( nl * bs * bs * sizeof(long) );
+		f = (double*) malloc( nl * sizeof(double) );
+		d = (double*) malloc( nl * sizeof(double) );
+		z = (double*) malloc( ( nl + 1 ) * sizeof(double) );
+		v = (int*) malloc( nl * sizeof(int) );
+
+		if( box == NULL || source == NULL || f == NULL || d == NULL || z == NULL || v == NULL )
+		{
+		   fprintf(stderr, "sparLongDistanceAxis error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each row of blocks along the axis, lines are independent
+		int g;
+		#ifdef _OPENMP
+		#pragma omp for schedule(dynamic)
+		#endif
+		for( g = 0 ; g < ma * mb ; g++ )
+		{
+			// Box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) inside the matrix
+			int x, y, zz, sx, sy, sz;
+			x = axis == 0 ? 0 : ( g % ma ) * bs;
+			y = axis == 1 ? 0 : ( axis == 0 ? ( g % ma ) * bs : ( g / ma ) * bs );
+			zz = axis == 2 ? 0 : ( g / ma ) * bs;
+			sx = axis == 0 ? distance->nx : ( distance->nx - x < bs ? distance->nx - x : bs );
+			sy = axis == 1 ? distance->ny : ( distance->ny - y < bs ? distance->ny - y : bs );
+			sz = axis == 2 ? distance->nz : ( distance->nz - zz < bs ? distance->nz - zz : bs );
+
+			int i;
+
+			// First pass, features of matrix
+			if( matrix != NULL )
+			{
+				long value;
+				if( sparLongUniformBox( matrix, x, y, zz, sx, sy, sz, &value ) )
+				{
+					sparFloatFillBox( distance, x, y, zz, sx, sy, sz,
+									  ( ( sparLongEqual( value, matrix->def ) == 0 ) != inside ) ? 0.0f : big );
+					continue;
+				}
+				sparLongGetBox( matrix, x, y, zz, sx, sy, sz, source );
+				for( i = 0 ; i < sx * sy * sz ; i++ )
+				{
+					box[i] = ( ( sparLongEqual( source[i], matrix->def ) == 0 ) != inside ) ? 0.0f : big;
+				}
+			}
+			// Next passes, constant lines are left unchanged
+			else
+			{
+				float value;
+				if( sparFloatUniformBox( distance, x, y, zz, sx, sy, sz, &value ) )
+				{
+					continue;
+				}
+				sparFloatGetBox( distance, x, y, zz, sx, sy, sz, box );
+			}
+
+			// Line stride and number of lines
+			int stride, lines;
+			stride = axis == 0 ? 1 : ( axis == 1 ? sx : sx * sy );
+			lines = sx * sy * sz / nl;
+
+			// For each line
+			int l;
+			for( l = 0 ; l < lines ; l++ )
+			{
+				// First line element
+				float *line;
+				if( axis == 0 )
+				{
+					line = box + nl * l;
+				}
+				else if( axis == 1 )
+				{
+					line = box + ( l % sx ) + sx * sy * ( l / sx );
+				}
+				else
+				{
+					line = box + l;
+				}
+
+				for( i = 0 ; i < nl ; i++ )
+				{
+					f[i] = line[ i * stride ];
+				}
+
+				sparLongDistanceLine( f, d, nl, v, z );
+
+				// Clamp at big
+				for( i = 0 ; i < nl ; i++ )
+				{
+					line[ i * stride ] = d[i] < big ? (float)( d[i] ) : big;
+				}
+			}
+
+			sparFloatSetBox( distance, x, y, zz, sx, sy, sz, box );
+		}
+
+		free(box);
+		free(source);
+		free(f);
+		free(d);
+		free(z);
+		free(v);
+	}
+}
+
+// Euclidean distance from each element to the nearest non-default element clamped at maxDistance, negative inside if sign
+void sparLongDistance( sparLong *matrix, sparFloat *distance, float maxDistance, int sign )
+{
+	// Check matrices
+	if( distance->nx != matrix->nx || distance->ny != matrix->ny || distance->nz != matrix->nz )
+	{
+		fprintf(stderr, "sparLongDistance error: Matrix sizes must agree\n");
+		exit(1);
+	}
+
+	if( !( maxDistance > 0.0f ) )
+	{
+		fprintf(stderr, "sparLongDistance error: Maximum distance must be positive\n");
+		exit(1);
+	}
+
+	// Squared distances are clamped, far regions become uniform
+	float big;
+	big = maxDistance * maxDistance;
+
+	// Squared distance to non-default elements
+	sparLongDistanceAxis( matrix, distance, 0, big, 0 );
+	sparLongDistanceAxis( NULL, distance, 1, big, 0 );
+	sparLongDistanceAxis( NULL, distance, 2, big, 0 );
+
+	// Squared distance to default elements
+	sparFloat *inner;
+	inner = NULL;
+	if( sign )
+	{
+		inner = sparFloatInit( distance->nx, distance->ny, distance->nz, distance->bs, big );
+		sparLongDistanceAxis( matrix, inner, 0, big, 1 );
+		sparLongDistanceAxis( NULL, inner, 1, big, 1 );
+		sparLongDistanceAxis( NULL, inner, 2, big, 1 );
+	}
+
+	// Distance, outer minus inner if signed
+	int mx, my, mz;
+	mx = distance->mx;
+	my = distance->my;
+	mz = distance->mz;
+
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		float *blockData, *innerData, innerValue;
+		blockData = distance->blockData[n];
+		innerData = inner == NULL ? NULL : inner->blockData[n];
+		innerValue = inner == NULL ? 0.0f : inner->blockValue[n];
+
+		// Uniform blocks
+		if( blockData == NULL && innerData == NULL )
+		{
+			distance->blockValue[n] = sqrtf( distance->blockValue[n] ) - sqrtf( innerValue );
+			continue;
+		}
+
+		// Heterogeneous blocks
+		sparFloatExpandBlock( distance, i1, j1, k1 );
+		blockData = distance->blockData[n];
+
+		int i;
+		for( i = 0 ; i < distance->bs3 ; i++ )
+		{
+			blockData[i] = sqrtf( blockData[i] ) - sqrtf( innerData == NULL ? innerValue : innerData[i] );
+		}
+
+		sparFloatReduceBlock( distance, i1, j1, k1 );
+	}
+
+	distance->def = maxDistance;
+
+	if( inner != NULL )
+	{
+		sparFloatFree( inner );
+	}
+}
+
+// Cast ray o+t*d (element (x,y,z) spans [x,x+1)) for 0 <= t <= tmax, return 1 with first non-default element hit[3] at t
+int sparLongRay( sparLong *matrix, double *o, double *d, double tmax, int *hit, double *t )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Matrix size
+	int size[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+
+	// Clip ray to the matrix bounds
+	double t0, t1;
+	t0 = 0.0;
+	t1 = tmax;
+
+	int a;
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		if( d[a] == 0.0 )
+		{
+			if( o[a] < 0.0 || o[a] >= size[a] )
+			{
+				return 0;
+			}
+		}
+		else
+		{
+			double ta, tb;
+			ta = ( 0.0 - o[a] ) / d[a];
+			tb = ( size[a] - o[a] ) / d[a];
+			if( ta > tb )
+			{
+				double tc;
+				tc = ta;
+				ta = tb;
+				tb = tc;
+			}
+			t0 = ta > t0 ? ta : t0;
+			t1 = tb < t1 ? tb : t1;
+		}
+	}
+
+	if( t0 > t1 )
+	{
+		return 0;
+	}
+
+	// Entry element, step direction, next element boundary and boundary spacing per axis
+	int v[3], step[3];
+	double tnext[3], tdelta[3];
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		v[a] = (int)( floor( o[a] + t0 * d[a] ) );
+		v[a] = v[a] < 0 ? 0 : ( v[a] >= size[a] ? size[a] - 1 : v[a] );
+		step[a] = d[a] > 0.0 ? 1 : -1;
+		tdelta[a] = d[a] == 0.0 ? HUGE_VAL : fabs( 1.0 / d[a] );
+		tnext[a] = d[a] == 0.0 ? HUGE_VAL : ( v[a] + ( step[a] > 0 ) - o[a] ) / d[a];
+	}
+
+	double tc;
+	tc = t0;
+
+	while( tc <= t1 )
+	{
+		// Linear block index (n) of element v
+		int b[3], n;
+		b[0] = v[0] / bs;
+		b[1] = v[1] / bs;
+		b[2] = v[2] / bs;
+		n = b[0] + matrix->mx * ( b[1] + matrix->my * b[2] );
+
+		// Uniform block
+		if( matrix->blockData[n] == NULL )
+		{
+			// Hit on entry
+			if( sparLongEqual( matrix->blockValue[n], matrix->def ) == 0 )
+			{
+				break;
+			}
+
+			// Skip to the block exit
+			int amin;
+			double tb[3];
+			amin = 0;
+			for( a = 0 ; a < 3 ; a++ )
+			{
+				tb[a] = d[a] == 0.0 ? HUGE_VAL : ( ( b[a] + ( step[a] > 0 ) ) * bs - o[a] ) / d[a];
+				if( tb[a] < tb[amin] )
+				{
+					amin = a;
+				}
+			}
+			tc = tb[amin];
+
+			// Element of the next block, stay inside the current block on the other axes
+			for( a = 0 ; a < 3 ; a++ )
+			{
+				if( a == amin )
+				{
+					v[a] = step[a] > 0 ? ( b[a] + 1 ) * bs : b[a] * bs - 1;
+				}
+				else
+				{
+					v[a] = (int)( floor( o[a] + tc * d[a] ) );
+					v[a] = v[a] < b[a] * bs ? b[a] * bs : ( v[a] >= ( b[a] + 1 ) * bs ? ( b[a] + 1 ) * bs - 1 : v[a] );
+				}
+				tnext[a] = d[a] == 0.0 ? HUGE_VAL : ( v[a] + ( step[a] > 0 ) - o[a] ) / d[a];
+			}
+		}
+		// Heterogeneous block, element by element
+		else
+		{
+			// Hit
+			int i;
+			i = v[0] % bs + bs * ( v[1] % bs + bs * ( v[2] % bs ) );
+			if( sparLongEqual( matrix->blockData[n][i], matrix->def ) == 0 )
+			{
+				break;
+			}
+
+			// Step to the next element
+			int amin;
+			amin = 0;
+			for( a = 1 ; a < 3 ; a++ )
+			{
+				if( tnext[a] < tnext[amin] )
+				{
+					amin = a;
+				}
+			}
+			tc = tnext[amin];
+			v[amin] += step[amin];
+			tnext[amin] += tdelta[amin];
+		}
+
+		// Left the matrix
+		if( v[0] < 0 || v[1] < 0 || v[2] < 0 || v[0] >= size[0] || v[1] >= size[1] || v[2] >= size[2] )
+		{
+			return 0;
+		}
+	}
+
+	// Beyond tmax or matrix exit
+	if( tc > t1 )
+	{
+		return 0;
+	}
+
+	hit[0] = v[0];
+	hit[1] = v[1];
+	hit[2] = v[2];
+	*t = tc;
+
+	return 1;
+}
+
+// Cast n rays o[3*i]+t*d[3*i] in parallel, hits[3*i] and t[i] (-1 if missed), return number of hits
+int sparLongRays( sparLong *matrix, int n, double *o, double *d, double tmax, int *hits, double *t )
+{
+	int count;
+	count = 0;
+
+	int i;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:count) schedule(guided)
+	#endif
+	for( i = 0 ; i < n ; i++ )
+	{
+		if( sparLongRay( matrix, o + 3 * i, d + 3 * i, tmax, hits + 3 * i, t + i ) )
+		{
+			count++;
+		}
+		else
+		{
+			t[i] = -1.0;
+		}
+	}
+
+	return count;
+}
+
+// Copy plane at index along axis into buffer, YZ (axis 0) y+ny*z, XZ (axis 1) x+nx*z, XY (axis 2) x+nx*y
+void sparLongSlice( sparLong *matrix, int axis, int index, long *buffer )
+{
+	// Matrix size
+	int nx, ny, nz;
+	nx = matrix->nx;
+	ny = matrix->ny;
+	nz = matrix->nz;
+
+	// Check plane
+	if( axis < 0 || axis > 2 || index < 0 ||
+		index >= ( axis == 0 ? nx : ( axis == 1 ? ny : nz ) ) )
+	{
+		fprintf(stderr, "sparLongSlice error: Plane outside the matrix\n");
+		exit(1);
+	}
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Block layer and element layer in the block
+	int b1, b2;
+	b1 = index / bs;
+	b2 = index % bs;
+
+	// XY plane, contiguous block rows
+	if( axis == 2 )
+	{
+		int j1;
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(guided)
+		#endif
+		for( j1 = 0 ; j1 < my ; j1++ )
+		{
+			int i1, i, j, ex, ey, n;
+			ey = ny - j1 * bs < bs ? ny - j1 * bs : bs;
+			for( i1 = 0 ; i1 < mx ; i1++ )
+			{
+				ex = nx - i1 * bs < bs ? nx - i1 * bs : bs;
+				n = i1 + mx * ( j1 + my * b1 );
+				for( j = 0 ; j < ey ; j++ )
+				{
+					long *row;
+					row = buffer + i1 * bs + nx * ( j1 * bs + j );
+
+					// Uniform block
+					if( matrix->blockData[n] == NULL )
+					{
+						for( i = 0 ; i < ex ; i++ )
+						{
+							row[i] = matrix->blockValue[n];
+						}
+					}
+					// Heterogeneous block
+					else
+					{
+						memcpy( row, matrix->blockData[n] + bs * ( j + bs * b2 ), ex * sizeof(long) );
+					}
+				}
+			}
+		}
+	}
+	// XZ plane, contiguous block rows
+	else if( axis == 1 )
+	{
+		int k1;
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(guided)
+		#endif
+		for( k1 = 0 ; k1 < mz ; k1++ )
+		{
+			int i1, i, k, ex, ez, n;
+			ez = nz - k1 * bs < bs ? nz - k1 * bs : bs;
+			for( i1 = 0 ; i1 < mx ; i1++ )
+			{
+				ex = nx - i1 * bs < bs ? nx - i1 * bs : bs;
+				n = i1 + mx * ( b1 + my * k1 );
+				for( k = 0 ; k < ez ; k++ )
+				{
+					long *row;
+					row = buffer + i1 * bs + nx * ( k1 * bs + k );
+
+					// Uniform block
+					if( matrix->blockData[n] == NULL )
+					{
+						for( i = 0 ; i < ex ; i++ )
+						{
+							row[i] = matrix->blockValue[n];
+						}
+					}
+					// Heterogeneous block
+					else
+					{
+						memcpy( row, matrix->blockData[n] + bs * ( b2 + bs * k ), ex * sizeof(long) );
+					}
+				}
+			}
+		}
+	}
+	// YZ plane, block elements are strided by bs
+	else
+	{
+		int k1;
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(guided)
+		#endif
+		for( k1 = 0 ; k1 < mz ; k1++ )
+		{
+			int j1, j, k, ey, ez, n;
+			ez = nz - k1 * bs < bs ? nz - k1 * bs : bs;
+			for( j1 = 0 ; j1 < my ; j1++ )
+			{
+				ey = ny - j1 * bs < bs ? ny - j1 * bs : bs;
+				n = b1 + mx * ( j1 + my * k1 );
+				for( k = 0 ; k < ez ; k++ )
+				{
+					long *row;
+					row = buffer + j1 * bs + ny * ( k1 * bs + k );
+
+					// Uniform block
+					if( matrix->blockData[n] == NULL )
+					{
+						for( j = 0 ; j < ey ; j++ )
+						{
+							row[j] = matrix->blockValue[n];
+						}
+					}
+					// Heterogeneous block, gather column of the block
+					else
+					{
+						long *column;
+						column = matrix->blockData[n] + b2 + bs * bs * k;
+						for( j = 0 ; j < ey ; j++ )
+						{
+							row[j] = column[ bs * j ];
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// Accumulate value, repeated count times, into o[0..n-1] with op (projection kernel)
+void sparLongProjectValue( double *o, int n, long value, int count, int op, long def )
+{
+	int i;
+	switch( op )
+	{
+		case SPAR_ADD:
+			for( i = 0 ; i < n ; i++ )
+			{
+				o[i] += (double)( value ) * count;
+			}
+			break;
+		case SPAR_MIN:
+			for( i = 0 ; i < n ; i++ )
+			{
+				o[i] = value < o[i] ? value : o[i];
+			}
+			break;
+		case SPAR_MAX:
+			for( i = 0 ; i < n ; i++ )
+			{
+				o[i] = value > o[i] ? value : o[i];
+			}
+			break;
+		case SPAR_COUNT:
+			if( sparLongEqual( value, def ) == 0 )
+			{
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] += count;
+				}
+			}
+			break;
+	}
+}
+
+// Accumulate row[0..n-1] into o[0..n-1], or into o[0] if reduce, with op (projection kernel)
+void sparLongProjectRow( double *o, long *row, int n, int op, int reduce, long def )
+{
+	int i;
+
+	// Row along the projection axis
+	if( reduce )
+	{
+		double value;
+		value = o[0];
+		switch( op )
+		{
+			case SPAR_ADD:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value += row[i];
+				}
+				break;
+			case SPAR_MIN:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value = row[i] < value ? row[i] : value;
+				}
+				break;
+			case SPAR_MAX:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value = row[i] > value ? row[i] : value;
+				}
+				break;
+			case SPAR_COUNT:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value += ( sparLongEqual( row[i], def ) == 0 );
+				}
+				break;
+		}
+		o[0] = value;
+	}
+	// Row across the projection axis
+	else
+	{
+		switch( op )
+		{
+			case SPAR_ADD:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] += row[i];
+				}
+				break;
+			case SPAR_MIN:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] = row[i] < o[i] ? row[i] : o[i];
+				}
+				break;
+			case SPAR_MAX:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] = row[i] > o[i] ? row[i] : o[i];
+				}
+				break;
+			case SPAR_COUNT:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] += ( sparLongEqual( row[i], def ) == 0 );
+				}
+				break;
+		}
+	}
+}
+
+// Project along axis with op (SPAR_ADD, SPAR_MIN, SPAR_MAX, SPAR_COUNT) into dense plane, same layout as slices
+void sparLongProject( sparLong *matrix, int axis, int op, double *buffer )
+{
+	// Check axis and operation
+	if( axis < 0 || axis > 2 )
+	{
+		fprintf(stderr, "sparLongProject error: Invalid axis\n");
+		exit(1);
+	}
+
+	if( op != SPAR_ADD && op != SPAR_MIN && op != SPAR_MAX && op != SPAR_COUNT )
+	{
+		fprintf(stderr, "sparLongProject error: Unknown operation\n");
+		exit(1);
+	}
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Matrix size (nx,ny,nz)
+	int nx, ny, nz;
+	nx = matrix->nx;
+	ny = matrix->ny;
+	nz = matrix->nz;
+
+	// Plane size (pa,pb), plane and axis block sizes (ma,mb,mc)
+	int pa, pb, ma, mb, mc;
+	pa = axis == 0 ? ny : nx;
+	pb = axis == 2 ? ny : nz;
+	ma = axis == 0 ? matrix->my : matrix->mx;
+	mb = axis == 2 ? matrix->my : matrix->mz;
+	mc = axis == 0 ? matrix->mx : ( axis == 1 ? matrix->my : matrix->mz );
+
+	// Initial values
+	int i;
+	for( i = 0 ; i < pa * pb ; i++ )
+	{
+		buffer[i] = op == SPAR_MIN ? HUGE_VAL : ( op == SPAR_MAX ? -HUGE_VAL : 0.0 );
+	}
+
+	// For each output tile
+	int t;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( t = 0 ; t < ma * mb ; t++ )
+	{
+		int a1, b1, c1;
+		a1 = t % ma;
+		b1 = t / ma;
+
+		// Tile extent
+		int ea, eb;
+		ea = pa - a1 * bs < bs ? pa - a1 * bs : bs;
+		eb = pb - b1 * bs < bs ? pb - b1 * bs : bs;
+
+		// For each block along the axis
+		for( c1 = 0 ; c1 < mc ; c1++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = axis == 0 ? c1 : a1;
+			j1 = axis == 0 ? a1 : ( axis == 1 ? c1 : b1 );
+			k1 = axis == 2 ? c1 : b1;
+
+			// Linear block index (n) <-> (i1,j1,k1)
+			int n;
+			n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = nx - i1 * bs < bs ? nx - i1 * bs : bs;
+			ey = ny - j1 * bs < bs ? ny - j1 * bs : bs;
+			ez = nz - k1 * bs < bs ? nz - k1 * bs : bs;
+
+			int b, j, k;
+
+			// Uniform block, whole column of elements at once
+			if( matrix->blockData[n] == NULL )
+			{
+				for( b = 0 ; b < eb ; b++ )
+				{
+					sparLongProjectValue( buffer + a1 * bs + pa * ( b1 * bs + b ), ea, matrix->blockValue[n],
+									  axis == 0 ? ex : ( axis == 1 ? ey : ez ), op, matrix->def );
+				}
+			}
+			// Heterogeneous block, row by row
+			else
+			{
+				for( k = 0 ; k < ez ; k++ )
+				{
+					for( j = 0 ; j < ey ; j++ )
+					{
+						long *row;
+						row = matrix->blockData[n] + bs * ( j + bs * k );
+						if( axis == 0 )
+						{
+							sparLongProjectRow( buffer + ( j1 * bs + j ) + pa * ( k1 * bs + k ), row, ex, op, 1, matrix->def );
+						}
+						else if( axis == 1 )
+						{
+							sparLongProjectRow( buffer + i1 * bs + pa * ( k1 * bs + k ), row, ex, op, 0, matrix->def );
+						}
+						else
+						{
+							sparLongProjectRow( buffer + i1 * bs + pa * ( j1 * bs + j ), row, ex, op, 0, matrix->def );
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// Order of two elements for qsort, NaN last
+int sparLongCompare( const void *a, const void *b )
+{
+	long va, vb;
+	va = *(const long*) a;
+	vb = *(const long*) b;
+
+	// NaN after any number
+	if( isnan( (double) va ) || isnan( (double) vb ) )
+	{
+		return ( isnan( (double) va ) != 0 ) - ( isnan( (double) vb ) != 0 );
+	}
+
+	return ( va > vb ) - ( va < vb );
+}
+
+// Recompute blocks of dst overlapping box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) from factor^3 cells of src, op SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE
+void sparLongDownsampleBox( sparLong *dst, sparLong *src, int factor, int op, int x, int y, int z, int sx, int sy, int sz )
+{
+	// Check matrices
+	if( factor < 1 || dst->nx != ( src->nx + factor - 1 ) / factor ||
+		dst->ny != ( src->ny + factor - 1 ) / factor || dst->nz != ( src->nz + factor - 1 ) / factor )
+	{
+		fprintf(stderr, "sparLongDownsampleBox error: Matrix sizes do not match the factor\n");
+		exit(1);
+	}
+
+	if( op != SPAR_MEAN && op != SPAR_MIN && op != SPAR_MAX && op != SPAR_MODE )
+	{
+		fprintf(stderr, "sparLongDownsampleBox error: Unknown operation\n");
+		exit(1);
+	}
+
+	// Clip box to dst
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > dst->nx ? dst->nx : x + sx;
+	y1 = y + sy > dst->ny ? dst->ny : y + sy;
+	z1 = z + sz > dst->nz ? dst->nz : z + sz;
+
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	// Destination block size
+	int bs, bs3;
+	bs = dst->bs;
+	bs3 = dst->bs3;
+
+	// Source box size of one destination block
+	int cs;
+	cs = bs * factor;
+
+	// Range of destination blocks
+	int bx, by, bz, cx, cy, cz;
+	bx = x0 / bs;
+	by = y0 / bs;
+	bz = z0 / bs;
+	cx = ( x1 - 1 ) / bs - bx + 1;
+	cy = ( y1 - 1 ) / bs - by + 1;
+	cz = ( z1 - 1 ) / bs - bz + 1;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Source elements of one destination block and of one cell
+		long *buffer, *cell;
+		buffer = (long*) malloc( cs * cs * cs * sizeof(long) );
+		cell = (long*) malloc( factor * factor * factor * sizeof(long) );
+
+		if( buffer == NULL || cell == NULL )
+		{
+		   fprintf(stderr, "sparLongDownsampleBox error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each destination block
+		int t;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( t = 0 ; t < cx * cy * cz ; t++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = bx + t % cx;
+			j1 = by + ( t / cx ) % cy;
+			k1 = bz + t / ( cx * cy );
+
+			// Linear block index (n) <-> (i1,j1,k1)
+			int n;
+			n = i1 + dst->mx * ( j1 + dst->my * k1 );
+
+			// Free previous data
+			if( dst->blockData[n] != NULL )
+			{
+				free(dst->blockData[n]);
+				dst->blockData[n] = NULL;
+			}
+
+			// Uniform source region, uniform destination block
+			long value;
+			if( sparLongUniformBox( src, i1 * cs, j1 * cs, k1 * cs, cs, cs, cs, &value ) )
+			{
+				dst->blockValue[n] = value;
+				continue;
+			}
+
+			// Read source region
+			sparLongGetBox( src, i1 * cs, j1 * cs, k1 * cs, cs, cs, cs, buffer );
+
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = dst->nx - i1 * bs < bs ? dst->nx - i1 * bs : bs;
+			ey = dst->ny - j1 * bs < bs ? dst->ny - j1 * bs : bs;
+			ez = dst->nz - k1 * bs < bs ? dst->nz - k1 * bs : bs;
+
+			long *blockData;
+			blockData = (long*) calloc( bs3, sizeof(long) );
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparLongDownsampleBox error: Out of memory\n");
+			   exit(1);
+			}
+
+			// For each destination element
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					for( i = 0 ; i < ex ; i++ )
+					{
+						// Cell extent inside the source matrix
+						int fx, fy, fz;
+						fx = src->nx - ( i1 * bs + i ) * factor < factor ? src->nx - ( i1 * bs + i ) * factor : factor;
+						fy = src->ny - ( j1 * bs + j ) * factor < factor ? src->ny - ( j1 * bs + j ) * factor : factor;
+						fz = src->nz - ( k1 * bs + k ) * factor < factor ? src->nz - ( k1 * bs + k ) * factor : factor;
+
+						// Reduce cell, one tight loop per operation
+						int a, b, c, m;
+						int best, run;
+						double sum;
+						long *row, *r;
+						row = buffer + i * factor + cs * ( j * factor + cs * k * factor );
+						value = row[0];
+						switch( op )
+						{
+							case SPAR_MEAN:
+								sum = 0.0;
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											sum += r[a];
+										}
+									}
+								}
+								value = sparLongRound( sum / ( fx * fy * fz ) );
+								break;
+							case SPAR_MIN:
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											value = r[a] < value ? r[a] : value;
+										}
+									}
+								}
+								break;
+							case SPAR_MAX:
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											value = r[a] > value ? r[a] : value;
+										}
+									}
+								}
+								break;
+							case SPAR_MODE:
+								// Gather cell
+								m = 0;
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											cell[ m + a ] = r[a];
+										}
+										m += fx;
+									}
+								}
+
+								// Longest run of sorted values
+								qsort( cell, m, sizeof(long), sparLongCompare );
+								value = cell[0];
+								best = 0;
+								run = 0;
+								for( a = 0 ; a < m ; a++ )
+								{
+									run = ( a > 0 && sparLongEqual( cell[a], cell[ a - 1 ] ) ) ? run + 1 : 1;
+									if( run > best )
+									{
+										best = run;
+										value = cell[a];
+									}
+								}
+								break;
+						}
+
+						blockData[ i + bs * ( j + bs * k ) ] = value;
+					}
+				}
+			}
+
+			// Write block and reduce if possible
+			dst->blockData[n] = blockData;
+			sparLongReduceBlock( dst, i1, j1, k1 );
+		}
+
+		free(buffer);
+		free(cell);
+	}
+}
+
+// New matrix downsampled by factor with op (SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE)
+sparLong* sparLongDownsample( sparLong *matrix, int factor, int op )
+{
+	if( factor < 1 )
+	{
+		fprintf(stderr, "sparLongDownsample error: Factor must be positive\n");
+		exit(1);
+	}
+
+	// Declare matrix and init
+	sparLong *matrix2;
+	matrix2 = sparLongInit( ( matrix->nx + factor - 1 ) / factor, ( matrix->ny + factor - 1 ) / factor,
+						( matrix->nz + factor - 1 ) / factor, matrix->bs, matrix->def );
+
+	sparLongDownsampleBox( matrix2, matrix, factor, op, 0, 0, 0, matrix2->nx, matrix2->ny, matrix2->nz );
+
+	return matrix2;
+}
+
+// Pyramid of levels matrices downsampled by 2, 4, 8... with op (SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE)
+void sparLongPyramid( sparLong *matrix, int levels, int op, sparLong **pyramid )
+{
+	int l;
+	for( l = 0 ; l < levels ; l++ )
+	{
+		pyramid[l] = sparLongDownsample( l == 0 ? matrix : pyramid[ l - 1 ], 2, op );
+	}
+}
+
+// Update pyramid after changes of matrix in box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1)
+void sparLongPyramidUpdate( sparLong *matrix, int levels, int op, sparLong **pyramid, int x, int y, int z, int sx, int sy, int sz )
+{
+	int l;
+	for( l = 0 ; l < levels ; l++ )
+	{
+		// Affected box in the next level
+		int x1, y1, z1;
+		x1 = ( x + sx + 1 ) / 2;
+		y1 = ( y + sy + 1 ) / 2;
+		z1 = ( z + sz + 1 ) / 2;
+		x = x / 2;
+		y = y / 2;
+		z = z / 2;
+		sx = x1 - x;
+		sy = y1 - y;
+		sz = z1 - z;
+
+		sparLongDownsampleBox( pyramid[l], l == 0 ? matrix : pyramid[ l - 1 ], 2, op, x, y, z, sx, sy, sz );
+	}
+}
+
+// Trilinear interpolation at (x,y,z), element (i,j,k) at integer coordinates, clamped to the matrix bounds
+double sparLongSample( sparLong *matrix, double x, double y, double z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Matrix size
+	int size[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+
+	double p[3];
+	p[0] = x;
+	p[1] = y;
+	p[2] = z;
+
+	// Lower (v0) and upper (v1) corners and fractions per axis
+	int a, v0[3], v1[3];
+	double f[3];
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		double q;
+		q = p[a] < 0.0 ? 0.0 : ( p[a] > size[a] - 1 ? size[a] - 1 : p[a] );
+		v0[a] = (int)( floor( q ) );
+		v1[a] = v0[a] + 1 < size[a] ? v0[a] + 1 : v0[a];
+		f[a] = q - v0[a];
+	}
+
+	// Corner values
+	long c[8];
+
+	// All corners in one block
+	if( v0[0] / bs == v1[0] / bs && v0[1] / bs == v1[1] / bs && v0[2] / bs == v1[2] / bs )
+	{
+		// Linear block index (n)
+		int n;
+		n = v0[0] / bs + matrix->mx * ( v0[1] / bs + matrix->my * ( v0[2] / bs ) );
+
+		long *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block
+		if( blockData == NULL )
+		{
+			return (double) matrix->blockValue[n];
+		}
+
+		// Lower corner and steps in the block
+		int i, dx, dy, dz;
+		i = v0[0] % bs + bs * ( v0[1] % bs + bs * ( v0[2] % bs ) );
+		dx = v1[0] - v0[0];
+		dy = bs * ( v1[1] - v0[1] );
+		dz = bs * bs * ( v1[2] - v0[2] );
+
+		c[0] = blockData[i];
+		c[1] = blockData[ i + dx ];
+		c[2] = blockData[ i + dy ];
+		c[3] = blockData[ i + dx + dy ];
+		c[4] = blockData[ i + dz ];
+		c[5] = blockData[ i + dx + dz ];
+		c[6] = blockData[ i + dy + dz ];
+		c[7] = blockData[ i + dx + dy + dz ];
+	}
+	// Corners across blocks
+	else
+	{
+		c[0] = sparLongGet( matrix, v0[0], v0[1], v0[2] );
+		c[1] = sparLongGet( matrix, v1[0], v0[1], v0[2] );
+		c[2] = sparLongGet( matrix, v0[0], v1[1], v0[2] );
+		c[3] = sparLongGet( matrix, v1[0], v1[1], v0[2] );
+		c[4] = sparLongGet( matrix, v0[0], v0[1], v1[2] );
+		c[5] = sparLongGet( matrix, v1[0], v0[1], v1[2] );
+		c[6] = sparLongGet( matrix, v0[0], v1[1], v1[2] );
+		c[7] = sparLongGet( matrix, v1[0], v1[1], v1[2] );
+	}
+
+	// Interpolate along x, y and z
+	double c0, c1, c2, c3;
+	c0 = c[0] + f[0] * ( (double) c[1] - c[0] );
+	c1 = c[2] + f[0] * ( (double) c[3] - c[2] );
+	c2 = c[4] + f[0] * ( (double) c[5] - c[4] );
+	c3 = c[6] + f[0] * ( (double) c[7] - c[6] );
+	c0 = c0 + f[1] * ( c1 - c0 );
+	c2 = c2 + f[1] * ( c3 - c2 );
+
+	return c0 + f[2] * ( c2 - c0 );
+}
+
+// Trilinear interpolation at n points p[3*i] in parallel into values[i]
+void sparLongSamples( sparLong *matrix, int n, double *p, double *values )
+{
+	int i;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( i = 0 ; i < n ; i++ )
+	{
+		values[i] = sparLongSample( matrix, p[ 3 * i ], p[ 3 * i + 1 ], p[ 3 * i + 2 ] );
+	}
+}
+
+// Marching cubes triangle edges of cube case c (bit i set if corner i is above the iso value), return number of triangles
+int sparLongCubeTriangles( int c, int *edges )
+{
+	// Triangle edges per case, -1 terminated, counter-clockwise seen from below the iso value
+	static const signed char table[256][16] =
+	{
+		{ -1 },
+		{ 0, 3, 8, -1 },
+		{ 0, 9, 1, -1 },
+		{ 3, 8, 9, 1, 3, 9, -1 },
+		{ 1, 10, 2, -1 },
+		{ 0, 3, 8, 1, 10, 2, -1 },
+		{ 9, 10, 2, 0, 9, 2, -1 },
+		{ 8, 9, 10, 3, 8, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, -1 },
+		{ 2, 11, 8, 0, 2, 8, -1 },
+		{ 0, 9, 1, 2, 11, 3, -1 },
+		{ 11, 8, 9, 2, 11, 9, 1, 2, 9, -1 },
+		{ 10, 11, 3, 1, 10, 3, -1 },
+		{ 10, 11, 8, 1, 10, 8, 0, 1, 8, -1 },
+		{ 10, 11, 3, 9, 10, 3, 0, 9, 3, -1 },
+		{ 9, 10, 11, 8, 9, 11, -1 },
+		{ 4, 8, 7, -1 },
+		{ 3, 7, 4, 0, 3, 4, -1 },
+		{ 0, 9, 1, 4, 8, 7, -1 },
+		{ 7, 4, 9, 3, 7, 9, 1, 3, 9, -1 },
+		{ 1, 10, 2, 4, 8, 7, -1 },
+		{ 3, 7, 4, 0, 3, 4, 1, 10, 2, -1 },
+		{ 9, 10, 2, 0, 9, 2, 4, 8, 7, -1 },
+		{ 4, 9, 10, 7, 4, 10, 3, 7, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, 4, 8, 7, -1 },
+		{ 11, 7, 4, 2, 11, 4, 0, 2, 4, -1 },
+		{ 0, 9, 1, 2, 11, 3, 4, 8, 7, -1 },
+		{ 7, 4, 9, 11, 7, 9, 2, 11, 9, 1, 2, 9, -1 },
+		{ 10, 11, 3, 1, 10, 3, 4, 8, 7, -1 },
+		{ 11, 7, 4, 10, 11, 4, 1, 10, 4, 0, 1, 4, -1 },
+		{ 10, 11, 3, 9, 10, 3, 0, 9, 3, 4, 8, 7, -1 },
+		{ 10, 11, 7, 9, 10, 7, 4, 9, 7, -1 },
+		{ 4, 5, 9, -1 },
+		{ 0, 3, 8, 4, 5, 9, -1 },
+		{ 4, 5, 1, 0, 4, 1, -1 },
+		{ 8, 4, 5, 3, 8, 5, 1, 3, 5, -1 },
+		{ 1, 10, 2, 4, 5, 9, -1 },
+		{ 0, 3, 8, 1, 10, 2, 4, 5, 9, -1 },
+		{ 5, 10, 2, 4, 5, 2, 0, 4, 2, -1 },
+		{ 4, 5, 10, 8, 4, 10, 3, 8, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, 4, 5, 9, -1 },
+		{ 2, 11, 8, 0, 2, 8, 4, 5, 9, -1 },
+		{ 4, 5, 1, 0, 4, 1, 2, 11, 3, -1 },
+		{ 8, 4, 5, 11, 8, 5, 2, 11, 5, 1, 2, 5, -1 },
+		{ 10, 11, 3, 1, 10, 3, 4, 5, 9, -1 },
+		{ 10, 11, 8, 1, 10, 8, 0, 1, 8, 4, 5, 9, -1 },
+		{ 10, 11, 3, 5, 10, 3, 4, 5, 3, 0, 4, 3, -1 },
+		{ 10, 11, 8, 5, 10, 8, 4, 5, 8, -1 },
+		{ 9, 8, 7, 5, 9, 7, -1 },
+		{ 7, 5, 9, 3, 7, 9, 0, 3, 9, -1 },
+		{ 7, 5, 1, 8, 7, 1, 0, 8, 1, -1 },
+		{ 3, 7, 5, 1, 3, 5, -1 },
+		{ 1, 10, 2, 9, 8, 7, 5, 9, 7, -1 },
+		{ 7, 5, 9, 3, 7, 9, 0, 3, 9, 1, 10, 2, -1 },
+		{ 5, 10, 2, 7, 5, 2, 8, 7, 2, 0, 8, 2, -1 },
+		{ 7, 5, 10, 3, 7, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, 9, 8, 7, 5, 9, 7, -1 },
+		{ 7, 5, 9, 11, 7, 9, 2, 11, 9, 0, 2, 9, -1 },
+		{ 7, 5, 1, 8, 7, 1, 0, 8, 1, 2, 11, 3, -1 },
+		{ 11, 7, 5, 2, 11, 5, 1, 2, 5, -1 },
+		{ 10, 11, 3, 1, 10, 3, 9, 8, 7, 5, 9, 7, -1 },
+		{ 1, 10, 11, 0, 1, 11, 7, 5, 9, 11, 7, 9, 0, 11, 9, -1 },
+		{ 8, 7, 5, 0, 8, 5, 10, 11, 3, 5, 10, 3, 0, 5, 3, -1 },
+		{ 10, 11, 7, 5, 10, 7, -1 },
+		{ 5, 6, 10, -1 },
+		{ 0, 3, 8, 5, 6, 10, -1 },
+		{ 0, 9, 1, 5, 6, 10, -1 },
+		{ 3, 8, 9, 1, 3, 9, 5, 6, 10, -1 },
+		{ 5, 6, 2, 1, 5, 2, -1 },
+		{ 0, 3, 8, 5, 6, 2, 1, 5, 2, -1 },
+		{ 5, 6, 2, 9, 5, 2, 0, 9, 2, -1 },
+		{ 9, 5, 6, 8, 9, 6, 3, 8, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 5, 6, 10, -1 },
+		{ 2, 11, 8, 0, 2, 8, 5, 6, 10, -1 },
+		{ 0, 9, 1, 2, 11, 3, 5, 6, 10, -1 },
+		{ 11, 8, 9, 2, 11, 9, 1, 2, 9, 5, 6, 10, -1 },
+		{ 6, 11, 3, 5, 6, 3, 1, 5, 3, -1 },
+		{ 6, 11, 8, 5, 6, 8, 1, 5, 8, 0, 1, 8, -1 },
+		{ 6, 11, 3, 5, 6, 3, 9, 5, 3, 0, 9, 3, -1 },
+		{ 11, 8, 9, 6, 11, 9, 5, 6, 9, -1 },
+		{ 4, 8, 7, 5, 6, 10, -1 },
+		{ 3, 7, 4, 0, 3, 4, 5, 6, 10, -1 },
+		{ 0, 9, 1, 4, 8, 7, 5, 6, 10, -1 },
+		{ 7, 4, 9, 3, 7, 9, 1, 3, 9, 5, 6, 10, -1 },
+		{ 5, 6, 2, 1, 5, 2, 4, 8, 7, -1 },
+		{ 3, 7, 4, 0, 3, 4, 5, 6, 2, 1, 5, 2, -1 },
+		{ 5, 6, 2, 9, 5, 2, 0, 9, 2, 4, 8, 7, -1 },
+		{ 7, 4, 9, 3, 7, 9, 9, 5, 6, 3, 9, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 4, 8, 7, 5, 6, 10, -1 },
+		{ 11, 7, 4, 2, 11, 4, 0, 2, 4, 5, 6, 10, -1 },
+		{ 0, 9, 1, 2, 11, 3, 4, 8, 7, 5, 6, 10, -1 },
+		{ 7, 4, 9, 11, 7, 9, 2, 11, 9, 1, 2, 9, 5, 6, 10, -1 },
+		{ 6, 11, 3, 5, 6, 3, 1, 5, 3, 4, 8, 7, -1 },
+		{ 5, 6, 11, 1, 5, 11, 11, 7, 4, 1, 11, 4, 0, 1, 4, -1 },
+		{ 6, 11, 3, 5, 6, 3, 9, 5, 3, 0, 9, 3, 4, 8, 7, -1 },
+		{ 5, 6, 11, 9, 5, 11, 9, 11, 7, 4, 9, 7, -1 },
+		{ 6, 10, 9, 4, 6, 9, -1 },
+		{ 0, 3, 8, 6, 10, 9, 4, 6, 9, -1 },
+		{ 6, 10, 1, 4, 6, 1, 0, 4, 1, -1 },
+		{ 4, 6, 10, 8, 4, 10, 3, 8, 10, 1, 3, 10, -1 },
+		{ 4, 6, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 0, 3, 8, 4, 6, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 4, 6, 2, 0, 4, 2, -1 },
+		{ 8, 4, 6, 3, 8, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 6, 10, 9, 4, 6, 9, -1 },
+		{ 2, 11, 8, 0, 2, 8, 6, 10, 9, 4, 6, 9, -1 },
+		{ 6, 10, 1, 4, 6, 1, 0, 4, 1, 2, 11, 3, -1 },
+		{ 2, 11, 8, 1, 2, 8, 4, 6, 10, 8, 4, 10, 1, 8, 10, -1 },
+		{ 6, 11, 3, 4, 6, 3, 9, 4, 3, 1, 9, 3, -1 },
+		{ 9, 4, 6, 1, 9, 6, 6, 11, 8, 1, 6, 8, 0, 1, 8, -1 },
+		{ 6, 11, 3, 4, 6, 3, 0, 4, 3, -1 },
+		{ 6, 11, 8, 4, 6, 8, -1 },
+		{ 9, 8, 7, 10, 9, 7, 6, 10, 7, -1 },
+		{ 6, 10, 9, 7, 6, 9, 3, 7, 9, 0, 3, 9, -1 },
+		{ 6, 10, 1, 7, 6, 1, 8, 7, 1, 0, 8, 1, -1 },
+		{ 7, 6, 10, 3, 7, 10, 1, 3, 10, -1 },
+		{ 7, 6, 2, 8, 7, 2, 9, 8, 2, 1, 9, 2, -1 },
+		{ 2, 1, 9, 6, 2, 9, 7, 6, 9, 3, 7, 9, 0, 3, 9, -1 },
+		{ 7, 6, 2, 8, 7, 2, 0, 8, 2, -1 },
+		{ 3, 7, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 9, 8, 7, 10, 9, 7, 6, 10, 7, -1 },
+		{ 6, 10, 9, 7, 6, 9, 11, 7, 9, 2, 11, 9, 0, 2, 9, -1 },
+		{ 6, 10, 1, 7, 6, 1, 8, 7, 1, 0, 8, 1, 2, 11, 3, -1 },
+		{ 2, 11, 7, 1, 2, 7, 7, 6, 10, 1, 7, 10, -1 },
+		{ 8, 7, 6, 9, 8, 6, 6, 11, 3, 9, 6, 3, 1, 9, 3, -1 },
+		{ 0, 1, 9, 6, 11, 7, -1 },
+		{ 8, 7, 6, 0, 8, 6, 6, 11, 3, 0, 6, 3, -1 },
+		{ 6, 11, 7, -1 },
+		{ 6, 7, 11, -1 },
+		{ 0, 3, 8, 6, 7, 11, -1 },
+		{ 0, 9, 1, 6, 7, 11, -1 },
+		{ 3, 8, 9, 1, 3, 9, 6, 7, 11, -1 },
+		{ 1, 10, 2, 6, 7, 11, -1 },
+		{ 0, 3, 8, 1, 10, 2, 6, 7, 11, -1 },
+		{ 9, 10, 2, 0, 9, 2, 6, 7, 11, -1 },
+		{ 8, 9, 10, 3, 8, 10, 2, 3, 10, 6, 7, 11, -1 },
+		{ 6, 7, 3, 2, 6, 3, -1 },
+		{ 6, 7, 8, 2, 6, 8, 0, 2, 8, -1 },
+		{ 0, 9, 1, 6, 7, 3, 2, 6, 3, -1 },
+		{ 7, 8, 9, 6, 7, 9, 2, 6, 9, 1, 2, 9, -1 },
+		{ 6, 7, 3, 10, 6, 3, 1, 10, 3, -1 },
+		{ 6, 7, 8, 10, 6, 8, 1, 10, 8, 0, 1, 8, -1 },
+		{ 6, 7, 3, 10, 6, 3, 9, 10, 3, 0, 9, 3, -1 },
+		{ 8, 9, 10, 7, 8, 10, 6, 7, 10, -1 },
+		{ 8, 11, 6, 4, 8, 6, -1 },
+		{ 11, 6, 4, 3, 11, 4, 0, 3, 4, -1 },
+		{ 0, 9, 1, 8, 11, 6, 4, 8, 6, -1 },
+		{ 6, 4, 9, 11, 6, 9, 3, 11, 9, 1, 3, 9, -1 },
+		{ 1, 10, 2, 8, 11, 6, 4, 8, 6, -1 },
+		{ 11, 6, 4, 3, 11, 4, 0, 3, 4, 1, 10, 2, -1 },
+		{ 9, 10, 2, 0, 9, 2, 8, 11, 6, 4, 8, 6, -1 },
+		{ 11, 6, 4, 3, 11, 4, 4, 9, 10, 3, 4, 10, 2, 3, 10, -1 },
+		{ 4, 8, 3, 6, 4, 3, 2, 6, 3, -1 },
+		{ 2, 6, 4, 0, 2, 4, -1 },
+		{ 0, 9, 1, 4, 8, 3, 6, 4, 3, 2, 6, 3, -1 },
+		{ 6, 4, 9, 2, 6, 9, 1, 2, 9, -1 },
+		{ 4, 8, 3, 6, 4, 3, 10, 6, 3, 1, 10, 3, -1 },
+		{ 10, 6, 4, 1, 10, 4, 0, 1, 4, -1 },
+		{ 4, 8, 3, 6, 4, 3, 10, 6, 3, 9, 10, 3, 0, 9, 3, -1 },
+		{ 9, 10, 6, 4, 9, 6, -1 },
+		{ 4, 5, 9, 6, 7, 11, -1 },
+		{ 0, 3, 8, 4, 5, 9, 6, 7, 11, -1 },
+		{ 4, 5, 1, 0, 4, 1, 6, 7, 11, -1 },
+		{ 8, 4, 5, 3, 8, 5, 1, 3, 5, 6, 7, 11, -1 },
+		{ 1, 10, 2, 4, 5, 9, 6, 7, 11, -1 },
+		{ 0, 3, 8, 1, 10, 2, 4, 5, 9, 6, 7, 11, -1 },
+		{ 5, 10, 2, 4, 5, 2, 0, 4, 2, 6, 7, 11, -1 },
+		{ 4, 5, 10, 8, 4, 10, 3, 8, 10, 2, 3, 10, 6, 7, 11, -1 },
+		{ 6, 7, 3, 2, 6, 3, 4, 5, 9, -1 },
+		{ 6, 7, 8, 2, 6, 8, 0, 2, 8, 4, 5, 9, -1 },
+		{ 4, 5, 1, 0, 4, 1, 6, 7, 3, 2, 6, 3, -1 },
+		{ 6, 7, 8, 2, 6, 8, 8, 4, 5, 2, 8, 5, 1, 2, 5, -1 },
+		{ 6, 7, 3, 10, 6, 3, 1, 10, 3, 4, 5, 9, -1 },
+		{ 6, 7, 8, 10, 6, 8, 1, 10, 8, 0, 1, 8, 4, 5, 9, -1 },
+		{ 6, 7, 3, 10, 6, 3, 5, 10, 3, 4, 5, 3, 0, 4, 3, -1 },
+		{ 6, 7, 8, 10, 6, 8, 5, 10, 8, 4, 5, 8, -1 },
+		{ 8, 11, 6, 9, 8, 6, 5, 9, 6, -1 },
+		{ 6, 5, 9, 11, 6, 9, 3, 11, 9, 0, 3, 9, -1 },
+		{ 6, 5, 1, 11, 6, 1, 8, 11, 1, 0, 8, 1, -1 },
+		{ 11, 6, 5, 3, 11, 5, 1, 3, 5, -1 },
+		{ 1, 10, 2, 8, 11, 6, 9, 8, 6, 5, 9, 6, -1 },
+		{ 6, 5, 9, 11, 6, 9, 3, 11, 9, 0, 3, 9, 1, 10, 2, -1 },
+		{ 11, 6, 5, 8, 11, 5, 5, 10, 2, 8, 5, 2, 0, 8, 2, -1 },
+		{ 11, 6, 5, 3, 11, 5, 3, 5, 10, 2, 3, 10, -1 },
+		{ 9, 8, 3, 5, 9, 3, 6, 5, 3, 2, 6, 3, -1 },
+		{ 6, 5, 9, 2, 6, 9, 0, 2, 9, -1 },
+		{ 3, 2, 6, 8, 3, 6, 6, 5, 1, 8, 6, 1, 0, 8, 1, -1 },
+		{ 2, 6, 5, 1, 2, 5, -1 },
+		{ 9, 8, 3, 5, 9, 3, 6, 5, 3, 10, 6, 3, 1, 10, 3, -1 },
+		{ 1, 10, 6, 0, 1, 6, 6, 5, 9, 0, 6, 9, -1 },
+		{ 0, 8, 3, 5, 10, 6, -1 },
+		{ 5, 10, 6, -1 },
+		{ 7, 11, 10, 5, 7, 10, -1 },
+		{ 0, 3, 8, 7, 11, 10, 5, 7, 10, -1 },
+		{ 0, 9, 1, 7, 11, 10, 5, 7, 10, -1 },
+		{ 3, 8, 9, 1, 3, 9, 7, 11, 10, 5, 7, 10, -1 },
+		{ 7, 11, 2, 5, 7, 2, 1, 5, 2, -1 },
+		{ 0, 3, 8, 7, 11, 2, 5, 7, 2, 1, 5, 2, -1 },
+		{ 7, 11, 2, 5, 7, 2, 9, 5, 2, 0, 9, 2, -1 },
+		{ 3, 8, 9, 2, 3, 9, 5, 7, 11, 9, 5, 11, 2, 9, 11, -1 },
+		{ 5, 7, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 5, 7, 8, 10, 5, 8, 2, 10, 8, 0, 2, 8, -1 },
+		{ 0, 9, 1, 5, 7, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 10, 5, 7, 2, 10, 7, 7, 8, 9, 2, 7, 9, 1, 2, 9, -1 },
+		{ 5, 7, 3, 1, 5, 3, -1 },
+		{ 5, 7, 8, 1, 5, 8, 0, 1, 8, -1 },
+		{ 5, 7, 3, 9, 5, 3, 0, 9, 3, -1 },
+		{ 7, 8, 9, 5, 7, 9, -1 },
+		{ 11, 10, 5, 8, 11, 5, 4, 8, 5, -1 },
+		{ 10, 5, 4, 11, 10, 4, 3, 11, 4, 0, 3, 4, -1 },
+		{ 0, 9, 1, 11, 10, 5, 8, 11, 5, 4, 8, 5, -1 },
+		{ 10, 5, 4, 11, 10, 4, 11, 4, 9, 3, 11, 9, 1, 3, 9, -1 },
+		{ 8, 11, 2, 4, 8, 2, 5, 4, 2, 1, 5, 2, -1 },
+		{ 1, 5, 4, 2, 1, 4, 11, 2, 4, 3, 11, 4, 0, 3, 4, -1 },
+		{ 8, 11, 2, 4, 8, 2, 5, 4, 2, 9, 5, 2, 0, 9, 2, -1 },
+		{ 2, 3, 11, 4, 9, 5, -1 },
+		{ 4, 8, 3, 5, 4, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 10, 5, 4, 2, 10, 4, 0, 2, 4, -1 },
+		{ 0, 9, 1, 4, 8, 3, 5, 4, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 10, 5, 4, 2, 10, 4, 2, 4, 9, 1, 2, 9, -1 },
+		{ 4, 8, 3, 5, 4, 3, 1, 5, 3, -1 },
+		{ 1, 5, 4, 0, 1, 4, -1 },
+		{ 4, 8, 3, 5, 4, 3, 9, 5, 3, 0, 9, 3, -1 },
+		{ 4, 9, 5, -1 },
+		{ 11, 10, 9, 7, 11, 9, 4, 7, 9, -1 },
+		{ 0, 3, 8, 11, 10, 9, 7, 11, 9, 4, 7, 9, -1 },
+		{ 11, 10, 1, 7, 11, 1, 4, 7, 1, 0, 4, 1, -1 },
+		{ 7, 11, 10, 4, 7, 10, 8, 4, 10, 3, 8, 10, 1, 3, 10, -1 },
+		{ 7, 11, 2, 4, 7, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 0, 3, 8, 7, 11, 2, 4, 7, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 7, 11, 2, 4, 7, 2, 0, 4, 2, -1 },
+		{ 3, 8, 4, 2, 3, 4, 4, 7, 11, 2, 4, 11, -1 },
+		{ 4, 7, 3, 9, 4, 3, 10, 9, 3, 2, 10, 3, -1 },
+		{ 9, 4, 7, 10, 9, 7, 10, 7, 8, 2, 10, 8, 0, 2, 8, -1 },
+		{ 3, 2, 10, 7, 3, 10, 7, 10, 1, 4, 7, 1, 0, 4, 1, -1 },
+		{ 1, 2, 10, 4, 7, 8, -1 },
+		{ 4, 7, 3, 9, 4, 3, 1, 9, 3, -1 },
+		{ 9, 4, 7, 1, 9, 7, 1, 7, 8, 0, 1, 8, -1 },
+		{ 4, 7, 3, 0, 4, 3, -1 },
+		{ 4, 7, 8, -1 },
+		{ 11, 10, 9, 8, 11, 9, -1 },
+		{ 11, 10, 9, 3, 11, 9, 0, 3, 9, -1 },
+		{ 11, 10, 1, 8, 11, 1, 0, 8, 1, -1 },
+		{ 3, 11, 10, 1, 3, 10, -1 },
+		{ 8, 11, 2, 9, 8, 2, 1, 9, 2, -1 },
+		{ 2, 1, 9, 11, 2, 9, 3, 11, 9, 0, 3, 9, -1 },
+		{ 8, 11, 2, 0, 8, 2, -1 },
+		{ 2, 3, 11, -1 },
+		{ 9, 8, 3, 10, 9, 3, 2, 10, 3, -1 },
+		{ 2, 10, 9, 0, 2, 9, -1 },
+		{ 3, 2, 10, 8, 3, 10, 8, 10, 1, 0, 8, 1, -1 },
+		{ 1, 2, 10, -1 },
+		{ 9, 8, 3, 1, 9, 3, -1 },
+		{ 0, 1, 9, -1 },
+		{ 0, 8, 3, -1 },
+		{ -1 }
+	};
+
+	int i;
+	for( i = 0 ; table[c][i] >= 0 ; i++ )
+	{
+		edges[i] = table[c][i];
+	}
+
+	return i / 3;
+}
+
+// Order of two edge keys for qsort
+int sparLongCompareKey( const void *a, const void *b )
+{
+	long long ka, kb;
+	ka = *(const long long*) a;
+	kb = *(const long long*) b;
+	return ( ka > kb ) - ( ka < kb );
+}
+
+// Marching cubes isosurface at iso into vertices[3*i] and triangles[3*j] (malloc, free after use), nt triangles, return number of vertices
+int sparLongIsosurface( sparLong *matrix, double iso, double **vertices, int **triangles, int *nt )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Matrix size
+	int nx, ny, nz;
+	nx = matrix->nx;
+	ny = matrix->ny;
+	nz = matrix->nz;
+
+	// Cube corner offsets, and edge lower corner offset and axis
+	static const int corner[8][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 },
+									  { 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 } };
+	static const int edge[12][4] = { { 0, 0, 0, 0 }, { 1, 0, 0, 1 }, { 0, 1, 0, 0 }, { 0, 0, 0, 1 },
+									 { 0, 0, 1, 0 }, { 1, 0, 1, 1 }, { 0, 1, 1, 0 }, { 0, 0, 1, 1 },
+									 { 0, 0, 0, 2 }, { 1, 0, 0, 2 }, { 1, 1, 0, 2 }, { 0, 1, 0, 2 } };
+
+	// Triangle edge keys and triangle count per block
+	int nb;
+	nb = matrix->mx * matrix->my * matrix->mz;
+
+	long long **keys;
+	int *count;
+	keys = (long long**) calloc( nb, sizeof(long long*) );
+	count = (int*) calloc( nb, sizeof(int) );
+
+	if( keys == NULL || count == NULL )
+	{
+	   fprintf(stderr, "sparLongIsosurface error: Out of memory\n");
+	   exit(1);
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block corners, including the next block first plane on each axis
+		int s;
+		long *buffer;
+		s = bs + 1;
+		buffer = (long*) malloc( s * s * s * sizeof(long) );
+
+		if( buffer == NULL )
+		{
+		   fprintf(stderr, "sparLongIsosurface error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < nb ; n++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = n % matrix->mx;
+			j1 = ( n / matrix->mx ) % matrix->my;
+			k1 = n / ( matrix->mx * matrix->my );
+
+			// Cells with lower corner in the block
+			int ex, ey, ez;
+			ex = nx - 1 - i1 * bs < bs ? nx - 1 - i1 * bs : bs;
+			ey = ny - 1 - j1 * bs < bs ? ny - 1 - j1 * bs : bs;
+			ez = nz - 1 - k1 * bs < bs ? nz - 1 - k1 * bs : bs;
+
+			if( ex <= 0 || ey <= 0 || ez <= 0 )
+			{
+				continue;
+			}
+
+			// Uniform corners, no crossing
+			long value;
+			if( sparLongUniformBox( matrix, i1 * bs, j1 * bs, k1 * bs, s, s, s, &value ) )
+			{
+				continue;
+			}
+
+			sparLongGetBox( matrix, i1 * bs, j1 * bs, k1 * bs, s, s, s, buffer );
+
+			// Corner offsets in the buffer
+			int offset[8], c;
+			for( c = 0 ; c < 8 ; c++ )
+			{
+				offset[c] = corner[c][0] + s * ( corner[c][1] + s * corner[c][2] );
+			}
+
+			int size;
+			size = 0;
+
+			// For each cell
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					for( i = 0 ; i < ex ; i++ )
+					{
+						// Cube case
+						long *cell;
+						int cube;
+						cell = buffer + i + s * ( j + s * k );
+						cube = 0;
+						for( c = 0 ; c < 8 ; c++ )
+						{
+							cube |= ( cell[ offset[c] ] > iso ) << c;
+						}
+
+						if( cube == 0 || cube == 255 )
+						{
+							continue;
+						}
+
+						int edges[15], t;
+						t = sparLongCubeTriangles( cube, edges );
+
+						// Grow keys
+						if( ( count[n] + t ) * 3 > size )
+						{
+							size = size == 0 ? 48 : 2 * size;
+							keys[n] = (long long*) realloc( keys[n], size * sizeof(long long) );
+
+							if( keys[n] == NULL )
+							{
+							   fprintf(stderr, "sparLongIsosurface error: Out of memory\n");
+							   exit(1);
+							}
+						}
+
+						// Edge key of lower element (x,y,z) and axis a, 3*(x+nx*(y+ny*z))+a
+						for( c = 0 ; c < 3 * t ; c++ )
+						{
+							const int *e;
+							e = edge[ edges[c] ];
+							keys[n][ 3 * count[n] + c ] = 3 * ( i1 * bs + i + e[0] + nx *
+								( j1 * bs + j + e[1] + (long long) ny * ( k1 * bs + k + e[2] ) ) ) + e[3];
+						}
+						count[n] += t;
+					}
+				}
+			}
+		}
+
+		free(buffer);
+	}
+
+	// Triangle offset per block
+	int m, total;
+	total = 0;
+	for( m = 0 ; m < nb ; m++ )
+	{
+		int c;
+		c = count[m];
+		count[m] = total;
+		total += c;
+	}
+	*nt = total;
+
+	if( total == 0 )
+	{
+		free(keys);
+		free(count);
+		*vertices = NULL;
+		*triangles = NULL;
+		return 0;
+	}
+
+	// All edge keys, then sorted unique keys as vertices
+	long long *all, *unique;
+	all = (long long*) malloc( 3 * total * sizeof(long long) );
+	unique = (long long*) malloc( 3 * total * sizeof(long long) );
+
+	if( all == NULL || unique == NULL )
+	{
+	   fprintf(stderr, "sparLongIsosurface error: Out of memory\n");
+	   exit(1);
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( m = 0 ; m < nb ; m++ )
+	{
+		if( keys[m] != NULL )
+		{
+			int c;
+			c = ( m + 1 < nb ? count[ m + 1 ] : total ) - count[m];
+			memcpy( all + 3 * count[m], keys[m], 3 * c * sizeof(long long) );
+			free(keys[m]);
+		}
+	}
+	free(keys);
+	free(count);
+
+	memcpy( unique, all, 3 * total * sizeof(long long) );
+	qsort( unique, 3 * total, sizeof(long long), sparLongCompareKey );
+
+	int nv;
+	nv = 1;
+	for( m = 1 ; m < 3 * total ; m++ )
+	{
+		if( unique[m] != unique[ nv - 1 ] )
+		{
+			unique[ nv++ ] = unique[m];
+		}
+	}
+
+	*vertices = (double*) malloc( 3 * nv * sizeof(double) );
+	*triangles = (int*) malloc( 3 * total * sizeof(int) );
+
+	if( *vertices == NULL || *triangles == NULL )
+	{
+	   fprintf(stderr, "sparLongIsosurface error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Vertex on edge by linear interpolation
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( m = 0 ; m < nv ; m++ )
+	{
+		// Lower element (x,y,z) and axis a
+		int a, p[3];
+		long long key;
+		key = unique[m] / 3;
+		a = (int)( unique[m] % 3 );
+		p[0] = (int)( key % nx );
+		p[1] = (int)( ( key / nx ) % ny );
+		p[2] = (int)( key / ( (long long) nx * ny ) );
+
+		double v0, v1, t;
+		v0 = sparLongGet( matrix, p[0], p[1], p[2] );
+		v1 = sparLongGet( matrix, p[0] + ( a == 0 ), p[1] + ( a == 1 ), p[2] + ( a == 2 ) );
+		t = ( iso - v0 ) / ( v1 - v0 );
+
+		(*vertices)[ 3 * m ] = p[0] + ( a == 0 ) * t;
+		(*vertices)[ 3 * m + 1 ] = p[1] + ( a == 1 ) * t;
+		(*vertices)[ 3 * m + 2 ] = p[2] + ( a == 2 ) * t;
+	}
+
+	// Triangle vertex indices
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( m = 0 ; m < 3 * total ; m++ )
+	{
+		long long *v;
+		v = (long long*) bsearch( all + m, unique, nv, sizeof(long long), sparLongCompareKey );
+		(*triangles)[m] = (int)( v - unique );
+	}
+
+	free(all);
+	free(unique);
+
+	return nv;
+}
+
+// Copy block (i,j,k) of src into block (x,y,z) of dst, same block size
+void sparLongCopyBlock( sparLong *dst, int x, int y, int z, sparLong *src, int i, int j, int k )
+{
+	// Linear block indices
+	int n, m;
+	n = x + dst->mx * ( y + dst->my * z );
+	m = i + src->mx * ( j + src->my * k );
+
+	// Uniform block
+	if( src->blockData[m] == NULL )
+	{
+		if( dst->blockData[n] != NULL )
+		{
+			free(dst->blockData[n]);
+			dst->blockData[n] = NULL;
+		}
+		dst->blockValue[n] = src->blockValue[m];
+		return;
+	}
+
+	// Heterogeneous block, reuse destination data if any
+	if( dst->blockData[n] == NULL )
+	{
+		dst->blockData[n] = (long*) malloc( dst->bs3 * sizeof(long) );
+
+		if( dst->blockData[n] == NULL )
+		{
+		   fprintf(stderr, "sparLongCopyBlock error: Out of memory\n");
+		   exit(1);
+		}
+	}
+
+	memcpy( dst->blockData[n], src->blockData[m], dst->bs3 * sizeof(long) );
+
+	// Boundary block may become uniform inside the matrix
+	if( x == dst->mx - 1 || y == dst->my - 1 || z == dst->mz - 1 )
+	{
+		sparLongReduceBlock( dst, x, y, z );
+	}
+}
+
+// New matrix with box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1), elements outside the matrix set to default, ring buffer origin reset
+sparLong* sparLongCrop( sparLong *matrix, int x, int y, int z, int sx, int sy, int sz )
+{
+	// Declare matrix and init
+	sparLong *matrix2;
+	matrix2 = sparLongInit( sx, sy, sz, matrix->bs, matrix->def );
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Box aligned with source blocks
+	int aligned;
+	aligned = x >= 0 && y >= 0 && z >= 0 && x % bs == 0 && y % bs == 0 && z % bs == 0;
+
+	// Number of blocks
+	int blocks;
+	blocks = matrix2->mx * matrix2->my * matrix2->mz;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		// Block (i1,j1,k1) and source box origin
+		int i1, j1, k1, x0, y0, z0;
+		i1 = n % matrix2->mx;
+		j1 = ( n / matrix2->mx ) % matrix2->my;
+		k1 = n / ( matrix2->mx * matrix2->my );
+		x0 = x + i1 * bs;
+		y0 = y + j1 * bs;
+		z0 = z + k1 * bs;
+
+		// Aligned source block covering the block elements inside the matrix, copy block
+		if( aligned && x0 < matrix->nx && y0 < matrix->ny && z0 < matrix->nz &&
+			matrix->nx - x0 >= ( sx - i1 * bs < bs ? sx - i1 * bs : bs ) &&
+			matrix->ny - y0 >= ( sy - j1 * bs < bs ? sy - j1 * bs : bs ) &&
+			matrix->nz - z0 >= ( sz - k1 * bs < bs ? sz - k1 * bs : bs ) )
+		{
+			sparLongCopyBlock( matrix2, i1, j1, k1, matrix, x0 / bs, y0 / bs, z0 / bs );
+			continue;
+		}
+
+		// Uniform source box
+		long value;
+		if( sparLongUniformBox( matrix, x0, y0, z0, bs, bs, bs, &value ) &&
+			x0 >= 0 && y0 >= 0 && z0 >= 0 && x0 + bs <= matrix->nx && y0 + bs <= matrix->ny && z0 + bs <= matrix->nz )
+		{
+			matrix2->blockValue[n] = value;
+			continue;
+		}
+
+		// Read source box rows into the block, reduce if possible
+		matrix2->blockData[n] = (long*) malloc( matrix2->bs3 * sizeof(long) );
+
+		if( matrix2->blockData[n] == NULL )
+		{
+		   fprintf(stderr, "sparLongCrop error: Out of memory\n");
+		   exit(1);
+		}
+
+		sparLongGetBox( matrix, x0, y0, z0, bs, bs, bs, matrix2->blockData[n] );
+		sparLongReduceBlock( matrix2, i1, j1, k1 );
+	}
+
+	return matrix2;
+}
+
+// Write src into matrix at (x,y,z), clipped to the matrix
+void sparLongPaste( sparLong *matrix, sparLong *src, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + src->nx > matrix->nx ? matrix->nx : x + src->nx;
+	y1 = y + src->ny > matrix->ny ? matrix->ny : y + src->ny;
+	z1 = z + src->nz > matrix->nz ? matrix->nz : z + src->nz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	// Box aligned with blocks of the same size
+	int aligned;
+	aligned = src->bs == bs && x >= 0 && y >= 0 && z >= 0 && x % bs == 0 && y % bs == 0 && z % bs == 0;
+
+	// Range of blocks
+	int bx, by, bz, cx, cy, cz;
+	bx = x0 / bs;
+	by = y0 / bs;
+	bz = z0 / bs;
+	cx = ( x1 - 1 ) / bs - bx + 1;
+	cy = ( y1 - 1 ) / bs - by + 1;
+	cz = ( z1 - 1 ) / bs - bz + 1;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		long *buffer;
+		buffer = (long*) malloc( bs * bs * bs * sizeof(long) );
+
+		if( buffer == NULL )
+		{
+		   fprintf(stderr, "sparLongPaste error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each block overlapping the box
+		int t;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( t = 0 ; t < cx * cy * cz ; t++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = bx + t % cx;
+			j1 = by + ( t / cx ) % cy;
+			k1 = bz + t / ( cx * cy );
+
+			// Block and box intersection
+			int bx0, by0, bz0, bx1, by1, bz1;
+			bx0 = i1 * bs > x0 ? i1 * bs : x0;
+			by0 = j1 * bs > y0 ? j1 * bs : y0;
+			bz0 = k1 * bs > z0 ? k1 * bs : z0;
+			bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+			by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+			bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+			// Aligned block with elements inside the matrix fully covered, copy block
+			if( aligned && bx0 == i1 * bs && by0 == j1 * bs && bz0 == k1 * bs &&
+				( bx1 == ( i1 + 1 ) * bs || bx1 == matrix->nx ) &&
+				( by1 == ( j1 + 1 ) * bs || by1 == matrix->ny ) &&
+				( bz1 == ( k1 + 1 ) * bs || bz1 == matrix->nz ) )
+			{
+				sparLongCopyBlock( matrix, i1, j1, k1, src, i1 - x / bs, j1 - y / bs, k1 - z / bs );
+				continue;
+			}
+
+			// Copy intersection rows
+			sparLongGetBox( src, bx0 - x, by0 - y, bz0 - z, bx1 - bx0, by1 - by0, bz1 - bz0, buffer );
+			sparLongSetBox( matrix, bx0, by0, bz0, bx1 - bx0, by1 - by0, bz1 - bz0, buffer );
+		}
+
+		free(buffer);
+	}
+}
+
+// Shift contents by (dx,dy,dz), element (x,y,z) moves to (x+dx,y+dy,z+dz), vacated elements set to default
+void sparLongShift( sparLong *matrix, int dx, int dy, int dz )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Shift in blocks (qx,qy,qz) and remainder (rx,ry,rz), same sign so no data is dropped early
+	int qx, qy, qz, rx, ry, rz;
+	qx = dx / bs;
+	qy = dy / bs;
+	qz = dz / bs;
+	rx = dx % bs;
+	ry = dy % bs;
+	rz = dz % bs;
+
+	// Move blocks
+	if( qx != 0 || qy != 0 || qz != 0 )
+	{
+		// New block data
+		long *blockValue;
+		long **blockData;
+
+		int blocks;
+		blocks = mx * my * mz;
+		blockValue = (long*) calloc( blocks, sizeof(long) ); // Sets to 0s
+		blockData = (long**) calloc( blocks, sizeof(long*) ); // Sets to NULLs
+
+		if( blockValue == NULL || blockData == NULL )
+		{
+		   fprintf(stderr, "sparLongShift error: Out of memory\n");
+		   exit(1);
+		}
+
+		int i, j, k;
+		for( k = 0 ; k < mz ; k++ )
+		{
+			for( j = 0 ; j < my ; j++ )
+			{
+				for( i = 0 ; i < mx ; i++ )
+				{
+					// Source block
+					int i2, j2, k2, n;
+					i2 = i - qx;
+					j2 = j - qy;
+					k2 = k - qz;
+					n = i + mx * ( j + my * k );
+
+					if( i2 >= 0 && j2 >= 0 && k2 >= 0 && i2 < mx && j2 < my && k2 < mz )
+					{
+						int m;
+						m = i2 + mx * ( j2 + my * k2 );
+						blockValue[n] = matrix->blockValue[m];
+						blockData[n] = matrix->blockData[m];
+						matrix->blockData[m] = NULL;
+					}
+					else
+					{
+						blockValue[n] = matrix->def;
+					}
+				}
+			}
+		}
+
+		// Free blocks moved outside
+		for( i = 0 ; i < blocks ; i++ )
+		{
+			if( matrix->blockData[i] != NULL )
+			{
+				free(matrix->blockData[i]);
+			}
+		}
+
+		free(matrix->blockData);
+		free(matrix->blockValue);
+
+		matrix->blockData = blockData;
+		matrix->blockValue = blockValue;
+
+		// Previous boundary blocks moved inside, set outside elements to default
+		int ex, ey, ez;
+		ex = matrix->nx - ( mx - 1 ) * bs;
+		ey = matrix->ny - ( my - 1 ) * bs;
+		ez = matrix->nz - ( mz - 1 ) * bs;
+
+		if( ex < bs && qx < 0 && mx - 1 + qx >= 0 )
+		{
+			sparLongFillBox( matrix, ( mx - 1 + qx ) * bs + ex, 0, 0, bs - ex, matrix->ny, matrix->nz, matrix->def );
+		}
+		if( ey < bs && qy < 0 && my - 1 + qy >= 0 )
+		{
+			sparLongFillBox( matrix, 0, ( my - 1 + qy ) * bs + ey, 0, matrix->nx, bs - ey, matrix->nz, matrix->def );
+		}
+		if( ez < bs && qz < 0 && mz - 1 + qz >= 0 )
+		{
+			sparLongFillBox( matrix, 0, 0, ( mz - 1 + qz ) * bs + ez, matrix->nx, matrix->ny, bs - ez, matrix->def );
+		}
+
+		// Blocks moved to the boundary may be uniform inside the matrix
+		for( k = 0 ; k < mz ; k++ )
+		{
+			for( j = 0 ; j < my ; j++ )
+			{
+				for( i = 0 ; i < mx ; i++ )
+				{
+					if( ( i == mx - 1 && ex < bs && qx != 0 ) || ( j == my - 1 && ey < bs && qy != 0 ) ||
+						( k == mz - 1 && ez < bs && qz != 0 ) )
+					{
+						sparLongReduceBlock( matrix, i, j, k );
+					}
+				}
+			}
+		}
+	}
+
+	// Recombine blocks for the remainder
+	if( rx != 0 || ry != 0 || rz != 0 )
+	{
+		sparLong *shifted;
+		shifted = sparLongCrop( matrix, -rx, -ry, -rz, matrix->nx, matrix->ny, matrix->nz );
+
+		// Swap block data
+		long *blockValue;
+		long **blockData;
+		blockValue = matrix->blockValue;
+		blockData = matrix->blockData;
+		matrix->blockValue = shifted->blockValue;
+		matrix->blockData = shifted->blockData;
+		shifted->blockValue = blockValue;
+		shifted->blockData = blockData;
+
+		sparLongFree( shifted );
+	}
+}
+
+// Ring buffer index of world coordinate w in a ring of size n
+int sparLongRingIndex( int w, int n )
+{
+	return ( w % n + n ) % n;
+}
+
+// Set element at world coordinates (x,y,z) of the ring buffer window, ignored outside the window
+void sparLongRingSet( sparLong *matrix, int x, int y, int z, long value )
+{
+	if( x < matrix->ox || y < matrix->oy || z < matrix->oz ||
+		x >= matrix->ox + matrix->nx || y >= matrix->oy + matrix->ny || z >= matrix->oz + matrix->nz )
+	{
+		return;
+	}
+
+	sparLongSet( matrix, sparLongRingIndex( x, matrix->nx ), sparLongRingIndex( y, matrix->ny ), sparLongRingIndex( z, matrix->nz ), value );
+}
+
+// Get element at world coordinates (x,y,z) of the ring buffer window, default value outside the window
+long sparLongRingGet( sparLong *matrix, int x, int y, int z )
+{
+	if( x < matrix->ox || y < matrix->oy || z < matrix->oz ||
+		x >= matrix->ox + matrix->nx || y >= matrix->oy + matrix->ny || z >= matrix->oz + matrix->nz )
+	{
+		return matrix->def;
+	}
+
+	return sparLongGet( matrix, sparLongRingIndex( x, matrix->nx ), sparLongRingIndex( y, matrix->ny ), sparLongRingIndex( z, matrix->nz ) );
+}
+
+// Move the ring buffer window origin to world coordinates (x,y,z), elements entering the window set to default
+void sparLongRingMove( sparLong *matrix, int x, int y, int z )
+{
+	// Matrix size, previous and new origin
+	int size[3], o[3], p[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+	o[0] = matrix->ox;
+	o[1] = matrix->oy;
+	o[2] = matrix->oz;
+	p[0] = x;
+	p[1] = y;
+	p[2] = z;
+
+	// Window moved by at least its size on one axis, reset all
+	int a;
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		if( abs( p[a] - o[a] ) >= size[a] )
+		{
+			sparLongFillBox( matrix, 0, 0, 0, matrix->nx, matrix->ny, matrix->nz, matrix->def );
+			matrix->ox = x;
+			matrix->oy = y;
+			matrix->oz = z;
+			return;
+		}
+	}
+
+	// For each axis, reset the slab of elements entering the window, in up to two boxes of ring indices
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		if( p[a] == o[a] )
+		{
+			continue;
+		}
+
+		// First entering world coordinate and slab thickness
+		int w, t;
+		w = p[a] > o[a] ? o[a] + size[a] : p[a];
+		t = abs( p[a] - o[a] );
+
+		// Ring index ranges [s0,s0+t0) and [0,t-t0)
+		int s0, t0;
+		s0 = sparLongRingIndex( w, size[a] );
+		t0 = s0 + t > size[a] ? size[a] - s0 : t;
+
+		int b[3], c[3];
+		b[0] = 0;
+		b[1] = 0;
+		b[2] = 0;
+		c[0] = matrix->nx;
+		c[1] = matrix->ny;
+		c[2] = matrix->nz;
+
+		b[a] = s0;
+		c[a] = t0;
+		sparLongFillBox( matrix, b[0], b[1], b[2], c[0], c[1], c[2], matrix->def );
+
+		if( t0 < t )
+		{
+			b[a] = 0;
+			c[a] = t - t0;
+			sparLongFillBox( matrix, b[0], b[1], b[2], c[0], c[1], c[2], matrix->def );
+		}
+	}
+
+	matrix->ox = x;
+	matrix->oy = y;
+	matrix->oz = z;
+}
+
+// New matrix with permuted axes, new x, y and z axes are the axes ax, ay and az (0 x, 1 y, 2 z) of matrix
+sparLong* sparLongPermute( sparLong *matrix, int ax, int ay, int az )
+{
+	// Check permutation
+	if( ax < 0 || ay < 0 || az < 0 || ax > 2 || ay > 2 || az > 2 || ax == ay || ay == az || az == ax )
+	{
+		fprintf(stderr, "sparLongPermute error: Axes must be a permutation of 0, 1 and 2\n");
+		exit(1);
+	}
+
+	// Matrix and block matrix size
+	int size[3], blockSize[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+	blockSize[0] = matrix->mx;
+	blockSize[1] = matrix->my;
+	blockSize[2] = matrix->mz;
+
+	// Declare matrix and init
+	sparLong *matrix2;
+	matrix2 = sparLongInit( size[ax], size[ay], size[az], matrix->bs, matrix->def );
+
+	// Permute ring buffer origin
+	int origin[3];
+	origin[0] = matrix->ox;
+	origin[1] = matrix->oy;
+	origin[2] = matrix->oz;
+	matrix2->ox = origin[ax];
+	matrix2->oy = origin[ay];
+	matrix2->oz = origin[az];
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Source strides of the new axes, blocks and elements
+	int stride[3], blockStride[3];
+	stride[0] = 1;
+	stride[1] = bs;
+	stride[2] = bs * bs;
+	blockStride[0] = 1;
+	blockStride[1] = blockSize[0];
+	blockStride[2] = blockSize[0] * blockSize[1];
+
+	int sx, sy, sz, bx, by, bz;
+	sx = stride[ax];
+	sy = stride[ay];
+	sz = stride[az];
+	bx = blockStride[ax];
+	by = blockStride[ay];
+	bz = blockStride[az];
+
+	// Number of blocks
+	int blocks;
+	blocks = matrix2->mx * matrix2->my * matrix2->mz;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		// Block (i1,j1,k1) and source block
+		int i1, j1, k1, m;
+		i1 = n % matrix2->mx;
+		j1 = ( n / matrix2->mx ) % matrix2->my;
+		k1 = n / ( matrix2->mx * matrix2->my );
+		m = i1 * bx + j1 * by + k1 * bz;
+
+		// Uniform block
+		if( matrix->blockData[m] == NULL )
+		{
+			matrix2->blockValue[n] = matrix->blockValue[m];
+			continue;
+		}
+
+		// Heterogeneous block, transpose in cache
+		long *blockData, *source;
+		blockData = (long*) malloc( matrix2->bs3 * sizeof(long) );
+		source = matrix->blockData[m];
+
+		if( blockData == NULL )
+		{
+		   fprintf(stderr, "sparLongPermute error: Out of memory\n");
+		   exit(1);
+		}
+
+		int i, j, k;
+		for( k = 0 ; k < bs ; k++ )
+		{
+			for( j = 0 ; j < bs ; j++ )
+			{
+				long *row, *column;
+				row = blockData + bs * ( j + bs * k );
+				column = source + j * sy + k * sz;
+				for( i = 0 ; i < bs ; i++ )
+				{
+					row[i] = column[ i * sx ];
+				}
+			}
+		}
+
+		matrix2->blockData[n] = blockData;
+	}
+
+	return matrix2;
+}
+
+// Allocate n elements 64-byte aligned with plain malloc (no C11 aligned_alloc), release with the matching DenseFree
+long* sparLongDenseAlloc( long n )
+{
+	// Room for the alignment offset and the original pointer
+	char *base;
+	base = (char*) malloc( n * sizeof(long) + 64 + sizeof(void*) );
+
+	if( base == NULL )
+	{
+		return NULL;
+	}
+
+	// First 64-byte boundary after the stored original pointer
+	char *aligned;
+	aligned = base + sizeof(void*);
+	aligned = aligned + ( 64 - (uintptr_t)( aligned ) % 64 ) % 64;
+	((void**) aligned)[-1] = base;
+
+	return (long*) aligned;
+}
+
+// Free dense buffer returned by Densify or DenseAlloc
+void sparLongDenseFree( long *buffer )
+{
+	if( buffer != NULL )
+	{
+		free( ((void**) buffer)[-1] );
+	}
+}
+
+// Dense copy padded to (px,py,pz) with the default value, rows along axis contiguous and 64-byte aligned every pitch elements (free with sparLongDenseFree)
+long* sparLongDensify( sparLong *matrix, int axis, int px, int py, int pz, int *pitch )
+{
+	// Check padded size
+	if( px < matrix->nx || py < matrix->ny || pz < matrix->nz || axis < 0 || axis > 2 )
+	{
+		fprintf(stderr, "sparLongDensify error: Padded size must contain the matrix\n");
+		exit(1);
+	}
+
+	// Padded size and the other two axes (b,c)
+	int p[3], b, c;
+	p[0] = px;
+	p[1] = py;
+	p[2] = pz;
+	b = axis == 0 ? 1 : 0;
+	c = axis == 2 ? 1 : 2;
+
+	// Row pitch, multiple of 64 bytes
+	int align;
+	align = 64 % sizeof(long) == 0 ? 64 / sizeof(long) : 1;
+	*pitch = ( p[axis] + align - 1 ) / align * align;
+
+	// Element (x,y,z) at x*s[0]+y*s[1]+z*s[2]
+	long s[3];
+	s[axis] = 1;
+	s[b] = *pitch;
+	s[c] = (long) *pitch * p[b];
+
+	long *buffer;
+	buffer = sparLongDenseAlloc( s[c] * p[c] );
+
+	if( buffer == NULL )
+	{
+	   fprintf(stderr, "sparLongDensify error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Matrix size
+	int size[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+
+	// Padding, row by row
+	int r;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( r = 0 ; r < p[b] * p[c] ; r++ )
+	{
+		// Row (j,k) along axes (b,c)
+		int i, j, k;
+		j = r % p[b];
+		k = r / p[b];
+
+		long *row;
+		row = buffer + j * s[b] + k * s[c];
+		for( i = ( j < size[b] && k < size[c] ) ? size[axis] : 0 ; i < *pitch ; i++ )
+		{
+			row[i] = matrix->def;
+		}
+	}
+
+	sparLongGetDense( matrix, buffer, s[0], s[1], s[2] );
+
+	return buffer;
+}
+
+// Copy dense buffer with element (x,y,z) at x*sx+y*sy+z*sz into matrix, uniform blocks detected
+void sparLongSetDense( sparLong *matrix, long *buffer, long sx, long sy, long sz )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Element strides
+	long s[3];
+	s[0] = sx;
+	s[1] = sy;
+	s[2] = sz;
+
+	// Number of blocks
+	int blocks;
+	blocks = matrix->mx * matrix->my * matrix->mz;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block elements
+		long *temp;
+		temp = (long*) malloc( bs3 * sizeof(long) );
+
+		if( temp == NULL )
+		{
+		   fprintf(stderr, "sparLongSetDense error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < blocks ; n++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = n % matrix->mx;
+			j1 = ( n / matrix->mx ) % matrix->my;
+			k1 = n / ( matrix->mx * matrix->my );
+
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = matrix->nx - i1 * bs < bs ? matrix->nx - i1 * bs : bs;
+			ey = matrix->ny - j1 * bs < bs ? matrix->ny - j1 * bs : bs;
+			ez = matrix->nz - k1 * bs < bs ? matrix->nz - k1 * bs : bs;
+
+			// Gather block and check uniformity in a single scan
+			long value;
+			int isUniform;
+			value = buffer[ i1 * bs * s[0] + j1 * bs * s[1] + k1 * bs * s[2] ];
+			isUniform = 1;
+
+			int i, j, k;
+			for( k = 0 ; k < bs ; k++ )
+			{
+				for( j = 0 ; j < bs ; j++ )
+				{
+					long *row, *blockRow;
+					row = buffer + i1 * bs * s[0] + ( j1 * bs + j ) * s[1] + ( k1 * bs + k ) * s[2];
+					blockRow = temp + bs * ( j + bs * k );
+
+					// Outside elements set to default
+					if( j >= ey || k >= ez )
+					{
+						for( i = 0 ; i < bs ; i++ )
+						{
+							blockRow[i] = matrix->def;
+						}
+						continue;
+					}
+
+					for( i = 0 ; i < ex ; i++ )
+					{
+						blockRow[i] = row[ i * s[0] ];
+						isUniform &= sparLongEqual( blockRow[i], value );
+					}
+					for( i = ex ; i < bs ; i++ )
+					{
+						blockRow[i] = matrix->def;
+					}
+				}
+			}
+
+			// Uniform block
+			if( isUniform )
+			{
+				if( matrix->blockData[n] != NULL )
+				{
+					free(matrix->blockData[n]);
+					matrix->blockData[n] = NULL;
+				}
+				matrix->blockValue[n] = value;
+			}
+			// Heterogeneous block, reuse previous data if any
+			else if( matrix->blockData[n] != NULL )
+			{
+				memcpy( matrix->blockData[n], temp, bs3 * sizeof(long) );
+			}
+			// Heterogeneous block, keep gathered elements
+			else
+			{
+				matrix->blockData[n] = temp;
+				temp = (long*) malloc( bs3 * sizeof(long) );
+
+				if( temp == NULL )
+				{
+				   fprintf(stderr, "sparLongSetDense error: Out of memory\n");
+				   exit(1);
+				}
+			}
+		}
+
+		free(temp);
+	}
+}
+
+// Copy dense buffer with the densify layout (axis, pitch and padded size) into matrix, uniform blocks detected
+void sparLongSparsify( sparLong *matrix, long *buffer, int axis, int pitch, int px, int py, int pz )
+{
+	// Check padded size and pitch
+	if( px < matrix->nx || py < matrix->ny || pz < matrix->nz || axis < 0 || axis > 2 )
+	{
+		fprintf(stderr, "sparLongSparsify error: Padded size must contain the matrix\n");
+		exit(1);
+	}
+
+	if( pitch < ( axis == 0 ? px : ( axis == 1 ? py : pz ) ) )
+	{
+		fprintf(stderr, "sparLongSparsify error: Pitch must be at least the padded row length\n");
+		exit(1);
+	}
+
+	// Padded size and the other two axes (b,c)
+	int p[3], b, c;
+	p[0] = px;
+	p[1] = py;
+	p[2] = pz;
+	b = axis == 0 ? 1 : 0;
+	c = axis == 2 ? 1 : 2;
+
+	// Element (x,y,z) at x*s[0]+y*s[1]+z*s[2]
+	long s[3];
+	s[axis] = 1;
+	s[b] = pitch;
+	s[c] = (long) pitch * p[b];
+
+	sparLongSetDense( matrix, buffer, s[0], s[1], s[2] );
+}
+
+// New matrix from dense buffer with element (x,y,z) at x*sx+y*sy+z*sz, only heterogeneous blocks allocated
+sparLong* sparLongInitDense( long *buffer, int nx, int ny, int nz, long sx, long sy, long sz, int bs, long def )
+{
+	// Declare matrix and init
+	sparLong *matrix;
+	matrix = sparLongInit( nx, ny, nz, bs, def );
+
+	sparLongSetDense( matrix, buffer, sx, sy, sz );
+
+	return matrix;
+}
+
+// Copy matrix into dense buffer with element (x,y,z) at x*sx+y*sy+z*sz
+void sparLongGetDense( sparLong *matrix, long *buffer, long sx, long sy, long sz )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// For each row along x, in contiguous slabs per thread
+	int r;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( r = 0 ; r < matrix->ny * matrix->nz ; r++ )
+	{
+		// Row (y,z), its blocks and offset in the block
+		int y, z, j1, k1, offset;
+		y = r % matrix->ny;
+		z = r / matrix->ny;
+		j1 = y / bs;
+		k1 = z / bs;
+		offset = bs * ( y % bs + bs * ( z % bs ) );
+
+		long *row;
+		row = buffer + y * sy + z * sz;
+
+		// For each block along the row
+		int i1;
+		for( i1 = 0 ; i1 < matrix->mx ; i1++ )
+		{
+			// Linear block index (n) <-> (i1,j1,k1)
+			int n;
+			n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+			// Block extent inside the matrix
+			int ex;
+			ex = matrix->nx - i1 * bs < bs ? matrix->nx - i1 * bs : bs;
+
+			long *blockData, *out, value;
+			blockData = matrix->blockData[n];
+			value = matrix->blockValue[n];
+			out = row + i1 * bs * sx;
+
+			int i;
+
+			// Uniform block, contiguous row
+			if( blockData == NULL && sx == 1 )
+			{
+				for( i = 0 ; i < ex ; i++ )
+				{
+					out[i] = value;
+				}
+			}
+			// Uniform block, strided row
+			else if( blockData == NULL )
+			{
+				for( i = 0 ; i < ex ; i++ )
+				{
+					out[ i * sx ] = value;
+				}
+			}
+			// Heterogeneous block, contiguous row
+			else if( sx == 1 )
+			{
+				memcpy( out, blockData + offset, ex * sizeof(long) );
+			}
+			// Heterogeneous block, strided row
+			else
+			{
+				for( i = 0 ; i < ex ; i++ )
+				{
+					out[ i * sx ] = blockData[ offset + i ];
+				}
+			}
+		}
+	}
+}
+
+// Change the default value, uniform blocks with the previous default value set to the new one
+void sparLongSetDefault( sparLong *matrix, long def )
+{
+	// Number of blocks
+	int blocks;
+	blocks = matrix->mx * matrix->my * matrix->mz;
+
+	int i;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( i = 0 ; i < blocks ; i++ )
+	{
+		if( matrix->blockData[i] == NULL && sparLongEqual( matrix->blockValue[i], matrix->def ) )
+		{
+			matrix->blockValue[i] = def;
+		}
+	}
+
+	matrix->def = def;
+}
+
+// Most frequent value in box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) clipped to the matrix, smallest on ties, its count in count if not NULL
+long sparLongDominant( sparLong *matrix, int x, int y, int z, int sx, int sy, int sz, double *count )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		if( count != NULL )
+		{
+			*count = 0.0;
+		}
+		return matrix->def;
+	}
+
+	// Runs of equal values, one per uniform block and per distinct value of heterogeneous blocks
+	int runs, size;
+	long *runValue, *temp;
+	double *runCount;
+	runs = 0;
+	size = 64;
+	runValue = (long*) malloc( size * sizeof(long) );
+	runCount = (double*) malloc( size * sizeof(double) );
+	temp = (long*) malloc( matrix->bs3 * sizeof(long) );
+
+	if( runValue == NULL || runCount == NULL || temp == NULL )
+	{
+	   fprintf(stderr, "sparLongDominant error: Out of memory\n");
+	   exit(1);
+	}
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1, m;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+				m = ( bx1 - bx0 ) * ( by1 - by0 ) * ( bz1 - bz0 );
+
+				// Grow runs
+				if( runs + m > size )
+				{
+					size = 2 * ( runs + m );
+					runValue = (long*) realloc( runValue, size * sizeof(long) );
+					runCount = (double*) realloc( runCount, size * sizeof(double) );
+
+					if( runValue == NULL || runCount == NULL )
+					{
+					   fprintf(stderr, "sparLongDominant error: Out of memory\n");
+					   exit(1);
+					}
+				}
+
+				// Uniform block, one run
+				if( matrix->blockData[n] == NULL )
+				{
+					runValue[runs] = matrix->blockValue[n];
+					runCount[runs] = m;
+					runs++;
+					continue;
+				}
+
+				// Heterogeneous block, sorted intersection elements
+				sparLongGetBox( matrix, bx0, by0, bz0, bx1 - bx0, by1 - by0, bz1 - bz0, temp );
+				qsort( temp, m, sizeof(long), sparLongCompare );
+
+				int i;
+				for( i = 0 ; i < m ; i++ )
+				{
+					if( i > 0 && sparLongEqual( temp[i], temp[ i - 1 ] ) )
+					{
+						runCount[ runs - 1 ] += 1.0;
+					}
+					else
+					{
+						runValue[runs] = temp[i];
+						runCount[runs] = 1.0;
+						runs++;
+					}
+				}
+			}
+		}
+	}
+
+	// Distinct values, sorted
+	int distinct, i;
+	long *values;
+	double *counts;
+	values = (long*) malloc( runs * sizeof(long) );
+	counts = (double*) calloc( runs, sizeof(double) );
+
+	if( values == NULL || counts == NULL )
+	{
+	   fprintf(stderr, "sparLongDominant error: Out of memory\n");
+	   exit(1);
+	}
+
+	memcpy( values, runValue, runs * sizeof(long) );
+	qsort( values, runs, sizeof(long), sparLongCompare );
+	distinct = 1;
+	for( i = 1 ; i < runs ; i++ )
+	{
+		if( sparLongEqual( values[i], values[ distinct - 1 ] ) == 0 )
+		{
+			values[ distinct++ ] = values[i];
+		}
+	}
+
+	// Count per distinct value
+	for( i = 0 ; i < runs ; i++ )
+	{
+		long *v;
+		v = (long*) bsearch( runValue + i, values, distinct, sizeof(long), sparLongCompare );
+		counts[ v - values ] += runCount[i];
+	}
+
+	// Most frequent, first in sorted order on ties
+	int best;
+	best = 0;
+	for( i = 1 ; i < distinct ; i++ )
+	{
+		if( counts[i] > counts[best] )
+		{
+			best = i;
+		}
+	}
+
+	long value;
+	value = values[best];
+
+	if( count != NULL )
+	{
+		*count = counts[best];
+	}
+
+	free(runValue);
+	free(runCount);
+	free(temp);
+	free(values);
+	free(counts);
+
+	return value;
+}
+
+
+
+// Matrix constructor
+sparFloat* sparFloatInit( int nx, int ny, int nz, int bs, float def )
+{
+	// Check matrix size
+	if( !( nx > 0 && ny > 0 && nz > 0 ) )
+	{
+		fprintf(stderr, "sparFloatInit error: Matrix size must be positive\n");
+		exit(1);
+	}
+
+	// Check block size
+	if( !( bs > 1 ) )
+	{
+		fprintf(stderr, "sparFloatInit error: Block size must be greater than 1\n");
+		exit(1);
+	}
+
+	// Declare struct and allocate space
+	sparFloat *matrix;
+	matrix = (sparFloat*) malloc(sizeof(sparFloat));
+
+	if( matrix == NULL )
+	{
+	   fprintf(stderr, "sparFloatInit error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Set matrix size (nx,ny,nz)
+	matrix->nx = nx;
+	matrix->ny = ny;
+	matrix->nz = nz;
+
+	// Set block size (bs,bs,bs)
+	matrix->bs  = bs;
+	matrix->bs3 = bs * bs * bs;
+
+	// Set block matrix size (mx,my,mz)
+	matrix->mx = (int)( ( nx + bs - 1 ) / bs );
+	matrix->my = (int)( ( ny + bs - 1 ) / bs );
+	matrix->mz = (int)( ( nz + bs - 1 ) / bs );
+
+	// Number of blocks
+	int blocks = matrix->mx * matrix->my * matrix->mz;
+
+	// Allocate space for block uniform data
+	matrix->blockValue = (float*) calloc( blocks, sizeof(float) );
+
+	if( matrix->blockValue == NULL )
+	{
+	   fprintf(stderr, "sparFloatInit error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Allocate space for block heterogeneous data arrays
+	matrix->blockData = (float**) calloc( blocks, sizeof(float*) );
+
+	if( matrix->blockData == NULL )
+	{
+	   fprintf(stderr, "sparFloatInit error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Allocate space for block locks, cleared below
+	matrix->blockLock = (atomic_flag*) malloc( blocks * sizeof(atomic_flag) );
+
+	if( matrix->blockLock == NULL )
+	{
+	   fprintf(stderr, "sparFloatInit error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Set default value
+	matrix->def = def;
+
+	// Set ring buffer origin. Duplicate and Map copy it, Op requires equal origins and copies it, Permute permutes it and in-place operations keep it.
+	// Crop, Downsample and InitDense leave it at zero, their storage does not follow the ring layout of a source window.
+	matrix->ox = 0;
+	matrix->oy = 0;
+	matrix->oz = 0;
+
+	// Set matrix elemets to default value
+	int i;
+	for( i = 0 ; i < blocks ; i++ )
+	{
+		matrix->blockData[i] = NULL; // Flag for uniform block
+		matrix->blockValue[i] = def;
+	}
+
+	// Unlock all blocks
+	sparFloatClearLocks( matrix );
+
+	// Return pointer
+	return matrix;
+}
+
+// Clear (unlock) every block lock, flags are not assumed clear after allocation
+void sparFloatClearLocks( sparFloat *matrix )
+{
+	int n;
+	for( n = 0 ; n < matrix->mx * matrix->my * matrix->mz ; n++ )
+	{
+		atomic_flag_clear( &matrix->blockLock[n] );
+	}
+}
+
+// Matrix destructor
+void sparFloatFree( sparFloat *matrix )
+{
+	// Number of blocks
+	int blocks;
+	blocks = matrix->mx * matrix->my * matrix->mz;
+
+	// Free heterogeneous blocks
+	int i;
+	for( i = 0 ; i < blocks ; i++ )
+	{
+		if( matrix->blockData[i] != NULL ) // Flag for uniform block
+		{
+			free( matrix->blockData[i] );
+		}
+	}
+
+	// Free block uniform data
+	free(matrix->blockValue);
+
+	// Free block heterogeneous data array
+	free(matrix->blockData);
+
+	// Free block locks
+	free(matrix->blockLock);
+
+	// Free matrix instance
+	free(matrix);
+}
+
+// Reset matrix values
+void sparFloatReset( sparFloat *matrix )
+{
+	// Number of blocks
+	int blocks;
+	blocks = matrix->mx * matrix->my * matrix->mz;
+
+	// Reduce blocks and set to default value
+	int i;
+	for( i = 0 ; i < blocks ; i++ )
+	{
+		// Heterogeneous block
+		if( matrix->blockData[i] != NULL )
+		{
+			free( matrix->blockData[i] );
+			matrix->blockData[i] = NULL;
+		}
+		matrix->blockValue[i] = matrix->def;
+	}
+}
+
+// Get matrix memory usage in bytes
+double sparFloatMemory( sparFloat *matrix )
+{
+	// Number of blocks
+	int blocks;
+	blocks = matrix->mx * matrix->my * matrix->mz;
+
+	// Matrix instance
+	double size;
+	size = (double)( sizeof(sparFloat) );
+
+	// Uniform block data
+	size = size + (double)( blocks * sizeof(float) );
+
+	// Heterogeneous block data arrays
+	size = size + (double)( blocks * sizeof(float*) );
+
+	// Block locks
+	size = size + (double)( blocks * sizeof(atomic_flag) );
+
+	// Heterogeneous block data
+	int i;
+	for( i = 0 ; i < blocks ; i++ )
+	{
+		// Heterogeneous block
+		if( matrix->blockData[i] != NULL )
+		{
+			size = size + (double)( sizeof(float) * matrix->bs3 );
+		}
+	}
+
+	return size;
+}
+
+// Element equality, NaN equal to NaN so NaN regions compress like any other uniform value
+int sparFloatEqual( float a, float b )
+{
+	return a == b || ( isnan( (double) a ) && isnan( (double) b ) );
+}
+
+// Convert x to the data type, rounding to nearest for integer types instead of truncating
+float sparFloatRound( double x )
+{
+	// Integer types turn 0.5 into 0
+	if( (float)( 0.5 ) == 0 )
+	{
+		return (float)( floor( x + 0.5 ) );
+	}
+	return (float)( x );
+}
+
+// Check if block is uniform
+int sparFloatUniformBlock( sparFloat *matrix, int x, int y, int z )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Linear block index (n) <-> (x,y,z)
+	int n;
+	n = x + mx * ( y + my * z );
+
+	// Block data array
+	float *blockData;
+	blockData = matrix->blockData[n];
+
+	// Uniform block
+	if( blockData == NULL )
+	{
+		return 1;
+	}
+
+	int isUniform;
+	isUniform = 1;
+
+	// Inner block
+	if( x < mx - 1 && y < my - 1 && z < mz - 1)
+	{
+		// Start with last element
+		float value;
+		value = blockData[ bs3 - 1 ];
+
+		// Read block elements
+		int i;
+		for( i = 0 ; i < bs3 ; i++ )
+		{
+			if( sparFloatEqual( blockData[i], value ) == 0 )
+			{
+				isUniform = 0;
+				i = bs3;
+			}
+		}
+	}
+	// Boundary block, with outside elements?
+	else
+	{
+		// Start with first element
+		float value;
+		value = blockData[0];
+
+		// Read block elements
+		int i, j, k;
+		for( k = 0 ; k < bs ; k++ )
+		{
+			if( z * bs + k < matrix->nz ) // Avoid outside elements
+			for( j = 0 ; j < bs ; j++ )
+			{
+				if( y * bs + j < matrix->ny ) // Idem
+				for( i = 0 ; i < bs ; i++ )
+				{
+					if( x * bs + i < matrix->nx ) // Idem
+					if( sparFloatEqual( blockData[ i + bs * ( j + bs * k ) ], value ) == 0 )
+					{
+						isUniform = 0;
+						i = j = k = bs;
+					}
+				}
+			}
+		}
+	}
+
+	return isUniform;
+}
+
+// Expand uniform block (x,y,z) into heterogeneous block data
+void sparFloatExpandBlock( sparFloat *matrix, int x, int y, int z )
+{
+	// Linear block index (n) <-> (x,y,z)
+	int n;
+	n = x + matrix->mx * ( y + matrix->my * z );
+
+	// Already heterogeneous
+	if( matrix->blockData[n] != NULL )
+	{
+		return;
+	}
+
+	// Allocate block data
+	float *blockData;
+	blockData = (float*) calloc( matrix->bs3, sizeof(float) );
+
+	if( blockData == NULL )
+	{
+	   fprintf(stderr, "sparFloatExpandBlock error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Set uniform value
+	float value;
+	value = matrix->blockValue[n];
+
+	int i;
+	for( i = 0 ; i < matrix->bs3 ; i++ )
+	{
+		blockData[i] = value;
+	}
+
+	matrix->blockData[n] = blockData;
+}
+
+// Reduce block (x,y,z) to uniform if possible, return 1 if uniform
+int sparFloatReduceBlock( sparFloat *matrix, int x, int y, int z )
+{
+	// Linear block index (n) <-> (x,y,z)
+	int n;
+	n = x + matrix->mx * ( y + matrix->my * z );
+
+	// Already uniform
+	if( matrix->blockData[n] == NULL )
+	{
+		return 1;
+	}
+
+	// Heterogeneous block
+	if( sparFloatUniformBlock( matrix, x, y, z ) == 0 )
+	{
+		return 0;
+	}
+
+	// First element is always inside the matrix
+	matrix->blockValue[n] = matrix->blockData[n][0];
+	free(matrix->blockData[n]);
+	matrix->blockData[n] = NULL;
+
+	return 1;
+}
+
+// Check if every block overlapping box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) is uniform with the same value
+int sparFloatUniformBox( sparFloat *matrix, int x, int y, int z, int sx, int sy, int sz, float *value )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return 0;
+	}
+
+	// Reference value
+	int n;
+	n = x0 / bs + matrix->mx * ( y0 / bs + matrix->my * ( z0 / bs ) );
+	*value = matrix->blockValue[n];
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+				if( matrix->blockData[n] != NULL || sparFloatEqual( matrix->blockValue[n], *value ) == 0 )
+				{
+					return 0;
+				}
+			}
+		}
+	}
+
+	return 1;
+}
+
+// Copy box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) into buffer[i+sx*(j+sy*k)], default value outside the matrix
+void sparFloatGetBox( sparFloat *matrix, int x, int y, int z, int sx, int sy, int sz, float *buffer )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	int i, j, k;
+
+	// Box partially outside the matrix, fill with default value
+	if( x0 != x || y0 != y || z0 != z || x1 != x + sx || y1 != y + sy || z1 != z + sz )
+	{
+		for( i = 0 ; i < sx * sy * sz ; i++ )
+		{
+			buffer[i] = matrix->def;
+		}
+	}
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+				float *blockData;
+				blockData = matrix->blockData[n];
+
+				// Copy block rows
+				for( k = bz0 ; k < bz1 ; k++ )
+				{
+					for( j = by0 ; j < by1 ; j++ )
+					{
+						float *row;
+						row = buffer + ( bx0 - x ) + sx * ( ( j - y ) + sy * ( k - z ) );
+
+						// Uniform block
+						if( blockData == NULL )
+						{
+							float value;
+							value = matrix->blockValue[n];
+							for( i = 0 ; i < bx1 - bx0 ; i++ )
+							{
+								row[i] = value;
+							}
+						}
+						// Heterogeneous block
+						else
+						{
+							memcpy( row, blockData + ( bx0 - i1 * bs ) + bs * ( ( j - j1 * bs ) + bs * ( k - k1 * bs ) ),
+									( bx1 - bx0 ) * sizeof(float) );
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// Copy buffer[i+sx*(j+sy*k)] into box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1), elements outside the matrix are ignored
+void sparFloatSetBox( sparFloat *matrix, int x, int y, int z, int sx, int sy, int sz, float *buffer )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	int i, j, k;
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+				// Block elements inside the matrix are fully covered
+				int covered;
+				covered = bx0 == i1 * bs && by0 == j1 * bs && bz0 == k1 * bs &&
+						  ( bx1 == ( i1 + 1 ) * bs || bx1 == matrix->nx ) &&
+						  ( by1 == ( j1 + 1 ) * bs || by1 == matrix->ny ) &&
+						  ( bz1 == ( k1 + 1 ) * bs || bz1 == matrix->nz );
+
+				// Covered block, check if input is uniform first
+				if( covered )
+				{
+					float value;
+					value = buffer[ ( bx0 - x ) + sx * ( ( by0 - y ) + sy * ( bz0 - z ) ) ];
+
+					int isUniform;
+					isUniform = 1;
+					for( k = bz0 ; k < bz1 && isUniform ; k++ )
+					{
+						for( j = by0 ; j < by1 && isUniform ; j++ )
+						{
+							float *row;
+							row = buffer + ( bx0 - x ) + sx * ( ( j - y ) + sy * ( k - z ) );
+							for( i = 0 ; i < bx1 - bx0 ; i++ )
+							{
+								if( sparFloatEqual( row[i], value ) == 0 )
+								{
+									isUniform = 0;
+									break;
+								}
+							}
+						}
+					}
+
+					if( isUniform )
+					{
+						if( matrix->blockData[n] != NULL )
+						{
+							free(matrix->blockData[n]);
+							matrix->blockData[n] = NULL;
+						}
+						matrix->blockValue[n] = value;
+						continue;
+					}
+				}
+
+				// Copy block rows into heterogeneous block
+				sparFloatExpandBlock( matrix, i1, j1, k1 );
+
+				float *blockData;
+				blockData = matrix->blockData[n];
+
+				for( k = bz0 ; k < bz1 ; k++ )
+				{
+					for( j = by0 ; j < by1 ; j++ )
+					{
+						memcpy( blockData + ( bx0 - i1 * bs ) + bs * ( ( j - j1 * bs ) + bs * ( k - k1 * bs ) ),
+								buffer + ( bx0 - x ) + sx * ( ( j - y ) + sy * ( k - z ) ),
+								( bx1 - bx0 ) * sizeof(float) );
+					}
+				}
+
+				// Partially covered blocks may have become uniform
+				if( !covered )
+				{
+					sparFloatReduceBlock( matrix, i1, j1, k1 );
+				}
+			}
+		}
+	}
+}
+
+// Set every element of box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) to value, elements outside the matrix are ignored
+void sparFloatFillBox( sparFloat *matrix, int x, int y, int z, int sx, int sy, int sz, float value )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	int i, j, k;
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+				// Block elements inside the matrix are fully covered, uniform block
+				if( bx0 == i1 * bs && by0 == j1 * bs && bz0 == k1 * bs &&
+					( bx1 == ( i1 + 1 ) * bs || bx1 == matrix->nx ) &&
+					( by1 == ( j1 + 1 ) * bs || by1 == matrix->ny ) &&
+					( bz1 == ( k1 + 1 ) * bs || bz1 == matrix->nz ) )
+				{
+					if( matrix->blockData[n] != NULL )
+					{
+						free(matrix->blockData[n]);
+						matrix->blockData[n] = NULL;
+					}
+					matrix->blockValue[n] = value;
+					continue;
+				}
+
+				// Already uniform with the same value
+				if( matrix->blockData[n] == NULL && sparFloatEqual( matrix->blockValue[n], value ) )
+				{
+					continue;
+				}
+
+				// Fill block rows and reduce if possible
+				sparFloatExpandBlock( matrix, i1, j1, k1 );
+
+				float *blockData;
+				blockData = matrix->blockData[n];
+
+				for( k = bz0 ; k < bz1 ; k++ )
+				{
+					for( j = by0 ; j < by1 ; j++ )
+					{
+						float *row;
+						row = blockData + ( bx0 - i1 * bs ) + bs * ( ( j - j1 * bs ) + bs * ( k - k1 * bs ) );
+						for( i = 0 ; i < bx1 - bx0 ; i++ )
+						{
+							row[i] = value;
+						}
+					}
+				}
+
+				sparFloatReduceBlock( matrix, i1, j1, k1 );
+			}
+		}
+	}
+}
+
+// Set matrix element (x,y,z)
+void sparFloatSet( sparFloat *matrix, int x, int y, int z, float value )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block (i1,j1,k1) contains the element (x,y,z)
+	int i1, j1, k1;
+	i1 = x / bs;
+	j1 = y / bs;
+	k1 = z / bs;
+
+	// Element indices in the block
+	int i2, j2, k2;
+	i2 = x % bs;
+	j2 = y % bs;
+	k2 = z % bs;
+
+	// Linear block index (n) <-> (i1,j1,k1)
+	int n;
+	n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+	// Block uniform value
+	float blockValue;
+	blockValue = matrix->blockValue[n];
+
+	// Block data array
+	float *blockData;
+	blockData = matrix->blockData[n];
+
+	// Uniform block
+	if( blockData == NULL )
+	{
+		// Input value is different
+		if( sparFloatEqual( value, blockValue ) == 0 )
+		{
+			// Expand block
+			blockData = (float*) calloc( bs3, sizeof(float) );
+			matrix->blockData[n] = blockData;
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparFloatSet error: Out of memory\n");
+			   exit(1);
+			}
+
+			// Set previous value
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				blockData[i] = blockValue;
+			}
+
+			// Set input value
+			blockData[ i2 + bs * ( j2 + bs * k2 ) ] = value;
+		}
+		// Else, do nothing
+	}
+	// Heterogeneous block
+	else
+	{
+		// Set input value
+		blockData[ i2 + bs * ( j2 + bs * k2 ) ] = value;
+
+		// Reduce block
+		if( sparFloatUniformBlock( matrix, i1, j1, k1 ) )
+		{
+			matrix->blockValue[n] = value;
+			free(matrix->blockData[n]);
+			matrix->blockData[n] = NULL;
+		}
+	}
+}
+
+// Get matrix element (x,y,z)
+float sparFloatGet( sparFloat *matrix, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Block (i1,j1,k1) contains the element (x,y,z)
+	int i1, j1, k1;
+	i1 = x / bs;
+	j1 = y / bs;
+	k1 = z / bs;
+
+	// Linear block index (n) <-> (i1,j1,k1)
+	int n;
+	n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+	float *blockData;
+	blockData = matrix->blockData[n];
+
+	// Uniform block
+	if( blockData == NULL )
+	{
+		return matrix->blockValue[n];
+	}
+	// Heterogeneous block
+	else
+	{
+		// Element indices in the block
+		int i2, j2, k2;
+		i2 = x % bs;
+		j2 = y % bs;
+		k2 = z % bs;
+		// Return element value
+		return blockData[ i2 + bs * ( j2 + bs * k2 ) ];
+	}
+}
+
+// Set matrix element (x,y,z) locking its block, safe for parallel writers
+void sparFloatSetSafe( sparFloat *matrix, int x, int y, int z, float value )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Linear block index (n) <-> (x/bs,y/bs,z/bs)
+	int n;
+	n = x / bs + matrix->mx * ( y / bs + matrix->my * ( z / bs ) );
+
+	// Acquire block lock
+	while( atomic_flag_test_and_set_explicit( &matrix->blockLock[n], memory_order_acquire ) );
+
+	// Set element, may expand or reduce the block
+	sparFloatSet( matrix, x, y, z, value );
+
+	// Release block lock
+	atomic_flag_clear_explicit( &matrix->blockLock[n], memory_order_release );
+}
+
+// Get matrix element (x,y,z) locking its block, safe with parallel writers
+float sparFloatGetSafe( sparFloat *matrix, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Linear block index (n) <-> (x/bs,y/bs,z/bs)
+	int n;
+	n = x / bs + matrix->mx * ( y / bs + matrix->my * ( z / bs ) );
+
+	// Acquire block lock
+	while( atomic_flag_test_and_set_explicit( &matrix->blockLock[n], memory_order_acquire ) );
+
+	// Get element
+	float value;
+	value = sparFloatGet( matrix, x, y, z );
+
+	// Release block lock
+	atomic_flag_clear_explicit( &matrix->blockLock[n], memory_order_release );
+
+	return value;
+}
+
+// Duplicate matrix
+sparFloat* sparFloatDuplicate( sparFloat *matrix )
+{
+	// Declare matrix and init
+	sparFloat *matrix2;
+	matrix2 = sparFloatInit( matrix->nx, matrix->ny, matrix->nz,
+						matrix->bs, matrix->def );
+
+	// Copy ring buffer origin
+	matrix2->ox = matrix->ox;
+	matrix2->oy = matrix->oy;
+	matrix2->oz = matrix->oz;
+
+	// Number of blocks
+	int blocks;
+	blocks = matrix2->mx * matrix2->my * matrix2->mz;
+
+	// Copy blocks
+	int i;
 	for( i = 0 ; i < blocks ; i++ )
 	{
-		// Heterogeneous block
-		if( matrix->blockData[i] != NULL )
+		// Heterogeneous block
+		if( matrix->blockData[i] != NULL )
+		{
+			// Allocate space for block data
+			matrix2->blockData[i] = (float*) calloc( matrix2->bs3, sizeof(float) );
+
+			if( matrix2->blockData[i] == NULL )
+			{
+			   fprintf(stderr, "sparFloatDuplicate error: Out of memory\n");
+			   exit(1);
+			}
+
+			// Copy block data
+			memcpy( matrix2->blockData[i], matrix->blockData[i], matrix2->bs3 * sizeof(float) );
+		}
+		// Uniform block
+		else
+		{
+			matrix2->blockValue[i] = matrix->blockValue[i];
+			matrix2->blockData[i] = NULL;
+		}
+	}
+
+	return matrix2;
+}
+
+// Get matrix memory usage in bytes under certain block size
+double sparFloatMemoryBs( sparFloat *matrix, int bs )
+{
+	if( bs == matrix->bs )
+	{
+		return sparFloatMemory( matrix );
+	}
+
+	// Matrix size (nx,ny,nz)
+	int nx, ny, nz;
+	nx = matrix->nx;
+	ny = matrix->ny;
+	nz = matrix->nz;
+
+	// Block size (bs,bs,bs)
+	int bs3;
+	bs3 = bs * bs * bs;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = (int)( ( nx + bs - 1 ) / bs );
+	my = (int)( ( ny + bs - 1 ) / bs );
+	mz = (int)( ( nz + bs - 1 ) / bs );
+
+	// Number of blocks
+	int blocks;
+	blocks = mx * my * mz;
+
+	// Size of matrix instance
+	double size;
+	size = (double)( sizeof(sparFloat) );
+
+	// Size of uniform block data
+	size = size + (double)( blocks * sizeof(float) );
+
+	// Size of heterogeneous block data arrays
+	size = size + (double)( blocks * sizeof(float*) );
+
+	// Size of block locks
+	size = size + (double)( blocks * sizeof(atomic_flag) );
+
+	int i, j, k;
+	int i1, j1, k1;
+	int isUniform;
+	float value;
+
+	// For each virtual block
+	for( k1 = 0 ; k1 < mz ; k1++ )
+	{
+		for( j1 = 0 ; j1 < my ; j1++ )
+		{
+			for( i1 = 0 ; i1 < mx ; i1++ )
+			{
+				// Check if block is uniform 
+				isUniform = 1;
+				value = sparFloatGet( matrix, i1 * bs, j1 * bs, k1 * bs );
+				for( k = k1 * bs ; k < ( k1 + 1 ) * bs ; k++ )
+				{
+					if( k < nz ) // Avoid outside elements
+					for( j = j1 * bs ; j < ( j1 + 1 ) * bs ; j++ )
+					{
+						if( j < ny ) // Idem
+						for( i = i1 * bs ; i < ( i1 + 1 ) * bs ; i++ )
+						{
+							if( i < nx ) // Idem
+							if( sparFloatEqual( sparFloatGet( matrix, i, j, k ), value ) == 0 )
+							{
+								isUniform = 0;
+								i = ( i1 + 1 ) * bs;
+								j = ( j1 + 1 ) * bs;
+								k = ( k1 + 1 ) * bs;
+							}
+						}
+					}
+				}
+				if( isUniform == 0 )
+				{
+					size = size + (double)( sizeof(float) * bs3 );
+				}
+			}
+		}
+	}
+
+	return size;
+}
+
+// Change matrix block size
+void sparFloatChangeBs( sparFloat *matrix, int bs )
+{
+	// Matrix size (nx,ny,nz)
+	int nx, ny, nz;
+	nx = matrix->nx;
+	ny = matrix->ny;
+	nz = matrix->nz;
+
+	// Default value
+	float def;
+	def = matrix->def;
+
+	// Declare temporal matrix and init
+	sparFloat *matrix2;
+	matrix2 = sparFloatInit( nx, ny, nz, bs, def );
+
+	// Copy values and clear original matrix
+	int i, j, k;
+	for( k=0 ; k<nz ; k++ )
+	{
+		for( j=0 ; j<ny ; j++ )
+		{
+			for( i=0 ; i<nx ; i++ )
+			{
+				// Copy element
+				sparFloatSet( matrix2, i, j, k, sparFloatGet( matrix, i, j, k ) );
+
+				// Set uniform to free memory
+				sparFloatSet( matrix, i, j, k, def);
+			}
+		}
+	}
+
+	// Set new block size and grid
+	matrix->bs  = matrix2->bs;
+	matrix->bs3 = matrix2->bs3;
+	matrix->mx  = matrix2->mx;
+	matrix->my  = matrix2->my;
+	matrix->mz  = matrix2->mz;
+
+	// Free old blocks
+	free(matrix->blockValue);
+	free(matrix->blockData);
+	free(matrix->blockLock);
+
+	// Copy new blocks
+	matrix->blockValue = matrix2->blockValue;
+	matrix->blockData = matrix2->blockData;
+	matrix->blockLock = matrix2->blockLock;
+
+	// Unlock all blocks of the new grid
+	sparFloatClearLocks( matrix );
+
+	// Free temporal matrix
+	free(matrix2);
+}
+
+// Optimize matrix block size
+void sparFloatOptimizeBs( sparFloat *matrix )
+{
+	// Test block size and store optimal
+	int bestBs;
+	double memory, bestMemory;
+	int bs[10] = { 2, 3, 4, 6, 8, 10 };
+
+	bestBs = bs[0];
+	bestMemory = sparFloatMemoryBs( matrix, bs[0] );
+
+	int i;
+	for( i=1 ; i<6 ; i++ )
+	{
+		memory = sparFloatMemoryBs( matrix, bs[i] );
+		if( memory < bestMemory )
+		{
+			bestBs = bs[i];
+			bestMemory = memory;
+		}
+	}
+
+	// Change matrix block size
+	sparFloatChangeBs( matrix, bestBs );
+}
+
+// Resize matrix
+void sparFloatResize( sparFloat *matrix, int nx, int ny, int nz )
+{
+	// Check matrix size
+	if( !( nx > 0 && ny > 0 && nz > 0 ) )
+	{
+		fprintf(stderr, "sparFloatResize error: Matrix size must be positive\n");
+		exit(1);
+	}
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Default value
+	float def;
+	def = matrix->def;
+
+	// New block grid size
+	int mx, my, mz;
+	mx = (int)( ( nx + bs - 1 ) / bs );
+	my = (int)( ( ny + bs - 1 ) / bs );
+	mz = (int)( ( nz + bs - 1 ) / bs );
+
+	// New block data
+	float *blockValue;
+	float **blockData;
+
+	int blocks;
+	blocks = mx * my * mz;
+	blockValue = (float*) calloc( blocks, sizeof(float) ); // Sets to 0s
+	blockData = (float**) calloc( blocks, sizeof(float*) ); // Sets to NULLs
+
+	if( blockValue == NULL || blockData == NULL )
+	{
+	   fprintf(stderr, "sparFloatResize error: Out of memory\n");
+	   exit(1);
+	}
+
+	int i, j, k;
+
+	// Move existing blocks, create new blocks
+	for( k = 0 ; k < mz ; k++ )
+	{
+		for( j = 0 ; j < my ; j++ )
+		{
+			for( i = 0 ; i < mx ; i++ )
+			{
+				if( i < matrix->mx && j < matrix->my && k < matrix->mz )
+				{
+					blockValue[ i + mx * ( j + my * k ) ]
+						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
+					blockData[ i + mx * ( j + my * k ) ]
+						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
+				}
+				else
+				{
+					blockValue[ i + mx * ( j + my * k ) ] = def;
+				}
+			}
+		}
+	}
+
+	// Free excedent blocks
+	for( k = 0 ; k < matrix->mz ; k++ )
+	{
+		for( j = 0 ; j < matrix->my ; j++ )
+		{
+			for( i = 0 ; i < matrix->mx ; i++ )
+			{
+				if( ( i >= mx || j >= my || k >= mz ) &&
+					matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
+				{
+					free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
+				}
+			}
+		}
+	}
+
+	// Previous matrix size
+	int ox, oy, oz;
+	ox = matrix->nx;
+	oy = matrix->ny;
+	oz = matrix->nz;
+
+	matrix->nx = nx;
+	matrix->ny = ny;
+	matrix->nz = nz;
+	matrix->mx = mx;
+	matrix->my = my;
+	matrix->mz = mz;
+
+	free(matrix->blockData);
+	free(matrix->blockValue);
+
+	matrix->blockData = blockData;
+	matrix->blockValue = blockValue;
+
+	// Set expanded elements of previous boundary blocks to default, block by block
+	if( nx > ox )
+	{
+		sparFloatFillBox( matrix, ox, 0, 0, nx - ox, ny, nz, def );
+	}
+	if( ny > oy )
+	{
+		sparFloatFillBox( matrix, 0, oy, 0, nx, ny - oy, nz, def );
+	}
+	if( nz > oz )
+	{
+		sparFloatFillBox( matrix, 0, 0, oz, nx, ny, nz - oz, def );
+	}
+
+	// Reallocate block locks for the new block grid
+	free(matrix->blockLock);
+	matrix->blockLock = (atomic_flag*) malloc( matrix->mx * matrix->my * matrix->mz * sizeof(atomic_flag) );
+
+	if( matrix->blockLock == NULL )
+	{
+	   fprintf(stderr, "sparFloatResize error: Out of memory\n");
+	   exit(1);
+	}
+
+	sparFloatClearLocks( matrix );
+}
+
+// Sum of matrix elements
+double sparFloatSum( sparFloat *matrix )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	double sum;
+	sum = 0.0;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:sum) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		float *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, value times element count
+		if( blockData == NULL )
+		{
+			sum += (double)( matrix->blockValue[n] ) * ex * ey * ez;
+		}
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
+		{
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				sum += (double)( blockData[i] );
+			}
+		}
+		// Boundary heterogeneous block, skip outside elements
+		else
+		{
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					float *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						sum += (double)( row[i] );
+					}
+				}
+			}
+		}
+	}
+
+	return sum;
+}
+
+// First matrix element in block order that is not NaN, NaN only if every element is NaN
+float sparFloatFirstNumber( sparFloat *matrix )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// For each block
+	int n;
+	for( n = 0 ; n < matrix->mx * matrix->my * matrix->mz ; n++ )
+	{
+		float *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block
+		if( blockData == NULL )
+		{
+			if( !isnan( (double) matrix->blockValue[n] ) )
+			{
+				return matrix->blockValue[n];
+			}
+			continue;
+		}
+
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % matrix->mx;
+		j1 = ( n / matrix->mx ) % matrix->my;
+		k1 = n / ( matrix->mx * matrix->my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs < bs ? matrix->nx - i1 * bs : bs;
+		ey = matrix->ny - j1 * bs < bs ? matrix->ny - j1 * bs : bs;
+		ez = matrix->nz - k1 * bs < bs ? matrix->nz - k1 * bs : bs;
+
+		// Heterogeneous block, skip outside elements
+		int i, j, k;
+		for( k = 0 ; k < ez ; k++ )
+		{
+			for( j = 0 ; j < ey ; j++ )
+			{
+				for( i = 0 ; i < ex ; i++ )
+				{
+					if( !isnan( (double) blockData[ i + bs * ( j + bs * k ) ] ) )
+					{
+						return blockData[ i + bs * ( j + bs * k ) ];
+					}
+				}
+			}
+		}
+	}
+
+	return sparFloatGet( matrix, 0, 0, 0 );
+}
+
+// Minimum matrix element, NaN elements ignored (NaN only if all are NaN)
+float sparFloatMin( sparFloat *matrix )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Start with an element that is not NaN, comparisons with NaN are false so NaN never replaces it
+	float value;
+	value = sparFloatFirstNumber( matrix );
+
+	// Every element is NaN
+	if( isnan( (double) value ) )
+	{
+		return value;
+	}
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(min:value) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		float *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block
+		if( blockData == NULL )
+		{
+			if( matrix->blockValue[n] < value )
+			{
+				value = matrix->blockValue[n];
+			}
+		}
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
+		{
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				value = blockData[i] < value ? blockData[i] : value;
+			}
+		}
+		// Boundary heterogeneous block, skip outside elements
+		else
+		{
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					float *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						value = row[i] < value ? row[i] : value;
+					}
+				}
+			}
+		}
+	}
+
+	return value;
+}
+
+// Maximum matrix element, NaN elements ignored (NaN only if all are NaN)
+float sparFloatMax( sparFloat *matrix )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Start with an element that is not NaN, comparisons with NaN are false so NaN never replaces it
+	float value;
+	value = sparFloatFirstNumber( matrix );
+
+	// Every element is NaN
+	if( isnan( (double) value ) )
+	{
+		return value;
+	}
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(max:value) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		float *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block
+		if( blockData == NULL )
+		{
+			if( matrix->blockValue[n] > value )
+			{
+				value = matrix->blockValue[n];
+			}
+		}
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
+		{
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				value = blockData[i] > value ? blockData[i] : value;
+			}
+		}
+		// Boundary heterogeneous block, skip outside elements
+		else
+		{
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					float *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						value = row[i] > value ? row[i] : value;
+					}
+				}
+			}
+		}
+	}
+
+	return value;
+}
+
+// Number of matrix elements different from the default value
+double sparFloatCount( sparFloat *matrix )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Default value
+	float def;
+	def = matrix->def;
+
+	double count;
+	count = 0.0;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:count) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		float *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, all or none of its elements
+		if( blockData == NULL )
+		{
+			if( sparFloatEqual( matrix->blockValue[n], def ) == 0 )
+			{
+				count += (double)( ex * ey * ez );
+			}
+		}
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
+		{
+			int i, c;
+			c = 0;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				c += ( sparFloatEqual( blockData[i], def ) == 0 );
+			}
+			count += (double)( c );
+		}
+		// Boundary heterogeneous block, skip outside elements
+		else
+		{
+			int i, j, k, c;
+			c = 0;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					float *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						c += ( sparFloatEqual( row[i], def ) == 0 );
+					}
+				}
+			}
+			count += (double)( c );
+		}
+	}
+
+	return count;
+}
+
+// Fold f over matrix elements from identity, f gets each uniform block once with its element count
+double sparFloatReduce( sparFloat *matrix, double (*f)( double acc, float value, int count ), double identity )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	double acc;
+	acc = identity;
+
+	// For each block, sequential so f needs no combine step
+	int n;
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		float *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, a single call for all its elements
+		if( blockData == NULL )
+		{
+			acc = f( acc, matrix->blockValue[n], ex * ey * ez );
+		}
+		// Heterogeneous block, skip outside elements
+		else
+		{
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					float *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						acc = f( acc, row[i], 1 );
+					}
+				}
+			}
+		}
+	}
+
+	return acc;
+}
+
+// Apply function f to every matrix element (and default value) in place
+void sparFloatApply( sparFloat *matrix, float (*f)( float ) )
+{
+	// Block size
+	int bs3;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		float *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, transform its value only
+		if( blockData == NULL )
+		{
+			matrix->blockValue[n] = f( matrix->blockValue[n] );
+		}
+		// Heterogeneous block, transform and reduce if possible
+		else
+		{
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				blockData[i] = f( blockData[i] );
+			}
+			sparFloatReduceBlock( matrix, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
+	}
+
+	// Keep the background consistent with transformed uniform blocks
+	matrix->def = f( matrix->def );
+}
+
+// New matrix with function f applied to every element (and default value)
+sparFloat* sparFloatMap( sparFloat *matrix, float (*f)( float ) )
+{
+	// Declare matrix and init
+	sparFloat *matrix2;
+	matrix2 = sparFloatInit( matrix->nx, matrix->ny, matrix->nz,
+						matrix->bs, f( matrix->def ) );
+
+	// Copy ring buffer origin
+	matrix2->ox = matrix->ox;
+	matrix2->oy = matrix->oy;
+	matrix2->oz = matrix->oz;
+
+	// Block size
+	int bs3;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		float *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, transform its value only
+		if( blockData == NULL )
+		{
+			matrix2->blockValue[n] = f( matrix->blockValue[n] );
+		}
+		// Heterogeneous block, transform into new block and reduce if possible
+		else
+		{
+			float *blockData2;
+			blockData2 = (float*) calloc( bs3, sizeof(float) );
+
+			if( blockData2 == NULL )
+			{
+			   fprintf(stderr, "sparFloatMap error: Out of memory\n");
+			   exit(1);
+			}
+
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				blockData2[i] = f( blockData[i] );
+			}
+			matrix2->blockData[n] = blockData2;
+			sparFloatReduceBlock( matrix2, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
+	}
+
+	return matrix2;
+}
+
+// Visit elements different from the default value, in block order
+void sparFloatForEach( sparFloat *matrix, void (*f)( int x, int y, int z, float value, void *data ), void *data )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Default value
+	float def;
+	def = matrix->def;
+
+	int i, j, k;
+	int i1, j1, k1;
+	int ex, ey, ez;
+	int n;
+
+	// For each block
+	for( k1 = 0 ; k1 < matrix->mz ; k1++ )
+	{
+		for( j1 = 0 ; j1 < matrix->my ; j1++ )
+		{
+			for( i1 = 0 ; i1 < matrix->mx ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				float *blockData;
+				blockData = matrix->blockData[n];
+
+				// Skip uniform blocks equal to the default value
+				if( blockData == NULL && sparFloatEqual( matrix->blockValue[n], def ) )
+				{
+					continue;
+				}
+
+				// Block extent inside the matrix
+				ex = matrix->nx - i1 * bs;
+				ey = matrix->ny - j1 * bs;
+				ez = matrix->nz - k1 * bs;
+				if( ex > bs ) ex = bs;
+				if( ey > bs ) ey = bs;
+				if( ez > bs ) ez = bs;
+
+				// Uniform block, every element
+				if( blockData == NULL )
+				{
+					float value;
+					value = matrix->blockValue[n];
+					for( k = 0 ; k < ez ; k++ )
+					{
+						for( j = 0 ; j < ey ; j++ )
+						{
+							for( i = 0 ; i < ex ; i++ )
+							{
+								f( i1 * bs + i, j1 * bs + j, k1 * bs + k, value, data );
+							}
+						}
+					}
+				}
+				// Heterogeneous block, non-default elements
+				else
+				{
+					for( k = 0 ; k < ez ; k++ )
+					{
+						for( j = 0 ; j < ey ; j++ )
+						{
+							float *row;
+							row = blockData + bs * ( j + bs * k );
+							for( i = 0 ; i < ex ; i++ )
+							{
+								if( sparFloatEqual( row[i], def ) == 0 )
+								{
+									f( i1 * bs + i, j1 * bs + j, k1 * bs + k, row[i], data );
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// Visit maximal runs of equal non-default elements along x, (x,y,z) to (x+n-1,y,z), merged across blocks
+void sparFloatForEachRun( sparFloat *matrix, void (*f)( int x, int y, int z, int n, float value, void *data ), void *data )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Default value
+	float def;
+	def = matrix->def;
+
+	int i, j, k;
+	int i1, j1, k1;
+	int ex, ey, ez;
+	int n;
+
+	// Current run (rx,y,z) to (rx+rn-1,y,z) of value rv
+	int rx, rn;
+	float rv;
+
+	// For each row of blocks
+	for( k1 = 0 ; k1 < matrix->mz ; k1++ )
+	{
+		for( j1 = 0 ; j1 < matrix->my ; j1++ )
+		{
+			// Block row extent inside the matrix
+			ey = matrix->ny - j1 * bs;
+			ez = matrix->nz - k1 * bs;
+			if( ey > bs ) ey = bs;
+			if( ez > bs ) ez = bs;
+
+			// For each matrix row, runs continue from one block into the next
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					rx = 0;
+					rn = 0;
+					rv = def;
+
+					for( i1 = 0 ; i1 < matrix->mx ; i1++ )
+					{
+						// Linear block index (n) <-> (i1,j1,k1)
+						n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+						ex = matrix->nx - i1 * bs;
+						if( ex > bs ) ex = bs;
+
+						float *blockData;
+						blockData = matrix->blockData[n];
+
+						// Uniform block, extend or restart the run with its whole row
+						if( blockData == NULL )
+						{
+							if( rn > 0 && sparFloatEqual( matrix->blockValue[n], rv ) )
+							{
+								rn += ex;
+							}
+							else
+							{
+								if( rn > 0 && sparFloatEqual( rv, def ) == 0 )
+								{
+									f( rx, j1 * bs + j, k1 * bs + k, rn, rv, data );
+								}
+								rx = i1 * bs;
+								rn = ex;
+								rv = matrix->blockValue[n];
+							}
+						}
+						// Heterogeneous block, element by element
+						else
+						{
+							float *row;
+							row = blockData + bs * ( j + bs * k );
+							for( i = 0 ; i < ex ; i++ )
+							{
+								if( rn > 0 && sparFloatEqual( row[i], rv ) )
+								{
+									rn++;
+								}
+								else
+								{
+									if( rn > 0 && sparFloatEqual( rv, def ) == 0 )
+									{
+										f( rx, j1 * bs + j, k1 * bs + k, rn, rv, data );
+									}
+									rx = i1 * bs + i;
+									rn = 1;
+									rv = row[i];
+								}
+							}
+						}
+					}
+
+					// End of row
+					if( rn > 0 && sparFloatEqual( rv, def ) == 0 )
+					{
+						f( rx, j1 * bs + j, k1 * bs + k, rn, rv, data );
+					}
+				}
+			}
+		}
+	}
+}
+
+// Element-wise operation between arrays, c[i] = a[i] op b[i]
+void sparFloatOpArray( float *c, float *a, float *b, int n, int op, float def )
+{
+	int i;
+	switch( op )
+	{
+		case SPAR_ADD:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] + b[i];
+			}
+			break;
+		case SPAR_SUB:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] - b[i];
+			}
+			break;
+		case SPAR_MUL:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] * b[i];
+			}
+			break;
+		case SPAR_MIN:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] < b[i] ? a[i] : b[i];
+			}
+			break;
+		case SPAR_MAX:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] > b[i] ? a[i] : b[i];
+			}
+			break;
+		case SPAR_MASK:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = b[i] != 0 ? a[i] : def;
+			}
+			break;
+		default:
+			fprintf(stderr, "sparFloatOpArray error: Unknown operation\n");
+			exit(1);
+	}
+}
+
+// Element-wise operation between array and scalar, c[i] = a[i] op value
+void sparFloatOpArrayScalar( float *c, float *a, float value, int n, int op, float def )
+{
+	int i;
+	switch( op )
+	{
+		case SPAR_ADD:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] + value;
+			}
+			break;
+		case SPAR_SUB:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] - value;
+			}
+			break;
+		case SPAR_MUL:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] * value;
+			}
+			break;
+		case SPAR_MIN:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] < value ? a[i] : value;
+			}
+			break;
+		case SPAR_MAX:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] > value ? a[i] : value;
+			}
+			break;
+		case SPAR_MASK:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = value != 0 ? a[i] : def;
+			}
+			break;
+		default:
+			fprintf(stderr, "sparFloatOpArrayScalar error: Unknown operation\n");
+			exit(1);
+	}
+}
+
+// New matrix with element-wise operation between matrices, c = a op b
+sparFloat* sparFloatOp( sparFloat *a, sparFloat *b, int op )
+{
+	// Check matrix size
+	if( a->nx != b->nx || a->ny != b->ny || a->nz != b->nz )
+	{
+		fprintf(stderr, "sparFloatOp error: Matrix sizes must agree\n");
+		exit(1);
+	}
+
+	// Check ring buffer origin, blocks are combined by storage index
+	if( a->ox != b->ox || a->oy != b->oy || a->oz != b->oz )
+	{
+		fprintf(stderr, "sparFloatOp error: Ring buffer origins must agree\n");
+		exit(1);
+	}
+
+	// Result default value
+	float def;
+	sparFloatOpArrayScalar( &def, &a->def, b->def, 1, op, a->def );
+
+	// Declare result matrix with block size of a
+	sparFloat *c;
+	c = sparFloatInit( a->nx, a->ny, a->nz, a->bs, def );
+
+	// Copy ring buffer origin of a
+	c->ox = a->ox;
+	c->oy = a->oy;
+	c->oz = a->oz;
+
+	// Block size
+	int bs, bs3;
+	bs = a->bs;
+	bs3 = a->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = a->mx;
+	my = a->my;
+	mz = a->mz;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block of b resampled on the block grid of a
+		float *buffer;
+		buffer = NULL;
+
+		if( b->bs != bs )
+		{
+			buffer = (float*) malloc( bs3 * sizeof(float) );
+
+			if( buffer == NULL )
+			{
+			   fprintf(stderr, "sparFloatOp error: Out of memory\n");
+			   exit(1);
+			}
+		}
+
+		// For each block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < mx * my * mz ; n++ )
+		{
+			// Block (i1,j1,k1) <-> (n)
+			int i1, j1, k1;
+			i1 = n % mx;
+			j1 = ( n / mx ) % my;
+			k1 = n / ( mx * my );
+
+			// Block of b, uniform (blockB == NULL) or heterogeneous
+			float *blockB, valueB;
+			if( b->bs == bs )
+			{
+				blockB = b->blockData[n];
+				valueB = b->blockValue[n];
+			}
+			else if( sparFloatUniformBox( b, i1 * bs, j1 * bs, k1 * bs, bs, bs, bs, &valueB ) )
+			{
+				blockB = NULL;
+			}
+			else
+			{
+				sparFloatGetBox( b, i1 * bs, j1 * bs, k1 * bs, bs, bs, bs, buffer );
+				blockB = buffer;
+			}
+
+			// Block of a
+			float *blockA, valueA;
+			blockA = a->blockData[n];
+			valueA = a->blockValue[n];
+
+			// Both uniform, one operation
+			if( blockA == NULL && blockB == NULL )
+			{
+				sparFloatOpArrayScalar( &c->blockValue[n], &valueA, valueB, 1, op, a->def );
+				continue;
+			}
+
+			// Heterogeneous result
+			float *blockC;
+			blockC = (float*) calloc( bs3, sizeof(float) );
+
+			if( blockC == NULL )
+			{
+			   fprintf(stderr, "sparFloatOp error: Out of memory\n");
+			   exit(1);
+			}
+
+			// Uniform b, scalar operation
+			if( blockB == NULL )
+			{
+				sparFloatOpArrayScalar( blockC, blockA, valueB, bs3, op, a->def );
+			}
+			// Uniform a, expand into result and operate in place
+			else if( blockA == NULL )
+			{
+				int i;
+				for( i = 0 ; i < bs3 ; i++ )
+				{
+					blockC[i] = valueA;
+				}
+				sparFloatOpArray( blockC, blockC, blockB, bs3, op, a->def );
+			}
+			// Both heterogeneous
+			else
+			{
+				sparFloatOpArray( blockC, blockA, blockB, bs3, op, a->def );
+			}
+
+			c->blockData[n] = blockC;
+			sparFloatReduceBlock( c, i1, j1, k1 );
+		}
+
+		free(buffer);
+	}
+
+	return c;
+}
+
+// Element-wise operation with scalar in place, matrix = matrix op value
+void sparFloatOpScalar( sparFloat *matrix, float value, int op )
+{
+	// Block size
+	int bs3;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Default value of the operation (SPAR_MASK)
+	float def;
+	def = matrix->def;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		float *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, one operation
+		if( blockData == NULL )
+		{
+			sparFloatOpArrayScalar( &matrix->blockValue[n], &matrix->blockValue[n], value, 1, op, def );
+		}
+		// Heterogeneous block, operate in place and reduce if possible
+		else
+		{
+			sparFloatOpArrayScalar( blockData, blockData, value, bs3, op, def );
+			sparFloatReduceBlock( matrix, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
+	}
+
+	// Keep the background consistent with updated uniform blocks
+	sparFloatOpArrayScalar( &matrix->def, &matrix->def, value, 1, op, def );
+}
+
+// Stencil of radius r from src into dst, f(c) reads neighbours c[i+sy*j+sz*k] with -r <= i,j,k <= r
+void sparFloatStencil( sparFloat *dst, sparFloat *src, int r, float (*f)( float *c, int r, int sy, int sz, void *data ), void *data )
+{
+	// Check matrices
+	if( dst == src )
+	{
+		fprintf(stderr, "sparFloatStencil error: Source and destination must be different\n");
+		exit(1);
+	}
+
+	if( dst->nx != src->nx || dst->ny != src->ny || dst->nz != src->nz )
+	{
+		fprintf(stderr, "sparFloatStencil error: Matrix sizes must agree\n");
+		exit(1);
+	}
+
+	if( r < 0 )
+	{
+		fprintf(stderr, "sparFloatStencil error: Radius must be non-negative\n");
+		exit(1);
+	}
+
+	// Destination block size
+	int bs, bs3;
+	bs = dst->bs;
+	bs3 = dst->bs3;
+
+	// Destination block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = dst->mx;
+	my = dst->my;
+	mz = dst->mz;
+
+	// Block plus halo size (hs,hs,hs)
+	int hs;
+	hs = bs + 2 * r;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block plus halo of the source
+		float *halo;
+		halo = (float*) malloc( hs * hs * hs * sizeof(float) );
+
+		if( halo == NULL )
+		{
+		   fprintf(stderr, "sparFloatStencil error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each destination block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < mx * my * mz ; n++ )
+		{
+			// Block (i1,j1,k1) <-> (n)
+			int i1, j1, k1;
+			i1 = n % mx;
+			j1 = ( n / mx ) % my;
+			k1 = n / ( mx * my );
+
+			// Block origin
+			int x, y, z;
+			x = i1 * bs;
+			y = j1 * bs;
+			z = k1 * bs;
+
+			// Free previous destination data
+			if( dst->blockData[n] != NULL )
+			{
+				free(dst->blockData[n]);
+				dst->blockData[n] = NULL;
+			}
+
+			// Uniform neighbourhood, uniform destination block
+			float value;
+			if( sparFloatUniformBox( src, x - r, y - r, z - r, hs, hs, hs, &value ) &&
+				( sparFloatEqual( value, src->def ) || ( x >= r && y >= r && z >= r &&
+				  x + bs + r <= src->nx && y + bs + r <= src->ny && z + bs + r <= src->nz ) ) )
+			{
+				int w, i;
+				w = 2 * r + 1;
+				for( i = 0 ; i < w * w * w ; i++ )
+				{
+					halo[i] = value;
+				}
+				dst->blockValue[n] = f( halo + r + w * ( r + w * r ), r, w, w * w, data );
+				continue;
+			}
+
+			// Read block plus halo
+			sparFloatGetBox( src, x - r, y - r, z - r, hs, hs, hs, halo );
+
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = dst->nx - x;
+			ey = dst->ny - y;
+			ez = dst->nz - z;
+			if( ex > bs ) ex = bs;
+			if( ey > bs ) ey = bs;
+			if( ez > bs ) ez = bs;
+
+			// Apply stencil
+			float *blockData;
+			blockData = (float*) calloc( bs3, sizeof(float) );
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparFloatStencil error: Out of memory\n");
+			   exit(1);
+			}
+
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					float *c;
+					c = halo + r + hs * ( ( j + r ) + hs * ( k + r ) );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						blockData[ i + bs * ( j + bs * k ) ] = f( c + i, r, hs, hs * hs, data );
+					}
+				}
+			}
+
+			// Write block and reduce if possible
+			dst->blockData[n] = blockData;
+			sparFloatReduceBlock( dst, i1, j1, k1 );
+		}
+
+		free(halo);
+	}
+}
+
+// Stencil kernel, weighted sum of the neighbourhood with data holding (2r+1)^3 weights
+float sparFloatConvolveKernel( float *c, int r, int sy, int sz, void *data )
+{
+	double *weights;
+	weights = (double*) data;
+
+	double sum;
+	sum = 0.0;
+
+	int i, j, k;
+	for( k = -r ; k <= r ; k++ )
+	{
+		for( j = -r ; j <= r ; j++ )
+		{
+			for( i = -r ; i <= r ; i++ )
+			{
+				sum += *weights++ * (double)( c[ i + sy * j + sz * k ] );
+			}
+		}
+	}
+
+	return sparFloatRound( sum );
+}
+
+// Convolution of src into dst with weights[(i+r)+(2r+1)*((j+r)+(2r+1)*(k+r))]
+void sparFloatConvolve( sparFloat *dst, sparFloat *src, int r, double *weights )
+{
+	sparFloatStencil( dst, src, r, sparFloatConvolveKernel, weights );
+}
+
+// One-dimensional filter of src into dst along axis (0 x, 1 y, 2 z) with 2r+1 weights, box (moving average) if weights is NULL
+void sparFloatFilterAxis( sparFloat *dst, sparFloat *src, int axis, int r, double *weights )
+{
+	// Check matrices
+	if( dst == src )
+	{
+		fprintf(stderr, "sparFloatFilterAxis error: Source and destination must be different\n");
+		exit(1);
+	}
+
+	if( dst->nx != src->nx || dst->ny != src->ny || dst->nz != src->nz )
+	{
+		fprintf(stderr, "sparFloatFilterAxis error: Matrix sizes must agree\n");
+		exit(1);
+	}
+
+	if( axis < 0 || axis > 2 || r < 0 )
+	{
+		fprintf(stderr, "sparFloatFilterAxis error: Invalid axis or radius\n");
+		exit(1);
+	}
+
+	// Destination block size
+	int bs, bs3;
+	bs = dst->bs;
+	bs3 = dst->bs3;
+
+	// Destination block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = dst->mx;
+	my = dst->my;
+	mz = dst->mz;
+
+	// Halo radius (rx,ry,rz) and block plus halo size (hx,hy,hz)
+	int rx, ry, rz;
+	rx = axis == 0 ? r : 0;
+	ry = axis == 1 ? r : 0;
+	rz = axis == 2 ? r : 0;
+
+	int hx, hy, hz;
+	hx = bs + 2 * rx;
+	hy = bs + 2 * ry;
+	hz = bs + 2 * rz;
+
+	// Element strides along the filter axis in the halo and in the block
+	int hstride, bstride;
+	hstride = axis == 0 ? 1 : ( axis == 1 ? hx : hx * hy );
+	bstride = axis == 0 ? 1 : ( axis == 1 ? bs : bs * bs );
+
+	// Sum of weights
+	double wsum;
+	wsum = 1.0;
+	if( weights != NULL )
+	{
+		int i;
+		wsum = 0.0;
+		for( i = 0 ; i < 2 * r + 1 ; i++ )
+		{
+			wsum += weights[i];
+		}
+
+		// Normalized kernel, keep uniform values exact
+		if( fabs( wsum - 1.0 ) < 1e-9 )
+		{
+			wsum = 1.0;
+		}
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block plus halo of the source and one line along the axis
+		float *halo;
+		double *line;
+		halo = (float*) malloc( hx * hy * hz * sizeof(float) );
+		line = (double*) malloc( ( bs + 2 * r ) * sizeof(double) );
+
+		if( halo == NULL || line == NULL )
+		{
+		   fprintf(stderr, "sparFloatFilterAxis error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each destination block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < mx * my * mz ; n++ )
+		{
+			// Block (i1,j1,k1) <-> (n)
+			int i1, j1, k1;
+			i1 = n % mx;
+			j1 = ( n / mx ) % my;
+			k1 = n / ( mx * my );
+
+			// Block origin
+			int x, y, z;
+			x = i1 * bs;
+			y = j1 * bs;
+			z = k1 * bs;
+
+			// Free previous destination data
+			if( dst->blockData[n] != NULL )
+			{
+				free(dst->blockData[n]);
+				dst->blockData[n] = NULL;
+			}
+
+			// Run of uniform blocks along the axis, uniform destination block
+			float value;
+			if( sparFloatUniformBox( src, x - rx, y - ry, z - rz, hx, hy, hz, &value ) &&
+				( sparFloatEqual( value, src->def ) || ( x >= rx && y >= ry && z >= rz &&
+				  x + bs + rx <= src->nx && y + bs + ry <= src->ny && z + bs + rz <= src->nz ) ) )
+			{
+				dst->blockValue[n] = weights == NULL || wsum == 1.0 ? value : sparFloatRound( wsum * value );
+				continue;
+			}
+
+			// Read block plus halo
+			sparFloatGetBox( src, x - rx, y - ry, z - rz, hx, hy, hz, halo );
+
+			float *blockData;
+			blockData = (float*) calloc( bs3, sizeof(float) );
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparFloatFilterAxis error: Out of memory\n");
+			   exit(1);
+			}
+
+			// For each line along the axis, (a,b) are the other two block indices
+			int a, b, i;
+			for( b = 0 ; b < bs ; b++ )
+			{
+				for( a = 0 ; a < bs ; a++ )
+				{
+					// First line element in the halo and in the block
+					float *hline, *bline;
+					if( axis == 0 )
+					{
+						hline = halo + hx * ( a + hy * b );
+						bline = blockData + bs * ( a + bs * b );
+					}
+					else if( axis == 1 )
+					{
+						hline = halo + a + hx * hy * b;
+						bline = blockData + a + bs * bs * b;
+					}
+					else
+					{
+						hline = halo + a + hx * b;
+						bline = blockData + a + bs * b;
+					}
+
+					// Gather line
+					for( i = 0 ; i < bs + 2 * r ; i++ )
+					{
+						line[i] = (double)( hline[ i * hstride ] );
+					}
+
+					// Box, sliding window sum
+					if( weights == NULL )
+					{
+						double sum;
+						sum = 0.0;
+						for( i = 0 ; i < 2 * r + 1 ; i++ )
+						{
+							sum += line[i];
+						}
+						for( i = 0 ; i < bs ; i++ )
+						{
+							bline[ i * bstride ] = sparFloatRound( sum / ( 2 * r + 1 ) );
+							if( i + 1 < bs )
+							{
+								sum += line[ i + 2 * r + 1 ] - line[i];
+							}
+						}
+					}
+					// Weighted window as offsets from the centre element, exact on constant lines
+					else
+					{
+						int w;
+						for( i = 0 ; i < bs ; i++ )
+						{
+							double sum;
+							sum = 0.0;
+							for( w = 0 ; w < 2 * r + 1 ; w++ )
+							{
+								sum += weights[w] * ( line[ i + w ] - line[ i + r ] );
+							}
+							bline[ i * bstride ] = sparFloatRound( wsum * line[ i + r ] + sum );
+						}
+					}
+				}
+			}
+
+			// Write block and reduce if possible
+			dst->blockData[n] = blockData;
+			sparFloatReduceBlock( dst, i1, j1, k1 );
+		}
+
+		free(halo);
+		free(line);
+	}
+}
+
+// Box filter (mean over (2r+1)^3 neighbourhood) of src into dst, three one-dimensional passes
+void sparFloatBoxFilter( sparFloat *dst, sparFloat *src, int r )
+{
+	// Temporal matrix for the second pass, intermediate passes see the source default value outside the matrix
+	sparFloat *tmp;
+	tmp = sparFloatInit( dst->nx, dst->ny, dst->nz, dst->bs, src->def );
+
+	float def;
+	def = dst->def;
+	dst->def = src->def;
+
+	sparFloatFilterAxis( dst, src, 0, r, NULL );
+	sparFloatFilterAxis( tmp, dst, 1, r, NULL );
+
+	dst->def = def;
+	sparFloatFilterAxis( dst, tmp, 2, r, NULL );
+
+	sparFloatFree( tmp );
+}
+
+// Gaussian filter of standard deviation sigma of src into dst, three one-dimensional passes
+void sparFloatGaussianFilter( sparFloat *dst, sparFloat *src, double sigma )
+{
+	if( !( sigma > 0.0 ) )
+	{
+		fprintf(stderr, "sparFloatGaussianFilter error: Standard deviation must be positive\n");
+		exit(1);
+	}
+
+	// Normalized kernel truncated at 3 sigma
+	int r;
+	r = (int)( ceil( 3.0 * sigma ) );
+
+	double *weights;
+	weights = (double*) malloc( ( 2 * r + 1 ) * sizeof(double) );
+
+	if( weights == NULL )
+	{
+	   fprintf(stderr, "sparFloatGaussianFilter error: Out of memory\n");
+	   exit(1);
+	}
+
+	int i;
+	double sum;
+	sum = 0.0;
+	for( i = -r ; i <= r ; i++ )
+	{
+		weights[ i + r ] = exp( -0.5 * i * i / ( sigma * sigma ) );
+		sum += weights[ i + r ];
+	}
+	for( i = 0 ; i < 2 * r + 1 ; i++ )
+	{
+		weights[i] /= sum;
+	}
+
+	// Temporal matrix for the second pass, intermediate passes see the source default value outside the matrix
+	sparFloat *tmp;
+	tmp = sparFloatInit( dst->nx, dst->ny, dst->nz, dst->bs, src->def );
+
+	float def;
+	def = dst->def;
+	dst->def = src->def;
+
+	sparFloatFilterAxis( dst, src, 0, r, weights );
+	sparFloatFilterAxis( tmp, dst, 1, r, weights );
+
+	dst->def = def;
+	sparFloatFilterAxis( dst, tmp, 2, r, weights );
+
+	sparFloatFree( tmp );
+	free(weights);
+}
+
+// Union-find root of node i with path halving (connected component labeling)
+int sparFloatLabelFind( int *parent, int i )
+{
+	while( parent[i] != i )
+	{
+		parent[i] = parent[ parent[i] ];
+		i = parent[i];
+	}
+	return i;
+}
+
+// Union-find merge of the sets of nodes i and j, the smallest node is kept as root
+void sparFloatLabelUnion( int *parent, int i, int j )
+{
+	i = sparFloatLabelFind( parent, i );
+	j = sparFloatLabelFind( parent, j );
+	if( i < j )
+	{
+		parent[j] = i;
+	}
+	else if( j < i )
+	{
+		parent[i] = j;
+	}
+}
+
+// Union-find node of element (x,y,z), -1 for elements equal to the default value
+int sparFloatLabelNode( sparFloat *matrix, int *offset, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Linear block index (n) <-> (x/bs,y/bs,z/bs)
+	int n;
+	n = x / bs + matrix->mx * ( y / bs + matrix->my * ( z / bs ) );
+
+	// Uniform block, one node or none
+	if( matrix->blockData[n] == NULL )
+	{
+		return offset[n];
+	}
+
+	// Heterogeneous block, one node per element
+	int i;
+	i = x % bs + bs * ( y % bs + bs * ( z % bs ) );
+	if( sparFloatEqual( matrix->blockData[n][i], matrix->def ) )
+	{
+		return -1;
+	}
+	return offset[n] + i;
+}
+
+// Connect block (x,y,z) with its neighbour block across the lower face along axis (0 x, 1 y, 2 z)
+void sparFloatLabelFace( sparFloat *matrix, int *offset, int *parent, int x, int y, int z, int axis )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Neighbour block
+	int x2, y2, z2;
+	x2 = x - ( axis == 0 );
+	y2 = y - ( axis == 1 );
+	z2 = z - ( axis == 2 );
+
+	// Linear block indices
+	int n, n2;
+	n = x + matrix->mx * ( y + matrix->my * z );
+	n2 = x2 + matrix->mx * ( y2 + matrix->my * z2 );
+
+	// Any default uniform block, nothing to connect
+	if( offset[n] < 0 || offset[n2] < 0 )
+	{
+		return;
+	}
+
+	// Both uniform, one connection
+	if( matrix->blockData[n] == NULL && matrix->blockData[n2] == NULL )
+	{
+		sparFloatLabelUnion( parent, offset[n], offset[n2] );
+		return;
+	}
+
+	// Block extent inside the matrix
+	int ex, ey, ez;
+	ex = matrix->nx - x * bs;
+	ey = matrix->ny - y * bs;
+	ez = matrix->nz - z * bs;
+	if( ex > bs ) ex = bs;
+	if( ey > bs ) ey = bs;
+	if( ez > bs ) ez = bs;
+
+	// Face elements
+	int a, b, na, nb;
+	na = axis == 0 ? ey : ex;
+	nb = axis == 2 ? ey : ez;
+	for( b = 0 ; b < nb ; b++ )
+	{
+		for( a = 0 ; a < na ; a++ )
+		{
+			// Element (i,j,k) on the face and its neighbour
+			int i, j, k, node, node2;
+			i = x * bs + ( axis == 0 ? 0 : a );
+			j = y * bs + ( axis == 0 ? a : ( axis == 1 ? 0 : b ) );
+			k = z * bs + ( axis == 2 ? 0 : b );
+
+			node = sparFloatLabelNode( matrix, offset, i, j, k );
+			if( node < 0 )
+			{
+				continue;
+			}
+			node2 = sparFloatLabelNode( matrix, offset, i - ( axis == 0 ), j - ( axis == 1 ), k - ( axis == 2 ) );
+			if( node2 < 0 )
+			{
+				continue;
+			}
+			sparFloatLabelUnion( parent, node, node2 );
+		}
+	}
+}
+
+// Connect elements inside heterogeneous block (x,y,z)
+void sparFloatLabelBlock( sparFloat *matrix, int *offset, int *parent, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Linear block index (n) <-> (x,y,z)
+	int n;
+	n = x + matrix->mx * ( y + matrix->my * z );
+
+	float *blockData;
+	blockData = matrix->blockData[n];
+
+	// Uniform block is a single node
+	if( blockData == NULL )
+	{
+		return;
+	}
+
+	// Block extent inside the matrix
+	int ex, ey, ez;
+	ex = matrix->nx - x * bs;
+	ey = matrix->ny - y * bs;
+	ez = matrix->nz - z * bs;
+	if( ex > bs ) ex = bs;
+	if( ey > bs ) ey = bs;
+	if( ez > bs ) ez = bs;
+
+	// Connect each non-default element with its lower neighbours
+	float def;
+	def = matrix->def;
+
+	int i, j, k, e;
+	for( k = 0 ; k < ez ; k++ )
+	{
+		for( j = 0 ; j < ey ; j++ )
+		{
+			for( i = 0 ; i < ex ; i++ )
+			{
+				e = i + bs * ( j + bs * k );
+				if( sparFloatEqual( blockData[e], def ) )
+				{
+					continue;
+				}
+				if( i > 0 && sparFloatEqual( blockData[ e - 1 ], def ) == 0 )
+				{
+					sparFloatLabelUnion( parent, offset[n] + e, offset[n] + e - 1 );
+				}
+				if( j > 0 && sparFloatEqual( blockData[ e - bs ], def ) == 0 )
+				{
+					sparFloatLabelUnion( parent, offset[n] + e, offset[n] + e - bs );
+				}
+				if( k > 0 && sparFloatEqual( blockData[ e - bs * bs ], def ) == 0 )
+				{
+					sparFloatLabelUnion( parent, offset[n] + e, offset[n] + e - bs * bs );
+				}
+			}
+		}
+	}
+}
+
+// Label 6-connected regions of non-default elements into labels (0 elsewhere), return number of regions
+int sparFloatLabel( sparFloat *matrix, sparInt *labels )
+{
+	// Check matrices
+	if( labels->nx != matrix->nx || labels->ny != matrix->ny || labels->nz != matrix->nz ||
+		labels->bs != matrix->bs )
+	{
+		fprintf(stderr, "sparFloatLabel error: Matrix and block sizes must agree\n");
+		exit(1);
+	}
+
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Number of blocks
+	int blocks;
+	blocks = mx * my * mz;
+
+	// First node of each block: one for non-default uniform blocks, one per element for heterogeneous blocks
+	int *offset;
+	offset = (int*) malloc( blocks * sizeof(int) );
+
+	if( offset == NULL )
+	{
+	   fprintf(stderr, "sparFloatLabel error: Out of memory\n");
+	   exit(1);
+	}
+
+	double nodes;
+	nodes = 0.0;
+
+	int n;
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		if( matrix->blockData[n] != NULL )
+		{
+			offset[n] = (int)( nodes );
+			nodes += bs3;
+		}
+		else if( sparFloatEqual( matrix->blockValue[n], matrix->def ) == 0 )
+		{
+			offset[n] = (int)( nodes );
+			nodes += 1;
+		}
+		else
+		{
+			offset[n] = -1;
+		}
+	}
+
+	if( nodes > INT_MAX )
+	{
+		fprintf(stderr, "sparFloatLabel error: Too many heterogeneous blocks\n");
+		exit(1);
+	}
+
+	// Union-find forest, -1 for unused nodes of default elements
+	int *parent;
+	parent = (int*) malloc( ( (int)( nodes ) + 1 ) * sizeof(int) );
+
+	if( parent == NULL )
+	{
+	   fprintf(stderr, "sparFloatLabel error: Out of memory\n");
+	   exit(1);
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		if( offset[n] < 0 )
+		{
+			continue;
+		}
+
+		float *blockData;
+		blockData = matrix->blockData[n];
+
+		if( blockData == NULL )
+		{
+			parent[ offset[n] ] = offset[n];
+			continue;
+		}
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - ( n % mx ) * bs;
+		ey = matrix->ny - ( ( n / mx ) % my ) * bs;
+		ez = matrix->nz - ( n / ( mx * my ) ) * bs;
+
+		int i, j, k, e;
+		for( k = 0 ; k < bs ; k++ )
+		{
+			for( j = 0 ; j < bs ; j++ )
+			{
+				for( i = 0 ; i < bs ; i++ )
+				{
+					e = i + bs * ( j + bs * k );
+					if( i < ex && j < ey && k < ez && sparFloatEqual( blockData[e], matrix->def ) == 0 )
+					{
+						parent[ offset[n] + e ] = offset[n] + e;
+					}
+					else
+					{
+						parent[ offset[n] + e ] = -1;
+					}
+				}
+			}
+		}
+	}
+
+	// Connect blocks within slabs of block layers in parallel, slabs hold disjoint node ranges
+	int slab, slabs;
+	slab = 8;
+	slabs = ( mz + slab - 1 ) / slab;
+
+	int s;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(dynamic)
+	#endif
+	for( s = 0 ; s < slabs ; s++ )
+	{
+		int i1, j1, k1;
+		for( k1 = s * slab ; k1 < ( s + 1 ) * slab && k1 < mz ; k1++ )
+		{
+			for( j1 = 0 ; j1 < my ; j1++ )
+			{
+				for( i1 = 0 ; i1 < mx ; i1++ )
+				{
+					sparFloatLabelBlock( matrix, offset, parent, i1, j1, k1 );
+					if( i1 > 0 )
+					{
+						sparFloatLabelFace( matrix, offset, parent, i1, j1, k1, 0 );
+					}
+					if( j1 > 0 )
+					{
+						sparFloatLabelFace( matrix, offset, parent, i1, j1, k1, 1 );
+					}
+					if( k1 > s * slab )
+					{
+						sparFloatLabelFace( matrix, offset, parent, i1, j1, k1, 2 );
+					}
+				}
+			}
+		}
+	}
+
+	// Merge slabs across their boundary layers
+	int i1, j1;
+	for( s = 1 ; s < slabs ; s++ )
+	{
+		for( j1 = 0 ; j1 < my ; j1++ )
+		{
+			for( i1 = 0 ; i1 < mx ; i1++ )
+			{
+				sparFloatLabelFace( matrix, offset, parent, i1, j1, s * slab, 2 );
+			}
+		}
+	}
+
+	// Consecutive labels from 1, roots are the smallest node of each set and parents precede children
+	int count;
+	count = 0;
+
+	int i;
+	for( i = 0 ; i < (int)( nodes ) ; i++ )
+	{
+		if( parent[i] == i )
+		{
+			parent[i] = ++count;
+		}
+		else if( parent[i] >= 0 )
+		{
+			parent[i] = parent[ parent[i] ];
+		}
+	}
+
+	// Write labels
+	labels->def = 0;
+
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		// Free previous labels
+		if( labels->blockData[n] != NULL )
+		{
+			free(labels->blockData[n]);
+			labels->blockData[n] = NULL;
+		}
+
+		// Default uniform block
+		if( offset[n] < 0 )
+		{
+			labels->blockValue[n] = 0;
+		}
+		// Non-default uniform block
+		else if( matrix->blockData[n] == NULL )
+		{
+			labels->blockValue[n] = parent[ offset[n] ];
+		}
+		// Heterogeneous block
+		else
+		{
+			int *blockData;
+			blockData = (int*) calloc( bs3, sizeof(int) );
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparFloatLabel error: Out of memory\n");
+			   exit(1);
+			}
+
+			int e;
+			for( e = 0 ; e < bs3 ; e++ )
+			{
+				blockData[e] = parent[ offset[n] + e ] < 0 ? 0 : parent[ offset[n] + e ];
+			}
+
+			labels->blockData[n] = blockData;
+			sparIntReduceBlock( labels, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
+	}
+
+	free(offset);
+	free(parent);
+
+	return count;
+}
+
+// Squared distance transform of sampled function f into d (Felzenszwalb), v and z hold n and n+1 elements
+void sparFloatDistanceLine( double *f, double *d, int n, int *v, double *z )
+{
+	int q, k;
+	double s;
+
+	// Lower envelope of parabolas rooted at (q,f[q])
+	k = 0;
+	v[0] = 0;
+	z[0] = -HUGE_VAL;
+	z[1] = HUGE_VAL;
+	for( q = 1 ; q < n ; q++ )
+	{
+		s = ( ( f[q] + (double)q * q ) - ( f[ v[k] ] + (double)v[k] * v[k] ) ) / ( 2.0 * ( q - v[k] ) );
+		while( s <= z[k] )
+		{
+			k--;
+			s = ( ( f[q] + (double)q * q ) - ( f[ v[k] ] + (double)v[k] * v[k] ) ) / ( 2.0 * ( q - v[k] ) );
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[ k + 1 ] = HUGE_VAL;
+	}
+
+	// Sample the envelope
+	k = 0;
+	for( q = 0 ; q < n ; q++ )
+	{
+		while( z[ k + 1 ] < q )
+		{
+			k++;
+		}
+		d[q] = (double)( q - v[k] ) * ( q - v[k] ) + f[ v[k] ];
+	}
+}
+
+// Squared distance pass along axis (0 x, 1 y, 2 z) in place, or from features of matrix if not NULL (default elements if inside)
+void sparFloatDistanceAxis( sparFloat *matrix, sparFloat *distance, int axis, float big, int inside )
+{
+	// Distance block size
+	int bs;
+	bs = distance->bs;
+
+	// Line length and number of block rows along the other two axes
+	int nl, ma, mb;
+	nl = axis == 0 ? distance->nx : ( axis == 1 ? distance->ny : distance->nz );
+	ma = axis == 0 ? distance->my : distance->mx;
+	mb = axis == 2 ? distance->my : distance->mz;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Row of blocks and one line
+		float *box;
+		float *source;
+		double *f, *d, *z;
+		int *v;
+		box = (float*) malloc( nl * bs * bs * sizeof(float) );
+		source = (float*) malloc( nl * bs * bs * sizeof(float) );
+		f = (double*) malloc( nl * sizeof(double) );
+		d = (double*) malloc( nl * sizeof(double) );
+		z = (double*) malloc( ( nl + 1 ) * sizeof(double) );
+		v = (int*) malloc( nl * sizeof(int) );
+
+		if( box == NULL || source == NULL || f == NULL || d == NULL || z == NULL || v == NULL )
+		{
+		   fprintf(stderr, "sparFloatDistanceAxis error: Out of memory\n");
+		   exit(1);
+		}
+
+		// For each row of blocks along the axis, lines are independent
+		int g;
+		#ifdef _OPENMP
+		#pragma omp for schedule(dynamic)
+		#endif
+		for( g = 0 ; g < ma * mb ; g++ )
+		{
+			// Box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) inside the matrix
+			int x, y, zz, sx, sy, sz;
+			x = axis == 0 ? 0 : ( g % ma ) * bs;
+			y = axis == 1 ? 0 : ( axis == 0 ? ( g % ma ) * bs : ( g / ma ) * bs );
+			zz = axis == 2 ? 0 : ( g / ma ) * bs;
+			sx = axis == 0 ? distance->nx : ( distance->nx - x < bs ? distance->nx - x : bs );
+			sy = axis == 1 ? distance->ny : ( distance->ny - y < bs ? distance->ny - y : bs );
+			sz = axis == 2 ? distance->nz : ( distance->nz - zz < bs ? distance->nz - zz : bs );
+
+			int i;
+
+			// First pass, features of matrix
+			if( matrix != NULL )
+			{
+				float value;
+				if( sparFloatUniformBox( matrix, x, y, zz, sx, sy, sz, &value ) )
+				{
+					sparFloatFillBox( distance, x, y, zz, sx, sy, sz,
+									  ( ( sparFloatEqual( value, matrix->def ) == 0 ) != inside ) ? 0.0f : big );
+					continue;
+				}
+				sparFloatGetBox( matrix, x, y, zz, sx, sy, sz, source );
+				for( i = 0 ; i < sx * sy * sz ; i++ )
+				{
+					box[i] = ( ( sparFloatEqual( source[i], matrix->def ) == 0 ) != inside ) ? 0.0f : big;
+				}
+			}
+			// Next passes, constant lines are left unchanged
+			else
+			{
+				float value;
+				if( sparFloatUniformBox( distance, x, y, zz, sx, sy, sz, &value ) )
+				{
+					continue;
+				}
+				sparFloatGetBox( distance, x, y, zz, sx, sy, sz, box );
+			}
+
+			// Line stride and number of lines
+			int stride, lines;
+			stride = axis == 0 ? 1 : ( axis == 1 ? sx : sx * sy );
+			lines = sx * sy * sz / nl;
+
+			// For each line
+			int l;
+			for( l = 0 ; l < lines ; l++ )
+			{
+				// First line element
+				float *line;
+				if( axis == 0 )
+				{
+					line = box + nl * l;
+				}
+				else if( axis == 1 )
+				{
+					line = box + ( l % sx ) + sx * sy * ( l / sx );
+				}
+				else
+				{
+					line = box + l;
+				}
+
+				for( i = 0 ; i < nl ; i++ )
+				{
+					f[i] = line[ i * stride ];
+				}
+
+				sparFloatDistanceLine( f, d, nl, v, z );
+
+				// Clamp at big
+				for( i = 0 ; i < nl ; i++ )
+				{
+					line[ i * stride ] = d[i] < big ? (float)( d[i] ) : big;
+				}
+			}
+
+			sparFloatSetBox( distance, x, y, zz, sx, sy, sz, box );
+		}
+
+		free(box);
+		free(source);
+		free(f);
+		free(d);
+		free(z);
+		free(v);
+	}
+}
+
+// Euclidean distance from each element to the nearest non-default element clamped at maxDistance, negative inside if sign
+void sparFloatDistance( sparFloat *matrix, sparFloat *distance, float maxDistance, int sign )
+{
+	// Check matrices
+	if( distance->nx != matrix->nx || distance->ny != matrix->ny || distance->nz != matrix->nz )
+	{
+		fprintf(stderr, "sparFloatDistance error: Matrix sizes must agree\n");
+		exit(1);
+	}
+
+	if( !( maxDistance > 0.0f ) )
+	{
+		fprintf(stderr, "sparFloatDistance error: Maximum distance must be positive\n");
+		exit(1);
+	}
+
+	// Squared distances are clamped, far regions become uniform
+	float big;
+	big = maxDistance * maxDistance;
+
+	// Squared distance to non-default elements
+	sparFloatDistanceAxis( matrix, distance, 0, big, 0 );
+	sparFloatDistanceAxis( NULL, distance, 1, big, 0 );
+	sparFloatDistanceAxis( NULL, distance, 2, big, 0 );
+
+	// Squared distance to default elements
+	sparFloat *inner;
+	inner = NULL;
+	if( sign )
+	{
+		inner = sparFloatInit( distance->nx, distance->ny, distance->nz, distance->bs, big );
+		sparFloatDistanceAxis( matrix, inner, 0, big, 1 );
+		sparFloatDistanceAxis( NULL, inner, 1, big, 1 );
+		sparFloatDistanceAxis( NULL, inner, 2, big, 1 );
+	}
+
+	// Distance, outer minus inner if signed
+	int mx, my, mz;
+	mx = distance->mx;
+	my = distance->my;
+	mz = distance->mz;
+
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		float *blockData, *innerData, innerValue;
+		blockData = distance->blockData[n];
+		innerData = inner == NULL ? NULL : inner->blockData[n];
+		innerValue = inner == NULL ? 0.0f : inner->blockValue[n];
+
+		// Uniform blocks
+		if( blockData == NULL && innerData == NULL )
+		{
+			distance->blockValue[n] = sqrtf( distance->blockValue[n] ) - sqrtf( innerValue );
+			continue;
+		}
+
+		// Heterogeneous blocks
+		sparFloatExpandBlock( distance, i1, j1, k1 );
+		blockData = distance->blockData[n];
+
+		int i;
+		for( i = 0 ; i < distance->bs3 ; i++ )
+		{
+			blockData[i] = sqrtf( blockData[i] ) - sqrtf( innerData == NULL ? innerValue : innerData[i] );
+		}
+
+		sparFloatReduceBlock( distance, i1, j1, k1 );
+	}
+
+	distance->def = maxDistance;
+
+	if( inner != NULL )
+	{
+		sparFloatFree( inner );
+	}
+}
+
+// Cast ray o+t*d (element (x,y,z) spans [x,x+1)) for 0 <= t <= tmax, return 1 with first non-default element hit[3] at t
+int sparFloatRay( sparFloat *matrix, double *o, double *d, double tmax, int *hit, double *t )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Matrix size
+	int size[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+
+	// Clip ray to the matrix bounds
+	double t0, t1;
+	t0 = 0.0;
+	t1 = tmax;
+
+	int a;
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		if( d[a] == 0.0 )
+		{
+			if( o[a] < 0.0 || o[a] >= size[a] )
+			{
+				return 0;
+			}
+		}
+		else
+		{
+			double ta, tb;
+			ta = ( 0.0 - o[a] ) / d[a];
+			tb = ( size[a] - o[a] ) / d[a];
+			if( ta > tb )
+			{
+				double tc;
+				tc = ta;
+				ta = tb;
+				tb = tc;
+			}
+			t0 = ta > t0 ? ta : t0;
+			t1 = tb < t1 ? tb : t1;
+		}
+	}
+
+	if( t0 > t1 )
+	{
+		return 0;
+	}
+
+	// Entry element, step direction, next element boundary and boundary spacing per axis
+	int v[3], step[3];
+	double tnext[3], tdelta[3];
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		v[a] = (int)( floor( o[a] + t0 * d[a] ) );
+		v[a] = v[a] < 0 ? 0 : ( v[a] >= size[a] ? size[a] - 1 : v[a] );
+		step[a] = d[a] > 0.0 ? 1 : -1;
+		tdelta[a] = d[a] == 0.0 ? HUGE_VAL : fabs( 1.0 / d[a] );
+		tnext[a] = d[a] == 0.0 ? HUGE_VAL : ( v[a] + ( step[a] > 0 ) - o[a] ) / d[a];
+	}
+
+	double tc;
+	tc = t0;
+
+	while( tc <= t1 )
+	{
+		// Linear block index (n) of element v
+		int b[3], n;
+		b[0] = v[0] / bs;
+		b[1] = v[1] / bs;
+		b[2] = v[2] / bs;
+		n = b[0] + matrix->mx * ( b[1] + matrix->my * b[2] );
+
+		// Uniform block
+		if( matrix->blockData[n] == NULL )
+		{
+			// Hit on entry
+			if( sparFloatEqual( matrix->blockValue[n], matrix->def ) == 0 )
+			{
+				break;
+			}
+
+			// Skip to the block exit
+			int amin;
+			double tb[3];
+			amin = 0;
+			for( a = 0 ; a < 3 ; a++ )
+			{
+				tb[a] = d[a] == 0.0 ? HUGE_VAL : ( ( b[a] + ( step[a] > 0 ) ) * bs - o[a] ) / d[a];
+				if( tb[a] < tb[amin] )
+				{
+					amin = a;
+				}
+			}
+			tc = tb[amin];
+
+			// Element of the next block, stay inside the current block on the other axes
+			for( a = 0 ; a < 3 ; a++ )
+			{
+				if( a == amin )
+				{
+					v[a] = step[a] > 0 ? ( b[a] + 1 ) * bs : b[a] * bs - 1;
+				}
+				else
+				{
+					v[a] = (int)( floor( o[a] + tc * d[a] ) );
+					v[a] = v[a] < b[a] * bs ? b[a] * bs : ( v[a] >= ( b[a] + 1 ) * bs ? ( b[a] + 1 ) * bs - 1 : v[a] );
+				}
+				tnext[a] = d[a] == 0.0 ? HUGE_VAL : ( v[a] + ( step[a] > 0 ) - o[a] ) / d[a];
+			}
+		}
+		// Heterogeneous block, element by element
+		else
+		{
+			// Hit
+			int i;
+			i = v[0] % bs + bs * ( v[1] % bs + bs * ( v[2] % bs ) );
+			if( sparFloatEqual( matrix->blockData[n][i], matrix->def ) == 0 )
+			{
+				break;
+			}
+
+			// Step to the next element
+			int amin;
+			amin = 0;
+			for( a = 1 ; a < 3 ; a++ )
+			{
+				if( tnext[a] < tnext[amin] )
+				{
+					amin = a;
+				}
+			}
+			tc = tnext[amin];
+			v[amin] += step[amin];
+			tnext[amin] += tdelta[amin];
+		}
+
+		// Left the matrix
+		if( v[0] < 0 || v[1] < 0 || v[2] < 0 || v[0] >= size[0] || v[1] >= size[1] || v[2] >= size[2] )
+		{
+			return 0;
+		}
+	}
+
+	// Beyond tmax or matrix exit
+	if( tc > t1 )
+	{
+		return 0;
+	}
+
+	hit[0] = v[0];
+	hit[1] = v[1];
+	hit[2] = v[2];
+	*t = tc;
+
+	return 1;
+}
+
+// Cast n rays o[3*i]+t*d[3*i] in parallel, hits[3*i] and t[i] (-1 if missed), return number of hits
+int sparFloatRays( sparFloat *matrix, int n, double *o, double *d, double tmax, int *hits, double *t )
+{
+	int count;
+	count = 0;
+
+	int i;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:count) schedule(guided)
+	#endif
+	for( i = 0 ; i < n ; i++ )
+	{
+		if( sparFloatRay( matrix, o + 3 * i, d + 3 * i, tmax, hits + 3 * i, t + i ) )
+		{
+			count++;
+		}
+		else
+		{
+			t[i] = -1.0;
+		}
+	}
+
+	return count;
+}
+
+// Copy plane at index along axis into buffer, YZ (axis 0) y+ny*z, XZ (axis 1) x+nx*z, XY (axis 2) x+nx*y
+void sparFloatSlice( sparFloat *matrix, int axis, int index, float *buffer )
+{
+	// Matrix size
+	int nx, ny, nz;
+	nx = matrix->nx;
+	ny = matrix->ny;
+	nz = matrix->nz;
+
+	// Check plane
+	if( axis < 0 || axis > 2 || index < 0 ||
+		index >= ( axis == 0 ? nx : ( axis == 1 ? ny : nz ) ) )
+	{
+		fprintf(stderr, "sparFloatSlice error: Plane outside the matrix\n");
+		exit(1);
+	}
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Block layer and element layer in the block
+	int b1, b2;
+	b1 = index / bs;
+	b2 = index % bs;
+
+	// XY plane, contiguous block rows
+	if( axis == 2 )
+	{
+		int j1;
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(guided)
+		#endif
+		for( j1 = 0 ; j1 < my ; j1++ )
+		{
+			int i1, i, j, ex, ey, n;
+			ey = ny - j1 * bs < bs ? ny - j1 * bs : bs;
+			for( i1 = 0 ; i1 < mx ; i1++ )
+			{
+				ex = nx - i1 * bs < bs ? nx - i1 * bs : bs;
+				n = i1 + mx * ( j1 + my * b1 );
+				for( j = 0 ; j < ey ; j++ )
+				{
+					float *row;
+					row = buffer + i1 * bs + nx * ( j1 * bs + j );
+
+					// Uniform block
+					if( matrix->blockData[n] == NULL )
+					{
+						for( i = 0 ; i < ex ; i++ )
+						{
+							row[i] = matrix->blockValue[n];
+						}
+					}
+					// Heterogeneous block
+					else
+					{
+						memcpy( row, matrix->blockData[n] + bs * ( j + bs * b2 ), ex * sizeof(float) );
+					}
+				}
+			}
+		}
+	}
+	// XZ plane, contiguous block rows
+	else if( axis == 1 )
+	{
+		int k1;
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(guided)
+		#endif
+		for( k1 = 0 ; k1 < mz ; k1++ )
+		{
+			int i1, i, k, ex, ez, n;
+			ez = nz - k1 * bs < bs ? nz - k1 * bs : bs;
+			for( i1 = 0 ; i1 < mx ; i1++ )
+			{
+				ex = nx - i1 * bs < bs ? nx - i1 * bs : bs;
+				n = i1 + mx * ( b1 + my * k1 );
+				for( k = 0 ; k < ez ; k++ )
+				{
+					float *row;
+					row = buffer + i1 * bs + nx * ( k1 * bs + k );
+
+					// Uniform block
+					if( matrix->blockData[n] == NULL )
+					{
+						for( i = 0 ; i < ex ; i++ )
+						{
+							row[i] = matrix->blockValue[n];
+						}
+					}
+					// Heterogeneous block
+					else
+					{
+						memcpy( row, matrix->blockData[n] + bs * ( b2 + bs * k ), ex * sizeof(float) );
+					}
+				}
+			}
+		}
+	}
+	// YZ plane, block elements are strided by bs
+	else
+	{
+		int k1;
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(guided)
+		#endif
+		for( k1 = 0 ; k1 < mz ; k1++ )
 		{
-			free( matrix->blockData[i] );
-			matrix->blockData[i] = NULL;
+			int j1, j, k, ey, ez, n;
+			ez = nz - k1 * bs < bs ? nz - k1 * bs : bs;
+			for( j1 = 0 ; j1 < my ; j1++ )
+			{
+				ey = ny - j1 * bs < bs ? ny - j1 * bs : bs;
+				n = b1 + mx * ( j1 + my * k1 );
+				for( k = 0 ; k < ez ; k++ )
+				{
+					float *row;
+					row = buffer + j1 * bs + ny * ( k1 * bs + k );
+
+					// Uniform block
+					if( matrix->blockData[n] == NULL )
+					{
+						for( j = 0 ; j < ey ; j++ )
+						{
+							row[j] = matrix->blockValue[n];
+						}
+					}
+					// Heterogeneous block, gather column of the block
+					else
+					{
+						float *column;
+						column = matrix->blockData[n] + b2 + bs * bs * k;
+						for( j = 0 ; j < ey ; j++ )
+						{
+							row[j] = column[ bs * j ];
+						}
+					}
+				}
+			}
 		}
-		matrix->blockValue[i] = matrix->def;
 	}
 }
 
-// Get matrix memory usage in bytes
-double sparIntMemory( sparInt *matrix )
+// Accumulate value, repeated count times, into o[0..n-1] with op (projection kernel)
+void sparFloatProjectValue( double *o, int n, float value, int count, int op, float def )
 {
-	// Number of blocks
-	int blocks;
-	blocks = matrix->mx * matrix->my * matrix->mz;
-
-	// Matrix instance
-	double size;
-	size = (double)( sizeof(sparInt) );
-
-	// Uniform block data
-	size = size + (double)( blocks * sizeof(int) );
-
-	// Heterogeneous block data arrays
-	size = size + (double)( blocks * sizeof(int*) );
+	int i;
+	switch( op )
+	{
+		case SPAR_ADD:
+			for( i = 0 ; i < n ; i++ )
+			{
+				o[i] += (double)( value ) * count;
+			}
+			break;
+		case SPAR_MIN:
+			for( i = 0 ; i < n ; i++ )
+			{
+				o[i] = value < o[i] ? value : o[i];
+			}
+			break;
+		case SPAR_MAX:
+			for( i = 0 ; i < n ; i++ )
+			{
+				o[i] = value > o[i] ? value : o[i];
+			}
+			break;
+		case SPAR_COUNT:
+			if( sparFloatEqual( value, def ) == 0 )
+			{
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] += count;
+				}
+			}
+			break;
+	}
+}
 
-	// Heterogeneous block data
+// Accumulate row[0..n-1] into o[0..n-1], or into o[0] if reduce, with op (projection kernel)
+void sparFloatProjectRow( double *o, float *row, int n, int op, int reduce, float def )
+{
 	int i;
-	for( i = 0 ; i < blocks ; i++ )
+
+	// Row along the projection axis
+	if( reduce )
 	{
-		// Heterogeneous block
-		if( matrix->blockData[i] != NULL )
+		double value;
+		value = o[0];
+		switch( op )
 		{
-			size = size + (double)( sizeof(int) * matrix->bs3 );
+			case SPAR_ADD:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value += row[i];
+				}
+				break;
+			case SPAR_MIN:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value = row[i] < value ? row[i] : value;
+				}
+				break;
+			case SPAR_MAX:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value = row[i] > value ? row[i] : value;
+				}
+				break;
+			case SPAR_COUNT:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value += ( sparFloatEqual( row[i], def ) == 0 );
+				}
+				break;
+		}
+		o[0] = value;
+	}
+	// Row across the projection axis
+	else
+	{
+		switch( op )
+		{
+			case SPAR_ADD:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] += row[i];
+				}
+				break;
+			case SPAR_MIN:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] = row[i] < o[i] ? row[i] : o[i];
+				}
+				break;
+			case SPAR_MAX:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] = row[i] > o[i] ? row[i] : o[i];
+				}
+				break;
+			case SPAR_COUNT:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] += ( sparFloatEqual( row[i], def ) == 0 );
+				}
+				break;
 		}
 	}
-
-	return size;
 }
 
-// Check if block is uniform
-int sparIntUniformBlock( sparInt *matrix, int x, int y, int z )
+// Project along axis with op (SPAR_ADD, SPAR_MIN, SPAR_MAX, SPAR_COUNT) into dense plane, same layout as slices
+void sparFloatProject( sparFloat *matrix, int axis, int op, double *buffer )
 {
+	// Check axis and operation
+	if( axis < 0 || axis > 2 )
+	{
+		fprintf(stderr, "sparFloatProject error: Invalid axis\n");
+		exit(1);
+	}
+
+	if( op != SPAR_ADD && op != SPAR_MIN && op != SPAR_MAX && op != SPAR_COUNT )
+	{
+		fprintf(stderr, "sparFloatProject error: Unknown operation\n");
+		exit(1);
+	}
+
 	// Block size
-	int bs, bs3;
+	int bs;
 	bs = matrix->bs;
-	bs3 = matrix->bs3;
 
-	// Block matrix size (mx,my,mz)
-	int mx, my, mz;
-	mx = matrix->mx;
-	my = matrix->my;
-	mz = matrix->mz;
-
-	// Linear block index (n) <-> (x,y,z)
-	int n;
-	n = x + mx * ( y + my * z );
+	// Matrix size (nx,ny,nz)
+	int nx, ny, nz;
+	nx = matrix->nx;
+	ny = matrix->ny;
+	nz = matrix->nz;
 
-	// Block data array
-	int *blockData;
-	blockData = matrix->blockData[n];
+	// Plane size (pa,pb), plane and axis block sizes (ma,mb,mc)
+	int pa, pb, ma, mb, mc;
+	pa = axis == 0 ? ny : nx;
+	pb = axis == 2 ? ny : nz;
+	ma = axis == 0 ? matrix->my : matrix->mx;
+	mb = axis == 2 ? matrix->my : matrix->mz;
+	mc = axis == 0 ? matrix->mx : ( axis == 1 ? matrix->my : matrix->mz );
 
-	// Uniform block
-	if( blockData == NULL )
+	// Initial values
+	int i;
+	for( i = 0 ; i < pa * pb ; i++ )
 	{
-		return 1;
+		buffer[i] = op == SPAR_MIN ? HUGE_VAL : ( op == SPAR_MAX ? -HUGE_VAL : 0.0 );
 	}
 
-	int isUniform;
-	isUniform = 1;
-
-	// Inner block
-	if( x < mx - 1 && y < my - 1 && z < mz - 1)
+	// For each output tile
+	int t;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( t = 0 ; t < ma * mb ; t++ )
 	{
-		// Start with last element
-		int value;
-		value = blockData[ bs3 - 1 ];
+		int a1, b1, c1;
+		a1 = t % ma;
+		b1 = t / ma;
 
-		// Read block elements
-		int i;
-		for( i = 0 ; i < bs3 ; i++ )
+		// Tile extent
+		int ea, eb;
+		ea = pa - a1 * bs < bs ? pa - a1 * bs : bs;
+		eb = pb - b1 * bs < bs ? pb - b1 * bs : bs;
+
+		// For each block along the axis
+		for( c1 = 0 ; c1 < mc ; c1++ )
 		{
-			if( blockData[i] != value )
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = axis == 0 ? c1 : a1;
+			j1 = axis == 0 ? a1 : ( axis == 1 ? c1 : b1 );
+			k1 = axis == 2 ? c1 : b1;
+
+			// Linear block index (n) <-> (i1,j1,k1)
+			int n;
+			n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = nx - i1 * bs < bs ? nx - i1 * bs : bs;
+			ey = ny - j1 * bs < bs ? ny - j1 * bs : bs;
+			ez = nz - k1 * bs < bs ? nz - k1 * bs : bs;
+
+			int b, j, k;
+
+			// Uniform block, whole column of elements at once
+			if( matrix->blockData[n] == NULL )
 			{
-				isUniform = 0;
-				i = bs3;
+				for( b = 0 ; b < eb ; b++ )
+				{
+					sparFloatProjectValue( buffer + a1 * bs + pa * ( b1 * bs + b ), ea, matrix->blockValue[n],
+									  axis == 0 ? ex : ( axis == 1 ? ey : ez ), op, matrix->def );
+				}
 			}
-		}
-	}
-	// Boundary block, with outside elements?
-	else
-	{
-		// Start with first element
-		int value;
-		value = blockData[0];
-
-		// Read block elements
-		int i, j, k;
-		for( k = 0 ; k < bs ; k++ )
-		{
-			if( z * bs + k < matrix->nz ) // Avoid outside elements
-			for( j = 0 ; j < bs ; j++ )
+			// Heterogeneous block, row by row
+			else
 			{
-				if( y * bs + j < matrix->ny ) // Idem
-				for( i = 0 ; i < bs ; i++ )
+				for( k = 0 ; k < ez ; k++ )
 				{
-					if( x * bs + i < matrix->nx ) // Idem
-					if( blockData[ i + bs * ( j + bs * k ) ] != value )
+					for( j = 0 ; j < ey ; j++ )
 					{
-						isUniform = 0;
-						i = j = k = bs;
+						float *row;
+						row = matrix->blockData[n] + bs * ( j + bs * k );
+						if( axis == 0 )
+						{
+							sparFloatProjectRow( buffer + ( j1 * bs + j ) + pa * ( k1 * bs + k ), row, ex, op, 1, matrix->def );
+						}
+						else if( axis == 1 )
+						{
+							sparFloatProjectRow( buffer + i1 * bs + pa * ( k1 * bs + k ), row, ex, op, 0, matrix->def );
+						}
+						else
+						{
+							sparFloatProjectRow( buffer + i1 * bs + pa * ( j1 * bs + j ), row, ex, op, 0, matrix->def );
+						}
 					}
 				}
 			}
 		}
 	}
-
-	return isUniform;
 }
 
-// Set matrix element (x,y,z)
-void sparIntSet( sparInt *matrix, int x, int y, int z, int value )
+// Order of two elements for qsort, NaN last
+int sparFloatCompare( const void *a, const void *b )
 {
-	// Block size
-	int bs, bs3;
-	bs = matrix->bs;
-	bs3 = matrix->bs3;
+	float va, vb;
+	va = *(const float*) a;
+	vb = *(const float*) b;
 
-	// Block (i1,j1,k1) contains the element (x,y,z)
-	int i1, j1, k1;
-	i1 = x / bs;
-	j1 = y / bs;
-	k1 = z / bs;
+	// NaN after any number
+	if( isnan( (double) va ) || isnan( (double) vb ) )
+	{
+		return ( isnan( (double) va ) != 0 ) - ( isnan( (double) vb ) != 0 );
+	}
 
-	// Element indices in the block
-	int i2, j2, k2;
-	i2 = x % bs;
-	j2 = y % bs;
-	k2 = z % bs;
+	return ( va > vb ) - ( va < vb );
+}
 
-	// Linear block index (n) <-> (i1,j1,k1)
-	int n;
-	n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+// Recompute blocks of dst overlapping box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) from factor^3 cells of src, op SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE
+void sparFloatDownsampleBox( sparFloat *dst, sparFloat *src, int factor, int op, int x, int y, int z, int sx, int sy, int sz )
+{
+	// Check matrices
+	if( factor < 1 || dst->nx != ( src->nx + factor - 1 ) / factor ||
+		dst->ny != ( src->ny + factor - 1 ) / factor || dst->nz != ( src->nz + factor - 1 ) / factor )
+	{
+		fprintf(stderr, "sparFloatDownsampleBox error: Matrix sizes do not match the factor\n");
+		exit(1);
+	}
 
-	// Block uniform value
-	int blockValue;
-	blockValue = matrix->blockValue[n];
+	if( op != SPAR_MEAN && op != SPAR_MIN && op != SPAR_MAX && op != SPAR_MODE )
+	{
+		fprintf(stderr, "sparFloatDownsampleBox error: Unknown operation\n");
+		exit(1);
+	}
 
-	// Block data array
-	int *blockData;
-	blockData = matrix->blockData[n];
+	// Clip box to dst
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > dst->nx ? dst->nx : x + sx;
+	y1 = y + sy > dst->ny ? dst->ny : y + sy;
+	z1 = z + sz > dst->nz ? dst->nz : z + sz;
 
-	// Uniform block
-	if( blockData == NULL )
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
 	{
-		// Input value is different
-		if( value != blockValue )
+		return;
+	}
+
+	// Destination block size
+	int bs, bs3;
+	bs = dst->bs;
+	bs3 = dst->bs3;
+
+	// Source box size of one destination block
+	int cs;
+	cs = bs * factor;
+
+	// Range of destination blocks
+	int bx, by, bz, cx, cy, cz;
+	bx = x0 / bs;
+	by = y0 / bs;
+	bz = z0 / bs;
+	cx = ( x1 - 1 ) / bs - bx + 1;
+	cy = ( y1 - 1 ) / bs - by + 1;
+	cz = ( z1 - 1 ) / bs - bz + 1;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Source elements of one destination block and of one cell
+		float *buffer, *cell;
+		buffer = (float*) malloc( cs * cs * cs * sizeof(float) );
+		cell = (float*) malloc( factor * factor * factor * sizeof(float) );
+
+		if( buffer == NULL || cell == NULL )
 		{
-			// Expand block
-			blockData = (int*) calloc( bs3, sizeof(int) );
-			matrix->blockData[n] = blockData;
+		   fprintf(stderr, "sparFloatDownsampleBox error: Out of memory\n");
+		   exit(1);
+		}
 
-			if( blockData == NULL )
+		// For each destination block
+		int t;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( t = 0 ; t < cx * cy * cz ; t++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = bx + t % cx;
+			j1 = by + ( t / cx ) % cy;
+			k1 = bz + t / ( cx * cy );
+
+			// Linear block index (n) <-> (i1,j1,k1)
+			int n;
+			n = i1 + dst->mx * ( j1 + dst->my * k1 );
+
+			// Free previous data
+			if( dst->blockData[n] != NULL )
 			{
-			   fprintf(stderr, "sparIntSet error: Out of memory\n");
-			   exit(1);
+				free(dst->blockData[n]);
+				dst->blockData[n] = NULL;
 			}
 
-			// Set previous value
-			int i;
-			for( i = 0 ; i < bs3 ; i++ )
+			// Uniform source region, uniform destination block
+			float value;
+			if( sparFloatUniformBox( src, i1 * cs, j1 * cs, k1 * cs, cs, cs, cs, &value ) )
 			{
-				blockData[i] = blockValue;
+				dst->blockValue[n] = value;
+				continue;
 			}
 
-			// Set input value
-			blockData[ i2 + bs * ( j2 + bs * k2 ) ] = value;
-		}
-		// Else, do nothing
-	}
-	// Heterogeneous block
-	else
-	{
-		// Set input value
-		blockData[ i2 + bs * ( j2 + bs * k2 ) ] = value;
+			// Read source region
+			sparFloatGetBox( src, i1 * cs, j1 * cs, k1 * cs, cs, cs, cs, buffer );
 
-		// Reduce block
-		if( sparIntUniformBlock( matrix, i1, j1, k1 ) )
-		{
-			matrix->blockValue[n] = value;
-			free(matrix->blockData[n]);
-			matrix->blockData[n] = NULL;
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = dst->nx - i1 * bs < bs ? dst->nx - i1 * bs : bs;
+			ey = dst->ny - j1 * bs < bs ? dst->ny - j1 * bs : bs;
+			ez = dst->nz - k1 * bs < bs ? dst->nz - k1 * bs : bs;
+
+			float *blockData;
+			blockData = (float*) calloc( bs3, sizeof(float) );
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparFloatDownsampleBox error: Out of memory\n");
+			   exit(1);
+			}
+
+			// For each destination element
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					for( i = 0 ; i < ex ; i++ )
+					{
+						// Cell extent inside the source matrix
+						int fx, fy, fz;
+						fx = src->nx - ( i1 * bs + i ) * factor < factor ? src->nx - ( i1 * bs + i ) * factor : factor;
+						fy = src->ny - ( j1 * bs + j ) * factor < factor ? src->ny - ( j1 * bs + j ) * factor : factor;
+						fz = src->nz - ( k1 * bs + k ) * factor < factor ? src->nz - ( k1 * bs + k ) * factor : factor;
+
+						// Reduce cell, one tight loop per operation
+						int a, b, c, m;
+						int best, run;
+						double sum;
+						float *row, *r;
+						row = buffer + i * factor + cs * ( j * factor + cs * k * factor );
+						value = row[0];
+						switch( op )
+						{
+							case SPAR_MEAN:
+								sum = 0.0;
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											sum += r[a];
+										}
+									}
+								}
+								value = sparFloatRound( sum / ( fx * fy * fz ) );
+								break;
+							case SPAR_MIN:
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											value = r[a] < value ? r[a] : value;
+										}
+									}
+								}
+								break;
+							case SPAR_MAX:
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											value = r[a] > value ? r[a] : value;
+										}
+									}
+								}
+								break;
+							case SPAR_MODE:
+								// Gather cell
+								m = 0;
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											cell[ m + a ] = r[a];
+										}
+										m += fx;
+									}
+								}
+
+								// Longest run of sorted values
+								qsort( cell, m, sizeof(float), sparFloatCompare );
+								value = cell[0];
+								best = 0;
+								run = 0;
+								for( a = 0 ; a < m ; a++ )
+								{
+									run = ( a > 0 && sparFloatEqual( cell[a], cell[ a - 1 ] ) ) ? run + 1 : 1;
+									if( run > best )
+									{
+										best = run;
+										value = cell[a];
+									}
+								}
+								break;
+						}
+
+						blockData[ i + bs * ( j + bs * k ) ] = value;
+					}
+				}
+			}
+
+			// Write block and reduce if possible
+			dst->blockData[n] = blockData;
+			sparFloatReduceBlock( dst, i1, j1, k1 );
 		}
+
+		free(buffer);
+		free(cell);
 	}
 }
 
-// Get matrix element (x,y,z)
-int sparIntGet( sparInt *matrix, int x, int y, int z )
+// New matrix downsampled by factor with op (SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE)
+sparFloat* sparFloatDownsample( sparFloat *matrix, int factor, int op )
 {
-	// Block size
-	int bs;
-	bs = matrix->bs;
+	if( factor < 1 )
+	{
+		fprintf(stderr, "sparFloatDownsample error: Factor must be positive\n");
+		exit(1);
+	}
 
-	// Block (i1,j1,k1) contains the element (x,y,z)
-	int i1, j1, k1;
-	i1 = x / bs;
-	j1 = y / bs;
-	k1 = z / bs;
+	// Declare matrix and init
+	sparFloat *matrix2;
+	matrix2 = sparFloatInit( ( matrix->nx + factor - 1 ) / factor, ( matrix->ny + factor - 1 ) / factor,
+						( matrix->nz + factor - 1 ) / factor, matrix->bs, matrix->def );
 
-	// Linear block index (n) <-> (i1,j1,k1)
-	int n;
-	n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+	sparFloatDownsampleBox( matrix2, matrix, factor, op, 0, 0, 0, matrix2->nx, matrix2->ny, matrix2->nz );
 
-	int *blockData;
-	blockData = matrix->blockData[n];
+	return matrix2;
+}
 
-	// Uniform block
-	if( blockData == NULL )
+// Pyramid of levels matrices downsampled by 2, 4, 8... with op (SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE)
+void sparFloatPyramid( sparFloat *matrix, int levels, int op, sparFloat **pyramid )
+{
+	int l;
+	for( l = 0 ; l < levels ; l++ )
 	{
-		return matrix->blockValue[n];
+		pyramid[l] = sparFloatDownsample( l == 0 ? matrix : pyramid[ l - 1 ], 2, op );
 	}
-	// Heterogeneous block
-	else
+}
+
+// Update pyramid after changes of matrix in box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1)
+void sparFloatPyramidUpdate( sparFloat *matrix, int levels, int op, sparFloat **pyramid, int x, int y, int z, int sx, int sy, int sz )
+{
+	int l;
+	for( l = 0 ; l < levels ; l++ )
 	{
-		// Element indices in the block
-		int i2, j2, k2;
-		i2 = x % bs;
-		j2 = y % bs;
-		k2 = z % bs;
-		// Return element value
-		return blockData[ i2 + bs * ( j2 + bs * k2 ) ];
+		// Affected box in the next level
+		int x1, y1, z1;
+		x1 = ( x + sx + 1 ) / 2;
+		y1 = ( y + sy + 1 ) / 2;
+		z1 = ( z + sz + 1 ) / 2;
+		x = x / 2;
+		y = y / 2;
+		z = z / 2;
+		sx = x1 - x;
+		sy = y1 - y;
+		sz = z1 - z;
+
+		sparFloatDownsampleBox( pyramid[l], l == 0 ? matrix : pyramid[ l - 1 ], 2, op, x, y, z, sx, sy, sz );
 	}
 }
 
-// Duplicate matrix
-sparInt* sparIntDuplicate( sparInt *matrix )
+// Trilinear interpolation at (x,y,z), element (i,j,k) at integer coordinates, clamped to the matrix bounds
+double sparFloatSample( sparFloat *matrix, double x, double y, double z )
 {
-	// Declare matrix and init
-	sparInt *matrix2;
-	matrix2 = sparIntInit( matrix->nx, matrix->ny, matrix->nz,
-						matrix->bs, matrix->def );
+	// Block size
+	int bs;
+	bs = matrix->bs;
 
-	// Number of blocks
-	int blocks;
-	blocks = matrix2->mx * matrix2->my * matrix2->mz;
+	// Matrix size
+	int size[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+
+	double p[3];
+	p[0] = x;
+	p[1] = y;
+	p[2] = z;
+
+	// Lower (v0) and upper (v1) corners and fractions per axis
+	int a, v0[3], v1[3];
+	double f[3];
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		double q;
+		q = p[a] < 0.0 ? 0.0 : ( p[a] > size[a] - 1 ? size[a] - 1 : p[a] );
+		v0[a] = (int)( floor( q ) );
+		v1[a] = v0[a] + 1 < size[a] ? v0[a] + 1 : v0[a];
+		f[a] = q - v0[a];
+	}
 
-	// Copy blocks
-	int i;
-	for( i = 0 ; i < blocks ; i++ )
+	// Corner values
+	float c[8];
+
+	// All corners in one block
+	if( v0[0] / bs == v1[0] / bs && v0[1] / bs == v1[1] / bs && v0[2] / bs == v1[2] / bs )
 	{
-		// Heterogeneous block
-		if( matrix->blockData[i] != NULL )
-		{
-			// Allocate space for block data
-			matrix2->blockData[i] = (int*) calloc( matrix2->bs3, sizeof(int) );
+		// Linear block index (n)
+		int n;
+		n = v0[0] / bs + matrix->mx * ( v0[1] / bs + matrix->my * ( v0[2] / bs ) );
 
-			if( matrix2->blockData[i] == NULL )
-			{
-			   fprintf(stderr, "sparIntDuplicate error: Out of memory\n");
-			   exit(1);
-			}
+		float *blockData;
+		blockData = matrix->blockData[n];
 
-			// Copy block data
-			memcpy( matrix2->blockData[i], matrix->blockData[i], matrix2->bs3 * sizeof(int) );
-		}
 		// Uniform block
-		else
+		if( blockData == NULL )
 		{
-			matrix2->blockValue[i] = matrix->blockValue[i];
-			matrix2->blockData[i] = NULL;
+			return (double) matrix->blockValue[n];
 		}
+
+		// Lower corner and steps in the block
+		int i, dx, dy, dz;
+		i = v0[0] % bs + bs * ( v0[1] % bs + bs * ( v0[2] % bs ) );
+		dx = v1[0] - v0[0];
+		dy = bs * ( v1[1] - v0[1] );
+		dz = bs * bs * ( v1[2] - v0[2] );
+
+		c[0] = blockData[i];
+		c[1] = blockData[ i + dx ];
+		c[2] = blockData[ i + dy ];
+		c[3] = blockData[ i + dx + dy ];
+		c[4] = blockData[ i + dz ];
+		c[5] = blockData[ i + dx + dz ];
+		c[6] = blockData[ i + dy + dz ];
+		c[7] = blockData[ i + dx + dy + dz ];
+	}
+	// Corners across blocks
+	else
+	{
+		c[0] = sparFloatGet( matrix, v0[0], v0[1], v0[2] );
+		c[1] = sparFloatGet( matrix, v1[0], v0[1], v0[2] );
+		c[2] = sparFloatGet( matrix, v0[0], v1[1], v0[2] );
+		c[3] = sparFloatGet( matrix, v1[0], v1[1], v0[2] );
+		c[4] = sparFloatGet( matrix, v0[0], v0[1], v1[2] );
+		c[5] = sparFloatGet( matrix, v1[0], v0[1], v1[2] );
+		c[6] = sparFloatGet( matrix, v0[0], v1[1], v1[2] );
+		c[7] = sparFloatGet( matrix, v1[0], v1[1], v1[2] );
 	}
 
-	return matrix2;
+	// Interpolate along x, y and z
+	double c0, c1, c2, c3;
+	c0 = c[0] + f[0] * ( (double) c[1] - c[0] );
+	c1 = c[2] + f[0] * ( (double) c[3] - c[2] );
+	c2 = c[4] + f[0] * ( (double) c[5] - c[4] );
+	c3 = c[6] + f[0] * ( (double) c[7] - c[6] );
+	c0 = c0 + f[1] * ( c1 - c0 );
+	c2 = c2 + f[1] * ( c3 - c2 );
+
+	return c0 + f[2] * ( c2 - c0 );
 }
 
-// Get matrix memory usage in bytes under certain block size
-double sparIntMemoryBs( sparInt *matrix, int bs )
+// Trilinear interpolation at n points p[3*i] in parallel into values[i]
+void sparFloatSamples( sparFloat *matrix, int n, double *p, double *values )
 {
-	if( bs == matrix->bs )
+	int i;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( i = 0 ; i < n ; i++ )
 	{
-		return sparIntMemory( matrix );
+		values[i] = sparFloatSample( matrix, p[ 3 * i ], p[ 3 * i + 1 ], p[ 3 * i + 2 ] );
+	}
+}
+
+// Marching cubes triangle edges of cube case c (bit i set if corner i is above the iso value), return number of triangles
+int sparFloatCubeTriangles( int c, int *edges )
+{
+	// Triangle edges per case, -1 terminated, counter-clockwise seen from below the iso value
+	static const signed char table[256][16] =
+	{
+		{ -1 },
+		{ 0, 3, 8, -1 },
+		{ 0, 9, 1, -1 },
+		{ 3, 8, 9, 1, 3, 9, -1 },
+		{ 1, 10, 2, -1 },
+		{ 0, 3, 8, 1, 10, 2, -1 },
+		{ 9, 10, 2, 0, 9, 2, -1 },
+		{ 8, 9, 10, 3, 8, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, -1 },
+		{ 2, 11, 8, 0, 2, 8, -1 },
+		{ 0, 9, 1, 2, 11, 3, -1 },
+		{ 11, 8, 9, 2, 11, 9, 1, 2, 9, -1 },
+		{ 10, 11, 3, 1, 10, 3, -1 },
+		{ 10, 11, 8, 1, 10, 8, 0, 1, 8, -1 },
+		{ 10, 11, 3, 9, 10, 3, 0, 9, 3, -1 },
+		{ 9, 10, 11, 8, 9, 11, -1 },
+		{ 4, 8, 7, -1 },
+		{ 3, 7, 4, 0, 3, 4, -1 },
+		{ 0, 9, 1, 4, 8, 7, -1 },
+		{ 7, 4, 9, 3, 7, 9, 1, 3, 9, -1 },
+		{ 1, 10, 2, 4, 8, 7, -1 },
+		{ 3, 7, 4, 0, 3, 4, 1, 10, 2, -1 },
+		{ 9, 10, 2, 0, 9, 2, 4, 8, 7, -1 },
+		{ 4, 9, 10, 7, 4, 10, 3, 7, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, 4, 8, 7, -1 },
+		{ 11, 7, 4, 2, 11, 4, 0, 2, 4, -1 },
+		{ 0, 9, 1, 2, 11, 3, 4, 8, 7, -1 },
+		{ 7, 4, 9, 11, 7, 9, 2, 11, 9, 1, 2, 9, -1 },
+		{ 10, 11, 3, 1, 10, 3, 4, 8, 7, -1 },
+		{ 11, 7, 4, 10, 11, 4, 1, 10, 4, 0, 1, 4, -1 },
+		{ 10, 11, 3, 9, 10, 3, 0, 9, 3, 4, 8, 7, -1 },
+		{ 10, 11, 7, 9, 10, 7, 4, 9, 7, -1 },
+		{ 4, 5, 9, -1 },
+		{ 0, 3, 8, 4, 5, 9, -1 },
+		{ 4, 5, 1, 0, 4, 1, -1 },
+		{ 8, 4, 5, 3, 8, 5, 1, 3, 5, -1 },
+		{ 1, 10, 2, 4, 5, 9, -1 },
+		{ 0, 3, 8, 1, 10, 2, 4, 5, 9, -1 },
+		{ 5, 10, 2, 4, 5, 2, 0, 4, 2, -1 },
+		{ 4, 5, 10, 8, 4, 10, 3, 8, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, 4, 5, 9, -1 },
+		{ 2, 11, 8, 0, 2, 8, 4, 5, 9, -1 },
+		{ 4, 5, 1, 0, 4, 1, 2, 11, 3, -1 },
+		{ 8, 4, 5, 11, 8, 5, 2, 11, 5, 1, 2, 5, -1 },
+		{ 10, 11, 3, 1, 10, 3, 4, 5, 9, -1 },
+		{ 10, 11, 8, 1, 10, 8, 0, 1, 8, 4, 5, 9, -1 },
+		{ 10, 11, 3, 5, 10, 3, 4, 5, 3, 0, 4, 3, -1 },
+		{ 10, 11, 8, 5, 10, 8, 4, 5, 8, -1 },
+		{ 9, 8, 7, 5, 9, 7, -1 },
+		{ 7, 5, 9, 3, 7, 9, 0, 3, 9, -1 },
+		{ 7, 5, 1, 8, 7, 1, 0, 8, 1, -1 },
+		{ 3, 7, 5, 1, 3, 5, -1 },
+		{ 1, 10, 2, 9, 8, 7, 5, 9, 7, -1 },
+		{ 7, 5, 9, 3, 7, 9, 0, 3, 9, 1, 10, 2, -1 },
+		{ 5, 10, 2, 7, 5, 2, 8, 7, 2, 0, 8, 2, -1 },
+		{ 7, 5, 10, 3, 7, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, 9, 8, 7, 5, 9, 7, -1 },
+		{ 7, 5, 9, 11, 7, 9, 2, 11, 9, 0, 2, 9, -1 },
+		{ 7, 5, 1, 8, 7, 1, 0, 8, 1, 2, 11, 3, -1 },
+		{ 11, 7, 5, 2, 11, 5, 1, 2, 5, -1 },
+		{ 10, 11, 3, 1, 10, 3, 9, 8, 7, 5, 9, 7, -1 },
+		{ 1, 10, 11, 0, 1, 11, 7, 5, 9, 11, 7, 9, 0, 11, 9, -1 },
+		{ 8, 7, 5, 0, 8, 5, 10, 11, 3, 5, 10, 3, 0, 5, 3, -1 },
+		{ 10, 11, 7, 5, 10, 7, -1 },
+		{ 5, 6, 10, -1 },
+		{ 0, 3, 8, 5, 6, 10, -1 },
+		{ 0, 9, 1, 5, 6, 10, -1 },
+		{ 3, 8, 9, 1, 3, 9, 5, 6, 10, -1 },
+		{ 5, 6, 2, 1, 5, 2, -1 },
+		{ 0, 3, 8, 5, 6, 2, 1, 5, 2, -1 },
+		{ 5, 6, 2, 9, 5, 2, 0, 9, 2, -1 },
+		{ 9, 5, 6, 8, 9, 6, 3, 8, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 5, 6, 10, -1 },
+		{ 2, 11, 8, 0, 2, 8, 5, 6, 10, -1 },
+		{ 0, 9, 1, 2, 11, 3, 5, 6, 10, -1 },
+		{ 11, 8, 9, 2, 11, 9, 1, 2, 9, 5, 6, 10, -1 },
+		{ 6, 11, 3, 5, 6, 3, 1, 5, 3, -1 },
+		{ 6, 11, 8, 5, 6, 8, 1, 5, 8, 0, 1, 8, -1 },
+		{ 6, 11, 3, 5, 6, 3, 9, 5, 3, 0, 9, 3, -1 },
+		{ 11, 8, 9, 6, 11, 9, 5, 6, 9, -1 },
+		{ 4, 8, 7, 5, 6, 10, -1 },
+		{ 3, 7, 4, 0, 3, 4, 5, 6, 10, -1 },
+		{ 0, 9, 1, 4, 8, 7, 5, 6, 10, -1 },
+		{ 7, 4, 9, 3, 7, 9, 1, 3, 9, 5, 6, 10, -1 },
+		{ 5, 6, 2, 1, 5, 2, 4, 8, 7, -1 },
+		{ 3, 7, 4, 0, 3, 4, 5, 6, 2, 1, 5, 2, -1 },
+		{ 5, 6, 2, 9, 5, 2, 0, 9, 2, 4, 8, 7, -1 },
+		{ 7, 4, 9, 3, 7, 9, 9, 5, 6, 3, 9, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 4, 8, 7, 5, 6, 10, -1 },
+		{ 11, 7, 4, 2, 11, 4, 0, 2, 4, 5, 6, 10, -1 },
+		{ 0, 9, 1, 2, 11, 3, 4, 8, 7, 5, 6, 10, -1 },
+		{ 7, 4, 9, 11, 7, 9, 2, 11, 9, 1, 2, 9, 5, 6, 10, -1 },
+		{ 6, 11, 3, 5, 6, 3, 1, 5, 3, 4, 8, 7, -1 },
+		{ 5, 6, 11, 1, 5, 11, 11, 7, 4, 1, 11, 4, 0, 1, 4, -1 },
+		{ 6, 11, 3, 5, 6, 3, 9, 5, 3, 0, 9, 3, 4, 8, 7, -1 },
+		{ 5, 6, 11, 9, 5, 11, 9, 11, 7, 4, 9, 7, -1 },
+		{ 6, 10, 9, 4, 6, 9, -1 },
+		{ 0, 3, 8, 6, 10, 9, 4, 6, 9, -1 },
+		{ 6, 10, 1, 4, 6, 1, 0, 4, 1, -1 },
+		{ 4, 6, 10, 8, 4, 10, 3, 8, 10, 1, 3, 10, -1 },
+		{ 4, 6, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 0, 3, 8, 4, 6, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 4, 6, 2, 0, 4, 2, -1 },
+		{ 8, 4, 6, 3, 8, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 6, 10, 9, 4, 6, 9, -1 },
+		{ 2, 11, 8, 0, 2, 8, 6, 10, 9, 4, 6, 9, -1 },
+		{ 6, 10, 1, 4, 6, 1, 0, 4, 1, 2, 11, 3, -1 },
+		{ 2, 11, 8, 1, 2, 8, 4, 6, 10, 8, 4, 10, 1, 8, 10, -1 },
+		{ 6, 11, 3, 4, 6, 3, 9, 4, 3, 1, 9, 3, -1 },
+		{ 9, 4, 6, 1, 9, 6, 6, 11, 8, 1, 6, 8, 0, 1, 8, -1 },
+		{ 6, 11, 3, 4, 6, 3, 0, 4, 3, -1 },
+		{ 6, 11, 8, 4, 6, 8, -1 },
+		{ 9, 8, 7, 10, 9, 7, 6, 10, 7, -1 },
+		{ 6, 10, 9, 7, 6, 9, 3, 7, 9, 0, 3, 9, -1 },
+		{ 6, 10, 1, 7, 6, 1, 8, 7, 1, 0, 8, 1, -1 },
+		{ 7, 6, 10, 3, 7, 10, 1, 3, 10, -1 },
+		{ 7, 6, 2, 8, 7, 2, 9, 8, 2, 1, 9, 2, -1 },
+		{ 2, 1, 9, 6, 2, 9, 7, 6, 9, 3, 7, 9, 0, 3, 9, -1 },
+		{ 7, 6, 2, 8, 7, 2, 0, 8, 2, -1 },
+		{ 3, 7, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 9, 8, 7, 10, 9, 7, 6, 10, 7, -1 },
+		{ 6, 10, 9, 7, 6, 9, 11, 7, 9, 2, 11, 9, 0, 2, 9, -1 },
+		{ 6, 10, 1, 7, 6, 1, 8, 7, 1, 0, 8, 1, 2, 11, 3, -1 },
+		{ 2, 11, 7, 1, 2, 7, 7, 6, 10, 1, 7, 10, -1 },
+		{ 8, 7, 6, 9, 8, 6, 6, 11, 3, 9, 6, 3, 1, 9, 3, -1 },
+		{ 0, 1, 9, 6, 11, 7, -1 },
+		{ 8, 7, 6, 0, 8, 6, 6, 11, 3, 0, 6, 3, -1 },
+		{ 6, 11, 7, -1 },
+		{ 6, 7, 11, -1 },
+		{ 0, 3, 8, 6, 7, 11, -1 },
+		{ 0, 9, 1, 6, 7, 11, -1 },
+		{ 3, 8, 9, 1, 3, 9, 6, 7, 11, -1 },
+		{ 1, 10, 2, 6, 7, 11, -1 },
+		{ 0, 3, 8, 1, 10, 2, 6, 7, 11, -1 },
+		{ 9, 10, 2, 0, 9, 2, 6, 7, 11, -1 },
+		{ 8, 9, 10, 3, 8, 10, 2, 3, 10, 6, 7, 11, -1 },
+		{ 6, 7, 3, 2, 6, 3, -1 },
+		{ 6, 7, 8, 2, 6, 8, 0, 2, 8, -1 },
+		{ 0, 9, 1, 6, 7, 3, 2, 6, 3, -1 },
+		{ 7, 8, 9, 6, 7, 9, 2, 6, 9, 1, 2, 9, -1 },
+		{ 6, 7, 3, 10, 6, 3, 1, 10, 3, -1 },
+		{ 6, 7, 8, 10, 6, 8, 1, 10, 8, 0, 1, 8, -1 },
+		{ 6, 7, 3, 10, 6, 3, 9, 10, 3, 0, 9, 3, -1 },
+		{ 8, 9, 10, 7, 8, 10, 6, 7, 10, -1 },
+		{ 8, 11, 6, 4, 8, 6, -1 },
+		{ 11, 6, 4, 3, 11, 4, 0, 3, 4, -1 },
+		{ 0, 9, 1, 8, 11, 6, 4, 8, 6, -1 },
+		{ 6, 4, 9, 11, 6, 9, 3, 11, 9, 1, 3, 9, -1 },
+		{ 1, 10, 2, 8, 11, 6, 4, 8, 6, -1 },
+		{ 11, 6, 4, 3, 11, 4, 0, 3, 4, 1, 10, 2, -1 },
+		{ 9, 10, 2, 0, 9, 2, 8, 11, 6, 4, 8, 6, -1 },
+		{ 11, 6, 4, 3, 11, 4, 4, 9, 10, 3, 4, 10, 2, 3, 10, -1 },
+		{ 4, 8, 3, 6, 4, 3, 2, 6, 3, -1 },
+		{ 2, 6, 4, 0, 2, 4, -1 },
+		{ 0, 9, 1, 4, 8, 3, 6, 4, 3, 2, 6, 3, -1 },
+		{ 6, 4, 9, 2, 6, 9, 1, 2, 9, -1 },
+		{ 4, 8, 3, 6, 4, 3, 10, 6, 3, 1, 10, 3, -1 },
+		{ 10, 6, 4, 1, 10, 4, 0, 1, 4, -1 },
+		{ 4, 8, 3, 6, 4, 3, 10, 6, 3, 9, 10, 3, 0, 9, 3, -1 },
+		{ 9, 10, 6, 4, 9, 6, -1 },
+		{ 4, 5, 9, 6, 7, 11, -1 },
+		{ 0, 3, 8, 4, 5, 9, 6, 7, 11, -1 },
+		{ 4, 5, 1, 0, 4, 1, 6, 7, 11, -1 },
+		{ 8, 4, 5, 3, 8, 5, 1, 3, 5, 6, 7, 11, -1 },
+		{ 1, 10, 2, 4, 5, 9, 6, 7, 11, -1 },
+		{ 0, 3, 8, 1, 10, 2, 4, 5, 9, 6, 7, 11, -1 },
+		{ 5, 10, 2, 4, 5, 2, 0, 4, 2, 6, 7, 11, -1 },
+		{ 4, 5, 10, 8, 4, 10, 3, 8, 10, 2, 3, 10, 6, 7, 11, -1 },
+		{ 6, 7, 3, 2, 6, 3, 4, 5, 9, -1 },
+		{ 6, 7, 8, 2, 6, 8, 0, 2, 8, 4, 5, 9, -1 },
+		{ 4, 5, 1, 0, 4, 1, 6, 7, 3, 2, 6, 3, -1 },
+		{ 6, 7, 8, 2, 6, 8, 8, 4, 5, 2, 8, 5, 1, 2, 5, -1 },
+		{ 6, 7, 3, 10, 6, 3, 1, 10, 3, 4, 5, 9, -1 },
+		{ 6, 7, 8, 10, 6, 8, 1, 10, 8, 0, 1, 8, 4, 5, 9, -1 },
+		{ 6, 7, 3, 10, 6, 3, 5, 10, 3, 4, 5, 3, 0, 4, 3, -1 },
+		{ 6, 7, 8, 10, 6, 8, 5, 10, 8, 4, 5, 8, -1 },
+		{ 8, 11, 6, 9, 8, 6, 5, 9, 6, -1 },
+		{ 6, 5, 9, 11, 6, 9, 3, 11, 9, 0, 3, 9, -1 },
+		{ 6, 5, 1, 11, 6, 1, 8, 11, 1, 0, 8, 1, -1 },
+		{ 11, 6, 5, 3, 11, 5, 1, 3, 5, -1 },
+		{ 1, 10, 2, 8, 11, 6, 9, 8, 6, 5, 9, 6, -1 },
+		{ 6, 5, 9, 11, 6, 9, 3, 11, 9, 0, 3, 9, 1, 10, 2, -1 },
+		{ 11, 6, 5, 8, 11, 5, 5, 10, 2, 8, 5, 2, 0, 8, 2, -1 },
+		{ 11, 6, 5, 3, 11, 5, 3, 5, 10, 2, 3, 10, -1 },
+		{ 9, 8, 3, 5, 9, 3, 6, 5, 3, 2, 6, 3, -1 },
+		{ 6, 5, 9, 2, 6, 9, 0, 2, 9, -1 },
+		{ 3, 2, 6, 8, 3, 6, 6, 5, 1, 8, 6, 1, 0, 8, 1, -1 },
+		{ 2, 6, 5, 1, 2, 5, -1 },
+		{ 9, 8, 3, 5, 9, 3, 6, 5, 3, 10, 6, 3, 1, 10, 3, -1 },
+		{ 1, 10, 6, 0, 1, 6, 6, 5, 9, 0, 6, 9, -1 },
+		{ 0, 8, 3, 5, 10, 6, -1 },
+		{ 5, 10, 6, -1 },
+		{ 7, 11, 10, 5, 7, 10, -1 },
+		{ 0, 3, 8, 7, 11, 10, 5, 7, 10, -1 },
+		{ 0, 9, 1, 7, 11, 10, 5, 7, 10, -1 },
+		{ 3, 8, 9, 1, 3, 9, 7, 11, 10, 5, 7, 10, -1 },
+		{ 7, 11, 2, 5, 7, 2, 1, 5, 2, -1 },
+		{ 0, 3, 8, 7, 11, 2, 5, 7, 2, 1, 5, 2, -1 },
+		{ 7, 11, 2, 5, 7, 2, 9, 5, 2, 0, 9, 2, -1 },
+		{ 3, 8, 9, 2, 3, 9, 5, 7, 11, 9, 5, 11, 2, 9, 11, -1 },
+		{ 5, 7, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 5, 7, 8, 10, 5, 8, 2, 10, 8, 0, 2, 8, -1 },
+		{ 0, 9, 1, 5, 7, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 10, 5, 7, 2, 10, 7, 7, 8, 9, 2, 7, 9, 1, 2, 9, -1 },
+		{ 5, 7, 3, 1, 5, 3, -1 },
+		{ 5, 7, 8, 1, 5, 8, 0, 1, 8, -1 },
+		{ 5, 7, 3, 9, 5, 3, 0, 9, 3, -1 },
+		{ 7, 8, 9, 5, 7, 9, -1 },
+		{ 11, 10, 5, 8, 11, 5, 4, 8, 5, -1 },
+		{ 10, 5, 4, 11, 10, 4, 3, 11, 4, 0, 3, 4, -1 },
+		{ 0, 9, 1, 11, 10, 5, 8, 11, 5, 4, 8, 5, -1 },
+		{ 10, 5, 4, 11, 10, 4, 11, 4, 9, 3, 11, 9, 1, 3, 9, -1 },
+		{ 8, 11, 2, 4, 8, 2, 5, 4, 2, 1, 5, 2, -1 },
+		{ 1, 5, 4, 2, 1, 4, 11, 2, 4, 3, 11, 4, 0, 3, 4, -1 },
+		{ 8, 11, 2, 4, 8, 2, 5, 4, 2, 9, 5, 2, 0, 9, 2, -1 },
+		{ 2, 3, 11, 4, 9, 5, -1 },
+		{ 4, 8, 3, 5, 4, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 10, 5, 4, 2, 10, 4, 0, 2, 4, -1 },
+		{ 0, 9, 1, 4, 8, 3, 5, 4, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 10, 5, 4, 2, 10, 4, 2, 4, 9, 1, 2, 9, -1 },
+		{ 4, 8, 3, 5, 4, 3, 1, 5, 3, -1 },
+		{ 1, 5, 4, 0, 1, 4, -1 },
+		{ 4, 8, 3, 5, 4, 3, 9, 5, 3, 0, 9, 3, -1 },
+		{ 4, 9, 5, -1 },
+		{ 11, 10, 9, 7, 11, 9, 4, 7, 9, -1 },
+		{ 0, 3, 8, 11, 10, 9, 7, 11, 9, 4, 7, 9, -1 },
+		{ 11, 10, 1, 7, 11, 1, 4, 7, 1, 0, 4, 1, -1 },
+		{ 7, 11, 10, 4, 7, 10, 8, 4, 10, 3, 8, 10, 1, 3, 10, -1 },
+		{ 7, 11, 2, 4, 7, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 0, 3, 8, 7, 11, 2, 4, 7, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 7, 11, 2, 4, 7, 2, 0, 4, 2, -1 },
+		{ 3, 8, 4, 2, 3, 4, 4, 7, 11, 2, 4, 11, -1 },
+		{ 4, 7, 3, 9, 4, 3, 10, 9, 3, 2, 10, 3, -1 },
+		{ 9, 4, 7, 10, 9, 7, 10, 7, 8, 2, 10, 8, 0, 2, 8, -1 },
+		{ 3, 2, 10, 7, 3, 10, 7, 10, 1, 4, 7, 1, 0, 4, 1, -1 },
+		{ 1, 2, 10, 4, 7, 8, -1 },
+		{ 4, 7, 3, 9, 4, 3, 1, 9, 3, -1 },
+		{ 9, 4, 7, 1, 9, 7, 1, 7, 8, 0, 1, 8, -1 },
+		{ 4, 7, 3, 0, 4, 3, -1 },
+		{ 4, 7, 8, -1 },
+		{ 11, 10, 9, 8, 11, 9, -1 },
+		{ 11, 10, 9, 3, 11, 9, 0, 3, 9, -1 },
+		{ 11, 10, 1, 8, 11, 1, 0, 8, 1, -1 },
+		{ 3, 11, 10, 1, 3, 10, -1 },
+		{ 8, 11, 2, 9, 8, 2, 1, 9, 2, -1 },
+		{ 2, 1, 9, 11, 2, 9, 3, 11, 9, 0, 3, 9, -1 },
+		{ 8, 11, 2, 0, 8, 2, -1 },
+		{ 2, 3, 11, -1 },
+		{ 9, 8, 3, 10, 9, 3, 2, 10, 3, -1 },
+		{ 2, 10, 9, 0, 2, 9, -1 },
+		{ 3, 2, 10, 8, 3, 10, 8, 10, 1, 0, 8, 1, -1 },
+		{ 1, 2, 10, -1 },
+		{ 9, 8, 3, 1, 9, 3, -1 },
+		{ 0, 1, 9, -1 },
+		{ 0, 8, 3, -1 },
+		{ -1 }
+	};
+
+	int i;
+	for( i = 0 ; table[c][i] >= 0 ; i++ )
+	{
+		edges[i] = table[c][i];
 	}
 
-	// Matrix size (nx,ny,nz)
+	return i / 3;
+}
+
+// Order of two edge keys for qsort
+int sparFloatCompareKey( const void *a, const void *b )
+{
+	long long ka, kb;
+	ka = *(const long long*) a;
+	kb = *(const long long*) b;
+	return ( ka > kb ) - ( ka < kb );
+}
+
+// Marching cubes isosurface at iso into vertices[3*i] and triangles[3*j] (malloc, free after use), nt triangles, return number of vertices
+int sparFloatIsosurface( sparFloat *matrix, double iso, double **vertices, int **triangles, int *nt )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Matrix size
 	int nx, ny, nz;
 	nx = matrix->nx;
 	ny = matrix->ny;
 	nz = matrix->nz;
 
-	// Block size (bs,bs,bs)
-	int bs3;
-	bs3 = bs * bs * bs;
-
-	// Block matrix size (mx,my,mz)
-	int mx, my, mz;
-	mx = (int)( ( nx + bs - 1 ) / bs );
-	my = (int)( ( ny + bs - 1 ) / bs );
-	mz = (int)( ( nz + bs - 1 ) / bs );
+	// Cube corner offsets, and edge lower corner offset and axis
+	static const int corner[8][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 },
+									  { 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 } };
+	static const int edge[12][4] = { { 0, 0, 0, 0 }, { 1, 0, 0, 1 }, { 0, 1, 0, 0 }, { 0, 0, 0, 1 },
+									 { 0, 0, 1, 0 }, { 1, 0, 1, 1 }, { 0, 1, 1, 0 }, { 0, 0, 1, 1 },
+									 { 0, 0, 0, 2 }, { 1, 0, 0, 2 }, { 1, 1, 0, 2 }, { 0, 1, 0, 2 } };
 
-	// Number of blocks
-	int blocks;
-	blocks = mx * my * mz;
+	// Triangle edge keys and triangle count per block
+	int nb;
+	nb = matrix->mx * matrix->my * matrix->mz;
 
-	// Size of matrix instance
-	double size;
-	size = (double)( sizeof(sparInt) );
+	long long **keys;
+	int *count;
+	keys = (long long**) calloc( nb, sizeof(long long*) );
+	count = (int*) calloc( nb, sizeof(int) );
 
-	// Size of uniform block data
-	size = size + (double)( blocks * sizeof(int) );
+	if( keys == NULL || count == NULL )
+	{
+	   fprintf(stderr, "sparFloatIsosurface error: Out of memory\n");
+	   exit(1);
+	}
 
-	// Size of heterogeneous block data arrays
-	size = size + (double)( blocks * sizeof(int*) );
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block corners, including the next block first plane on each axis
+		int s;
+		float *buffer;
+		s = bs + 1;
+		buffer = (float*) malloc( s * s * s * sizeof(float) );
 
-	int i, j, k;
-	int i1, j1, k1;
-	int isUniform;
-	int value;
+		if( buffer == NULL )
+		{
+		   fprintf(stderr, "sparFloatIsosurface error: Out of memory\n");
+		   exit(1);
+		}
 
-	// For each virtual block
-	for( k1 = 0 ; k1 < mz ; k1++ )
-	{
-		for( j1 = 0 ; j1 < my ; j1++ )
+		// For each block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < nb ; n++ )
 		{
-			for( i1 = 0 ; i1 < mx ; i1++ )
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = n % matrix->mx;
+			j1 = ( n / matrix->mx ) % matrix->my;
+			k1 = n / ( matrix->mx * matrix->my );
+
+			// Cells with lower corner in the block
+			int ex, ey, ez;
+			ex = nx - 1 - i1 * bs < bs ? nx - 1 - i1 * bs : bs;
+			ey = ny - 1 - j1 * bs < bs ? ny - 1 - j1 * bs : bs;
+			ez = nz - 1 - k1 * bs < bs ? nz - 1 - k1 * bs : bs;
+
+			if( ex <= 0 || ey <= 0 || ez <= 0 )
 			{
-				// Check if block is uniform 
-				isUniform = 1;
-				value = sparIntGet( matrix, i1 * bs, j1 * bs, k1 * bs );
-				for( k = k1 * bs ; k < ( k1 + 1 ) * bs ; k++ )
+				continue;
+			}
+
+			// Uniform corners, no crossing
+			float value;
+			if( sparFloatUniformBox( matrix, i1 * bs, j1 * bs, k1 * bs, s, s, s, &value ) )
+			{
+				continue;
+			}
+
+			sparFloatGetBox( matrix, i1 * bs, j1 * bs, k1 * bs, s, s, s, buffer );
+
+			// Corner offsets in the buffer
+			int offset[8], c;
+			for( c = 0 ; c < 8 ; c++ )
+			{
+				offset[c] = corner[c][0] + s * ( corner[c][1] + s * corner[c][2] );
+			}
+
+			int size;
+			size = 0;
+
+			// For each cell
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
 				{
-					if( k < nz ) // Avoid outside elements
-					for( j = j1 * bs ; j < ( j1 + 1 ) * bs ; j++ )
+					for( i = 0 ; i < ex ; i++ )
 					{
-						if( j < ny ) // Idem
-						for( i = i1 * bs ; i < ( i1 + 1 ) * bs ; i++ )
+						// Cube case
+						float *cell;
+						int cube;
+						cell = buffer + i + s * ( j + s * k );
+						cube = 0;
+						for( c = 0 ; c < 8 ; c++ )
 						{
-							if( i < nx ) // Idem
-							if( sparIntGet( matrix, i, j, k ) != value )
+							cube |= ( cell[ offset[c] ] > iso ) << c;
+						}
+
+						if( cube == 0 || cube == 255 )
+						{
+							continue;
+						}
+
+						int edges[15], t;
+						t = sparFloatCubeTriangles( cube, edges );
+
+						// Grow keys
+						if( ( count[n] + t ) * 3 > size )
+						{
+							size = size == 0 ? 48 : 2 * size;
+							keys[n] = (long long*) realloc( keys[n], size * sizeof(long long) );
+
+							if( keys[n] == NULL )
 							{
-								isUniform = 0;
-								i = ( i1 + 1 ) * bs;
-								j = ( j1 + 1 ) * bs;
-								k = ( k1 + 1 ) * bs;
+							   fprintf(stderr, "sparFloatIsosurface error: Out of memory\n");
+							   exit(1);
 							}
 						}
+
+						// Edge key of lower element (x,y,z) and axis a, 3*(x+nx*(y+ny*z))+a
+						for( c = 0 ; c < 3 * t ; c++ )
+						{
+							const int *e;
+							e = edge[ edges[c] ];
+							keys[n][ 3 * count[n] + c ] = 3 * ( i1 * bs + i + e[0] + nx *
+								( j1 * bs + j + e[1] + (long long) ny * ( k1 * bs + k + e[2] ) ) ) + e[3];
+						}
+						count[n] += t;
 					}
 				}
-				if( isUniform == 0 )
-				{
-					size = size + (double)( sizeof(int) * bs3 );
-				}
 			}
 		}
+
+		free(buffer);
 	}
 
-	return size;
+	// Triangle offset per block
+	int m, total;
+	total = 0;
+	for( m = 0 ; m < nb ; m++ )
+	{
+		int c;
+		c = count[m];
+		count[m] = total;
+		total += c;
+	}
+	*nt = total;
+
+	if( total == 0 )
+	{
+		free(keys);
+		free(count);
+		*vertices = NULL;
+		*triangles = NULL;
+		return 0;
+	}
+
+	// All edge keys, then sorted unique keys as vertices
+	long long *all, *unique;
+	all = (long long*) malloc( 3 * total * sizeof(long long) );
+	unique = (long long*) malloc( 3 * total * sizeof(long long) );
+
+	if( all == NULL || unique == NULL )
+	{
+	   fprintf(stderr, "sparFloatIsosurface error: Out of memory\n");
+	   exit(1);
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( m = 0 ; m < nb ; m++ )
+	{
+		if( keys[m] != NULL )
+		{
+			int c;
+			c = ( m + 1 < nb ? count[ m + 1 ] : total ) - count[m];
+			memcpy( all + 3 * count[m], keys[m], 3 * c * sizeof(long long) );
+			free(keys[m]);
+		}
+	}
+	free(keys);
+	free(count);
+
+	memcpy( unique, all, 3 * total * sizeof(long long) );
+	qsort( unique, 3 * total, sizeof(long long), sparFloatCompareKey );
+
+	int nv;
+	nv = 1;
+	for( m = 1 ; m < 3 * total ; m++ )
+	{
+		if( unique[m] != unique[ nv - 1 ] )
+		{
+			unique[ nv++ ] = unique[m];
+		}
+	}
+
+	*vertices = (double*) malloc( 3 * nv * sizeof(double) );
+	*triangles = (int*) malloc( 3 * total * sizeof(int) );
+
+	if( *vertices == NULL || *triangles == NULL )
+	{
+	   fprintf(stderr, "sparFloatIsosurface error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Vertex on edge by linear interpolation
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( m = 0 ; m < nv ; m++ )
+	{
+		// Lower element (x,y,z) and axis a
+		int a, p[3];
+		long long key;
+		key = unique[m] / 3;
+		a = (int)( unique[m] % 3 );
+		p[0] = (int)( key % nx );
+		p[1] = (int)( ( key / nx ) % ny );
+		p[2] = (int)( key / ( (long long) nx * ny ) );
+
+		double v0, v1, t;
+		v0 = sparFloatGet( matrix, p[0], p[1], p[2] );
+		v1 = sparFloatGet( matrix, p[0] + ( a == 0 ), p[1] + ( a == 1 ), p[2] + ( a == 2 ) );
+		t = ( iso - v0 ) / ( v1 - v0 );
+
+		(*vertices)[ 3 * m ] = p[0] + ( a == 0 ) * t;
+		(*vertices)[ 3 * m + 1 ] = p[1] + ( a == 1 ) * t;
+		(*vertices)[ 3 * m + 2 ] = p[2] + ( a == 2 ) * t;
+	}
+
+	// Triangle vertex indices
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( m = 0 ; m < 3 * total ; m++ )
+	{
+		long long *v;
+		v = (long long*) bsearch( all + m, unique, nv, sizeof(long long), sparFloatCompareKey );
+		(*triangles)[m] = (int)( v - unique );
+	}
+
+	free(all);
+	free(unique);
+
+	return nv;
 }
 
-// Change matrix block size
-void sparIntChangeBs( sparInt *matrix, int bs )
+// Copy block (i,j,k) of src into block (x,y,z) of dst, same block size
+void sparFloatCopyBlock( sparFloat *dst, int x, int y, int z, sparFloat *src, int i, int j, int k )
 {
-	// Matrix size (nx,ny,nz)
-	int nx, ny, nz;
-	nx = matrix->nx;
-	ny = matrix->ny;
-	nz = matrix->nz;
+	// Linear block indices
+	int n, m;
+	n = x + dst->mx * ( y + dst->my * z );
+	m = i + src->mx * ( j + src->my * k );
 
-	// Default value
-	int def;
-	def = matrix->def;
+	// Uniform block
+	if( src->blockData[m] == NULL )
+	{
+		if( dst->blockData[n] != NULL )
+		{
+			free(dst->blockData[n]);
+			dst->blockData[n] = NULL;
+		}
+		dst->blockValue[n] = src->blockValue[m];
+		return;
+	}
 
-	// Declare temporal matrix and init
-	sparInt *matrix2;
-	matrix2 = sparIntInit( nx, ny, nz, bs, def );
+	// Heterogeneous block, reuse destination data if any
+	if( dst->blockData[n] == NULL )
+	{
+		dst->blockData[n] = (float*) malloc( dst->bs3 * sizeof(float) );
+
+		if( dst->blockData[n] == NULL )
+		{
+		   fprintf(stderr, "sparFloatCopyBlock error: Out of memory\n");
+		   exit(1);
+		}
+	}
+
+	memcpy( dst->blockData[n], src->blockData[m], dst->bs3 * sizeof(float) );
+
+	// Boundary block may become uniform inside the matrix
+	if( x == dst->mx - 1 || y == dst->my - 1 || z == dst->mz - 1 )
+	{
+		sparFloatReduceBlock( dst, x, y, z );
+	}
+}
+
+// New matrix with box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1), elements outside the matrix set to default, ring buffer origin reset
+sparFloat* sparFloatCrop( sparFloat *matrix, int x, int y, int z, int sx, int sy, int sz )
+{
+	// Declare matrix and init
+	sparFloat *matrix2;
+	matrix2 = sparFloatInit( sx, sy, sz, matrix->bs, matrix->def );
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Box aligned with source blocks
+	int aligned;
+	aligned = x >= 0 && y >= 0 && z >= 0 && x % bs == 0 && y % bs == 0 && z % bs == 0;
+
+	// Number of blocks
+	int blocks;
+	blocks = matrix2->mx * matrix2->my * matrix2->mz;
 
-	// Copy values and clear original matrix
-	int i, j, k;
-	for( k=0 ; k<nz ; k++ )
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
 	{
-		for( j=0 ; j<ny ; j++ )
+		// Block (i1,j1,k1) and source box origin
+		int i1, j1, k1, x0, y0, z0;
+		i1 = n % matrix2->mx;
+		j1 = ( n / matrix2->mx ) % matrix2->my;
+		k1 = n / ( matrix2->mx * matrix2->my );
+		x0 = x + i1 * bs;
+		y0 = y + j1 * bs;
+		z0 = z + k1 * bs;
+
+		// Aligned source block covering the block elements inside the matrix, copy block
+		if( aligned && x0 < matrix->nx && y0 < matrix->ny && z0 < matrix->nz &&
+			matrix->nx - x0 >= ( sx - i1 * bs < bs ? sx - i1 * bs : bs ) &&
+			matrix->ny - y0 >= ( sy - j1 * bs < bs ? sy - j1 * bs : bs ) &&
+			matrix->nz - z0 >= ( sz - k1 * bs < bs ? sz - k1 * bs : bs ) )
 		{
-			for( i=0 ; i<nx ; i++ )
-			{
-				// Copy element
-				sparIntSet( matrix2, i, j, k, sparIntGet( matrix, i, j, k ) );
+			sparFloatCopyBlock( matrix2, i1, j1, k1, matrix, x0 / bs, y0 / bs, z0 / bs );
+			continue;
+		}
 
-				// Set uniform to free memory
-				sparIntSet( matrix, i, j, k, def);
-			}
+		// Uniform source box
+		float value;
+		if( sparFloatUniformBox( matrix, x0, y0, z0, bs, bs, bs, &value ) &&
+			x0 >= 0 && y0 >= 0 && z0 >= 0 && x0 + bs <= matrix->nx && y0 + bs <= matrix->ny && z0 + bs <= matrix->nz )
+		{
+			matrix2->blockValue[n] = value;
+			continue;
 		}
-	}
 
-	// Set new block size and grid
-	matrix->bs  = matrix2->bs;
-	matrix->bs3 = matrix2->bs3;
-	matrix->mx  = matrix2->mx;
-	matrix->my  = matrix2->my;
-	matrix->mz  = matrix2->mz;
+		// Read source box rows into the block, reduce if possible
+		matrix2->blockData[n] = (float*) malloc( matrix2->bs3 * sizeof(float) );
 
-	// Free old blocks
-	free(matrix->blockValue);
-	free(matrix->blockData);
+		if( matrix2->blockData[n] == NULL )
+		{
+		   fprintf(stderr, "sparFloatCrop error: Out of memory\n");
+		   exit(1);
+		}
 
-	// Copy new blocks
-	matrix->blockValue = matrix2->blockValue;
-	matrix->blockData = matrix2->blockData;
+		sparFloatGetBox( matrix, x0, y0, z0, bs, bs, bs, matrix2->blockData[n] );
+		sparFloatReduceBlock( matrix2, i1, j1, k1 );
+	}
 
-	// Free temporal matrix
-	free(matrix2);
+	return matrix2;
 }
 
-// Optimize matrix block size
-void sparIntOptimizeBs( sparInt *matrix )
+// Write src into matrix at (x,y,z), clipped to the matrix
+void sparFloatPaste( sparFloat *matrix, sparFloat *src, int x, int y, int z )
 {
-	// Test block size and store optimal
-	int bestBs;
-	double memory, bestMemory;
-	int bs[10] = { 2, 3, 4, 6, 8, 10 };
+	// Block size
+	int bs;
+	bs = matrix->bs;
 
-	bestBs = bs[0];
-	bestMemory = sparIntMemoryBs( matrix, bs[0] );
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + src->nx > matrix->nx ? matrix->nx : x + src->nx;
+	y1 = y + src->ny > matrix->ny ? matrix->ny : y + src->ny;
+	z1 = z + src->nz > matrix->nz ? matrix->nz : z + src->nz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
 
-	int i;
-	for( i=1 ; i<6 ; i++ )
+	// Box aligned with blocks of the same size
+	int aligned;
+	aligned = src->bs == bs && x >= 0 && y >= 0 && z >= 0 && x % bs == 0 && y % bs == 0 && z % bs == 0;
+
+	// Range of blocks
+	int bx, by, bz, cx, cy, cz;
+	bx = x0 / bs;
+	by = y0 / bs;
+	bz = z0 / bs;
+	cx = ( x1 - 1 ) / bs - bx + 1;
+	cy = ( y1 - 1 ) / bs - by + 1;
+	cz = ( z1 - 1 ) / bs - bz + 1;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
 	{
-		memory = sparIntMemoryBs( matrix, bs[i] );
-		if( memory < bestMemory )
+		float *buffer;
+		buffer = (float*) malloc( bs * bs * bs * sizeof(float) );
+
+		if( buffer == NULL )
 		{
-			bestBs = bs[i];
-			bestMemory = memory;
+		   fprintf(stderr, "sparFloatPaste error: Out of memory\n");
+		   exit(1);
 		}
-	}
 
-	// Change matrix block size
-	sparIntChangeBs( matrix, bestBs );
-}
+		// For each block overlapping the box
+		int t;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( t = 0 ; t < cx * cy * cz ; t++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = bx + t % cx;
+			j1 = by + ( t / cx ) % cy;
+			k1 = bz + t / ( cx * cy );
+
+			// Block and box intersection
+			int bx0, by0, bz0, bx1, by1, bz1;
+			bx0 = i1 * bs > x0 ? i1 * bs : x0;
+			by0 = j1 * bs > y0 ? j1 * bs : y0;
+			bz0 = k1 * bs > z0 ? k1 * bs : z0;
+			bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+			by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+			bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+			// Aligned block with elements inside the matrix fully covered, copy block
+			if( aligned && bx0 == i1 * bs && by0 == j1 * bs && bz0 == k1 * bs &&
+				( bx1 == ( i1 + 1 ) * bs || bx1 == matrix->nx ) &&
+				( by1 == ( j1 + 1 ) * bs || by1 == matrix->ny ) &&
+				( bz1 == ( k1 + 1 ) * bs || bz1 == matrix->nz ) )
+			{
+				sparFloatCopyBlock( matrix, i1, j1, k1, src, i1 - x / bs, j1 - y / bs, k1 - z / bs );
+				continue;
+			}
 
-// Resize matrix
-void sparIntResize( sparInt *matrix, int nx, int ny, int nz )
-{
-	// Check matrix size
-	if( !( nx > 0 && ny > 0 && nz > 0 ) )
-	{
-		fprintf(stderr, "sparIntResize error: Matrix size must be positive\n");
-		exit(1);
+			// Copy intersection rows
+			sparFloatGetBox( src, bx0 - x, by0 - y, bz0 - z, bx1 - bx0, by1 - by0, bz1 - bz0, buffer );
+			sparFloatSetBox( matrix, bx0, by0, bz0, bx1 - bx0, by1 - by0, bz1 - bz0, buffer );
+		}
+
+		free(buffer);
 	}
+}
 
+// Shift contents by (dx,dy,dz), element (x,y,z) moves to (x+dx,y+dy,z+dz), vacated elements set to default
+void sparFloatShift( sparFloat *matrix, int dx, int dy, int dz )
+{
 	// Block size
 	int bs;
 	bs = matrix->bs;
 
-	// Default value
-	int def;
-	def = matrix->def;
-
-	// Block grid size
+	// Block matrix size (mx,my,mz)
 	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
 
-	// New block data
-	int *blockValue;
-	int **blockData;
-
-	int i, j, k;
-	int blocks;
-
-	// Expand x
-	if( nx > matrix->nx )
+	// Shift in blocks (qx,qy,qz) and remainder (rx,ry,rz), same sign so no data is dropped early
+	int qx, qy, qz, rx, ry, rz;
+	qx = dx / bs;
+	qy = dy / bs;
+	qz = dz / bs;
+	rx = dx % bs;
+	ry = dy % bs;
+	rz = dz % bs;
+
+	// Move blocks
+	if( qx != 0 || qy != 0 || qz != 0 )
 	{
-		// New block grid size
-		mx = (int)( ( nx + bs - 1 ) / bs );
-		my = matrix->my;
-		mz = matrix->mz;
+		// New block data
+		float *blockValue;
+		float **blockData;
 
-		// Number of blocks
+		int blocks;
 		blocks = mx * my * mz;
-		blockValue = (int*) calloc( blocks, sizeof(int) ); // Sets to 0s
-		blockData = (int**) calloc( blocks, sizeof(int*) ); // Sets to NULLs
+		blockValue = (float*) calloc( blocks, sizeof(float) ); // Sets to 0s
+		blockData = (float**) calloc( blocks, sizeof(float*) ); // Sets to NULLs
 
 		if( blockValue == NULL || blockData == NULL )
 		{
-		   fprintf(stderr, "sparIntResize error: Out of memory\n");
+		   fprintf(stderr, "sparFloatShift error: Out of memory\n");
 		   exit(1);
 		}
 
-		// Copy existing blocks
+		int i, j, k;
 		for( k = 0 ; k < mz ; k++ )
 		{
 			for( j = 0 ; j < my ; j++ )
 			{
-				for( i = 0 ; i < matrix->mx ; i++ )
+				for( i = 0 ; i < mx ; i++ )
 				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
+					// Source block
+					int i2, j2, k2, n;
+					i2 = i - qx;
+					j2 = j - qy;
+					k2 = k - qz;
+					n = i + mx * ( j + my * k );
+
+					if( i2 >= 0 && j2 >= 0 && k2 >= 0 && i2 < mx && j2 < my && k2 < mz )
+					{
+						int m;
+						m = i2 + mx * ( j2 + my * k2 );
+						blockValue[n] = matrix->blockValue[m];
+						blockData[n] = matrix->blockData[m];
+						matrix->blockData[m] = NULL;
+					}
+					else
+					{
+						blockValue[n] = matrix->def;
+					}
 				}
 			}
 		}
-		// Create new blocks
-		for( k = 0 ; k < mz ; k++ )
+
+		// Free blocks moved outside
+		for( i = 0 ; i < blocks ; i++ )
 		{
-			for( j = 0 ; j < my ; j++ )
+			if( matrix->blockData[i] != NULL )
 			{
-				for( i = matrix->mx ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j +  my * k ) ] = def;
-					blockData[ i + mx * ( j +  my * k ) ] = NULL;
-				}
+				free(matrix->blockData[i]);
 			}
 		}
 
-		int xi, xf;
-		xi = matrix->nx;
-		xf = matrix->bs * matrix->mx;
-		if( xf >= nx )
-		{
-			xf = nx - 1;
-		}
-
-		matrix->nx = nx;
-		matrix->mx = mx;
-
 		free(matrix->blockData);
 		free(matrix->blockValue);
 
 		matrix->blockData = blockData;
 		matrix->blockValue = blockValue;
 
-		// Set expanded elements to default
-		for( k = 0 ; k < matrix->nz ; k++ )
+		// Previous boundary blocks moved inside, set outside elements to default
+		int ex, ey, ez;
+		ex = matrix->nx - ( mx - 1 ) * bs;
+		ey = matrix->ny - ( my - 1 ) * bs;
+		ez = matrix->nz - ( mz - 1 ) * bs;
+
+		if( ex < bs && qx < 0 && mx - 1 + qx >= 0 )
+		{
+			sparFloatFillBox( matrix, ( mx - 1 + qx ) * bs + ex, 0, 0, bs - ex, matrix->ny, matrix->nz, matrix->def );
+		}
+		if( ey < bs && qy < 0 && my - 1 + qy >= 0 )
+		{
+			sparFloatFillBox( matrix, 0, ( my - 1 + qy ) * bs + ey, 0, matrix->nx, bs - ey, matrix->nz, matrix->def );
+		}
+		if( ez < bs && qz < 0 && mz - 1 + qz >= 0 )
+		{
+			sparFloatFillBox( matrix, 0, 0, ( mz - 1 + qz ) * bs + ez, matrix->nx, matrix->ny, bs - ez, matrix->def );
+		}
+
+		// Blocks moved to the boundary may be uniform inside the matrix
+		for( k = 0 ; k < mz ; k++ )
 		{
-			for( j = 0 ; j < matrix->ny ; j++ )
+			for( j = 0 ; j < my ; j++ )
 			{
-				for( i = xi ; i < xf ; i++ )
+				for( i = 0 ; i < mx ; i++ )
 				{
-					sparIntSet( matrix, i, j, k, def );
+					if( ( i == mx - 1 && ex < bs && qx != 0 ) || ( j == my - 1 && ey < bs && qy != 0 ) ||
+						( k == mz - 1 && ez < bs && qz != 0 ) )
+					{
+						sparFloatReduceBlock( matrix, i, j, k );
+					}
 				}
 			}
 		}
 	}
-	// Shrink x
-	else if( nx < matrix->nx )
+
+	// Recombine blocks for the remainder
+	if( rx != 0 || ry != 0 || rz != 0 )
 	{
-		// New block grid size
-		mx = (int)( ( nx + bs - 1 ) / bs );
-		my = matrix->my;
-		mz = matrix->mz;
+		sparFloat *shifted;
+		shifted = sparFloatCrop( matrix, -rx, -ry, -rz, matrix->nx, matrix->ny, matrix->nz );
+
+		// Swap block data
+		float *blockValue;
+		float **blockData;
+		blockValue = matrix->blockValue;
+		blockData = matrix->blockData;
+		matrix->blockValue = shifted->blockValue;
+		matrix->blockData = shifted->blockData;
+		shifted->blockValue = blockValue;
+		shifted->blockData = blockData;
+
+		sparFloatFree( shifted );
+	}
+}
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (int*) calloc( blocks, sizeof(int) ); // Sets to 0s
-		blockData = (int**) calloc( blocks, sizeof(int*) ); // Sets to NULLs
+// Ring buffer index of world coordinate w in a ring of size n
+int sparFloatRingIndex( int w, int n )
+{
+	return ( w % n + n ) % n;
+}
 
-		if( blockValue == NULL || blockData == NULL )
+// Set element at world coordinates (x,y,z) of the ring buffer window, ignored outside the window
+void sparFloatRingSet( sparFloat *matrix, int x, int y, int z, float value )
+{
+	if( x < matrix->ox || y < matrix->oy || z < matrix->oz ||
+		x >= matrix->ox + matrix->nx || y >= matrix->oy + matrix->ny || z >= matrix->oz + matrix->nz )
+	{
+		return;
+	}
+
+	sparFloatSet( matrix, sparFloatRingIndex( x, matrix->nx ), sparFloatRingIndex( y, matrix->ny ), sparFloatRingIndex( z, matrix->nz ), value );
+}
+
+// Get element at world coordinates (x,y,z) of the ring buffer window, default value outside the window
+float sparFloatRingGet( sparFloat *matrix, int x, int y, int z )
+{
+	if( x < matrix->ox || y < matrix->oy || z < matrix->oz ||
+		x >= matrix->ox + matrix->nx || y >= matrix->oy + matrix->ny || z >= matrix->oz + matrix->nz )
+	{
+		return matrix->def;
+	}
+
+	return sparFloatGet( matrix, sparFloatRingIndex( x, matrix->nx ), sparFloatRingIndex( y, matrix->ny ), sparFloatRingIndex( z, matrix->nz ) );
+}
+
+// Move the ring buffer window origin to world coordinates (x,y,z), elements entering the window set to default
+void sparFloatRingMove( sparFloat *matrix, int x, int y, int z )
+{
+	// Matrix size, previous and new origin
+	int size[3], o[3], p[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+	o[0] = matrix->ox;
+	o[1] = matrix->oy;
+	o[2] = matrix->oz;
+	p[0] = x;
+	p[1] = y;
+	p[2] = z;
+
+	// Window moved by at least its size on one axis, reset all
+	int a;
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		if( abs( p[a] - o[a] ) >= size[a] )
 		{
-		   fprintf(stderr, "sparIntResize error: Out of memory\n");
-		   exit(1);
+			sparFloatFillBox( matrix, 0, 0, 0, matrix->nx, matrix->ny, matrix->nz, matrix->def );
+			matrix->ox = x;
+			matrix->oy = y;
+			matrix->oz = z;
+			return;
 		}
+	}
 
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+	// For each axis, reset the slab of elements entering the window, in up to two boxes of ring indices
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		if( p[a] == o[a] )
 		{
-			for( j = 0 ; j < my ; j++ )
-			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
-				}
-			}
+			continue;
 		}
 
-		// Free excedent blocks
-		for( k = 0 ; k < mz ; k++ )
+		// First entering world coordinate and slab thickness
+		int w, t;
+		w = p[a] > o[a] ? o[a] + size[a] : p[a];
+		t = abs( p[a] - o[a] );
+
+		// Ring index ranges [s0,s0+t0) and [0,t-t0)
+		int s0, t0;
+		s0 = sparFloatRingIndex( w, size[a] );
+		t0 = s0 + t > size[a] ? size[a] - s0 : t;
+
+		int b[3], c[3];
+		b[0] = 0;
+		b[1] = 0;
+		b[2] = 0;
+		c[0] = matrix->nx;
+		c[1] = matrix->ny;
+		c[2] = matrix->nz;
+
+		b[a] = s0;
+		c[a] = t0;
+		sparFloatFillBox( matrix, b[0], b[1], b[2], c[0], c[1], c[2], matrix->def );
+
+		if( t0 < t )
 		{
-			for( j = 0 ; j < my ; j++ )
+			b[a] = 0;
+			c[a] = t - t0;
+			sparFloatFillBox( matrix, b[0], b[1], b[2], c[0], c[1], c[2], matrix->def );
+		}
+	}
+
+	matrix->ox = x;
+	matrix->oy = y;
+	matrix->oz = z;
+}
+
+// New matrix with permuted axes, new x, y and z axes are the axes ax, ay and az (0 x, 1 y, 2 z) of matrix
+sparFloat* sparFloatPermute( sparFloat *matrix, int ax, int ay, int az )
+{
+	// Check permutation
+	if( ax < 0 || ay < 0 || az < 0 || ax > 2 || ay > 2 || az > 2 || ax == ay || ay == az || az == ax )
+	{
+		fprintf(stderr, "sparFloatPermute error: Axes must be a permutation of 0, 1 and 2\n");
+		exit(1);
+	}
+
+	// Matrix and block matrix size
+	int size[3], blockSize[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+	blockSize[0] = matrix->mx;
+	blockSize[1] = matrix->my;
+	blockSize[2] = matrix->mz;
+
+	// Declare matrix and init
+	sparFloat *matrix2;
+	matrix2 = sparFloatInit( size[ax], size[ay], size[az], matrix->bs, matrix->def );
+
+	// Permute ring buffer origin
+	int origin[3];
+	origin[0] = matrix->ox;
+	origin[1] = matrix->oy;
+	origin[2] = matrix->oz;
+	matrix2->ox = origin[ax];
+	matrix2->oy = origin[ay];
+	matrix2->oz = origin[az];
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Source strides of the new axes, blocks and elements
+	int stride[3], blockStride[3];
+	stride[0] = 1;
+	stride[1] = bs;
+	stride[2] = bs * bs;
+	blockStride[0] = 1;
+	blockStride[1] = blockSize[0];
+	blockStride[2] = blockSize[0] * blockSize[1];
+
+	int sx, sy, sz, bx, by, bz;
+	sx = stride[ax];
+	sy = stride[ay];
+	sz = stride[az];
+	bx = blockStride[ax];
+	by = blockStride[ay];
+	bz = blockStride[az];
+
+	// Number of blocks
+	int blocks;
+	blocks = matrix2->mx * matrix2->my * matrix2->mz;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		// Block (i1,j1,k1) and source block
+		int i1, j1, k1, m;
+		i1 = n % matrix2->mx;
+		j1 = ( n / matrix2->mx ) % matrix2->my;
+		k1 = n / ( matrix2->mx * matrix2->my );
+		m = i1 * bx + j1 * by + k1 * bz;
+
+		// Uniform block
+		if( matrix->blockData[m] == NULL )
+		{
+			matrix2->blockValue[n] = matrix->blockValue[m];
+			continue;
+		}
+
+		// Heterogeneous block, transpose in cache
+		float *blockData, *source;
+		blockData = (float*) malloc( matrix2->bs3 * sizeof(float) );
+		source = matrix->blockData[m];
+
+		if( blockData == NULL )
+		{
+		   fprintf(stderr, "sparFloatPermute error: Out of memory\n");
+		   exit(1);
+		}
+
+		int i, j, k;
+		for( k = 0 ; k < bs ; k++ )
+		{
+			for( j = 0 ; j < bs ; j++ )
 			{
-				for( i = mx ; i < matrix->mx ; i++ )
+				float *row, *column;
+				row = blockData + bs * ( j + bs * k );
+				column = source + j * sy + k * sz;
+				for( i = 0 ; i < bs ; i++ )
 				{
-					if( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
-					{
-						free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
-					}
+					row[i] = column[ i * sx ];
 				}
 			}
 		}
 
-		matrix->nx = nx;
-		matrix->mx = mx;
+		matrix2->blockData[n] = blockData;
+	}
 
-		free(matrix->blockData);
-		free(matrix->blockValue);
+	return matrix2;
+}
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
+// Allocate n elements 64-byte aligned with plain malloc (no C11 aligned_alloc), release with the matching DenseFree
+float* sparFloatDenseAlloc( long n )
+{
+	// Room for the alignment offset and the original pointer
+	char *base;
+	base = (char*) malloc( n * sizeof(float) + 64 + sizeof(void*) );
+
+	if( base == NULL )
+	{
+		return NULL;
+	}
+
+	// First 64-byte boundary after the stored original pointer
+	char *aligned;
+	aligned = base + sizeof(void*);
+	aligned = aligned + ( 64 - (uintptr_t)( aligned ) % 64 ) % 64;
+	((void**) aligned)[-1] = base;
+
+	return (float*) aligned;
+}
+
+// Free dense buffer returned by Densify or DenseAlloc
+void sparFloatDenseFree( float *buffer )
+{
+	if( buffer != NULL )
+	{
+		free( ((void**) buffer)[-1] );
+	}
+}
+
+// Dense copy padded to (px,py,pz) with the default value, rows along axis contiguous and 64-byte aligned every pitch elements (free with sparFloatDenseFree)
+float* sparFloatDensify( sparFloat *matrix, int axis, int px, int py, int pz, int *pitch )
+{
+	// Check padded size
+	if( px < matrix->nx || py < matrix->ny || pz < matrix->nz || axis < 0 || axis > 2 )
+	{
+		fprintf(stderr, "sparFloatDensify error: Padded size must contain the matrix\n");
+		exit(1);
+	}
+
+	// Padded size and the other two axes (b,c)
+	int p[3], b, c;
+	p[0] = px;
+	p[1] = py;
+	p[2] = pz;
+	b = axis == 0 ? 1 : 0;
+	c = axis == 2 ? 1 : 2;
+
+	// Row pitch, multiple of 64 bytes
+	int align;
+	align = 64 % sizeof(float) == 0 ? 64 / sizeof(float) : 1;
+	*pitch = ( p[axis] + align - 1 ) / align * align;
+
+	// Element (x,y,z) at x*s[0]+y*s[1]+z*s[2]
+	long s[3];
+	s[axis] = 1;
+	s[b] = *pitch;
+	s[c] = (long) *pitch * p[b];
+
+	float *buffer;
+	buffer = sparFloatDenseAlloc( s[c] * p[c] );
+
+	if( buffer == NULL )
+	{
+	   fprintf(stderr, "sparFloatDensify error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Matrix size
+	int size[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+
+	// Padding, row by row
+	int r;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( r = 0 ; r < p[b] * p[c] ; r++ )
+	{
+		// Row (j,k) along axes (b,c)
+		int i, j, k;
+		j = r % p[b];
+		k = r / p[b];
+
+		float *row;
+		row = buffer + j * s[b] + k * s[c];
+		for( i = ( j < size[b] && k < size[c] ) ? size[axis] : 0 ; i < *pitch ; i++ )
+		{
+			row[i] = matrix->def;
+		}
 	}
 
-	// Expand y
-	if( ny > matrix->ny )
+	sparFloatGetDense( matrix, buffer, s[0], s[1], s[2] );
+
+	return buffer;
+}
+
+// Copy dense buffer with element (x,y,z) at x*sx+y*sy+z*sz into matrix, uniform blocks detected
+void sparFloatSetDense( sparFloat *matrix, float *buffer, long sx, long sy, long sz )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Element strides
+	long s[3];
+	s[0] = sx;
+	s[1] = sy;
+	s[2] = sz;
+
+	// Number of blocks
+	int blocks;
+	blocks = matrix->mx * matrix->my * matrix->mz;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
 	{
-		// New block grid size
-		mx = matrix->mx;
-		my = (int)( ( ny + bs - 1 ) / bs );
-		mz = matrix->mz;
-
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (int*) calloc( blocks, sizeof(int) ); // Sets to 0s
-		blockData = (int**) calloc( blocks, sizeof(int*) ); // Sets to NULLs
+		// Block elements
+		float *temp;
+		temp = (float*) malloc( bs3 * sizeof(float) );
 
-		if( blockValue == NULL || blockData == NULL )
+		if( temp == NULL )
 		{
-		   fprintf(stderr, "sparIntResize error: Out of memory\n");
+		   fprintf(stderr, "sparFloatSetDense error: Out of memory\n");
 		   exit(1);
 		}
 
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+		// For each block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < blocks ; n++ )
 		{
-			for( j = 0 ; j < matrix->my ; j++ )
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = n % matrix->mx;
+			j1 = ( n / matrix->mx ) % matrix->my;
+			k1 = n / ( matrix->mx * matrix->my );
+
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = matrix->nx - i1 * bs < bs ? matrix->nx - i1 * bs : bs;
+			ey = matrix->ny - j1 * bs < bs ? matrix->ny - j1 * bs : bs;
+			ez = matrix->nz - k1 * bs < bs ? matrix->nz - k1 * bs : bs;
+
+			// Gather block and check uniformity in a single scan
+			float value;
+			int isUniform;
+			value = buffer[ i1 * bs * s[0] + j1 * bs * s[1] + k1 * bs * s[2] ];
+			isUniform = 1;
+
+			int i, j, k;
+			for( k = 0 ; k < bs ; k++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				for( j = 0 ; j < bs ; j++ )
 				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
+					float *row, *blockRow;
+					row = buffer + i1 * bs * s[0] + ( j1 * bs + j ) * s[1] + ( k1 * bs + k ) * s[2];
+					blockRow = temp + bs * ( j + bs * k );
+
+					// Outside elements set to default
+					if( j >= ey || k >= ez )
+					{
+						for( i = 0 ; i < bs ; i++ )
+						{
+							blockRow[i] = matrix->def;
+						}
+						continue;
+					}
+
+					for( i = 0 ; i < ex ; i++ )
+					{
+						blockRow[i] = row[ i * s[0] ];
+						isUniform &= sparFloatEqual( blockRow[i], value );
+					}
+					for( i = ex ; i < bs ; i++ )
+					{
+						blockRow[i] = matrix->def;
+					}
 				}
 			}
-		}
-		// Create new blocks
-		for( k = 0 ; k < mz ; k++ )
-		{
-			for( j = matrix->my ; j < my ; j++ )
+
+			// Uniform block
+			if( isUniform )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				if( matrix->blockData[n] != NULL )
 				{
-					blockValue[ i + mx * ( j +  my * k ) ] = def;
-					blockData[ i + mx * ( j +  my * k ) ] = NULL;
+					free(matrix->blockData[n]);
+					matrix->blockData[n] = NULL;
 				}
+				matrix->blockValue[n] = value;
 			}
-		}
-
-		int yi, yf;
-		yi = matrix->ny;
-		yf = matrix->bs * matrix->my;
-		if( yf >= ny )
-		{
-			yf = ny - 1;
-		}
-
-		matrix->ny = ny;
-		matrix->my = my;
-
-		free(matrix->blockData);
-		free(matrix->blockValue);
-
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
-
-		// Set expanded elements to default
-		for( k = 0 ; k < matrix->nz ; k++ )
-		{
-			for( j = yi ; j < yf ; j++ )
+			// Heterogeneous block, reuse previous data if any
+			else if( matrix->blockData[n] != NULL )
+			{
+				memcpy( matrix->blockData[n], temp, bs3 * sizeof(float) );
+			}
+			// Heterogeneous block, keep gathered elements
+			else
 			{
-				for( i = 0 ; i < matrix->nx ; i++ )
+				matrix->blockData[n] = temp;
+				temp = (float*) malloc( bs3 * sizeof(float) );
+
+				if( temp == NULL )
 				{
-					sparIntSet( matrix, i, j, k, def );
+				   fprintf(stderr, "sparFloatSetDense error: Out of memory\n");
+				   exit(1);
 				}
 			}
 		}
+
+		free(temp);
 	}
-	// Shrink y
-	else if( ny < matrix->ny )
-	{
-		// New block grid size
-		mx = matrix->mx;
-		my = (int)( ( ny + bs - 1 ) / bs );
-		mz = matrix->mz;
+}
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (int*) calloc( blocks, sizeof(int) ); // Sets to 0s
-		blockData = (int**) calloc( blocks, sizeof(int*) ); // Sets to NULLs
+// Copy dense buffer with the densify layout (axis, pitch and padded size) into matrix, uniform blocks detected
+void sparFloatSparsify( sparFloat *matrix, float *buffer, int axis, int pitch, int px, int py, int pz )
+{
+	// Check padded size and pitch
+	if( px < matrix->nx || py < matrix->ny || pz < matrix->nz || axis < 0 || axis > 2 )
+	{
+		fprintf(stderr, "sparFloatSparsify error: Padded size must contain the matrix\n");
+		exit(1);
+	}
 
-		if( blockValue == NULL || blockData == NULL )
-		{
-		   fprintf(stderr, "sparIntResize error: Out of memory\n");
-		   exit(1);
-		}
+	if( pitch < ( axis == 0 ? px : ( axis == 1 ? py : pz ) ) )
+	{
+		fprintf(stderr, "sparFloatSparsify error: Pitch must be at least the padded row length\n");
+		exit(1);
+	}
 
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
-		{
-			for( j = 0 ; j < my ; j++ )
-			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
-				}
-			}
-		}
+	// Padded size and the other two axes (b,c)
+	int p[3], b, c;
+	p[0] = px;
+	p[1] = py;
+	p[2] = pz;
+	b = axis == 0 ? 1 : 0;
+	c = axis == 2 ? 1 : 2;
+
+	// Element (x,y,z) at x*s[0]+y*s[1]+z*s[2]
+	long s[3];
+	s[axis] = 1;
+	s[b] = pitch;
+	s[c] = (long) pitch * p[b];
+
+	sparFloatSetDense( matrix, buffer, s[0], s[1], s[2] );
+}
 
-		// Free excedent blocks
-		for( k = 0 ; k < mz ; k++ )
-		{
-			for( j = my ; j < matrix->my ; j++ )
-			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					if( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
-					{
-						free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
-					}
-				}
-			}
-		}
+// New matrix from dense buffer with element (x,y,z) at x*sx+y*sy+z*sz, only heterogeneous blocks allocated
+sparFloat* sparFloatInitDense( float *buffer, int nx, int ny, int nz, long sx, long sy, long sz, int bs, float def )
+{
+	// Declare matrix and init
+	sparFloat *matrix;
+	matrix = sparFloatInit( nx, ny, nz, bs, def );
 
-		matrix->ny = ny;
-		matrix->my = my;
+	sparFloatSetDense( matrix, buffer, sx, sy, sz );
 
-		free(matrix->blockData);
-		free(matrix->blockValue);
+	return matrix;
+}
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
-	}
+// Copy matrix into dense buffer with element (x,y,z) at x*sx+y*sy+z*sz
+void sparFloatGetDense( sparFloat *matrix, float *buffer, long sx, long sy, long sz )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
 
-	// Expand z
-	if( nz > matrix->nz )
+	// For each row along x, in contiguous slabs per thread
+	int r;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( r = 0 ; r < matrix->ny * matrix->nz ; r++ )
 	{
-		// New block grid size
-		mx = matrix->mx;
-		my = matrix->my;
-		mz = (int)( ( nz + bs - 1 ) / bs );
+		// Row (y,z), its blocks and offset in the block
+		int y, z, j1, k1, offset;
+		y = r % matrix->ny;
+		z = r / matrix->ny;
+		j1 = y / bs;
+		k1 = z / bs;
+		offset = bs * ( y % bs + bs * ( z % bs ) );
+
+		float *row;
+		row = buffer + y * sy + z * sz;
+
+		// For each block along the row
+		int i1;
+		for( i1 = 0 ; i1 < matrix->mx ; i1++ )
+		{
+			// Linear block index (n) <-> (i1,j1,k1)
+			int n;
+			n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (int*) calloc( blocks, sizeof(int) ); // Sets to 0s
-		blockData = (int**) calloc( blocks, sizeof(int*) ); // Sets to NULLs
+			// Block extent inside the matrix
+			int ex;
+			ex = matrix->nx - i1 * bs < bs ? matrix->nx - i1 * bs : bs;
 
-		if( blockValue == NULL || blockData == NULL )
-		{
-		   fprintf(stderr, "sparIntResize error: Out of memory\n");
-		   exit(1);
-		}
+			float *blockData, *out, value;
+			blockData = matrix->blockData[n];
+			value = matrix->blockValue[n];
+			out = row + i1 * bs * sx;
 
-		// Copy existing blocks
-		for( k = 0 ; k < matrix->mz ; k++ )
-		{
-			for( j = 0 ; j < my ; j++ )
+			int i;
+
+			// Uniform block, contiguous row
+			if( blockData == NULL && sx == 1 )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				for( i = 0 ; i < ex ; i++ )
 				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
+					out[i] = value;
 				}
 			}
-		}
-		// Create new blocks
-		for( k = matrix->mz ; k < mz ; k++ )
-		{
-			for( j = 0 ; j < my ; j++ )
+			// Uniform block, strided row
+			else if( blockData == NULL )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				for( i = 0 ; i < ex ; i++ )
 				{
-					blockValue[ i + mx * ( j +  my * k ) ] = def;
-					blockData[ i + mx * ( j +  my * k ) ] = NULL;
+					out[ i * sx ] = value;
 				}
 			}
-		}
-
-		int zi, zf;
-		zi = matrix->nz;
-		zf = matrix->bs * matrix->mz;
-		if( zf >= nz )
-		{
-			zf = nz - 1;
-		}
-
-		matrix->nz = nz;
-		matrix->mz = mz;
-
-		free(matrix->blockData);
-		free(matrix->blockValue);
-
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
-
-		// Set expanded elements to default
-		for( k = zi ; k < zf ; k++ )
-		{
-			for( j = 0 ; j < matrix->ny ; j++ )
+			// Heterogeneous block, contiguous row
+			else if( sx == 1 )
+			{
+				memcpy( out, blockData + offset, ex * sizeof(float) );
+			}
+			// Heterogeneous block, strided row
+			else
 			{
-				for( i = 0 ; i < matrix->nx ; i++ )
+				for( i = 0 ; i < ex ; i++ )
 				{
-					sparIntSet( matrix, i, j, k, def );
+					out[ i * sx ] = blockData[ offset + i ];
 				}
 			}
 		}
 	}
-	// Shrink z
-	else if( nz < matrix->nz )
+}
+
+// Change the default value, uniform blocks with the previous default value set to the new one
+void sparFloatSetDefault( sparFloat *matrix, float def )
+{
+	// Number of blocks
+	int blocks;
+	blocks = matrix->mx * matrix->my * matrix->mz;
+
+	int i;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( i = 0 ; i < blocks ; i++ )
 	{
-		// New block grid size
-		mx = matrix->mx;
-		my = matrix->my;
-		mz = (int)( ( nz + bs - 1 ) / bs );
+		if( matrix->blockData[i] == NULL && sparFloatEqual( matrix->blockValue[i], matrix->def ) )
+		{
+			matrix->blockValue[i] = def;
+		}
+	}
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (int*) calloc( blocks, sizeof(int) ); // Sets to 0s
-		blockData = (int**) calloc( blocks, sizeof(int*) ); // Sets to NULLs
+	matrix->def = def;
+}
 
-		if( blockValue == NULL || blockData == NULL )
+// Most frequent value in box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) clipped to the matrix, smallest on ties, its count in count if not NULL
+float sparFloatDominant( sparFloat *matrix, int x, int y, int z, int sx, int sy, int sz, double *count )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		if( count != NULL )
 		{
-		   fprintf(stderr, "sparIntResize error: Out of memory\n");
-		   exit(1);
+			*count = 0.0;
 		}
+		return matrix->def;
+	}
 
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+	// Runs of equal values, one per uniform block and per distinct value of heterogeneous blocks
+	int runs, size;
+	float *runValue, *temp;
+	double *runCount;
+	runs = 0;
+	size = 64;
+	runValue = (float*) malloc( size * sizeof(float) );
+	runCount = (double*) malloc( size * sizeof(double) );
+	temp = (float*) malloc( matrix->bs3 * sizeof(float) );
+
+	if( runValue == NULL || runCount == NULL || temp == NULL )
+	{
+	   fprintf(stderr, "sparFloatDominant error: Out of memory\n");
+	   exit(1);
+	}
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
 		{
-			for( j = 0 ; j < my ; j++ )
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1, m;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+				m = ( bx1 - bx0 ) * ( by1 - by0 ) * ( bz1 - bz0 );
+
+				// Grow runs
+				if( runs + m > size )
 				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
+					size = 2 * ( runs + m );
+					runValue = (float*) realloc( runValue, size * sizeof(float) );
+					runCount = (double*) realloc( runCount, size * sizeof(double) );
+
+					if( runValue == NULL || runCount == NULL )
+					{
+					   fprintf(stderr, "sparFloatDominant error: Out of memory\n");
+					   exit(1);
+					}
 				}
-			}
-		}
 
-		// Free excedent blocks
-		for( k = mz ; k < matrix->mz ; k++ )
-		{
-			for( j = 0 ; j < my ; j++ )
-			{
-				for( i = 0 ; i < mx ; i++ )
+				// Uniform block, one run
+				if( matrix->blockData[n] == NULL )
+				{
+					runValue[runs] = matrix->blockValue[n];
+					runCount[runs] = m;
+					runs++;
+					continue;
+				}
+
+				// Heterogeneous block, sorted intersection elements
+				sparFloatGetBox( matrix, bx0, by0, bz0, bx1 - bx0, by1 - by0, bz1 - bz0, temp );
+				qsort( temp, m, sizeof(float), sparFloatCompare );
+
+				int i;
+				for( i = 0 ; i < m ; i++ )
 				{
-					if( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
+					if( i > 0 && sparFloatEqual( temp[i], temp[ i - 1 ] ) )
+					{
+						runCount[ runs - 1 ] += 1.0;
+					}
+					else
 					{
-						free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
+						runValue[runs] = temp[i];
+						runCount[runs] = 1.0;
+						runs++;
 					}
 				}
 			}
 		}
+	}
 
-		matrix->nz = nz;
-		matrix->mz = mz;
+	// Distinct values, sorted
+	int distinct, i;
+	float *values;
+	double *counts;
+	values = (float*) malloc( runs * sizeof(float) );
+	counts = (double*) calloc( runs, sizeof(double) );
 
-		free(matrix->blockData);
-		free(matrix->blockValue);
+	if( values == NULL || counts == NULL )
+	{
+	   fprintf(stderr, "sparFloatDominant error: Out of memory\n");
+	   exit(1);
+	}
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
+	memcpy( values, runValue, runs * sizeof(float) );
+	qsort( values, runs, sizeof(float), sparFloatCompare );
+	distinct = 1;
+	for( i = 1 ; i < runs ; i++ )
+	{
+		if( sparFloatEqual( values[i], values[ distinct - 1 ] ) == 0 )
+		{
+			values[ distinct++ ] = values[i];
+		}
+	}
+
+	// Count per distinct value
+	for( i = 0 ; i < runs ; i++ )
+	{
+		float *v;
+		v = (float*) bsearch( runValue + i, values, distinct, sizeof(float), sparFloatCompare );
+		counts[ v - values ] += runCount[i];
+	}
+
+	// Most frequent, first in sorted order on ties
+	int best;
+	best = 0;
+	for( i = 1 ; i < distinct ; i++ )
+	{
+		if( counts[i] > counts[best] )
+		{
+			best = i;
+		}
 	}
+
+	float value;
+	value = values[best];
+
+	if( count != NULL )
+	{
+		*count = counts[best];
+	}
+
+	free(runValue);
+	free(runCount);
+	free(temp);
+	free(values);
+	free(counts);
+
+	return value;
 }
 
 
+
 // Matrix constructor
-sparLong* sparLongInit( int nx, int ny, int nz, int bs, long def )
+sparDouble* sparDoubleInit( int nx, int ny, int nz, int bs, double def )
 {
 	// Check matrix size
 	if( !( nx > 0 && ny > 0 && nz > 0 ) )
 	{
-		fprintf(stderr, "sparLongInit error: Matrix size must be positive\n");
+		fprintf(stderr, "sparDoubleInit error: Matrix size must be positive\n");
 		exit(1);
 	}
 
 	// Check block size
 	if( !( bs > 1 ) )
 	{
-		fprintf(stderr, "sparLongInit error: Block size must be greater than 1\n");
+		fprintf(stderr, "sparDoubleInit error: Block size must be greater than 1\n");
 		exit(1);
 	}
 
 	// Declare struct and allocate space
-	sparLong *matrix;
-	matrix = (sparLong*) malloc(sizeof(sparLong));
+	sparDouble *matrix;
+	matrix = (sparDouble*) malloc(sizeof(sparDouble));
 
 	if( matrix == NULL )
 	{
-	   fprintf(stderr, "sparLongInit error: Out of memory\n");
+	   fprintf(stderr, "sparDoubleInit error: Out of memory\n");
 	   exit(1);
 	}
 
@@ -2203,26 +24791,41 @@ sparLong* sparLongInit( int nx, int ny, int nz, int bs, long def )
 	int blocks = matrix->mx * matrix->my * matrix->mz;
 
 	// Allocate space for block uniform data
-	matrix->blockValue = (long*) calloc( blocks, sizeof(long) );
+	matrix->blockValue = (double*) calloc( blocks, sizeof(double) );
 
 	if( matrix->blockValue == NULL )
 	{
-	   fprintf(stderr, "sparLongInit error: Out of memory\n");
+	   fprintf(stderr, "sparDoubleInit error: Out of memory\n");
 	   exit(1);
 	}
 
 	// Allocate space for block heterogeneous data arrays
-	matrix->blockData = (long**) calloc( blocks, sizeof(long*) );
+	matrix->blockData = (double**) calloc( blocks, sizeof(double*) );
 
 	if( matrix->blockData == NULL )
 	{
-	   fprintf(stderr, "sparLongInit error: Out of memory\n");
+	   fprintf(stderr, "sparDoubleInit error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Allocate space for block locks, cleared below
+	matrix->blockLock = (atomic_flag*) malloc( blocks * sizeof(atomic_flag) );
+
+	if( matrix->blockLock == NULL )
+	{
+	   fprintf(stderr, "sparDoubleInit error: Out of memory\n");
 	   exit(1);
 	}
 
 	// Set default value
 	matrix->def = def;
 
+	// Set ring buffer origin. Duplicate and Map copy it, Op requires equal origins and copies it, Permute permutes it and in-place operations keep it.
+	// Crop, Downsample and InitDense leave it at zero, their storage does not follow the ring layout of a source window.
+	matrix->ox = 0;
+	matrix->oy = 0;
+	matrix->oz = 0;
+
 	// Set matrix elemets to default value
 	int i;
 	for( i = 0 ; i < blocks ; i++ )
@@ -2231,12 +24834,25 @@ sparLong* sparLongInit( int nx, int ny, int nz, int bs, long def )
 		matrix->blockValue[i] = def;
 	}
 
+	// Unlock all blocks
+	sparDoubleClearLocks( matrix );
+
 	// Return pointer
 	return matrix;
 }
 
+// Clear (unlock) every block lock, flags are not assumed clear after allocation
+void sparDoubleClearLocks( sparDouble *matrix )
+{
+	int n;
+	for( n = 0 ; n < matrix->mx * matrix->my * matrix->mz ; n++ )
+	{
+		atomic_flag_clear( &matrix->blockLock[n] );
+	}
+}
+
 // Matrix destructor
-void sparLongFree( sparLong *matrix )
+void sparDoubleFree( sparDouble *matrix )
 {
 	// Number of blocks
 	int blocks;
@@ -2258,12 +24874,15 @@ void sparLongFree( sparLong *matrix )
 	// Free block heterogeneous data array
 	free(matrix->blockData);
 
+	// Free block locks
+	free(matrix->blockLock);
+
 	// Free matrix instance
 	free(matrix);
 }
 
 // Reset matrix values
-void sparLongReset( sparLong *matrix )
+void sparDoubleReset( sparDouble *matrix )
 {
 	// Number of blocks
 	int blocks;
@@ -2284,7 +24903,7 @@ void sparLongReset( sparLong *matrix )
 }
 
 // Get matrix memory usage in bytes
-double sparLongMemory( sparLong *matrix )
+double sparDoubleMemory( sparDouble *matrix )
 {
 	// Number of blocks
 	int blocks;
@@ -2292,13 +24911,16 @@ double sparLongMemory( sparLong *matrix )
 
 	// Matrix instance
 	double size;
-	size = (double)( sizeof(sparLong) );
+	size = (double)( sizeof(sparDouble) );
 
 	// Uniform block data
-	size = size + (double)( blocks * sizeof(long) );
+	size = size + (double)( blocks * sizeof(double) );
 
 	// Heterogeneous block data arrays
-	size = size + (double)( blocks * sizeof(long*) );
+	size = size + (double)( blocks * sizeof(double*) );
+
+	// Block locks
+	size = size + (double)( blocks * sizeof(atomic_flag) );
 
 	// Heterogeneous block data
 	int i;
@@ -2307,15 +24929,32 @@ double sparLongMemory( sparLong *matrix )
 		// Heterogeneous block
 		if( matrix->blockData[i] != NULL )
 		{
-			size = size + (double)( sizeof(long) * matrix->bs3 );
+			size = size + (double)( sizeof(double) * matrix->bs3 );
 		}
 	}
 
 	return size;
 }
 
+// Element equality, NaN equal to NaN so NaN regions compress like any other uniform value
+int sparDoubleEqual( double a, double b )
+{
+	return a == b || ( isnan( (double) a ) && isnan( (double) b ) );
+}
+
+// Convert x to the data type, rounding to nearest for integer types instead of truncating
+double sparDoubleRound( double x )
+{
+	// Integer types turn 0.5 into 0
+	if( (double)( 0.5 ) == 0 )
+	{
+		return (double)( floor( x + 0.5 ) );
+	}
+	return (double)( x );
+}
+
 // Check if block is uniform
-int sparLongUniformBlock( sparLong *matrix, int x, int y, int z )
+int sparDoubleUniformBlock( sparDouble *matrix, int x, int y, int z )
 {
 	// Block size
 	int bs, bs3;
@@ -2333,7 +24972,7 @@ int sparLongUniformBlock( sparLong *matrix, int x, int y, int z )
 	n = x + mx * ( y + my * z );
 
 	// Block data array
-	long *blockData;
+	double *blockData;
 	blockData = matrix->blockData[n];
 
 	// Uniform block
@@ -2349,14 +24988,14 @@ int sparLongUniformBlock( sparLong *matrix, int x, int y, int z )
 	if( x < mx - 1 && y < my - 1 && z < mz - 1)
 	{
 		// Start with last element
-		long value;
+		double value;
 		value = blockData[ bs3 - 1 ];
 
 		// Read block elements
 		int i;
 		for( i = 0 ; i < bs3 ; i++ )
 		{
-			if( blockData[i] != value )
+			if( sparDoubleEqual( blockData[i], value ) == 0 )
 			{
 				isUniform = 0;
 				i = bs3;
@@ -2367,7 +25006,7 @@ int sparLongUniformBlock( sparLong *matrix, int x, int y, int z )
 	else
 	{
 		// Start with first element
-		long value;
+		double value;
 		value = blockData[0];
 
 		// Read block elements
@@ -2381,7 +25020,7 @@ int sparLongUniformBlock( sparLong *matrix, int x, int y, int z )
 				for( i = 0 ; i < bs ; i++ )
 				{
 					if( x * bs + i < matrix->nx ) // Idem
-					if( blockData[ i + bs * ( j + bs * k ) ] != value )
+					if( sparDoubleEqual( blockData[ i + bs * ( j + bs * k ) ], value ) == 0 )
 					{
 						isUniform = 0;
 						i = j = k = bs;
@@ -2394,8 +25033,412 @@ int sparLongUniformBlock( sparLong *matrix, int x, int y, int z )
 	return isUniform;
 }
 
+// Expand uniform block (x,y,z) into heterogeneous block data
+void sparDoubleExpandBlock( sparDouble *matrix, int x, int y, int z )
+{
+	// Linear block index (n) <-> (x,y,z)
+	int n;
+	n = x + matrix->mx * ( y + matrix->my * z );
+
+	// Already heterogeneous
+	if( matrix->blockData[n] != NULL )
+	{
+		return;
+	}
+
+	// Allocate block data
+	double *blockData;
+	blockData = (double*) calloc( matrix->bs3, sizeof(double) );
+
+	if( blockData == NULL )
+	{
+	   fprintf(stderr, "sparDoubleExpandBlock error: Out of memory\n");
+	   exit(1);
+	}
+
+	// Set uniform value
+	double value;
+	value = matrix->blockValue[n];
+
+	int i;
+	for( i = 0 ; i < matrix->bs3 ; i++ )
+	{
+		blockData[i] = value;
+	}
+
+	matrix->blockData[n] = blockData;
+}
+
+// Reduce block (x,y,z) to uniform if possible, return 1 if uniform
+int sparDoubleReduceBlock( sparDouble *matrix, int x, int y, int z )
+{
+	// Linear block index (n) <-> (x,y,z)
+	int n;
+	n = x + matrix->mx * ( y + matrix->my * z );
+
+	// Already uniform
+	if( matrix->blockData[n] == NULL )
+	{
+		return 1;
+	}
+
+	// Heterogeneous block
+	if( sparDoubleUniformBlock( matrix, x, y, z ) == 0 )
+	{
+		return 0;
+	}
+
+	// First element is always inside the matrix
+	matrix->blockValue[n] = matrix->blockData[n][0];
+	free(matrix->blockData[n]);
+	matrix->blockData[n] = NULL;
+
+	return 1;
+}
+
+// Check if every block overlapping box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) is uniform with the same value
+int sparDoubleUniformBox( sparDouble *matrix, int x, int y, int z, int sx, int sy, int sz, double *value )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return 0;
+	}
+
+	// Reference value
+	int n;
+	n = x0 / bs + matrix->mx * ( y0 / bs + matrix->my * ( z0 / bs ) );
+	*value = matrix->blockValue[n];
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+				if( matrix->blockData[n] != NULL || sparDoubleEqual( matrix->blockValue[n], *value ) == 0 )
+				{
+					return 0;
+				}
+			}
+		}
+	}
+
+	return 1;
+}
+
+// Copy box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) into buffer[i+sx*(j+sy*k)], default value outside the matrix
+void sparDoubleGetBox( sparDouble *matrix, int x, int y, int z, int sx, int sy, int sz, double *buffer )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	int i, j, k;
+
+	// Box partially outside the matrix, fill with default value
+	if( x0 != x || y0 != y || z0 != z || x1 != x + sx || y1 != y + sy || z1 != z + sz )
+	{
+		for( i = 0 ; i < sx * sy * sz ; i++ )
+		{
+			buffer[i] = matrix->def;
+		}
+	}
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+				double *blockData;
+				blockData = matrix->blockData[n];
+
+				// Copy block rows
+				for( k = bz0 ; k < bz1 ; k++ )
+				{
+					for( j = by0 ; j < by1 ; j++ )
+					{
+						double *row;
+						row = buffer + ( bx0 - x ) + sx * ( ( j - y ) + sy * ( k - z ) );
+
+						// Uniform block
+						if( blockData == NULL )
+						{
+							double value;
+							value = matrix->blockValue[n];
+							for( i = 0 ; i < bx1 - bx0 ; i++ )
+							{
+								row[i] = value;
+							}
+						}
+						// Heterogeneous block
+						else
+						{
+							memcpy( row, blockData + ( bx0 - i1 * bs ) + bs * ( ( j - j1 * bs ) + bs * ( k - k1 * bs ) ),
+									( bx1 - bx0 ) * sizeof(double) );
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// Copy buffer[i+sx*(j+sy*k)] into box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1), elements outside the matrix are ignored
+void sparDoubleSetBox( sparDouble *matrix, int x, int y, int z, int sx, int sy, int sz, double *buffer )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	int i, j, k;
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+				// Block elements inside the matrix are fully covered
+				int covered;
+				covered = bx0 == i1 * bs && by0 == j1 * bs && bz0 == k1 * bs &&
+						  ( bx1 == ( i1 + 1 ) * bs || bx1 == matrix->nx ) &&
+						  ( by1 == ( j1 + 1 ) * bs || by1 == matrix->ny ) &&
+						  ( bz1 == ( k1 + 1 ) * bs || bz1 == matrix->nz );
+
+				// Covered block, check if input is uniform first
+				if( covered )
+				{
+					double value;
+					value = buffer[ ( bx0 - x ) + sx * ( ( by0 - y ) + sy * ( bz0 - z ) ) ];
+
+					int isUniform;
+					isUniform = 1;
+					for( k = bz0 ; k < bz1 && isUniform ; k++ )
+					{
+						for( j = by0 ; j < by1 && isUniform ; j++ )
+						{
+							double *row;
+							row = buffer + ( bx0 - x ) + sx * ( ( j - y ) + sy * ( k - z ) );
+							for( i = 0 ; i < bx1 - bx0 ; i++ )
+							{
+								if( sparDoubleEqual( row[i], value ) == 0 )
+								{
+									isUniform = 0;
+									break;
+								}
+							}
+						}
+					}
+
+					if( isUniform )
+					{
+						if( matrix->blockData[n] != NULL )
+						{
+							free(matrix->blockData[n]);
+							matrix->blockData[n] = NULL;
+						}
+						matrix->blockValue[n] = value;
+						continue;
+					}
+				}
+
+				// Copy block rows into heterogeneous block
+				sparDoubleExpandBlock( matrix, i1, j1, k1 );
+
+				double *blockData;
+				blockData = matrix->blockData[n];
+
+				for( k = bz0 ; k < bz1 ; k++ )
+				{
+					for( j = by0 ; j < by1 ; j++ )
+					{
+						memcpy( blockData + ( bx0 - i1 * bs ) + bs * ( ( j - j1 * bs ) + bs * ( k - k1 * bs ) ),
+								buffer + ( bx0 - x ) + sx * ( ( j - y ) + sy * ( k - z ) ),
+								( bx1 - bx0 ) * sizeof(double) );
+					}
+				}
+
+				// Partially covered blocks may have become uniform
+				if( !covered )
+				{
+					sparDoubleReduceBlock( matrix, i1, j1, k1 );
+				}
+			}
+		}
+	}
+}
+
+// Set every element of box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) to value, elements outside the matrix are ignored
+void sparDoubleFillBox( sparDouble *matrix, int x, int y, int z, int sx, int sy, int sz, double value )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	int i, j, k;
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
+		{
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
+			{
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+				// Block elements inside the matrix are fully covered, uniform block
+				if( bx0 == i1 * bs && by0 == j1 * bs && bz0 == k1 * bs &&
+					( bx1 == ( i1 + 1 ) * bs || bx1 == matrix->nx ) &&
+					( by1 == ( j1 + 1 ) * bs || by1 == matrix->ny ) &&
+					( bz1 == ( k1 + 1 ) * bs || bz1 == matrix->nz ) )
+				{
+					if( matrix->blockData[n] != NULL )
+					{
+						free(matrix->blockData[n]);
+						matrix->blockData[n] = NULL;
+					}
+					matrix->blockValue[n] = value;
+					continue;
+				}
+
+				// Already uniform with the same value
+				if( matrix->blockData[n] == NULL && sparDoubleEqual( matrix->blockValue[n], value ) )
+				{
+					continue;
+				}
+
+				// Fill block rows and reduce if possible
+				sparDoubleExpandBlock( matrix, i1, j1, k1 );
+
+				double *blockData;
+				blockData = matrix->blockData[n];
+
+				for( k = bz0 ; k < bz1 ; k++ )
+				{
+					for( j = by0 ; j < by1 ; j++ )
+					{
+						double *row;
+						row = blockData + ( bx0 - i1 * bs ) + bs * ( ( j - j1 * bs ) + bs * ( k - k1 * bs ) );
+						for( i = 0 ; i < bx1 - bx0 ; i++ )
+						{
+							row[i] = value;
+						}
+					}
+				}
+
+				sparDoubleReduceBlock( matrix, i1, j1, k1 );
+			}
+		}
+	}
+}
+
 // Set matrix element (x,y,z)
-void sparLongSet( sparLong *matrix, int x, int y, int z, long value )
+void sparDoubleSet( sparDouble *matrix, int x, int y, int z, double value )
 {
 	// Block size
 	int bs, bs3;
@@ -2419,26 +25462,26 @@ void sparLongSet( sparLong *matrix, int x, int y, int z, long value )
 	n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
 
 	// Block uniform value
-	long blockValue;
+	double blockValue;
 	blockValue = matrix->blockValue[n];
 
 	// Block data array
-	long *blockData;
+	double *blockData;
 	blockData = matrix->blockData[n];
 
 	// Uniform block
 	if( blockData == NULL )
 	{
 		// Input value is different
-		if( value != blockValue )
+		if( sparDoubleEqual( value, blockValue ) == 0 )
 		{
 			// Expand block
-			blockData = (long*) calloc( bs3, sizeof(long) );
+			blockData = (double*) calloc( bs3, sizeof(double) );
 			matrix->blockData[n] = blockData;
 
 			if( blockData == NULL )
 			{
-			   fprintf(stderr, "sparLongSet error: Out of memory\n");
+			   fprintf(stderr, "sparDoubleSet error: Out of memory\n");
 			   exit(1);
 			}
 
@@ -2461,7 +25504,7 @@ void sparLongSet( sparLong *matrix, int x, int y, int z, long value )
 		blockData[ i2 + bs * ( j2 + bs * k2 ) ] = value;
 
 		// Reduce block
-		if( sparLongUniformBlock( matrix, i1, j1, k1 ) )
+		if( sparDoubleUniformBlock( matrix, i1, j1, k1 ) )
 		{
 			matrix->blockValue[n] = value;
 			free(matrix->blockData[n]);
@@ -2471,7 +25514,7 @@ void sparLongSet( sparLong *matrix, int x, int y, int z, long value )
 }
 
 // Get matrix element (x,y,z)
-long sparLongGet( sparLong *matrix, int x, int y, int z )
+double sparDoubleGet( sparDouble *matrix, int x, int y, int z )
 {
 	// Block size
 	int bs;
@@ -2487,7 +25530,7 @@ long sparLongGet( sparLong *matrix, int x, int y, int z )
 	int n;
 	n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
 
-	long *blockData;
+	double *blockData;
 	blockData = matrix->blockData[n];
 
 	// Uniform block
@@ -2508,14 +25551,64 @@ long sparLongGet( sparLong *matrix, int x, int y, int z )
 	}
 }
 
+// Set matrix element (x,y,z) locking its block, safe for parallel writers
+void sparDoubleSetSafe( sparDouble *matrix, int x, int y, int z, double value )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Linear block index (n) <-> (x/bs,y/bs,z/bs)
+	int n;
+	n = x / bs + matrix->mx * ( y / bs + matrix->my * ( z / bs ) );
+
+	// Acquire block lock
+	while( atomic_flag_test_and_set_explicit( &matrix->blockLock[n], memory_order_acquire ) );
+
+	// Set element, may expand or reduce the block
+	sparDoubleSet( matrix, x, y, z, value );
+
+	// Release block lock
+	atomic_flag_clear_explicit( &matrix->blockLock[n], memory_order_release );
+}
+
+// Get matrix element (x,y,z) locking its block, safe with parallel writers
+double sparDoubleGetSafe( sparDouble *matrix, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Linear block index (n) <-> (x/bs,y/bs,z/bs)
+	int n;
+	n = x / bs + matrix->mx * ( y / bs + matrix->my * ( z / bs ) );
+
+	// Acquire block lock
+	while( atomic_flag_test_and_set_explicit( &matrix->blockLock[n], memory_order_acquire ) );
+
+	// Get element
+	double value;
+	value = sparDoubleGet( matrix, x, y, z );
+
+	// Release block lock
+	atomic_flag_clear_explicit( &matrix->blockLock[n], memory_order_release );
+
+	return value;
+}
+
 // Duplicate matrix
-sparLong* sparLongDuplicate( sparLong *matrix )
+sparDouble* sparDoubleDuplicate( sparDouble *matrix )
 {
 	// Declare matrix and init
-	sparLong *matrix2;
-	matrix2 = sparLongInit( matrix->nx, matrix->ny, matrix->nz,
+	sparDouble *matrix2;
+	matrix2 = sparDoubleInit( matrix->nx, matrix->ny, matrix->nz,
 						matrix->bs, matrix->def );
 
+	// Copy ring buffer origin
+	matrix2->ox = matrix->ox;
+	matrix2->oy = matrix->oy;
+	matrix2->oz = matrix->oz;
+
 	// Number of blocks
 	int blocks;
 	blocks = matrix2->mx * matrix2->my * matrix2->mz;
@@ -2528,16 +25621,16 @@ sparLong* sparLongDuplicate( sparLong *matrix )
 		if( matrix->blockData[i] != NULL )
 		{
 			// Allocate space for block data
-			matrix2->blockData[i] = (long*) calloc( matrix2->bs3, sizeof(long) );
+			matrix2->blockData[i] = (double*) calloc( matrix2->bs3, sizeof(double) );
 
 			if( matrix2->blockData[i] == NULL )
 			{
-			   fprintf(stderr, "sparLongDuplicate error: Out of memory\n");
+			   fprintf(stderr, "sparDoubleDuplicate error: Out of memory\n");
 			   exit(1);
 			}
 
 			// Copy block data
-			memcpy( matrix2->blockData[i], matrix->blockData[i], matrix2->bs3 * sizeof(long) );
+			memcpy( matrix2->blockData[i], matrix->blockData[i], matrix2->bs3 * sizeof(double) );
 		}
 		// Uniform block
 		else
@@ -2551,11 +25644,11 @@ sparLong* sparLongDuplicate( sparLong *matrix )
 }
 
 // Get matrix memory usage in bytes under certain block size
-double sparLongMemoryBs( sparLong *matrix, int bs )
+double sparDoubleMemoryBs( sparDouble *matrix, int bs )
 {
 	if( bs == matrix->bs )
 	{
-		return sparLongMemory( matrix );
+		return sparDoubleMemory( matrix );
 	}
 
 	// Matrix size (nx,ny,nz)
@@ -2580,18 +25673,21 @@ double sparLongMemoryBs( sparLong *matrix, int bs )
 
 	// Size of matrix instance
 	double size;
-	size = (double)( sizeof(sparLong) );
+	size = (double)( sizeof(sparDouble) );
 
 	// Size of uniform block data
-	size = size + (double)( blocks * sizeof(long) );
+	size = size + (double)( blocks * sizeof(double) );
 
 	// Size of heterogeneous block data arrays
-	size = size + (double)( blocks * sizeof(long*) );
+	size = size + (double)( blocks * sizeof(double*) );
+
+	// Size of block locks
+	size = size + (double)( blocks * sizeof(atomic_flag) );
 
 	int i, j, k;
 	int i1, j1, k1;
 	int isUniform;
-	long value;
+	double value;
 
 	// For each virtual block
 	for( k1 = 0 ; k1 < mz ; k1++ )
@@ -2602,7 +25698,7 @@ double sparLongMemoryBs( sparLong *matrix, int bs )
 			{
 				// Check if block is uniform 
 				isUniform = 1;
-				value = sparLongGet( matrix, i1 * bs, j1 * bs, k1 * bs );
+				value = sparDoubleGet( matrix, i1 * bs, j1 * bs, k1 * bs );
 				for( k = k1 * bs ; k < ( k1 + 1 ) * bs ; k++ )
 				{
 					if( k < nz ) // Avoid outside elements
@@ -2612,7 +25708,7 @@ double sparLongMemoryBs( sparLong *matrix, int bs )
 						for( i = i1 * bs ; i < ( i1 + 1 ) * bs ; i++ )
 						{
 							if( i < nx ) // Idem
-							if( sparLongGet( matrix, i, j, k ) != value )
+							if( sparDoubleEqual( sparDoubleGet( matrix, i, j, k ), value ) == 0 )
 							{
 								isUniform = 0;
 								i = ( i1 + 1 ) * bs;
@@ -2624,7 +25720,7 @@ double sparLongMemoryBs( sparLong *matrix, int bs )
 				}
 				if( isUniform == 0 )
 				{
-					size = size + (double)( sizeof(long) * bs3 );
+					size = size + (double)( sizeof(double) * bs3 );
 				}
 			}
 		}
@@ -2634,7 +25730,7 @@ double sparLongMemoryBs( sparLong *matrix, int bs )
 }
 
 // Change matrix block size
-void sparLongChangeBs( sparLong *matrix, int bs )
+void sparDoubleChangeBs( sparDouble *matrix, int bs )
 {
 	// Matrix size (nx,ny,nz)
 	int nx, ny, nz;
@@ -2643,12 +25739,12 @@ void sparLongChangeBs( sparLong *matrix, int bs )
 	nz = matrix->nz;
 
 	// Default value
-	long def;
+	double def;
 	def = matrix->def;
 
 	// Declare temporal matrix and init
-	sparLong *matrix2;
-	matrix2 = sparLongInit( nx, ny, nz, bs, def );
+	sparDouble *matrix2;
+	matrix2 = sparDoubleInit( nx, ny, nz, bs, def );
 
 	// Copy values and clear original matrix
 	int i, j, k;
@@ -2659,10 +25755,10 @@ void sparLongChangeBs( sparLong *matrix, int bs )
 			for( i=0 ; i<nx ; i++ )
 			{
 				// Copy element
-				sparLongSet( matrix2, i, j, k, sparLongGet( matrix, i, j, k ) );
+				sparDoubleSet( matrix2, i, j, k, sparDoubleGet( matrix, i, j, k ) );
 
 				// Set uniform to free memory
-				sparLongSet( matrix, i, j, k, def);
+				sparDoubleSet( matrix, i, j, k, def);
 			}
 		}
 	}
@@ -2677,17 +25773,22 @@ void sparLongChangeBs( sparLong *matrix, int bs )
 	// Free old blocks
 	free(matrix->blockValue);
 	free(matrix->blockData);
+	free(matrix->blockLock);
 
 	// Copy new blocks
 	matrix->blockValue = matrix2->blockValue;
 	matrix->blockData = matrix2->blockData;
+	matrix->blockLock = matrix2->blockLock;
+
+	// Unlock all blocks of the new grid
+	sparDoubleClearLocks( matrix );
 
 	// Free temporal matrix
 	free(matrix2);
 }
 
 // Optimize matrix block size
-void sparLongOptimizeBs( sparLong *matrix )
+void sparDoubleOptimizeBs( sparDouble *matrix )
 {
 	// Test block size and store optimal
 	int bestBs;
@@ -2695,12 +25796,12 @@ void sparLongOptimizeBs( sparLong *matrix )
 	int bs[10] = { 2, 3, 4, 6, 8, 10 };
 
 	bestBs = bs[0];
-	bestMemory = sparLongMemoryBs( matrix, bs[0] );
+	bestMemory = sparDoubleMemoryBs( matrix, bs[0] );
 
 	int i;
 	for( i=1 ; i<6 ; i++ )
 	{
-		memory = sparLongMemoryBs( matrix, bs[i] );
+		memory = sparDoubleMemoryBs( matrix, bs[i] );
 		if( memory < bestMemory )
 		{
 			bestBs = bs[i];
@@ -2709,16 +25810,16 @@ void sparLongOptimizeBs( sparLong *matrix )
 	}
 
 	// Change matrix block size
-	sparLongChangeBs( matrix, bestBs );
+	sparDoubleChangeBs( matrix, bestBs );
 }
 
 // Resize matrix
-void sparLongResize( sparLong *matrix, int nx, int ny, int nz )
+void sparDoubleResize( sparDouble *matrix, int nx, int ny, int nz )
 {
 	// Check matrix size
 	if( !( nx > 0 && ny > 0 && nz > 0 ) )
 	{
-		fprintf(stderr, "sparLongResize error: Matrix size must be positive\n");
+		fprintf(stderr, "sparDoubleResize error: Matrix size must be positive\n");
 		exit(1);
 	}
 
@@ -2727,585 +25828,639 @@ void sparLongResize( sparLong *matrix, int nx, int ny, int nz )
 	bs = matrix->bs;
 
 	// Default value
-	long def;
+	double def;
 	def = matrix->def;
 
-	// Block grid size
+	// New block grid size
 	int mx, my, mz;
+	mx = (int)( ( nx + bs - 1 ) / bs );
+	my = (int)( ( ny + bs - 1 ) / bs );
+	mz = (int)( ( nz + bs - 1 ) / bs );
 
 	// New block data
-	long *blockValue;
-	long **blockData;
+	double *blockValue;
+	double **blockData;
 
-	int i, j, k;
 	int blocks;
+	blocks = mx * my * mz;
+	blockValue = (double*) calloc( blocks, sizeof(double) ); // Sets to 0s
+	blockData = (double**) calloc( blocks, sizeof(double*) ); // Sets to NULLs
 
-	// Expand x
-	if( nx > matrix->nx )
+	if( blockValue == NULL || blockData == NULL )
 	{
-		// New block grid size
-		mx = (int)( ( nx + bs - 1 ) / bs );
-		my = matrix->my;
-		mz = matrix->mz;
-
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (long*) calloc( blocks, sizeof(long) ); // Sets to 0s
-		blockData = (long**) calloc( blocks, sizeof(long*) ); // Sets to NULLs
+	   fprintf(stderr, "sparDoubleResize error: Out of memory\n");
+	   exit(1);
+	}
 
-		if( blockValue == NULL || blockData == NULL )
-		{
-		   fprintf(stderr, "sparLongResize error: Out of memory\n");
-		   exit(1);
-		}
+	int i, j, k;
 
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+	// Move existing blocks, create new blocks
+	for( k = 0 ; k < mz ; k++ )
+	{
+		for( j = 0 ; j < my ; j++ )
 		{
-			for( j = 0 ; j < my ; j++ )
+			for( i = 0 ; i < mx ; i++ )
 			{
-				for( i = 0 ; i < matrix->mx ; i++ )
+				if( i < matrix->mx && j < matrix->my && k < matrix->mz )
 				{
 					blockValue[ i + mx * ( j + my * k ) ]
 						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
 					blockData[ i + mx * ( j + my * k ) ]
 						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
 				}
-			}
-		}
-		// Create new blocks
-		for( k = 0 ; k < mz ; k++ )
-		{
-			for( j = 0 ; j < my ; j++ )
-			{
-				for( i = matrix->mx ; i < mx ; i++ )
+				else
 				{
-					blockValue[ i + mx * ( j +  my * k ) ] = def;
-					blockData[ i + mx * ( j +  my * k ) ] = NULL;
+					blockValue[ i + mx * ( j + my * k ) ] = def;
 				}
 			}
 		}
+	}
 
-		int xi, xf;
-		xi = matrix->nx;
-		xf = matrix->bs * matrix->mx;
-		if( xf >= nx )
-		{
-			xf = nx - 1;
-		}
-
-		matrix->nx = nx;
-		matrix->mx = mx;
-
-		free(matrix->blockData);
-		free(matrix->blockValue);
-
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
-
-		// Set expanded elements to default
-		for( k = 0 ; k < matrix->nz ; k++ )
+	// Free excedent blocks
+	for( k = 0 ; k < matrix->mz ; k++ )
+	{
+		for( j = 0 ; j < matrix->my ; j++ )
 		{
-			for( j = 0 ; j < matrix->ny ; j++ )
+			for( i = 0 ; i < matrix->mx ; i++ )
 			{
-				for( i = xi ; i < xf ; i++ )
+				if( ( i >= mx || j >= my || k >= mz ) &&
+					matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
 				{
-					sparLongSet( matrix, i, j, k, def );
+					free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
 				}
 			}
 		}
 	}
-	// Shrink x
-	else if( nx < matrix->nx )
-	{
-		// New block grid size
-		mx = (int)( ( nx + bs - 1 ) / bs );
-		my = matrix->my;
-		mz = matrix->mz;
-
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (long*) calloc( blocks, sizeof(long) ); // Sets to 0s
-		blockData = (long**) calloc( blocks, sizeof(long*) ); // Sets to NULLs
-
-		if( blockValue == NULL || blockData == NULL )
-		{
-		   fprintf(stderr, "sparLongResize error: Out of memory\n");
-		   exit(1);
-		}
 
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
-		{
-			for( j = 0 ; j < my ; j++ )
-			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
-				}
-			}
-		}
+	// Previous matrix size
+	int ox, oy, oz;
+	ox = matrix->nx;
+	oy = matrix->ny;
+	oz = matrix->nz;
 
-		// Free excedent blocks
-		for( k = 0 ; k < mz ; k++ )
-		{
-			for( j = 0 ; j < my ; j++ )
-			{
-				for( i = mx ; i < matrix->mx ; i++ )
-				{
-					if( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
-					{
-						free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
-					}
-				}
-			}
-		}
+	matrix->nx = nx;
+	matrix->ny = ny;
+	matrix->nz = nz;
+	matrix->mx = mx;
+	matrix->my = my;
+	matrix->mz = mz;
 
-		matrix->nx = nx;
-		matrix->mx = mx;
+	free(matrix->blockData);
+	free(matrix->blockValue);
 
-		free(matrix->blockData);
-		free(matrix->blockValue);
+	matrix->blockData = blockData;
+	matrix->blockValue = blockValue;
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
+	// Set expanded elements of previous boundary blocks to default, block by block
+	if( nx > ox )
+	{
+		sparDoubleFillBox( matrix, ox, 0, 0, nx - ox, ny, nz, def );
 	}
-
-	// Expand y
-	if( ny > matrix->ny )
+	if( ny > oy )
 	{
-		// New block grid size
-		mx = matrix->mx;
-		my = (int)( ( ny + bs - 1 ) / bs );
-		mz = matrix->mz;
-
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (long*) calloc( blocks, sizeof(long) ); // Sets to 0s
-		blockData = (long**) calloc( blocks, sizeof(long*) ); // Sets to NULLs
+		sparDoubleFillBox( matrix, 0, oy, 0, nx, ny - oy, nz, def );
+	}
+	if( nz > oz )
+	{
+		sparDoubleFillBox( matrix, 0, 0, oz, nx, ny, nz - oz, def );
+	}
 
-		if( blockValue == NULL || blockData == NULL )
-		{
-		   fprintf(stderr, "sparLongResize error: Out of memory\n");
-		   exit(1);
-		}
+	// Reallocate block locks for the new block grid
+	free(matrix->blockLock);
+	matrix->blockLock = (atomic_flag*) malloc( matrix->mx * matrix->my * matrix->mz * sizeof(atomic_flag) );
 
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
-		{
-			for( j = 0 ; j < matrix->my ; j++ )
-			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
-				}
-			}
-		}
-		// Create new blocks
-		for( k = 0 ; k < mz ; k++ )
-		{
-			for( j = matrix->my ; j < my ; j++ )
-			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j +  my * k ) ] = def;
-					blockData[ i + mx * ( j +  my * k ) ] = NULL;
-				}
-			}
-		}
+	if( matrix->blockLock == NULL )
+	{
+	   fprintf(stderr, "sparDoubleResize error: Out of memory\n");
+	   exit(1);
+	}
 
-		int yi, yf;
-		yi = matrix->ny;
-		yf = matrix->bs * matrix->my;
-		if( yf >= ny )
-		{
-			yf = ny - 1;
-		}
+	sparDoubleClearLocks( matrix );
+}
 
-		matrix->ny = ny;
-		matrix->my = my;
+// Sum of matrix elements
+double sparDoubleSum( sparDouble *matrix )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
 
-		free(matrix->blockData);
-		free(matrix->blockValue);
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
+	double sum;
+	sum = 0.0;
 
-		// Set expanded elements to default
-		for( k = 0 ; k < matrix->nz ; k++ )
-		{
-			for( j = yi ; j < yf ; j++ )
-			{
-				for( i = 0 ; i < matrix->nx ; i++ )
-				{
-					sparLongSet( matrix, i, j, k, def );
-				}
-			}
-		}
-	}
-	// Shrink y
-	else if( ny < matrix->ny )
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:sum) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
 	{
-		// New block grid size
-		mx = matrix->mx;
-		my = (int)( ( ny + bs - 1 ) / bs );
-		mz = matrix->mz;
-
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (long*) calloc( blocks, sizeof(long) ); // Sets to 0s
-		blockData = (long**) calloc( blocks, sizeof(long*) ); // Sets to NULLs
-
-		if( blockValue == NULL || blockData == NULL )
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		double *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, value times element count
+		if( blockData == NULL )
 		{
-		   fprintf(stderr, "sparLongResize error: Out of memory\n");
-		   exit(1);
+			sum += (double)( matrix->blockValue[n] ) * ex * ey * ez;
 		}
-
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
 		{
-			for( j = 0 ; j < my ; j++ )
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
-				}
+				sum += (double)( blockData[i] );
 			}
 		}
-
-		// Free excedent blocks
-		for( k = 0 ; k < mz ; k++ )
+		// Boundary heterogeneous block, skip outside elements
+		else
 		{
-			for( j = my ; j < matrix->my ; j++ )
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				for( j = 0 ; j < ey ; j++ )
 				{
-					if( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
+					double *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
 					{
-						free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
+						sum += (double)( row[i] );
 					}
 				}
 			}
 		}
-
-		matrix->ny = ny;
-		matrix->my = my;
-
-		free(matrix->blockData);
-		free(matrix->blockValue);
-
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
 	}
 
-	// Expand z
-	if( nz > matrix->nz )
-	{
-		// New block grid size
-		mx = matrix->mx;
-		my = matrix->my;
-		mz = (int)( ( nz + bs - 1 ) / bs );
+	return sum;
+}
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (long*) calloc( blocks, sizeof(long) ); // Sets to 0s
-		blockData = (long**) calloc( blocks, sizeof(long*) ); // Sets to NULLs
+// First matrix element in block order that is not NaN, NaN only if every element is NaN
+double sparDoubleFirstNumber( sparDouble *matrix )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
 
-		if( blockValue == NULL || blockData == NULL )
-		{
-		   fprintf(stderr, "sparLongResize error: Out of memory\n");
-		   exit(1);
-		}
+	// For each block
+	int n;
+	for( n = 0 ; n < matrix->mx * matrix->my * matrix->mz ; n++ )
+	{
+		double *blockData;
+		blockData = matrix->blockData[n];
 
-		// Copy existing blocks
-		for( k = 0 ; k < matrix->mz ; k++ )
-		{
-			for( j = 0 ; j < my ; j++ )
-			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
-				}
-			}
-		}
-		// Create new blocks
-		for( k = matrix->mz ; k < mz ; k++ )
+		// Uniform block
+		if( blockData == NULL )
 		{
-			for( j = 0 ; j < my ; j++ )
+			if( !isnan( (double) matrix->blockValue[n] ) )
 			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j +  my * k ) ] = def;
-					blockData[ i + mx * ( j +  my * k ) ] = NULL;
-				}
+				return matrix->blockValue[n];
 			}
+			continue;
 		}
 
-		int zi, zf;
-		zi = matrix->nz;
-		zf = matrix->bs * matrix->mz;
-		if( zf >= nz )
-		{
-			zf = nz - 1;
-		}
-
-		matrix->nz = nz;
-		matrix->mz = mz;
-
-		free(matrix->blockData);
-		free(matrix->blockValue);
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % matrix->mx;
+		j1 = ( n / matrix->mx ) % matrix->my;
+		k1 = n / ( matrix->mx * matrix->my );
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs < bs ? matrix->nx - i1 * bs : bs;
+		ey = matrix->ny - j1 * bs < bs ? matrix->ny - j1 * bs : bs;
+		ez = matrix->nz - k1 * bs < bs ? matrix->nz - k1 * bs : bs;
 
-		// Set expanded elements to default
-		for( k = zi ; k < zf ; k++ )
+		// Heterogeneous block, skip outside elements
+		int i, j, k;
+		for( k = 0 ; k < ez ; k++ )
 		{
-			for( j = 0 ; j < matrix->ny ; j++ )
+			for( j = 0 ; j < ey ; j++ )
 			{
-				for( i = 0 ; i < matrix->nx ; i++ )
+				for( i = 0 ; i < ex ; i++ )
 				{
-					sparLongSet( matrix, i, j, k, def );
+					if( !isnan( (double) blockData[ i + bs * ( j + bs * k ) ] ) )
+					{
+						return blockData[ i + bs * ( j + bs * k ) ];
+					}
 				}
 			}
 		}
 	}
-	// Shrink z
-	else if( nz < matrix->nz )
+
+	return sparDoubleGet( matrix, 0, 0, 0 );
+}
+
+// Minimum matrix element, NaN elements ignored (NaN only if all are NaN)
+double sparDoubleMin( sparDouble *matrix )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Start with an element that is not NaN, comparisons with NaN are false so NaN never replaces it
+	double value;
+	value = sparDoubleFirstNumber( matrix );
+
+	// Every element is NaN
+	if( isnan( (double) value ) )
 	{
-		// New block grid size
-		mx = matrix->mx;
-		my = matrix->my;
-		mz = (int)( ( nz + bs - 1 ) / bs );
+		return value;
+	}
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (long*) calloc( blocks, sizeof(long) ); // Sets to 0s
-		blockData = (long**) calloc( blocks, sizeof(long*) ); // Sets to NULLs
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(min:value) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		double *blockData;
+		blockData = matrix->blockData[n];
 
-		if( blockValue == NULL || blockData == NULL )
+		// Uniform block
+		if( blockData == NULL )
 		{
-		   fprintf(stderr, "sparLongResize error: Out of memory\n");
-		   exit(1);
+			if( matrix->blockValue[n] < value )
+			{
+				value = matrix->blockValue[n];
+			}
 		}
-
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
 		{
-			for( j = 0 ; j < my ; j++ )
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
-				}
+				value = blockData[i] < value ? blockData[i] : value;
 			}
 		}
-
-		// Free excedent blocks
-		for( k = mz ; k < matrix->mz ; k++ )
+		// Boundary heterogeneous block, skip outside elements
+		else
 		{
-			for( j = 0 ; j < my ; j++ )
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				for( j = 0 ; j < ey ; j++ )
 				{
-					if( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
+					double *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
 					{
-						free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
+						value = row[i] < value ? row[i] : value;
 					}
 				}
 			}
 		}
-
-		matrix->nz = nz;
-		matrix->mz = mz;
-
-		free(matrix->blockData);
-		free(matrix->blockValue);
-
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
 	}
-}
 
+	return value;
+}
 
-// Matrix constructor
-sparFloat* sparFloatInit( int nx, int ny, int nz, int bs, float def )
+// Maximum matrix element, NaN elements ignored (NaN only if all are NaN)
+double sparDoubleMax( sparDouble *matrix )
 {
-	// Check matrix size
-	if( !( nx > 0 && ny > 0 && nz > 0 ) )
-	{
-		fprintf(stderr, "sparFloatInit error: Matrix size must be positive\n");
-		exit(1);
-	}
-
-	// Check block size
-	if( !( bs > 1 ) )
-	{
-		fprintf(stderr, "sparFloatInit error: Block size must be greater than 1\n");
-		exit(1);
-	}
-
-	// Declare struct and allocate space
-	sparFloat *matrix;
-	matrix = (sparFloat*) malloc(sizeof(sparFloat));
-
-	if( matrix == NULL )
-	{
-	   fprintf(stderr, "sparFloatInit error: Out of memory\n");
-	   exit(1);
-	}
-
-	// Set matrix size (nx,ny,nz)
-	matrix->nx = nx;
-	matrix->ny = ny;
-	matrix->nz = nz;
-
-	// Set block size (bs,bs,bs)
-	matrix->bs  = bs;
-	matrix->bs3 = bs * bs * bs;
-
-	// Set block matrix size (mx,my,mz)
-	matrix->mx = (int)( ( nx + bs - 1 ) / bs );
-	matrix->my = (int)( ( ny + bs - 1 ) / bs );
-	matrix->mz = (int)( ( nz + bs - 1 ) / bs );
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
 
-	// Number of blocks
-	int blocks = matrix->mx * matrix->my * matrix->mz;
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
 
-	// Allocate space for block uniform data
-	matrix->blockValue = (float*) calloc( blocks, sizeof(float) );
+	// Start with an element that is not NaN, comparisons with NaN are false so NaN never replaces it
+	double value;
+	value = sparDoubleFirstNumber( matrix );
 
-	if( matrix->blockValue == NULL )
+	// Every element is NaN
+	if( isnan( (double) value ) )
 	{
-	   fprintf(stderr, "sparFloatInit error: Out of memory\n");
-	   exit(1);
+		return value;
 	}
 
-	// Allocate space for block heterogeneous data arrays
-	matrix->blockData = (float**) calloc( blocks, sizeof(float*) );
-
-	if( matrix->blockData == NULL )
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(max:value) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
 	{
-	   fprintf(stderr, "sparFloatInit error: Out of memory\n");
-	   exit(1);
-	}
-
-	// Set default value
-	matrix->def = def;
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		double *blockData;
+		blockData = matrix->blockData[n];
 
-	// Set matrix elemets to default value
-	int i;
-	for( i = 0 ; i < blocks ; i++ )
-	{
-		matrix->blockData[i] = NULL; // Flag for uniform block
-		matrix->blockValue[i] = def;
+		// Uniform block
+		if( blockData == NULL )
+		{
+			if( matrix->blockValue[n] > value )
+			{
+				value = matrix->blockValue[n];
+			}
+		}
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
+		{
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				value = blockData[i] > value ? blockData[i] : value;
+			}
+		}
+		// Boundary heterogeneous block, skip outside elements
+		else
+		{
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					double *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						value = row[i] > value ? row[i] : value;
+					}
+				}
+			}
+		}
 	}
 
-	// Return pointer
-	return matrix;
+	return value;
 }
 
-// Matrix destructor
-void sparFloatFree( sparFloat *matrix )
+// Number of matrix elements different from the default value
+double sparDoubleCount( sparDouble *matrix )
 {
-	// Number of blocks
-	int blocks;
-	blocks = matrix->mx * matrix->my * matrix->mz;
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
 
-	// Free heterogeneous blocks
-	int i;
-	for( i = 0 ; i < blocks ; i++ )
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Default value
+	double def;
+	def = matrix->def;
+
+	double count;
+	count = 0.0;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:count) schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
 	{
-		if( matrix->blockData[i] != NULL ) // Flag for uniform block
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		double *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, all or none of its elements
+		if( blockData == NULL )
 		{
-			free( matrix->blockData[i] );
+			if( sparDoubleEqual( matrix->blockValue[n], def ) == 0 )
+			{
+				count += (double)( ex * ey * ez );
+			}
+		}
+		// Inner heterogeneous block
+		else if( ex == bs && ey == bs && ez == bs )
+		{
+			int i, c;
+			c = 0;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				c += ( sparDoubleEqual( blockData[i], def ) == 0 );
+			}
+			count += (double)( c );
+		}
+		// Boundary heterogeneous block, skip outside elements
+		else
+		{
+			int i, j, k, c;
+			c = 0;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					double *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						c += ( sparDoubleEqual( row[i], def ) == 0 );
+					}
+				}
+			}
+			count += (double)( c );
 		}
 	}
 
-	// Free block uniform data
-	free(matrix->blockValue);
-
-	// Free block heterogeneous data array
-	free(matrix->blockData);
-
-	// Free matrix instance
-	free(matrix);
+	return count;
 }
 
-// Reset matrix values
-void sparFloatReset( sparFloat *matrix )
+// Fold f over matrix elements from identity, f gets each uniform block once with its element count
+double sparDoubleReduce( sparDouble *matrix, double (*f)( double acc, double value, int count ), double identity )
 {
-	// Number of blocks
-	int blocks;
-	blocks = matrix->mx * matrix->my * matrix->mz;
+	// Block size
+	int bs;
+	bs = matrix->bs;
 
-	// Reduce blocks and set to default value
-	int i;
-	for( i = 0 ; i < blocks ; i++ )
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	double acc;
+	acc = identity;
+
+	// For each block, sequential so f needs no combine step
+	int n;
+	for( n = 0 ; n < mx * my * mz ; n++ )
 	{
-		// Heterogeneous block
-		if( matrix->blockData[i] != NULL )
+		// Block (i1,j1,k1) <-> (n)
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - i1 * bs;
+		ey = matrix->ny - j1 * bs;
+		ez = matrix->nz - k1 * bs;
+		if( ex > bs ) ex = bs;
+		if( ey > bs ) ey = bs;
+		if( ez > bs ) ez = bs;
+
+		double *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, a single call for all its elements
+		if( blockData == NULL )
 		{
-			free( matrix->blockData[i] );
-			matrix->blockData[i] = NULL;
+			acc = f( acc, matrix->blockValue[n], ex * ey * ez );
+		}
+		// Heterogeneous block, skip outside elements
+		else
+		{
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					double *row;
+					row = blockData + bs * ( j + bs * k );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						acc = f( acc, row[i], 1 );
+					}
+				}
+			}
 		}
-		matrix->blockValue[i] = matrix->def;
 	}
+
+	return acc;
 }
 
-// Get matrix memory usage in bytes
-double sparFloatMemory( sparFloat *matrix )
+// Apply function f to every matrix element (and default value) in place
+void sparDoubleApply( sparDouble *matrix, double (*f)( double ) )
 {
-	// Number of blocks
-	int blocks;
-	blocks = matrix->mx * matrix->my * matrix->mz;
-
-	// Matrix instance
-	double size;
-	size = (double)( sizeof(sparFloat) );
-
-	// Uniform block data
-	size = size + (double)( blocks * sizeof(float) );
+	// Block size
+	int bs3;
+	bs3 = matrix->bs3;
 
-	// Heterogeneous block data arrays
-	size = size + (double)( blocks * sizeof(float*) );
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
 
-	// Heterogeneous block data
-	int i;
-	for( i = 0 ; i < blocks ; i++ )
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
 	{
-		// Heterogeneous block
-		if( matrix->blockData[i] != NULL )
+		double *blockData;
+		blockData = matrix->blockData[n];
+
+		// Uniform block, transform its value only
+		if( blockData == NULL )
 		{
-			size = size + (double)( sizeof(float) * matrix->bs3 );
+			matrix->blockValue[n] = f( matrix->blockValue[n] );
+		}
+		// Heterogeneous block, transform and reduce if possible
+		else
+		{
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				blockData[i] = f( blockData[i] );
+			}
+			sparDoubleReduceBlock( matrix, n % mx, ( n / mx ) % my, n / ( mx * my ) );
 		}
 	}
 
-	return size;
+	// Keep the background consistent with transformed uniform blocks
+	matrix->def = f( matrix->def );
 }
 
-// Check if block is uniform
-int sparFloatUniformBlock( sparFloat *matrix, int x, int y, int z )
+// New matrix with function f applied to every element (and default value)
+sparDouble* sparDoubleMap( sparDouble *matrix, double (*f)( double ) )
 {
+	// Declare matrix and init
+	sparDouble *matrix2;
+	matrix2 = sparDoubleInit( matrix->nx, matrix->ny, matrix->nz,
+						matrix->bs, f( matrix->def ) );
+
+	// Copy ring buffer origin
+	matrix2->ox = matrix->ox;
+	matrix2->oy = matrix->oy;
+	matrix2->oz = matrix->oz;
+
 	// Block size
-	int bs, bs3;
-	bs = matrix->bs;
+	int bs3;
 	bs3 = matrix->bs3;
 
 	// Block matrix size (mx,my,mz)
@@ -3314,985 +26469,1847 @@ int sparFloatUniformBlock( sparFloat *matrix, int x, int y, int z )
 	my = matrix->my;
 	mz = matrix->mz;
 
-	// Linear block index (n) <-> (x,y,z)
+	// For each block
 	int n;
-	n = x + mx * ( y + my * z );
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		double *blockData;
+		blockData = matrix->blockData[n];
 
-	// Block data array
-	float *blockData;
-	blockData = matrix->blockData[n];
+		// Uniform block, transform its value only
+		if( blockData == NULL )
+		{
+			matrix2->blockValue[n] = f( matrix->blockValue[n] );
+		}
+		// Heterogeneous block, transform into new block and reduce if possible
+		else
+		{
+			double *blockData2;
+			blockData2 = (double*) calloc( bs3, sizeof(double) );
 
-	// Uniform block
-	if( blockData == NULL )
-	{
-		return 1;
+			if( blockData2 == NULL )
+			{
+			   fprintf(stderr, "sparDoubleMap error: Out of memory\n");
+			   exit(1);
+			}
+
+			int i;
+			for( i = 0 ; i < bs3 ; i++ )
+			{
+				blockData2[i] = f( blockData[i] );
+			}
+			matrix2->blockData[n] = blockData2;
+			sparDoubleReduceBlock( matrix2, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
 	}
 
-	int isUniform;
-	isUniform = 1;
+	return matrix2;
+}
 
-	// Inner block
-	if( x < mx - 1 && y < my - 1 && z < mz - 1)
-	{
-		// Start with last element
-		float value;
-		value = blockData[ bs3 - 1 ];
+// Visit elements different from the default value, in block order
+void sparDoubleForEach( sparDouble *matrix, void (*f)( int x, int y, int z, double value, void *data ), void *data )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
 
-		// Read block elements
-		int i;
-		for( i = 0 ; i < bs3 ; i++ )
+	// Default value
+	double def;
+	def = matrix->def;
+
+	int i, j, k;
+	int i1, j1, k1;
+	int ex, ey, ez;
+	int n;
+
+	// For each block
+	for( k1 = 0 ; k1 < matrix->mz ; k1++ )
+	{
+		for( j1 = 0 ; j1 < matrix->my ; j1++ )
 		{
-			if( blockData[i] != value )
+			for( i1 = 0 ; i1 < matrix->mx ; i1++ )
 			{
-				isUniform = 0;
-				i = bs3;
+				// Linear block index (n) <-> (i1,j1,k1)
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				double *blockData;
+				blockData = matrix->blockData[n];
+
+				// Skip uniform blocks equal to the default value
+				if( blockData == NULL && sparDoubleEqual( matrix->blockValue[n], def ) )
+				{
+					continue;
+				}
+
+				// Block extent inside the matrix
+				ex = matrix->nx - i1 * bs;
+				ey = matrix->ny - j1 * bs;
+				ez = matrix->nz - k1 * bs;
+				if( ex > bs ) ex = bs;
+				if( ey > bs ) ey = bs;
+				if( ez > bs ) ez = bs;
+
+				// Uniform block, every element
+				if( blockData == NULL )
+				{
+					double value;
+					value = matrix->blockValue[n];
+					for( k = 0 ; k < ez ; k++ )
+					{
+						for( j = 0 ; j < ey ; j++ )
+						{
+							for( i = 0 ; i < ex ; i++ )
+							{
+								f( i1 * bs + i, j1 * bs + j, k1 * bs + k, value, data );
+							}
+						}
+					}
+				}
+				// Heterogeneous block, non-default elements
+				else
+				{
+					for( k = 0 ; k < ez ; k++ )
+					{
+						for( j = 0 ; j < ey ; j++ )
+						{
+							double *row;
+							row = blockData + bs * ( j + bs * k );
+							for( i = 0 ; i < ex ; i++ )
+							{
+								if( sparDoubleEqual( row[i], def ) == 0 )
+								{
+									f( i1 * bs + i, j1 * bs + j, k1 * bs + k, row[i], data );
+								}
+							}
+						}
+					}
+				}
 			}
 		}
 	}
-	// Boundary block, with outside elements?
-	else
-	{
-		// Start with first element
-		float value;
-		value = blockData[0];
+}
 
-		// Read block elements
-		int i, j, k;
-		for( k = 0 ; k < bs ; k++ )
+// Visit maximal runs of equal non-default elements along x, (x,y,z) to (x+n-1,y,z), merged across blocks
+void sparDoubleForEachRun( sparDouble *matrix, void (*f)( int x, int y, int z, int n, double value, void *data ), void *data )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Default value
+	double def;
+	def = matrix->def;
+
+	int i, j, k;
+	int i1, j1, k1;
+	int ex, ey, ez;
+	int n;
+
+	// Current run (rx,y,z) to (rx+rn-1,y,z) of value rv
+	int rx, rn;
+	double rv;
+
+	// For each row of blocks
+	for( k1 = 0 ; k1 < matrix->mz ; k1++ )
+	{
+		for( j1 = 0 ; j1 < matrix->my ; j1++ )
 		{
-			if( z * bs + k < matrix->nz ) // Avoid outside elements
-			for( j = 0 ; j < bs ; j++ )
+			// Block row extent inside the matrix
+			ey = matrix->ny - j1 * bs;
+			ez = matrix->nz - k1 * bs;
+			if( ey > bs ) ey = bs;
+			if( ez > bs ) ez = bs;
+
+			// For each matrix row, runs continue from one block into the next
+			for( k = 0 ; k < ez ; k++ )
 			{
-				if( y * bs + j < matrix->ny ) // Idem
-				for( i = 0 ; i < bs ; i++ )
+				for( j = 0 ; j < ey ; j++ )
 				{
-					if( x * bs + i < matrix->nx ) // Idem
-					if( blockData[ i + bs * ( j + bs * k ) ] != value )
+					rx = 0;
+					rn = 0;
+					rv = def;
+
+					for( i1 = 0 ; i1 < matrix->mx ; i1++ )
 					{
-						isUniform = 0;
-						i = j = k = bs;
+						// Linear block index (n) <-> (i1,j1,k1)
+						n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+						ex = matrix->nx - i1 * bs;
+						if( ex > bs ) ex = bs;
+
+						double *blockData;
+						blockData = matrix->blockData[n];
+
+						// Uniform block, extend or restart the run with its whole row
+						if( blockData == NULL )
+						{
+							if( rn > 0 && sparDoubleEqual( matrix->blockValue[n], rv ) )
+							{
+								rn += ex;
+							}
+							else
+							{
+								if( rn > 0 && sparDoubleEqual( rv, def ) == 0 )
+								{
+									f( rx, j1 * bs + j, k1 * bs + k, rn, rv, data );
+								}
+								rx = i1 * bs;
+								rn = ex;
+								rv = matrix->blockValue[n];
+							}
+						}
+						// Heterogeneous block, element by element
+						else
+						{
+							double *row;
+							row = blockData + bs * ( j + bs * k );
+							for( i = 0 ; i < ex ; i++ )
+							{
+								if( rn > 0 && sparDoubleEqual( row[i], rv ) )
+								{
+									rn++;
+								}
+								else
+								{
+									if( rn > 0 && sparDoubleEqual( rv, def ) == 0 )
+									{
+										f( rx, j1 * bs + j, k1 * bs + k, rn, rv, data );
+									}
+									rx = i1 * bs + i;
+									rn = 1;
+									rv = row[i];
+								}
+							}
+						}
+					}
+
+					// End of row
+					if( rn > 0 && sparDoubleEqual( rv, def ) == 0 )
+					{
+						f( rx, j1 * bs + j, k1 * bs + k, rn, rv, data );
 					}
 				}
 			}
 		}
 	}
+}
 
-	return isUniform;
+// Element-wise operation between arrays, c[i] = a[i] op b[i]
+void sparDoubleOpArray( double *c, double *a, double *b, int n, int op, double def )
+{
+	int i;
+	switch( op )
+	{
+		case SPAR_ADD:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] + b[i];
+			}
+			break;
+		case SPAR_SUB:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] - b[i];
+			}
+			break;
+		case SPAR_MUL:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] * b[i];
+			}
+			break;
+		case SPAR_MIN:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] < b[i] ? a[i] : b[i];
+			}
+			break;
+		case SPAR_MAX:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] > b[i] ? a[i] : b[i];
+			}
+			break;
+		case SPAR_MASK:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = b[i] != 0 ? a[i] : def;
+			}
+			break;
+		default:
+			fprintf(stderr, "sparDoubleOpArray error: Unknown operation\n");
+			exit(1);
+	}
 }
 
-// Set matrix element (x,y,z)
-void sparFloatSet( sparFloat *matrix, int x, int y, int z, float value )
+// Element-wise operation between array and scalar, c[i] = a[i] op value
+void sparDoubleOpArrayScalar( double *c, double *a, double value, int n, int op, double def )
 {
-	// Block size
-	int bs, bs3;
-	bs = matrix->bs;
-	bs3 = matrix->bs3;
+	int i;
+	switch( op )
+	{
+		case SPAR_ADD:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] + value;
+			}
+			break;
+		case SPAR_SUB:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] - value;
+			}
+			break;
+		case SPAR_MUL:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] * value;
+			}
+			break;
+		case SPAR_MIN:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] < value ? a[i] : value;
+			}
+			break;
+		case SPAR_MAX:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = a[i] > value ? a[i] : value;
+			}
+			break;
+		case SPAR_MASK:
+			for( i = 0 ; i < n ; i++ )
+			{
+				c[i] = value != 0 ? a[i] : def;
+			}
+			break;
+		default:
+			fprintf(stderr, "sparDoubleOpArrayScalar error: Unknown operation\n");
+			exit(1);
+	}
+}
 
-	// Block (i1,j1,k1) contains the element (x,y,z)
-	int i1, j1, k1;
-	i1 = x / bs;
-	j1 = y / bs;
-	k1 = z / bs;
+// New matrix with element-wise operation between matrices, c = a op b
+sparDouble* sparDoubleOp( sparDouble *a, sparDouble *b, int op )
+{
+	// Check matrix size
+	if( a->nx != b->nx || a->ny != b->ny || a->nz != b->nz )
+	{
+		fprintf(stderr, "sparDoubleOp error: Matrix sizes must agree\n");
+		exit(1);
+	}
 
-	// Element indices in the block
-	int i2, j2, k2;
-	i2 = x % bs;
-	j2 = y % bs;
-	k2 = z % bs;
+	// Check ring buffer origin, blocks are combined by storage index
+	if( a->ox != b->ox || a->oy != b->oy || a->oz != b->oz )
+	{
+		fprintf(stderr, "sparDoubleOp error: Ring buffer origins must agree\n");
+		exit(1);
+	}
 
-	// Linear block index (n) <-> (i1,j1,k1)
-	int n;
-	n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+	// Result default value
+	double def;
+	sparDoubleOpArrayScalar( &def, &a->def, b->def, 1, op, a->def );
 
-	// Block uniform value
-	float blockValue;
-	blockValue = matrix->blockValue[n];
+	// Declare result matrix with block size of a
+	sparDouble *c;
+	c = sparDoubleInit( a->nx, a->ny, a->nz, a->bs, def );
 
-	// Block data array
-	float *blockData;
-	blockData = matrix->blockData[n];
+	// Copy ring buffer origin of a
+	c->ox = a->ox;
+	c->oy = a->oy;
+	c->oz = a->oz;
 
-	// Uniform block
-	if( blockData == NULL )
+	// Block size
+	int bs, bs3;
+	bs = a->bs;
+	bs3 = a->bs3;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = a->mx;
+	my = a->my;
+	mz = a->mz;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
 	{
-		// Input value is different
-		if( value != blockValue )
+		// Block of b resampled on the block grid of a
+		double *buffer;
+		buffer = NULL;
+
+		if( b->bs != bs )
 		{
-			// Expand block
-			blockData = (float*) calloc( bs3, sizeof(float) );
-			matrix->blockData[n] = blockData;
+			buffer = (double*) malloc( bs3 * sizeof(double) );
 
-			if( blockData == NULL )
+			if( buffer == NULL )
 			{
-			   fprintf(stderr, "sparFloatSet error: Out of memory\n");
+			   fprintf(stderr, "sparDoubleOp error: Out of memory\n");
+			   exit(1);
+			}
+		}
+
+		// For each block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < mx * my * mz ; n++ )
+		{
+			// Block (i1,j1,k1) <-> (n)
+			int i1, j1, k1;
+			i1 = n % mx;
+			j1 = ( n / mx ) % my;
+			k1 = n / ( mx * my );
+
+			// Block of b, uniform (blockB == NULL) or heterogeneous
+			double *blockB, valueB;
+			if( b->bs == bs )
+			{
+				blockB = b->blockData[n];
+				valueB = b->blockValue[n];
+			}
+			else if( sparDoubleUniformBox( b, i1 * bs, j1 * bs, k1 * bs, bs, bs, bs, &valueB ) )
+			{
+				blockB = NULL;
+			}
+			else
+			{
+				sparDoubleGetBox( b, i1 * bs, j1 * bs, k1 * bs, bs, bs, bs, buffer );
+				blockB = buffer;
+			}
+
+			// Block of a
+			double *blockA, valueA;
+			blockA = a->blockData[n];
+			valueA = a->blockValue[n];
+
+			// Both uniform, one operation
+			if( blockA == NULL && blockB == NULL )
+			{
+				sparDoubleOpArrayScalar( &c->blockValue[n], &valueA, valueB, 1, op, a->def );
+				continue;
+			}
+
+			// Heterogeneous result
+			double *blockC;
+			blockC = (double*) calloc( bs3, sizeof(double) );
+
+			if( blockC == NULL )
+			{
+			   fprintf(stderr, "sparDoubleOp error: Out of memory\n");
 			   exit(1);
 			}
-
-			// Set previous value
-			int i;
-			for( i = 0 ; i < bs3 ; i++ )
+
+			// Uniform b, scalar operation
+			if( blockB == NULL )
+			{
+				sparDoubleOpArrayScalar( blockC, blockA, valueB, bs3, op, a->def );
+			}
+			// Uniform a, expand into result and operate in place
+			else if( blockA == NULL )
+			{
+				int i;
+				for( i = 0 ; i < bs3 ; i++ )
+				{
+					blockC[i] = valueA;
+				}
+				sparDoubleOpArray( blockC, blockC, blockB, bs3, op, a->def );
+			}
+			// Both heterogeneous
+			else
 			{
-				blockData[i] = blockValue;
+				sparDoubleOpArray( blockC, blockA, blockB, bs3, op, a->def );
 			}
 
-			// Set input value
-			blockData[ i2 + bs * ( j2 + bs * k2 ) ] = value;
+			c->blockData[n] = blockC;
+			sparDoubleReduceBlock( c, i1, j1, k1 );
 		}
-		// Else, do nothing
-	}
-	// Heterogeneous block
-	else
-	{
-		// Set input value
-		blockData[ i2 + bs * ( j2 + bs * k2 ) ] = value;
 
-		// Reduce block
-		if( sparFloatUniformBlock( matrix, i1, j1, k1 ) )
-		{
-			matrix->blockValue[n] = value;
-			free(matrix->blockData[n]);
-			matrix->blockData[n] = NULL;
-		}
+		free(buffer);
 	}
+
+	return c;
 }
 
-// Get matrix element (x,y,z)
-float sparFloatGet( sparFloat *matrix, int x, int y, int z )
+// Element-wise operation with scalar in place, matrix = matrix op value
+void sparDoubleOpScalar( sparDouble *matrix, double value, int op )
 {
 	// Block size
-	int bs;
-	bs = matrix->bs;
+	int bs3;
+	bs3 = matrix->bs3;
 
-	// Block (i1,j1,k1) contains the element (x,y,z)
-	int i1, j1, k1;
-	i1 = x / bs;
-	j1 = y / bs;
-	k1 = z / bs;
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
 
-	// Linear block index (n) <-> (i1,j1,k1)
+	// Default value of the operation (SPAR_MASK)
+	double def;
+	def = matrix->def;
+
+	// For each block
 	int n;
-	n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		double *blockData;
+		blockData = matrix->blockData[n];
 
-	float *blockData;
-	blockData = matrix->blockData[n];
+		// Uniform block, one operation
+		if( blockData == NULL )
+		{
+			sparDoubleOpArrayScalar( &matrix->blockValue[n], &matrix->blockValue[n], value, 1, op, def );
+		}
+		// Heterogeneous block, operate in place and reduce if possible
+		else
+		{
+			sparDoubleOpArrayScalar( blockData, blockData, value, bs3, op, def );
+			sparDoubleReduceBlock( matrix, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
+	}
 
-	// Uniform block
-	if( blockData == NULL )
+	// Keep the background consistent with updated uniform blocks
+	sparDoubleOpArrayScalar( &matrix->def, &matrix->def, value, 1, op, def );
+}
+
+// Stencil of radius r from src into dst, f(c) reads neighbours c[i+sy*j+sz*k] with -r <= i,j,k <= r
+void sparDoubleStencil( sparDouble *dst, sparDouble *src, int r, double (*f)( double *c, int r, int sy, int sz, void *data ), void *data )
+{
+	// Check matrices
+	if( dst == src )
 	{
-		return matrix->blockValue[n];
+		fprintf(stderr, "sparDoubleStencil error: Source and destination must be different\n");
+		exit(1);
 	}
-	// Heterogeneous block
-	else
+
+	if( dst->nx != src->nx || dst->ny != src->ny || dst->nz != src->nz )
 	{
-		// Element indices in the block
-		int i2, j2, k2;
-		i2 = x % bs;
-		j2 = y % bs;
-		k2 = z % bs;
-		// Return element value
-		return blockData[ i2 + bs * ( j2 + bs * k2 ) ];
+		fprintf(stderr, "sparDoubleStencil error: Matrix sizes must agree\n");
+		exit(1);
 	}
-}
 
-// Duplicate matrix
-sparFloat* sparFloatDuplicate( sparFloat *matrix )
-{
-	// Declare matrix and init
-	sparFloat *matrix2;
-	matrix2 = sparFloatInit( matrix->nx, matrix->ny, matrix->nz,
-						matrix->bs, matrix->def );
+	if( r < 0 )
+	{
+		fprintf(stderr, "sparDoubleStencil error: Radius must be non-negative\n");
+		exit(1);
+	}
 
-	// Number of blocks
-	int blocks;
-	blocks = matrix2->mx * matrix2->my * matrix2->mz;
+	// Destination block size
+	int bs, bs3;
+	bs = dst->bs;
+	bs3 = dst->bs3;
 
-	// Copy blocks
-	int i;
-	for( i = 0 ; i < blocks ; i++ )
+	// Destination block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = dst->mx;
+	my = dst->my;
+	mz = dst->mz;
+
+	// Block plus halo size (hs,hs,hs)
+	int hs;
+	hs = bs + 2 * r;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
 	{
-		// Heterogeneous block
-		if( matrix->blockData[i] != NULL )
+		// Block plus halo of the source
+		double *halo;
+		halo = (double*) malloc( hs * hs * hs * sizeof(double) );
+
+		if( halo == NULL )
 		{
-			// Allocate space for block data
-			matrix2->blockData[i] = (float*) calloc( matrix2->bs3, sizeof(float) );
+		   fprintf(stderr, "sparDoubleStencil error: Out of memory\n");
+		   exit(1);
+		}
 
-			if( matrix2->blockData[i] == NULL )
+		// For each destination block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < mx * my * mz ; n++ )
+		{
+			// Block (i1,j1,k1) <-> (n)
+			int i1, j1, k1;
+			i1 = n % mx;
+			j1 = ( n / mx ) % my;
+			k1 = n / ( mx * my );
+
+			// Block origin
+			int x, y, z;
+			x = i1 * bs;
+			y = j1 * bs;
+			z = k1 * bs;
+
+			// Free previous destination data
+			if( dst->blockData[n] != NULL )
 			{
-			   fprintf(stderr, "sparFloatDuplicate error: Out of memory\n");
+				free(dst->blockData[n]);
+				dst->blockData[n] = NULL;
+			}
+
+			// Uniform neighbourhood, uniform destination block
+			double value;
+			if( sparDoubleUniformBox( src, x - r, y - r, z - r, hs, hs, hs, &value ) &&
+				( sparDoubleEqual( value, src->def ) || ( x >= r && y >= r && z >= r &&
+				  x + bs + r <= src->nx && y + bs + r <= src->ny && z + bs + r <= src->nz ) ) )
+			{
+				int w, i;
+				w = 2 * r + 1;
+				for( i = 0 ; i < w * w * w ; i++ )
+				{
+					halo[i] = value;
+				}
+				dst->blockValue[n] = f( halo + r + w * ( r + w * r ), r, w, w * w, data );
+				continue;
+			}
+
+			// Read block plus halo
+			sparDoubleGetBox( src, x - r, y - r, z - r, hs, hs, hs, halo );
+
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = dst->nx - x;
+			ey = dst->ny - y;
+			ez = dst->nz - z;
+			if( ex > bs ) ex = bs;
+			if( ey > bs ) ey = bs;
+			if( ez > bs ) ez = bs;
+
+			// Apply stencil
+			double *blockData;
+			blockData = (double*) calloc( bs3, sizeof(double) );
+
+			if( blockData == NULL )
+			{
+			   fprintf(stderr, "sparDoubleStencil error: Out of memory\n");
 			   exit(1);
 			}
 
-			// Copy block data
-			memcpy( matrix2->blockData[i], matrix->blockData[i], matrix2->bs3 * sizeof(float) );
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
+				{
+					double *c;
+					c = halo + r + hs * ( ( j + r ) + hs * ( k + r ) );
+					for( i = 0 ; i < ex ; i++ )
+					{
+						blockData[ i + bs * ( j + bs * k ) ] = f( c + i, r, hs, hs * hs, data );
+					}
+				}
+			}
+
+			// Write block and reduce if possible
+			dst->blockData[n] = blockData;
+			sparDoubleReduceBlock( dst, i1, j1, k1 );
 		}
-		// Uniform block
-		else
+
+		free(halo);
+	}
+}
+
+// Stencil kernel, weighted sum of the neighbourhood with data holding (2r+1)^3 weights
+double sparDoubleConvolveKernel( double *c, int r, int sy, int sz, void *data )
+{
+	double *weights;
+	weights = (double*) data;
+
+	double sum;
+	sum = 0.0;
+
+	int i, j, k;
+	for( k = -r ; k <= r ; k++ )
+	{
+		for( j = -r ; j <= r ; j++ )
 		{
-			matrix2->blockValue[i] = matrix->blockValue[i];
-			matrix2->blockData[i] = NULL;
+			for( i = -r ; i <= r ; i++ )
+			{
+				sum += *weights++ * (double)( c[ i + sy * j + sz * k ] );
+			}
 		}
 	}
 
-	return matrix2;
+	return sparDoubleRound( sum );
 }
 
-// Get matrix memory usage in bytes under certain block size
-double sparFloatMemoryBs( sparFloat *matrix, int bs )
+// Convolution of src into dst with weights[(i+r)+(2r+1)*((j+r)+(2r+1)*(k+r))]
+void sparDoubleConvolve( sparDouble *dst, sparDouble *src, int r, double *weights )
 {
-	if( bs == matrix->bs )
+	sparDoubleStencil( dst, src, r, sparDoubleConvolveKernel, weights );
+}
+
+// One-dimensional filter of src into dst along axis (0 x, 1 y, 2 z) with 2r+1 weights, box (moving average) if weights is NULL
+void sparDoubleFilterAxis( sparDouble *dst, sparDouble *src, int axis, int r, double *weights )
+{
+	// Check matrices
+	if( dst == src )
 	{
-		return sparFloatMemory( matrix );
+		fprintf(stderr, "sparDoubleFilterAxis error: Source and destination must be different\n");
+		exit(1);
 	}
 
-	// Matrix size (nx,ny,nz)
-	int nx, ny, nz;
-	nx = matrix->nx;
-	ny = matrix->ny;
-	nz = matrix->nz;
+	if( dst->nx != src->nx || dst->ny != src->ny || dst->nz != src->nz )
+	{
+		fprintf(stderr, "sparDoubleFilterAxis error: Matrix sizes must agree\n");
+		exit(1);
+	}
 
-	// Block size (bs,bs,bs)
-	int bs3;
-	bs3 = bs * bs * bs;
+	if( axis < 0 || axis > 2 || r < 0 )
+	{
+		fprintf(stderr, "sparDoubleFilterAxis error: Invalid axis or radius\n");
+		exit(1);
+	}
 
-	// Block matrix size (mx,my,mz)
+	// Destination block size
+	int bs, bs3;
+	bs = dst->bs;
+	bs3 = dst->bs3;
+
+	// Destination block matrix size (mx,my,mz)
 	int mx, my, mz;
-	mx = (int)( ( nx + bs - 1 ) / bs );
-	my = (int)( ( ny + bs - 1 ) / bs );
-	mz = (int)( ( nz + bs - 1 ) / bs );
+	mx = dst->mx;
+	my = dst->my;
+	mz = dst->mz;
+
+	// Halo radius (rx,ry,rz) and block plus halo size (hx,hy,hz)
+	int rx, ry, rz;
+	rx = axis == 0 ? r : 0;
+	ry = axis == 1 ? r : 0;
+	rz = axis == 2 ? r : 0;
+
+	int hx, hy, hz;
+	hx = bs + 2 * rx;
+	hy = bs + 2 * ry;
+	hz = bs + 2 * rz;
+
+	// Element strides along the filter axis in the halo and in the block
+	int hstride, bstride;
+	hstride = axis == 0 ? 1 : ( axis == 1 ? hx : hx * hy );
+	bstride = axis == 0 ? 1 : ( axis == 1 ? bs : bs * bs );
+
+	// Sum of weights
+	double wsum;
+	wsum = 1.0;
+	if( weights != NULL )
+	{
+		int i;
+		wsum = 0.0;
+		for( i = 0 ; i < 2 * r + 1 ; i++ )
+		{
+			wsum += weights[i];
+		}
 
-	// Number of blocks
-	int blocks;
-	blocks = mx * my * mz;
+		// Normalized kernel, keep uniform values exact
+		if( fabs( wsum - 1.0 ) < 1e-9 )
+		{
+			wsum = 1.0;
+		}
+	}
 
-	// Size of matrix instance
-	double size;
-	size = (double)( sizeof(sparFloat) );
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block plus halo of the source and one line along the axis
+		double *halo;
+		double *line;
+		halo = (double*) malloc( hx * hy * hz * sizeof(double) );
+		line = (double*) malloc( ( bs + 2 * r ) * sizeof(double) );
 
-	// Size of uniform block data
-	size = size + (double)( blocks * sizeof(float) );
+		if( halo == NULL || line == NULL )
+		{
+		   fprintf(stderr, "sparDoubleFilterAxis error: Out of memory\n");
+		   exit(1);
+		}
 
-	// Size of heterogeneous block data arrays
-	size = size + (double)( blocks * sizeof(float*) );
+		// For each destination block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < mx * my * mz ; n++ )
+		{
+			// Block (i1,j1,k1) <-> (n)
+			int i1, j1, k1;
+			i1 = n % mx;
+			j1 = ( n / mx ) % my;
+			k1 = n / ( mx * my );
+
+			// Block origin
+			int x, y, z;
+			x = i1 * bs;
+			y = j1 * bs;
+			z = k1 * bs;
+
+			// Free previous destination data
+			if( dst->blockData[n] != NULL )
+			{
+				free(dst->blockData[n]);
+				dst->blockData[n] = NULL;
+			}
 
-	int i, j, k;
-	int i1, j1, k1;
-	int isUniform;
-	float value;
+			// Run of uniform blocks along the axis, uniform destination block
+			double value;
+			if( sparDoubleUniformBox( src, x - rx, y - ry, z - rz, hx, hy, hz, &value ) &&
+				( sparDoubleEqual( value, src->def ) || ( x >= rx && y >= ry && z >= rz &&
+				  x + bs + rx <= src->nx && y + bs + ry <= src->ny && z + bs + rz <= src->nz ) ) )
+			{
+				dst->blockValue[n] = weights == NULL || wsum == 1.0 ? value : sparDoubleRound( wsum * value );
+				continue;
+			}
 
-	// For each virtual block
-	for( k1 = 0 ; k1 < mz ; k1++ )
-	{
-		for( j1 = 0 ; j1 < my ; j1++ )
-		{
-			for( i1 = 0 ; i1 < mx ; i1++ )
+			// Read block plus halo
+			sparDoubleGetBox( src, x - rx, y - ry, z - rz, hx, hy, hz, halo );
+
+			double *blockData;
+			blockData = (double*) calloc( bs3, sizeof(double) );
+
+			if( blockData == NULL )
 			{
-				// Check if block is uniform 
-				isUniform = 1;
-				value = sparFloatGet( matrix, i1 * bs, j1 * bs, k1 * bs );
-				for( k = k1 * bs ; k < ( k1 + 1 ) * bs ; k++ )
+			   fprintf(stderr, "sparDoubleFilterAxis error: Out of memory\n");
+			   exit(1);
+			}
+
+			// For each line along the axis, (a,b) are the other two block indices
+			int a, b, i;
+			for( b = 0 ; b < bs ; b++ )
+			{
+				for( a = 0 ; a < bs ; a++ )
 				{
-					if( k < nz ) // Avoid outside elements
-					for( j = j1 * bs ; j < ( j1 + 1 ) * bs ; j++ )
+					// First line element in the halo and in the block
+					double *hline, *bline;
+					if( axis == 0 )
 					{
-						if( j < ny ) // Idem
-						for( i = i1 * bs ; i < ( i1 + 1 ) * bs ; i++ )
+						hline = halo + hx * ( a + hy * b );
+						bline = blockData + bs * ( a + bs * b );
+					}
+					else if( axis == 1 )
+					{
+						hline = halo + a + hx * hy * b;
+						bline = blockData + a + bs * bs * b;
+					}
+					else
+					{
+						hline = halo + a + hx * b;
+						bline = blockData + a + bs * b;
+					}
+
+					// Gather line
+					for( i = 0 ; i < bs + 2 * r ; i++ )
+					{
+						line[i] = (double)( hline[ i * hstride ] );
+					}
+
+					// Box, sliding window sum
+					if( weights == NULL )
+					{
+						double sum;
+						sum = 0.0;
+						for( i = 0 ; i < 2 * r + 1 ; i++ )
 						{
-							if( i < nx ) // Idem
-							if( sparFloatGet( matrix, i, j, k ) != value )
+							sum += line[i];
+						}
+						for( i = 0 ; i < bs ; i++ )
+						{
+							bline[ i * bstride ] = sparDoubleRound( sum / ( 2 * r + 1 ) );
+							if( i + 1 < bs )
 							{
-								isUniform = 0;
-								i = ( i1 + 1 ) * bs;
-								j = ( j1 + 1 ) * bs;
-								k = ( k1 + 1 ) * bs;
+								sum += line[ i + 2 * r + 1 ] - line[i];
 							}
 						}
 					}
-				}
-				if( isUniform == 0 )
-				{
-					size = size + (double)( sizeof(float) * bs3 );
+					// Weighted window as offsets from the centre element, exact on constant lines
+					else
+					{
+						int w;
+						for( i = 0 ; i < bs ; i++ )
+						{
+							double sum;
+							sum = 0.0;
+							for( w = 0 ; w < 2 * r + 1 ; w++ )
+							{
+								sum += weights[w] * ( line[ i + w ] - line[ i + r ] );
+							}
+							bline[ i * bstride ] = sparDoubleRound( wsum * line[ i + r ] + sum );
+						}
+					}
 				}
 			}
+
+			// Write block and reduce if possible
+			dst->blockData[n] = blockData;
+			sparDoubleReduceBlock( dst, i1, j1, k1 );
 		}
+
+		free(halo);
+		free(line);
 	}
+}
 
-	return size;
+// Box filter (mean over (2r+1)^3 neighbourhood) of src into dst, three one-dimensional passes
+void sparDoubleBoxFilter( sparDouble *dst, sparDouble *src, int r )
+{
+	// Temporal matrix for the second pass, intermediate passes see the source default value outside the matrix
+	sparDouble *tmp;
+	tmp = sparDoubleInit( dst->nx, dst->ny, dst->nz, dst->bs, src->def );
+
+	double def;
+	def = dst->def;
+	dst->def = src->def;
+
+	sparDoubleFilterAxis( dst, src, 0, r, NULL );
+	sparDoubleFilterAxis( tmp, dst, 1, r, NULL );
+
+	dst->def = def;
+	sparDoubleFilterAxis( dst, tmp, 2, r, NULL );
+
+	sparDoubleFree( tmp );
 }
 
-// Change matrix block size
-void sparFloatChangeBs( sparFloat *matrix, int bs )
+// Gaussian filter of standard deviation sigma of src into dst, three one-dimensional passes
+void sparDoubleGaussianFilter( sparDouble *dst, sparDouble *src, double sigma )
 {
-	// Matrix size (nx,ny,nz)
-	int nx, ny, nz;
-	nx = matrix->nx;
-	ny = matrix->ny;
-	nz = matrix->nz;
+	if( !( sigma > 0.0 ) )
+	{
+		fprintf(stderr, "sparDoubleGaussianFilter error: Standard deviation must be positive\n");
+		exit(1);
+	}
 
-	// Default value
-	float def;
-	def = matrix->def;
+	// Normalized kernel truncated at 3 sigma
+	int r;
+	r = (int)( ceil( 3.0 * sigma ) );
 
-	// Declare temporal matrix and init
-	sparFloat *matrix2;
-	matrix2 = sparFloatInit( nx, ny, nz, bs, def );
+	double *weights;
+	weights = (double*) malloc( ( 2 * r + 1 ) * sizeof(double) );
 
-	// Copy values and clear original matrix
-	int i, j, k;
-	for( k=0 ; k<nz ; k++ )
+	if( weights == NULL )
 	{
-		for( j=0 ; j<ny ; j++ )
-		{
-			for( i=0 ; i<nx ; i++ )
-			{
-				// Copy element
-				sparFloatSet( matrix2, i, j, k, sparFloatGet( matrix, i, j, k ) );
+	   fprintf(stderr, "sparDoubleGaussianFilter error: Out of memory\n");
+	   exit(1);
+	}
 
-				// Set uniform to free memory
-				sparFloatSet( matrix, i, j, k, def);
-			}
-		}
+	int i;
+	double sum;
+	sum = 0.0;
+	for( i = -r ; i <= r ; i++ )
+	{
+		weights[ i + r ] = exp( -0.5 * i * i / ( sigma * sigma ) );
+		sum += weights[ i + r ];
+	}
+	for( i = 0 ; i < 2 * r + 1 ; i++ )
+	{
+		weights[i] /= sum;
 	}
 
-	// Set new block size and grid
-	matrix->bs  = matrix2->bs;
-	matrix->bs3 = matrix2->bs3;
-	matrix->mx  = matrix2->mx;
-	matrix->my  = matrix2->my;
-	matrix->mz  = matrix2->mz;
+	// Temporal matrix for the second pass, intermediate passes see the source default value outside the matrix
+	sparDouble *tmp;
+	tmp = sparDoubleInit( dst->nx, dst->ny, dst->nz, dst->bs, src->def );
 
-	// Free old blocks
-	free(matrix->blockValue);
-	free(matrix->blockData);
+	double def;
+	def = dst->def;
+	dst->def = src->def;
 
-	// Copy new blocks
-	matrix->blockValue = matrix2->blockValue;
-	matrix->blockData = matrix2->blockData;
+	sparDoubleFilterAxis( dst, src, 0, r, weights );
+	sparDoubleFilterAxis( tmp, dst, 1, r, weights );
 
-	// Free temporal matrix
-	free(matrix2);
+	dst->def = def;
+	sparDoubleFilterAxis( dst, tmp, 2, r, weights );
+
+	sparDoubleFree( tmp );
+	free(weights);
 }
 
-// Optimize matrix block size
-void sparFloatOptimizeBs( sparFloat *matrix )
+// Union-find root of node i with path halving (connected component labeling)
+int sparDoubleLabelFind( int *parent, int i )
 {
-	// Test block size and store optimal
-	int bestBs;
-	double memory, bestMemory;
-	int bs[10] = { 2, 3, 4, 6, 8, 10 };
-
-	bestBs = bs[0];
-	bestMemory = sparFloatMemoryBs( matrix, bs[0] );
-
-	int i;
-	for( i=1 ; i<6 ; i++ )
+	while( parent[i] != i )
 	{
-		memory = sparFloatMemoryBs( matrix, bs[i] );
-		if( memory < bestMemory )
-		{
-			bestBs = bs[i];
-			bestMemory = memory;
-		}
+		parent[i] = parent[ parent[i] ];
+		i = parent[i];
 	}
-
-	// Change matrix block size
-	sparFloatChangeBs( matrix, bestBs );
+	return i;
 }
 
-// Resize matrix
-void sparFloatResize( sparFloat *matrix, int nx, int ny, int nz )
+// Union-find merge of the sets of nodes i and j, the smallest node is kept as root
+void sparDoubleLabelUnion( int *parent, int i, int j )
 {
-	// Check matrix size
-	if( !( nx > 0 && ny > 0 && nz > 0 ) )
+	i = sparDoubleLabelFind( parent, i );
+	j = sparDoubleLabelFind( parent, j );
+	if( i < j )
 	{
-		fprintf(stderr, "sparFloatResize error: Matrix size must be positive\n");
-		exit(1);
+		parent[j] = i;
+	}
+	else if( j < i )
+	{
+		parent[i] = j;
 	}
+}
 
+// Union-find node of element (x,y,z), -1 for elements equal to the default value
+int sparDoubleLabelNode( sparDouble *matrix, int *offset, int x, int y, int z )
+{
 	// Block size
 	int bs;
 	bs = matrix->bs;
 
-	// Default value
-	float def;
-	def = matrix->def;
+	// Linear block index (n) <-> (x/bs,y/bs,z/bs)
+	int n;
+	n = x / bs + matrix->mx * ( y / bs + matrix->my * ( z / bs ) );
 
-	// Block grid size
-	int mx, my, mz;
+	// Uniform block, one node or none
+	if( matrix->blockData[n] == NULL )
+	{
+		return offset[n];
+	}
 
-	// New block data
-	float *blockValue;
-	float **blockData;
+	// Heterogeneous block, one node per element
+	int i;
+	i = x % bs + bs * ( y % bs + bs * ( z % bs ) );
+	if( sparDoubleEqual( matrix->blockData[n][i], matrix->def ) )
+	{
+		return -1;
+	}
+	return offset[n] + i;
+}
 
-	int i, j, k;
-	int blocks;
+// Connect block (x,y,z) with its neighbour block across the lower face along axis (0 x, 1 y, 2 z)
+void sparDoubleLabelFace( sparDouble *matrix, int *offset, int *parent, int x, int y, int z, int axis )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
 
-	// Expand x
-	if( nx > matrix->nx )
-	{
-		// New block grid size
-		mx = (int)( ( nx + bs - 1 ) / bs );
-		my = matrix->my;
-		mz = matrix->mz;
+	// Neighbour block
+	int x2, y2, z2;
+	x2 = x - ( axis == 0 );
+	y2 = y - ( axis == 1 );
+	z2 = z - ( axis == 2 );
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (float*) calloc( blocks, sizeof(float) ); // Sets to 0s
-		blockData = (float**) calloc( blocks, sizeof(float*) ); // Sets to NULLs
+	// Linear block indices
+	int n, n2;
+	n = x + matrix->mx * ( y + matrix->my * z );
+	n2 = x2 + matrix->mx * ( y2 + matrix->my * z2 );
 
-		if( blockValue == NULL || blockData == NULL )
-		{
-		   fprintf(stderr, "sparFloatResize error: Out of memory\n");
-		   exit(1);
-		}
+	// Any default uniform block, nothing to connect
+	if( offset[n] < 0 || offset[n2] < 0 )
+	{
+		return;
+	}
 
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+	// Both uniform, one connection
+	if( matrix->blockData[n] == NULL && matrix->blockData[n2] == NULL )
+	{
+		sparDoubleLabelUnion( parent, offset[n], offset[n2] );
+		return;
+	}
+
+	// Block extent inside the matrix
+	int ex, ey, ez;
+	ex = matrix->nx - x * bs;
+	ey = matrix->ny - y * bs;
+	ez = matrix->nz - z * bs;
+	if( ex > bs ) ex = bs;
+	if( ey > bs ) ey = bs;
+	if( ez > bs ) ez = bs;
+
+	// Face elements
+	int a, b, na, nb;
+	na = axis == 0 ? ey : ex;
+	nb = axis == 2 ? ey : ez;
+	for( b = 0 ; b < nb ; b++ )
+	{
+		for( a = 0 ; a < na ; a++ )
 		{
-			for( j = 0 ; j < my ; j++ )
+			// Element (i,j,k) on the face and its neighbour
+			int i, j, k, node, node2;
+			i = x * bs + ( axis == 0 ? 0 : a );
+			j = y * bs + ( axis == 0 ? a : ( axis == 1 ? 0 : b ) );
+			k = z * bs + ( axis == 2 ? 0 : b );
+
+			node = sparDoubleLabelNode( matrix, offset, i, j, k );
+			if( node < 0 )
 			{
-				for( i = 0 ; i < matrix->mx ; i++ )
-				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
-				}
+				continue;
 			}
-		}
-		// Create new blocks
-		for( k = 0 ; k < mz ; k++ )
-		{
-			for( j = 0 ; j < my ; j++ )
+			node2 = sparDoubleLabelNode( matrix, offset, i - ( axis == 0 ), j - ( axis == 1 ), k - ( axis == 2 ) );
+			if( node2 < 0 )
 			{
-				for( i = matrix->mx ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j +  my * k ) ] = def;
-					blockData[ i + mx * ( j +  my * k ) ] = NULL;
-				}
+				continue;
 			}
+			sparDoubleLabelUnion( parent, node, node2 );
 		}
+	}
+}
 
-		int xi, xf;
-		xi = matrix->nx;
-		xf = matrix->bs * matrix->mx;
-		if( xf >= nx )
-		{
-			xf = nx - 1;
-		}
-
-		matrix->nx = nx;
-		matrix->mx = mx;
+// Connect elements inside heterogeneous block (x,y,z)
+void sparDoubleLabelBlock( sparDouble *matrix, int *offset, int *parent, int x, int y, int z )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
 
-		free(matrix->blockData);
-		free(matrix->blockValue);
+	// Linear block index (n) <-> (x,y,z)
+	int n;
+	n = x + matrix->mx * ( y + matrix->my * z );
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
+	double *blockData;
+	blockData = matrix->blockData[n];
 
-		// Set expanded elements to default
-		for( k = 0 ; k < matrix->nz ; k++ )
-		{
-			for( j = 0 ; j < matrix->ny ; j++ )
-			{
-				for( i = xi ; i < xf ; i++ )
-				{
-					sparFloatSet( matrix, i, j, k, def );
-				}
-			}
-		}
-	}
-	// Shrink x
-	else if( nx < matrix->nx )
+	// Uniform block is a single node
+	if( blockData == NULL )
 	{
-		// New block grid size
-		mx = (int)( ( nx + bs - 1 ) / bs );
-		my = matrix->my;
-		mz = matrix->mz;
+		return;
+	}
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (float*) calloc( blocks, sizeof(float) ); // Sets to 0s
-		blockData = (float**) calloc( blocks, sizeof(float*) ); // Sets to NULLs
+	// Block extent inside the matrix
+	int ex, ey, ez;
+	ex = matrix->nx - x * bs;
+	ey = matrix->ny - y * bs;
+	ez = matrix->nz - z * bs;
+	if( ex > bs ) ex = bs;
+	if( ey > bs ) ey = bs;
+	if( ez > bs ) ez = bs;
 
-		if( blockValue == NULL || blockData == NULL )
-		{
-		   fprintf(stderr, "sparFloatResize error: Out of memory\n");
-		   exit(1);
-		}
+	// Connect each non-default element with its lower neighbours
+	double def;
+	def = matrix->def;
 
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+	int i, j, k, e;
+	for( k = 0 ; k < ez ; k++ )
+	{
+		for( j = 0 ; j < ey ; j++ )
 		{
-			for( j = 0 ; j < my ; j++ )
+			for( i = 0 ; i < ex ; i++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				e = i + bs * ( j + bs * k );
+				if( sparDoubleEqual( blockData[e], def ) )
 				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
+					continue;
 				}
-			}
-		}
-
-		// Free excedent blocks
-		for( k = 0 ; k < mz ; k++ )
-		{
-			for( j = 0 ; j < my ; j++ )
-			{
-				for( i = mx ; i < matrix->mx ; i++ )
+				if( i > 0 && sparDoubleEqual( blockData[ e - 1 ], def ) == 0 )
 				{
-					if( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
-					{
-						free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
-					}
+					sparDoubleLabelUnion( parent, offset[n] + e, offset[n] + e - 1 );
+				}
+				if( j > 0 && sparDoubleEqual( blockData[ e - bs ], def ) == 0 )
+				{
+					sparDoubleLabelUnion( parent, offset[n] + e, offset[n] + e - bs );
+				}
+				if( k > 0 && sparDoubleEqual( blockData[ e - bs * bs ], def ) == 0 )
+				{
+					sparDoubleLabelUnion( parent, offset[n] + e, offset[n] + e - bs * bs );
 				}
 			}
 		}
+	}
+}
+
+// Label 6-connected regions of non-default elements into labels (0 elsewhere), return number of regions
+int sparDoubleLabel( sparDouble *matrix, sparInt *labels )
+{
+	// Check matrices
+	if( labels->nx != matrix->nx || labels->ny != matrix->ny || labels->nz != matrix->nz ||
+		labels->bs != matrix->bs )
+	{
+		fprintf(stderr, "sparDoubleLabel error: Matrix and block sizes must agree\n");
+		exit(1);
+	}
 
-		matrix->nx = nx;
-		matrix->mx = mx;
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
 
-		free(matrix->blockData);
-		free(matrix->blockValue);
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
-	}
+	// Number of blocks
+	int blocks;
+	blocks = mx * my * mz;
 
-	// Expand y
-	if( ny > matrix->ny )
-	{
-		// New block grid size
-		mx = matrix->mx;
-		my = (int)( ( ny + bs - 1 ) / bs );
-		mz = matrix->mz;
+	// First node of each block: one for non-default uniform blocks, one per element for heterogeneous blocks
+	int *offset;
+	offset = (int*) malloc( blocks * sizeof(int) );
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (float*) calloc( blocks, sizeof(float) ); // Sets to 0s
-		blockData = (float**) calloc( blocks, sizeof(float*) ); // Sets to NULLs
+	if( offset == NULL )
+	{
+	   fprintf(stderr, "sparDoubleLabel error: Out of memory\n");
+	   exit(1);
+	}
 
-		if( blockValue == NULL || blockData == NULL )
-		{
-		   fprintf(stderr, "sparFloatResize error: Out of memory\n");
-		   exit(1);
-		}
+	double nodes;
+	nodes = 0.0;
 
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+	int n;
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		if( matrix->blockData[n] != NULL )
 		{
-			for( j = 0 ; j < matrix->my ; j++ )
-			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
-				}
-			}
+			offset[n] = (int)( nodes );
+			nodes += bs3;
 		}
-		// Create new blocks
-		for( k = 0 ; k < mz ; k++ )
+		else if( sparDoubleEqual( matrix->blockValue[n], matrix->def ) == 0 )
 		{
-			for( j = matrix->my ; j < my ; j++ )
-			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j +  my * k ) ] = def;
-					blockData[ i + mx * ( j +  my * k ) ] = NULL;
-				}
-			}
+			offset[n] = (int)( nodes );
+			nodes += 1;
 		}
-
-		int yi, yf;
-		yi = matrix->ny;
-		yf = matrix->bs * matrix->my;
-		if( yf >= ny )
+		else
 		{
-			yf = ny - 1;
+			offset[n] = -1;
 		}
+	}
 
-		matrix->ny = ny;
-		matrix->my = my;
-
-		free(matrix->blockData);
-		free(matrix->blockValue);
+	if( nodes > INT_MAX )
+	{
+		fprintf(stderr, "sparDoubleLabel error: Too many heterogeneous blocks\n");
+		exit(1);
+	}
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
+	// Union-find forest, -1 for unused nodes of default elements
+	int *parent;
+	parent = (int*) malloc( ( (int)( nodes ) + 1 ) * sizeof(int) );
 
-		// Set expanded elements to default
-		for( k = 0 ; k < matrix->nz ; k++ )
-		{
-			for( j = yi ; j < yf ; j++ )
-			{
-				for( i = 0 ; i < matrix->nx ; i++ )
-				{
-					sparFloatSet( matrix, i, j, k, def );
-				}
-			}
-		}
+	if( parent == NULL )
+	{
+	   fprintf(stderr, "sparDoubleLabel error: Out of memory\n");
+	   exit(1);
 	}
-	// Shrink y
-	else if( ny < matrix->ny )
+
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
 	{
-		// New block grid size
-		mx = matrix->mx;
-		my = (int)( ( ny + bs - 1 ) / bs );
-		mz = matrix->mz;
+		if( offset[n] < 0 )
+		{
+			continue;
+		}
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (float*) calloc( blocks, sizeof(float) ); // Sets to 0s
-		blockData = (float**) calloc( blocks, sizeof(float*) ); // Sets to NULLs
+		double *blockData;
+		blockData = matrix->blockData[n];
 
-		if( blockValue == NULL || blockData == NULL )
+		if( blockData == NULL )
 		{
-		   fprintf(stderr, "sparFloatResize error: Out of memory\n");
-		   exit(1);
+			parent[ offset[n] ] = offset[n];
+			continue;
 		}
 
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+		// Block extent inside the matrix
+		int ex, ey, ez;
+		ex = matrix->nx - ( n % mx ) * bs;
+		ey = matrix->ny - ( ( n / mx ) % my ) * bs;
+		ez = matrix->nz - ( n / ( mx * my ) ) * bs;
+
+		int i, j, k, e;
+		for( k = 0 ; k < bs ; k++ )
 		{
-			for( j = 0 ; j < my ; j++ )
+			for( j = 0 ; j < bs ; j++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				for( i = 0 ; i < bs ; i++ )
 				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
+					e = i + bs * ( j + bs * k );
+					if( i < ex && j < ey && k < ez && sparDoubleEqual( blockData[e], matrix->def ) == 0 )
+					{
+						parent[ offset[n] + e ] = offset[n] + e;
+					}
+					else
+					{
+						parent[ offset[n] + e ] = -1;
+					}
 				}
 			}
 		}
+	}
 
-		// Free excedent blocks
-		for( k = 0 ; k < mz ; k++ )
+	// Connect blocks within slabs of block layers in parallel, slabs hold disjoint node ranges
+	int slab, slabs;
+	slab = 8;
+	slabs = ( mz + slab - 1 ) / slab;
+
+	int s;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(dynamic)
+	#endif
+	for( s = 0 ; s < slabs ; s++ )
+	{
+		int i1, j1, k1;
+		for( k1 = s * slab ; k1 < ( s + 1 ) * slab && k1 < mz ; k1++ )
 		{
-			for( j = my ; j < matrix->my ; j++ )
+			for( j1 = 0 ; j1 < my ; j1++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				for( i1 = 0 ; i1 < mx ; i1++ )
 				{
-					if( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
+					sparDoubleLabelBlock( matrix, offset, parent, i1, j1, k1 );
+					if( i1 > 0 )
+					{
+						sparDoubleLabelFace( matrix, offset, parent, i1, j1, k1, 0 );
+					}
+					if( j1 > 0 )
 					{
-						free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
+						sparDoubleLabelFace( matrix, offset, parent, i1, j1, k1, 1 );
+					}
+					if( k1 > s * slab )
+					{
+						sparDoubleLabelFace( matrix, offset, parent, i1, j1, k1, 2 );
 					}
 				}
 			}
 		}
+	}
 
-		matrix->ny = ny;
-		matrix->my = my;
-
-		free(matrix->blockData);
-		free(matrix->blockValue);
-
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
+	// Merge slabs across their boundary layers
+	int i1, j1;
+	for( s = 1 ; s < slabs ; s++ )
+	{
+		for( j1 = 0 ; j1 < my ; j1++ )
+		{
+			for( i1 = 0 ; i1 < mx ; i1++ )
+			{
+				sparDoubleLabelFace( matrix, offset, parent, i1, j1, s * slab, 2 );
+			}
+		}
 	}
 
-	// Expand z
-	if( nz > matrix->nz )
+	// Consecutive labels from 1, roots are the smallest node of each set and parents precede children
+	int count;
+	count = 0;
+
+	int i;
+	for( i = 0 ; i < (int)( nodes ) ; i++ )
 	{
-		// New block grid size
-		mx = matrix->mx;
-		my = matrix->my;
-		mz = (int)( ( nz + bs - 1 ) / bs );
+		if( parent[i] == i )
+		{
+			parent[i] = ++count;
+		}
+		else if( parent[i] >= 0 )
+		{
+			parent[i] = parent[ parent[i] ];
+		}
+	}
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (float*) calloc( blocks, sizeof(float) ); // Sets to 0s
-		blockData = (float**) calloc( blocks, sizeof(float*) ); // Sets to NULLs
+	// Write labels
+	labels->def = 0;
 
-		if( blockValue == NULL || blockData == NULL )
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
+	{
+		// Free previous labels
+		if( labels->blockData[n] != NULL )
 		{
-		   fprintf(stderr, "sparFloatResize error: Out of memory\n");
-		   exit(1);
+			free(labels->blockData[n]);
+			labels->blockData[n] = NULL;
 		}
 
-		// Copy existing blocks
-		for( k = 0 ; k < matrix->mz ; k++ )
+		// Default uniform block
+		if( offset[n] < 0 )
 		{
-			for( j = 0 ; j < my ; j++ )
-			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
-				}
-			}
+			labels->blockValue[n] = 0;
 		}
-		// Create new blocks
-		for( k = matrix->mz ; k < mz ; k++ )
+		// Non-default uniform block
+		else if( matrix->blockData[n] == NULL )
 		{
-			for( j = 0 ; j < my ; j++ )
+			labels->blockValue[n] = parent[ offset[n] ];
+		}
+		// Heterogeneous block
+		else
+		{
+			int *blockData;
+			blockData = (int*) calloc( bs3, sizeof(int) );
+
+			if( blockData == NULL )
 			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j +  my * k ) ] = def;
-					blockData[ i + mx * ( j +  my * k ) ] = NULL;
-				}
+			   fprintf(stderr, "sparDoubleLabel error: Out of memory\n");
+			   exit(1);
 			}
-		}
 
-		int zi, zf;
-		zi = matrix->nz;
-		zf = matrix->bs * matrix->mz;
-		if( zf >= nz )
-		{
-			zf = nz - 1;
-		}
+			int e;
+			for( e = 0 ; e < bs3 ; e++ )
+			{
+				blockData[e] = parent[ offset[n] + e ] < 0 ? 0 : parent[ offset[n] + e ];
+			}
 
-		matrix->nz = nz;
-		matrix->mz = mz;
+			labels->blockData[n] = blockData;
+			sparIntReduceBlock( labels, n % mx, ( n / mx ) % my, n / ( mx * my ) );
+		}
+	}
 
-		free(matrix->blockData);
-		free(matrix->blockValue);
+	free(offset);
+	free(parent);
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
+	return count;
+}
 
-		// Set expanded elements to default
-		for( k = zi ; k < zf ; k++ )
+// Squared distance transform of sampled function f into d (Felzenszwalb), v and z hold n and n+1 elements
+void sparDoubleDistanceLine( double *f, double *d, int n, int *v, double *z )
+{
+	int q, k;
+	double s;
+
+	// Lower envelope of parabolas rooted at (q,f[q])
+	k = 0;
+	v[0] = 0;
+	z[0] = -HUGE_VAL;
+	z[1] = HUGE_VAL;
+	for( q = 1 ; q < n ; q++ )
+	{
+		s = ( ( f[q] + (double)q * q ) - ( f[ v[k] ] + (double)v[k] * v[k] ) ) / ( 2.0 * ( q - v[k] ) );
+		while( s <= z[k] )
 		{
-			for( j = 0 ; j < matrix->ny ; j++ )
-			{
-				for( i = 0 ; i < matrix->nx ; i++ )
-				{
-					sparFloatSet( matrix, i, j, k, def );
-				}
-			}
+			k--;
+			s = ( ( f[q] + (double)q * q ) - ( f[ v[k] ] + (double)v[k] * v[k] ) ) / ( 2.0 * ( q - v[k] ) );
 		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[ k + 1 ] = HUGE_VAL;
 	}
-	// Shrink z
-	else if( nz < matrix->nz )
+
+	// Sample the envelope
+	k = 0;
+	for( q = 0 ; q < n ; q++ )
 	{
-		// New block grid size
-		mx = matrix->mx;
-		my = matrix->my;
-		mz = (int)( ( nz + bs - 1 ) / bs );
+		while( z[ k + 1 ] < q )
+		{
+			k++;
+		}
+		d[q] = (double)( q - v[k] ) * ( q - v[k] ) + f[ v[k] ];
+	}
+}
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (float*) calloc( blocks, sizeof(float) ); // Sets to 0s
-		blockData = (float**) calloc( blocks, sizeof(float*) ); // Sets to NULLs
+// Squared distance pass along axis (0 x, 1 y, 2 z) in place, or from features of matrix if not NULL (default elements if inside)
+void sparDoubleDistanceAxis( sparDouble *matrix, sparFloat *distance, int axis, float big, int inside )
+{
+	// Distance block size
+	int bs;
+	bs = distance->bs;
 
-		if( blockValue == NULL || blockData == NULL )
+	// Line length and number of block rows along the other two axes
+	int nl, ma, mb;
+	nl = axis == 0 ? distance->nx : ( axis == 1 ? distance->ny : distance->nz );
+	ma = axis == 0 ? distance->my : distance->mx;
+	mb = axis == 2 ? distance->my : distance->mz;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Row of blocks and one line
+		float *box;
+		double *source;
+		double *f, *d, *z;
+		int *v;
+		box = (float*) malloc( nl * bs * bs * sizeof(float) );
+		source = (double*) malloc( nl * bs * bs * sizeof(double) );
+		f = (double*) malloc( nl * sizeof(double) );
+		d = (double*) malloc( nl * sizeof(double) );
+		z = (double*) malloc( ( nl + 1 ) * sizeof(double) );
+		v = (int*) malloc( nl * sizeof(int) );
+
+		if( box == NULL || source == NULL || f == NULL || d == NULL || z == NULL || v == NULL )
 		{
-		   fprintf(stderr, "sparFloatResize error: Out of memory\n");
+		   fprintf(stderr, "sparDoubleDistanceAxis error: Out of memory\n");
 		   exit(1);
 		}
 
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+		// For each row of blocks along the axis, lines are independent
+		int g;
+		#ifdef _OPENMP
+		#pragma omp for schedule(dynamic)
+		#endif
+		for( g = 0 ; g < ma * mb ; g++ )
 		{
-			for( j = 0 ; j < my ; j++ )
+			// Box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) inside the matrix
+			int x, y, zz, sx, sy, sz;
+			x = axis == 0 ? 0 : ( g % ma ) * bs;
+			y = axis == 1 ? 0 : ( axis == 0 ? ( g % ma ) * bs : ( g / ma ) * bs );
+			zz = axis == 2 ? 0 : ( g / ma ) * bs;
+			sx = axis == 0 ? distance->nx : ( distance->nx - x < bs ? distance->nx - x : bs );
+			sy = axis == 1 ? distance->ny : ( distance->ny - y < bs ? distance->ny - y : bs );
+			sz = axis == 2 ? distance->nz : ( distance->nz - zz < bs ? distance->nz - zz : bs );
+
+			int i;
+
+			// First pass, features of matrix
+			if( matrix != NULL )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				double value;
+				if( sparDoubleUniformBox( matrix, x, y, zz, sx, sy, sz, &value ) )
 				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
+					sparFloatFillBox( distance, x, y, zz, sx, sy, sz,
+									  ( ( sparDoubleEqual( value, matrix->def ) == 0 ) != inside ) ? 0.0f : big );
+					continue;
+				}
+				sparDoubleGetBox( matrix, x, y, zz, sx, sy, sz, source );
+				for( i = 0 ; i < sx * sy * sz ; i++ )
+				{
+					box[i] = ( ( sparDoubleEqual( source[i], matrix->def ) == 0 ) != inside ) ? 0.0f : big;
 				}
 			}
-		}
-
-		// Free excedent blocks
-		for( k = mz ; k < matrix->mz ; k++ )
-		{
-			for( j = 0 ; j < my ; j++ )
+			// Next passes, constant lines are left unchanged
+			else
 			{
-				for( i = 0 ; i < mx ; i++ )
+				float value;
+				if( sparFloatUniformBox( distance, x, y, zz, sx, sy, sz, &value ) )
 				{
-					if( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
-					{
-						free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
-					}
+					continue;
 				}
+				sparFloatGetBox( distance, x, y, zz, sx, sy, sz, box );
 			}
-		}
 
-		matrix->nz = nz;
-		matrix->mz = mz;
+			// Line stride and number of lines
+			int stride, lines;
+			stride = axis == 0 ? 1 : ( axis == 1 ? sx : sx * sy );
+			lines = sx * sy * sz / nl;
 
-		free(matrix->blockData);
-		free(matrix->blockValue);
+			// For each line
+			int l;
+			for( l = 0 ; l < lines ; l++ )
+			{
+				// First line element
+				float *line;
+				if( axis == 0 )
+				{
+					line = box + nl * l;
+				}
+				else if( axis == 1 )
+				{
+					line = box + ( l % sx ) + sx * sy * ( l / sx );
+				}
+				else
+				{
+					line = box + l;
+				}
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
+				for( i = 0 ; i < nl ; i++ )
+				{
+					f[i] = line[ i * stride ];
+				}
+
+				sparDoubleDistanceLine( f, d, nl, v, z );
+
+				// Clamp at big
+				for( i = 0 ; i < nl ; i++ )
+				{
+					line[ i * stride ] = d[i] < big ? (float)( d[i] ) : big;
+				}
+			}
+
+			sparFloatSetBox( distance, x, y, zz, sx, sy, sz, box );
+		}
+
+		free(box);
+		free(source);
+		free(f);
+		free(d);
+		free(z);
+		free(v);
 	}
 }
 
-
-// Matrix constructor
-sparDouble* sparDoubleInit( int nx, int ny, int nz, int bs, double def )
+// Euclidean distance from each element to the nearest non-default element clamped at maxDistance, negative inside if sign
+void sparDoubleDistance( sparDouble *matrix, sparFloat *distance, float maxDistance, int sign )
 {
-	// Check matrix size
-	if( !( nx > 0 && ny > 0 && nz > 0 ) )
+	// Check matrices
+	if( distance->nx != matrix->nx || distance->ny != matrix->ny || distance->nz != matrix->nz )
 	{
-		fprintf(stderr, "sparDoubleInit error: Matrix size must be positive\n");
+		fprintf(stderr, "sparDoubleDistance error: Matrix sizes must agree\n");
 		exit(1);
 	}
 
-	// Check block size
-	if( !( bs > 1 ) )
+	if( !( maxDistance > 0.0f ) )
 	{
-		fprintf(stderr, "sparDoubleInit error: Block size must be greater than 1\n");
+		fprintf(stderr, "sparDoubleDistance error: Maximum distance must be positive\n");
 		exit(1);
 	}
 
-	// Declare struct and allocate space
-	sparDouble *matrix;
-	matrix = (sparDouble*) malloc(sizeof(sparDouble));
+	// Squared distances are clamped, far regions become uniform
+	float big;
+	big = maxDistance * maxDistance;
 
-	if( matrix == NULL )
+	// Squared distance to non-default elements
+	sparDoubleDistanceAxis( matrix, distance, 0, big, 0 );
+	sparDoubleDistanceAxis( NULL, distance, 1, big, 0 );
+	sparDoubleDistanceAxis( NULL, distance, 2, big, 0 );
+
+	// Squared distance to default elements
+	sparFloat *inner;
+	inner = NULL;
+	if( sign )
 	{
-	   fprintf(stderr, "sparDoubleInit error: Out of memory\n");
-	   exit(1);
+		inner = sparFloatInit( distance->nx, distance->ny, distance->nz, distance->bs, big );
+		sparDoubleDistanceAxis( matrix, inner, 0, big, 1 );
+		sparDoubleDistanceAxis( NULL, inner, 1, big, 1 );
+		sparDoubleDistanceAxis( NULL, inner, 2, big, 1 );
 	}
 
-	// Set matrix size (nx,ny,nz)
-	matrix->nx = nx;
-	matrix->ny = ny;
-	matrix->nz = nz;
+	// Distance, outer minus inner if signed
+	int mx, my, mz;
+	mx = distance->mx;
+	my = distance->my;
+	mz = distance->mz;
 
-	// Set block size (bs,bs,bs)
-	matrix->bs  = bs;
-	matrix->bs3 = bs * bs * bs;
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < mx * my * mz ; n++ )
+	{
+		int i1, j1, k1;
+		i1 = n % mx;
+		j1 = ( n / mx ) % my;
+		k1 = n / ( mx * my );
+
+		float *blockData, *innerData, innerValue;
+		blockData = distance->blockData[n];
+		innerData = inner == NULL ? NULL : inner->blockData[n];
+		innerValue = inner == NULL ? 0.0f : inner->blockValue[n];
+
+		// Uniform blocks
+		if( blockData == NULL && innerData == NULL )
+		{
+			distance->blockValue[n] = sqrtf( distance->blockValue[n] ) - sqrtf( innerValue );
+			continue;
+		}
 
-	// Set block matrix size (mx,my,mz)
-	matrix->mx = (int)( ( nx + bs - 1 ) / bs );
-	matrix->my = (int)( ( ny + bs - 1 ) / bs );
-	matrix->mz = (int)( ( nz + bs - 1 ) / bs );
+		// Heterogeneous blocks
+		sparFloatExpandBlock( distance, i1, j1, k1 );
+		blockData = distance->blockData[n];
 
-	// Number of blocks
-	int blocks = matrix->mx * matrix->my * matrix->mz;
+		int i;
+		for( i = 0 ; i < distance->bs3 ; i++ )
+		{
+			blockData[i] = sqrtf( blockData[i] ) - sqrtf( innerData == NULL ? innerValue : innerData[i] );
+		}
 
-	// Allocate space for block uniform data
-	matrix->blockValue = (double*) calloc( blocks, sizeof(double) );
+		sparFloatReduceBlock( distance, i1, j1, k1 );
+	}
 
-	if( matrix->blockValue == NULL )
+	distance->def = maxDistance;
+
+	if( inner != NULL )
 	{
-	   fprintf(stderr, "sparDoubleInit error: Out of memory\n");
-	   exit(1);
+		sparFloatFree( inner );
 	}
+}
 
-	// Allocate space for block heterogeneous data arrays
-	matrix->blockData = (double**) calloc( blocks, sizeof(double*) );
+// Cast ray o+t*d (element (x,y,z) spans [x,x+1)) for 0 <= t <= tmax, return 1 with first non-default element hit[3] at t
+int sparDoubleRay( sparDouble *matrix, double *o, double *d, double tmax, int *hit, double *t )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
 
-	if( matrix->blockData == NULL )
+	// Matrix size
+	int size[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+
+	// Clip ray to the matrix bounds
+	double t0, t1;
+	t0 = 0.0;
+	t1 = tmax;
+
+	int a;
+	for( a = 0 ; a < 3 ; a++ )
 	{
-	   fprintf(stderr, "sparDoubleInit error: Out of memory\n");
-	   exit(1);
+		if( d[a] == 0.0 )
+		{
+			if( o[a] < 0.0 || o[a] >= size[a] )
+			{
+				return 0;
+			}
+		}
+		else
+		{
+			double ta, tb;
+			ta = ( 0.0 - o[a] ) / d[a];
+			tb = ( size[a] - o[a] ) / d[a];
+			if( ta > tb )
+			{
+				double tc;
+				tc = ta;
+				ta = tb;
+				tb = tc;
+			}
+			t0 = ta > t0 ? ta : t0;
+			t1 = tb < t1 ? tb : t1;
+		}
 	}
 
-	// Set default value
-	matrix->def = def;
+	if( t0 > t1 )
+	{
+		return 0;
+	}
 
-	// Set matrix elemets to default value
-	int i;
-	for( i = 0 ; i < blocks ; i++ )
+	// Entry element, step direction, next element boundary and boundary spacing per axis
+	int v[3], step[3];
+	double tnext[3], tdelta[3];
+	for( a = 0 ; a < 3 ; a++ )
 	{
-		matrix->blockData[i] = NULL; // Flag for uniform block
-		matrix->blockValue[i] = def;
+		v[a] = (int)( floor( o[a] + t0 * d[a] ) );
+		v[a] = v[a] < 0 ? 0 : ( v[a] >= size[a] ? size[a] - 1 : v[a] );
+		step[a] = d[a] > 0.0 ? 1 : -1;
+		tdelta[a] = d[a] == 0.0 ? HUGE_VAL : fabs( 1.0 / d[a] );
+		tnext[a] = d[a] == 0.0 ? HUGE_VAL : ( v[a] + ( step[a] > 0 ) - o[a] ) / d[a];
 	}
 
-	// Return pointer
-	return matrix;
-}
+	double tc;
+	tc = t0;
+
+	while( tc <= t1 )
+	{
+		// Linear block index (n) of element v
+		int b[3], n;
+		b[0] = v[0] / bs;
+		b[1] = v[1] / bs;
+		b[2] = v[2] / bs;
+		n = b[0] + matrix->mx * ( b[1] + matrix->my * b[2] );
+
+		// Uniform block
+		if( matrix->blockData[n] == NULL )
+		{
+			// Hit on entry
+			if( sparDoubleEqual( matrix->blockValue[n], matrix->def ) == 0 )
+			{
+				break;
+			}
+
+			// Skip to the block exit
+			int amin;
+			double tb[3];
+			amin = 0;
+			for( a = 0 ; a < 3 ; a++ )
+			{
+				tb[a] = d[a] == 0.0 ? HUGE_VAL : ( ( b[a] + ( step[a] > 0 ) ) * bs - o[a] ) / d[a];
+				if( tb[a] < tb[amin] )
+				{
+					amin = a;
+				}
+			}
+			tc = tb[amin];
+
+			// Element of the next block, stay inside the current block on the other axes
+			for( a = 0 ; a < 3 ; a++ )
+			{
+				if( a == amin )
+				{
+					v[a] = step[a] > 0 ? ( b[a] + 1 ) * bs : b[a] * bs - 1;
+				}
+				else
+				{
+					v[a] = (int)( floor( o[a] + tc * d[a] ) );
+					v[a] = v[a] < b[a] * bs ? b[a] * bs : ( v[a] >= ( b[a] + 1 ) * bs ? ( b[a] + 1 ) * bs - 1 : v[a] );
+				}
+				tnext[a] = d[a] == 0.0 ? HUGE_VAL : ( v[a] + ( step[a] > 0 ) - o[a] ) / d[a];
+			}
+		}
+		// Heterogeneous block, element by element
+		else
+		{
+			// Hit
+			int i;
+			i = v[0] % bs + bs * ( v[1] % bs + bs * ( v[2] % bs ) );
+			if( sparDoubleEqual( matrix->blockData[n][i], matrix->def ) == 0 )
+			{
+				break;
+			}
 
-// Matrix destructor
-void sparDoubleFree( sparDouble *matrix )
-{
-	// Number of blocks
-	int blocks;
-	blocks = matrix->mx * matrix->my * matrix->mz;
+			// Step to the next element
+			int amin;
+			amin = 0;
+			for( a = 1 ; a < 3 ; a++ )
+			{
+				if( tnext[a] < tnext[amin] )
+				{
+					amin = a;
+				}
+			}
+			tc = tnext[amin];
+			v[amin] += step[amin];
+			tnext[amin] += tdelta[amin];
+		}
 
-	// Free heterogeneous blocks
-	int i;
-	for( i = 0 ; i < blocks ; i++ )
-	{
-		if( matrix->blockData[i] != NULL ) // Flag for uniform block
+		// Left the matrix
+		if( v[0] < 0 || v[1] < 0 || v[2] < 0 || v[0] >= size[0] || v[1] >= size[1] || v[2] >= size[2] )
 		{
-			free( matrix->blockData[i] );
+			return 0;
 		}
 	}
 
-	// Free block uniform data
-	free(matrix->blockValue);
+	// Beyond tmax or matrix exit
+	if( tc > t1 )
+	{
+		return 0;
+	}
 
-	// Free block heterogeneous data array
-	free(matrix->blockData);
+	hit[0] = v[0];
+	hit[1] = v[1];
+	hit[2] = v[2];
+	*t = tc;
 
-	// Free matrix instance
-	free(matrix);
+	return 1;
 }
 
-// Reset matrix values
-void sparDoubleReset( sparDouble *matrix )
+// Cast n rays o[3*i]+t*d[3*i] in parallel, hits[3*i] and t[i] (-1 if missed), return number of hits
+int sparDoubleRays( sparDouble *matrix, int n, double *o, double *d, double tmax, int *hits, double *t )
 {
-	// Number of blocks
-	int blocks;
-	blocks = matrix->mx * matrix->my * matrix->mz;
+	int count;
+	count = 0;
 
-	// Reduce blocks and set to default value
 	int i;
-	for( i = 0 ; i < blocks ; i++ )
+	#ifdef _OPENMP
+	#pragma omp parallel for reduction(+:count) schedule(guided)
+	#endif
+	for( i = 0 ; i < n ; i++ )
 	{
-		// Heterogeneous block
-		if( matrix->blockData[i] != NULL )
+		if( sparDoubleRay( matrix, o + 3 * i, d + 3 * i, tmax, hits + 3 * i, t + i ) )
 		{
-			free( matrix->blockData[i] );
-			matrix->blockData[i] = NULL;
+			count++;
+		}
+		else
+		{
+			t[i] = -1.0;
 		}
-		matrix->blockValue[i] = matrix->def;
 	}
+
+	return count;
 }
 
-// Get matrix memory usage in bytes
-double sparDoubleMemory( sparDouble *matrix )
+// Copy plane at index along axis into buffer, YZ (axis 0) y+ny*z, XZ (axis 1) x+nx*z, XY (axis 2) x+nx*y
+void sparDoubleSlice( sparDouble *matrix, int axis, int index, double *buffer )
 {
-	// Number of blocks
-	int blocks;
-	blocks = matrix->mx * matrix->my * matrix->mz;
-
-	// Matrix instance
-	double size;
-	size = (double)( sizeof(sparDouble) );
-
-	// Uniform block data
-	size = size + (double)( blocks * sizeof(double) );
-
-	// Heterogeneous block data arrays
-	size = size + (double)( blocks * sizeof(double*) );
+	// Matrix size
+	int nx, ny, nz;
+	nx = matrix->nx;
+	ny = matrix->ny;
+	nz = matrix->nz;
 
-	// Heterogeneous block data
-	int i;
-	for( i = 0 ; i < blocks ; i++ )
+	// Check plane
+	if( axis < 0 || axis > 2 || index < 0 ||
+		index >= ( axis == 0 ? nx : ( axis == 1 ? ny : nz ) ) )
 	{
-		// Heterogeneous block
-		if( matrix->blockData[i] != NULL )
-		{
-			size = size + (double)( sizeof(double) * matrix->bs3 );
-		}
+		fprintf(stderr, "sparDoubleSlice error: Plane outside the matrix\n");
+		exit(1);
 	}
 
-	return size;
-}
-
-// Check if block is uniform
-int sparDoubleUniformBlock( sparDouble *matrix, int x, int y, int z )
-{
 	// Block size
-	int bs, bs3;
+	int bs;
 	bs = matrix->bs;
-	bs3 = matrix->bs3;
 
 	// Block matrix size (mx,my,mz)
 	int mx, my, mz;
@@ -4300,817 +28317,2374 @@ int sparDoubleUniformBlock( sparDouble *matrix, int x, int y, int z )
 	my = matrix->my;
 	mz = matrix->mz;
 
-	// Linear block index (n) <-> (x,y,z)
-	int n;
-	n = x + mx * ( y + my * z );
+	// Block layer and element layer in the block
+	int b1, b2;
+	b1 = index / bs;
+	b2 = index % bs;
 
-	// Block data array
-	double *blockData;
-	blockData = matrix->blockData[n];
+	// XY plane, contiguous block rows
+	if( axis == 2 )
+	{
+		int j1;
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(guided)
+		#endif
+		for( j1 = 0 ; j1 < my ; j1++ )
+		{
+			int i1, i, j, ex, ey, n;
+			ey = ny - j1 * bs < bs ? ny - j1 * bs : bs;
+			for( i1 = 0 ; i1 < mx ; i1++ )
+			{
+				ex = nx - i1 * bs < bs ? nx - i1 * bs : bs;
+				n = i1 + mx * ( j1 + my * b1 );
+				for( j = 0 ; j < ey ; j++ )
+				{
+					double *row;
+					row = buffer + i1 * bs + nx * ( j1 * bs + j );
 
-	// Uniform block
-	if( blockData == NULL )
+					// Uniform block
+					if( matrix->blockData[n] == NULL )
+					{
+						for( i = 0 ; i < ex ; i++ )
+						{
+							row[i] = matrix->blockValue[n];
+						}
+					}
+					// Heterogeneous block
+					else
+					{
+						memcpy( row, matrix->blockData[n] + bs * ( j + bs * b2 ), ex * sizeof(double) );
+					}
+				}
+			}
+		}
+	}
+	// XZ plane, contiguous block rows
+	else if( axis == 1 )
 	{
-		return 1;
+		int k1;
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(guided)
+		#endif
+		for( k1 = 0 ; k1 < mz ; k1++ )
+		{
+			int i1, i, k, ex, ez, n;
+			ez = nz - k1 * bs < bs ? nz - k1 * bs : bs;
+			for( i1 = 0 ; i1 < mx ; i1++ )
+			{
+				ex = nx - i1 * bs < bs ? nx - i1 * bs : bs;
+				n = i1 + mx * ( b1 + my * k1 );
+				for( k = 0 ; k < ez ; k++ )
+				{
+					double *row;
+					row = buffer + i1 * bs + nx * ( k1 * bs + k );
+
+					// Uniform block
+					if( matrix->blockData[n] == NULL )
+					{
+						for( i = 0 ; i < ex ; i++ )
+						{
+							row[i] = matrix->blockValue[n];
+						}
+					}
+					// Heterogeneous block
+					else
+					{
+						memcpy( row, matrix->blockData[n] + bs * ( b2 + bs * k ), ex * sizeof(double) );
+					}
+				}
+			}
+		}
 	}
+	// YZ plane, block elements are strided by bs
+	else
+	{
+		int k1;
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(guided)
+		#endif
+		for( k1 = 0 ; k1 < mz ; k1++ )
+		{
+			int j1, j, k, ey, ez, n;
+			ez = nz - k1 * bs < bs ? nz - k1 * bs : bs;
+			for( j1 = 0 ; j1 < my ; j1++ )
+			{
+				ey = ny - j1 * bs < bs ? ny - j1 * bs : bs;
+				n = b1 + mx * ( j1 + my * k1 );
+				for( k = 0 ; k < ez ; k++ )
+				{
+					double *row;
+					row = buffer + j1 * bs + ny * ( k1 * bs + k );
 
-	int isUniform;
-	isUniform = 1;
+					// Uniform block
+					if( matrix->blockData[n] == NULL )
+					{
+						for( j = 0 ; j < ey ; j++ )
+						{
+							row[j] = matrix->blockValue[n];
+						}
+					}
+					// Heterogeneous block, gather column of the block
+					else
+					{
+						double *column;
+						column = matrix->blockData[n] + b2 + bs * bs * k;
+						for( j = 0 ; j < ey ; j++ )
+						{
+							row[j] = column[ bs * j ];
+						}
+					}
+				}
+			}
+		}
+	}
+}
 
-	// Inner block
-	if( x < mx - 1 && y < my - 1 && z < mz - 1)
+// Accumulate value, repeated count times, into o[0..n-1] with op (projection kernel)
+void sparDoubleProjectValue( double *o, int n, double value, int count, int op, double def )
+{
+	int i;
+	switch( op )
 	{
-		// Start with last element
-		double value;
-		value = blockData[ bs3 - 1 ];
-
-		// Read block elements
-		int i;
-		for( i = 0 ; i < bs3 ; i++ )
-		{
-			if( blockData[i] != value )
+		case SPAR_ADD:
+			for( i = 0 ; i < n ; i++ )
 			{
-				isUniform = 0;
-				i = bs3;
+				o[i] += (double)( value ) * count;
+			}
+			break;
+		case SPAR_MIN:
+			for( i = 0 ; i < n ; i++ )
+			{
+				o[i] = value < o[i] ? value : o[i];
+			}
+			break;
+		case SPAR_MAX:
+			for( i = 0 ; i < n ; i++ )
+			{
+				o[i] = value > o[i] ? value : o[i];
+			}
+			break;
+		case SPAR_COUNT:
+			if( sparDoubleEqual( value, def ) == 0 )
+			{
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] += count;
+				}
 			}
+			break;
+	}
+}
+
+// Accumulate row[0..n-1] into o[0..n-1], or into o[0] if reduce, with op (projection kernel)
+void sparDoubleProjectRow( double *o, double *row, int n, int op, int reduce, double def )
+{
+	int i;
+
+	// Row along the projection axis
+	if( reduce )
+	{
+		double value;
+		value = o[0];
+		switch( op )
+		{
+			case SPAR_ADD:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value += row[i];
+				}
+				break;
+			case SPAR_MIN:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value = row[i] < value ? row[i] : value;
+				}
+				break;
+			case SPAR_MAX:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value = row[i] > value ? row[i] : value;
+				}
+				break;
+			case SPAR_COUNT:
+				for( i = 0 ; i < n ; i++ )
+				{
+					value += ( sparDoubleEqual( row[i], def ) == 0 );
+				}
+				break;
 		}
+		o[0] = value;
 	}
-	// Boundary block, with outside elements?
+	// Row across the projection axis
 	else
 	{
-		// Start with first element
-		double value;
-		value = blockData[0];
+		switch( op )
+		{
+			case SPAR_ADD:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] += row[i];
+				}
+				break;
+			case SPAR_MIN:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] = row[i] < o[i] ? row[i] : o[i];
+				}
+				break;
+			case SPAR_MAX:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] = row[i] > o[i] ? row[i] : o[i];
+				}
+				break;
+			case SPAR_COUNT:
+				for( i = 0 ; i < n ; i++ )
+				{
+					o[i] += ( sparDoubleEqual( row[i], def ) == 0 );
+				}
+				break;
+		}
+	}
+}
 
-		// Read block elements
-		int i, j, k;
-		for( k = 0 ; k < bs ; k++ )
+// Project along axis with op (SPAR_ADD, SPAR_MIN, SPAR_MAX, SPAR_COUNT) into dense plane, same layout as slices
+void sparDoubleProject( sparDouble *matrix, int axis, int op, double *buffer )
+{
+	// Check axis and operation
+	if( axis < 0 || axis > 2 )
+	{
+		fprintf(stderr, "sparDoubleProject error: Invalid axis\n");
+		exit(1);
+	}
+
+	if( op != SPAR_ADD && op != SPAR_MIN && op != SPAR_MAX && op != SPAR_COUNT )
+	{
+		fprintf(stderr, "sparDoubleProject error: Unknown operation\n");
+		exit(1);
+	}
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Matrix size (nx,ny,nz)
+	int nx, ny, nz;
+	nx = matrix->nx;
+	ny = matrix->ny;
+	nz = matrix->nz;
+
+	// Plane size (pa,pb), plane and axis block sizes (ma,mb,mc)
+	int pa, pb, ma, mb, mc;
+	pa = axis == 0 ? ny : nx;
+	pb = axis == 2 ? ny : nz;
+	ma = axis == 0 ? matrix->my : matrix->mx;
+	mb = axis == 2 ? matrix->my : matrix->mz;
+	mc = axis == 0 ? matrix->mx : ( axis == 1 ? matrix->my : matrix->mz );
+
+	// Initial values
+	int i;
+	for( i = 0 ; i < pa * pb ; i++ )
+	{
+		buffer[i] = op == SPAR_MIN ? HUGE_VAL : ( op == SPAR_MAX ? -HUGE_VAL : 0.0 );
+	}
+
+	// For each output tile
+	int t;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( t = 0 ; t < ma * mb ; t++ )
+	{
+		int a1, b1, c1;
+		a1 = t % ma;
+		b1 = t / ma;
+
+		// Tile extent
+		int ea, eb;
+		ea = pa - a1 * bs < bs ? pa - a1 * bs : bs;
+		eb = pb - b1 * bs < bs ? pb - b1 * bs : bs;
+
+		// For each block along the axis
+		for( c1 = 0 ; c1 < mc ; c1++ )
 		{
-			if( z * bs + k < matrix->nz ) // Avoid outside elements
-			for( j = 0 ; j < bs ; j++ )
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = axis == 0 ? c1 : a1;
+			j1 = axis == 0 ? a1 : ( axis == 1 ? c1 : b1 );
+			k1 = axis == 2 ? c1 : b1;
+
+			// Linear block index (n) <-> (i1,j1,k1)
+			int n;
+			n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = nx - i1 * bs < bs ? nx - i1 * bs : bs;
+			ey = ny - j1 * bs < bs ? ny - j1 * bs : bs;
+			ez = nz - k1 * bs < bs ? nz - k1 * bs : bs;
+
+			int b, j, k;
+
+			// Uniform block, whole column of elements at once
+			if( matrix->blockData[n] == NULL )
 			{
-				if( y * bs + j < matrix->ny ) // Idem
-				for( i = 0 ; i < bs ; i++ )
+				for( b = 0 ; b < eb ; b++ )
 				{
-					if( x * bs + i < matrix->nx ) // Idem
-					if( blockData[ i + bs * ( j + bs * k ) ] != value )
+					sparDoubleProjectValue( buffer + a1 * bs + pa * ( b1 * bs + b ), ea, matrix->blockValue[n],
+									  axis == 0 ? ex : ( axis == 1 ? ey : ez ), op, matrix->def );
+				}
+			}
+			// Heterogeneous block, row by row
+			else
+			{
+				for( k = 0 ; k < ez ; k++ )
+				{
+					for( j = 0 ; j < ey ; j++ )
 					{
-						isUniform = 0;
-						i = j = k = bs;
+						double *row;
+						row = matrix->blockData[n] + bs * ( j + bs * k );
+						if( axis == 0 )
+						{
+							sparDoubleProjectRow( buffer + ( j1 * bs + j ) + pa * ( k1 * bs + k ), row, ex, op, 1, matrix->def );
+						}
+						else if( axis == 1 )
+						{
+							sparDoubleProjectRow( buffer + i1 * bs + pa * ( k1 * bs + k ), row, ex, op, 0, matrix->def );
+						}
+						else
+						{
+							sparDoubleProjectRow( buffer + i1 * bs + pa * ( j1 * bs + j ), row, ex, op, 0, matrix->def );
+						}
 					}
 				}
 			}
 		}
 	}
+}
+
+// Order of two elements for qsort, NaN last
+int sparDoubleCompare( const void *a, const void *b )
+{
+	double va, vb;
+	va = *(const double*) a;
+	vb = *(const double*) b;
+
+	// NaN after any number
+	if( isnan( (double) va ) || isnan( (double) vb ) )
+	{
+		return ( isnan( (double) va ) != 0 ) - ( isnan( (double) vb ) != 0 );
+	}
+
+	return ( va > vb ) - ( va < vb );
+}
+
+// Recompute blocks of dst overlapping box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) from factor^3 cells of src, op SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE
+void sparDoubleDownsampleBox( sparDouble *dst, sparDouble *src, int factor, int op, int x, int y, int z, int sx, int sy, int sz )
+{
+	// Check matrices
+	if( factor < 1 || dst->nx != ( src->nx + factor - 1 ) / factor ||
+		dst->ny != ( src->ny + factor - 1 ) / factor || dst->nz != ( src->nz + factor - 1 ) / factor )
+	{
+		fprintf(stderr, "sparDoubleDownsampleBox error: Matrix sizes do not match the factor\n");
+		exit(1);
+	}
+
+	if( op != SPAR_MEAN && op != SPAR_MIN && op != SPAR_MAX && op != SPAR_MODE )
+	{
+		fprintf(stderr, "sparDoubleDownsampleBox error: Unknown operation\n");
+		exit(1);
+	}
 
-	return isUniform;
-}
+	// Clip box to dst
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > dst->nx ? dst->nx : x + sx;
+	y1 = y + sy > dst->ny ? dst->ny : y + sy;
+	z1 = z + sz > dst->nz ? dst->nz : z + sz;
 
-// Set matrix element (x,y,z)
-void sparDoubleSet( sparDouble *matrix, int x, int y, int z, double value )
-{
-	// Block size
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
+
+	// Destination block size
 	int bs, bs3;
-	bs = matrix->bs;
-	bs3 = matrix->bs3;
+	bs = dst->bs;
+	bs3 = dst->bs3;
+
+	// Source box size of one destination block
+	int cs;
+	cs = bs * factor;
+
+	// Range of destination blocks
+	int bx, by, bz, cx, cy, cz;
+	bx = x0 / bs;
+	by = y0 / bs;
+	bz = z0 / bs;
+	cx = ( x1 - 1 ) / bs - bx + 1;
+	cy = ( y1 - 1 ) / bs - by + 1;
+	cz = ( z1 - 1 ) / bs - bz + 1;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Source elements of one destination block and of one cell
+		double *buffer, *cell;
+		buffer = (double*) malloc( cs * cs * cs * sizeof(double) );
+		cell = (double*) malloc( factor * factor * factor * sizeof(double) );
 
-	// Block (i1,j1,k1) contains the element (x,y,z)
-	int i1, j1, k1;
-	i1 = x / bs;
-	j1 = y / bs;
-	k1 = z / bs;
+		if( buffer == NULL || cell == NULL )
+		{
+		   fprintf(stderr, "sparDoubleDownsampleBox error: Out of memory\n");
+		   exit(1);
+		}
 
-	// Element indices in the block
-	int i2, j2, k2;
-	i2 = x % bs;
-	j2 = y % bs;
-	k2 = z % bs;
+		// For each destination block
+		int t;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( t = 0 ; t < cx * cy * cz ; t++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = bx + t % cx;
+			j1 = by + ( t / cx ) % cy;
+			k1 = bz + t / ( cx * cy );
+
+			// Linear block index (n) <-> (i1,j1,k1)
+			int n;
+			n = i1 + dst->mx * ( j1 + dst->my * k1 );
+
+			// Free previous data
+			if( dst->blockData[n] != NULL )
+			{
+				free(dst->blockData[n]);
+				dst->blockData[n] = NULL;
+			}
 
-	// Linear block index (n) <-> (i1,j1,k1)
-	int n;
-	n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+			// Uniform source region, uniform destination block
+			double value;
+			if( sparDoubleUniformBox( src, i1 * cs, j1 * cs, k1 * cs, cs, cs, cs, &value ) )
+			{
+				dst->blockValue[n] = value;
+				continue;
+			}
 
-	// Block uniform value
-	double blockValue;
-	blockValue = matrix->blockValue[n];
+			// Read source region
+			sparDoubleGetBox( src, i1 * cs, j1 * cs, k1 * cs, cs, cs, cs, buffer );
 
-	// Block data array
-	double *blockData;
-	blockData = matrix->blockData[n];
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = dst->nx - i1 * bs < bs ? dst->nx - i1 * bs : bs;
+			ey = dst->ny - j1 * bs < bs ? dst->ny - j1 * bs : bs;
+			ez = dst->nz - k1 * bs < bs ? dst->nz - k1 * bs : bs;
 
-	// Uniform block
-	if( blockData == NULL )
-	{
-		// Input value is different
-		if( value != blockValue )
-		{
-			// Expand block
+			double *blockData;
 			blockData = (double*) calloc( bs3, sizeof(double) );
-			matrix->blockData[n] = blockData;
 
 			if( blockData == NULL )
 			{
-			   fprintf(stderr, "sparDoubleSet error: Out of memory\n");
+			   fprintf(stderr, "sparDoubleDownsampleBox error: Out of memory\n");
 			   exit(1);
 			}
 
-			// Set previous value
-			int i;
-			for( i = 0 ; i < bs3 ; i++ )
+			// For each destination element
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
 			{
-				blockData[i] = blockValue;
+				for( j = 0 ; j < ey ; j++ )
+				{
+					for( i = 0 ; i < ex ; i++ )
+					{
+						// Cell extent inside the source matrix
+						int fx, fy, fz;
+						fx = src->nx - ( i1 * bs + i ) * factor < factor ? src->nx - ( i1 * bs + i ) * factor : factor;
+						fy = src->ny - ( j1 * bs + j ) * factor < factor ? src->ny - ( j1 * bs + j ) * factor : factor;
+						fz = src->nz - ( k1 * bs + k ) * factor < factor ? src->nz - ( k1 * bs + k ) * factor : factor;
+
+						// Reduce cell, one tight loop per operation
+						int a, b, c, m;
+						int best, run;
+						double sum;
+						double *row, *r;
+						row = buffer + i * factor + cs * ( j * factor + cs * k * factor );
+						value = row[0];
+						switch( op )
+						{
+							case SPAR_MEAN:
+								sum = 0.0;
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											sum += r[a];
+										}
+									}
+								}
+								value = sparDoubleRound( sum / ( fx * fy * fz ) );
+								break;
+							case SPAR_MIN:
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											value = r[a] < value ? r[a] : value;
+										}
+									}
+								}
+								break;
+							case SPAR_MAX:
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											value = r[a] > value ? r[a] : value;
+										}
+									}
+								}
+								break;
+							case SPAR_MODE:
+								// Gather cell
+								m = 0;
+								for( c = 0 ; c < fz ; c++ )
+								{
+									for( b = 0 ; b < fy ; b++ )
+									{
+										r = row + cs * ( b + cs * c );
+										for( a = 0 ; a < fx ; a++ )
+										{
+											cell[ m + a ] = r[a];
+										}
+										m += fx;
+									}
+								}
+
+								// Longest run of sorted values
+								qsort( cell, m, sizeof(double), sparDoubleCompare );
+								value = cell[0];
+								best = 0;
+								run = 0;
+								for( a = 0 ; a < m ; a++ )
+								{
+									run = ( a > 0 && sparDoubleEqual( cell[a], cell[ a - 1 ] ) ) ? run + 1 : 1;
+									if( run > best )
+									{
+										best = run;
+										value = cell[a];
+									}
+								}
+								break;
+						}
+
+						blockData[ i + bs * ( j + bs * k ) ] = value;
+					}
+				}
 			}
 
-			// Set input value
-			blockData[ i2 + bs * ( j2 + bs * k2 ) ] = value;
+			// Write block and reduce if possible
+			dst->blockData[n] = blockData;
+			sparDoubleReduceBlock( dst, i1, j1, k1 );
 		}
-		// Else, do nothing
-	}
-	// Heterogeneous block
-	else
-	{
-		// Set input value
-		blockData[ i2 + bs * ( j2 + bs * k2 ) ] = value;
 
-		// Reduce block
-		if( sparDoubleUniformBlock( matrix, i1, j1, k1 ) )
-		{
-			matrix->blockValue[n] = value;
-			free(matrix->blockData[n]);
-			matrix->blockData[n] = NULL;
-		}
+		free(buffer);
+		free(cell);
 	}
 }
 
-// Get matrix element (x,y,z)
-double sparDoubleGet( sparDouble *matrix, int x, int y, int z )
+// New matrix downsampled by factor with op (SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE)
+sparDouble* sparDoubleDownsample( sparDouble *matrix, int factor, int op )
 {
-	// Block size
-	int bs;
-	bs = matrix->bs;
+	if( factor < 1 )
+	{
+		fprintf(stderr, "sparDoubleDownsample error: Factor must be positive\n");
+		exit(1);
+	}
 
-	// Block (i1,j1,k1) contains the element (x,y,z)
-	int i1, j1, k1;
-	i1 = x / bs;
-	j1 = y / bs;
-	k1 = z / bs;
+	// Declare matrix and init
+	sparDouble *matrix2;
+	matrix2 = sparDoubleInit( ( matrix->nx + factor - 1 ) / factor, ( matrix->ny + factor - 1 ) / factor,
+						( matrix->nz + factor - 1 ) / factor, matrix->bs, matrix->def );
 
-	// Linear block index (n) <-> (i1,j1,k1)
-	int n;
-	n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+	sparDoubleDownsampleBox( matrix2, matrix, factor, op, 0, 0, 0, matrix2->nx, matrix2->ny, matrix2->nz );
 
-	double *blockData;
-	blockData = matrix->blockData[n];
+	return matrix2;
+}
 
-	// Uniform block
-	if( blockData == NULL )
+// Pyramid of levels matrices downsampled by 2, 4, 8... with op (SPAR_MEAN, SPAR_MIN, SPAR_MAX or SPAR_MODE)
+void sparDoublePyramid( sparDouble *matrix, int levels, int op, sparDouble **pyramid )
+{
+	int l;
+	for( l = 0 ; l < levels ; l++ )
 	{
-		return matrix->blockValue[n];
+		pyramid[l] = sparDoubleDownsample( l == 0 ? matrix : pyramid[ l - 1 ], 2, op );
 	}
-	// Heterogeneous block
-	else
+}
+
+// Update pyramid after changes of matrix in box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1)
+void sparDoublePyramidUpdate( sparDouble *matrix, int levels, int op, sparDouble **pyramid, int x, int y, int z, int sx, int sy, int sz )
+{
+	int l;
+	for( l = 0 ; l < levels ; l++ )
 	{
-		// Element indices in the block
-		int i2, j2, k2;
-		i2 = x % bs;
-		j2 = y % bs;
-		k2 = z % bs;
-		// Return element value
-		return blockData[ i2 + bs * ( j2 + bs * k2 ) ];
+		// Affected box in the next level
+		int x1, y1, z1;
+		x1 = ( x + sx + 1 ) / 2;
+		y1 = ( y + sy + 1 ) / 2;
+		z1 = ( z + sz + 1 ) / 2;
+		x = x / 2;
+		y = y / 2;
+		z = z / 2;
+		sx = x1 - x;
+		sy = y1 - y;
+		sz = z1 - z;
+
+		sparDoubleDownsampleBox( pyramid[l], l == 0 ? matrix : pyramid[ l - 1 ], 2, op, x, y, z, sx, sy, sz );
 	}
 }
 
-// Duplicate matrix
-sparDouble* sparDoubleDuplicate( sparDouble *matrix )
+// Trilinear interpolation at (x,y,z), element (i,j,k) at integer coordinates, clamped to the matrix bounds
+double sparDoubleSample( sparDouble *matrix, double x, double y, double z )
 {
-	// Declare matrix and init
-	sparDouble *matrix2;
-	matrix2 = sparDoubleInit( matrix->nx, matrix->ny, matrix->nz,
-						matrix->bs, matrix->def );
+	// Block size
+	int bs;
+	bs = matrix->bs;
 
-	// Number of blocks
-	int blocks;
-	blocks = matrix2->mx * matrix2->my * matrix2->mz;
+	// Matrix size
+	int size[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+
+	double p[3];
+	p[0] = x;
+	p[1] = y;
+	p[2] = z;
+
+	// Lower (v0) and upper (v1) corners and fractions per axis
+	int a, v0[3], v1[3];
+	double f[3];
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		double q;
+		q = p[a] < 0.0 ? 0.0 : ( p[a] > size[a] - 1 ? size[a] - 1 : p[a] );
+		v0[a] = (int)( floor( q ) );
+		v1[a] = v0[a] + 1 < size[a] ? v0[a] + 1 : v0[a];
+		f[a] = q - v0[a];
+	}
 
-	// Copy blocks
-	int i;
-	for( i = 0 ; i < blocks ; i++ )
+	// Corner values
+	double c[8];
+
+	// All corners in one block
+	if( v0[0] / bs == v1[0] / bs && v0[1] / bs == v1[1] / bs && v0[2] / bs == v1[2] / bs )
 	{
-		// Heterogeneous block
-		if( matrix->blockData[i] != NULL )
-		{
-			// Allocate space for block data
-			matrix2->blockData[i] = (double*) calloc( matrix2->bs3, sizeof(double) );
+		// Linear block index (n)
+		int n;
+		n = v0[0] / bs + matrix->mx * ( v0[1] / bs + matrix->my * ( v0[2] / bs ) );
 
-			if( matrix2->blockData[i] == NULL )
-			{
-			   fprintf(stderr, "sparDoubleDuplicate error: Out of memory\n");
-			   exit(1);
-			}
+		double *blockData;
+		blockData = matrix->blockData[n];
 
-			// Copy block data
-			memcpy( matrix2->blockData[i], matrix->blockData[i], matrix2->bs3 * sizeof(double) );
-		}
 		// Uniform block
-		else
+		if( blockData == NULL )
 		{
-			matrix2->blockValue[i] = matrix->blockValue[i];
-			matrix2->blockData[i] = NULL;
+			return (double) matrix->blockValue[n];
 		}
+
+		// Lower corner and steps in the block
+		int i, dx, dy, dz;
+		i = v0[0] % bs + bs * ( v0[1] % bs + bs * ( v0[2] % bs ) );
+		dx = v1[0] - v0[0];
+		dy = bs * ( v1[1] - v0[1] );
+		dz = bs * bs * ( v1[2] - v0[2] );
+
+		c[0] = blockData[i];
+		c[1] = blockData[ i + dx ];
+		c[2] = blockData[ i + dy ];
+		c[3] = blockData[ i + dx + dy ];
+		c[4] = blockData[ i + dz ];
+		c[5] = blockData[ i + dx + dz ];
+		c[6] = blockData[ i + dy + dz ];
+		c[7] = blockData[ i + dx + dy + dz ];
+	}
+	// Corners across blocks
+	else
+	{
+		c[0] = sparDoubleGet( matrix, v0[0], v0[1], v0[2] );
+		c[1] = sparDoubleGet( matrix, v1[0], v0[1], v0[2] );
+		c[2] = sparDoubleGet( matrix, v0[0], v1[1], v0[2] );
+		c[3] = sparDoubleGet( matrix, v1[0], v1[1], v0[2] );
+		c[4] = sparDoubleGet( matrix, v0[0], v0[1], v1[2] );
+		c[5] = sparDoubleGet( matrix, v1[0], v0[1], v1[2] );
+		c[6] = sparDoubleGet( matrix, v0[0], v1[1], v1[2] );
+		c[7] = sparDoubleGet( matrix, v1[0], v1[1], v1[2] );
 	}
 
-	return matrix2;
+	// Interpolate along x, y and z
+	double c0, c1, c2, c3;
+	c0 = c[0] + f[0] * ( (double) c[1] - c[0] );
+	c1 = c[2] + f[0] * ( (double) c[3] - c[2] );
+	c2 = c[4] + f[0] * ( (double) c[5] - c[4] );
+	c3 = c[6] + f[0] * ( (double) c[7] - c[6] );
+	c0 = c0 + f[1] * ( c1 - c0 );
+	c2 = c2 + f[1] * ( c3 - c2 );
+
+	return c0 + f[2] * ( c2 - c0 );
 }
 
-// Get matrix memory usage in bytes under certain block size
-double sparDoubleMemoryBs( sparDouble *matrix, int bs )
+// Trilinear interpolation at n points p[3*i] in parallel into values[i]
+void sparDoubleSamples( sparDouble *matrix, int n, double *p, double *values )
 {
-	if( bs == matrix->bs )
+	int i;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( i = 0 ; i < n ; i++ )
 	{
-		return sparDoubleMemory( matrix );
+		values[i] = sparDoubleSample( matrix, p[ 3 * i ], p[ 3 * i + 1 ], p[ 3 * i + 2 ] );
 	}
+}
 
-	// Matrix size (nx,ny,nz)
+// Marching cubes triangle edges of cube case c (bit i set if corner i is above the iso value), return number of triangles
+int sparDoubleCubeTriangles( int c, int *edges )
+{
+	// Triangle edges per case, -1 terminated, counter-clockwise seen from below the iso value
+	static const signed char table[256][16] =
+	{
+		{ -1 },
+		{ 0, 3, 8, -1 },
+		{ 0, 9, 1, -1 },
+		{ 3, 8, 9, 1, 3, 9, -1 },
+		{ 1, 10, 2, -1 },
+		{ 0, 3, 8, 1, 10, 2, -1 },
+		{ 9, 10, 2, 0, 9, 2, -1 },
+		{ 8, 9, 10, 3, 8, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, -1 },
+		{ 2, 11, 8, 0, 2, 8, -1 },
+		{ 0, 9, 1, 2, 11, 3, -1 },
+		{ 11, 8, 9, 2, 11, 9, 1, 2, 9, -1 },
+		{ 10, 11, 3, 1, 10, 3, -1 },
+		{ 10, 11, 8, 1, 10, 8, 0, 1, 8, -1 },
+		{ 10, 11, 3, 9, 10, 3, 0, 9, 3, -1 },
+		{ 9, 10, 11, 8, 9, 11, -1 },
+		{ 4, 8, 7, -1 },
+		{ 3, 7, 4, 0, 3, 4, -1 },
+		{ 0, 9, 1, 4, 8, 7, -1 },
+		{ 7, 4, 9, 3, 7, 9, 1, 3, 9, -1 },
+		{ 1, 10, 2, 4, 8, 7, -1 },
+		{ 3, 7, 4, 0, 3, 4, 1, 10, 2, -1 },
+		{ 9, 10, 2, 0, 9, 2, 4, 8, 7, -1 },
+		{ 4, 9, 10, 7, 4, 10, 3, 7, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, 4, 8, 7, -1 },
+		{ 11, 7, 4, 2, 11, 4, 0, 2, 4, -1 },
+		{ 0, 9, 1, 2, 11, 3, 4, 8, 7, -1 },
+		{ 7, 4, 9, 11, 7, 9, 2, 11, 9, 1, 2, 9, -1 },
+		{ 10, 11, 3, 1, 10, 3, 4, 8, 7, -1 },
+		{ 11, 7, 4, 10, 11, 4, 1, 10, 4, 0, 1, 4, -1 },
+		{ 10, 11, 3, 9, 10, 3, 0, 9, 3, 4, 8, 7, -1 },
+		{ 10, 11, 7, 9, 10, 7, 4, 9, 7, -1 },
+		{ 4, 5, 9, -1 },
+		{ 0, 3, 8, 4, 5, 9, -1 },
+		{ 4, 5, 1, 0, 4, 1, -1 },
+		{ 8, 4, 5, 3, 8, 5, 1, 3, 5, -1 },
+		{ 1, 10, 2, 4, 5, 9, -1 },
+		{ 0, 3, 8, 1, 10, 2, 4, 5, 9, -1 },
+		{ 5, 10, 2, 4, 5, 2, 0, 4, 2, -1 },
+		{ 4, 5, 10, 8, 4, 10, 3, 8, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, 4, 5, 9, -1 },
+		{ 2, 11, 8, 0, 2, 8, 4, 5, 9, -1 },
+		{ 4, 5, 1, 0, 4, 1, 2, 11, 3, -1 },
+		{ 8, 4, 5, 11, 8, 5, 2, 11, 5, 1, 2, 5, -1 },
+		{ 10, 11, 3, 1, 10, 3, 4, 5, 9, -1 },
+		{ 10, 11, 8, 1, 10, 8, 0, 1, 8, 4, 5, 9, -1 },
+		{ 10, 11, 3, 5, 10, 3, 4, 5, 3, 0, 4, 3, -1 },
+		{ 10, 11, 8, 5, 10, 8, 4, 5, 8, -1 },
+		{ 9, 8, 7, 5, 9, 7, -1 },
+		{ 7, 5, 9, 3, 7, 9, 0, 3, 9, -1 },
+		{ 7, 5, 1, 8, 7, 1, 0, 8, 1, -1 },
+		{ 3, 7, 5, 1, 3, 5, -1 },
+		{ 1, 10, 2, 9, 8, 7, 5, 9, 7, -1 },
+		{ 7, 5, 9, 3, 7, 9, 0, 3, 9, 1, 10, 2, -1 },
+		{ 5, 10, 2, 7, 5, 2, 8, 7, 2, 0, 8, 2, -1 },
+		{ 7, 5, 10, 3, 7, 10, 2, 3, 10, -1 },
+		{ 2, 11, 3, 9, 8, 7, 5, 9, 7, -1 },
+		{ 7, 5, 9, 11, 7, 9, 2, 11, 9, 0, 2, 9, -1 },
+		{ 7, 5, 1, 8, 7, 1, 0, 8, 1, 2, 11, 3, -1 },
+		{ 11, 7, 5, 2, 11, 5, 1, 2, 5, -1 },
+		{ 10, 11, 3, 1, 10, 3, 9, 8, 7, 5, 9, 7, -1 },
+		{ 1, 10, 11, 0, 1, 11, 7, 5, 9, 11, 7, 9, 0, 11, 9, -1 },
+		{ 8, 7, 5, 0, 8, 5, 10, 11, 3, 5, 10, 3, 0, 5, 3, -1 },
+		{ 10, 11, 7, 5, 10, 7, -1 },
+		{ 5, 6, 10, -1 },
+		{ 0, 3, 8, 5, 6, 10, -1 },
+		{ 0, 9, 1, 5, 6, 10, -1 },
+		{ 3, 8, 9, 1, 3, 9, 5, 6, 10, -1 },
+		{ 5, 6, 2, 1, 5, 2, -1 },
+		{ 0, 3, 8, 5, 6, 2, 1, 5, 2, -1 },
+		{ 5, 6, 2, 9, 5, 2, 0, 9, 2, -1 },
+		{ 9, 5, 6, 8, 9, 6, 3, 8, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 5, 6, 10, -1 },
+		{ 2, 11, 8, 0, 2, 8, 5, 6, 10, -1 },
+		{ 0, 9, 1, 2, 11, 3, 5, 6, 10, -1 },
+		{ 11, 8, 9, 2, 11, 9, 1, 2, 9, 5, 6, 10, -1 },
+		{ 6, 11, 3, 5, 6, 3, 1, 5, 3, -1 },
+		{ 6, 11, 8, 5, 6, 8, 1, 5, 8, 0, 1, 8, -1 },
+		{ 6, 11, 3, 5, 6, 3, 9, 5, 3, 0, 9, 3, -1 },
+		{ 11, 8, 9, 6, 11, 9, 5, 6, 9, -1 },
+		{ 4, 8, 7, 5, 6, 10, -1 },
+		{ 3, 7, 4, 0, 3, 4, 5, 6, 10, -1 },
+		{ 0, 9, 1, 4, 8, 7, 5, 6, 10, -1 },
+		{ 7, 4, 9, 3, 7, 9, 1, 3, 9, 5, 6, 10, -1 },
+		{ 5, 6, 2, 1, 5, 2, 4, 8, 7, -1 },
+		{ 3, 7, 4, 0, 3, 4, 5, 6, 2, 1, 5, 2, -1 },
+		{ 5, 6, 2, 9, 5, 2, 0, 9, 2, 4, 8, 7, -1 },
+		{ 7, 4, 9, 3, 7, 9, 9, 5, 6, 3, 9, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 4, 8, 7, 5, 6, 10, -1 },
+		{ 11, 7, 4, 2, 11, 4, 0, 2, 4, 5, 6, 10, -1 },
+		{ 0, 9, 1, 2, 11, 3, 4, 8, 7, 5, 6, 10, -1 },
+		{ 7, 4, 9, 11, 7, 9, 2, 11, 9, 1, 2, 9, 5, 6, 10, -1 },
+		{ 6, 11, 3, 5, 6, 3, 1, 5, 3, 4, 8, 7, -1 },
+		{ 5, 6, 11, 1, 5, 11, 11, 7, 4, 1, 11, 4, 0, 1, 4, -1 },
+		{ 6, 11, 3, 5, 6, 3, 9, 5, 3, 0, 9, 3, 4, 8, 7, -1 },
+		{ 5, 6, 11, 9, 5, 11, 9, 11, 7, 4, 9, 7, -1 },
+		{ 6, 10, 9, 4, 6, 9, -1 },
+		{ 0, 3, 8, 6, 10, 9, 4, 6, 9, -1 },
+		{ 6, 10, 1, 4, 6, 1, 0, 4, 1, -1 },
+		{ 4, 6, 10, 8, 4, 10, 3, 8, 10, 1, 3, 10, -1 },
+		{ 4, 6, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 0, 3, 8, 4, 6, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 4, 6, 2, 0, 4, 2, -1 },
+		{ 8, 4, 6, 3, 8, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 6, 10, 9, 4, 6, 9, -1 },
+		{ 2, 11, 8, 0, 2, 8, 6, 10, 9, 4, 6, 9, -1 },
+		{ 6, 10, 1, 4, 6, 1, 0, 4, 1, 2, 11, 3, -1 },
+		{ 2, 11, 8, 1, 2, 8, 4, 6, 10, 8, 4, 10, 1, 8, 10, -1 },
+		{ 6, 11, 3, 4, 6, 3, 9, 4, 3, 1, 9, 3, -1 },
+		{ 9, 4, 6, 1, 9, 6, 6, 11, 8, 1, 6, 8, 0, 1, 8, -1 },
+		{ 6, 11, 3, 4, 6, 3, 0, 4, 3, -1 },
+		{ 6, 11, 8, 4, 6, 8, -1 },
+		{ 9, 8, 7, 10, 9, 7, 6, 10, 7, -1 },
+		{ 6, 10, 9, 7, 6, 9, 3, 7, 9, 0, 3, 9, -1 },
+		{ 6, 10, 1, 7, 6, 1, 8, 7, 1, 0, 8, 1, -1 },
+		{ 7, 6, 10, 3, 7, 10, 1, 3, 10, -1 },
+		{ 7, 6, 2, 8, 7, 2, 9, 8, 2, 1, 9, 2, -1 },
+		{ 2, 1, 9, 6, 2, 9, 7, 6, 9, 3, 7, 9, 0, 3, 9, -1 },
+		{ 7, 6, 2, 8, 7, 2, 0, 8, 2, -1 },
+		{ 3, 7, 6, 2, 3, 6, -1 },
+		{ 2, 11, 3, 9, 8, 7, 10, 9, 7, 6, 10, 7, -1 },
+		{ 6, 10, 9, 7, 6, 9, 11, 7, 9, 2, 11, 9, 0, 2, 9, -1 },
+		{ 6, 10, 1, 7, 6, 1, 8, 7, 1, 0, 8, 1, 2, 11, 3, -1 },
+		{ 2, 11, 7, 1, 2, 7, 7, 6, 10, 1, 7, 10, -1 },
+		{ 8, 7, 6, 9, 8, 6, 6, 11, 3, 9, 6, 3, 1, 9, 3, -1 },
+		{ 0, 1, 9, 6, 11, 7, -1 },
+		{ 8, 7, 6, 0, 8, 6, 6, 11, 3, 0, 6, 3, -1 },
+		{ 6, 11, 7, -1 },
+		{ 6, 7, 11, -1 },
+		{ 0, 3, 8, 6, 7, 11, -1 },
+		{ 0, 9, 1, 6, 7, 11, -1 },
+		{ 3, 8, 9, 1, 3, 9, 6, 7, 11, -1 },
+		{ 1, 10, 2, 6, 7, 11, -1 },
+		{ 0, 3, 8, 1, 10, 2, 6, 7, 11, -1 },
+		{ 9, 10, 2, 0, 9, 2, 6, 7, 11, -1 },
+		{ 8, 9, 10, 3, 8, 10, 2, 3, 10, 6, 7, 11, -1 },
+		{ 6, 7, 3, 2, 6, 3, -1 },
+		{ 6, 7, 8, 2, 6, 8, 0, 2, 8, -1 },
+		{ 0, 9, 1, 6, 7, 3, 2, 6, 3, -1 },
+		{ 7, 8, 9, 6, 7, 9, 2, 6, 9, 1, 2, 9, -1 },
+		{ 6, 7, 3, 10, 6, 3, 1, 10, 3, -1 },
+		{ 6, 7, 8, 10, 6, 8, 1, 10, 8, 0, 1, 8, -1 },
+		{ 6, 7, 3, 10, 6, 3, 9, 10, 3, 0, 9, 3, -1 },
+		{ 8, 9, 10, 7, 8, 10, 6, 7, 10, -1 },
+		{ 8, 11, 6, 4, 8, 6, -1 },
+		{ 11, 6, 4, 3, 11, 4, 0, 3, 4, -1 },
+		{ 0, 9, 1, 8, 11, 6, 4, 8, 6, -1 },
+		{ 6, 4, 9, 11, 6, 9, 3, 11, 9, 1, 3, 9, -1 },
+		{ 1, 10, 2, 8, 11, 6, 4, 8, 6, -1 },
+		{ 11, 6, 4, 3, 11, 4, 0, 3, 4, 1, 10, 2, -1 },
+		{ 9, 10, 2, 0, 9, 2, 8, 11, 6, 4, 8, 6, -1 },
+		{ 11, 6, 4, 3, 11, 4, 4, 9, 10, 3, 4, 10, 2, 3, 10, -1 },
+		{ 4, 8, 3, 6, 4, 3, 2, 6, 3, -1 },
+		{ 2, 6, 4, 0, 2, 4, -1 },
+		{ 0, 9, 1, 4, 8, 3, 6, 4, 3, 2, 6, 3, -1 },
+		{ 6, 4, 9, 2, 6, 9, 1, 2, 9, -1 },
+		{ 4, 8, 3, 6, 4, 3, 10, 6, 3, 1, 10, 3, -1 },
+		{ 10, 6, 4, 1, 10, 4, 0, 1, 4, -1 },
+		{ 4, 8, 3, 6, 4, 3, 10, 6, 3, 9, 10, 3, 0, 9, 3, -1 },
+		{ 9, 10, 6, 4, 9, 6, -1 },
+		{ 4, 5, 9, 6, 7, 11, -1 },
+		{ 0, 3, 8, 4, 5, 9, 6, 7, 11, -1 },
+		{ 4, 5, 1, 0, 4, 1, 6, 7, 11, -1 },
+		{ 8, 4, 5, 3, 8, 5, 1, 3, 5, 6, 7, 11, -1 },
+		{ 1, 10, 2, 4, 5, 9, 6, 7, 11, -1 },
+		{ 0, 3, 8, 1, 10, 2, 4, 5, 9, 6, 7, 11, -1 },
+		{ 5, 10, 2, 4, 5, 2, 0, 4, 2, 6, 7, 11, -1 },
+		{ 4, 5, 10, 8, 4, 10, 3, 8, 10, 2, 3, 10, 6, 7, 11, -1 },
+		{ 6, 7, 3, 2, 6, 3, 4, 5, 9, -1 },
+		{ 6, 7, 8, 2, 6, 8, 0, 2, 8, 4, 5, 9, -1 },
+		{ 4, 5, 1, 0, 4, 1, 6, 7, 3, 2, 6, 3, -1 },
+		{ 6, 7, 8, 2, 6, 8, 8, 4, 5, 2, 8, 5, 1, 2, 5, -1 },
+		{ 6, 7, 3, 10, 6, 3, 1, 10, 3, 4, 5, 9, -1 },
+		{ 6, 7, 8, 10, 6, 8, 1, 10, 8, 0, 1, 8, 4, 5, 9, -1 },
+		{ 6, 7, 3, 10, 6, 3, 5, 10, 3, 4, 5, 3, 0, 4, 3, -1 },
+		{ 6, 7, 8, 10, 6, 8, 5, 10, 8, 4, 5, 8, -1 },
+		{ 8, 11, 6, 9, 8, 6, 5, 9, 6, -1 },
+		{ 6, 5, 9, 11, 6, 9, 3, 11, 9, 0, 3, 9, -1 },
+		{ 6, 5, 1, 11, 6, 1, 8, 11, 1, 0, 8, 1, -1 },
+		{ 11, 6, 5, 3, 11, 5, 1, 3, 5, -1 },
+		{ 1, 10, 2, 8, 11, 6, 9, 8, 6, 5, 9, 6, -1 },
+		{ 6, 5, 9, 11, 6, 9, 3, 11, 9, 0, 3, 9, 1, 10, 2, -1 },
+		{ 11, 6, 5, 8, 11, 5, 5, 10, 2, 8, 5, 2, 0, 8, 2, -1 },
+		{ 11, 6, 5, 3, 11, 5, 3, 5, 10, 2, 3, 10, -1 },
+		{ 9, 8, 3, 5, 9, 3, 6, 5, 3, 2, 6, 3, -1 },
+		{ 6, 5, 9, 2, 6, 9, 0, 2, 9, -1 },
+		{ 3, 2, 6, 8, 3, 6, 6, 5, 1, 8, 6, 1, 0, 8, 1, -1 },
+		{ 2, 6, 5, 1, 2, 5, -1 },
+		{ 9, 8, 3, 5, 9, 3, 6, 5, 3, 10, 6, 3, 1, 10, 3, -1 },
+		{ 1, 10, 6, 0, 1, 6, 6, 5, 9, 0, 6, 9, -1 },
+		{ 0, 8, 3, 5, 10, 6, -1 },
+		{ 5, 10, 6, -1 },
+		{ 7, 11, 10, 5, 7, 10, -1 },
+		{ 0, 3, 8, 7, 11, 10, 5, 7, 10, -1 },
+		{ 0, 9, 1, 7, 11, 10, 5, 7, 10, -1 },
+		{ 3, 8, 9, 1, 3, 9, 7, 11, 10, 5, 7, 10, -1 },
+		{ 7, 11, 2, 5, 7, 2, 1, 5, 2, -1 },
+		{ 0, 3, 8, 7, 11, 2, 5, 7, 2, 1, 5, 2, -1 },
+		{ 7, 11, 2, 5, 7, 2, 9, 5, 2, 0, 9, 2, -1 },
+		{ 3, 8, 9, 2, 3, 9, 5, 7, 11, 9, 5, 11, 2, 9, 11, -1 },
+		{ 5, 7, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 5, 7, 8, 10, 5, 8, 2, 10, 8, 0, 2, 8, -1 },
+		{ 0, 9, 1, 5, 7, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 10, 5, 7, 2, 10, 7, 7, 8, 9, 2, 7, 9, 1, 2, 9, -1 },
+		{ 5, 7, 3, 1, 5, 3, -1 },
+		{ 5, 7, 8, 1, 5, 8, 0, 1, 8, -1 },
+		{ 5, 7, 3, 9, 5, 3, 0, 9, 3, -1 },
+		{ 7, 8, 9, 5, 7, 9, -1 },
+		{ 11, 10, 5, 8, 11, 5, 4, 8, 5, -1 },
+		{ 10, 5, 4, 11, 10, 4, 3, 11, 4, 0, 3, 4, -1 },
+		{ 0, 9, 1, 11, 10, 5, 8, 11, 5, 4, 8, 5, -1 },
+		{ 10, 5, 4, 11, 10, 4, 11, 4, 9, 3, 11, 9, 1, 3, 9, -1 },
+		{ 8, 11, 2, 4, 8, 2, 5, 4, 2, 1, 5, 2, -1 },
+		{ 1, 5, 4, 2, 1, 4, 11, 2, 4, 3, 11, 4, 0, 3, 4, -1 },
+		{ 8, 11, 2, 4, 8, 2, 5, 4, 2, 9, 5, 2, 0, 9, 2, -1 },
+		{ 2, 3, 11, 4, 9, 5, -1 },
+		{ 4, 8, 3, 5, 4, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 10, 5, 4, 2, 10, 4, 0, 2, 4, -1 },
+		{ 0, 9, 1, 4, 8, 3, 5, 4, 3, 10, 5, 3, 2, 10, 3, -1 },
+		{ 10, 5, 4, 2, 10, 4, 2, 4, 9, 1, 2, 9, -1 },
+		{ 4, 8, 3, 5, 4, 3, 1, 5, 3, -1 },
+		{ 1, 5, 4, 0, 1, 4, -1 },
+		{ 4, 8, 3, 5, 4, 3, 9, 5, 3, 0, 9, 3, -1 },
+		{ 4, 9, 5, -1 },
+		{ 11, 10, 9, 7, 11, 9, 4, 7, 9, -1 },
+		{ 0, 3, 8, 11, 10, 9, 7, 11, 9, 4, 7, 9, -1 },
+		{ 11, 10, 1, 7, 11, 1, 4, 7, 1, 0, 4, 1, -1 },
+		{ 7, 11, 10, 4, 7, 10, 8, 4, 10, 3, 8, 10, 1, 3, 10, -1 },
+		{ 7, 11, 2, 4, 7, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 0, 3, 8, 7, 11, 2, 4, 7, 2, 9, 4, 2, 1, 9, 2, -1 },
+		{ 7, 11, 2, 4, 7, 2, 0, 4, 2, -1 },
+		{ 3, 8, 4, 2, 3, 4, 4, 7, 11, 2, 4, 11, -1 },
+		{ 4, 7, 3, 9, 4, 3, 10, 9, 3, 2, 10, 3, -1 },
+		{ 9, 4, 7, 10, 9, 7, 10, 7, 8, 2, 10, 8, 0, 2, 8, -1 },
+		{ 3, 2, 10, 7, 3, 10, 7, 10, 1, 4, 7, 1, 0, 4, 1, -1 },
+		{ 1, 2, 10, 4, 7, 8, -1 },
+		{ 4, 7, 3, 9, 4, 3, 1, 9, 3, -1 },
+		{ 9, 4, 7, 1, 9, 7, 1, 7, 8, 0, 1, 8, -1 },
+		{ 4, 7, 3, 0, 4, 3, -1 },
+		{ 4, 7, 8, -1 },
+		{ 11, 10, 9, 8, 11, 9, -1 },
+		{ 11, 10, 9, 3, 11, 9, 0, 3, 9, -1 },
+		{ 11, 10, 1, 8, 11, 1, 0, 8, 1, -1 },
+		{ 3, 11, 10, 1, 3, 10, -1 },
+		{ 8, 11, 2, 9, 8, 2, 1, 9, 2, -1 },
+		{ 2, 1, 9, 11, 2, 9, 3, 11, 9, 0, 3, 9, -1 },
+		{ 8, 11, 2, 0, 8, 2, -1 },
+		{ 2, 3, 11, -1 },
+		{ 9, 8, 3, 10, 9, 3, 2, 10, 3, -1 },
+		{ 2, 10, 9, 0, 2, 9, -1 },
+		{ 3, 2, 10, 8, 3, 10, 8, 10, 1, 0, 8, 1, -1 },
+		{ 1, 2, 10, -1 },
+		{ 9, 8, 3, 1, 9, 3, -1 },
+		{ 0, 1, 9, -1 },
+		{ 0, 8, 3, -1 },
+		{ -1 }
+	};
+
+	int i;
+	for( i = 0 ; table[c][i] >= 0 ; i++ )
+	{
+		edges[i] = table[c][i];
+	}
+
+	return i / 3;
+}
+
+// Order of two edge keys for qsort
+int sparDoubleCompareKey( const void *a, const void *b )
+{
+	long long ka, kb;
+	ka = *(const long long*) a;
+	kb = *(const long long*) b;
+	return ( ka > kb ) - ( ka < kb );
+}
+
+// Marching cubes isosurface at iso into vertices[3*i] and triangles[3*j] (malloc, free after use), nt triangles, return number of vertices
+int sparDoubleIsosurface( sparDouble *matrix, double iso, double **vertices, int **triangles, int *nt )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Matrix size
 	int nx, ny, nz;
 	nx = matrix->nx;
 	ny = matrix->ny;
 	nz = matrix->nz;
 
-	// Block size (bs,bs,bs)
-	int bs3;
-	bs3 = bs * bs * bs;
-
-	// Block matrix size (mx,my,mz)
-	int mx, my, mz;
-	mx = (int)( ( nx + bs - 1 ) / bs );
-	my = (int)( ( ny + bs - 1 ) / bs );
-	mz = (int)( ( nz + bs - 1 ) / bs );
+	// Cube corner offsets, and edge lower corner offset and axis
+	static const int corner[8][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 },
+									  { 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 } };
+	static const int edge[12][4] = { { 0, 0, 0, 0 }, { 1, 0, 0, 1 }, { 0, 1, 0, 0 }, { 0, 0, 0, 1 },
+									 { 0, 0, 1, 0 }, { 1, 0, 1, 1 }, { 0, 1, 1, 0 }, { 0, 0, 1, 1 },
+									 { 0, 0, 0, 2 }, { 1, 0, 0, 2 }, { 1, 1, 0, 2 }, { 0, 1, 0, 2 } };
 
-	// Number of blocks
-	int blocks;
-	blocks = mx * my * mz;
+	// Triangle edge keys and triangle count per block
+	int nb;
+	nb = matrix->mx * matrix->my * matrix->mz;
 
-	// Size of matrix instance
-	double size;
-	size = (double)( sizeof(sparDouble) );
+	long long **keys;
+	int *count;
+	keys = (long long**) calloc( nb, sizeof(long long*) );
+	count = (int*) calloc( nb, sizeof(int) );
 
-	// Size of uniform block data
-	size = size + (double)( blocks * sizeof(double) );
+	if( keys == NULL || count == NULL )
+	{
+	   fprintf(stderr, "sparDoubleIsosurface error: Out of memory\n");
+	   exit(1);
+	}
 
-	// Size of heterogeneous block data arrays
-	size = size + (double)( blocks * sizeof(double*) );
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block corners, including the next block first plane on each axis
+		int s;
+		double *buffer;
+		s = bs + 1;
+		buffer = (double*) malloc( s * s * s * sizeof(double) );
 
-	int i, j, k;
-	int i1, j1, k1;
-	int isUniform;
-	double value;
+		if( buffer == NULL )
+		{
+		   fprintf(stderr, "sparDoubleIsosurface error: Out of memory\n");
+		   exit(1);
+		}
 
-	// For each virtual block
-	for( k1 = 0 ; k1 < mz ; k1++ )
-	{
-		for( j1 = 0 ; j1 < my ; j1++ )
+		// For each block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < nb ; n++ )
 		{
-			for( i1 = 0 ; i1 < mx ; i1++ )
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = n % matrix->mx;
+			j1 = ( n / matrix->mx ) % matrix->my;
+			k1 = n / ( matrix->mx * matrix->my );
+
+			// Cells with lower corner in the block
+			int ex, ey, ez;
+			ex = nx - 1 - i1 * bs < bs ? nx - 1 - i1 * bs : bs;
+			ey = ny - 1 - j1 * bs < bs ? ny - 1 - j1 * bs : bs;
+			ez = nz - 1 - k1 * bs < bs ? nz - 1 - k1 * bs : bs;
+
+			if( ex <= 0 || ey <= 0 || ez <= 0 )
 			{
-				// Check if block is uniform 
-				isUniform = 1;
-				value = sparDoubleGet( matrix, i1 * bs, j1 * bs, k1 * bs );
-				for( k = k1 * bs ; k < ( k1 + 1 ) * bs ; k++ )
+				continue;
+			}
+
+			// Uniform corners, no crossing
+			double value;
+			if( sparDoubleUniformBox( matrix, i1 * bs, j1 * bs, k1 * bs, s, s, s, &value ) )
+			{
+				continue;
+			}
+
+			sparDoubleGetBox( matrix, i1 * bs, j1 * bs, k1 * bs, s, s, s, buffer );
+
+			// Corner offsets in the buffer
+			int offset[8], c;
+			for( c = 0 ; c < 8 ; c++ )
+			{
+				offset[c] = corner[c][0] + s * ( corner[c][1] + s * corner[c][2] );
+			}
+
+			int size;
+			size = 0;
+
+			// For each cell
+			int i, j, k;
+			for( k = 0 ; k < ez ; k++ )
+			{
+				for( j = 0 ; j < ey ; j++ )
 				{
-					if( k < nz ) // Avoid outside elements
-					for( j = j1 * bs ; j < ( j1 + 1 ) * bs ; j++ )
+					for( i = 0 ; i < ex ; i++ )
 					{
-						if( j < ny ) // Idem
-						for( i = i1 * bs ; i < ( i1 + 1 ) * bs ; i++ )
+						// Cube case
+						double *cell;
+						int cube;
+						cell = buffer + i + s * ( j + s * k );
+						cube = 0;
+						for( c = 0 ; c < 8 ; c++ )
 						{
-							if( i < nx ) // Idem
-							if( sparDoubleGet( matrix, i, j, k ) != value )
+							cube |= ( cell[ offset[c] ] > iso ) << c;
+						}
+
+						if( cube == 0 || cube == 255 )
+						{
+							continue;
+						}
+
+						int edges[15], t;
+						t = sparDoubleCubeTriangles( cube, edges );
+
+						// Grow keys
+						if( ( count[n] + t ) * 3 > size )
+						{
+							size = size == 0 ? 48 : 2 * size;
+							keys[n] = (long long*) realloc( keys[n], size * sizeof(long long) );
+
+							if( keys[n] == NULL )
 							{
-								isUniform = 0;
-								i = ( i1 + 1 ) * bs;
-								j = ( j1 + 1 ) * bs;
-								k = ( k1 + 1 ) * bs;
+							   fprintf(stderr, "sparDoubleIsosurface error: Out of memory\n");
+							   exit(1);
 							}
 						}
+
+						// Edge key of lower element (x,y,z) and axis a, 3*(x+nx*(y+ny*z))+a
+						for( c = 0 ; c < 3 * t ; c++ )
+						{
+							const int *e;
+							e = edge[ edges[c] ];
+							keys[n][ 3 * count[n] + c ] = 3 * ( i1 * bs + i + e[0] + nx *
+								( j1 * bs + j + e[1] + (long long) ny * ( k1 * bs + k + e[2] ) ) ) + e[3];
+						}
+						count[n] += t;
 					}
 				}
-				if( isUniform == 0 )
-				{
-					size = size + (double)( sizeof(double) * bs3 );
-				}
 			}
 		}
+
+		free(buffer);
+	}
+
+	// Triangle offset per block
+	int m, total;
+	total = 0;
+	for( m = 0 ; m < nb ; m++ )
+	{
+		int c;
+		c = count[m];
+		count[m] = total;
+		total += c;
+	}
+	*nt = total;
+
+	if( total == 0 )
+	{
+		free(keys);
+		free(count);
+		*vertices = NULL;
+		*triangles = NULL;
+		return 0;
 	}
 
-	return size;
-}
+	// All edge keys, then sorted unique keys as vertices
+	long long *all, *unique;
+	all = (long long*) malloc( 3 * total * sizeof(long long) );
+	unique = (long long*) malloc( 3 * total * sizeof(long long) );
 
-// Change matrix block size
-void sparDoubleChangeBs( sparDouble *matrix, int bs )
-{
-	// Matrix size (nx,ny,nz)
-	int nx, ny, nz;
-	nx = matrix->nx;
-	ny = matrix->ny;
-	nz = matrix->nz;
+	if( all == NULL || unique == NULL )
+	{
+	   fprintf(stderr, "sparDoubleIsosurface error: Out of memory\n");
+	   exit(1);
+	}
 
-	// Default value
-	double def;
-	def = matrix->def;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( m = 0 ; m < nb ; m++ )
+	{
+		if( keys[m] != NULL )
+		{
+			int c;
+			c = ( m + 1 < nb ? count[ m + 1 ] : total ) - count[m];
+			memcpy( all + 3 * count[m], keys[m], 3 * c * sizeof(long long) );
+			free(keys[m]);
+		}
+	}
+	free(keys);
+	free(count);
 
-	// Declare temporal matrix and init
-	sparDouble *matrix2;
-	matrix2 = sparDoubleInit( nx, ny, nz, bs, def );
+	memcpy( unique, all, 3 * total * sizeof(long long) );
+	qsort( unique, 3 * total, sizeof(long long), sparDoubleCompareKey );
 
-	// Copy values and clear original matrix
-	int i, j, k;
-	for( k=0 ; k<nz ; k++ )
+	int nv;
+	nv = 1;
+	for( m = 1 ; m < 3 * total ; m++ )
 	{
-		for( j=0 ; j<ny ; j++ )
+		if( unique[m] != unique[ nv - 1 ] )
 		{
-			for( i=0 ; i<nx ; i++ )
-			{
-				// Copy element
-				sparDoubleSet( matrix2, i, j, k, sparDoubleGet( matrix, i, j, k ) );
-
-				// Set uniform to free memory
-				sparDoubleSet( matrix, i, j, k, def);
-			}
+			unique[ nv++ ] = unique[m];
 		}
 	}
 
-	// Set new block size and grid
-	matrix->bs  = matrix2->bs;
-	matrix->bs3 = matrix2->bs3;
-	matrix->mx  = matrix2->mx;
-	matrix->my  = matrix2->my;
-	matrix->mz  = matrix2->mz;
+	*vertices = (double*) malloc( 3 * nv * sizeof(double) );
+	*triangles = (int*) malloc( 3 * total * sizeof(int) );
 
-	// Free old blocks
-	free(matrix->blockValue);
-	free(matrix->blockData);
+	if( *vertices == NULL || *triangles == NULL )
+	{
+	   fprintf(stderr, "sparDoubleIsosurface error: Out of memory\n");
+	   exit(1);
+	}
 
-	// Copy new blocks
-	matrix->blockValue = matrix2->blockValue;
-	matrix->blockData = matrix2->blockData;
+	// Vertex on edge by linear interpolation
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( m = 0 ; m < nv ; m++ )
+	{
+		// Lower element (x,y,z) and axis a
+		int a, p[3];
+		long long key;
+		key = unique[m] / 3;
+		a = (int)( unique[m] % 3 );
+		p[0] = (int)( key % nx );
+		p[1] = (int)( ( key / nx ) % ny );
+		p[2] = (int)( key / ( (long long) nx * ny ) );
+
+		double v0, v1, t;
+		v0 = sparDoubleGet( matrix, p[0], p[1], p[2] );
+		v1 = sparDoubleGet( matrix, p[0] + ( a == 0 ), p[1] + ( a == 1 ), p[2] + ( a == 2 ) );
+		t = ( iso - v0 ) / ( v1 - v0 );
+
+		(*vertices)[ 3 * m ] = p[0] + ( a == 0 ) * t;
+		(*vertices)[ 3 * m + 1 ] = p[1] + ( a == 1 ) * t;
+		(*vertices)[ 3 * m + 2 ] = p[2] + ( a == 2 ) * t;
+	}
 
-	// Free temporal matrix
-	free(matrix2);
+	// Triangle vertex indices
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( m = 0 ; m < 3 * total ; m++ )
+	{
+		long long *v;
+		v = (long long*) bsearch( all + m, unique, nv, sizeof(long long), sparDoubleCompareKey );
+		(*triangles)[m] = (int)( v - unique );
+	}
+
+	free(all);
+	free(unique);
+
+	return nv;
 }
 
-// Optimize matrix block size
-void sparDoubleOptimizeBs( sparDouble *matrix )
+// Copy block (i,j,k) of src into block (x,y,z) of dst, same block size
+void sparDoubleCopyBlock( sparDouble *dst, int x, int y, int z, sparDouble *src, int i, int j, int k )
 {
-	// Test block size and store optimal
-	int bestBs;
-	double memory, bestMemory;
-	int bs[10] = { 2, 3, 4, 6, 8, 10 };
+	// Linear block indices
+	int n, m;
+	n = x + dst->mx * ( y + dst->my * z );
+	m = i + src->mx * ( j + src->my * k );
 
-	bestBs = bs[0];
-	bestMemory = sparDoubleMemoryBs( matrix, bs[0] );
+	// Uniform block
+	if( src->blockData[m] == NULL )
+	{
+		if( dst->blockData[n] != NULL )
+		{
+			free(dst->blockData[n]);
+			dst->blockData[n] = NULL;
+		}
+		dst->blockValue[n] = src->blockValue[m];
+		return;
+	}
 
-	int i;
-	for( i=1 ; i<6 ; i++ )
+	// Heterogeneous block, reuse destination data if any
+	if( dst->blockData[n] == NULL )
 	{
-		memory = sparDoubleMemoryBs( matrix, bs[i] );
-		if( memory < bestMemory )
+		dst->blockData[n] = (double*) malloc( dst->bs3 * sizeof(double) );
+
+		if( dst->blockData[n] == NULL )
 		{
-			bestBs = bs[i];
-			bestMemory = memory;
+		   fprintf(stderr, "sparDoubleCopyBlock error: Out of memory\n");
+		   exit(1);
 		}
 	}
 
-	// Change matrix block size
-	sparDoubleChangeBs( matrix, bestBs );
+	memcpy( dst->blockData[n], src->blockData[m], dst->bs3 * sizeof(double) );
+
+	// Boundary block may become uniform inside the matrix
+	if( x == dst->mx - 1 || y == dst->my - 1 || z == dst->mz - 1 )
+	{
+		sparDoubleReduceBlock( dst, x, y, z );
+	}
 }
 
-// Resize matrix
-void sparDoubleResize( sparDouble *matrix, int nx, int ny, int nz )
+// New matrix with box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1), elements outside the matrix set to default, ring buffer origin reset
+sparDouble* sparDoubleCrop( sparDouble *matrix, int x, int y, int z, int sx, int sy, int sz )
 {
-	// Check matrix size
-	if( !( nx > 0 && ny > 0 && nz > 0 ) )
+	// Declare matrix and init
+	sparDouble *matrix2;
+	matrix2 = sparDoubleInit( sx, sy, sz, matrix->bs, matrix->def );
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Box aligned with source blocks
+	int aligned;
+	aligned = x >= 0 && y >= 0 && z >= 0 && x % bs == 0 && y % bs == 0 && z % bs == 0;
+
+	// Number of blocks
+	int blocks;
+	blocks = matrix2->mx * matrix2->my * matrix2->mz;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
 	{
-		fprintf(stderr, "sparDoubleResize error: Matrix size must be positive\n");
-		exit(1);
+		// Block (i1,j1,k1) and source box origin
+		int i1, j1, k1, x0, y0, z0;
+		i1 = n % matrix2->mx;
+		j1 = ( n / matrix2->mx ) % matrix2->my;
+		k1 = n / ( matrix2->mx * matrix2->my );
+		x0 = x + i1 * bs;
+		y0 = y + j1 * bs;
+		z0 = z + k1 * bs;
+
+		// Aligned source block covering the block elements inside the matrix, copy block
+		if( aligned && x0 < matrix->nx && y0 < matrix->ny && z0 < matrix->nz &&
+			matrix->nx - x0 >= ( sx - i1 * bs < bs ? sx - i1 * bs : bs ) &&
+			matrix->ny - y0 >= ( sy - j1 * bs < bs ? sy - j1 * bs : bs ) &&
+			matrix->nz - z0 >= ( sz - k1 * bs < bs ? sz - k1 * bs : bs ) )
+		{
+			sparDoubleCopyBlock( matrix2, i1, j1, k1, matrix, x0 / bs, y0 / bs, z0 / bs );
+			continue;
+		}
+
+		// Uniform source box
+		double value;
+		if( sparDoubleUniformBox( matrix, x0, y0, z0, bs, bs, bs, &value ) &&
+			x0 >= 0 && y0 >= 0 && z0 >= 0 && x0 + bs <= matrix->nx && y0 + bs <= matrix->ny && z0 + bs <= matrix->nz )
+		{
+			matrix2->blockValue[n] = value;
+			continue;
+		}
+
+		// Read source box rows into the block, reduce if possible
+		matrix2->blockData[n] = (double*) malloc( matrix2->bs3 * sizeof(double) );
+
+		if( matrix2->blockData[n] == NULL )
+		{
+		   fprintf(stderr, "sparDoubleCrop error: Out of memory\n");
+		   exit(1);
+		}
+
+		sparDoubleGetBox( matrix, x0, y0, z0, bs, bs, bs, matrix2->blockData[n] );
+		sparDoubleReduceBlock( matrix2, i1, j1, k1 );
 	}
 
+	return matrix2;
+}
+
+// Write src into matrix at (x,y,z), clipped to the matrix
+void sparDoublePaste( sparDouble *matrix, sparDouble *src, int x, int y, int z )
+{
 	// Block size
 	int bs;
 	bs = matrix->bs;
 
-	// Default value
-	double def;
-	def = matrix->def;
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + src->nx > matrix->nx ? matrix->nx : x + src->nx;
+	y1 = y + src->ny > matrix->ny ? matrix->ny : y + src->ny;
+	z1 = z + src->nz > matrix->nz ? matrix->nz : z + src->nz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		return;
+	}
 
-	// Block grid size
-	int mx, my, mz;
+	// Box aligned with blocks of the same size
+	int aligned;
+	aligned = src->bs == bs && x >= 0 && y >= 0 && z >= 0 && x % bs == 0 && y % bs == 0 && z % bs == 0;
+
+	// Range of blocks
+	int bx, by, bz, cx, cy, cz;
+	bx = x0 / bs;
+	by = y0 / bs;
+	bz = z0 / bs;
+	cx = ( x1 - 1 ) / bs - bx + 1;
+	cy = ( y1 - 1 ) / bs - by + 1;
+	cz = ( z1 - 1 ) / bs - bz + 1;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		double *buffer;
+		buffer = (double*) malloc( bs * bs * bs * sizeof(double) );
 
-	// New block data
-	double *blockValue;
-	double **blockData;
+		if( buffer == NULL )
+		{
+		   fprintf(stderr, "sparDoublePaste error: Out of memory\n");
+		   exit(1);
+		}
 
-	int i, j, k;
-	int blocks;
+		// For each block overlapping the box
+		int t;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( t = 0 ; t < cx * cy * cz ; t++ )
+		{
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = bx + t % cx;
+			j1 = by + ( t / cx ) % cy;
+			k1 = bz + t / ( cx * cy );
+
+			// Block and box intersection
+			int bx0, by0, bz0, bx1, by1, bz1;
+			bx0 = i1 * bs > x0 ? i1 * bs : x0;
+			by0 = j1 * bs > y0 ? j1 * bs : y0;
+			bz0 = k1 * bs > z0 ? k1 * bs : z0;
+			bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+			by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+			bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+
+			// Aligned block with elements inside the matrix fully covered, copy block
+			if( aligned && bx0 == i1 * bs && by0 == j1 * bs && bz0 == k1 * bs &&
+				( bx1 == ( i1 + 1 ) * bs || bx1 == matrix->nx ) &&
+				( by1 == ( j1 + 1 ) * bs || by1 == matrix->ny ) &&
+				( bz1 == ( k1 + 1 ) * bs || bz1 == matrix->nz ) )
+			{
+				sparDoubleCopyBlock( matrix, i1, j1, k1, src, i1 - x / bs, j1 - y / bs, k1 - z / bs );
+				continue;
+			}
+
+			// Copy intersection rows
+			sparDoubleGetBox( src, bx0 - x, by0 - y, bz0 - z, bx1 - bx0, by1 - by0, bz1 - bz0, buffer );
+			sparDoubleSetBox( matrix, bx0, by0, bz0, bx1 - bx0, by1 - by0, bz1 - bz0, buffer );
+		}
+
+		free(buffer);
+	}
+}
 
-	// Expand x
-	if( nx > matrix->nx )
+// Shift contents by (dx,dy,dz), element (x,y,z) moves to (x+dx,y+dy,z+dz), vacated elements set to default
+void sparDoubleShift( sparDouble *matrix, int dx, int dy, int dz )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Block matrix size (mx,my,mz)
+	int mx, my, mz;
+	mx = matrix->mx;
+	my = matrix->my;
+	mz = matrix->mz;
+
+	// Shift in blocks (qx,qy,qz) and remainder (rx,ry,rz), same sign so no data is dropped early
+	int qx, qy, qz, rx, ry, rz;
+	qx = dx / bs;
+	qy = dy / bs;
+	qz = dz / bs;
+	rx = dx % bs;
+	ry = dy % bs;
+	rz = dz % bs;
+
+	// Move blocks
+	if( qx != 0 || qy != 0 || qz != 0 )
 	{
-		// New block grid size
-		mx = (int)( ( nx + bs - 1 ) / bs );
-		my = matrix->my;
-		mz = matrix->mz;
+		// New block data
+		double *blockValue;
+		double **blockData;
 
-		// Number of blocks
+		int blocks;
 		blocks = mx * my * mz;
 		blockValue = (double*) calloc( blocks, sizeof(double) ); // Sets to 0s
 		blockData = (double**) calloc( blocks, sizeof(double*) ); // Sets to NULLs
 
 		if( blockValue == NULL || blockData == NULL )
 		{
-		   fprintf(stderr, "sparDoubleResize error: Out of memory\n");
+		   fprintf(stderr, "sparDoubleShift error: Out of memory\n");
 		   exit(1);
 		}
 
-		// Copy existing blocks
+		int i, j, k;
 		for( k = 0 ; k < mz ; k++ )
 		{
 			for( j = 0 ; j < my ; j++ )
 			{
-				for( i = 0 ; i < matrix->mx ; i++ )
+				for( i = 0 ; i < mx ; i++ )
 				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
+					// Source block
+					int i2, j2, k2, n;
+					i2 = i - qx;
+					j2 = j - qy;
+					k2 = k - qz;
+					n = i + mx * ( j + my * k );
+
+					if( i2 >= 0 && j2 >= 0 && k2 >= 0 && i2 < mx && j2 < my && k2 < mz )
+					{
+						int m;
+						m = i2 + mx * ( j2 + my * k2 );
+						blockValue[n] = matrix->blockValue[m];
+						blockData[n] = matrix->blockData[m];
+						matrix->blockData[m] = NULL;
+					}
+					else
+					{
+						blockValue[n] = matrix->def;
+					}
 				}
 			}
 		}
-		// Create new blocks
-		for( k = 0 ; k < mz ; k++ )
+
+		// Free blocks moved outside
+		for( i = 0 ; i < blocks ; i++ )
 		{
-			for( j = 0 ; j < my ; j++ )
+			if( matrix->blockData[i] != NULL )
 			{
-				for( i = matrix->mx ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j +  my * k ) ] = def;
-					blockData[ i + mx * ( j +  my * k ) ] = NULL;
-				}
+				free(matrix->blockData[i]);
 			}
 		}
 
-		int xi, xf;
-		xi = matrix->nx;
-		xf = matrix->bs * matrix->mx;
-		if( xf >= nx )
-		{
-			xf = nx - 1;
-		}
-
-		matrix->nx = nx;
-		matrix->mx = mx;
-
 		free(matrix->blockData);
 		free(matrix->blockValue);
 
 		matrix->blockData = blockData;
 		matrix->blockValue = blockValue;
 
-		// Set expanded elements to default
-		for( k = 0 ; k < matrix->nz ; k++ )
+		// Previous boundary blocks moved inside, set outside elements to default
+		int ex, ey, ez;
+		ex = matrix->nx - ( mx - 1 ) * bs;
+		ey = matrix->ny - ( my - 1 ) * bs;
+		ez = matrix->nz - ( mz - 1 ) * bs;
+
+		if( ex < bs && qx < 0 && mx - 1 + qx >= 0 )
 		{
-			for( j = 0 ; j < matrix->ny ; j++ )
-			{
-				for( i = xi ; i < xf ; i++ )
-				{
-					sparDoubleSet( matrix, i, j, k, def );
-				}
-			}
+			sparDoubleFillBox( matrix, ( mx - 1 + qx ) * bs + ex, 0, 0, bs - ex, matrix->ny, matrix->nz, matrix->def );
 		}
-	}
-	// Shrink x
-	else if( nx < matrix->nx )
-	{
-		// New block grid size
-		mx = (int)( ( nx + bs - 1 ) / bs );
-		my = matrix->my;
-		mz = matrix->mz;
-
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (double*) calloc( blocks, sizeof(double) ); // Sets to 0s
-		blockData = (double**) calloc( blocks, sizeof(double*) ); // Sets to NULLs
-
-		if( blockValue == NULL || blockData == NULL )
+		if( ey < bs && qy < 0 && my - 1 + qy >= 0 )
 		{
-		   fprintf(stderr, "sparDoubleResize error: Out of memory\n");
-		   exit(1);
+			sparDoubleFillBox( matrix, 0, ( my - 1 + qy ) * bs + ey, 0, matrix->nx, bs - ey, matrix->nz, matrix->def );
 		}
-
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+		if( ez < bs && qz < 0 && mz - 1 + qz >= 0 )
 		{
-			for( j = 0 ; j < my ; j++ )
-			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
-				}
-			}
+			sparDoubleFillBox( matrix, 0, 0, ( mz - 1 + qz ) * bs + ez, matrix->nx, matrix->ny, bs - ez, matrix->def );
 		}
 
-		// Free excedent blocks
+		// Blocks moved to the boundary may be uniform inside the matrix
 		for( k = 0 ; k < mz ; k++ )
 		{
 			for( j = 0 ; j < my ; j++ )
 			{
-				for( i = mx ; i < matrix->mx ; i++ )
+				for( i = 0 ; i < mx ; i++ )
 				{
-					if( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
+					if( ( i == mx - 1 && ex < bs && qx != 0 ) || ( j == my - 1 && ey < bs && qy != 0 ) ||
+						( k == mz - 1 && ez < bs && qz != 0 ) )
 					{
-						free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
+						sparDoubleReduceBlock( matrix, i, j, k );
 					}
 				}
 			}
 		}
+	}
 
-		matrix->nx = nx;
-		matrix->mx = mx;
+	// Recombine blocks for the remainder
+	if( rx != 0 || ry != 0 || rz != 0 )
+	{
+		sparDouble *shifted;
+		shifted = sparDoubleCrop( matrix, -rx, -ry, -rz, matrix->nx, matrix->ny, matrix->nz );
+
+		// Swap block data
+		double *blockValue;
+		double **blockData;
+		blockValue = matrix->blockValue;
+		blockData = matrix->blockData;
+		matrix->blockValue = shifted->blockValue;
+		matrix->blockData = shifted->blockData;
+		shifted->blockValue = blockValue;
+		shifted->blockData = blockData;
+
+		sparDoubleFree( shifted );
+	}
+}
 
-		free(matrix->blockData);
-		free(matrix->blockValue);
+// Ring buffer index of world coordinate w in a ring of size n
+int sparDoubleRingIndex( int w, int n )
+{
+	return ( w % n + n ) % n;
+}
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
+// Set element at world coordinates (x,y,z) of the ring buffer window, ignored outside the window
+void sparDoubleRingSet( sparDouble *matrix, int x, int y, int z, double value )
+{
+	if( x < matrix->ox || y < matrix->oy || z < matrix->oz ||
+		x >= matrix->ox + matrix->nx || y >= matrix->oy + matrix->ny || z >= matrix->oz + matrix->nz )
+	{
+		return;
+	}
+
+	sparDoubleSet( matrix, sparDoubleRingIndex( x, matrix->nx ), sparDoubleRingIndex( y, matrix->ny ), sparDoubleRingIndex( z, matrix->nz ), value );
+}
+
+// Get element at world coordinates (x,y,z) of the ring buffer window, default value outside the window
+double sparDoubleRingGet( sparDouble *matrix, int x, int y, int z )
+{
+	if( x < matrix->ox || y < matrix->oy || z < matrix->oz ||
+		x >= matrix->ox + matrix->nx || y >= matrix->oy + matrix->ny || z >= matrix->oz + matrix->nz )
+	{
+		return matrix->def;
+	}
+
+	return sparDoubleGet( matrix, sparDoubleRingIndex( x, matrix->nx ), sparDoubleRingIndex( y, matrix->ny ), sparDoubleRingIndex( z, matrix->nz ) );
+}
+
+// Move the ring buffer window origin to world coordinates (x,y,z), elements entering the window set to default
+void sparDoubleRingMove( sparDouble *matrix, int x, int y, int z )
+{
+	// Matrix size, previous and new origin
+	int size[3], o[3], p[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+	o[0] = matrix->ox;
+	o[1] = matrix->oy;
+	o[2] = matrix->oz;
+	p[0] = x;
+	p[1] = y;
+	p[2] = z;
+
+	// Window moved by at least its size on one axis, reset all
+	int a;
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		if( abs( p[a] - o[a] ) >= size[a] )
+		{
+			sparDoubleFillBox( matrix, 0, 0, 0, matrix->nx, matrix->ny, matrix->nz, matrix->def );
+			matrix->ox = x;
+			matrix->oy = y;
+			matrix->oz = z;
+			return;
+		}
+	}
+
+	// For each axis, reset the slab of elements entering the window, in up to two boxes of ring indices
+	for( a = 0 ; a < 3 ; a++ )
+	{
+		if( p[a] == o[a] )
+		{
+			continue;
+		}
+
+		// First entering world coordinate and slab thickness
+		int w, t;
+		w = p[a] > o[a] ? o[a] + size[a] : p[a];
+		t = abs( p[a] - o[a] );
+
+		// Ring index ranges [s0,s0+t0) and [0,t-t0)
+		int s0, t0;
+		s0 = sparDoubleRingIndex( w, size[a] );
+		t0 = s0 + t > size[a] ? size[a] - s0 : t;
+
+		int b[3], c[3];
+		b[0] = 0;
+		b[1] = 0;
+		b[2] = 0;
+		c[0] = matrix->nx;
+		c[1] = matrix->ny;
+		c[2] = matrix->nz;
+
+		b[a] = s0;
+		c[a] = t0;
+		sparDoubleFillBox( matrix, b[0], b[1], b[2], c[0], c[1], c[2], matrix->def );
+
+		if( t0 < t )
+		{
+			b[a] = 0;
+			c[a] = t - t0;
+			sparDoubleFillBox( matrix, b[0], b[1], b[2], c[0], c[1], c[2], matrix->def );
+		}
+	}
+
+	matrix->ox = x;
+	matrix->oy = y;
+	matrix->oz = z;
+}
+
+// New matrix with permuted axes, new x, y and z axes are the axes ax, ay and az (0 x, 1 y, 2 z) of matrix
+sparDouble* sparDoublePermute( sparDouble *matrix, int ax, int ay, int az )
+{
+	// Check permutation
+	if( ax < 0 || ay < 0 || az < 0 || ax > 2 || ay > 2 || az > 2 || ax == ay || ay == az || az == ax )
+	{
+		fprintf(stderr, "sparDoublePermute error: Axes must be a permutation of 0, 1 and 2\n");
+		exit(1);
 	}
 
-	// Expand y
-	if( ny > matrix->ny )
+	// Matrix and block matrix size
+	int size[3], blockSize[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+	blockSize[0] = matrix->mx;
+	blockSize[1] = matrix->my;
+	blockSize[2] = matrix->mz;
+
+	// Declare matrix and init
+	sparDouble *matrix2;
+	matrix2 = sparDoubleInit( size[ax], size[ay], size[az], matrix->bs, matrix->def );
+
+	// Permute ring buffer origin
+	int origin[3];
+	origin[0] = matrix->ox;
+	origin[1] = matrix->oy;
+	origin[2] = matrix->oz;
+	matrix2->ox = origin[ax];
+	matrix2->oy = origin[ay];
+	matrix2->oz = origin[az];
+
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Source strides of the new axes, blocks and elements
+	int stride[3], blockStride[3];
+	stride[0] = 1;
+	stride[1] = bs;
+	stride[2] = bs * bs;
+	blockStride[0] = 1;
+	blockStride[1] = blockSize[0];
+	blockStride[2] = blockSize[0] * blockSize[1];
+
+	int sx, sy, sz, bx, by, bz;
+	sx = stride[ax];
+	sy = stride[ay];
+	sz = stride[az];
+	bx = blockStride[ax];
+	by = blockStride[ay];
+	bz = blockStride[az];
+
+	// Number of blocks
+	int blocks;
+	blocks = matrix2->mx * matrix2->my * matrix2->mz;
+
+	// For each block
+	int n;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(guided)
+	#endif
+	for( n = 0 ; n < blocks ; n++ )
 	{
-		// New block grid size
-		mx = matrix->mx;
-		my = (int)( ( ny + bs - 1 ) / bs );
-		mz = matrix->mz;
-
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (double*) calloc( blocks, sizeof(double) ); // Sets to 0s
-		blockData = (double**) calloc( blocks, sizeof(double*) ); // Sets to NULLs
+		// Block (i1,j1,k1) and source block
+		int i1, j1, k1, m;
+		i1 = n % matrix2->mx;
+		j1 = ( n / matrix2->mx ) % matrix2->my;
+		k1 = n / ( matrix2->mx * matrix2->my );
+		m = i1 * bx + j1 * by + k1 * bz;
 
-		if( blockValue == NULL || blockData == NULL )
+		// Uniform block
+		if( matrix->blockData[m] == NULL )
 		{
-		   fprintf(stderr, "sparDoubleResize error: Out of memory\n");
-		   exit(1);
+			matrix2->blockValue[n] = matrix->blockValue[m];
+			continue;
 		}
 
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+		// Heterogeneous block, transpose in cache
+		double *blockData, *source;
+		blockData = (double*) malloc( matrix2->bs3 * sizeof(double) );
+		source = matrix->blockData[m];
+
+		if( blockData == NULL )
 		{
-			for( j = 0 ; j < matrix->my ; j++ )
-			{
-				for( i = 0 ; i < mx ; i++ )
-				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
-				}
-			}
+		   fprintf(stderr, "sparDoublePermute error: Out of memory\n");
+		   exit(1);
 		}
-		// Create new blocks
-		for( k = 0 ; k < mz ; k++ )
+
+		int i, j, k;
+		for( k = 0 ; k < bs ; k++ )
 		{
-			for( j = matrix->my ; j < my ; j++ )
+			for( j = 0 ; j < bs ; j++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				double *row, *column;
+				row = blockData + bs * ( j + bs * k );
+				column = source + j * sy + k * sz;
+				for( i = 0 ; i < bs ; i++ )
 				{
-					blockValue[ i + mx * ( j +  my * k ) ] = def;
-					blockData[ i + mx * ( j +  my * k ) ] = NULL;
+					row[i] = column[ i * sx ];
 				}
 			}
 		}
 
-		int yi, yf;
-		yi = matrix->ny;
-		yf = matrix->bs * matrix->my;
-		if( yf >= ny )
-		{
-			yf = ny - 1;
-		}
+		matrix2->blockData[n] = blockData;
+	}
+
+	return matrix2;
+}
 
-		matrix->ny = ny;
-		matrix->my = my;
+// Allocate n elements 64-byte aligned with plain malloc (no C11 aligned_alloc), release with the matching DenseFree
+double* sparDoubleDenseAlloc( long n )
+{
+	// Room for the alignment offset and the original pointer
+	char *base;
+	base = (char*) malloc( n * sizeof(double) + 64 + sizeof(void*) );
 
-		free(matrix->blockData);
-		free(matrix->blockValue);
+	if( base == NULL )
+	{
+		return NULL;
+	}
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
+	// First 64-byte boundary after the stored original pointer
+	char *aligned;
+	aligned = base + sizeof(void*);
+	aligned = aligned + ( 64 - (uintptr_t)( aligned ) % 64 ) % 64;
+	((void**) aligned)[-1] = base;
+
+	return (double*) aligned;
+}
+
+// Free dense buffer returned by Densify or DenseAlloc
+void sparDoubleDenseFree( double *buffer )
+{
+	if( buffer != NULL )
+	{
+		free( ((void**) buffer)[-1] );
+	}
+}
+
+// Dense copy padded to (px,py,pz) with the default value, rows along axis contiguous and 64-byte aligned every pitch elements (free with sparDoubleDenseFree)
+double* sparDoubleDensify( sparDouble *matrix, int axis, int px, int py, int pz, int *pitch )
+{
+	// Check padded size
+	if( px < matrix->nx || py < matrix->ny || pz < matrix->nz || axis < 0 || axis > 2 )
+	{
+		fprintf(stderr, "sparDoubleDensify error: Padded size must contain the matrix\n");
+		exit(1);
+	}
+
+	// Padded size and the other two axes (b,c)
+	int p[3], b, c;
+	p[0] = px;
+	p[1] = py;
+	p[2] = pz;
+	b = axis == 0 ? 1 : 0;
+	c = axis == 2 ? 1 : 2;
+
+	// Row pitch, multiple of 64 bytes
+	int align;
+	align = 64 % sizeof(double) == 0 ? 64 / sizeof(double) : 1;
+	*pitch = ( p[axis] + align - 1 ) / align * align;
+
+	// Element (x,y,z) at x*s[0]+y*s[1]+z*s[2]
+	long s[3];
+	s[axis] = 1;
+	s[b] = *pitch;
+	s[c] = (long) *pitch * p[b];
+
+	double *buffer;
+	buffer = sparDoubleDenseAlloc( s[c] * p[c] );
+
+	if( buffer == NULL )
+	{
+	   fprintf(stderr, "sparDoubleDensify error: Out of memory\n");
+	   exit(1);
+	}
 
-		// Set expanded elements to default
-		for( k = 0 ; k < matrix->nz ; k++ )
+	// Matrix size
+	int size[3];
+	size[0] = matrix->nx;
+	size[1] = matrix->ny;
+	size[2] = matrix->nz;
+
+	// Padding, row by row
+	int r;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( r = 0 ; r < p[b] * p[c] ; r++ )
+	{
+		// Row (j,k) along axes (b,c)
+		int i, j, k;
+		j = r % p[b];
+		k = r / p[b];
+
+		double *row;
+		row = buffer + j * s[b] + k * s[c];
+		for( i = ( j < size[b] && k < size[c] ) ? size[axis] : 0 ; i < *pitch ; i++ )
 		{
-			for( j = yi ; j < yf ; j++ )
-			{
-				for( i = 0 ; i < matrix->nx ; i++ )
-				{
-					sparDoubleSet( matrix, i, j, k, def );
-				}
-			}
+			row[i] = matrix->def;
 		}
 	}
-	// Shrink y
-	else if( ny < matrix->ny )
-	{
-		// New block grid size
-		mx = matrix->mx;
-		my = (int)( ( ny + bs - 1 ) / bs );
-		mz = matrix->mz;
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (double*) calloc( blocks, sizeof(double) ); // Sets to 0s
-		blockData = (double**) calloc( blocks, sizeof(double*) ); // Sets to NULLs
+	sparDoubleGetDense( matrix, buffer, s[0], s[1], s[2] );
 
-		if( blockValue == NULL || blockData == NULL )
+	return buffer;
+}
+
+// Copy dense buffer with element (x,y,z) at x*sx+y*sy+z*sz into matrix, uniform blocks detected
+void sparDoubleSetDense( sparDouble *matrix, double *buffer, long sx, long sy, long sz )
+{
+	// Block size
+	int bs, bs3;
+	bs = matrix->bs;
+	bs3 = matrix->bs3;
+
+	// Element strides
+	long s[3];
+	s[0] = sx;
+	s[1] = sy;
+	s[2] = sz;
+
+	// Number of blocks
+	int blocks;
+	blocks = matrix->mx * matrix->my * matrix->mz;
+
+	#ifdef _OPENMP
+	#pragma omp parallel
+	#endif
+	{
+		// Block elements
+		double *temp;
+		temp = (double*) malloc( bs3 * sizeof(double) );
+
+		if( temp == NULL )
 		{
-		   fprintf(stderr, "sparDoubleResize error: Out of memory\n");
+		   fprintf(stderr, "sparDoubleSetDense error: Out of memory\n");
 		   exit(1);
 		}
 
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+		// For each block
+		int n;
+		#ifdef _OPENMP
+		#pragma omp for schedule(guided)
+		#endif
+		for( n = 0 ; n < blocks ; n++ )
 		{
-			for( j = 0 ; j < my ; j++ )
+			// Block (i1,j1,k1)
+			int i1, j1, k1;
+			i1 = n % matrix->mx;
+			j1 = ( n / matrix->mx ) % matrix->my;
+			k1 = n / ( matrix->mx * matrix->my );
+
+			// Block extent inside the matrix
+			int ex, ey, ez;
+			ex = matrix->nx - i1 * bs < bs ? matrix->nx - i1 * bs : bs;
+			ey = matrix->ny - j1 * bs < bs ? matrix->ny - j1 * bs : bs;
+			ez = matrix->nz - k1 * bs < bs ? matrix->nz - k1 * bs : bs;
+
+			// Gather block and check uniformity in a single scan
+			double value;
+			int isUniform;
+			value = buffer[ i1 * bs * s[0] + j1 * bs * s[1] + k1 * bs * s[2] ];
+			isUniform = 1;
+
+			int i, j, k;
+			for( k = 0 ; k < bs ; k++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				for( j = 0 ; j < bs ; j++ )
 				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
+					double *row, *blockRow;
+					row = buffer + i1 * bs * s[0] + ( j1 * bs + j ) * s[1] + ( k1 * bs + k ) * s[2];
+					blockRow = temp + bs * ( j + bs * k );
+
+					// Outside elements set to default
+					if( j >= ey || k >= ez )
+					{
+						for( i = 0 ; i < bs ; i++ )
+						{
+							blockRow[i] = matrix->def;
+						}
+						continue;
+					}
+
+					for( i = 0 ; i < ex ; i++ )
+					{
+						blockRow[i] = row[ i * s[0] ];
+						isUniform &= sparDoubleEqual( blockRow[i], value );
+					}
+					for( i = ex ; i < bs ; i++ )
+					{
+						blockRow[i] = matrix->def;
+					}
 				}
 			}
-		}
 
-		// Free excedent blocks
-		for( k = 0 ; k < mz ; k++ )
-		{
-			for( j = my ; j < matrix->my ; j++ )
+			// Uniform block
+			if( isUniform )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				if( matrix->blockData[n] != NULL )
 				{
-					if( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
-					{
-						free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
-					}
+					free(matrix->blockData[n]);
+					matrix->blockData[n] = NULL;
 				}
+				matrix->blockValue[n] = value;
 			}
-		}
+			// Heterogeneous block, reuse previous data if any
+			else if( matrix->blockData[n] != NULL )
+			{
+				memcpy( matrix->blockData[n], temp, bs3 * sizeof(double) );
+			}
+			// Heterogeneous block, keep gathered elements
+			else
+			{
+				matrix->blockData[n] = temp;
+				temp = (double*) malloc( bs3 * sizeof(double) );
 
-		matrix->ny = ny;
-		matrix->my = my;
+				if( temp == NULL )
+				{
+				   fprintf(stderr, "sparDoubleSetDense error: Out of memory\n");
+				   exit(1);
+				}
+			}
+		}
 
-		free(matrix->blockData);
-		free(matrix->blockValue);
+		free(temp);
+	}
+}
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
+// Copy dense buffer with the densify layout (axis, pitch and padded size) into matrix, uniform blocks detected
+void sparDoubleSparsify( sparDouble *matrix, double *buffer, int axis, int pitch, int px, int py, int pz )
+{
+	// Check padded size and pitch
+	if( px < matrix->nx || py < matrix->ny || pz < matrix->nz || axis < 0 || axis > 2 )
+	{
+		fprintf(stderr, "sparDoubleSparsify error: Padded size must contain the matrix\n");
+		exit(1);
 	}
 
-	// Expand z
-	if( nz > matrix->nz )
+	if( pitch < ( axis == 0 ? px : ( axis == 1 ? py : pz ) ) )
 	{
-		// New block grid size
-		mx = matrix->mx;
-		my = matrix->my;
-		mz = (int)( ( nz + bs - 1 ) / bs );
+		fprintf(stderr, "sparDoubleSparsify error: Pitch must be at least the padded row length\n");
+		exit(1);
+	}
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (double*) calloc( blocks, sizeof(double) ); // Sets to 0s
-		blockData = (double**) calloc( blocks, sizeof(double*) ); // Sets to NULLs
+	// Padded size and the other two axes (b,c)
+	int p[3], b, c;
+	p[0] = px;
+	p[1] = py;
+	p[2] = pz;
+	b = axis == 0 ? 1 : 0;
+	c = axis == 2 ? 1 : 2;
+
+	// Element (x,y,z) at x*s[0]+y*s[1]+z*s[2]
+	long s[3];
+	s[axis] = 1;
+	s[b] = pitch;
+	s[c] = (long) pitch * p[b];
+
+	sparDoubleSetDense( matrix, buffer, s[0], s[1], s[2] );
+}
 
-		if( blockValue == NULL || blockData == NULL )
-		{
-		   fprintf(stderr, "sparDoubleResize error: Out of memory\n");
-		   exit(1);
-		}
+// New matrix from dense buffer with element (x,y,z) at x*sx+y*sy+z*sz, only heterogeneous blocks allocated
+sparDouble* sparDoubleInitDense( double *buffer, int nx, int ny, int nz, long sx, long sy, long sz, int bs, double def )
+{
+	// Declare matrix and init
+	sparDouble *matrix;
+	matrix = sparDoubleInit( nx, ny, nz, bs, def );
+
+	sparDoubleSetDense( matrix, buffer, sx, sy, sz );
+
+	return matrix;
+}
+
+// Copy matrix into dense buffer with element (x,y,z) at x*sx+y*sy+z*sz
+void sparDoubleGetDense( sparDouble *matrix, double *buffer, long sx, long sy, long sz )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
 
-		// Copy existing blocks
-		for( k = 0 ; k < matrix->mz ; k++ )
+	// For each row along x, in contiguous slabs per thread
+	int r;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( r = 0 ; r < matrix->ny * matrix->nz ; r++ )
+	{
+		// Row (y,z), its blocks and offset in the block
+		int y, z, j1, k1, offset;
+		y = r % matrix->ny;
+		z = r / matrix->ny;
+		j1 = y / bs;
+		k1 = z / bs;
+		offset = bs * ( y % bs + bs * ( z % bs ) );
+
+		double *row;
+		row = buffer + y * sy + z * sz;
+
+		// For each block along the row
+		int i1;
+		for( i1 = 0 ; i1 < matrix->mx ; i1++ )
 		{
-			for( j = 0 ; j < my ; j++ )
+			// Linear block index (n) <-> (i1,j1,k1)
+			int n;
+			n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+			// Block extent inside the matrix
+			int ex;
+			ex = matrix->nx - i1 * bs < bs ? matrix->nx - i1 * bs : bs;
+
+			double *blockData, *out, value;
+			blockData = matrix->blockData[n];
+			value = matrix->blockValue[n];
+			out = row + i1 * bs * sx;
+
+			int i;
+
+			// Uniform block, contiguous row
+			if( blockData == NULL && sx == 1 )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				for( i = 0 ; i < ex ; i++ )
 				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
+					out[i] = value;
 				}
 			}
-		}
-		// Create new blocks
-		for( k = matrix->mz ; k < mz ; k++ )
-		{
-			for( j = 0 ; j < my ; j++ )
+			// Uniform block, strided row
+			else if( blockData == NULL )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				for( i = 0 ; i < ex ; i++ )
 				{
-					blockValue[ i + mx * ( j +  my * k ) ] = def;
-					blockData[ i + mx * ( j +  my * k ) ] = NULL;
+					out[ i * sx ] = value;
 				}
 			}
-		}
-
-		int zi, zf;
-		zi = matrix->nz;
-		zf = matrix->bs * matrix->mz;
-		if( zf >= nz )
-		{
-			zf = nz - 1;
-		}
-
-		matrix->nz = nz;
-		matrix->mz = mz;
-
-		free(matrix->blockData);
-		free(matrix->blockValue);
-
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
-
-		// Set expanded elements to default
-		for( k = zi ; k < zf ; k++ )
-		{
-			for( j = 0 ; j < matrix->ny ; j++ )
+			// Heterogeneous block, contiguous row
+			else if( sx == 1 )
+			{
+				memcpy( out, blockData + offset, ex * sizeof(double) );
+			}
+			// Heterogeneous block, strided row
+			else
 			{
-				for( i = 0 ; i < matrix->nx ; i++ )
+				for( i = 0 ; i < ex ; i++ )
 				{
-					sparDoubleSet( matrix, i, j, k, def );
+					out[ i * sx ] = blockData[ offset + i ];
 				}
 			}
 		}
 	}
-	// Shrink z
-	else if( nz < matrix->nz )
+}
+
+// Change the default value, uniform blocks with the previous default value set to the new one
+void sparDoubleSetDefault( sparDouble *matrix, double def )
+{
+	// Number of blocks
+	int blocks;
+	blocks = matrix->mx * matrix->my * matrix->mz;
+
+	int i;
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+	#endif
+	for( i = 0 ; i < blocks ; i++ )
 	{
-		// New block grid size
-		mx = matrix->mx;
-		my = matrix->my;
-		mz = (int)( ( nz + bs - 1 ) / bs );
+		if( matrix->blockData[i] == NULL && sparDoubleEqual( matrix->blockValue[i], matrix->def ) )
+		{
+			matrix->blockValue[i] = def;
+		}
+	}
 
-		// Number of blocks
-		blocks = mx * my * mz;
-		blockValue = (double*) calloc( blocks, sizeof(double) ); // Sets to 0s
-		blockData = (double**) calloc( blocks, sizeof(double*) ); // Sets to NULLs
+	matrix->def = def;
+}
 
-		if( blockValue == NULL || blockData == NULL )
+// Most frequent value in box (x,y,z)-(x+sx-1,y+sy-1,z+sz-1) clipped to the matrix, smallest on ties, its count in count if not NULL
+double sparDoubleDominant( sparDouble *matrix, int x, int y, int z, int sx, int sy, int sz, double *count )
+{
+	// Block size
+	int bs;
+	bs = matrix->bs;
+
+	// Clip box to the matrix
+	int x0, y0, z0, x1, y1, z1;
+	x0 = x < 0 ? 0 : x;
+	y0 = y < 0 ? 0 : y;
+	z0 = z < 0 ? 0 : z;
+	x1 = x + sx > matrix->nx ? matrix->nx : x + sx;
+	y1 = y + sy > matrix->ny ? matrix->ny : y + sy;
+	z1 = z + sz > matrix->nz ? matrix->nz : z + sz;
+
+	// Empty box
+	if( x0 >= x1 || y0 >= y1 || z0 >= z1 )
+	{
+		if( count != NULL )
 		{
-		   fprintf(stderr, "sparDoubleResize error: Out of memory\n");
-		   exit(1);
+			*count = 0.0;
 		}
+		return matrix->def;
+	}
 
-		// Copy existing blocks
-		for( k = 0 ; k < mz ; k++ )
+	// Runs of equal values, one per uniform block and per distinct value of heterogeneous blocks
+	int runs, size;
+	double *runValue, *temp;
+	double *runCount;
+	runs = 0;
+	size = 64;
+	runValue = (double*) malloc( size * sizeof(double) );
+	runCount = (double*) malloc( size * sizeof(double) );
+	temp = (double*) malloc( matrix->bs3 * sizeof(double) );
+
+	if( runValue == NULL || runCount == NULL || temp == NULL )
+	{
+	   fprintf(stderr, "sparDoubleDominant error: Out of memory\n");
+	   exit(1);
+	}
+
+	// For each block overlapping the box
+	int i1, j1, k1;
+	for( k1 = z0 / bs ; k1 <= ( z1 - 1 ) / bs ; k1++ )
+	{
+		for( j1 = y0 / bs ; j1 <= ( y1 - 1 ) / bs ; j1++ )
 		{
-			for( j = 0 ; j < my ; j++ )
+			for( i1 = x0 / bs ; i1 <= ( x1 - 1 ) / bs ; i1++ )
 			{
-				for( i = 0 ; i < mx ; i++ )
+				// Linear block index (n) <-> (i1,j1,k1)
+				int n;
+				n = i1 + matrix->mx * ( j1 + matrix->my * k1 );
+
+				// Block and box intersection
+				int bx0, by0, bz0, bx1, by1, bz1, m;
+				bx0 = i1 * bs > x0 ? i1 * bs : x0;
+				by0 = j1 * bs > y0 ? j1 * bs : y0;
+				bz0 = k1 * bs > z0 ? k1 * bs : z0;
+				bx1 = ( i1 + 1 ) * bs < x1 ? ( i1 + 1 ) * bs : x1;
+				by1 = ( j1 + 1 ) * bs < y1 ? ( j1 + 1 ) * bs : y1;
+				bz1 = ( k1 + 1 ) * bs < z1 ? ( k1 + 1 ) * bs : z1;
+				m = ( bx1 - bx0 ) * ( by1 - by0 ) * ( bz1 - bz0 );
+
+				// Grow runs
+				if( runs + m > size )
 				{
-					blockValue[ i + mx * ( j + my * k ) ]
-						= matrix->blockValue[ i + matrix->mx * ( j + matrix->my * k ) ];
-					blockData[ i + mx * ( j + my * k ) ]
-						= matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ];
+					size = 2 * ( runs + m );
+					runValue = (double*) realloc( runValue, size * sizeof(double) );
+					runCount = (double*) realloc( runCount, size * sizeof(double) );
+
+					if( runValue == NULL || runCount == NULL )
+					{
+					   fprintf(stderr, "sparDoubleDominant error: Out of memory\n");
+					   exit(1);
+					}
 				}
-			}
-		}
 
-		// Free excedent blocks
-		for( k = mz ; k < matrix->mz ; k++ )
-		{
-			for( j = 0 ; j < my ; j++ )
-			{
-				for( i = 0 ; i < mx ; i++ )
+				// Uniform block, one run
+				if( matrix->blockData[n] == NULL )
 				{
-					if( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] != NULL )
+					runValue[runs] = matrix->blockValue[n];
+					runCount[runs] = m;
+					runs++;
+					continue;
+				}
+
+				// Heterogeneous block, sorted intersection elements
+				sparDoubleGetBox( matrix, bx0, by0, bz0, bx1 - bx0, by1 - by0, bz1 - bz0, temp );
+				qsort( temp, m, sizeof(double), sparDoubleCompare );
+
+				int i;
+				for( i = 0 ; i < m ; i++ )
+				{
+					if( i > 0 && sparDoubleEqual( temp[i], temp[ i - 1 ] ) )
 					{
-						free( matrix->blockData[ i + matrix->mx * ( j + matrix->my * k ) ] );
+						runCount[ runs - 1 ] += 1.0;
+					}
+					else
+					{
+						runValue[runs] = temp[i];
+						runCount[runs] = 1.0;
+						runs++;
 					}
 				}
 			}
 		}
+	}
 
-		matrix->nz = nz;
-		matrix->mz = mz;
+	// Distinct values, sorted
+	int distinct, i;
+	double *values;
+	double *counts;
+	values = (double*) malloc( runs * sizeof(double) );
+	counts = (double*) calloc( runs, sizeof(double) );
 
-		free(matrix->blockData);
-		free(matrix->blockValue);
+	if( values == NULL || counts == NULL )
+	{
+	   fprintf(stderr, "sparDoubleDominant error: Out of memory\n");
+	   exit(1);
+	}
 
-		matrix->blockData = blockData;
-		matrix->blockValue = blockValue;
+	memcpy( values, runValue, runs * sizeof(double) );
+	qsort( values, runs, sizeof(double), sparDoubleCompare );
+	distinct = 1;
+	for( i = 1 ; i < runs ; i++ )
+	{
+		if( sparDoubleEqual( values[i], values[ distinct - 1 ] ) == 0 )
+		{
+			values[ distinct++ ] = values[i];
+		}
+	}
+
+	// Count per distinct value
+	for( i = 0 ; i < runs ; i++ )
+	{
+		double *v;
+		v = (double*) bsearch( runValue + i, values, distinct, sizeof(double), sparDoubleCompare );
+		counts[ v - values ] += runCount[i];
+	}
+
+	// Most frequent, first in sorted order on ties
+	int best;
+	best = 0;
+	for( i = 1 ; i < distinct ; i++ )
+	{
+		if( counts[i] > counts[best] )
+		{
+			best = i;
+		}
+	}
+
+	double value;
+	value = values[best];
+
+	if( count != NULL )
+	{
+		*count = counts[best];
 	}
+
+	free(runValue);
+	free(runCount);
+	free(temp);
+	free(values);
+	free(counts);
+
+	return value;
 }